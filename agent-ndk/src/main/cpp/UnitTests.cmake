@@ -26,6 +26,34 @@ set(TEST_SRC_DIR ${CMAKE_HOME_DIRECTORY}/../../test/cpp)
 set(TEST_SOURCES
         ${TEST_SRC_DIR}/AgentNDKTests.cpp
         ${TEST_SRC_DIR}/TestFixtures.cpp
+        ${TEST_SRC_DIR}/EmitterTests.cpp
+        ${TEST_SRC_DIR}/LzCodecTests.cpp
+        ${TEST_SRC_DIR}/ArenaTests.cpp
+        ${TEST_SRC_DIR}/legacy/emitter-legacy.cpp
+        ${TEST_SRC_DIR}/SerializerTests.cpp
+        ${TEST_SRC_DIR}/legacy/serializer-legacy.cpp
+        ${TEST_SRC_DIR}/ReportSlotsTests.cpp
+        ${TEST_SRC_DIR}/ReportStoreTests.cpp
+        ${TEST_SRC_DIR}/ReportHandoffTests.cpp
+        ${TEST_SRC_DIR}/EventRingTests.cpp
+        ${TEST_SRC_DIR}/ContextSnapshotTests.cpp
+        ${TEST_SRC_DIR}/RecordTests.cpp
+        ${TEST_SRC_DIR}/ThreadStacksTests.cpp
+        ${TEST_SRC_DIR}/UnwinderTests.cpp
+        ${TEST_SRC_DIR}/CfiUnwinderTests.cpp
+        ${TEST_SRC_DIR}/CrashHelperTests.cpp
+        ${TEST_SRC_DIR}/AnrHandlerTests.cpp
+        ${TEST_SRC_DIR}/WatchdogTests.cpp
+        ${TEST_SRC_DIR}/StackTrieTests.cpp
+        ${TEST_SRC_DIR}/ProfilerTests.cpp
+        ${TEST_SRC_DIR}/ProcfsTests.cpp
+        ${TEST_SRC_DIR}/legacy/thread-info-legacy.cpp
+        ${TEST_SRC_DIR}/legacy/anr-detect-legacy.cpp
+        ${TEST_SRC_DIR}/ModuleIndexTests.cpp
+        ${TEST_SRC_DIR}/DemanglerTests.cpp
+        ${TEST_SRC_DIR}/SymbolizerTests.cpp
+        ${TEST_SRC_DIR}/SymbolCacheTests.cpp
+        ${TEST_SRC_DIR}/FingerprintTests.cpp
         )
 
 add_executable(
@@ -33,9 +61,12 @@ add_executable(
         ${TEST_SOURCES}
 )
 
+# Tests exercise internal (hidden) symbols, so link the static library
+target_include_directories(agent-ndk-test PRIVATE ${CMAKE_HOME_DIRECTORY} ${TEST_SRC_DIR})
+
 target_link_libraries(
         agent-ndk-test
-        agent-ndk
+        agent-ndk-a
         gtest_main
         gmock_main
 )
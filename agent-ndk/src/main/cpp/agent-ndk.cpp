@@ -17,6 +17,18 @@
 #include "jni/jni-delegate.h"
 #include "serializer.h"
 #include "procfs.h"
+#include "arena.h"
+#include "report-slots.h"
+#include "report-store.h"
+#include "report-handoff.h"
+#include "record.h"
+#include "thread-stacks.h"
+#include "module-index.h"
+#include "symbol-cache.h"
+#include "fingerprint.h"
+#include "unwinder.h"
+#include "watchdog.h"
+#include "profiler.h"
 
 
 const char *get_arch() {
@@ -42,6 +54,44 @@ bool arch_is_32b() {
 }
 
 volatile bool initialized = false;
+volatile bool log_disabled = false;
+
+/**
+ * Apply the managed context's report quota to every report type
+ */
+static void set_report_quotas(const jni::native_context_t &native_context) {
+    store::quota_t quota = {static_cast<size_t>(native_context.reportQuotaBytes),
+                            static_cast<size_t>(native_context.reportQuotaCount)};
+    for (int type = 0; type < store::REPORT_TYPE_CNT; type++) {
+        store::set_quota(static_cast<store::report_type_t>(type), quota);
+    }
+}
+
+typedef struct store_flush {
+    JNIEnv *env;
+    jobject agent;
+    jmethodID onStoredReport;
+
+} store_flush_t;
+
+/**
+ * Pass a stored report to AgentNDK.onStoredReport() as a direct ByteBuffer over the native
+ * copy, and acknowledge it if it was consumed
+ */
+static bool post_stored_report(const store::report_t &report, const char *data, size_t size, void *arg) {
+    store_flush_t *flush = static_cast<store_flush_t *>(arg);
+    jobject buffer = jni::env_new_direct_byte_buffer(flush->env, data, size);
+    if (buffer == nullptr) {
+        return false;
+    }
+
+    jboolean consumed = jni::env_call_bool_method(flush->env, flush->agent, flush->onStoredReport,
+                                                  static_cast<jint>(report.type),
+                                                  static_cast<jlong>(report.timestamp), buffer);
+    jni::env_delete_local_ref(flush->env, buffer);
+
+    return consumed;
+}
 
 extern "C"
 JNIEXPORT jboolean JNICALL
@@ -56,12 +106,39 @@ Java_com_newrelic_agent_android_ndk_AgentNDK_nativeStart(JNIEnv *env, jobject th
     _LOGD("    Process[%s] pid: %d ppid: %d tid: %d", procName, getpid(), getppid(), gettid());
 
     jni::native_context_t &native_context = jni::set_native_context(env, managedContext);
+    set_report_quotas(native_context);
 
     native_context.initialized = bind_delegate(env, native_context);
     if (!native_context.initialized) {
         _LOGW("Could not bind to JVM delegates. Reports will cached until the next app launch.");
     }
 
+    if (!slots::initialize()) {
+        _LOGW("Report slots unavailable. Reports will be written directly to storage.");
+    }
+
+    // the main thread's stack bounds validate frame pointer walks of it
+    unwinder_initialize();
+
+    // ANR reports ask the main thread for its stack the same way
+    if ((native_context.allThreadStacksEnabled || native_context.anrMonitorEnabled) && !stacks::initialize()) {
+        _LOGW("Thread stack capture unavailable. Only the reporting thread's stack will be captured.");
+    }
+
+    if (!symcache::initialize()) {
+        _LOGW("Symbol cache unavailable. Frames will be symbolized on every capture.");
+    }
+
+    // map the fingerprint table before the crash helper is forked, so they share it
+    if (native_context.coalesceWindow > 0 && !fingerprint::initialize()) {
+        _LOGW("Fingerprint table unavailable. Repeated reports will not be coalesced.");
+    }
+
+    // index the loaded modules before the crash helper is forked, so it inherits the index
+    if (!modules::initialize()) {
+        _LOGW("Module index unavailable. Frames will be resolved with dladdr().");
+    }
+
     if (!signal_handler_initialize()) {
         _LOGE("Error: Failed to initialize signal handlers!");
     } else {
@@ -82,6 +159,13 @@ Java_com_newrelic_agent_android_ndk_AgentNDK_nativeStart(JNIEnv *env, jobject th
         _LOGD("Exception handler installed");
     }
 
+    // samples are keyed by the module index, so the profiler starts after it
+    if (native_context.profilerMode != profiler::PROFILE_OFF &&
+        !profiler::start(static_cast<profiler::profile_mode_t>(native_context.profilerMode),
+                         native_context.profilerHz)) {
+        _LOGW("Profiler unavailable. Native threads will not be sampled.");
+    }
+
     initialized = true;
 
     return initialized;
@@ -93,11 +177,19 @@ Java_com_newrelic_agent_android_ndk_AgentNDK_nativeStop(JNIEnv *env, jobject thi
     (void) env;
     (void) thiz;
 
+    profiler::stop();
     signal_handler_shutdown();
     if (jni::get_native_context().anrMonitorEnabled) {
         anr_handler_shutdown();
     }
     terminate_handler_shutdown();
+    watchdog::shutdown();
+    stacks::shutdown();
+    modules::shutdown();
+    symcache::shutdown();
+    fingerprint::shutdown();
+    slots::shutdown();
+    store::shutdown();
 }
 
 extern "C"
@@ -106,17 +198,29 @@ Java_com_newrelic_agent_android_ndk_AgentNDK_dumpStack(JNIEnv *env, jobject thiz
     (void) env;
     (void) thiz;
 
-    char *buffer = new char[BACKTRACE_SZ_MAX];
-    siginfo_t _siginfo = {};
-    ucontext_t _sa_ucontext = {};
-    if (collect_backtrace(buffer, BACKTRACE_SZ_MAX, &_siginfo, &_sa_ucontext)) {
-        jstring result = env->NewStringUTF(buffer);
-        delete[] buffer;
-        return result;
+    jstring result = nullptr;
+    modules::refresh();
+
+    // the full symbol tables of the modules on this stack can't be read on the crash path: index them here
+    ucontext_t ucontext = {};
+    backtrace_state_t state = {};
+    state.sa_ucontext = &ucontext;
+    if (unwind_backtrace(state)) {
+        modules::load_symbols(state.frames, state.frame_cnt);
+    }
+
+    if (arena::acquire()) {
+        char *buffer = arena::alloc_array<char>(BACKTRACE_SZ_MAX);
+        siginfo_t _siginfo = {};
+        ucontext_t _sa_ucontext = {};
+        if (buffer != nullptr &&
+            collect_backtrace(buffer, BACKTRACE_SZ_MAX, &_siginfo, &_sa_ucontext)) {
+            result = env->NewStringUTF(buffer);
+        }
+        arena::release();
     }
-    delete[] buffer;
 
-    return nullptr;
+    return result;
 }
 
 extern "C"
@@ -133,7 +237,46 @@ JNIEXPORT void JNICALL
 Java_com_newrelic_agent_android_ndk_AgentNDK_nativeSetContext(JNIEnv *env, jobject thiz,
                                                               jobject managedContext) {
     (void) thiz;
-    jni::set_native_context(env, managedContext);
+    set_report_quotas(jni::set_native_context(env, managedContext));
+
+    // a healthy thread, where libraries loaded since startup can be indexed
+    modules::refresh();
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_newrelic_agent_android_ndk_AgentNDK_nativeDrainSlots(JNIEnv *env, jobject thiz) {
+    (void) env;
+    (void) thiz;
+
+    return slots::drain();
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_newrelic_agent_android_ndk_AgentNDK_nativeRenderRecords(JNIEnv *env, jobject thiz) {
+    (void) env;
+    (void) thiz;
+
+    // records may be rendered before the agent starts
+    symcache::initialize();
+    fingerprint::initialize();
+    return record::render_pending();
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_newrelic_agent_android_ndk_AgentNDK_nativeFlushStore(JNIEnv *env, jobject thiz, jlong budgetMs) {
+    jclass agentClass = jni::env_get_object_class(env, thiz);
+    jmethodID onStoredReport = jni::env_get_methodid(env, agentClass, "onStoredReport",
+                                                     "(IJLjava/nio/ByteBuffer;)Z");
+    if (onStoredReport == nullptr) {
+        _LOGE("Failed to retrieve onStoredReport() method id");
+        return 0;
+    }
+
+    store_flush_t flush = {env, thiz, onStoredReport};
+    return handoff::flush(post_stored_report, &flush, budgetMs);
 }
 
 extern "C"
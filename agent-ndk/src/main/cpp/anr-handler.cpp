@@ -3,27 +3,29 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-#include <dirent.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
+#include <ucontext.h>
+#include <atomic>
 
 #include <agent-ndk.h>
 #include <errno.h>
 #include "procfs.h"
 #include "signal-utils.h"
 #include "backtrace.h"
+#include "unwinder.h"
 #include "serializer.h"
+#include "arena.h"
 #include "anr-handler.h"
 
 
 static pid_t pid = getpid();
 static pid_t anr_monitor_tid = -1;
+static int task_fd = -1;
 static const char *const ANR_THREAD_NAME = "Signal Catcher";
-static const char *const ANR_SIGBLK_LABEL = "SigBlk:\t";
-static size_t const ANR_THREAD_NAME_LEN = std::strlen(ANR_THREAD_NAME);
-static size_t const ANR_SIGBLK_LABEL_LEN = std::strlen(ANR_SIGBLK_LABEL);
 static const uint64_t ANR_THREAD_SIGBLK = 0x1000;
 
 static volatile bool enabled = true;
@@ -32,8 +34,112 @@ static volatile bool watchdog_triggered = false;
 static pthread_t watchdog_thread = 0;
 static sem_t watchdog_semaphore;
 static bool watchdog_must_poll = false;
-static char *reportBuffer = nullptr;
+static bool arena_reserved = false;
 
+/**
+ * What the SIGQUIT handler saves for the watchdog, which collects the report
+ */
+typedef struct anr_trigger {
+    siginfo_t siginfo;
+    ucontext_t ucontext;
+    pid_t tid;                  // the thread that took the signal
+    backtrace_state_t stack;    // its frames, walked while its stack was live
+    uint64_t handler_ns;        // time spent in the handler
+
+} anr_trigger_t;
+
+static anr_trigger_t trigger = {};
+static std::atomic<bool> trigger_pending(false);
+
+static uint64_t now_ns() {
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Collect and store an ANR report from the state saved by the handler
+ */
+static void report_anr() {
+    if (!trigger_pending.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    _LOGD("anr_monitor_thread: interceptor ran for [%llu] ns", (unsigned long long) trigger.handler_ns);
+
+    // the watchdog's own context, saved while it waited, describes a stack it has since left
+    if (trigger.tid == gettid()) {
+        getcontext(&trigger.ucontext);
+    }
+
+    if (arena::acquire()) {
+        char *reportBuffer = arena::alloc_array<char>(BACKTRACE_SZ_MAX);
+        size_t size = (reportBuffer != nullptr) ?
+                      collect_anr_record(reportBuffer, BACKTRACE_SZ_MAX, &trigger.siginfo,
+                                         &trigger.ucontext, trigger.tid, &trigger.stack) : 0;
+
+        // the record holds all it needs from the trigger: the next signal can be taken
+        trigger_pending.store(false, std::memory_order_release);
+        if (size > 0) {
+            serializer::from_anr(reportBuffer, size);
+            _LOGI("ANR report posted from watchdog");
+        }
+        // the last lease decommits the arena, so an ANR leaves nothing resident
+        arena::release();
+    } else {
+        _LOGE("Crash arena not available for ANR report!");
+        trigger_pending.store(false, std::memory_order_release);
+    }
+}
+
+
+/**
+ * THE Android runtime uses a SIGQUIT handler to monitor ANR state, The handler runs
+ * on a well-known thread ("Signal Catcher") with a known SIGBLK value (0000000000001000).
+ * List the task directory of the current process to identify the thread ID. The directory
+ * is kept open, to revalidate the thread found.
+ */
+bool detect_android_anr_handler() {
+    pid = getpid();
+    anr_monitor_tid = -1;
+    if (task_fd == -1) {
+        task_fd = procfs::open_task_dir(pid);
+        if (task_fd == -1) {
+            return false;
+        }
+    }
+
+    // look through this process' threads for the ANR monitor thread
+    pid_t tid = procfs::find_thread(task_fd, ANR_THREAD_NAME);
+    if (tid == -1) {
+        return false;
+    }
+
+    uint64_t sigblk = 0;
+    if (procfs::read_sigblk(task_fd, tid, sigblk) &&
+        (sigblk & ANR_THREAD_SIGBLK) == ANR_THREAD_SIGBLK) {
+        anr_monitor_tid = tid;
+        _LOGD("Android ANR monitor found on thread[%d]", anr_monitor_tid);
+    } else {
+        _LOGE("Cannot access Android runtime ANR monitor while debugging");
+    }
+
+    return (anr_monitor_tid != -1);
+}
+
+/**
+ * Check the ANR monitor thread found is still running, or find it again if the runtime
+ * has replaced it: one small read, in the usual case
+ */
+static bool revalidate_android_anr_handler() {
+    if (task_fd != -1 && anr_monitor_tid != -1 &&
+        procfs::thread_has_name(task_fd, anr_monitor_tid, ANR_THREAD_NAME)) {
+        return true;
+    }
+
+    _LOGD("Android ANR monitor thread[%d] has gone: looking for it again", anr_monitor_tid);
+    return detect_android_anr_handler();
+}
 
 void *anr_monitor_thread(__unused void *unused) {
     static const useconds_t poll_sleep = 100000;
@@ -49,7 +155,11 @@ void *anr_monitor_thread(__unused void *unused) {
         _LOGD("anr_monitor_thread: waiting on trigger via %s",
               watchdog_must_poll ? "polling" : "semaphore");
 
-        if (watchdog_must_poll || sem_wait(&watchdog_semaphore) != 0) {
+        // the handler may interrupt this wait on its way to posting the semaphore
+        int waited = -1;
+        while (!watchdog_must_poll && (waited = sem_wait(&watchdog_semaphore)) != 0 && errno == EINTR);
+
+        if (watchdog_must_poll || waited != 0) {
             while (enabled && !watchdog_triggered) {
                 _LOGD("anr_monitor_thread: sleeping [%d] ns", poll_sleep);
                 usleep(poll_sleep);
@@ -63,10 +173,13 @@ void *anr_monitor_thread(__unused void *unused) {
              * Signal the runtime handler using syscall() with SYS_tgkill and
              * SIGQUIT to target the Android handler thread
              */
-            if (pid >= 0 && anr_monitor_tid >= 0) {
+            if (pid >= 0 && revalidate_android_anr_handler()) {
                 _LOGD("raise_anr_signal: pid [%d] tid [%d]", pid, anr_monitor_tid);
                 syscall(SYS_tgkill, pid, anr_monitor_tid, SIGQUIT);
             }
+
+            // then report it, while the runtime writes its traces
+            report_anr();
         }
 
         // Unblock SIGQUIT again so handler will run again.
@@ -77,24 +190,29 @@ void *anr_monitor_thread(__unused void *unused) {
     return nullptr;
 }
 
+/**
+ * Runs on the thread that took SIGQUIT, ahead of the runtime's own ANR dump: save the signal
+ * state and the thread's frame records, and wake the watchdog, which does the collection.
+ */
 void anr_interceptor(__unused int signo, siginfo_t *_siginfo, void *ucontext) {
+    uint64_t entered = now_ns();
 
     // Block SIGQUIT in this thread so the default handler can run.
     sigutils::block_signal(SIGQUIT);
 
-    if (enabled) {
-        _LOGD("Notify the JVM delegate an ANR has occurred");
-        const ucontext_t *_ucontext = static_cast<const ucontext_t *>(ucontext);
-
-        _LOGI("ANR interceptor invoked:");
-        if (reportBuffer != nullptr) {
-            if (collect_backtrace(reportBuffer, BACKTRACE_SZ_MAX, _siginfo, _ucontext)) {
-                serializer::from_anr(reportBuffer, BACKTRACE_SZ_MAX);
-                _LOGI("ANR report posted from Android handler");
-            }
-        } else {
-            _LOGE("Buffer not allocated for ANR report!");
-        }
+    // a report still being collected covers this signal too
+    bool pending = false;
+    if (enabled && trigger_pending.compare_exchange_strong(pending, true, std::memory_order_acquire)) {
+        trigger.siginfo = *_siginfo;
+        trigger.ucontext = *static_cast<const ucontext_t *>(ucontext);
+        trigger.tid = gettid();
+
+        // the saved context's stack is reused once the handler returns: only the cheap frame
+        // pointer walk is done here, for a fallback should the main thread not answer
+        trigger.stack.sa_ucontext = static_cast<const ucontext_t *>(ucontext);
+        unwind_frame_pointers(trigger.stack);
+        trigger.stack.sa_ucontext = nullptr;
+        trigger.handler_ns = now_ns() - entered;
     }
 
     // set the trigger flag for the poll loop if a semaphore was not created
@@ -102,80 +220,24 @@ void anr_interceptor(__unused int signo, siginfo_t *_siginfo, void *ucontext) {
 
     // Signal the ANR monitor thread to report:
     if (!watchdog_must_poll && (sem_post(&watchdog_semaphore) != 0)) {
-        _LOGE("Could not post ANR handler semaphore");
         watchdog_must_poll = true;
     }
 }
 
 
-/**
- * THE Android runtime uses a SIGQUIT handler to monitor ANR state, The handler runs
- * on a well-known thread ("Signal Catcher") with a known SIGBLK value (0000000000001000).
- * Scan the /proc tree for the the current process to identify the thread ID.
- */
-bool detect_android_anr_handler() {
-    pid_t pid = getpid();
-    struct dirent *_dirent;
-    std::string path;
-    const char *taskPath = procfs::get_task_path(pid, path);
-    DIR *dir = opendir(taskPath);
-
-    // iterate through this process' threads, looking for the ANR monitor thread
-    while ((_dirent = readdir(dir)) != nullptr) {
-        // only interested in numeric directories (representing thread ids)
-        if (!isdigit(_dirent->d_name[0])) {
-            continue;
-        }
-
-        // convert dir entry name to thread id
-        pid_t tid = std::strtol(_dirent->d_name, nullptr, 10);
-
-        std::string threadName;
-        procfs::get_thread_name(pid, tid, threadName);
-
-        if (std::strncmp(threadName.c_str(), ANR_THREAD_NAME, ANR_THREAD_NAME_LEN) == 0) {
-            char buff[1024];
-            uint64_t sigblk = 0;
-            std::string threadStatus;
-            FILE *fp = fopen(procfs::get_thread_status_path(pid, tid, threadStatus), "r");
-
-            if (fp != nullptr) {
-                while (fgets(buff, sizeof(buff), fp) != NULL) {
-                    if (std::strncmp(buff, ANR_SIGBLK_LABEL, ANR_SIGBLK_LABEL_LEN) == 0) {
-                        sigblk = std::strtoull(buff + ANR_SIGBLK_LABEL_LEN, nullptr, 16);
-                        break;
-                    }
-                }
-                fclose(fp);
-            }
-
-            if ((sigblk & ANR_THREAD_SIGBLK) == ANR_THREAD_SIGBLK) {
-                anr_monitor_tid = tid;
-                _LOGD("Android ANR monitor found on thread[%d]", anr_monitor_tid);
-            } else {
-                _LOGE("Cannot access Android runtime ANR monitor while debugging");
-            }
-        }
-
-        if (anr_monitor_tid != -1) {
-            break;
-        }
-    }
-
-    closedir(dir);
-
-    return (anr_monitor_tid != -1);
-}
-
 /**
  * Return anr detection to previous state
  */
 void reset_android_anr_handler() {
     pid = 0;
     anr_monitor_tid = -1;
-    if (reportBuffer != nullptr) {
-        delete[] reportBuffer;
-        reportBuffer = nullptr;
+    if (task_fd != -1) {
+        close(task_fd);
+        task_fd = -1;
+    }
+    if (arena_reserved) {
+        arena::shutdown();
+        arena_reserved = false;
     }
 }
 
@@ -191,18 +253,23 @@ bool anr_handler_initialize() {
         _LOGE("Failed to detect the Android ANR monitor thread. Native ANR reports will not be sent to New Relic.");
     }
 
+    // alloc our thread semaphore, before the watchdog waits on it
+    watchdog_must_poll = (sem_init(&watchdog_semaphore, 0, 0) != 0);
+    if (watchdog_must_poll) {
+        _LOGW("Failed to init semaphore, revert to polling");
+    }
+
+    // Share the crash arena rather than holding a permanent report buffer
+    arena_reserved = arena::initialize(BACKTRACE_ARENA_SZ_MAX);
+    enabled = true;
+
     // Start a watchdog thread
     if (0 != pthread_create(&watchdog_thread, nullptr, anr_monitor_thread, nullptr)) {
         _LOGE("Could not create an ANR watchdog thread. ANR reports will not be collected.");
+        enabled = false;
         return false;
     }
 
-    // alloc our thread semaphore
-    watchdog_must_poll = (sem_init(&watchdog_semaphore, 0, 0) != 0);
-    if (watchdog_must_poll) {
-        _LOGW("Failed to init semaphore, revert to polling");
-    }
-
     // Install the new SIGQUIT (ANR) handler. DO NOT CALL the previous SIGQUIT handler
     if (!sigutils::install_handler(SIGQUIT, anr_interceptor, nullptr, 0)) {
         _LOGE("Could not install SIGQUIT handler: ANR reports will not be collected.");
@@ -211,9 +278,6 @@ bool anr_handler_initialize() {
     // Unblock SIGQUIT to allow the ANR handler to run
     sigutils::unblock_signal(SIGQUIT);
 
-    reportBuffer = new char[BACKTRACE_SZ_MAX];
-    enabled = true;
-
     _LOGD("anr_handler_initialize: watchdog sem [%p]", &watchdog_semaphore);
 
     return enabled;
@@ -236,7 +300,9 @@ void anr_handler_shutdown() {
         watchdog_thread = (pthread_t) nullptr;
     }
 
-    sem_close(&watchdog_semaphore);
+    if (!watchdog_must_poll) {
+        sem_destroy(&watchdog_semaphore);
+    }
     watchdog_triggered = false;
 
     reset_android_anr_handler();
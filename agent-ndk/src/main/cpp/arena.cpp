@@ -0,0 +1,200 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <atomic>
+
+#include <agent-ndk.h>
+#include "arena.h"
+
+namespace arena {
+
+    // Upper bound on spins while another thread commits or decommits the region
+    static const int TRANSITION_SPIN_MAX = 1000;
+
+    /* Module-wide mutex, guards reservation and unmap (never taken on the signal path) */
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    static uint8_t *reservation = nullptr;   // start of mapping, including leading guard page
+    static size_t reservation_sz = 0;        // size of mapping, including both guard pages
+    static std::atomic<uint8_t *> region(nullptr);  // start of usable region: null once unmapped
+    static size_t region_sz = 0;             // size of usable region
+    static int references = 0;
+
+    static std::atomic<size_t> offset(0);
+    static std::atomic<int> leases(0);
+    static std::atomic_flag transition = ATOMIC_FLAG_INIT;
+
+    static bool lock_transition() {
+        for (int spin = 0; spin < TRANSITION_SPIN_MAX; spin++) {
+            if (!transition.test_and_set(std::memory_order_acquire)) {
+                return true;
+            }
+            sched_yield();
+        }
+        return false;
+    }
+
+    static void unlock_transition() {
+        transition.clear(std::memory_order_release);
+    }
+
+    bool initialize(size_t capacity) {
+        bool reserved = false;
+
+        if (0 == pthread_mutex_lock(&mutex)) {
+            if (reservation == nullptr) {
+                size_t page_sz = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                size_t usable_sz = (capacity + page_sz - 1) & ~(page_sz - 1);
+                size_t mapping_sz = usable_sz + (2 * page_sz);
+
+                // Reserve address space only: the whole mapping, guard pages included,
+                // stays PROT_NONE until a lease commits the usable region
+                void *mapping = mmap(nullptr, mapping_sz, PROT_NONE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+                if (mapping != MAP_FAILED) {
+                    reservation = static_cast<uint8_t *>(mapping);
+                    reservation_sz = mapping_sz;
+                    region_sz = usable_sz;
+                    region.store(reservation + page_sz);
+                    offset.store(0);
+                    leases = 0;
+                    _LOGD("arena::initialize: reserved %zu bytes at [%p]", region_sz, region.load());
+                } else {
+                    _LOGE_POSIX("mmap()");
+                }
+            }
+
+            if (reservation != nullptr) {
+                references++;
+                reserved = true;
+            }
+
+            if (0 != pthread_mutex_unlock(&mutex)) {
+                _LOGE_POSIX("pthread_mutex_unlock()");
+            }
+        } else {
+            _LOGE_POSIX("pthread_mutex_lock()");
+        }
+
+        return reserved;
+    }
+
+    void shutdown() {
+        if (0 == pthread_mutex_lock(&mutex)) {
+            if (references > 0 && --references == 0) {
+                // a lease taken between the check and the unmap would be left on unmapped pages
+                if (!lock_transition()) {
+                    _LOGW("arena::shutdown: timed out waiting on arena transition, arena will not be unmapped");
+                    references++;
+                } else if (leases > 0) {
+                    _LOGW("arena::shutdown: %d leases outstanding, arena will not be unmapped", leases.load());
+                    references++;
+                    unlock_transition();
+                } else {
+                    region.store(nullptr);
+                    munmap(reservation, reservation_sz);
+                    reservation = nullptr;
+                    reservation_sz = 0;
+                    region_sz = 0;
+                    unlock_transition();
+                    _LOGD("arena::shutdown: arena unmapped");
+                }
+            }
+            if (0 != pthread_mutex_unlock(&mutex)) {
+                _LOGE_POSIX("pthread_mutex_unlock()");
+            }
+        } else {
+            _LOGE_POSIX("pthread_mutex_lock()");
+        }
+    }
+
+    bool acquire() {
+        if (region.load() == nullptr) {
+            return false;
+        }
+
+        if (!lock_transition()) {
+            _LOGE("arena::acquire: timed out waiting on arena transition");
+            return false;
+        }
+
+        // the arena may have been unmapped while this thread waited
+        uint8_t *committed = region.load();
+        bool leased = (committed != nullptr);
+        if (leased && leases == 0) {
+            // first lease commits the usable region (guard pages are left untouched)
+            if (0 != mprotect(committed, region_sz, PROT_READ | PROT_WRITE)) {
+                leased = false;
+            }
+        }
+        if (leased) {
+            leases++;
+        }
+
+        unlock_transition();
+
+        return leased;
+    }
+
+    void release() {
+        if (region.load() == nullptr || !lock_transition()) {
+            return;
+        }
+
+        uint8_t *committed = region.load();
+        if (committed != nullptr && leases > 0 && --leases == 0) {
+            // return the pages to the kernel: the next commit will see zero-filled memory
+            madvise(committed, region_sz, MADV_DONTNEED);
+            mprotect(committed, region_sz, PROT_NONE);
+            offset.store(0, std::memory_order_relaxed);
+        }
+
+        unlock_transition();
+    }
+
+    void reset_after_fork() {
+        uint8_t *committed = region.load();
+        if (committed != nullptr && leases > 0) {
+            madvise(committed, region_sz, MADV_DONTNEED);
+            mprotect(committed, region_sz, PROT_NONE);
+        }
+        leases = 0;
+        offset.store(0, std::memory_order_relaxed);
+        unlock_transition();
+    }
+
+    void *alloc(size_t size, size_t align) {
+        uint8_t *committed = region.load(std::memory_order_acquire);
+        if (committed == nullptr || leases <= 0 || size == 0) {
+            return nullptr;
+        }
+
+        size_t start, end;
+        size_t current = offset.load(std::memory_order_relaxed);
+        do {
+            start = (current + align - 1) & ~(align - 1);
+            end = start + size;
+            if (end > region_sz || end < start) {
+                return nullptr;
+            }
+        } while (!offset.compare_exchange_weak(current, end, std::memory_order_relaxed));
+
+        return committed + start;
+    }
+
+    size_t used() {
+        return offset.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() {
+        return region_sz;
+    }
+
+}   // namespace arena
@@ -0,0 +1,86 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_ARENA_H
+#define _AGENT_NDK_ARENA_H
+
+#include <stddef.h>
+
+/**
+ * Crash capture arena
+ *
+ * A single virtual reservation, mapped once at startup and bracketed by guard pages,
+ * from which the signal path carves all of its working storage (frames, thread table,
+ * emitted report) with a lock-free bump allocator. Nothing is allocated from the heap
+ * once a signal has been delivered.
+ *
+ * The usable region is left inaccessible (and uncommitted) until the first lease is taken,
+ * so the arena costs no RSS until a capture actually runs. The last lease returns the
+ * pages to the kernel.
+ */
+namespace arena {
+
+    /**
+     * Reserve the arena. Safe to call more than once; each call must be paired with shutdown()
+     *
+     * @param capacity usable size in bytes, rounded up to a page multiple
+     * @return true if the arena is reserved
+     */
+    bool initialize(size_t capacity);
+
+    /**
+     * Drop a reference to the arena, unmapping it when the last reference is dropped
+     */
+    void shutdown();
+
+    /**
+     * Take a lease on the arena, committing its pages if this is the first lease.
+     * Async-signal-safe.
+     *
+     * @return true if allocations may be made from the arena
+     */
+    bool acquire();
+
+    /**
+     * Return a lease. The last lease resets the bump pointer and decommits the pages.
+     * Async-signal-safe.
+     */
+    void release();
+
+    /**
+     * In a child forked from a multi-threaded process, drop the leases and transition its
+     * parent's threads held at the fork: those threads don't exist in the child, and would never
+     * return them. Call before the child takes a lease. Async-signal-safe.
+     */
+    void reset_after_fork();
+
+    /**
+     * Bump-allocate zero-filled storage from the arena. Requires a lease.
+     * Async-signal-safe and lock-free.
+     *
+     * @param size number of bytes
+     * @param align power-of-two alignment
+     * @return pointer to storage, or nullptr if the arena is exhausted or not leased
+     */
+    void *alloc(size_t size, size_t align = alignof(max_align_t));
+
+    template<typename T>
+    T *alloc_array(size_t cnt) {
+        return static_cast<T *>(alloc(sizeof(T) * cnt, alignof(T)));
+    }
+
+    /**
+     * @return number of bytes currently allocated from the arena
+     */
+    size_t used();
+
+    /**
+     * @return usable size of the arena (excluding guard pages)
+     */
+    size_t capacity();
+
+}   // namespace arena
+
+#endif // _AGENT_NDK_ARENA_H
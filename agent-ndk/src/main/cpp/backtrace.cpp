@@ -6,10 +6,7 @@
 
 #include <unistd.h>
 #include <fcntl.h>
-#include <dirent.h>
-#include <string>
 #include <cstdlib>
-#include <vector>
 
 #include <agent-ndk.h>
 #include "procfs.h"
@@ -17,122 +14,234 @@
 #include "unwinder.h"
 #include "emitter.h"
 #include "signal-utils.h"
+#include "arena.h"
+#include "writer.h"
+#include "record.h"
+#include "thread-stacks.h"
+#include "module-index.h"
+#include "jni/native-context.h"
 
 
-void collect_thread_info(int tid, threadinfo_t &threadinfo) {
-    pid_t pid = getpid();
-    std::string cstr;
-    const char *tstat = procfs::get_thread_stat(pid, tid, cstr);
+void sanitize_name(char *name) {
+    // the report's string fields are not escaped: keep the name JSON-safe
+    for (char *ch = name; *ch != '\0'; ch++) {
+        if (*ch == '"' || *ch == '\'' || *ch == '\\' || static_cast<unsigned char>(*ch) < ' ') {
+            *ch = '_';
+        }
+    }
+}
+
+/**
+ * Map a stat run state code to the state reported
+ */
+static const char *thread_state_name(char state) {
+    switch (std::tolower(state)) {
+        case 'r':
+            return "RUNNING";
+        case 's':
+        case 'd':
+            return "SLEEPING";
+        case 'z':
+            return "ZOMBIE";
+        case 't':
+            return "STOPPED";
+        case 'x':
+            return "DEAD";
+        case 'w':
+            return "WAKING";
+        case 'k':
+            return "WAKE KILL";
+        case 'p':
+            return "PARKED";
+        default:
+            return "unknown";
+    }
+}
 
+void collect_thread_info(int task_fd, pid_t tid, threadinfo_t &threadinfo) {
     threadinfo.tid = tid;
 
     // everything needed is in thread's /proc stat file
-    if (tstat && *tstat != '\0') {
-        char value[0x100];
-        const char *delim = " ";
-        char *ppos = const_cast<char *>(tstat);
-        char *token = strtok_r(ppos, delim, &ppos);
-
-        if (token) {
-            token = strtok_r(nullptr, ")", &ppos);
-            if (token) {
-                if (std::sscanf(token, "(%[A-Za-z0-9 _.:-])", value) == 1) {
-                    std::strncpy(threadinfo.thread_name, value, sizeof(threadinfo.thread_name) - 1);
-                }
-            }
-            token = strtok_r(nullptr, delim, &ppos);
-            if (token) {
-                const char *rstate = "unknown";
-                switch (std::tolower(*token)) {
-                    case 'r':
-                        rstate = "RUNNING";
-                        break;
-                    case 's':
-                    case 'd':
-                        rstate = "SLEEPING";
-                        break;
-                    case 'z':
-                        rstate = "ZOMBIE";
-                        break;
-                    case 't':
-                        rstate = "STOPPED";
-                        break;
-                    case 'x':
-                        rstate = "DEAD";
-                        break;
-                    case 'w':
-                        rstate = "WAKING";
-                        break;
-                    case 'k':
-                        rstate = "WAKE KILL";
-                        break;
-                    case 'p':
-                        rstate = "PARKED";
-                        break;
-                };  // switch
-                std::strncpy(threadinfo.thread_state, rstate, sizeof(threadinfo.thread_state) - 1);
-            }
-            token = strtok_r(nullptr, delim, &ppos);    // skip ppid
-            token = strtok_r(nullptr, delim, &ppos);    // skip pgrp
-            token = strtok_r(nullptr, delim, &ppos);    // skip session id
-            token = strtok_r(nullptr, delim, &ppos);    // skip tty_nr
-            token = strtok_r(nullptr, delim, &ppos);    // skip tty_pgrp
-            token = strtok_r(nullptr, delim, &ppos);    // skip flags
-            token = strtok_r(nullptr, delim, &ppos);    // skip min_fault
-            token = strtok_r(nullptr, delim, &ppos);    // skip cmin_fault
-            token = strtok_r(nullptr, delim, &ppos);    // skip maj_fault
-            token = strtok_r(nullptr, delim, &ppos);    // skip cmaj_fault
-            token = strtok_r(nullptr, delim, &ppos);    // skip utime
-            token = strtok_r(nullptr, delim, &ppos);    // skip stime
-            token = strtok_r(nullptr, delim, &ppos);    // skip cutime
-            token = strtok_r(nullptr, delim, &ppos);    // skip cstime
-            token = strtok_r(nullptr, delim, &ppos);    // prior
-            if (token) {
-                threadinfo.priority = std::strtol(token, nullptr, 10);
-            }
-            token = strtok_r(nullptr, delim, &ppos);    // skip nice
-            token = strtok_r(nullptr, delim, &ppos);    // skip num threads
-            token = strtok_r(nullptr, delim, &ppos);    // skip itrealvalue
-            token = strtok_r(nullptr, delim, &ppos);    // skip start time
-            token = strtok_r(nullptr, delim, &ppos);    // skip vsize
-            token = strtok_r(nullptr, delim, &ppos);    // skip rss mem
-            token = strtok_r(nullptr, delim, &ppos);    // skip rss lim
-            token = strtok_r(nullptr, delim, &ppos);    // skip start code
-            token = strtok_r(nullptr, delim, &ppos);    // skip end code
-            token = strtok_r(nullptr, delim, &ppos);    // start stack
-            if (token) {
-                threadinfo.stack = std::strtoull(token, nullptr, 10);
-            }
-            // ignore the rest, the values tend to be the same for all threads anyway
+    char path[32];
+    writer_t writer = {};
+    writer::to_buffer(writer, path, sizeof(path) - 1);
+    writer::put_dec(writer, tid);
+    writer::put_cstr(writer, "/stat");
+    path[writer.length] = '\0';
+
+    procfs::proc_stat_t stat;
+    if (!procfs::read_stat(task_fd, path, stat)) {
+        return;
+    }
+
+    sanitize_name(stat.name);
+    std::strncpy(threadinfo.thread_name, stat.name, sizeof(threadinfo.thread_name) - 1);
+    std::strncpy(threadinfo.thread_state, thread_state_name(stat.state),
+                 sizeof(threadinfo.thread_state) - 1);
+    threadinfo.priority = stat.priority;
+    threadinfo.stack = stat.start_stack;
+
+    // ignore the rest, the values tend to be the same for all threads anyway
+}
+
+void collect_thread_state(backtrace_t &backtrace, pid_t crashed_tid) {
+    if (backtrace.threads == nullptr) {
+        return;
+    }
+
+    // listed with getdents64 into the arena: opendir() and readdir() allocate
+    pid_t *tids = arena::alloc_array<pid_t>(BACKTRACE_THREADS_MAX);
+    int task_fd = procfs::open_task_dir(backtrace.pid);
+    if (tids == nullptr || task_fd == -1) {
+        if (task_fd != -1) {
+            close(task_fd);
         }
+        return;
     }
 
-    threadinfo.crashed = (tid == gettid());
+    // iterate through this process' threads gathering info on each thread
+    size_t tid_cnt = procfs::list_threads(task_fd, tids, BACKTRACE_THREADS_MAX);
+    for (size_t i = 0; i < tid_cnt && backtrace.thread_cnt < BACKTRACE_THREADS_MAX; i++) {
+        pid_t tid = tids[i];
+        threadinfo_t &threadinfo = backtrace.threads[backtrace.thread_cnt];
+        collect_thread_info(task_fd, tid, threadinfo);
+        threadinfo.crashed = (tid == crashed_tid);
+        if (threadinfo.crashed && backtrace.state.frame_cnt > 0) {
+            threadinfo.backtrace_state = &backtrace.state;
+        }
+        backtrace.thread_cnt++;
+    }
+    close(task_fd);
+}
+
+/**
+ * Copy the process context from a snapshot, which the backtrace holds until it is emitted
+ */
+static void copy_context(const context::snapshot_t &snapshot, backtrace_t &backtrace) {
+    std::memcpy(backtrace.arch, snapshot.arch, sizeof(backtrace.arch));
+    backtrace.pid = snapshot.pid;
+    backtrace.ppid = snapshot.ppid;
+    backtrace.uid = snapshot.uid;
+    std::memcpy(backtrace.process_name, snapshot.process_name, sizeof(backtrace.process_name));
+    std::memcpy(backtrace.build_id, snapshot.build_id, sizeof(backtrace.build_id));
+    std::memcpy(backtrace.session_id, snapshot.session_id, sizeof(backtrace.session_id));
+    backtrace.context = &snapshot;
 }
 
-void collect_thread_state(backtrace &backtrace) {
-    std::string path;
-    const char *taskPath = procfs::get_task_path(getpid(), path);
-
-    DIR *dir = opendir(taskPath);
-    if (dir != nullptr) {
-        // iterate through this process' threads gathering info on each thread
-        struct dirent *_dirent;
-        while ((_dirent = readdir(dir)) != nullptr &&
-               (backtrace.threads.size() < BACKTRACE_THREADS_MAX)) {
-            // only interested in numeric directories (representing thread ids)
-            if (isdigit(_dirent->d_name[0])) {
-                pid_t tid = std::strtol(_dirent->d_name, nullptr, 10);
-                threadinfo_t threadinfo = {};
-                collect_thread_info(tid, threadinfo);
-                if (threadinfo.crashed && backtrace.state.frame_cnt > 0) {
-                    threadinfo.backtrace_state = &backtrace.state;
-                }
-                backtrace.threads.push_back(threadinfo);
-            }
+/**
+ * Unwind the thread a report is about into the backtrace state
+ *
+ * @param tid the thread that took the signal, whose handler saved the context
+ * @param directed_tid a thread to signal to unwind itself instead, or -1
+ * @param unwound frames the handler unwound, reported for a thread other than the caller, or null
+ * @return the thread unwound
+ */
+static pid_t unwind_primary(backtrace_state_t &state, const ucontext_t *sa_ucontext, pid_t tid, pid_t directed_tid,
+                            const backtrace_state_t *unwound) {
+    if (directed_tid != -1 && directed_tid != gettid()) {
+        if (stacks::capture_thread(directed_tid, state, BACKTRACE_MAIN_THREAD_TIMEOUT_MS * 1000000ULL)) {
+            return directed_tid;
+        }
+        if (sa_ucontext == nullptr) {
+            _LOGW("Thread[%d] did not answer: reporting it without a stack", directed_tid);
+            return directed_tid;
         }
-        closedir(dir);
+        _LOGW("Thread[%d] did not answer: reporting the thread that took the signal", directed_tid);
+    }
+
+    state.sa_ucontext = sa_ucontext;
+    if (tid == gettid()) {
+        unwind_backtrace(state);
+        return tid;
     }
+
+    // Another thread's saved context describes a stack it has since reused: report its registers,
+    // with only what its handler unwound while the stack was live.
+    state.frame_cnt = 0;
+    if (unwound != nullptr && unwound->frame_cnt > 0) {
+        std::memcpy(state.frames, unwound->frames, unwound->frame_cnt * sizeof(uintptr_t));
+        state.frame_cnt = unwound->frame_cnt;
+        state.crash_ip = unwound->crash_ip;
+    } else {
+        _LOGW("Thread[%d] has moved on: reporting it without a stack", tid);
+    }
+
+    return tid;
+}
+
+/**
+ * Capture the machine and process state at the point of violation
+ *
+ * @param tid the thread that took the signal, whose handler saved the context
+ * @param directed_tid a thread to signal to unwind itself, reported as the primary thread, or -1
+ * @param unwound frames the handler unwound, if it ran on another thread, or null
+ * @return backtrace alloc'd from the crash arena, or null
+ */
+static backtrace_t *capture_backtrace(const siginfo_t *siginfo, const ucontext_t *sa_ucontext, pid_t tid,
+                                      pid_t directed_tid = -1, const backtrace_state_t *unwound = nullptr) {
+    jni::native_context_t &native_context = jni::get_native_context();
+
+    // the backtrace and thread table live in the arena, not on the (alternate) signal stack
+    backtrace_t *backtrace = arena::alloc_array<backtrace_t>(1);
+    if (backtrace == nullptr) {
+        _LOGE("collect_backtrace: could not alloc backtrace from the crash arena");
+        return nullptr;
+    }
+
+    backtrace->state.siginfo = siginfo;
+
+    // unwind the primary thread's stacktrace asap
+    pid_t primary_tid = unwind_primary(backtrace->state, sa_ucontext, tid, directed_tid, unwound);
+
+    if (siginfo != nullptr) {
+        std::strncpy(backtrace->description,
+                     sigutils::get_signal_description(siginfo->si_signo, siginfo->si_code),
+                     sizeof(backtrace->description) - 1);
+    }
+    backtrace->timestamp = time(0L);
+
+    // the process context, as captured when the managed context was last set
+    const context::snapshot_t *snapshot = context::acquire(getpid());
+    if (snapshot != nullptr) {
+        copy_context(*snapshot, *backtrace);
+    } else {
+        std::strncpy(backtrace->arch, get_arch(), sizeof(backtrace->arch) - 1);
+        backtrace->uid = getuid();
+        backtrace->pid = getpid();
+        backtrace->ppid = getppid();
+        procfs::read_process_name(backtrace->pid, backtrace->process_name,
+                                  sizeof(backtrace->process_name));
+        std::strncpy(backtrace->build_id, native_context.buildId, sizeof(backtrace->build_id) - 1);
+        std::strncpy(backtrace->session_id, native_context.sessionId, sizeof(backtrace->session_id) - 1);
+    }
+    backtrace->threads = arena::alloc_array<threadinfo_t>(BACKTRACE_THREADS_MAX);
+    backtrace->thread_cnt = 0;
+
+    // then collect the threads, passing the backtrace state to the primary thread
+    collect_thread_state(*backtrace, primary_tid);
+
+    // and have every other thread unwind itself, bounded by the capture deadline
+    if (native_context.allThreadStacksEnabled) {
+        stacks::capture(*backtrace, BACKTRACE_THREADS_TIMEOUT_MS * 1000000ULL);
+    }
+
+    return backtrace;
+}
+
+/**
+ * Encode a captured backtrace as a crash record, releasing its context snapshot
+ *
+ * @return size of the record, or 0 if nothing was captured
+ */
+static size_t encode_backtrace(backtrace_t *backtrace, char *record_buffer, size_t max_size) {
+    if (backtrace == nullptr) {
+        return 0;
+    }
+
+    size_t size = record::encode(*backtrace, record_buffer, max_size);
+    context::release(backtrace->context);
+
+    return size;
 }
 
 bool collect_backtrace(char *backtrace_buffer,
@@ -140,37 +249,55 @@ bool collect_backtrace(char *backtrace_buffer,
                        const siginfo_t *siginfo,
                        const ucontext_t *sa_ucontext) {
 
-    std::string state;
-    backtrace_t backtrace = {};
+    backtrace_t *backtrace = capture_backtrace(siginfo, sa_ucontext, gettid());
+    if (backtrace == nullptr) {
+        return false;
+    }
 
-    backtrace.state.sa_ucontext = sa_ucontext;
-    backtrace.state.siginfo = siginfo;
+    // name the modules holding the frames (the record captures its own from the maps)
+    backtrace->modules = arena::alloc_array<moduleinfo_t>(BACKTRACE_MODULES_MAX);
+    if (backtrace->modules != nullptr) {
+        backtrace->module_cnt = modules::collect(*backtrace, backtrace->modules, BACKTRACE_MODULES_MAX);
+    }
 
-    // unwind the current thread's stacktrace asap
-    unwind_backtrace(backtrace.state);
+    // emit directly into the caller's buffer, leaving room for the terminator
+    writer_t writer = {};
+    writer::to_buffer(writer, backtrace_buffer, max_size - 1);
+    bool emitted = emit_backtrace(*backtrace, writer);
+    backtrace_buffer[writer.length] = '\0';
+    context::release(backtrace->context);
 
-    std::strncpy(backtrace.arch, get_arch(), sizeof(backtrace.arch) - 1);
-    std::strncpy(backtrace.description,
-                 sigutils::get_signal_description(siginfo->si_signo, siginfo->si_code),
-                 sizeof(backtrace.description) - 1);
+    return emitted;
+}
 
-    backtrace.timestamp = time(0L);
-    backtrace.uid = getuid();
-    backtrace.pid = getpid();
-    backtrace.ppid = getppid();
-    backtrace.threads.clear();
+size_t collect_crash_record(char *record_buffer,
+                            size_t max_size,
+                            const siginfo_t *siginfo,
+                            const ucontext_t *sa_ucontext) {
 
-    state.reserve(BACKTRACE_SZ_MAX);
+    return encode_backtrace(capture_backtrace(siginfo, sa_ucontext, gettid()), record_buffer, max_size);
+}
 
-    // then collect the threads, passing the backtrace state to the crashing thread
-    collect_thread_state(backtrace);
+size_t collect_anr_record(char *record_buffer,
+                          size_t max_size,
+                          const siginfo_t *siginfo,
+                          const ucontext_t *sa_ucontext,
+                          pid_t tid,
+                          const backtrace_state_t *unwound) {
 
-    std::string emitted = emit_backtrace(backtrace, state);
+    return encode_backtrace(capture_backtrace(siginfo, sa_ucontext, tid, getpid(), unwound),
+                            record_buffer, max_size);
+}
+
+size_t collect_stall_record(char *record_buffer,
+                            size_t max_size,
+                            pid_t tid,
+                            const char *description) {
 
-    size_t str_size = emitted.size();
-    size_t copy_size = std::min(str_size, max_size - 2);
-    memcpy(backtrace_buffer, emitted.data(), copy_size);
-    backtrace_buffer[copy_size] = '\0';
+    backtrace_t *backtrace = capture_backtrace(nullptr, nullptr, tid, tid);
+    if (backtrace != nullptr) {
+        std::strncpy(backtrace->description, description, sizeof(backtrace->description) - 1);
+    }
 
-    return copy_size == str_size;
+    return encode_backtrace(backtrace, record_buffer, max_size);
 }
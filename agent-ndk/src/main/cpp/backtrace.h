@@ -7,12 +7,13 @@
 #define _AGENT_NDK_BACKTRACE_H
 
 #include <agent-ndk.h>
-#include <vector>
 
 #ifndef PATH_MAX
 #define PATH_MAX 1024
 #endif  // !PATH_MAX
 
+#include "context-snapshot.h"
+
 /**
  * Supported ABIs: https://developer.android.com/ndk/guides/abis
  *
@@ -52,6 +53,7 @@ typedef struct backtrace_state {
     uintptr_t crash_ip;
     const ucontext_t *sa_ucontext;
     const siginfo_t *siginfo;
+    struct stackframe *stackframes;     // Frames resolved ahead of emission, or null to resolve in-process
 
 }   backtrace_state_t;
 
@@ -87,6 +89,18 @@ typedef struct threadinfo {
 }   threadinfo_t;
 
 
+/**
+ * A loaded module holding one or more frames
+ */
+typedef struct moduleinfo {
+    uintptr_t base;             // Lowest mapped address of the module
+    uintptr_t end;              // End of the module's last loadable segment
+    const char *path;           // Pathname of the module
+    const char *build_id;       // Hex encoded ELF build-id, or empty
+
+}   moduleinfo_t;
+
+
 /**
  * A backtrace represents the state of the machine at the point of violation:
  */
@@ -99,10 +113,40 @@ typedef struct backtrace {
     int pid;
     int ppid;
     int uid;
+    char process_name[PATH_MAX];
+    char build_id[40];
+    char session_id[40];
+    const context::snapshot_t *context;     // Snapshot the process context was copied from, or null
+
+    threadinfo_t *threads;      // Thread table, alloc'd from the crash arena
+    size_t thread_cnt;
 
-    std::vector<threadinfo_t> threads;
+    moduleinfo_t *modules;      // Modules holding the frames, or null if not reported
+    size_t module_cnt;
+
+    unsigned occurrences;       // Reports coalesced into this one, including itself (0 if not counted)
+    long last_occurrence;       // Time of the latest coalesced report
 
 }   backtrace_t;
 
 
+/**
+ * Replace what a report's unescaped string fields can't hold (quotes, backslashes and control
+ * characters) with '_'. Async-signal-safe.
+ */
+void sanitize_name(char *name);
+
+/**
+ * Read a thread's name, state, priority and stack from its stat file,
+ * given an open /proc/<pid>/task directory
+ */
+void collect_thread_info(int task_fd, pid_t tid, threadinfo_t &);
+
+/**
+ * Fill the backtrace's thread table (alloc'd by the caller) with the threads of backtrace.pid,
+ * passing the backtrace state to the crashed thread
+ */
+void collect_thread_state(backtrace_t &, pid_t crashed_tid);
+
+
 #endif // _AGENT_NDK_BACKTRACE_H
@@ -0,0 +1,1466 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <signal.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <cstring>
+
+#include <agent-ndk.h>
+#include "cfi-unwinder.h"
+#include "module-index.h"
+#include "unwinder.h"
+
+#if defined(__aarch64__) || defined(__x86_64__) || defined(__i386__)
+#define CFI_SUPPORTED 1
+#endif
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Unsupported byte order"
+#endif
+
+namespace cfi {
+
+#if defined(CFI_SUPPORTED)
+
+#if defined(__aarch64__)
+    static const uint32_t DWARF_SP = 31;
+
+    // x0-x30, sp and pc, as the kernel saves them in a signal frame
+    static const size_t SAVED_OFFSET = offsetof(ucontext_t, uc_mcontext.regs);
+    static const size_t SAVED_CNT = 33;
+#elif defined(__x86_64__)
+    static const uint32_t DWARF_SP = 7;
+    static const uint32_t DWARF_RA = 16;
+    static const size_t SAVED_OFFSET = offsetof(ucontext_t, uc_mcontext.gregs);
+    static const size_t SAVED_CNT = NGREG;
+
+    // general registers in DWARF order
+    static const int GREGS[] = {REG_RAX, REG_RDX, REG_RCX, REG_RBX, REG_RSI, REG_RDI, REG_RBP, REG_RSP,
+                                REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15};
+#elif defined(__i386__)
+    static const uint32_t DWARF_SP = 4;
+    static const uint32_t DWARF_RA = 8;
+    static const size_t SAVED_OFFSET = offsetof(ucontext_t, uc_mcontext.gregs);
+    static const size_t SAVED_CNT = NGREG;
+
+    static const int GREGS[] = {REG_EAX, REG_ECX, REG_EDX, REG_EBX, REG_ESP, REG_EBP, REG_ESI, REG_EDI};
+#endif
+
+    static const uint64_t ALL_REGS = (REG_CNT < 64) ? ((1ull << REG_CNT) - 1) : ~0ull;
+
+    /**
+     * .eh_frame pointer encodings (DW_EH_PE_*)
+     */
+    enum : uint8_t {
+        PE_ABSPTR = 0x00,
+        PE_ULEB128 = 0x01,
+        PE_UDATA2 = 0x02,
+        PE_UDATA4 = 0x03,
+        PE_UDATA8 = 0x04,
+        PE_SLEB128 = 0x09,
+        PE_SDATA2 = 0x0a,
+        PE_SDATA4 = 0x0b,
+        PE_SDATA8 = 0x0c,
+        PE_PCREL = 0x10,
+        PE_DATAREL = 0x30,
+        PE_INDIRECT = 0x80,
+        PE_OMIT = 0xff,
+    };
+
+    /**
+     * Call frame instructions (DW_CFA_*)
+     */
+    enum : uint8_t {
+        CFA_NOP = 0x00,
+        CFA_SET_LOC = 0x01,
+        CFA_ADVANCE_LOC1 = 0x02,
+        CFA_ADVANCE_LOC2 = 0x03,
+        CFA_ADVANCE_LOC4 = 0x04,
+        CFA_OFFSET_EXTENDED = 0x05,
+        CFA_RESTORE_EXTENDED = 0x06,
+        CFA_UNDEFINED = 0x07,
+        CFA_SAME_VALUE = 0x08,
+        CFA_REGISTER = 0x09,
+        CFA_REMEMBER_STATE = 0x0a,
+        CFA_RESTORE_STATE = 0x0b,
+        CFA_DEF_CFA = 0x0c,
+        CFA_DEF_CFA_REGISTER = 0x0d,
+        CFA_DEF_CFA_OFFSET = 0x0e,
+        CFA_DEF_CFA_EXPRESSION = 0x0f,
+        CFA_EXPRESSION = 0x10,
+        CFA_OFFSET_EXTENDED_SF = 0x11,
+        CFA_DEF_CFA_SF = 0x12,
+        CFA_DEF_CFA_OFFSET_SF = 0x13,
+        CFA_VAL_OFFSET = 0x14,
+        CFA_VAL_OFFSET_SF = 0x15,
+        CFA_VAL_EXPRESSION = 0x16,
+        CFA_NEGATE_RA_STATE = 0x2d,     // DW_CFA_AARCH64_negate_ra_state (DW_CFA_GNU_window_save elsewhere)
+        CFA_GNU_ARGS_SIZE = 0x2e,
+        CFA_GNU_NEGATIVE_OFFSET_EXTENDED = 0x2f,
+        CFA_ADVANCE_LOC = 0x40,         // high two bits, with the operand in the low six
+        CFA_OFFSET = 0x80,
+        CFA_RESTORE = 0xc0,
+    };
+
+    /**
+     * DWARF expression operations (DW_OP_*), the subset CFI uses
+     */
+    enum : uint8_t {
+        OP_ADDR = 0x03,
+        OP_DEREF = 0x06,
+        OP_CONST1U = 0x08,
+        OP_CONST1S = 0x09,
+        OP_CONST2U = 0x0a,
+        OP_CONST2S = 0x0b,
+        OP_CONST4U = 0x0c,
+        OP_CONST4S = 0x0d,
+        OP_CONST8U = 0x0e,
+        OP_CONST8S = 0x0f,
+        OP_CONSTU = 0x10,
+        OP_CONSTS = 0x11,
+        OP_DUP = 0x12,
+        OP_DROP = 0x13,
+        OP_OVER = 0x14,
+        OP_PICK = 0x15,
+        OP_SWAP = 0x16,
+        OP_AND = 0x1a,
+        OP_MINUS = 0x1c,
+        OP_MUL = 0x1e,
+        OP_NEG = 0x1f,
+        OP_NOT = 0x20,
+        OP_OR = 0x21,
+        OP_PLUS = 0x22,
+        OP_PLUS_UCONST = 0x23,
+        OP_SHL = 0x24,
+        OP_SHR = 0x25,
+        OP_SHRA = 0x26,
+        OP_XOR = 0x27,
+        OP_BRA = 0x28,
+        OP_EQ = 0x29,
+        OP_GE = 0x2a,
+        OP_GT = 0x2b,
+        OP_LE = 0x2c,
+        OP_LT = 0x2d,
+        OP_NE = 0x2e,
+        OP_SKIP = 0x2f,
+        OP_LIT0 = 0x30,
+        OP_LIT31 = 0x4f,
+        OP_BREG0 = 0x70,
+        OP_BREG31 = 0x8f,
+        OP_BREGX = 0x92,
+        OP_DEREF_SIZE = 0x94,
+        OP_NOP = 0x96,
+    };
+
+    static const size_t EXPRESSION_STACK_MAX = 16;
+    static const size_t EXPRESSION_STEPS_MAX = 256;
+    static const size_t STATE_STACK_MAX = 4;
+    static const size_t RULES_MAX = 16;
+    static const size_t CACHE_SIZE = 512;
+
+    /**
+     * Bounded cursor over mapped CFI
+     */
+    typedef struct reader {
+        const uint8_t *pos;
+        const uint8_t *end;
+
+    } reader_t;
+
+    /**
+     * A decoded FDE, and what it needs from its CIE
+     */
+    typedef struct fde {
+        uintptr_t pc_begin;
+        uintptr_t pc_end;
+        const uint8_t *instructions;
+        const uint8_t *instructions_end;
+        const uint8_t *cie_instructions;
+        const uint8_t *cie_instructions_end;
+        uint64_t code_align;
+        int64_t data_align;
+        uint32_t ra_reg;
+        uint8_t encoding;           // of the FDE's addresses
+        bool signal_frame;          // 'S': the caller's pc is where it was interrupted
+
+    } fde_t;
+
+    /**
+     * How a register is recovered in the caller's frame (DWARF register rules)
+     */
+    enum rule_type : uint8_t {
+        RULE_SAME = 0,
+        RULE_UNDEFINED,
+        RULE_OFFSET,                // saved at CFA + value
+        RULE_VAL_OFFSET,            // is CFA + value
+        RULE_REGISTER,              // saved in register value
+        RULE_EXPRESSION,            // saved at the address an expression computes
+        RULE_VAL_EXPRESSION,        // is the value an expression computes
+    };
+
+    typedef struct rule {
+        uint8_t type;
+        intptr_t value;             // an offset, a register, or an expression's address
+
+    } rule_t;
+
+    /**
+     * A row of the CFI table: the CFA rule and a rule per register
+     */
+    typedef struct row {
+        uint32_t cfa_reg;
+        intptr_t cfa_offset;
+        const uint8_t *cfa_expression;      // if set, computes the CFA instead
+        rule_t rules[REG_CNT];
+
+    } row_t;
+
+    typedef struct reg_rule {
+        uint8_t reg;
+        uint8_t type;
+        intptr_t value;
+
+    } reg_rule_t;
+
+    /**
+     * A row as applied: the CFA rule, and the registers whose rule isn't "same value".
+     * Saved registers are the callee-saved ones, so a row with more isn't unwound
+     * (sigreturn trampolines, which describe every register, are restored separately).
+     */
+    typedef struct rules {
+        uintptr_t pc_begin;         // the pcs the row covers
+        uintptr_t pc_end;
+        uint32_t cfa_reg;
+        uint32_t ra_reg;
+        intptr_t cfa_offset;
+        const uint8_t *cfa_expression;
+        bool signal_frame;
+        uint8_t reg_cnt;
+        reg_rule_t regs[RULES_MAX];
+
+    } rules_t;
+
+    /**
+     * A cache entry, written under a sequence lock: odd while being written
+     */
+    typedef struct cached_rules {
+        std::atomic<uint32_t> sequence;
+        const modules::module_t *module;
+        rules_t rules;
+
+    } cached_rules_t;
+
+    static cached_rules_t rules_cache[CACHE_SIZE];
+
+    template<typename T>
+    static bool read(reader_t &reader, T &value) {
+        if (static_cast<size_t>(reader.end - reader.pos) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, reader.pos, sizeof(T));
+        reader.pos += sizeof(T);
+        return true;
+    }
+
+    static bool read_uleb128(reader_t &reader, uint64_t &value) {
+        value = 0;
+        for (unsigned shift = 0; reader.pos < reader.end; shift += 7) {
+            uint8_t byte = *reader.pos++;
+            if (shift < 64) {
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            }
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool read_sleb128(reader_t &reader, int64_t &value) {
+        uint64_t result = 0;
+        for (unsigned shift = 0; reader.pos < reader.end;) {
+            uint8_t byte = *reader.pos++;
+            if (shift < 64) {
+                result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            }
+            shift += 7;
+            if ((byte & 0x80) == 0) {
+                if (shift < 64 && (byte & 0x40) != 0) {
+                    result |= ~0ull << shift;
+                }
+                value = static_cast<int64_t>(result);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Read a pointer in one of the encodings .eh_frame and .eh_frame_hdr use.
+     * Only personality routines are encoded indirectly, and those are skipped: the
+     * indirection is never followed.
+     */
+    static bool read_encoded(reader_t &reader, uint8_t encoding, uintptr_t data_base, uintptr_t &value) {
+        if (encoding == PE_OMIT) {
+            value = 0;
+            return true;
+        }
+
+        uintptr_t base = 0;
+        switch (encoding & 0x70) {
+            case PE_ABSPTR:
+                break;
+            case PE_PCREL:
+                base = reinterpret_cast<uintptr_t>(reader.pos);
+                break;
+            case PE_DATAREL:
+                if (data_base == 0) {
+                    return false;
+                }
+                base = data_base;
+                break;
+            default:
+                return false;
+        }
+
+        bool ok = false;
+        switch (encoding & 0x0f) {
+            case PE_ABSPTR: {
+                uintptr_t raw = 0;
+                ok = read(reader, raw);
+                value = raw;
+                break;
+            }
+            case PE_ULEB128: {
+                uint64_t raw = 0;
+                ok = read_uleb128(reader, raw);
+                value = static_cast<uintptr_t>(raw);
+                break;
+            }
+            case PE_UDATA2: {
+                uint16_t raw = 0;
+                ok = read(reader, raw);
+                value = raw;
+                break;
+            }
+            case PE_UDATA4: {
+                uint32_t raw = 0;
+                ok = read(reader, raw);
+                value = raw;
+                break;
+            }
+            case PE_UDATA8: {
+                uint64_t raw = 0;
+                ok = read(reader, raw);
+                value = static_cast<uintptr_t>(raw);
+                break;
+            }
+            case PE_SLEB128: {
+                int64_t raw = 0;
+                ok = read_sleb128(reader, raw);
+                value = static_cast<uintptr_t>(raw);
+                break;
+            }
+            case PE_SDATA2: {
+                int16_t raw = 0;
+                ok = read(reader, raw);
+                value = static_cast<uintptr_t>(static_cast<intptr_t>(raw));
+                break;
+            }
+            case PE_SDATA4: {
+                int32_t raw = 0;
+                ok = read(reader, raw);
+                value = static_cast<uintptr_t>(static_cast<intptr_t>(raw));
+                break;
+            }
+            case PE_SDATA8: {
+                int64_t raw = 0;
+                ok = read(reader, raw);
+                value = static_cast<uintptr_t>(raw);
+                break;
+            }
+            default:
+                return false;
+        }
+
+        value += base;
+        return ok;
+    }
+
+    /**
+     * Read memory the unwound frames saved. The calling thread's stack is read directly;
+     * anything else (an alternate signal stack, another thread's stack, a corrupt pointer)
+     * is read through the kernel, which fails rather than faults on an unmapped address.
+     */
+    static bool read_memory(const cursor_t &cursor, uintptr_t address, void *value, size_t size) {
+        if (address >= cursor.stack_lo && cursor.stack_hi >= size && address <= cursor.stack_hi - size) {
+            std::memcpy(value, reinterpret_cast<const void *>(address), size);
+            return true;
+        }
+
+        struct iovec local = {value, size};
+        struct iovec remote = {reinterpret_cast<void *>(address), size};
+        return syscall(SYS_process_vm_readv, getpid(), &local, 1, &remote, 1, 0) == static_cast<ssize_t>(size);
+    }
+
+    static bool read_word(const cursor_t &cursor, uintptr_t address, uintptr_t &value) {
+        if (address >= cursor.stack_lo && address + sizeof(value) <= cursor.stack_hi && address + sizeof(value) > address) {
+            std::memcpy(&value, reinterpret_cast<const void *>(address), sizeof(value));
+            return true;
+        }
+        return read_memory(cursor, address, &value, sizeof(value));
+    }
+
+    /**
+     * Strip a pointer authentication code from a return address
+     */
+    static uintptr_t strip_pac(uintptr_t address) {
+#if defined(__aarch64__)
+        // xpaclri, encoded as a hint: a no-op on cores without pointer authentication
+        register uintptr_t x30 __asm__("x30") = address;
+        __asm__("hint 0x7" : "+r"(x30));
+        return x30;
+#else
+        return address;
+#endif
+    }
+
+    /**
+     * Evaluate a DWARF expression (a uleb128 length, then the operations)
+     */
+    static bool evaluate(const cursor_t &cursor, const uint8_t *expression, bool push_cfa, uintptr_t cfa,
+                         uintptr_t &result) {
+        uintptr_t stack[EXPRESSION_STACK_MAX];
+        size_t depth = 0;
+        if (push_cfa) {
+            stack[depth++] = cfa;
+        }
+
+        // the expression's bounds were validated when its instruction was decoded
+        uint64_t length = 0;
+        reader_t reader = {expression, expression + 16};
+        if (!read_uleb128(reader, length)) {
+            return false;
+        }
+        const uint8_t *begin = reader.pos;
+        reader.end = begin + length;
+
+        for (size_t steps = 0; reader.pos < reader.end; steps++) {
+            uint8_t op = 0;
+            if (steps >= EXPRESSION_STEPS_MAX || !read(reader, op)) {
+                return false;
+            }
+
+            uintptr_t value = 0;
+            bool push = true;
+
+            if (op >= OP_LIT0 && op <= OP_LIT31) {
+                value = op - OP_LIT0;
+            } else if ((op >= OP_BREG0 && op <= OP_BREG31) || op == OP_BREGX) {
+                uint64_t reg = op - OP_BREG0;
+                int64_t offset = 0;
+                if ((op == OP_BREGX && !read_uleb128(reader, reg)) || !read_sleb128(reader, offset) ||
+                    reg >= REG_CNT || (cursor.valid & (1ull << reg)) == 0) {
+                    return false;
+                }
+                value = cursor.regs[reg] + static_cast<uintptr_t>(offset);
+            } else {
+                switch (op) {
+                    case OP_ADDR:
+                        if (!read(reader, value)) {
+                            return false;
+                        }
+                        break;
+                    case OP_CONST1U:
+                    case OP_CONST1S:
+                    case OP_CONST2U:
+                    case OP_CONST2S:
+                    case OP_CONST4U:
+                    case OP_CONST4S:
+                    case OP_CONST8U:
+                    case OP_CONST8S: {
+                        bool ok = false;
+                        if (op == OP_CONST1U) {
+                            uint8_t raw = 0;
+                            ok = read(reader, raw);
+                            value = raw;
+                        } else if (op == OP_CONST1S) {
+                            int8_t raw = 0;
+                            ok = read(reader, raw);
+                            value = static_cast<uintptr_t>(static_cast<intptr_t>(raw));
+                        } else if (op == OP_CONST2U) {
+                            uint16_t raw = 0;
+                            ok = read(reader, raw);
+                            value = raw;
+                        } else if (op == OP_CONST2S) {
+                            int16_t raw = 0;
+                            ok = read(reader, raw);
+                            value = static_cast<uintptr_t>(static_cast<intptr_t>(raw));
+                        } else if (op == OP_CONST4U) {
+                            uint32_t raw = 0;
+                            ok = read(reader, raw);
+                            value = raw;
+                        } else if (op == OP_CONST4S) {
+                            int32_t raw = 0;
+                            ok = read(reader, raw);
+                            value = static_cast<uintptr_t>(static_cast<intptr_t>(raw));
+                        } else {
+                            uint64_t raw = 0;
+                            ok = read(reader, raw);
+                            value = static_cast<uintptr_t>(raw);
+                        }
+                        if (!ok) {
+                            return false;
+                        }
+                        break;
+                    }
+                    case OP_CONSTU: {
+                        uint64_t raw = 0;
+                        if (!read_uleb128(reader, raw)) {
+                            return false;
+                        }
+                        value = static_cast<uintptr_t>(raw);
+                        break;
+                    }
+                    case OP_CONSTS: {
+                        int64_t raw = 0;
+                        if (!read_sleb128(reader, raw)) {
+                            return false;
+                        }
+                        value = static_cast<uintptr_t>(raw);
+                        break;
+                    }
+                    case OP_DUP:
+                    case OP_OVER:
+                    case OP_PICK: {
+                        uint8_t index = (op == OP_DUP) ? 0 : 1;
+                        if ((op == OP_PICK && !read(reader, index)) || index >= depth) {
+                            return false;
+                        }
+                        value = stack[depth - 1 - index];
+                        break;
+                    }
+                    case OP_DROP:
+                        if (depth < 1) {
+                            return false;
+                        }
+                        depth--;
+                        push = false;
+                        break;
+                    case OP_SWAP:
+                        if (depth < 2) {
+                            return false;
+                        }
+                        value = stack[depth - 1];
+                        stack[depth - 1] = stack[depth - 2];
+                        stack[depth - 2] = value;
+                        push = false;
+                        break;
+                    case OP_DEREF:
+                    case OP_DEREF_SIZE: {
+                        uint8_t size = sizeof(uintptr_t);
+                        if ((op == OP_DEREF_SIZE && !read(reader, size)) || size == 0 || size > sizeof(uintptr_t) ||
+                            depth < 1) {
+                            return false;
+                        }
+                        uintptr_t address = stack[--depth];
+                        if (!read_memory(cursor, address, &value, size)) {
+                            return false;
+                        }
+                        if (size < sizeof(uintptr_t)) {
+                            value &= (static_cast<uintptr_t>(1) << (size * 8)) - 1;
+                        }
+                        break;
+                    }
+                    case OP_NEG:
+                    case OP_NOT:
+                        if (depth < 1) {
+                            return false;
+                        }
+                        value = stack[--depth];
+                        value = (op == OP_NEG) ? -value : ~value;
+                        break;
+                    case OP_PLUS_UCONST: {
+                        uint64_t addend = 0;
+                        if (depth < 1 || !read_uleb128(reader, addend)) {
+                            return false;
+                        }
+                        value = stack[--depth] + static_cast<uintptr_t>(addend);
+                        break;
+                    }
+                    case OP_AND:
+                    case OP_MINUS:
+                    case OP_MUL:
+                    case OP_OR:
+                    case OP_PLUS:
+                    case OP_SHL:
+                    case OP_SHR:
+                    case OP_SHRA:
+                    case OP_XOR:
+                    case OP_EQ:
+                    case OP_GE:
+                    case OP_GT:
+                    case OP_LE:
+                    case OP_LT:
+                    case OP_NE: {
+                        if (depth < 2) {
+                            return false;
+                        }
+                        uintptr_t b = stack[--depth];
+                        uintptr_t a = stack[--depth];
+                        intptr_t sa = static_cast<intptr_t>(a);
+                        intptr_t sb = static_cast<intptr_t>(b);
+                        switch (op) {
+                            case OP_AND: value = a & b; break;
+                            case OP_MINUS: value = a - b; break;
+                            case OP_MUL: value = a * b; break;
+                            case OP_OR: value = a | b; break;
+                            case OP_PLUS: value = a + b; break;
+                            case OP_SHL: value = (b < sizeof(a) * 8) ? a << b : 0; break;
+                            case OP_SHR: value = (b < sizeof(a) * 8) ? a >> b : 0; break;
+                            case OP_SHRA: value = static_cast<uintptr_t>(sa >> ((b < sizeof(a) * 8) ? b : sizeof(a) * 8 - 1)); break;
+                            case OP_XOR: value = a ^ b; break;
+                            case OP_EQ: value = (sa == sb); break;
+                            case OP_GE: value = (sa >= sb); break;
+                            case OP_GT: value = (sa > sb); break;
+                            case OP_LE: value = (sa <= sb); break;
+                            case OP_LT: value = (sa < sb); break;
+                            default: value = (sa != sb); break;
+                        }
+                        break;
+                    }
+                    case OP_SKIP:
+                    case OP_BRA: {
+                        int16_t offset = 0;
+                        if (!read(reader, offset)) {
+                            return false;
+                        }
+                        push = false;
+                        if (op == OP_BRA) {
+                            if (depth < 1) {
+                                return false;
+                            }
+                            if (stack[--depth] == 0) {
+                                break;
+                            }
+                        }
+                        if (offset < begin - reader.pos || offset > reader.end - reader.pos) {
+                            return false;
+                        }
+                        reader.pos += offset;
+                        break;
+                    }
+                    case OP_NOP:
+                        push = false;
+                        break;
+                    default:
+                        return false;
+                }
+            }
+
+            if (push) {
+                if (depth >= EXPRESSION_STACK_MAX) {
+                    return false;
+                }
+                stack[depth++] = value;
+            }
+        }
+
+        if (depth < 1) {
+            return false;
+        }
+        result = stack[depth - 1];
+        return true;
+    }
+
+    /**
+     * Decode a CIE's augmentation and alignment factors, and locate its initial instructions
+     *
+     * @return false if it isn't a CIE this unwinder understands
+     */
+    static bool parse_cie(const modules::module_t *module, const uint8_t *cie, fde_t &fde, bool &augmented) {
+        if (reinterpret_cast<uintptr_t>(cie) < module->start || reinterpret_cast<uintptr_t>(cie) >= module->end) {
+            return false;
+        }
+
+        reader_t reader = {cie, reinterpret_cast<const uint8_t *>(module->end)};
+        uint32_t length = 0;
+        uint32_t id = 0;
+        uint8_t version = 0;
+
+        // a 64-bit length (0xffffffff) is never emitted for .eh_frame
+        if (!read(reader, length) || length == 0 || length == 0xffffffff ||
+            length > static_cast<size_t>(reader.end - reader.pos)) {
+            return false;
+        }
+        reader.end = reader.pos + length;
+        if (!read(reader, id) || id != 0 || !read(reader, version) || (version != 1 && version != 3 && version != 4)) {
+            return false;
+        }
+
+        const char *augmentation = reinterpret_cast<const char *>(reader.pos);
+        while (reader.pos < reader.end && *reader.pos != '\0') {
+            reader.pos++;
+        }
+        if (reader.pos++ >= reader.end) {
+            return false;
+        }
+
+        uint8_t address_size = 0;
+        uint8_t segment_size = 0;
+        if (version == 4 && (!read(reader, address_size) || !read(reader, segment_size))) {
+            return false;
+        }
+
+        uint64_t ra_reg = 0;
+        if (!read_uleb128(reader, fde.code_align) || !read_sleb128(reader, fde.data_align)) {
+            return false;
+        }
+        if (version == 1) {
+            uint8_t reg = 0;
+            if (!read(reader, reg)) {
+                return false;
+            }
+            ra_reg = reg;
+        } else if (!read_uleb128(reader, ra_reg)) {
+            return false;
+        }
+        if (ra_reg >= REG_CNT) {
+            return false;
+        }
+        fde.ra_reg = static_cast<uint32_t>(ra_reg);
+        fde.encoding = PE_ABSPTR;
+        fde.signal_frame = false;
+
+        augmented = (augmentation[0] == 'z');
+        if (augmented) {
+            uint64_t size = 0;
+            if (!read_uleb128(reader, size) || size > static_cast<size_t>(reader.end - reader.pos)) {
+                return false;
+            }
+            reader_t data = {reader.pos, reader.pos + size};
+            for (const char *c = augmentation + 1; *c != '\0'; c++) {
+                uint8_t encoding = 0;
+                uintptr_t personality = 0;
+                if (*c == 'L') {
+                    read(data, encoding);
+                } else if (*c == 'P') {
+                    if (!read(data, encoding) || !read_encoded(data, encoding & ~PE_INDIRECT, 0, personality)) {
+                        break;
+                    }
+                } else if (*c == 'R') {
+                    if (!read(data, fde.encoding)) {
+                        return false;
+                    }
+                } else if (*c == 'S') {
+                    fde.signal_frame = true;
+                } else if (*c != 'B' && *c != 'G') {
+                    // the rest of the data can't be interpreted, but is skipped all the same
+                    break;
+                }
+            }
+            reader.pos = data.end;
+        } else if (augmentation[0] != '\0') {
+            return false;
+        }
+
+        fde.cie_instructions = reader.pos;
+        fde.cie_instructions_end = reader.end;
+        return true;
+    }
+
+    /**
+     * Decode the FDE at an address, and the CIE it references
+     */
+    static bool parse_fde(const modules::module_t *module, const uint8_t *address, fde_t &fde) {
+        if (reinterpret_cast<uintptr_t>(address) < module->start || reinterpret_cast<uintptr_t>(address) >= module->end) {
+            return false;
+        }
+
+        reader_t reader = {address, reinterpret_cast<const uint8_t *>(module->end)};
+        uint32_t length = 0;
+        if (!read(reader, length) || length == 0 || length == 0xffffffff ||
+            length > static_cast<size_t>(reader.end - reader.pos)) {
+            return false;
+        }
+        reader.end = reader.pos + length;
+
+        const uint8_t *id_address = reader.pos;
+        uint32_t cie_offset = 0;
+        if (!read(reader, cie_offset) || cie_offset == 0 ||
+            cie_offset > static_cast<uintptr_t>(id_address - reinterpret_cast<const uint8_t *>(module->start))) {
+            return false;
+        }
+
+        bool augmented = false;
+        if (!parse_cie(module, id_address - cie_offset, fde, augmented)) {
+            return false;
+        }
+
+        uintptr_t pc_range = 0;
+        if (!read_encoded(reader, fde.encoding, 0, fde.pc_begin) ||
+            !read_encoded(reader, fde.encoding & 0x0f, 0, pc_range)) {
+            return false;
+        }
+        fde.pc_end = fde.pc_begin + pc_range;
+
+        if (augmented) {
+            uint64_t size = 0;
+            if (!read_uleb128(reader, size) || size > static_cast<size_t>(reader.end - reader.pos)) {
+                return false;
+            }
+            reader.pos += size;
+        }
+
+        fde.instructions = reader.pos;
+        fde.instructions_end = reader.end;
+        return true;
+    }
+
+    /**
+     * Binary search a module's .eh_frame_hdr table for the FDE covering a pc
+     */
+    static bool search(const modules::module_t *module, uintptr_t pc, fde_t &fde) {
+        const uint8_t *hdr = module->eh_frame_hdr;
+        if (hdr == nullptr) {
+            return false;
+        }
+
+        reader_t reader = {hdr, hdr + module->eh_frame_hdr_size};
+        uint8_t version = 0;
+        uint8_t eh_frame_encoding = 0;
+        uint8_t count_encoding = 0;
+        uint8_t table_encoding = 0;
+        uintptr_t eh_frame = 0;
+        uintptr_t count = 0;
+        uintptr_t data_base = reinterpret_cast<uintptr_t>(hdr);
+        if (!read(reader, version) || version != 1 || !read(reader, eh_frame_encoding) ||
+            !read(reader, count_encoding) || !read(reader, table_encoding) ||
+            !read_encoded(reader, eh_frame_encoding, data_base, eh_frame) ||
+            !read_encoded(reader, count_encoding, data_base, count)) {
+            return false;
+        }
+
+        // linkers always emit the sorted table as pairs of datarel sdata4 offsets
+        static const size_t ENTRY_SIZE = 2 * sizeof(int32_t);
+        if (table_encoding != (PE_DATAREL | PE_SDATA4) || count == 0 ||
+            count > static_cast<size_t>(reader.end - reader.pos) / ENTRY_SIZE) {
+            return false;
+        }
+        const uint8_t *table = reader.pos;
+
+        // the last entry starting at or below the pc
+        size_t lo = 0;
+        size_t hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            int32_t start = 0;
+            std::memcpy(&start, table + mid * ENTRY_SIZE, sizeof(start));
+            if (data_base + static_cast<intptr_t>(start) <= pc) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == 0) {
+            return false;
+        }
+
+        int32_t offset = 0;
+        std::memcpy(&offset, table + (lo - 1) * ENTRY_SIZE + sizeof(int32_t), sizeof(offset));
+        const uint8_t *address = reinterpret_cast<const uint8_t *>(data_base + static_cast<intptr_t>(offset));
+
+        return parse_fde(module, address, fde) && pc >= fde.pc_begin && pc < fde.pc_end;
+    }
+
+    static void set_rule(row_t &row, uint64_t reg, uint8_t type, intptr_t value) {
+        // rules for registers that never hold addresses (vector, flags) are not tracked
+        if (reg < REG_CNT) {
+            row.rules[reg].type = type;
+            row.rules[reg].value = value;
+        }
+    }
+
+    /**
+     * Skip an instruction's expression block, returning its address
+     */
+    static bool read_block(reader_t &reader, const uint8_t *&expression) {
+        expression = reader.pos;
+        uint64_t length = 0;
+        if (!read_uleb128(reader, length) || length > static_cast<size_t>(reader.end - reader.pos)) {
+            return false;
+        }
+        reader.pos += length;
+        return true;
+    }
+
+    /**
+     * Run call frame instructions up to the row covering a pc
+     *
+     * @param initial the row the CIE's instructions produced, restored by DW_CFA_restore
+     * @param pc_begin, pc_end set to the pcs the row covers
+     */
+    static bool execute(const uint8_t *instructions, const uint8_t *end, const fde_t &fde, uintptr_t pc,
+                        row_t &row, const row_t *initial, uintptr_t &pc_begin, uintptr_t &pc_end) {
+        row_t remembered[STATE_STACK_MAX];
+        size_t remembered_cnt = 0;
+        uintptr_t loc = fde.pc_begin;
+        reader_t reader = {instructions, end};
+
+        pc_begin = fde.pc_begin;
+        pc_end = fde.pc_end;
+
+        while (reader.pos < reader.end) {
+            uint8_t op = *reader.pos++;
+            uint8_t operand = op & 0x3f;
+            uint64_t reg = 0;
+            uint64_t uoffset = 0;
+            int64_t soffset = 0;
+            uintptr_t delta = 0;
+            const uint8_t *expression = nullptr;
+
+            switch (op & 0xc0) {
+                case CFA_ADVANCE_LOC:
+                    delta = operand;
+                    break;
+                case CFA_OFFSET:
+                    if (!read_uleb128(reader, uoffset)) {
+                        return false;
+                    }
+                    set_rule(row, operand, RULE_OFFSET, static_cast<intptr_t>(uoffset) * fde.data_align);
+                    continue;
+                case CFA_RESTORE:
+                    if (operand < REG_CNT) {
+                        row.rules[operand] = (initial != nullptr) ? initial->rules[operand] : rule_t{RULE_SAME, 0};
+                    }
+                    continue;
+                default:
+                    break;
+            }
+
+            if ((op & 0xc0) == 0) {
+                switch (op) {
+                    case CFA_NOP:
+                    case CFA_NEGATE_RA_STATE:       // return addresses are stripped whether signed or not
+                        continue;
+                    case CFA_SET_LOC: {
+                        uintptr_t address = 0;
+                        if (!read_encoded(reader, fde.encoding, 0, address)) {
+                            return false;
+                        }
+                        if (address > pc) {
+                            pc_end = address;
+                            return true;
+                        }
+                        loc = pc_begin = address;
+                        continue;
+                    }
+                    case CFA_ADVANCE_LOC1: {
+                        uint8_t raw = 0;
+                        if (!read(reader, raw)) {
+                            return false;
+                        }
+                        delta = raw;
+                        break;
+                    }
+                    case CFA_ADVANCE_LOC2: {
+                        uint16_t raw = 0;
+                        if (!read(reader, raw)) {
+                            return false;
+                        }
+                        delta = raw;
+                        break;
+                    }
+                    case CFA_ADVANCE_LOC4: {
+                        uint32_t raw = 0;
+                        if (!read(reader, raw)) {
+                            return false;
+                        }
+                        delta = raw;
+                        break;
+                    }
+                    case CFA_OFFSET_EXTENDED:
+                    case CFA_VAL_OFFSET:
+                    case CFA_GNU_NEGATIVE_OFFSET_EXTENDED:
+                        if (!read_uleb128(reader, reg) || !read_uleb128(reader, uoffset)) {
+                            return false;
+                        }
+                        soffset = static_cast<intptr_t>(uoffset) * fde.data_align;
+                        if (op == CFA_GNU_NEGATIVE_OFFSET_EXTENDED) {
+                            soffset = -soffset;
+                        }
+                        set_rule(row, reg, (op == CFA_VAL_OFFSET) ? RULE_VAL_OFFSET : RULE_OFFSET,
+                                 static_cast<intptr_t>(soffset));
+                        continue;
+                    case CFA_OFFSET_EXTENDED_SF:
+                    case CFA_VAL_OFFSET_SF:
+                        if (!read_uleb128(reader, reg) || !read_sleb128(reader, soffset)) {
+                            return false;
+                        }
+                        set_rule(row, reg, (op == CFA_VAL_OFFSET_SF) ? RULE_VAL_OFFSET : RULE_OFFSET,
+                                 static_cast<intptr_t>(soffset * fde.data_align));
+                        continue;
+                    case CFA_RESTORE_EXTENDED:
+                        if (!read_uleb128(reader, reg)) {
+                            return false;
+                        }
+                        if (reg < REG_CNT) {
+                            row.rules[reg] = (initial != nullptr) ? initial->rules[reg] : rule_t{RULE_SAME, 0};
+                        }
+                        continue;
+                    case CFA_UNDEFINED:
+                    case CFA_SAME_VALUE:
+                        if (!read_uleb128(reader, reg)) {
+                            return false;
+                        }
+                        set_rule(row, reg, (op == CFA_UNDEFINED) ? RULE_UNDEFINED : RULE_SAME, 0);
+                        continue;
+                    case CFA_REGISTER:
+                        if (!read_uleb128(reader, reg) || !read_uleb128(reader, uoffset)) {
+                            return false;
+                        }
+                        set_rule(row, reg, RULE_REGISTER, static_cast<intptr_t>(uoffset));
+                        continue;
+                    case CFA_REMEMBER_STATE:
+                        if (remembered_cnt >= STATE_STACK_MAX) {
+                            return false;
+                        }
+                        remembered[remembered_cnt++] = row;
+                        continue;
+                    case CFA_RESTORE_STATE:
+                        if (remembered_cnt == 0) {
+                            return false;
+                        }
+                        row = remembered[--remembered_cnt];
+                        continue;
+                    case CFA_DEF_CFA:
+                        if (!read_uleb128(reader, reg) || !read_uleb128(reader, uoffset)) {
+                            return false;
+                        }
+                        row.cfa_reg = static_cast<uint32_t>(reg);
+                        row.cfa_offset = static_cast<intptr_t>(uoffset);
+                        row.cfa_expression = nullptr;
+                        continue;
+                    case CFA_DEF_CFA_SF:
+                        if (!read_uleb128(reader, reg) || !read_sleb128(reader, soffset)) {
+                            return false;
+                        }
+                        row.cfa_reg = static_cast<uint32_t>(reg);
+                        row.cfa_offset = static_cast<intptr_t>(soffset * fde.data_align);
+                        row.cfa_expression = nullptr;
+                        continue;
+                    case CFA_DEF_CFA_REGISTER:
+                        if (!read_uleb128(reader, reg)) {
+                            return false;
+                        }
+                        row.cfa_reg = static_cast<uint32_t>(reg);
+                        row.cfa_expression = nullptr;
+                        continue;
+                    case CFA_DEF_CFA_OFFSET:
+                        if (!read_uleb128(reader, uoffset)) {
+                            return false;
+                        }
+                        row.cfa_offset = static_cast<intptr_t>(uoffset);
+                        continue;
+                    case CFA_DEF_CFA_OFFSET_SF:
+                        if (!read_sleb128(reader, soffset)) {
+                            return false;
+                        }
+                        row.cfa_offset = static_cast<intptr_t>(soffset * fde.data_align);
+                        continue;
+                    case CFA_DEF_CFA_EXPRESSION:
+                        if (!read_block(reader, expression)) {
+                            return false;
+                        }
+                        row.cfa_expression = expression;
+                        continue;
+                    case CFA_EXPRESSION:
+                    case CFA_VAL_EXPRESSION:
+                        if (!read_uleb128(reader, reg) || !read_block(reader, expression)) {
+                            return false;
+                        }
+                        set_rule(row, reg, (op == CFA_EXPRESSION) ? RULE_EXPRESSION : RULE_VAL_EXPRESSION,
+                                 reinterpret_cast<intptr_t>(expression));
+                        continue;
+                    case CFA_GNU_ARGS_SIZE:
+                        if (!read_uleb128(reader, uoffset)) {
+                            return false;
+                        }
+                        continue;
+                    default:
+                        return false;
+                }
+            }
+
+            // the rows past the pc don't apply to it
+            loc += delta * fde.code_align;
+            if (loc > pc) {
+                pc_end = loc;
+                return true;
+            }
+            pc_begin = loc;
+        }
+
+        return true;
+    }
+
+    /**
+     * Keep a row's CFA rule and the rules of the registers it restores
+     */
+    static bool compact(const row_t &row, const fde_t &fde, rules_t &rules) {
+        rules.cfa_reg = row.cfa_reg;
+        rules.cfa_offset = row.cfa_offset;
+        rules.cfa_expression = row.cfa_expression;
+        rules.ra_reg = fde.ra_reg;
+        rules.signal_frame = fde.signal_frame;
+        rules.reg_cnt = 0;
+
+        for (size_t reg = 0; reg < REG_CNT; reg++) {
+            if (row.rules[reg].type == RULE_SAME) {
+                continue;
+            }
+            if (rules.reg_cnt >= RULES_MAX) {
+                return false;
+            }
+            reg_rule_t &rule = rules.regs[rules.reg_cnt++];
+            rule.reg = static_cast<uint8_t>(reg);
+            rule.type = row.rules[reg].type;
+            rule.value = row.rules[reg].value;
+        }
+        return true;
+    }
+
+    /**
+     * Decode the row covering a pc from the module's CFI
+     */
+    static bool decode(const modules::module_t *module, uintptr_t pc, rules_t &rules) {
+        fde_t fde;
+        if (!search(module, pc, fde)) {
+            return false;
+        }
+
+        uintptr_t cie_begin = 0;
+        uintptr_t cie_end = 0;
+        row_t initial = {};
+        if (!execute(fde.cie_instructions, fde.cie_instructions_end, fde, pc, initial, nullptr, cie_begin, cie_end)) {
+            return false;
+        }
+        row_t row = initial;
+        if (!execute(fde.instructions, fde.instructions_end, fde, pc, row, &initial, rules.pc_begin, rules.pc_end)) {
+            return false;
+        }
+
+        return compact(row, fde, rules);
+    }
+
+    static size_t cache_slot(uintptr_t pc) {
+        uint64_t hash = static_cast<uint64_t>(pc) * 0x9e3779b97f4a7c15ull;
+        return static_cast<size_t>(hash >> 32) % CACHE_SIZE;
+    }
+
+    /**
+     * Find the row covering a pc, in the cache or else decoded from the module's CFI
+     */
+    static bool find_rules(const modules::module_t *module, uintptr_t pc, rules_t &rules) {
+        cached_rules_t &entry = rules_cache[cache_slot(pc)];
+
+        uint32_t sequence = entry.sequence.load(std::memory_order_acquire);
+        if ((sequence & 1) == 0) {
+            const modules::module_t *cached_module = entry.module;
+            std::memcpy(&rules, &entry.rules, offsetof(rules_t, regs));
+            if (rules.reg_cnt <= RULES_MAX) {
+                std::memcpy(rules.regs, entry.rules.regs, rules.reg_cnt * sizeof(reg_rule_t));
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // a module rebuilt by a refresh is a new module_t, so stale entries never match
+            if (entry.sequence.load(std::memory_order_relaxed) == sequence && cached_module == module &&
+                pc >= rules.pc_begin && pc < rules.pc_end) {
+                return true;
+            }
+        }
+
+        if (!decode(module, pc, rules)) {
+            return false;
+        }
+
+        // another writer holds the entry: leave it to them
+        if ((sequence & 1) == 0 &&
+            entry.sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire)) {
+            entry.module = module;
+            entry.rules = rules;
+            entry.sequence.store(sequence + 2, std::memory_order_release);
+        }
+        return true;
+    }
+
+    /**
+     * Seed the cursor's registers from the general registers saved in a signal frame
+     */
+    static void load_registers(cursor_t &cursor, const uintptr_t *saved) {
+#if defined(__aarch64__)
+        for (size_t i = 0; i < REG_CNT; i++) {
+            cursor.regs[i] = saved[i];
+        }
+        cursor.pc = saved[REG_CNT];
+#elif defined(__x86_64__)
+        for (size_t i = 0; i < sizeof(GREGS) / sizeof(GREGS[0]); i++) {
+            cursor.regs[i] = saved[GREGS[i]];
+        }
+        cursor.pc = saved[REG_RIP];
+        cursor.regs[DWARF_RA] = cursor.pc;
+#elif defined(__i386__)
+        for (size_t i = 0; i < sizeof(GREGS) / sizeof(GREGS[0]); i++) {
+            cursor.regs[i] = saved[GREGS[i]];
+        }
+        cursor.pc = saved[REG_EIP];
+        cursor.regs[DWARF_RA] = cursor.pc;
+#endif
+        cursor.valid = ALL_REGS;
+        cursor.signal_frame = true;
+    }
+
+    /**
+     * Recognize the kernel's sigreturn trampoline: a signal handler returns into it, with the
+     * interrupted context saved above the stack pointer
+     *
+     * @return the address of the saved ucontext_t, or 0
+     */
+    static uintptr_t sigreturn_context(const cursor_t &cursor) {
+        uintptr_t sp = cursor.regs[DWARF_SP];
+#if defined(__aarch64__)
+        // mov x8, #__NR_rt_sigreturn; svc #0
+        static const uint32_t TRAMPOLINE[] = {0xd2801168, 0xd4000001};
+        uint32_t code[2] = {};
+        if (read_memory(cursor, cursor.pc, code, sizeof(code)) && std::memcmp(code, TRAMPOLINE, sizeof(code)) == 0) {
+            return sp + sizeof(siginfo_t);
+        }
+#elif defined(__x86_64__)
+        // mov $__NR_rt_sigreturn, %rax (glibc) or %eax (bionic); syscall
+        static const uint8_t TRAMPOLINE_RAX[] = {0x48, 0xc7, 0xc0, 0x0f, 0x00, 0x00, 0x00, 0x0f, 0x05};
+        static const uint8_t TRAMPOLINE_EAX[] = {0xb8, 0x0f, 0x00, 0x00, 0x00, 0x0f, 0x05};
+        uint8_t code[sizeof(TRAMPOLINE_RAX)] = {};
+        if (read_memory(cursor, cursor.pc, code, sizeof(code)) &&
+            (std::memcmp(code, TRAMPOLINE_RAX, sizeof(TRAMPOLINE_RAX)) == 0 ||
+             std::memcmp(code, TRAMPOLINE_EAX, sizeof(TRAMPOLINE_EAX)) == 0)) {
+            return sp;
+        }
+#elif defined(__i386__)
+        // mov $__NR_rt_sigreturn, %eax; int $0x80, with the signal number, siginfo and
+        // ucontext pointers above the stack pointer
+        static const uint8_t TRAMPOLINE[] = {0xb8, 0xad, 0x00, 0x00, 0x00, 0xcd, 0x80};
+        uint8_t code[sizeof(TRAMPOLINE)] = {};
+        uintptr_t ucontext = 0;
+        if (read_memory(cursor, cursor.pc, code, sizeof(code)) && std::memcmp(code, TRAMPOLINE, sizeof(code)) == 0 &&
+            read_word(cursor, sp + 2 * sizeof(uintptr_t), ucontext)) {
+            return ucontext;
+        }
+#endif
+        return 0;
+    }
+
+    /**
+     * Step into the context a signal interrupted, saved by the kernel
+     */
+    static bool step_sigreturn(cursor_t &cursor, uintptr_t ucontext) {
+        uintptr_t saved[SAVED_CNT];
+        if (!read_memory(cursor, ucontext + SAVED_OFFSET, saved, sizeof(saved))) {
+            return false;
+        }
+        load_registers(cursor, saved);
+        return cursor.pc != 0;
+    }
+
+    /**
+     * Step out of an interrupted frame no CFI covers, assuming it's at a function's entry
+     * (a call through a bad function pointer): nothing has been pushed but the return address
+     */
+    static bool step_entry(cursor_t &cursor) {
+#if defined(__aarch64__)
+        cursor.pc = strip_pac(cursor.regs[30]);
+#else
+        uintptr_t sp = cursor.regs[DWARF_SP];
+        if (!read_word(cursor, sp, cursor.pc)) {
+            return false;
+        }
+        cursor.regs[DWARF_SP] = sp + sizeof(uintptr_t);
+        cursor.regs[DWARF_RA] = cursor.pc;
+#endif
+        cursor.signal_frame = false;
+        return cursor.pc != 0 && modules::find(cursor.pc - 1) != nullptr;
+    }
+
+    /**
+     * Apply a row's rules to step the cursor into the caller's frame
+     */
+    static bool apply(cursor_t &cursor, const rules_t &rules) {
+        uintptr_t cfa = 0;
+        if (rules.cfa_expression != nullptr) {
+            if (!evaluate(cursor, rules.cfa_expression, false, 0, cfa)) {
+                return false;
+            }
+        } else {
+            if (rules.cfa_reg >= REG_CNT || (cursor.valid & (1ull << rules.cfa_reg)) == 0) {
+                return false;
+            }
+            cfa = cursor.regs[rules.cfa_reg] + rules.cfa_offset;
+        }
+
+        // every rule reads the callee's registers
+        uintptr_t regs[REG_CNT];
+        uint64_t valid = cursor.valid;
+        bool sp_restored = false;
+        std::memcpy(regs, cursor.regs, sizeof(regs));
+        for (size_t i = 0; i < rules.reg_cnt; i++) {
+            const reg_rule_t &rule = rules.regs[i];
+            uint64_t bit = 1ull << rule.reg;
+            uintptr_t address = 0;
+            sp_restored |= (rule.reg == DWARF_SP);
+
+            switch (rule.type) {
+                case RULE_UNDEFINED:
+                    valid &= ~bit;
+                    break;
+                case RULE_OFFSET:
+                    if (!read_word(cursor, cfa + rule.value, regs[rule.reg])) {
+                        return false;
+                    }
+                    valid |= bit;
+                    break;
+                case RULE_VAL_OFFSET:
+                    regs[rule.reg] = cfa + rule.value;
+                    valid |= bit;
+                    break;
+                case RULE_REGISTER:
+                    if (rule.value < 0 || static_cast<size_t>(rule.value) >= REG_CNT ||
+                        (cursor.valid & (1ull << rule.value)) == 0) {
+                        valid &= ~bit;
+                    } else {
+                        regs[rule.reg] = cursor.regs[rule.value];
+                        valid |= bit;
+                    }
+                    break;
+                case RULE_EXPRESSION:
+                    if (!evaluate(cursor, reinterpret_cast<const uint8_t *>(rule.value), true, cfa, address) ||
+                        !read_word(cursor, address, regs[rule.reg])) {
+                        return false;
+                    }
+                    valid |= bit;
+                    break;
+                case RULE_VAL_EXPRESSION:
+                    if (!evaluate(cursor, reinterpret_cast<const uint8_t *>(rule.value), true, cfa, regs[rule.reg])) {
+                        return false;
+                    }
+                    valid |= bit;
+                    break;
+                default:
+                    return false;
+            }
+        }
+
+        // the caller's sp is the CFA, unless a rule says otherwise
+        if (!sp_restored) {
+            regs[DWARF_SP] = cfa;
+            valid |= (1ull << DWARF_SP);
+        }
+
+        // an undefined return address marks the outermost frame
+        if ((valid & (1ull << rules.ra_reg)) == 0) {
+            return false;
+        }
+        uintptr_t pc = strip_pac(regs[rules.ra_reg]);
+
+        // stacks grow down: a caller's frame is never below its callee's, and a frame that
+        // returns to itself would never end
+        uintptr_t sp = cursor.regs[DWARF_SP];
+        if (pc == 0 || regs[DWARF_SP] < sp || (regs[DWARF_SP] == sp && pc == cursor.pc)) {
+            return false;
+        }
+
+        std::memcpy(cursor.regs, regs, sizeof(regs));
+        cursor.valid = valid;
+        cursor.pc = pc;
+        cursor.signal_frame = rules.signal_frame;
+        return true;
+    }
+
+#endif  // CFI_SUPPORTED
+
+    bool init(cursor_t &cursor, const ucontext_t *ucontext) {
+#if defined(CFI_SUPPORTED)
+        if (ucontext == nullptr || !modules::available()) {
+            return false;
+        }
+
+        std::memset(&cursor, 0, sizeof(cursor));
+        if (!get_stack_bounds(cursor.stack_lo, cursor.stack_hi)) {
+            cursor.stack_lo = cursor.stack_hi = 0;
+        }
+
+        uintptr_t saved[SAVED_CNT];
+        std::memcpy(saved, reinterpret_cast<const uint8_t *>(ucontext) + SAVED_OFFSET, sizeof(saved));
+        load_registers(cursor, saved);
+        return true;
+#else
+        (void) cursor;
+        (void) ucontext;
+        return false;
+#endif
+    }
+
+    bool step(cursor_t &cursor) {
+#if defined(CFI_SUPPORTED)
+        // a return address may be the first byte past its call's function: look up the call
+        uintptr_t pc = cursor.signal_frame ? cursor.pc : cursor.pc - 1;
+        const modules::module_t *module = modules::find(pc);
+
+        rules_t rules;
+        if (module == nullptr || !find_rules(module, pc, rules)) {
+            uintptr_t ucontext = sigreturn_context(cursor);
+            if (ucontext != 0) {
+                return step_sigreturn(cursor, ucontext);
+            }
+            if (cursor.signal_frame && step_entry(cursor)) {
+                return true;
+            }
+            cursor.unindexed = (module == nullptr);
+            return false;
+        }
+
+        // a trampoline's CFI may not describe every register the kernel saved
+        if (rules.signal_frame) {
+            uintptr_t ucontext = sigreturn_context(cursor);
+            if (ucontext != 0) {
+                return step_sigreturn(cursor, ucontext);
+            }
+        }
+
+        return apply(cursor, rules);
+#else
+        (void) cursor;
+        return false;
+#endif
+    }
+
+    void flush() {
+#if defined(CFI_SUPPORTED)
+        for (size_t i = 0; i < CACHE_SIZE; i++) {
+            cached_rules_t &entry = rules_cache[i];
+            uint32_t sequence = entry.sequence.load(std::memory_order_acquire);
+            if ((sequence & 1) == 0 &&
+                entry.sequence.compare_exchange_strong(sequence, sequence + 1, std::memory_order_acquire)) {
+                entry.module = nullptr;
+                entry.sequence.store(sequence + 2, std::memory_order_release);
+            }
+        }
+#endif
+    }
+
+}   // namespace cfi
@@ -0,0 +1,81 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_CFI_UNWINDER_H
+#define _AGENT_NDK_CFI_UNWINDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/ucontext.h>
+
+#include <agent-ndk.h>
+
+/**
+ * DWARF CFI unwinder seeded from a signal context
+ *
+ * Steps from the interrupted registers, rather than from the handler's own frame as
+ * _Unwind_Backtrace does, so the frames unwound are exactly the interrupted thread's,
+ * including a crashing leaf with no CFI of its own and the frames beneath nested signal
+ * handlers (the kernel's sigreturn trampolines are recognized and their saved contexts
+ * restored).
+ *
+ * FDEs are found with a binary search of each module's mapped .eh_frame_hdr table, through
+ * the module index. The table rows decoded from an FDE and its CIE are kept, compacted to
+ * the registers they restore, in a direct-mapped cache shared by every thread and capture
+ * and validated against the module index on each hit: repeated captures of hot stacks skip
+ * the search, the CIE parse and the instructions. Everything here is async-signal-safe.
+ *
+ * Supported on aarch64, x86_64 and x86. 32-bit ARM unwinds with .ARM.exidx, not .eh_frame:
+ * init() fails there, and callers fall back to _Unwind_Backtrace.
+ */
+namespace cfi {
+
+#if defined(__aarch64__)
+    static const size_t REG_CNT = 32;       // x0-x30, sp
+#elif defined(__x86_64__)
+    static const size_t REG_CNT = 17;       // rax, rdx, rcx, rbx, rsi, rdi, rbp, rsp, r8-r15, return address
+#elif defined(__i386__)
+    static const size_t REG_CNT = 9;        // eax, ecx, edx, ebx, esp, ebp, esi, edi, return address
+#else
+    static const size_t REG_CNT = 1;
+#endif
+
+    /**
+     * Registers of the frame being unwound, by DWARF register number
+     */
+    typedef struct cursor {
+        uintptr_t regs[REG_CNT];
+        uint64_t valid;             // bit per register whose value is known
+        uintptr_t pc;
+        bool signal_frame;          // pc is where execution was interrupted, not a return address
+        bool unindexed;             // the walk stopped at a pc in no indexed module
+        uintptr_t stack_lo;         // the calling thread's stack, read without a syscall
+        uintptr_t stack_hi;
+
+    } cursor_t;
+
+    /**
+     * Seed a cursor from a signal context
+     *
+     * @return false if the architecture isn't supported or the module index isn't built
+     */
+    bool init(cursor_t &, const ucontext_t *);
+
+    /**
+     * Step to the caller of the cursor's frame
+     *
+     * @return false at the outermost frame, or if the frame can't be unwound. A frame in no
+     * indexed module (a library loaded after the index was built) also sets the cursor's unindexed.
+     */
+    bool step(cursor_t &);
+
+    /**
+     * Drop every cached FDE. Called when the module index is released.
+     */
+    void flush();
+
+}   // namespace cfi
+
+#endif // _AGENT_NDK_CFI_UNWINDER_H
@@ -0,0 +1,94 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "jni/native-context.h"
+#include "procfs.h"
+#include "writer.h"
+#include "emitter.h"
+#include "context-snapshot.h"
+
+namespace context {
+
+    static std::atomic<const snapshot_t *> current(nullptr);
+    static std::atomic<int> readers(0);
+
+    static pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static std::vector<const snapshot_t *> retired;     // replaced, waiting for no readers
+
+    /**
+     * Render the snapshot's members as they are emitted in a report
+     */
+    static void render(snapshot_t &snapshot) {
+        writer_t writer = {};
+        writer::to_buffer(writer, snapshot.json, sizeof(snapshot.json));
+
+        emit_process_name(snapshot.process_name, writer);
+        snapshot.json_name_len = writer.length;
+        emit_process_context(snapshot.arch, snapshot.pid, snapshot.ppid, snapshot.uid,
+                             snapshot.build_id, snapshot.session_id, writer);
+        snapshot.json_len = writer::ok(writer) ? writer.length : 0;
+    }
+
+    bool publish() {
+        snapshot_t *snapshot = new(std::nothrow) snapshot_t();
+        if (snapshot == nullptr) {
+            _LOGE("context: could not allocate a snapshot");
+            return false;
+        }
+
+        jni::native_context_t &native_context = jni::get_native_context();
+        snapshot->pid = getpid();
+        snapshot->ppid = getppid();
+        snapshot->uid = getuid();
+        strncpy(snapshot->arch, get_arch(), sizeof(snapshot->arch) - 1);
+        procfs::read_process_name(snapshot->pid, snapshot->process_name, sizeof(snapshot->process_name));
+        strncpy(snapshot->build_id, native_context.buildId, sizeof(snapshot->build_id) - 1);
+        strncpy(snapshot->session_id, native_context.sessionId, sizeof(snapshot->session_id) - 1);
+        render(*snapshot);
+
+        pthread_mutex_lock(&publish_mutex);
+        const snapshot_t *replaced = current.exchange(snapshot);
+        if (replaced != nullptr) {
+            retired.push_back(replaced);
+        }
+
+        // a reader counted now may hold any retired snapshot, but not one retired after this
+        if (readers.load() == 0) {
+            for (auto retiree: retired) {
+                delete retiree;
+            }
+            retired.clear();
+        }
+        pthread_mutex_unlock(&publish_mutex);
+
+        return true;
+    }
+
+    const snapshot_t *acquire(pid_t pid) {
+        readers.fetch_add(1);
+        const snapshot_t *snapshot = current.load();
+        if (snapshot == nullptr || snapshot->pid != pid) {
+            readers.fetch_sub(1);
+            return nullptr;
+        }
+
+        return snapshot;
+    }
+
+    void release(const snapshot_t *snapshot) {
+        if (snapshot != nullptr) {
+            readers.fetch_sub(1);
+        }
+    }
+
+}   // namespace context
@@ -0,0 +1,65 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_CONTEXT_SNAPSHOT_H
+#define _AGENT_NDK_CONTEXT_SNAPSHOT_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Report context snapshots
+ *
+ * The parts of a report's context that don't change while the process runs (its name, abi,
+ * ids, build and session) are captured when the managed context is set, rather than read at
+ * crash time. Each update builds a new snapshot, and publishes it with a single pointer swap:
+ * a published snapshot is never written again, so a crashing thread reads a consistent one
+ * without a lock, while the context is being updated on another thread.
+ *
+ * A snapshot also holds its members pre-rendered as report JSON, which the emitter copies.
+ * Replaced snapshots are freed by a later update, once no thread holds one.
+ */
+namespace context {
+
+    typedef struct snapshot {
+        int pid;
+        int ppid;
+        int uid;
+        char arch[16];
+        char process_name[PATH_MAX];
+        char build_id[40];
+        char session_id[40];
+
+        // the "name" member, then the members that follow the report's timestamp
+        char json[PATH_MAX + 512];
+        size_t json_name_len;
+        size_t json_len;            // 0 if the members didn't fit
+
+    } snapshot_t;
+
+    /**
+     * Capture the process and native context in a new snapshot, and publish it
+     *
+     * @return false if the snapshot could not be allocated
+     */
+    bool publish();
+
+    /**
+     * Take the current snapshot. Async-signal-safe and lock-free.
+     *
+     * @param pid the process the snapshot must describe: a forked process holds its parent's
+     * @return the snapshot, or null if none has been published for the process
+     */
+    const snapshot_t *acquire(pid_t pid);
+
+    /**
+     * Return a snapshot taken with acquire(). Async-signal-safe.
+     */
+    void release(const snapshot_t *);
+
+}   // namespace context
+
+#endif // _AGENT_NDK_CONTEXT_SNAPSHOT_H
@@ -0,0 +1,449 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <elf.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <cstring>
+
+#include <agent-ndk.h>
+#include "arena.h"
+#include "backtrace.h"
+#include "procfs.h"
+#include "record.h"
+#include "serializer.h"
+#include "signal-utils.h"
+#include "unwinder.h"
+#include "jni/native-context.h"
+#include "crash-helper.h"
+
+namespace helper {
+
+    static const int HANDOFF_IDLE = 0;
+    static const int HANDOFF_CLAIMED = 1;       // a crashing thread is filling in the handoff
+    static const int HANDOFF_REQUESTED = 2;     // the helper owns the handoff
+    static const int HANDOFF_DONE = 3;
+    static const int HANDOFF_FAILED = 4;
+
+    static const uint64_t NSEC_PER_MSEC = 1000000ULL;
+    static const uint64_t NSEC_PER_SEC = 1000000000ULL;
+
+    // how often an idle helper checks that the app is still alive
+    static const uint64_t HELPER_POLL_NS = NSEC_PER_SEC;
+
+    // signals whose app handlers the helper must not inherit
+    static const int crash_signals[] = {SIGILL, SIGTRAP, SIGABRT, SIGFPE, SIGBUS, SIGSEGV};
+
+    /**
+     * State passed from the crashing process, in a mapping shared with the helper.
+     * Holds no pointers: the helper cannot follow them.
+     */
+    typedef struct handoff {
+        int state;                  // futex word: HANDOFF_*
+        pid_t pid;
+        pid_t ppid;
+        uid_t uid;
+        pid_t tid;                  // the crashed thread
+        long timestamp;
+        bool has_siginfo;
+        bool has_ucontext;
+        bool all_thread_stacks;
+        char build_id[40];
+        char session_id[40];
+        siginfo_t siginfo;
+        ucontext_t ucontext;
+        backtrace_state_t state_crashed;    // unwound by the crashed thread itself
+
+    } handoff_t;
+
+    static handoff_t *handoff = nullptr;
+    static volatile pid_t helper_pid = 0;
+
+    static uint64_t monotonic_ns() {
+        struct timespec ts = {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * NSEC_PER_SEC + ts.tv_nsec;
+    }
+
+    /**
+     * The futex is shared across processes, so the _PRIVATE operations can't be used
+     */
+    static void futex_wake(int *word) {
+        syscall(SYS_futex, word, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    static void futex_wait(int *word, int expected, uint64_t timeout_ns) {
+        struct timespec ts = {static_cast<time_t>(timeout_ns / NSEC_PER_SEC),
+                              static_cast<long>(timeout_ns % NSEC_PER_SEC)};
+        syscall(SYS_futex, word, FUTEX_WAIT, expected, &ts, nullptr, 0);
+    }
+
+    static int load_state() {
+        return __atomic_load_n(&handoff->state, __ATOMIC_ACQUIRE);
+    }
+
+    static void store_state(int state) {
+        __atomic_store_n(&handoff->state, state, __ATOMIC_RELEASE);
+        futex_wake(&handoff->state);
+    }
+
+    /**
+     * Stop a thread of the crashed process, and wait (to the deadline) for it to stop
+     *
+     * @return true if the thread is stopped and attached
+     */
+    static bool stop_thread(pid_t tid, uint64_t deadline) {
+        if (ptrace(PTRACE_SEIZE, tid, nullptr, nullptr) != 0) {
+            return false;
+        }
+        if (ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr) == 0) {
+            while (monotonic_ns() < deadline) {
+                int status = 0;
+                pid_t waited = waitpid(tid, &status, __WALL | WNOHANG);
+                if (waited == tid && WIFSTOPPED(status)) {
+                    return true;
+                }
+                if (waited == -1 && errno != EINTR) {
+                    break;
+                }
+                usleep(100);
+            }
+        }
+        return false;
+    }
+
+    static bool get_registers(pid_t tid, uintptr_t &pc, uintptr_t &fp) {
+#if defined(__arm__)
+        struct user_regs regs = {};
+#else
+        struct user_regs_struct regs = {};
+#endif
+        struct iovec iov = {&regs, sizeof(regs)};
+        if (ptrace(PTRACE_GETREGSET, tid, reinterpret_cast<void *>(NT_PRSTATUS), &iov) != 0) {
+            return false;
+        }
+
+#if defined(__aarch64__)
+        pc = regs.pc;
+        fp = regs.regs[29];
+#elif defined(__arm__)
+        // ARM and Thumb code don't keep frame records alike, so as in-process (see
+        // unwind_frame_pointers()), r11 isn't followed: the thread is reported by its pc
+        pc = regs.uregs[15];
+        fp = 0;
+#elif defined(__x86_64__)
+        pc = regs.rip;
+        fp = regs.rbp;
+#elif defined(__i386__)
+        pc = regs.eip;
+        fp = regs.ebp;
+#else
+#error "Unknown ABI"
+#endif
+        return true;
+    }
+
+    /**
+     * Walk a stopped thread's frame pointer chain: each frame record holds the caller's
+     * frame pointer, followed by the return address
+     */
+    static void walk_frames(pid_t pid, pid_t tid, backtrace_state_t &state) {
+        uintptr_t pc = 0;
+        uintptr_t fp = 0;
+        if (!get_registers(tid, pc, fp)) {
+            return;
+        }
+
+        state.crash_ip = pc;
+        state.frames[state.frame_cnt++] = pc;
+
+        while (fp != 0 && (fp % sizeof(uintptr_t)) == 0 && state.frame_cnt < BACKTRACE_FRAMES_MAX) {
+            uintptr_t record[2] = {};
+            struct iovec local = {record, sizeof(record)};
+            struct iovec remote = {reinterpret_cast<void *>(fp), sizeof(record)};
+            if (process_vm_readv(pid, &local, 1, &remote, 1, 0) != sizeof(record) || record[1] == 0) {
+                break;
+            }
+
+            uintptr_t ip = record[1];
+#if defined(__aarch64__)
+            ip -= sizeof(u_int32_t);    // as the in-process unwinder reports it
+#elif defined(__arm__)
+            ip &= ~static_cast<uintptr_t>(1);
+#endif
+            state.frames[state.frame_cnt++] = ip;
+
+            // the stack grows down: callers' frames are at higher addresses
+            if (record[0] <= fp) {
+                break;
+            }
+            fp = record[0];
+        }
+    }
+
+    /**
+     * Attach to each of the crashed process' other threads in turn and walk its stack
+     *
+     * @return false if a thread could not be detached
+     */
+    static bool capture_remote_stacks(backtrace_t &backtrace, uint64_t deadline) {
+        bool detached = true;
+
+        for (size_t i = 0; i < backtrace.thread_cnt; i++) {
+            threadinfo_t &thread = backtrace.threads[i];
+            if (thread.crashed) {
+                continue;
+            }
+
+            if (stop_thread(thread.tid, deadline)) {
+                backtrace_state_t *state = arena::alloc_array<backtrace_state_t>(1);
+                if (state != nullptr) {
+                    walk_frames(backtrace.pid, thread.tid, *state);
+                    thread.backtrace_state = (state->frame_cnt > 0) ? state : nullptr;
+                }
+            }
+
+            // a thread that never stopped stays attached until the helper exits
+            if (ptrace(PTRACE_DETACH, thread.tid, nullptr, nullptr) != 0 && errno != ESRCH) {
+                detached = false;
+            }
+        }
+
+        return detached;
+    }
+
+    /**
+     * Assemble and store the crash record, in the helper
+     *
+     * @return true if the record was stored
+     */
+    static bool process_crash(bool &detached) {
+        if (!arena::acquire()) {
+            return false;
+        }
+
+        bool stored = false;
+        backtrace_t *backtrace = arena::alloc_array<backtrace_t>(1);
+        char *buffer = arena::alloc_array<char>(BACKTRACE_SZ_MAX);
+
+        if (backtrace != nullptr && buffer != nullptr) {
+            uint64_t deadline = monotonic_ns() + BACKTRACE_THREADS_TIMEOUT_MS * NSEC_PER_MSEC;
+
+            backtrace->state = handoff->state_crashed;
+            backtrace->state.siginfo = handoff->has_siginfo ? &handoff->siginfo : nullptr;
+            backtrace->state.sa_ucontext = handoff->has_ucontext ? &handoff->ucontext : nullptr;
+
+            std::strncpy(backtrace->arch, get_arch(), sizeof(backtrace->arch) - 1);
+            if (handoff->has_siginfo) {
+                std::strncpy(backtrace->description,
+                             sigutils::get_signal_description(handoff->siginfo.si_signo,
+                                                              handoff->siginfo.si_code),
+                             sizeof(backtrace->description) - 1);
+            }
+            backtrace->timestamp = handoff->timestamp;
+            backtrace->pid = handoff->pid;
+            backtrace->ppid = handoff->ppid;
+            backtrace->uid = handoff->uid;
+
+            // the helper was forked with the snapshot of the process it serves
+            const context::snapshot_t *snapshot = context::acquire(backtrace->pid);
+            if (snapshot != nullptr) {
+                std::memcpy(backtrace->process_name, snapshot->process_name, sizeof(backtrace->process_name));
+            } else {
+                procfs::read_process_name(backtrace->pid, backtrace->process_name,
+                                          sizeof(backtrace->process_name));
+            }
+            context::release(snapshot);
+            std::memcpy(backtrace->build_id, handoff->build_id, sizeof(backtrace->build_id));
+            std::memcpy(backtrace->session_id, handoff->session_id, sizeof(backtrace->session_id));
+
+            backtrace->threads = arena::alloc_array<threadinfo_t>(BACKTRACE_THREADS_MAX);
+            collect_thread_state(*backtrace, handoff->tid);
+            if (handoff->all_thread_stacks) {
+                detached = capture_remote_stacks(*backtrace, deadline);
+            }
+
+            // straight to storage: the helper's copy of the report slots is stale
+            size_t size = record::encode(*backtrace, buffer, BACKTRACE_SZ_MAX);
+            stored = (size > 0) &&
+                     (serializer::coalesce(buffer, size) || serializer::to_storage("rec-crash-", buffer, size));
+        }
+
+        arena::release();
+
+        return stored;
+    }
+
+    static void helper_main(pid_t parent) {
+        for (auto signo: crash_signals) {
+            signal(signo, SIG_DFL);
+        }
+
+        for (;;) {
+            int state = load_state();
+            if (state == HANDOFF_REQUESTED) {
+                bool detached = true;
+                store_state(process_crash(detached) ? HANDOFF_DONE : HANDOFF_FAILED);
+                if (!detached) {
+                    // exiting detaches the threads left stopped
+                    _exit(0);
+                }
+                continue;
+            }
+
+            // the app has gone, without crashing
+            if (getppid() != parent) {
+                _exit(0);
+            }
+            futex_wait(&handoff->state, state, HELPER_POLL_NS);
+        }
+    }
+
+    bool initialize() {
+        if (helper_pid > 0) {
+            return true;
+        }
+
+        void *map = mmap(nullptr, sizeof(handoff_t), PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            _LOGE_POSIX("helper: could not map the handoff");
+            return false;
+        }
+        handoff = static_cast<handoff_t *>(map);
+
+        pid_t parent = getpid();
+        pid_t pid = fork();
+        if (pid == 0) {
+            // the helper is a copy of a multi-threaded process, with only this thread: like a signal
+            // handler, it must not take a lock another thread may have held at the fork. Everything
+            // it runs is async-signal-safe, as the in-process capture is, and it doesn't log.
+            log_disabled = true;
+            arena::reset_after_fork();
+            helper_main(parent);
+            _exit(0);
+        }
+        if (pid == -1) {
+            _LOGE_POSIX("helper: could not fork the crash helper");
+            munmap(map, sizeof(handoff_t));
+            handoff = nullptr;
+            return false;
+        }
+
+        // where Yama restricts ptrace to ancestors, let the helper attach to us
+        if (prctl(PR_SET_PTRACER, pid, 0, 0, 0) != 0 && errno != EINVAL) {
+            _LOGW("helper: could not permit the helper to attach: %s", strerror(errno));
+        }
+
+        helper_pid = pid;
+        _LOGI("Crash helper [%d] started", pid);
+
+        return true;
+    }
+
+    void shutdown() {
+        if (helper_pid > 0) {
+            kill(helper_pid, SIGKILL);
+            waitpid(helper_pid, nullptr, 0);
+            helper_pid = 0;
+        }
+        if (handoff != nullptr) {
+            munmap(handoff, sizeof(handoff_t));
+            handoff = nullptr;
+        }
+    }
+
+    /**
+     * The helper is gone: crashes are captured in-process from now on
+     */
+    static void abandon_helper(pid_t pid) {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        helper_pid = 0;
+    }
+
+    bool request(const siginfo_t *siginfo, const ucontext_t *ucontext) {
+        pid_t pid = helper_pid;
+        if (pid <= 0 || handoff == nullptr) {
+            return false;
+        }
+        if (waitpid(pid, nullptr, WNOHANG) == pid) {
+            helper_pid = 0;
+            return false;
+        }
+
+        // one crash at a time: a second crashing thread captures in-process
+        int expected = HANDOFF_IDLE;
+        if (!__atomic_compare_exchange_n(&handoff->state, &expected, HANDOFF_CLAIMED, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return false;
+        }
+
+        jni::native_context_t &native_context = jni::get_native_context();
+        handoff->pid = getpid();
+        handoff->ppid = getppid();
+        handoff->uid = getuid();
+        handoff->tid = gettid();
+        handoff->timestamp = time(0L);
+        handoff->all_thread_stacks = native_context.allThreadStacksEnabled;
+        const context::snapshot_t *snapshot = context::acquire(handoff->pid);
+        std::strncpy(handoff->build_id, snapshot != nullptr ? snapshot->build_id : native_context.buildId,
+                     sizeof(handoff->build_id) - 1);
+        std::strncpy(handoff->session_id, snapshot != nullptr ? snapshot->session_id : native_context.sessionId,
+                     sizeof(handoff->session_id) - 1);
+        context::release(snapshot);
+
+        handoff->has_siginfo = (siginfo != nullptr);
+        if (siginfo != nullptr) {
+            handoff->siginfo = *siginfo;
+        }
+        handoff->has_ucontext = (ucontext != nullptr);
+        if (ucontext != nullptr) {
+            handoff->ucontext = *ucontext;
+        }
+
+        // the crashed thread's stack can only be unwound from here, and only touches the stack
+        backtrace_state_t &state = handoff->state_crashed;
+        std::memset(&state, 0, sizeof(state));
+        state.sa_ucontext = ucontext;
+        unwind_backtrace(state);
+        state.sa_ucontext = nullptr;
+
+        store_state(HANDOFF_REQUESTED);
+
+        uint64_t deadline = monotonic_ns() + BACKTRACE_HELPER_TIMEOUT_MS * NSEC_PER_MSEC;
+        int state_now = load_state();
+        while (state_now == HANDOFF_REQUESTED) {
+            uint64_t now = monotonic_ns();
+            if (now >= deadline) {
+                break;
+            }
+            futex_wait(&handoff->state, state_now, deadline - now);
+            state_now = load_state();
+        }
+
+        if (state_now == HANDOFF_REQUESTED) {
+            // don't let a late helper write a second report
+            _LOGE("helper: crash helper [%d] did not respond", pid);
+            abandon_helper(pid);
+            return false;
+        }
+
+        __atomic_store_n(&handoff->state, HANDOFF_IDLE, __ATOMIC_RELEASE);
+
+        return state_now == HANDOFF_DONE;
+    }
+
+}   // namespace helper
@@ -0,0 +1,49 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_CRASH_HELPER_H
+#define _AGENT_NDK_CRASH_HELPER_H
+
+#include <signal.h>
+#include <sys/ucontext.h>
+
+/**
+ * Out-of-process crash processing
+ *
+ * A helper process is forked at startup, while the heap is known to be sane, and sleeps
+ * on a futex in a mapping it shares with the app. On a crash, the handler unwinds the
+ * crashing thread, copies its signal context into the mapping and wakes the helper. The helper
+ * then reads the thread table and module maps of the crashed process, attaches to its
+ * other threads with ptrace to walk their stacks (if enabled), and writes the crash record.
+ * None of that work runs in the crashed address space.
+ *
+ * The helper is forked from a multi-threaded process, so it is held to what a signal handler
+ * may do: raw system calls and the async-signal-safe capture path, over the crash arena, with
+ * logging disabled.
+ */
+namespace helper {
+
+    /**
+     * Fork the helper process. Call once, after the native context and crash arena are set up.
+     *
+     * @return true if the helper is running
+     */
+    bool initialize();
+
+    /**
+     * Stop the helper process
+     */
+    void shutdown();
+
+    /**
+     * Hand a crash off to the helper, and wait for it to write the record. Async-signal-safe.
+     *
+     * @return true if the helper wrote the crash record; false if the caller should capture it
+     */
+    bool request(const siginfo_t *, const ucontext_t *);
+
+}   // namespace helper
+
+#endif // _AGENT_NDK_CRASH_HELPER_H
@@ -0,0 +1,1455 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <cstring>
+
+#include "demangler.h"
+
+namespace demangler {
+
+    static const size_t MANGLED_MAX = UINT16_MAX;   // names are recorded as 16-bit offsets
+    static const int DEPTH_MAX = 48;                // deepest nesting of productions followed
+    static const unsigned STEPS_MAX = 16384;        // productions parsed in a pass, across replays
+    static const size_t SUBSTITUTIONS_MAX = 256;
+    static const size_t TEMPLATE_ARGS_MAX = 32;
+    static const size_t ARRAY_DIMS_MAX = 8;
+
+    static const uint8_t CV_RESTRICT = 0x1;
+    static const uint8_t CV_VOLATILE = 0x2;
+    static const uint8_t CV_CONST = 0x4;
+
+    typedef enum entry_kind {
+        ENTRY_TYPE,         // a <type>, re-parsed from begin
+        ENTRY_PREFIX,       // the components of a name from begin to end
+
+    } entry_kind_t;
+
+    /**
+     * A substitution candidate, as offsets into the mangled name
+     */
+    typedef struct substitution {
+        uint16_t begin;
+        uint16_t end;
+        uint8_t kind;
+
+    } substitution_t;
+
+    /**
+     * A pointer, reference or member pointer chain wrapped around a function or array type:
+     * "PFviE" renders as "void (*)(int)"
+     */
+    typedef struct declarator {
+        size_t chain_begin;     // P, R, O and qualifiers, outermost first
+        size_t chain_end;
+        size_t member_class;    // class type of a member pointer, or 0
+        uint8_t cv;             // qualifiers of a member function
+
+    } declarator_t;
+
+    typedef struct state {
+        const char *mangled;
+        size_t len;
+        size_t pos;
+
+        char *out;
+        size_t size;                // output capacity, less the terminator
+        size_t length;
+        bool truncated;
+
+        bool record;                // first pass: record substitutions and template args
+        bool emit;                  // second pass: render
+        int depth;
+        unsigned steps;
+        int type_depth;             // template args inside types are not the entity's
+        int lambda_depth;           // template params in a lambda signature are its auto params
+
+        substitution_t subs[SUBSTITUTIONS_MAX];
+        size_t sub_cnt;
+        uint16_t args[TEMPLATE_ARGS_MAX];
+        size_t arg_cnt;
+
+        const char *last_name;      // last source name, which constructors and destructors repeat
+        size_t last_name_len;
+        bool ends_with_args;        // the last name parsed ended with template args,
+        bool no_return;             // or named a constructor, destructor or conversion
+        uint8_t name_cv;            // qualifiers of the last nested name
+        char name_ref;
+
+    } state_t;
+
+    /**
+     * Bounds the depth and the work of every production
+     */
+    typedef struct scope {
+        state_t &st;
+
+        explicit scope(state_t &st) : st(st) {
+            st.depth++;
+            st.steps++;
+        }
+
+        ~scope() {
+            st.depth--;
+        }
+
+        bool exceeded() const {
+            return st.depth > DEPTH_MAX || st.steps > STEPS_MAX;
+        }
+
+    } scope_t;
+
+    static bool parse_type(state_t &);
+    static bool parse_name(state_t &);
+    static bool parse_encoding(state_t &);
+    static bool parse_template_args(state_t &);
+    static bool parse_template_arg(state_t &);
+
+    static char peek(const state_t &st, size_t ahead = 0) {
+        return (st.pos + ahead < st.len) ? st.mangled[st.pos + ahead] : '\0';
+    }
+
+    static bool consume(state_t &st, char c) {
+        if (peek(st) == c) {
+            st.pos++;
+            return true;
+        }
+        return false;
+    }
+
+    static bool is_digit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    static void put(state_t &st, const char *str, size_t len) {
+        if (!st.emit || st.truncated) {
+            return;
+        }
+        if (len > st.size - st.length) {
+            len = st.size - st.length;
+            st.truncated = true;
+        }
+        std::memcpy(st.out + st.length, str, len);
+        st.length += len;
+    }
+
+    static void put(state_t &st, const char *str) {
+        put(st, str, std::strlen(str));
+    }
+
+    static void put_cv(state_t &st, uint8_t cv) {
+        if (cv & CV_CONST) {
+            put(st, " const");
+        }
+        if (cv & CV_VOLATILE) {
+            put(st, " volatile");
+        }
+        if (cv & CV_RESTRICT) {
+            put(st, " restrict");
+        }
+    }
+
+    /**
+     * Close a template argument list, keeping ">>" apart
+     */
+    static void put_close(state_t &st) {
+        if (st.emit && st.length > 0 && st.out[st.length - 1] == '>') {
+            put(st, " >");
+        } else {
+            put(st, ">");
+        }
+    }
+
+    static bool add_sub(state_t &st, entry_kind_t kind, size_t begin, size_t end = 0) {
+        if (!st.record) {
+            return true;
+        }
+        if (st.sub_cnt == SUBSTITUTIONS_MAX) {
+            return false;
+        }
+        st.subs[st.sub_cnt++] = {static_cast<uint16_t>(begin), static_cast<uint16_t>(end),
+                                 static_cast<uint8_t>(kind)};
+        return true;
+    }
+
+    static bool parse_number(state_t &st, size_t &value) {
+        if (!is_digit(peek(st))) {
+            return false;
+        }
+        value = 0;
+        while (is_digit(peek(st))) {
+            value = value * 10 + (st.mangled[st.pos++] - '0');
+            if (value > MANGLED_MAX) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * <seq-id> _: base 36, with the first index written as a bare "_"
+     */
+    static bool parse_seq_id(state_t &st, size_t &index) {
+        if (consume(st, '_')) {
+            index = 0;
+            return true;
+        }
+
+        size_t value = 0;
+        for (char c = peek(st); c != '_'; c = peek(st)) {
+            if (is_digit(c)) {
+                value = value * 36 + (c - '0');
+            } else if (c >= 'A' && c <= 'Z') {
+                value = value * 36 + (c - 'A' + 10);
+            } else {
+                return false;
+            }
+            if (value > MANGLED_MAX) {
+                return false;
+            }
+            st.pos++;
+        }
+        st.pos++;
+        index = value + 1;
+        return true;
+    }
+
+    static const char *builtin_name(char c) {
+        switch (c) {
+            case 'v': return "void";
+            case 'w': return "wchar_t";
+            case 'b': return "bool";
+            case 'c': return "char";
+            case 'a': return "signed char";
+            case 'h': return "unsigned char";
+            case 's': return "short";
+            case 't': return "unsigned short";
+            case 'i': return "int";
+            case 'j': return "unsigned int";
+            case 'l': return "long";
+            case 'm': return "unsigned long";
+            case 'x': return "long long";
+            case 'y': return "unsigned long long";
+            case 'n': return "__int128";
+            case 'o': return "unsigned __int128";
+            case 'f': return "float";
+            case 'd': return "double";
+            case 'e': return "long double";
+            case 'g': return "__float128";
+            case 'z': return "...";
+            default: return nullptr;
+        }
+    }
+
+    static const char *builtin_d_name(char c) {
+        switch (c) {
+            case 'd': return "decimal64";
+            case 'e': return "decimal128";
+            case 'f': return "decimal32";
+            case 'h': return "half";
+            case 'i': return "char32_t";
+            case 's': return "char16_t";
+            case 'u': return "char8_t";
+            case 'a': return "auto";
+            case 'c': return "decltype(auto)";
+            case 'n': return "std::nullptr_t";
+            default: return nullptr;
+        }
+    }
+
+    typedef struct operator_name {
+        char code[3];
+        const char *name;
+
+    } operator_name_t;
+
+    static const operator_name_t OPERATORS[] = {
+            {"nw", "operator new"}, {"na", "operator new[]"}, {"dl", "operator delete"},
+            {"da", "operator delete[]"}, {"ps", "operator+"}, {"ng", "operator-"}, {"ad", "operator&"},
+            {"de", "operator*"}, {"co", "operator~"}, {"pl", "operator+"}, {"mi", "operator-"},
+            {"ml", "operator*"}, {"dv", "operator/"}, {"rm", "operator%"}, {"an", "operator&"},
+            {"or", "operator|"}, {"eo", "operator^"}, {"aS", "operator="}, {"pL", "operator+="},
+            {"mI", "operator-="}, {"mL", "operator*="}, {"dV", "operator/="}, {"rM", "operator%="},
+            {"aN", "operator&="}, {"oR", "operator|="}, {"eO", "operator^="}, {"ls", "operator<<"},
+            {"rs", "operator>>"}, {"lS", "operator<<="}, {"rS", "operator>>="}, {"eq", "operator=="},
+            {"ne", "operator!="}, {"lt", "operator<"}, {"gt", "operator>"}, {"le", "operator<="},
+            {"ge", "operator>="}, {"ss", "operator<=>"}, {"nt", "operator!"}, {"aa", "operator&&"},
+            {"oo", "operator||"}, {"pp", "operator++"}, {"mm", "operator--"}, {"cm", "operator,"},
+            {"pm", "operator->*"}, {"pt", "operator->"}, {"cl", "operator()"}, {"ix", "operator[]"},
+            {"qu", "operator?"}, {"aw", "operator co_await"},
+    };
+
+    /**
+     * Render a production recorded at an earlier offset. The pass that renders records nothing.
+     */
+    static bool replay_type(state_t &st, size_t begin) {
+        if (!st.emit || st.truncated) {
+            return true;
+        }
+        size_t pos = st.pos;
+        st.pos = begin;
+        bool ok = parse_type(st);
+        st.pos = pos;
+        return ok;
+    }
+
+    static bool parse_prefix(state_t &st, size_t end);
+
+    static bool replay(state_t &st, const substitution_t &sub) {
+        if (!st.emit || st.truncated) {
+            return true;
+        }
+        if (sub.kind == ENTRY_TYPE) {
+            return replay_type(st, sub.begin);
+        }
+        size_t pos = st.pos;
+        st.pos = sub.begin;
+        bool ok = parse_prefix(st, sub.end);
+        st.pos = pos;
+        return ok;
+    }
+
+    static bool parse_source_name(state_t &st) {
+        size_t len = 0;
+        if (!parse_number(st, len) || len > st.len - st.pos) {
+            return false;
+        }
+
+        const char *name = st.mangled + st.pos;
+        if (len >= 10 && std::strncmp(name, "_GLOBAL__N", 10) == 0) {
+            put(st, "(anonymous namespace)");
+        } else {
+            put(st, name, len);
+        }
+        st.last_name = name;
+        st.last_name_len = len;
+        st.pos += len;
+        return true;
+    }
+
+    /**
+     * Sa, Sb, Ss, Si, So, Sd, or S <seq-id> _
+     */
+    static bool parse_substitution(state_t &st) {
+        if (!consume(st, 'S')) {
+            return false;
+        }
+
+        // the abbreviated name of a constructor or destructor is spelled out in full
+        char c = peek(st);
+        bool structor = peek(st, 1) == 'C' || (peek(st, 1) == 'D' && is_digit(peek(st, 2)));
+        const char *text = nullptr;
+        const char *name = nullptr;
+        switch (c) {
+            case 'a':
+                text = "std::allocator";
+                name = "allocator";
+                break;
+            case 'b':
+                text = "std::basic_string";
+                name = "basic_string";
+                break;
+            case 's':
+                text = structor ? "std::basic_string<char, std::char_traits<char>, std::allocator<char> >"
+                                : "std::string";
+                name = "basic_string";
+                break;
+            case 'i':
+                text = structor ? "std::basic_istream<char, std::char_traits<char> >" : "std::istream";
+                name = "basic_istream";
+                break;
+            case 'o':
+                text = structor ? "std::basic_ostream<char, std::char_traits<char> >" : "std::ostream";
+                name = "basic_ostream";
+                break;
+            case 'd':
+                text = structor ? "std::basic_iostream<char, std::char_traits<char> >" : "std::iostream";
+                name = "basic_iostream";
+                break;
+            default:
+                break;
+        }
+        if (text != nullptr) {
+            st.pos++;
+            put(st, text);
+            st.last_name = name;
+            st.last_name_len = std::strlen(name);
+            return true;
+        }
+
+        size_t index = 0;
+        if (!parse_seq_id(st, index) || index >= SUBSTITUTIONS_MAX) {
+            return false;
+        }
+        if (st.record) {
+            return index < st.sub_cnt;
+        }
+        return index < st.sub_cnt && replay(st, st.subs[index]);
+    }
+
+    /**
+     * T [<number>] _
+     */
+    static bool parse_template_param(state_t &st) {
+        if (!consume(st, 'T')) {
+            return false;
+        }
+
+        size_t index = 0;
+        if (!consume(st, '_')) {
+            if (!parse_number(st, index) || !consume(st, '_')) {
+                return false;
+            }
+            index++;
+        }
+        if (!st.emit) {
+            return true;
+        }
+
+        if (st.lambda_depth > 0) {
+            // a generic lambda's parameters
+            char number[8];
+            size_t len = 0;
+            size_t value = index + 1;
+            do {
+                number[sizeof(number) - 1 - len++] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            } while (value > 0 && len < sizeof(number));
+            put(st, "auto:");
+            put(st, number + sizeof(number) - len, len);
+            return true;
+        }
+        if (index >= st.arg_cnt) {
+            return false;
+        }
+        if (st.truncated) {
+            return true;
+        }
+
+        size_t pos = st.pos;
+        st.pos = st.args[index];
+        bool ok = parse_template_arg(st);
+        st.pos = pos;
+        return ok;
+    }
+
+    /**
+     * Ut [<number>] _, or Ul <lambda-sig> E [<number>] _
+     */
+    static bool parse_unnamed_type(state_t &st) {
+        st.pos++;
+        bool lambda = consume(st, 'l');
+        if (!lambda && !consume(st, 't')) {
+            return false;
+        }
+
+        if (lambda) {
+            size_t at = st.length;
+            put(st, "'lambda'(");
+            size_t params = st.length;
+
+            st.lambda_depth++;
+            bool first = true;
+            bool ok = true;
+            if (peek(st) == 'v' && peek(st, 1) == 'E') {
+                st.pos++;
+            }
+            while (ok && !consume(st, 'E')) {
+                size_t before = st.length;
+                if (!first) {
+                    put(st, ", ");
+                }
+                size_t after = st.length;
+                ok = st.pos < st.len && parse_type(st);
+                if (st.length == after && !st.truncated) {
+                    st.length = before;
+                } else {
+                    first = false;
+                }
+            }
+            st.lambda_depth--;
+            if (!ok) {
+                return false;
+            }
+            put(st, ")");
+
+            // the number is rendered inside the quotes: 'lambda0'(int)
+            size_t number = st.pos;
+            while (is_digit(peek(st))) {
+                st.pos++;
+            }
+            if (st.emit && !st.truncated && st.pos > number) {
+                size_t len = st.pos - number;
+                size_t quote = params - 2;
+                if (st.length + len <= st.size) {
+                    std::memmove(st.out + quote + len, st.out + quote, st.length - quote);
+                    std::memcpy(st.out + quote, st.mangled + number, len);
+                    st.length += len;
+                } else {
+                    st.length = at;
+                    st.truncated = true;
+                }
+            }
+            return consume(st, '_');
+        }
+
+        size_t number = st.pos;
+        while (is_digit(peek(st))) {
+            st.pos++;
+        }
+        put(st, "'unnamed");
+        put(st, st.mangled + number, st.pos - number);
+        put(st, "'");
+        return consume(st, '_');
+    }
+
+    static bool parse_operator_name(state_t &st) {
+        char c0 = peek(st);
+        char c1 = peek(st, 1);
+
+        if (c0 == 'c' && c1 == 'v') {
+            st.pos += 2;
+            put(st, "operator ");
+            if (!parse_type(st)) {
+                return false;
+            }
+            st.no_return = true;
+            return true;
+        }
+        if (c0 == 'l' && c1 == 'i') {
+            st.pos += 2;
+            put(st, "operator\"\" ");
+            return parse_source_name(st);
+        }
+
+        for (auto &op: OPERATORS) {
+            if (op.code[0] == c0 && op.code[1] == c1) {
+                st.pos += 2;
+                put(st, op.name);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool parse_unqualified_name(state_t &st) {
+        char c = peek(st);
+        bool ok;
+
+        st.no_return = false;
+        if (is_digit(c)) {
+            ok = parse_source_name(st);
+        } else if (c == 'L') {
+            // internal linkage
+            st.pos++;
+            ok = parse_source_name(st);
+        } else if (c == 'U') {
+            ok = parse_unnamed_type(st);
+        } else if (c == 'C' || (c == 'D' && peek(st, 1) >= '0' && peek(st, 1) <= '5')) {
+            st.pos++;
+            if (c == 'C' && consume(st, 'I')) {
+                // inheriting constructor: CI1 <base class type>
+                if (!is_digit(peek(st))) {
+                    return false;
+                }
+                st.pos++;
+                bool emit = st.emit;
+                st.emit = false;
+                ok = parse_type(st);
+                st.emit = emit;
+            } else {
+                ok = is_digit(peek(st));
+                st.pos++;
+            }
+            if (st.emit && st.last_name == nullptr) {
+                return false;
+            }
+            if (c == 'D') {
+                put(st, "~");
+            }
+            put(st, st.last_name, st.last_name_len);
+            st.no_return = true;
+        } else if (c >= 'a' && c <= 'z') {
+            ok = parse_operator_name(st);
+        } else {
+            return false;
+        }
+
+        // abi tags: f[abi:cxx11]
+        while (ok && consume(st, 'B')) {
+            const char *last_name = st.last_name;
+            size_t last_name_len = st.last_name_len;
+            put(st, "[abi:");
+            ok = parse_source_name(st);
+            put(st, "]");
+            st.last_name = last_name;
+            st.last_name_len = last_name_len;
+        }
+        return ok;
+    }
+
+    /**
+     * One component of a nested name
+     *
+     * @param substitutable false if the component is a substitution, and not a new candidate
+     */
+    static bool parse_component(state_t &st, bool first, bool &substitutable) {
+        char c = peek(st);
+        substitutable = true;
+
+        if (c == 'I') {
+            // a constructor template has no return type
+            bool no_return = st.no_return;
+            if (first || !parse_template_args(st)) {
+                return false;
+            }
+            st.no_return = no_return;
+            st.ends_with_args = true;
+            return true;
+        }
+
+        st.ends_with_args = false;
+        if (!first) {
+            put(st, "::");
+        }
+        if (c == 'S' && peek(st, 1) == 't') {
+            st.pos += 2;
+            put(st, "std::");
+            return parse_unqualified_name(st);
+        }
+        if (c == 'S') {
+            substitutable = false;
+            st.no_return = false;
+            return parse_substitution(st);
+        }
+        if (c == 'T') {
+            st.no_return = false;
+            return parse_template_param(st);
+        }
+        return parse_unqualified_name(st);
+    }
+
+    /**
+     * Render the components of a name recorded as a prefix
+     */
+    static bool parse_prefix(state_t &st, size_t end) {
+        scope_t scope(st);
+        if (scope.exceeded()) {
+            return false;
+        }
+
+        bool substitutable;
+        for (bool first = true; st.pos < end; first = false) {
+            if (!parse_component(st, first, substitutable)) {
+                return false;
+            }
+            consume(st, 'M');
+        }
+        return st.pos == end;
+    }
+
+    /**
+     * N [<CV-qualifiers>] [<ref-qualifier>] <prefix> <unqualified-name> E
+     */
+    static bool parse_nested_name(state_t &st) {
+        st.pos++;
+
+        uint8_t cv = 0;
+        if (consume(st, 'r')) {
+            cv |= CV_RESTRICT;
+        }
+        if (consume(st, 'V')) {
+            cv |= CV_VOLATILE;
+        }
+        if (consume(st, 'K')) {
+            cv |= CV_CONST;
+        }
+        char ref = (peek(st) == 'R' || peek(st) == 'O') ? st.mangled[st.pos++] : '\0';
+
+        // every prefix is a candidate, but the name itself
+        size_t begin = st.pos;
+        bool pushed = false;
+        bool substitutable;
+        bool ends_with_args = false;
+        for (bool first = true; !consume(st, 'E'); first = false) {
+            if (st.pos >= st.len || !parse_component(st, first, substitutable)) {
+                return false;
+            }
+            ends_with_args = st.ends_with_args;
+            if (substitutable) {
+                if (!add_sub(st, ENTRY_PREFIX, begin, st.pos)) {
+                    return false;
+                }
+                pushed = true;
+            }
+            consume(st, 'M');
+        }
+        if (pushed && st.record) {
+            st.sub_cnt--;
+        }
+
+        st.ends_with_args = ends_with_args;
+        st.name_cv = cv;
+        st.name_ref = ref;
+        return pushed;
+    }
+
+    /**
+     * Z <function encoding> E <entity name> [<discriminator>]
+     */
+    static bool parse_local_name(state_t &st) {
+        st.pos++;
+        if (!parse_encoding(st) || !consume(st, 'E')) {
+            return false;
+        }
+        put(st, "::");
+
+        st.name_cv = 0;
+        st.name_ref = '\0';
+        if (consume(st, 's')) {
+            put(st, "string literal");
+            st.ends_with_args = false;
+            st.no_return = false;
+        } else if (peek(st) == 'd' || !parse_name(st)) {
+            return false;
+        }
+
+        // discriminators are not rendered
+        if (consume(st, '_')) {
+            if (consume(st, '_')) {
+                size_t value;
+                return parse_number(st, value) && consume(st, '_');
+            }
+            return is_digit(st.mangled[st.pos++]);
+        }
+        return true;
+    }
+
+    static bool parse_name(state_t &st) {
+        scope_t scope(st);
+        if (scope.exceeded()) {
+            return false;
+        }
+
+        char c = peek(st);
+        if (c == 'N') {
+            return parse_nested_name(st);
+        }
+        if (c == 'Z') {
+            return parse_local_name(st);
+        }
+
+        st.name_cv = 0;
+        st.name_ref = '\0';
+        size_t begin = st.pos;
+        if (c == 'S' && peek(st, 1) != 't') {
+            // a substitution names a template here
+            if (!parse_substitution(st) || peek(st) != 'I') {
+                return false;
+            }
+            st.no_return = false;
+        } else {
+            if (c == 'S') {
+                st.pos += 2;
+                put(st, "std::");
+            }
+            if (!parse_unqualified_name(st)) {
+                return false;
+            }
+            if (peek(st) != 'I') {
+                st.ends_with_args = false;
+                return true;
+            }
+            if (!add_sub(st, ENTRY_PREFIX, begin, st.pos)) {
+                return false;
+            }
+        }
+
+        bool no_return = st.no_return;
+        if (!parse_template_args(st)) {
+            return false;
+        }
+        st.no_return = no_return;
+        st.ends_with_args = true;
+        return true;
+    }
+
+    /**
+     * L <type> <value> E, or L <nullptr type> E
+     */
+    static bool parse_literal(state_t &st) {
+        st.pos++;
+        if (peek(st) == 'D' && peek(st, 1) == 'n' && peek(st, 2) == 'E') {
+            st.pos += 3;
+            put(st, "nullptr");
+            return true;
+        }
+
+        char type = peek(st);
+        const char *suffix = nullptr;
+        switch (type) {
+            case 'i': suffix = ""; break;
+            case 'j': suffix = "u"; break;
+            case 'l': suffix = "l"; break;
+            case 'm': suffix = "ul"; break;
+            case 'x': suffix = "ll"; break;
+            case 'y': suffix = "ull"; break;
+            case 'f':
+            case 'd':
+            case 'e':
+            case '_':
+                // floating point and external names
+                return false;
+            default: break;
+        }
+
+        if (type == 'b') {
+            st.pos++;
+        } else if (suffix != nullptr) {
+            st.pos++;
+        } else {
+            put(st, "(");
+            if (!parse_type(st)) {
+                return false;
+            }
+            put(st, ")");
+        }
+
+        bool negative = consume(st, 'n');
+        size_t begin = st.pos;
+        while (is_digit(peek(st))) {
+            st.pos++;
+        }
+        size_t len = st.pos - begin;
+        if (len == 0 || !consume(st, 'E')) {
+            return false;
+        }
+
+        if (type == 'b' && len == 1 && !negative) {
+            put(st, st.mangled[begin] == '0' ? "false" : "true");
+            return true;
+        }
+        if (negative) {
+            put(st, "-");
+        }
+        put(st, st.mangled + begin, len);
+        if (suffix != nullptr) {
+            put(st, suffix);
+        }
+        return true;
+    }
+
+    static bool parse_template_arg(state_t &st) {
+        char c = peek(st);
+
+        if (c == 'L') {
+            return parse_literal(st);
+        }
+        if (c == 'X') {
+            // expressions
+            return false;
+        }
+        if (c == 'J') {
+            // an argument pack renders as its arguments
+            st.pos++;
+            bool first = true;
+            while (!consume(st, 'E')) {
+                size_t before = st.length;
+                if (!first) {
+                    put(st, ", ");
+                }
+                size_t after = st.length;
+                if (st.pos >= st.len || !parse_template_arg(st)) {
+                    return false;
+                }
+                if (st.length == after && !st.truncated) {
+                    st.length = before;
+                } else {
+                    first = false;
+                }
+            }
+            return true;
+        }
+        return parse_type(st);
+    }
+
+    /**
+     * I <template-arg>+ E. Arguments of the entity's own name are recorded for template params.
+     */
+    static bool parse_template_args(state_t &st) {
+        if (!consume(st, 'I')) {
+            return false;
+        }
+
+        const char *last_name = st.last_name;
+        size_t last_name_len = st.last_name_len;
+        bool recording = st.record && st.type_depth == 0;
+        uint16_t args[TEMPLATE_ARGS_MAX];
+        size_t arg_cnt = 0;
+
+        put(st, "<");
+        st.type_depth++;
+        bool first = true;
+        bool ok = true;
+        while (ok && !consume(st, 'E')) {
+            if (st.pos >= st.len || (recording && arg_cnt == TEMPLATE_ARGS_MAX)) {
+                ok = false;
+                break;
+            }
+            if (recording) {
+                args[arg_cnt++] = static_cast<uint16_t>(st.pos);
+            }
+
+            size_t before = st.length;
+            if (!first) {
+                put(st, ", ");
+            }
+            size_t after = st.length;
+            ok = parse_template_arg(st);
+            if (st.length == after && !st.truncated) {
+                st.length = before;
+            } else {
+                first = false;
+            }
+        }
+        st.type_depth--;
+        if (!ok) {
+            return false;
+        }
+        put_close(st);
+
+        st.last_name = last_name;
+        st.last_name_len = last_name_len;
+        if (recording) {
+            std::memcpy(st.args, args, arg_cnt * sizeof(args[0]));
+            st.arg_cnt = arg_cnt;
+        }
+        return true;
+    }
+
+    static bool at_params_end(const state_t &st, bool function_type) {
+        char c = peek(st);
+        if (function_type) {
+            return c == 'E' || ((c == 'R' || c == 'O') && peek(st, 1) == 'E');
+        }
+        return c == '\0' || c == 'E' || c == '.';
+    }
+
+    /**
+     * The parameter types of a function, comma separated: a lone "v" is an empty list
+     */
+    static bool parse_parameters(state_t &st, bool function_type) {
+        if (peek(st) == 'v') {
+            st.pos++;
+            if (at_params_end(st, function_type)) {
+                return true;
+            }
+            st.pos--;
+        }
+
+        bool first = true;
+        while (!at_params_end(st, function_type)) {
+            size_t before = st.length;
+            if (!first) {
+                put(st, ", ");
+            }
+            size_t after = st.length;
+            if (!parse_type(st)) {
+                return false;
+            }
+            if (st.length == after && !st.truncated) {
+                st.length = before;
+            } else {
+                first = false;
+            }
+        }
+        return true;
+    }
+
+    static void put_declarator(state_t &st, const declarator_t *decl) {
+        if (decl->member_class != 0) {
+            replay_type(st, decl->member_class);
+            put(st, "::*");
+        }
+        for (size_t at = decl->chain_end; at > decl->chain_begin; at--) {
+            switch (st.mangled[at - 1]) {
+                case 'P': put(st, "*"); break;
+                case 'R': put(st, "&"); break;
+                case 'O': put(st, "&&"); break;
+                case 'K': put(st, " const"); break;
+                case 'V': put(st, " volatile"); break;
+                default: put(st, " restrict"); break;
+            }
+        }
+    }
+
+    /**
+     * F [Y] <return type> <parameter types> [<ref-qualifier>] E
+     */
+    static bool parse_function_type(state_t &st, const declarator_t *decl) {
+        if (!consume(st, 'F')) {
+            return false;
+        }
+        consume(st, 'Y');
+
+        if (!parse_type(st)) {
+            return false;
+        }
+        put(st, " (");
+        if (decl != nullptr) {
+            put_declarator(st, decl);
+            put(st, ")(");
+        }
+        if (!parse_parameters(st, true)) {
+            return false;
+        }
+        put(st, ")");
+
+        if (decl != nullptr) {
+            put_cv(st, decl->cv);
+        }
+        if (consume(st, 'R')) {
+            put(st, " &");
+        } else if (consume(st, 'O')) {
+            put(st, " &&");
+        }
+        return consume(st, 'E');
+    }
+
+    /**
+     * A <dimension> _ <element type>. Nested arrays render their dimensions in order.
+     */
+    static bool parse_array_type(state_t &st, const declarator_t *decl) {
+        size_t arrays[ARRAY_DIMS_MAX];
+        size_t dims[ARRAY_DIMS_MAX];
+        size_t dim_cnt = 0;
+
+        while (peek(st) == 'A') {
+            if (dim_cnt == ARRAY_DIMS_MAX) {
+                return false;
+            }
+            arrays[dim_cnt] = st.pos++;
+            dims[dim_cnt++] = st.pos;
+            while (is_digit(peek(st))) {
+                st.pos++;
+            }
+            if (!consume(st, '_')) {
+                return false;
+            }
+        }
+
+        if (!parse_type(st)) {
+            return false;
+        }
+        for (size_t i = dim_cnt - 1; i > 0; i--) {
+            if (!add_sub(st, ENTRY_TYPE, arrays[i])) {
+                return false;
+            }
+        }
+
+        put(st, " ");
+        if (decl != nullptr) {
+            put(st, "(");
+            put_declarator(st, decl);
+            put(st, ") ");
+        }
+        for (size_t i = 0; i < dim_cnt; i++) {
+            size_t end = dims[i];
+            while (is_digit(st.mangled[end])) {
+                end++;
+            }
+            put(st, "[");
+            put(st, st.mangled + dims[i], end - dims[i]);
+            put(st, "]");
+        }
+        return true;
+    }
+
+    /**
+     * Pointers and references to functions and arrays, whose declarators wrap the name
+     */
+    static bool parse_wrapped_type(state_t &st, size_t chain_end) {
+        declarator_t decl = {st.pos, chain_end, 0, 0};
+
+        st.pos = chain_end;
+        bool ok = (peek(st) == 'F') ? parse_function_type(st, &decl) : parse_array_type(st, &decl);
+        if (!ok || !add_sub(st, ENTRY_TYPE, chain_end)) {
+            return false;
+        }
+
+        // the inner pointers are candidates, innermost first; the caller adds the outermost
+        for (size_t at = chain_end - 1; at > decl.chain_begin; at--) {
+            if (!add_sub(st, ENTRY_TYPE, at)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool parse_qualified_type(state_t &);
+
+    static bool parse_pointer_type(state_t &st) {
+        size_t chain_end = st.pos;
+        while (chain_end < st.len && std::strchr("PROKVr", st.mangled[chain_end]) != nullptr) {
+            chain_end++;
+        }
+        if (chain_end < st.len && (st.mangled[chain_end] == 'F' || st.mangled[chain_end] == 'A') &&
+            std::strchr("PRO", st.mangled[chain_end - 1]) != nullptr) {
+            return parse_wrapped_type(st, chain_end);
+        }
+        if (std::strchr("KVr", peek(st)) != nullptr) {
+            return parse_qualified_type(st);
+        }
+
+        char c = st.mangled[st.pos++];
+        if (!parse_type(st)) {
+            return false;
+        }
+        put(st, c == 'P' ? "*" : c == 'R' ? "&" : "&&");
+        return true;
+    }
+
+    /**
+     * M <class type> <member type>
+     */
+    static bool parse_member_pointer_type(state_t &st) {
+        st.pos++;
+
+        // the class is rendered inside the declarator
+        size_t member_class = st.pos;
+        bool emit = st.emit;
+        st.emit = false;
+        bool ok = parse_type(st);
+        st.emit = emit;
+        if (!ok) {
+            return false;
+        }
+
+        size_t qualified = st.pos;
+        uint8_t cv = 0;
+        for (;; st.pos++) {
+            char c = peek(st);
+            if (c == 'r') {
+                cv |= CV_RESTRICT;
+            } else if (c == 'V') {
+                cv |= CV_VOLATILE;
+            } else if (c == 'K') {
+                cv |= CV_CONST;
+            } else {
+                break;
+            }
+        }
+
+        if (peek(st) == 'F') {
+            declarator_t decl = {0, 0, member_class, cv};
+            size_t function = st.pos;
+            return parse_function_type(st, &decl) &&
+                   add_sub(st, ENTRY_TYPE, function) &&
+                   (cv == 0 || add_sub(st, ENTRY_TYPE, qualified));
+        }
+
+        st.pos = qualified;
+        if (!parse_type(st)) {
+            return false;
+        }
+        put(st, " ");
+        replay_type(st, member_class);
+        put(st, "::*");
+        return true;
+    }
+
+    static bool parse_qualified_type(state_t &st) {
+        uint8_t cv = 0;
+        if (consume(st, 'r')) {
+            cv |= CV_RESTRICT;
+        }
+        if (consume(st, 'V')) {
+            cv |= CV_VOLATILE;
+        }
+        if (consume(st, 'K')) {
+            cv |= CV_CONST;
+        }
+        if (!parse_type(st)) {
+            return false;
+        }
+        put_cv(st, cv);
+        return true;
+    }
+
+    static bool parse_type(state_t &st) {
+        scope_t scope(st);
+        if (scope.exceeded()) {
+            return false;
+        }
+
+        size_t begin = st.pos;
+        char c = peek(st);
+        const char *builtin = builtin_name(c);
+        if (builtin != nullptr) {
+            st.pos++;
+            put(st, builtin);
+            return true;
+        }
+        if (c == 'D' && (builtin = builtin_d_name(peek(st, 1))) != nullptr) {
+            st.pos += 2;
+            put(st, builtin);
+            return true;
+        }
+
+        bool ok;
+        bool substitutable = true;
+        st.type_depth++;
+        switch (c) {
+            case 'u':
+                // vendor extended type
+                st.pos++;
+                ok = parse_source_name(st);
+                break;
+            case 'D':
+                // pack expansion, rendered as its pattern
+                st.pos++;
+                ok = consume(st, 'p') && parse_type(st);
+                break;
+            case 'r':
+            case 'V':
+            case 'K':
+            case 'P':
+            case 'R':
+            case 'O':
+                ok = parse_pointer_type(st);
+                break;
+            case 'F':
+                ok = parse_function_type(st, nullptr);
+                break;
+            case 'A':
+                ok = parse_array_type(st, nullptr);
+                break;
+            case 'M':
+                ok = parse_member_pointer_type(st);
+                break;
+            case 'T':
+                ok = parse_template_param(st);
+                if (ok && peek(st) == 'I') {
+                    ok = add_sub(st, ENTRY_TYPE, begin) && parse_template_args(st);
+                }
+                break;
+            case 'S':
+                if (peek(st, 1) == 't') {
+                    ok = parse_name(st);
+                    break;
+                }
+                ok = parse_substitution(st);
+                if (ok && peek(st) == 'I') {
+                    ok = parse_template_args(st);
+                } else {
+                    substitutable = false;
+                }
+                break;
+            case 'N':
+            case 'Z':
+                ok = parse_name(st);
+                break;
+            default:
+                ok = is_digit(c) && parse_name(st);
+                break;
+        }
+        st.type_depth--;
+
+        return ok && (!substitutable || add_sub(st, ENTRY_TYPE, begin));
+    }
+
+    static bool parse_call_offset(state_t &st, bool is_virtual) {
+        size_t value;
+        consume(st, 'n');
+        if (!parse_number(st, value) || !consume(st, '_')) {
+            return false;
+        }
+        if (is_virtual) {
+            consume(st, 'n');
+            return parse_number(st, value) && consume(st, '_');
+        }
+        return true;
+    }
+
+    static bool parse_special_name(state_t &st) {
+        char c0 = st.mangled[st.pos];
+        char c1 = peek(st, 1);
+        st.pos += 2;
+
+        if (c0 == 'G') {
+            put(st, "guard variable for ");
+            return c1 == 'V' && parse_name(st);
+        }
+
+        switch (c1) {
+            case 'V':
+                put(st, "vtable for ");
+                return parse_type(st);
+            case 'T':
+                put(st, "VTT for ");
+                return parse_type(st);
+            case 'I':
+                put(st, "typeinfo for ");
+                return parse_type(st);
+            case 'S':
+                put(st, "typeinfo name for ");
+                return parse_type(st);
+            case 'h':
+                put(st, "non-virtual thunk to ");
+                return parse_call_offset(st, false) && parse_encoding(st);
+            case 'v':
+                put(st, "virtual thunk to ");
+                return parse_call_offset(st, true) && parse_encoding(st);
+            case 'W':
+                put(st, "thread-local wrapper routine for ");
+                return parse_name(st);
+            case 'H':
+                put(st, "thread-local initialization routine for ");
+                return parse_name(st);
+            default:
+                return false;
+        }
+    }
+
+    /**
+     * <name> [<bare-function-type>]
+     */
+    static bool parse_encoding(state_t &st) {
+        scope_t scope(st);
+        if (scope.exceeded()) {
+            return false;
+        }
+
+        char c = peek(st);
+        if (c == 'T' || (c == 'G' && peek(st, 1) == 'V')) {
+            return parse_special_name(st);
+        }
+
+        if (!st.emit) {
+            if (!parse_name(st)) {
+                return false;
+            }
+            if (at_params_end(st, false)) {
+                return true;
+            }
+            if (st.ends_with_args && !st.no_return && !parse_type(st)) {
+                return false;
+            }
+            return parse_parameters(st, false);
+        }
+
+        // the return type of a template function comes first, though it's mangled after the name
+        size_t name = st.pos;
+        st.emit = false;
+        bool ok = parse_name(st);
+        st.emit = true;
+        if (!ok) {
+            return false;
+        }
+        if (at_params_end(st, false)) {
+            st.pos = name;
+            return parse_name(st);
+        }
+
+        uint8_t cv = st.name_cv;
+        char ref = st.name_ref;
+        if (st.ends_with_args && !st.no_return) {
+            if (!parse_type(st)) {
+                return false;
+            }
+            put(st, " ");
+        }
+        size_t params = st.pos;
+
+        st.pos = name;
+        if (!parse_name(st)) {
+            return false;
+        }
+        st.pos = params;
+
+        put(st, "(");
+        if (!parse_parameters(st, false)) {
+            return false;
+        }
+        put(st, ")");
+        put_cv(st, cv);
+        if (ref == 'R') {
+            put(st, " &");
+        } else if (ref == 'O') {
+            put(st, " &&");
+        }
+        return true;
+    }
+
+    /**
+     * Compiler generated clones: foo() (.cold)
+     */
+    static bool parse_clone_suffix(state_t &st) {
+        if (st.pos == st.len) {
+            return true;
+        }
+        if (peek(st) != '.') {
+            return false;
+        }
+        put(st, " (");
+        put(st, st.mangled + st.pos, st.len - st.pos);
+        put(st, ")");
+        st.pos = st.len;
+        return true;
+    }
+
+    bool demangle(const char *mangled, char *buffer, size_t size) {
+        if (mangled == nullptr || buffer == nullptr || size == 0 ||
+            mangled[0] != '_' || mangled[1] != 'Z') {
+            return false;
+        }
+
+        size_t len = strnlen(mangled, MANGLED_MAX + 1);
+        if (len > MANGLED_MAX) {
+            return false;
+        }
+
+        state_t st;
+        st.mangled = mangled;
+        st.len = len;
+        st.pos = 2;
+        st.out = buffer;
+        st.size = size - 1;
+        st.length = 0;
+        st.truncated = false;
+        st.record = true;
+        st.emit = false;
+        st.depth = 0;
+        st.steps = 0;
+        st.type_depth = 0;
+        st.lambda_depth = 0;
+        st.sub_cnt = 0;
+        st.arg_cnt = 0;
+        st.last_name = nullptr;
+        st.last_name_len = 0;
+        st.ends_with_args = false;
+        st.no_return = false;
+        st.name_cv = 0;
+        st.name_ref = '\0';
+
+        // the first pass validates the name and records substitutions; the second renders it
+        if (!parse_encoding(st) || !parse_clone_suffix(st)) {
+            return false;
+        }
+
+        st.pos = 2;
+        st.record = false;
+        st.emit = true;
+        st.steps = 0;
+        st.last_name = nullptr;
+        if (!parse_encoding(st) || !parse_clone_suffix(st)) {
+            return false;
+        }
+
+        buffer[st.length] = '\0';
+        return true;
+    }
+
+}   // namespace demangler
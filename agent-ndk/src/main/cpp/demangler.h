@@ -0,0 +1,32 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_DEMANGLER_H
+#define _AGENT_NDK_DEMANGLER_H
+
+#include <stddef.h>
+
+/**
+ * Itanium C++ ABI demangler for crash-time symbol names
+ *
+ * Writes into a caller-supplied buffer, and never touches the heap: substitutions and
+ * template arguments are recorded as offsets into the mangled name in a first pass, and
+ * re-parsed where they are referenced while rendering in a second pass. Recursion depth
+ * and the work done are bounded, so a pathological name can't exhaust an alternate signal
+ * stack. Output follows the LLVM runtime's __cxa_demangle(); constructs it doesn't know
+ * (expressions, decltype, vendor qualifiers) leave the name mangled.
+ */
+namespace demangler {
+
+    /**
+     * Demangle a symbol name into buffer, truncating the output to fit. Async-signal-safe.
+     *
+     * @return false if the name is not a mangled C++ name this demangler can render
+     */
+    bool demangle(const char *mangled, char *buffer, size_t size);
+
+}   // namespace demangler
+
+#endif // _AGENT_NDK_DEMANGLER_H
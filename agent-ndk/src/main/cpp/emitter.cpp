@@ -5,320 +5,394 @@
  **/
 
 #include <unistd.h>
-#include <dirent.h>
-#include <string>
 #include <sys/ucontext.h>
 #include <asm/sigcontext.h>
-#include <sstream>
 
 #include <agent-ndk.h>
 #include "backtrace.h"
 #include "unwinder.h"
-#include "procfs.h"
 #include "signal-utils.h"
-#include "jni/native-context.h"
+#include "writer.h"
+#include "emitter.h"
 
 /**
- * Append a formatted string to the output state
- * This method can only emit up to 2K characters
+ * Emit the name of an element, including the separator
  *
- * @param state
- * @param fmt
- * @param vararg List of parameters appropriate to format
+ * @param writer Output writer
+ * @param name of element
  */
-static void _EMIT_F(std::string &state, const char *fmt...) {
-    char buffer[2048];
-    va_list args;
-
-    va_start(args, fmt);
-    vsnprintf(buffer, sizeof(buffer), fmt, args);
-    va_end(args);
-
-    state.append(buffer);
+static void _EMIT_N(writer_t &writer, const char *name) {
+    writer::put_char(writer, '"');
+    writer::put_cstr(writer, name);
+    writer::put(writer, "\":", 2);
 }
 
 /**
- * Append a list of strings to the output state
+ * Emit a named string field: "name":"value"
  *
- * @param state
- * @param fmt
- * @param vararg List of strings
+ * @param writer Output writer
+ * @param name of field
+ * @param value string value
  */
-static std::string _EMIT_C(std::string &state, const char *cstr...) {
-    va_list args;
-
-    va_start(args, cstr);
-    while (cstr != nullptr) {
-        state.append(cstr);
-        cstr = va_arg(args,
-        const char*);
-    }
-    va_end(args);
-
-    return state;
+static void _EMIT_S(writer_t &writer, const char *name, const char *value) {
+    _EMIT_N(writer, name);
+    writer::put_char(writer, '"');
+    writer::put_string(writer, value);
+    writer::put_char(writer, '"');
 }
 
 /**
- * Append a formatted element (as string) to the output state
- *
- * @param state
- * @param name of element (optional)
- * @param vararg List of element items
+ * Emit a named signed integer field: "name":value
  */
-static std::string _EMIT_E(std::string &state, const char *name, const char *cstr...) {
-    va_list args;
+static void _EMIT_D(writer_t &writer, const char *name, long long value) {
+    _EMIT_N(writer, name);
+    writer::put_dec(writer, value);
+}
 
-    if (name != nullptr) {
-        _EMIT_F(state, "'%s':", name);
-    }
-    state.append("{");
-    va_start(args, cstr);
-    while (cstr != nullptr) {
-        state.append(cstr);
-        cstr = va_arg(args,
-        const char*);
-        if (cstr != nullptr) {
-            state.append(",");
-        }
-    }
-    va_end(args);
-    state.append("}");
+/**
+ * Emit a named unsigned integer field: "name":value
+ */
+static void _EMIT_U(writer_t &writer, const char *name, unsigned long long value) {
+    _EMIT_N(writer, name);
+    writer::put_udec(writer, value);
+}
 
-    return state;
+/**
+ * Emit a named, quoted, zero-padded hex register value: "name":"0000cafe"
+ */
+static void _EMIT_X(writer_t &writer, const char *name, unsigned long long value, int width) {
+    _EMIT_N(writer, name);
+    writer::put_char(writer, '"');
+    writer::put_hex(writer, value, width);
+    writer::put_char(writer, '"');
 }
 
 /**
- * Append a formatted array (as string) to the output state
- *
- * @param state
- * @param name of array (optional)
- * @param vararg List of array items
+ * Emit a named, quoted, zero-padded decimal register value: "name":"00001234"
  */
-static std::string _EMIT_A(std::string &state, const char *name, const char *cstr...) {
-    va_list args;
+__unused static void _EMIT_R(writer_t &writer, const char *name, long long value, int width) {
+    _EMIT_N(writer, name);
+    writer::put_char(writer, '"');
+    writer::put_dec(writer, value, width);
+    writer::put_char(writer, '"');
+}
 
-    if (name != nullptr) {
-        _EMIT_F(state, "'%s':", name);
-    }
-    state.append("[");
-    va_start(args, cstr);
-    while (cstr != nullptr) {
-        state.append(cstr);
-        cstr = va_arg(args,
-        const char*);
-        if (cstr != nullptr) {
-            state.append(",");
-        }
-    }
-    va_end(args);
-    state.append("]");
+static inline void _EMIT_SEP(writer_t &writer) {
+    writer::put_char(writer, ',');
+}
 
-    return state;
+/**
+ * Format an indexed register name ("r0", "x29") into a small buffer
+ */
+__unused static const char *indexed_name(char *name, size_t size, char prefix, int index) {
+    writer_t writer = {};
+    writer::to_buffer(writer, name, size - 1);
+    writer::put_char(writer, prefix);
+    writer::put_dec(writer, index);
+    name[writer.length] = '\0';
+    return name;
 }
 
-__unused static const char *frame_to_string(stackframe_t &stackframe, std::string &frame) {
-    _EMIT_F(frame, "#%02zu pc %016x %s", stackframe.index, stackframe.pc, stackframe.so_path);
+/**
+ * Emit the human-readable form of a frame: #00 pc 0000000000001234 /path/lib.so (symbol+12)
+ *
+ * Historically formatted with "%016x" (and "%d" for the offset) from 64-bit values,
+ * so only the low 32 bits are emitted. That is preserved here.
+ */
+static void frame_to_string(stackframe_t &stackframe, writer_t &writer) {
+    writer::put_char(writer, '#');
+    writer::put_udec(writer, stackframe.index, 2);
+    writer::put(writer, " pc ", 4);
+    writer::put_hex(writer, static_cast<uint32_t>(stackframe.pc), 16);
+    writer::put_char(writer, ' ');
+    writer::put_string(writer, stackframe.so_path);
     if (*stackframe.sym_name != '\0') {
-        _EMIT_F(frame, " (%s+%d)", stackframe.sym_name, stackframe.sym_addr_offset);
+        writer::put(writer, " (", 2);
+        writer::put_string(writer, stackframe.sym_name);
+        writer::put_char(writer, '+');
+        writer::put_dec(writer, static_cast<int>(stackframe.sym_addr_offset));
+        writer::put_char(writer, ')');
     }
-    return frame.c_str();
 }
 
-static const char *frame_to_json(stackframe_t &stackframe, std::string &state) {
-    std::string frame, cstr;
-
-    _EMIT_F(frame, "'cstr':'%s',", frame_to_string(stackframe, cstr));
-    _EMIT_F(frame, "'index':%d,", stackframe.index);
-    _EMIT_F(frame, "'address':%zu,", stackframe.address);
-    _EMIT_F(frame, "'pc':%zu,", stackframe.pc);
-    _EMIT_F(frame, "'so_base':%zu,", stackframe.so_base);
-    _EMIT_F(frame, "'sym_addr':%zu,", stackframe.sym_addr);
-    _EMIT_F(frame, "'sym_addr_offset':%zu", stackframe.sym_addr_offset);
+static void frame_to_json(stackframe_t &stackframe, writer_t &writer) {
+    writer::put_char(writer, '{');
+
+    _EMIT_N(writer, "cstr");
+    writer::put_char(writer, '"');
+    frame_to_string(stackframe, writer);
+    writer::put_char(writer, '"');
+    _EMIT_SEP(writer);
+
+    _EMIT_D(writer, "index", static_cast<int>(stackframe.index));
+    _EMIT_SEP(writer);
+    _EMIT_U(writer, "address", stackframe.address);
+    _EMIT_SEP(writer);
+    _EMIT_U(writer, "pc", stackframe.pc);
+    _EMIT_SEP(writer);
+    _EMIT_U(writer, "so_base", stackframe.so_base);
+    _EMIT_SEP(writer);
+    _EMIT_U(writer, "sym_addr", stackframe.sym_addr);
+    _EMIT_SEP(writer);
+    _EMIT_U(writer, "sym_addr_offset", stackframe.sym_addr_offset);
 
     if (*stackframe.so_path != '\0') {
-        _EMIT_F(frame, ",'so_path':'%s'", stackframe.so_path);
+        _EMIT_SEP(writer);
+        _EMIT_S(writer, "so_path", stackframe.so_path);
     }
     if (*stackframe.sym_name != '\0') {
-        _EMIT_F(frame, ",'sym_name':'%s'", stackframe.sym_name);
+        _EMIT_SEP(writer);
+        _EMIT_S(writer, "sym_name", stackframe.sym_name);
     }
 
-    _EMIT_E(state, nullptr, frame.c_str(), nullptr);
-
-    return state.c_str();
+    writer::put_char(writer, '}');
 }
 
 /**
  * Emit a single stack frame
  *
  * @param stackframe Single frame in the callstack
- * @param state Output buffer
+ * @param writer Output writer
  */
-const char *emit_stackframe(stackframe_t &stackframe, std::string &frame) {
-    return frame_to_json(stackframe, frame);
+void emit_stackframe(stackframe_t &stackframe, writer_t &writer) {
+    frame_to_json(stackframe, writer);
 }
 
 /**
  * Emit the violation's signal state
  *
  * @param siginfo_t Signal state
- * @param state Output buffer
+ * @param writer Output writer
  */
-const char *emit_signal_context(const siginfo_t *siginfo, std::string &state) {
-    std::string exception;
+void emit_signal_context(const siginfo_t *siginfo, writer_t &writer) {
+    _EMIT_N(writer, "exception");
+    writer::put_char(writer, '{');
 
-    _EMIT_F(exception, "'name':'%s',", "Native exception");
+    _EMIT_S(writer, "name", "Native exception");
     if (siginfo != nullptr) {
-        _EMIT_F(exception, "'cause':'%s',",
+        _EMIT_SEP(writer);
+        _EMIT_S(writer, "cause",
                 sigutils::get_signal_description(siginfo->si_signo, siginfo->si_code));
-
-        std::string csiginfo;
-        _EMIT_F(csiginfo, "'signalName':'%s',",
-                sigutils::get_signal_description(siginfo->si_signo, -1));
-        _EMIT_F(csiginfo, "'signalCode':%d,", siginfo->si_code);
-        _EMIT_F(csiginfo, "'faultAddress':%zu", siginfo->si_addr);
-
-        _EMIT_E(exception, "signalInfo", csiginfo.c_str(), nullptr);
+        _EMIT_SEP(writer);
+
+        _EMIT_N(writer, "signalInfo");
+        writer::put_char(writer, '{');
+        _EMIT_S(writer, "signalName", sigutils::get_signal_description(siginfo->si_signo, -1));
+        _EMIT_SEP(writer);
+        _EMIT_D(writer, "signalCode", siginfo->si_code);
+        _EMIT_SEP(writer);
+        _EMIT_U(writer, "faultAddress", reinterpret_cast<uintptr_t>(siginfo->si_addr));
+        writer::put_char(writer, '}');
     }
 
-    _EMIT_E(state, "exception", exception.c_str(), nullptr);
-
-    return state.c_str();
+    writer::put_char(writer, '}');
 }
 
 /**
  * Emit the current register set state, which is contained
  * in the u_context's mcontext struct
  *
+ * Register values are formatted exactly as the legacy printf-based emitter formatted
+ * them, including the truncation of 64-bit values by "%x".
+ *
  * @param mcontext registers context from sa_context,
- * @param state Output buffer
+ * @param writer Output writer
+ * @return false if there is no register context to emit
  */
-const char *emit_registers(const ucontext_t *sa_ucontext, std::string &state) {
+bool emit_registers(const ucontext_t *sa_ucontext, writer_t &writer) {
 
     if (sa_ucontext == nullptr) {
         _LOGE("emit_registers: sa_ucontext is null");
-        return nullptr;
+        return false;
     }
 
     // get pointer to registers specific context
     const mcontext_t *mcontext = &(sa_ucontext->uc_mcontext);
-    if (mcontext == nullptr) {
-        _LOGE("emit_registers: uc_mcontext is null");
-        return nullptr;
-    }
 
-    std::string registers;
+    _EMIT_N(writer, "registers");
+    writer::put_char(writer, '{');
 
 #if defined(__i386__)
-    _EMIT_F(registers, "'eax':'%08lu',", mcontext->gregs[REG_EAX]);
-    _EMIT_F(registers, "'ebx':'%08lu',", mcontext->gregs[REG_EBX]);
-    _EMIT_F(registers, "'ecx':'%08lu',", mcontext->gregs[REG_ECX]);
-    _EMIT_F(registers, "'edx':'%08lu',", mcontext->gregs[REG_EAX]);
-    _EMIT_F(registers, "'edi':'%08lu',", mcontext->gregs[REG_EDI]);
-    _EMIT_F(registers, "'esi':'%08lu',", mcontext->gregs[REG_ESI]);
-    _EMIT_F(registers, "'ebp':'%08lu',", mcontext->gregs[REG_EBP]);
-    _EMIT_F(registers, "'esp':'%08x',", mcontext->gregs[REG_ESP]);
-    _EMIT_F(registers, "'eip':'%08x',", mcontext->gregs[REG_EIP]);
-    _EMIT_F(registers, "'trapno':%d,", mcontext->gregs[REG_TRAPNO]);
-    _EMIT_F(registers, "'error_code':%d", mcontext->gregs[REG_ERR]);
+    _EMIT_R(writer, "eax", static_cast<uint32_t>(mcontext->gregs[REG_EAX]), 8);
+    _EMIT_SEP(writer);
+    _EMIT_R(writer, "ebx", static_cast<uint32_t>(mcontext->gregs[REG_EBX]), 8);
+    _EMIT_SEP(writer);
+    _EMIT_R(writer, "ecx", static_cast<uint32_t>(mcontext->gregs[REG_ECX]), 8);
+    _EMIT_SEP(writer);
+    _EMIT_R(writer, "edx", static_cast<uint32_t>(mcontext->gregs[REG_EAX]), 8);
+    _EMIT_SEP(writer);
+    _EMIT_R(writer, "edi", static_cast<uint32_t>(mcontext->gregs[REG_EDI]), 8);
+    _EMIT_SEP(writer);
+    _EMIT_R(writer, "esi", static_cast<uint32_t>(mcontext->gregs[REG_ESI]), 8);
+    _EMIT_SEP(writer);
+    _EMIT_R(writer, "ebp", static_cast<uint32_t>(mcontext->gregs[REG_EBP]), 8);
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "esp", static_cast<uint32_t>(mcontext->gregs[REG_ESP]), 8);
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "eip", static_cast<uint32_t>(mcontext->gregs[REG_EIP]), 8);
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "trapno", static_cast<int>(mcontext->gregs[REG_TRAPNO]));
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "error_code", static_cast<int>(mcontext->gregs[REG_ERR]));
 
 #elif defined(__x86_64__)
-    for (int i = 0; i< NGREG; i++) {
-        _EMIT_F(registers, "'r%d':'%016ld',", i, mcontext->gregs[i]);
+    char name[8];
+    for (int i = 0; i < NGREG; i++) {
+        indexed_name(name, sizeof(name), 'r', i);
+        _EMIT_R(writer, name, static_cast<long>(mcontext->gregs[i]), 16);
+        _EMIT_SEP(writer);
     }
-    _EMIT_F(registers, "'rip':'%016x',", mcontext->gregs[REG_RIP]);
-    _EMIT_F(registers, "'rsp':'%016x',", mcontext->gregs[REG_RSP]);
-    _EMIT_F(registers, "'trapno':%d,", mcontext->gregs[REG_TRAPNO]);
-    _EMIT_F(registers, "'error_code':%d", mcontext->gregs[REG_ERR]);
+    _EMIT_X(writer, "rip", static_cast<uint32_t>(mcontext->gregs[REG_RIP]), 16);
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "rsp", static_cast<uint32_t>(mcontext->gregs[REG_RSP]), 16);
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "trapno", static_cast<int>(mcontext->gregs[REG_TRAPNO]));
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "error_code", static_cast<int>(mcontext->gregs[REG_ERR]));
 
 #elif defined(__arm__)
-    _EMIT_F(registers, "'r0':'%08x',", REG_R0, mcontext->arm_r0);
-    _EMIT_F(registers, "'r1':'%08x',", REG_R1, mcontext->arm_r1);
-    _EMIT_F(registers, "'r2':'%08x',", REG_R2, mcontext->arm_r2);
-    _EMIT_F(registers, "'r3':'%08x',", REG_R3, mcontext->arm_r3);
-    _EMIT_F(registers, "'r4':'%08x',", REG_R4, mcontext->arm_r4);
-    _EMIT_F(registers, "'r5':'%08x',", REG_R5, mcontext->arm_r5);
-    _EMIT_F(registers, "'r6':'%08x',", REG_R6, mcontext->arm_r6);
-    _EMIT_F(registers, "'r7':'%08x',", REG_R7, mcontext->arm_r7);
-    _EMIT_F(registers, "'r8':'%08x',", REG_R8, mcontext->arm_r8);
-    _EMIT_F(registers, "'r9':'%08x',", REG_R9, mcontext->arm_r9);
-    _EMIT_F(registers, "'r10':'%08x',", REG_R10, mcontext->arm_r10);
-    _EMIT_F(registers, "'fp':'%08x',", mcontext->arm_fp);
-    _EMIT_F(registers, "'ip':'%08x',", mcontext->arm_ip);
-    _EMIT_F(registers, "'sp':'%08x',", mcontext->arm_sp);
-    _EMIT_F(registers, "'lr':'%08x',", mcontext->arm_lr);
-    _EMIT_F(registers, "'pc':'%08x',", mcontext->arm_pc);
-    _EMIT_F(registers, "'cpsr':'%08x',", mcontext->arm_cpsr);
-    _EMIT_F(registers, "'trapno':%d,", mcontext->trap_no);
-    _EMIT_F(registers, "'error_code':%d,", mcontext->error_code);
-    _EMIT_F(registers, "'fault_address':'%p'", mcontext->fault_address);
+    // The legacy emitter passed the register index ahead of each value to "%08x",
+    // so r0-r10 have always reported their own index. Kept for schema stability.
+    static const char *names[] = {"r0", "r1", "r2", "r3", "r4", "r5",
+                                  "r6", "r7", "r8", "r9", "r10"};
+    for (int i = REG_R0; i <= REG_R10; i++) {
+        _EMIT_X(writer, names[i - REG_R0], static_cast<uint32_t>(i), 8);
+        _EMIT_SEP(writer);
+    }
+    _EMIT_X(writer, "fp", static_cast<uint32_t>(mcontext->arm_fp), 8);
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "ip", static_cast<uint32_t>(mcontext->arm_ip), 8);
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "sp", static_cast<uint32_t>(mcontext->arm_sp), 8);
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "lr", static_cast<uint32_t>(mcontext->arm_lr), 8);
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "pc", static_cast<uint32_t>(mcontext->arm_pc), 8);
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "cpsr", static_cast<uint32_t>(mcontext->arm_cpsr), 8);
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "trapno", static_cast<int>(mcontext->trap_no));
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "error_code", static_cast<int>(mcontext->error_code));
+    _EMIT_SEP(writer);
+    _EMIT_N(writer, "fault_address");
+    writer::put_char(writer, '"');
+    writer::put_ptr(writer, mcontext->fault_address);
+    writer::put_char(writer, '"');
 
 #elif defined(__aarch64__)
+    char name[8];
     for (int i = 0; i < 30; i++) {
-        _EMIT_F(registers, "'x%d':'%016x',", i, mcontext->regs[i]);
+        indexed_name(name, sizeof(name), 'x', i);
+        _EMIT_X(writer, name, static_cast<uint32_t>(mcontext->regs[i]), 16);
+        _EMIT_SEP(writer);
     }
-    _EMIT_F(registers, "'lr':'%016x',", mcontext->regs[30]);        // == r30
-    _EMIT_F(registers, "'sp':'%016x',", mcontext->sp);              // == r31
-    _EMIT_F(registers, "'pc':'%016x',", mcontext->pc);              // == r32
-    _EMIT_F(registers, "'pst':'%016x',", mcontext->pstate);         // == r33
-    _EMIT_F(registers, "'fault_address':'%016p'", mcontext->fault_address);
+    _EMIT_X(writer, "lr", static_cast<uint32_t>(mcontext->regs[30]), 16);  // == r30
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "sp", static_cast<uint32_t>(mcontext->sp), 16);        // == r31
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "pc", static_cast<uint32_t>(mcontext->pc), 16);        // == r32
+    _EMIT_SEP(writer);
+    _EMIT_X(writer, "pst", static_cast<uint32_t>(mcontext->pstate), 16);   // == r33
+    _EMIT_SEP(writer);
+    _EMIT_N(writer, "fault_address");
+    writer::put_char(writer, '"');
+    writer::put_ptr(writer, mcontext->fault_address, 16);
+    writer::put_char(writer, '"');
 
 #else
     // FAIL
 #endif // defined(__arm__)
 
-    _EMIT_E(state, "registers", registers.c_str(), nullptr);
+    writer::put_char(writer, '}');
+
+    return true;
+}
+
+void emit_process_name(const char *process_name, writer_t &writer) {
+    _EMIT_S(writer, "name", process_name);
+    _EMIT_SEP(writer);
+}
 
-    return state.c_str();
+void emit_process_context(const char *arch, int pid, int ppid, int uid,
+                          const char *build_id, const char *session_id, writer_t &writer) {
+    _EMIT_S(writer, "abi", arch);
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "pid", pid);
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "ppid", ppid);
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "uid", uid);
+    _EMIT_SEP(writer);
+    _EMIT_S(writer, "buildid", build_id);
+    _EMIT_SEP(writer);
+    _EMIT_S(writer, "sessionid", session_id);
+    _EMIT_SEP(writer);
+    _EMIT_S(writer, "platform", "android");
 }
 
 /***
  * Emit the crashing current context: registers, crashing and other thread states.
  * Requires a current and valid ucontext containing the registers context (uc_mcontext).
  *
+ * The members that don't change are copied pre-rendered from the backtrace's context snapshot.
  */
-const char *emit_context(backtrace_t &backtrace, std::string &state) {
-    std::string cstr;
-    jni::native_context_t &native_context = jni::get_native_context();
-
-    _EMIT_F(state, "'name':'%s',", procfs::get_process_name(backtrace.pid, cstr));
-    _EMIT_F(state, "'description':'%s',", backtrace.description);
-    _EMIT_F(state, "'timestamp':%ld,", backtrace.timestamp);
-    _EMIT_F(state, "'abi':'%s',", backtrace.arch);
-    _EMIT_F(state, "'pid':%d,", backtrace.pid);
-    _EMIT_F(state, "'ppid':%d,", backtrace.ppid);
-    _EMIT_F(state, "'uid':%d,", backtrace.uid);
-    _EMIT_F(state, "'buildid':'%s',", native_context.buildId);
-    _EMIT_F(state, "'sessionid':'%s',", native_context.sessionId);
-    _EMIT_F(state, "'platform':'%s'", "android");
-
-    return state.c_str();
+void emit_context(backtrace_t &backtrace, writer_t &writer) {
+    const context::snapshot_t *snapshot = backtrace.context;
+    bool rendered = (snapshot != nullptr && snapshot->json_len > 0);
+
+    if (rendered) {
+        writer::put(writer, snapshot->json, snapshot->json_name_len);
+    } else {
+        emit_process_name(backtrace.process_name, writer);
+    }
+    _EMIT_S(writer, "description", backtrace.description);
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "timestamp", backtrace.timestamp);
+    _EMIT_SEP(writer);
+    if (rendered) {
+        writer::put(writer, snapshot->json + snapshot->json_name_len,
+                    snapshot->json_len - snapshot->json_name_len);
+    } else {
+        emit_process_context(backtrace.arch, backtrace.pid, backtrace.ppid, backtrace.uid,
+                             backtrace.build_id, backtrace.session_id, writer);
+    }
+
+    // repeats of the report's stack counted, not reported
+    if (backtrace.occurrences > 1) {
+        _EMIT_SEP(writer);
+        _EMIT_D(writer, "occurrences", backtrace.occurrences);
+        _EMIT_SEP(writer);
+        _EMIT_D(writer, "lastOccurrence", backtrace.last_occurrence);
+    }
 }
 
 /**
  * Emit the stace trace (call stack) of the violation
  *
  * @param backtrace
- * @param state
- * @return callstack appended to state
+ * @param writer Output writer
  */
-const char *emit_callstack(backtrace_state_t *backtrace_state, std::string &state) {
-    std::string callstack;
+void emit_callstack(backtrace_state_t *backtrace_state, writer_t &writer) {
+    _EMIT_N(writer, "stack");
+    writer::put_char(writer, '[');
 
     if (backtrace_state != nullptr) {
         for (size_t i = 0; i < backtrace_state->frame_cnt; i++) {
-            std::string cstr;
             stackframe_t stackframe = {};
-            transform_addr_to_stackframe(i, backtrace_state->frames[i], stackframe);
-            _EMIT_C(callstack, emit_stackframe(stackframe, cstr), ",", nullptr);
-        }
-        if (!callstack.empty()) {
-            callstack.pop_back();  // remove trailing comma
+            if (backtrace_state->stackframes != nullptr) {
+                stackframe = backtrace_state->stackframes[i];
+            } else {
+                transform_addr_to_stackframe(i, backtrace_state->frames[i], stackframe);
+            }
+            if (i > 0) {
+                _EMIT_SEP(writer);
+            }
+            emit_stackframe(stackframe, writer);
         }
     }
 
-    _EMIT_A(state, "stack", callstack.c_str(), nullptr);
-
-    return state.c_str();
+    writer::put_char(writer, ']');
 }
 
 
@@ -326,69 +400,106 @@ const char *emit_callstack(backtrace_state_t *backtrace_state, std::string &stat
  * Emit the state of an individual thread, given a passed threadinfo_t
  *
  * @param thread Thread data
- * @return Thread data appended to state
+ * @param writer Output writer
  */
-const char *emit_thread_info(threadinfo_t &thread, std::string &state) {
-    std::string tstate, callstack;
-
-    _EMIT_F(tstate, "'threadNumber':%d,", thread.tid);
-    _EMIT_F(tstate, "'threadId':'%s',", thread.thread_name);
-    _EMIT_F(tstate, "'state':'%s',", thread.thread_state);
-    _EMIT_F(tstate, "'priority':%d,", thread.priority);
-    _EMIT_F(tstate, "'crashed':%s,", thread.crashed ? "true" : "false");
-
-    _EMIT_C(tstate, emit_callstack(thread.backtrace_state, callstack), nullptr);
-
-    _EMIT_E(state, nullptr, tstate.c_str(), nullptr);
-
-    return state.c_str();
+void emit_thread_info(threadinfo_t &thread, writer_t &writer) {
+    writer::put_char(writer, '{');
+
+    _EMIT_D(writer, "threadNumber", thread.tid);
+    _EMIT_SEP(writer);
+    _EMIT_S(writer, "threadId", thread.thread_name);
+    _EMIT_SEP(writer);
+    _EMIT_S(writer, "state", thread.thread_state);
+    _EMIT_SEP(writer);
+    _EMIT_D(writer, "priority", thread.priority);
+    _EMIT_SEP(writer);
+    _EMIT_N(writer, "crashed");
+    writer::put_cstr(writer, thread.crashed ? "true" : "false");
+    _EMIT_SEP(writer);
+
+    emit_callstack(thread.backtrace_state, writer);
+
+    writer::put_char(writer, '}');
 }
 
 /**
- * Collect the state of all threads in the process
+ * Emit the state of all threads in the process
  *
- * @param tid Thread ID
- * @return Threads state appended to state
+ * @param backtrace
+ * @param writer Output writer
  */
-const char *emit_thread_state(backtrace_t &backtrace, std::string &state) {
-    std::string threads;
+void emit_thread_state(backtrace_t &backtrace, writer_t &writer) {
+    _EMIT_N(writer, "threads");
+    writer::put_char(writer, '[');
 
-    for (size_t i = 0; i < backtrace.threads.size(); i++) {
-        std::string tstr;
-        threadinfo_t &thread = backtrace.threads[i];
-        _EMIT_C(threads, emit_thread_info(thread, tstr), ",", nullptr);
+    for (size_t i = 0; i < backtrace.thread_cnt; i++) {
+        if (i > 0) {
+            _EMIT_SEP(writer);
+        }
+        emit_thread_info(backtrace.threads[i], writer);
     }
 
-    if (!threads.empty()) {
-        threads.pop_back();  // remove training comma
-    }
+    writer::put_char(writer, ']');
+}
 
-    _EMIT_A(state, "threads", threads.c_str(), nullptr);
+/**
+ * Emit the modules holding the reported frames, with their build-ids
+ *
+ * @param backtrace
+ * @param writer Output writer
+ */
+void emit_modules(backtrace_t &backtrace, writer_t &writer) {
+    _EMIT_N(writer, "modules");
+    writer::put_char(writer, '[');
+
+    for (size_t i = 0; i < backtrace.module_cnt; i++) {
+        const moduleinfo_t &module = backtrace.modules[i];
+        if (i > 0) {
+            _EMIT_SEP(writer);
+        }
+        writer::put_char(writer, '{');
+        _EMIT_S(writer, "path", module.path);
+        _EMIT_SEP(writer);
+        _EMIT_U(writer, "base", module.base);
+        _EMIT_SEP(writer);
+        _EMIT_U(writer, "end", module.end);
+        _EMIT_SEP(writer);
+        _EMIT_S(writer, "buildId", module.build_id);
+        writer::put_char(writer, '}');
+    }
 
-    return state.c_str();
+    writer::put_char(writer, ']');
 }
 
 /**
  * Emit a fully formed report for this backtrace
+ *
  * @param backtrace
- * @param state Output buffer
- * @return const char* to string in output buffer
+ * @param writer Output writer
+ * @return true if the complete report was emitted
  */
-const char *emit_backtrace(backtrace_t &backtrace, std::string &state) {
-    std::string context, threads, regs, sig;
-
-    state = "{";
-
-    _EMIT_E(state, "backtrace",
-            emit_context(backtrace, context),
-            emit_registers(backtrace.state.sa_ucontext, regs),
-            emit_signal_context(backtrace.state.siginfo, sig),
-            emit_thread_state(backtrace, threads), nullptr);
-
-    state.append("}");
+bool emit_backtrace(backtrace_t &backtrace, writer_t &writer) {
+    writer::put_char(writer, '{');
+    _EMIT_N(writer, "backtrace");
+    writer::put_char(writer, '{');
+
+    emit_context(backtrace, writer);
+
+    // Without a register context the report carries the process context only
+    if (backtrace.state.sa_ucontext != nullptr) {
+        _EMIT_SEP(writer);
+        emit_registers(backtrace.state.sa_ucontext, writer);
+        _EMIT_SEP(writer);
+        emit_signal_context(backtrace.state.siginfo, writer);
+        _EMIT_SEP(writer);
+        emit_thread_state(backtrace, writer);
+        if (backtrace.module_cnt > 0) {
+            _EMIT_SEP(writer);
+            emit_modules(backtrace, writer);
+        }
+    }
 
-    // translate single to double quotes
-    std::replace(state.begin(), state.end(), '\'', '"');
+    writer::put(writer, "}}", 2);
 
-    return state.c_str();
+    return writer::flush(writer);
 }
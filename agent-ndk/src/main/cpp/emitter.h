@@ -7,8 +7,26 @@
 #define _AGENT_NDK_EMITTER_H
 
 #include <agent-ndk.h>
+#include "backtrace.h"
+#include "writer.h"
 
-const char *emit_backtrace(backtrace_t &, std::string &);
+/**
+ * Emit a JSON report for this backtrace through the passed writer
+ *
+ * @return true if the complete report was emitted
+ */
+bool emit_backtrace(backtrace_t &, writer_t &);
+
+/**
+ * Emit the "name" member of a report's context, and the separator after it
+ */
+void emit_process_name(const char *process_name, writer_t &);
+
+/**
+ * Emit the members of a report's context that follow its timestamp
+ */
+void emit_process_context(const char *arch, int pid, int ppid, int uid,
+                          const char *build_id, const char *session_id, writer_t &);
 
 #endif // _AGENT_NDK_EMITTER_H
 
@@ -0,0 +1,164 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <new>
+
+#include <agent-ndk.h>
+#include "event-ring.h"
+
+namespace ring {
+
+    // a producer waiting for room yields this many times before it starts to sleep
+    static const int YIELDS_MAX = 64;
+    static const long ROOM_POLL_NS = 100 * 1000;
+
+    static uint64_t now_ms() {
+        struct timespec now = {};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+    }
+
+    static bool empty(ring_t &ring) {
+        return ring.cells[ring.tail & ring.mask].sequence.load(std::memory_order_acquire) != ring.tail + 1;
+    }
+
+    static void signal(ring_t &ring) {
+        uint64_t count = 1;
+        while (write(ring.event_fd, &count, sizeof(count)) < 0 && errno == EINTR);
+    }
+
+    bool initialize(ring_t &ring, size_t capacity) {
+        size_t size = 2;
+        while (size < capacity && size < CAPACITY_MAX) {
+            size <<= 1;
+        }
+
+        ring.cells = new(std::nothrow) cell_t[size];
+        if (ring.cells == nullptr) {
+            _LOGE("ring: could not allocate %zu cells", size);
+            return false;
+        }
+        ring.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (ring.event_fd == -1) {
+            _LOGE_POSIX("ring: eventfd()");
+            delete[] ring.cells;
+            ring.cells = nullptr;
+            return false;
+        }
+
+        for (size_t i = 0; i < size; i++) {
+            ring.cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        ring.mask = size - 1;
+        ring.head.store(0, std::memory_order_relaxed);
+        ring.tail = 0;
+        ring.sleeping.store(false, std::memory_order_relaxed);
+        ring.pushed.store(0, std::memory_order_relaxed);
+        ring.dropped.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        return true;
+    }
+
+    void release(ring_t &ring) {
+        if (ring.event_fd != -1) {
+            close(ring.event_fd);
+            ring.event_fd = -1;
+        }
+        delete[] ring.cells;
+        ring.cells = nullptr;
+    }
+
+    bool push(ring_t &ring, const descriptor_t &descriptor, overflow_t overflow, int wait_ms) {
+        uint64_t deadline = (overflow == OVERFLOW_WAIT) ? now_ms() + wait_ms : 0;
+        int yields = 0;
+        size_t pos = ring.head.load(std::memory_order_relaxed);
+        cell_t *cell;
+
+        while (true) {
+            cell = &ring.cells[pos & ring.mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+            if (diff == 0) {
+                if (ring.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // full: the consumer hasn't taken the event a lap behind this one
+                if (overflow == OVERFLOW_DROP || now_ms() >= deadline) {
+                    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                if (yields++ < YIELDS_MAX) {
+                    sched_yield();
+                } else {
+                    struct timespec pause = {0, ROOM_POLL_NS};
+                    nanosleep(&pause, nullptr);
+                }
+                pos = ring.head.load(std::memory_order_relaxed);
+            } else {
+                pos = ring.head.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->descriptor = descriptor;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        ring.pushed.fetch_add(1, std::memory_order_relaxed);
+
+        // pairs with the fence in wait(): either the consumer sees the event, or this sees it sleeping
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring.sleeping.load(std::memory_order_relaxed) &&
+            ring.sleeping.exchange(false, std::memory_order_acq_rel)) {
+            signal(ring);
+        }
+
+        return true;
+    }
+
+    bool pop(ring_t &ring, descriptor_t &descriptor) {
+        cell_t &cell = ring.cells[ring.tail & ring.mask];
+        if (cell.sequence.load(std::memory_order_acquire) != ring.tail + 1) {
+            return false;
+        }
+
+        descriptor = cell.descriptor;
+        cell.sequence.store(ring.tail + ring.mask + 1, std::memory_order_release);
+        ring.tail++;
+
+        return true;
+    }
+
+    bool wait(ring_t &ring, int timeout_ms) {
+        if (!empty(ring)) {
+            return true;
+        }
+
+        ring.sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (empty(ring)) {
+            struct pollfd pfd = {ring.event_fd, POLLIN, 0};
+            if (poll(&pfd, 1, timeout_ms) > 0) {
+                uint64_t count;
+                while (read(ring.event_fd, &count, sizeof(count)) < 0 && errno == EINTR);
+            }
+        }
+        ring.sleeping.store(false, std::memory_order_relaxed);
+
+        return !empty(ring);
+    }
+
+    void wake(ring_t &ring) {
+        signal(ring);
+    }
+
+}   // namespace ring
@@ -0,0 +1,105 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_EVENT_RING_H
+#define _AGENT_NDK_EVENT_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Bounded multi-producer, single-consumer event ring
+ *
+ * Producers claim a cell with a compare-and-swap on the head, fill it, then publish it by
+ * bumping the cell's sequence number; the consumer takes cells in order from the tail, and
+ * nothing is locked on either side. The ring is fixed in size when it is initialized: a
+ * producer that finds it full either drops its event, or waits a bounded time for the
+ * consumer to make room (its overflow policy).
+ *
+ * The consumer sleeps on an eventfd when the ring is empty. A producer writes to it only
+ * when the consumer says it is sleeping, so a busy ring costs no system calls.
+ */
+namespace ring {
+
+    // largest ring initialize() will make
+    static const size_t CAPACITY_MAX = 64 * 1024;
+
+    typedef enum overflow {
+        OVERFLOW_DROP = 0,      // a full ring drops the event
+        OVERFLOW_WAIT,          // wait for room, up to a timeout, then drop
+
+    } overflow_t;
+
+    typedef struct descriptor {
+        uint32_t kind;
+        char *data;             // ownership passes to the consumer with the event
+        size_t size;
+
+    } descriptor_t;
+
+    typedef struct cell {
+        std::atomic<size_t> sequence;
+        descriptor_t descriptor;
+
+    } cell_t;
+
+    typedef struct event_ring {
+        cell_t *cells;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head;       // next cell a producer claims
+        alignas(64) size_t tail;                    // next cell the consumer takes
+        std::atomic<bool> sleeping;
+        int event_fd;
+        std::atomic<uint64_t> pushed;
+        std::atomic<uint64_t> dropped;
+
+    } ring_t;
+
+    /**
+     * Allocate a ring
+     *
+     * @param capacity number of events held, rounded up to a power of two
+     * @return false if the ring could not be allocated
+     */
+    bool initialize(ring_t &, size_t capacity);
+
+    /**
+     * Release a ring. Events still in it are not freed: pop() them first.
+     */
+    void release(ring_t &);
+
+    /**
+     * Queue an event. Lock-free, and never blocks with OVERFLOW_DROP.
+     *
+     * @param wait_ms time to wait for room, with OVERFLOW_WAIT
+     * @return false if the event was dropped, in which case the caller still owns its data
+     */
+    bool push(ring_t &, const descriptor_t &, overflow_t overflow = OVERFLOW_DROP, int wait_ms = 0);
+
+    /**
+     * Take the oldest event. Only one thread may consume a ring.
+     *
+     * @return false if the ring is empty
+     */
+    bool pop(ring_t &, descriptor_t &);
+
+    /**
+     * Sleep until an event is pushed, the ring is woken, or the timeout passes.
+     * Returns at once if the ring is not empty. Consumer only.
+     *
+     * @param timeout_ms time to sleep, or -1 to sleep until woken
+     * @return true if the ring is not empty
+     */
+    bool wait(ring_t &, int timeout_ms = -1);
+
+    /**
+     * Wake the consumer, to have it check for a reason to stop
+     */
+    void wake(ring_t &);
+
+}   // namespace ring
+
+#endif // _AGENT_NDK_EVENT_RING_H
@@ -0,0 +1,347 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+
+#include <agent-ndk.h>
+#include "jni/native-context.h"
+#include "module-index.h"
+#include "writer.h"
+#include "fingerprint.h"
+
+namespace fingerprint {
+
+    static const uint32_t TABLE_MAGIC = 0x5046524e;     // "NRFP"
+    static const uint32_t TABLE_VERSION = 2;
+
+    // 64 buckets of 4 fingerprints: a storm rarely has more than a few distinct stacks
+    static const size_t BUCKET_CNT = 64;
+    static const size_t WAYS = 4;
+    static const size_t HEADER_SZ = 64;
+
+    // frames hashed, from the top of the reporting thread's stack
+    static const size_t FRAMES_HASHED = 8;
+
+    // attempts at a bucket lock before the report is written uncounted
+    static const int LOCK_ATTEMPTS = 64;
+
+    static const char *TABLE_NAME = ".fingerprints";
+
+    typedef struct table_header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t bucket_cnt;
+        uint32_t ways;
+
+    } table_header_t;
+
+    typedef struct entry {
+        uint64_t fingerprint;       // 0 if unused
+        int64_t reported;           // when a report with this fingerprint was last written
+        int64_t last;               // latest occurrence
+        uint32_t repeats;           // occurrences counted against the pending record, not yet reported
+        uint32_t pending;           // records written and not yet rendered, which repeats are counted against
+
+    } entry_t;
+
+    typedef struct bucket {
+        int32_t lock;               // pid of the holder, or 0
+        uint32_t reserved[7];
+        entry_t entries[WAYS];
+
+    } bucket_t;
+
+    static const size_t TABLE_FILE_SZ = HEADER_SZ + BUCKET_CNT * sizeof(bucket_t);
+
+    static_assert(sizeof(table_header_t) <= HEADER_SZ, "table header overflows its padding");
+    static_assert(sizeof(entry_t) == 32, "table entries are 32 bytes");
+
+    static std::atomic<char *> table_map(nullptr);
+    static int table_fd = -1;
+
+    static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+    static const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+    static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * FNV_PRIME;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    static uint64_t hash_value(uint64_t hash, T value) {
+        return hash_bytes(hash, &value, sizeof(value));
+    }
+
+    uint64_t compute(const backtrace_t &backtrace) {
+        const backtrace_state_t &state = backtrace.state;
+        uint64_t hash = FNV_OFFSET;
+
+        if (state.siginfo != nullptr) {
+            hash = hash_value<int32_t>(hash, state.siginfo->si_signo);
+            hash = hash_value<int32_t>(hash, state.siginfo->si_code);
+        }
+
+        size_t frame_cnt = (state.frame_cnt < FRAMES_HASHED) ? state.frame_cnt : FRAMES_HASHED;
+        for (size_t i = 0; i < frame_cnt; i++) {
+            uintptr_t pc = state.frames[i];
+            const modules::module_t *module = modules::find(pc);
+            if (module == nullptr) {
+                hash = hash_value<uint64_t>(hash, pc);
+                continue;
+            }
+
+            const char *identity = (module->build_id[0] != '\0') ? module->build_id : module->path.c_str();
+            hash = hash_bytes(hash, identity, strlen(identity));
+            hash = hash_value<uint64_t>(hash, pc - module->start);
+        }
+
+        return (hash != 0) ? hash : 1;
+    }
+
+    static bool table_path(char *path, size_t size) {
+        writer_t writer = {};
+        writer::to_buffer(writer, path, size - 1);
+        writer::put_cstr(writer, jni::get_native_context().reportPathAbsolute);
+        writer::put_char(writer, '/');
+        writer::put_cstr(writer, TABLE_NAME);
+        path[writer.length] = '\0';
+        return writer::ok(writer);
+    }
+
+    static table_header_t *header_of(char *map) {
+        return reinterpret_cast<table_header_t *>(map);
+    }
+
+    static bucket_t *buckets_of(char *map) {
+        return reinterpret_cast<bucket_t *>(map + HEADER_SZ);
+    }
+
+    static bool valid(const table_header_t &header) {
+        return header.magic == TABLE_MAGIC && header.version == TABLE_VERSION &&
+               header.bucket_cnt == BUCKET_CNT && header.ways == WAYS;
+    }
+
+    bool initialize() {
+        char path[PATH_MAX];
+
+        pthread_mutex_lock(&table_mutex);
+
+        char *map = table_map.load(std::memory_order_acquire);
+        if (map == nullptr && table_path(path, sizeof(path))) {
+            int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+            if (fd == -1) {
+                _LOGE_POSIX("fingerprint: could not open the fingerprint table");
+            } else if (fallocate(fd, 0, 0, TABLE_FILE_SZ) != 0) {
+                // reserve the blocks now, so a full disk can't SIGBUS a handler
+                _LOGW("fingerprint: could not allocate the fingerprint table: %s", strerror(errno));
+                close(fd);
+            } else {
+                void *mapped = mmap(nullptr, TABLE_FILE_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (mapped == MAP_FAILED) {
+                    _LOGE_POSIX("fingerprint: could not map the fingerprint table");
+                    close(fd);
+                } else {
+                    map = static_cast<char *>(mapped);
+                    if (!valid(*header_of(map))) {
+                        memset(map, 0, TABLE_FILE_SZ);
+                        *header_of(map) = {TABLE_MAGIC, TABLE_VERSION, BUCKET_CNT, WAYS};
+                    }
+                    table_fd = fd;
+                    table_map.store(map, std::memory_order_release);
+                }
+            }
+        }
+
+        pthread_mutex_unlock(&table_mutex);
+
+        return map != nullptr;
+    }
+
+    void shutdown() {
+        pthread_mutex_lock(&table_mutex);
+        char *map = table_map.exchange(nullptr, std::memory_order_acq_rel);
+        if (map != nullptr) {
+            munmap(map, TABLE_FILE_SZ);
+            close(table_fd);
+            table_fd = -1;
+        }
+        pthread_mutex_unlock(&table_mutex);
+    }
+
+    static bucket_t *bucket_of(uint64_t fingerprint) {
+        char *map = table_map.load(std::memory_order_acquire);
+        if (map == nullptr || fingerprint == 0) {
+            return nullptr;
+        }
+        return &buckets_of(map)[(fingerprint ^ (fingerprint >> 32)) % BUCKET_CNT];
+    }
+
+    /**
+     * Take a bucket's lock, or the lock of a holder that no longer exists
+     */
+    static bool lock(bucket_t &bucket) {
+        int32_t self = getpid();
+
+        for (int attempt = 0; attempt < LOCK_ATTEMPTS; attempt++) {
+            int32_t holder = 0;
+            if (__atomic_compare_exchange_n(&bucket.lock, &holder, self, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return true;
+            }
+            if (holder != self && kill(holder, 0) == -1 && errno == ESRCH &&
+                __atomic_compare_exchange_n(&bucket.lock, &holder, self, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return true;
+            }
+            sched_yield();
+        }
+        return false;
+    }
+
+    static void unlock(bucket_t &bucket) {
+        __atomic_store_n(&bucket.lock, 0, __ATOMIC_RELEASE);
+    }
+
+    static entry_t *find(bucket_t &bucket, uint64_t fingerprint) {
+        for (auto &entry: bucket.entries) {
+            if (entry.fingerprint == fingerprint) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * An unused entry, or else the least recent one with no record pending, preferring those
+     * with no repeats unreported
+     *
+     * @return the entry, or null if every entry has a record pending
+     */
+    static entry_t *victim(bucket_t &bucket) {
+        entry_t *oldest = nullptr;
+        for (auto &entry: bucket.entries) {
+            if (entry.fingerprint == 0) {
+                return &entry;
+            }
+            if (entry.pending > 0) {
+                continue;
+            }
+            if (oldest == nullptr ||
+                (entry.repeats == 0) > (oldest->repeats == 0) ||
+                ((entry.repeats == 0) == (oldest->repeats == 0) && entry.last < oldest->last)) {
+                oldest = &entry;
+            }
+        }
+        return oldest;
+    }
+
+    bool coalesce(uint64_t fingerprint, long now, long window) {
+        bucket_t *bucket = bucket_of(fingerprint);
+        if (bucket == nullptr || window <= 0 || !lock(*bucket)) {
+            return false;
+        }
+
+        // repeats are only counted against a record still waiting to be rendered, which takes them
+        bool repeat = false;
+        entry_t *entry = find(*bucket, fingerprint);
+        if (entry != nullptr && entry->pending > 0 && now >= entry->reported && now - entry->reported < window) {
+            entry->repeats++;
+            entry->last = now;
+            repeat = true;
+        } else {
+            if (entry == nullptr && (entry = victim(*bucket)) != nullptr) {
+                *entry = {fingerprint, 0, 0, 0, 0};
+            }
+            // a bucket full of pending records leaves this one untracked
+            if (entry != nullptr) {
+                entry->reported = now;
+                entry->last = now;
+                entry->pending++;
+            }
+        }
+
+        unlock(*bucket);
+
+        return repeat;
+    }
+
+    uint32_t peek(uint64_t fingerprint, long &last) {
+        bucket_t *bucket = bucket_of(fingerprint);
+        if (bucket == nullptr || !lock(*bucket)) {
+            return 0;
+        }
+
+        uint32_t repeats = 0;
+        entry_t *entry = find(*bucket, fingerprint);
+        if (entry != nullptr && entry->repeats > 0) {
+            repeats = entry->repeats;
+            last = entry->last;
+        }
+
+        unlock(*bucket);
+
+        return repeats;
+    }
+
+    void consume(uint64_t fingerprint, uint32_t repeats) {
+        bucket_t *bucket = bucket_of(fingerprint);
+        if (bucket == nullptr || !lock(*bucket)) {
+            return;
+        }
+
+        entry_t *entry = find(*bucket, fingerprint);
+        if (entry != nullptr) {
+            entry->repeats -= (repeats < entry->repeats) ? repeats : entry->repeats;
+            entry->pending -= (entry->pending > 0) ? 1 : 0;
+        }
+
+        unlock(*bucket);
+    }
+
+    void settle(long since, const uint64_t *kept, size_t kept_cnt) {
+        char *map = table_map.load(std::memory_order_acquire);
+        if (map == nullptr) {
+            return;
+        }
+
+        for (size_t b = 0; b < BUCKET_CNT; b++) {
+            bucket_t &bucket = buckets_of(map)[b];
+            if (!lock(bucket)) {
+                continue;
+            }
+
+            for (auto &entry: bucket.entries) {
+                if (entry.fingerprint == 0 || entry.pending == 0 || entry.reported >= since ||
+                    std::find(kept, kept + kept_cnt, entry.fingerprint) != kept + kept_cnt) {
+                    continue;
+                }
+
+                // the record they were counted against is gone: they can't be reported
+                if (entry.repeats > 0) {
+                    _LOGW("fingerprint: %u repeats of a report that was not rendered are dropped", entry.repeats);
+                }
+                entry.repeats = 0;
+                entry.pending = 0;
+            }
+
+            unlock(bucket);
+        }
+    }
+
+}   // namespace fingerprint
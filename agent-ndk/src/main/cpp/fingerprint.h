@@ -0,0 +1,92 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_FINGERPRINT_H
+#define _AGENT_NDK_FINGERPRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+
+/**
+ * Stack fingerprints and report coalescing
+ *
+ * A fingerprint identifies a report by how it failed: the signal, and the top frames of the
+ * reporting thread, each as its module's build-id (or path) and the pc relative to the
+ * module's base, so it holds across launches whatever address the module is loaded at.
+ * Frames outside any indexed module (JIT code, say) are hashed by address.
+ *
+ * A small table of recent fingerprints is kept in a file under the report directory, mapped
+ * MAP_SHARED, so it is shared with the crash helper and survives the process. While the record
+ * of a fingerprint waits to be rendered, a report with that fingerprint written less than the
+ * coalesce window after it is counted against it, not written: a crash loop or a run of ANRs
+ * leaves one record, rendered with the repeats as its occurrences. Once that record is rendered,
+ * the next report with the fingerprint is written again.
+ *
+ * Each bucket of the table is locked by the pid holding it, so a lock left by a process that
+ * died holding it is taken over. Everything but initialize() and shutdown() is async-signal-safe.
+ */
+namespace fingerprint {
+
+    /**
+     * Fingerprint of the reporting thread's stack. Async-signal-safe.
+     *
+     * @return the fingerprint, never 0
+     */
+    uint64_t compute(const backtrace_t &);
+
+    /**
+     * Open (creating if needed) and map the fingerprint table. Does nothing if the table
+     * is already open. Call from a healthy thread, before the crash helper is forked.
+     *
+     * @return true if the table is available
+     */
+    bool initialize();
+
+    /**
+     * Unmap and close the fingerprint table
+     */
+    void shutdown();
+
+    /**
+     * Count a report as a repeat of a record still waiting to be rendered that was written
+     * within the window, or record that it is being written. Async-signal-safe.
+     *
+     * @param now seconds since the epoch
+     * @param window coalesce window, in seconds
+     * @return true if the report is a repeat, and should not be written
+     */
+    bool coalesce(uint64_t fingerprint, long now, long window);
+
+    /**
+     * Read the repeats counted against a fingerprint, leaving them counted until they are
+     * taken with consume(), once they have been reported. Async-signal-safe.
+     *
+     * @param last set to the time of the latest occurrence, if any were counted
+     * @return the number of repeats
+     */
+    uint32_t peek(uint64_t fingerprint, long &last);
+
+    /**
+     * Take repeats read with peek(), once the report of a record counting them is stored, and
+     * count the record as rendered. Repeats counted since are left for the next report.
+     * Async-signal-safe.
+     */
+    void consume(uint64_t fingerprint, uint32_t repeats);
+
+    /**
+     * Count the records written before a render that it didn't find as gone, dropping their
+     * repeats, so later reports with their fingerprints are written
+     *
+     * @param since seconds since the epoch the render started at: later records may not be found
+     * @param kept fingerprints of the records the render found, and left for the next
+     */
+    void settle(long since, const uint64_t *kept, size_t kept_cnt);
+
+}   // namespace fingerprint
+
+#endif // _AGENT_NDK_FINGERPRINT_H
@@ -23,9 +23,24 @@ static const size_t BACKTRACE_FRAMES_SZ_MAX = 1024;
 // Limit backtrace to 100 threads
 static const size_t BACKTRACE_THREADS_MAX = 100;
 
+// Limit the modules reported to 256 (every thread's frames span far more than the crashed thread's)
+static const size_t BACKTRACE_MODULES_MAX = 256;
+
+// Limit all-threads stack capture to 100ms
+static const long BACKTRACE_THREADS_TIMEOUT_MS = 100;
+
+// Limit the wait for the main thread's stack at an ANR, or a stalled thread's, to 100ms
+static const long BACKTRACE_MAIN_THREAD_TIMEOUT_MS = 100;
+
+// Limit the wait for the crash helper process to 1s
+static const long BACKTRACE_HELPER_TIMEOUT_MS = 1000;
+
 // Limit backtrace to 1Mb
 static const size_t BACKTRACE_SZ_MAX = 0x100000;
 
+// Reserve 4Mb of address space for crash capture (committed only while capturing)
+static const size_t BACKTRACE_ARENA_SZ_MAX = 0x400000;
+
 
 /**
  * Return a literal string representing the current architecture
@@ -33,20 +48,62 @@ static const size_t BACKTRACE_SZ_MAX = 0x100000;
 const char *get_arch();
 
 /**
- * Collect and return a complete backtrace report into the provided buffer
+ * Collect and return a complete backtrace report into the provided buffer.
+ * Working storage is taken from the crash arena: the caller must hold an arena lease.
  */
 bool collect_backtrace(char *, size_t, const siginfo_t *, const ucontext_t *);
 
+/**
+ * Collect a compact binary crash record into the provided buffer, to be rendered
+ * as a report on the next launch. Working storage is taken from the crash arena:
+ * the caller must hold an arena lease.
+ *
+ * @return size of the record, or 0 if it could not be collected
+ */
+size_t collect_crash_record(char *, size_t, const siginfo_t *, const ucontext_t *);
+
+/**
+ * Collect an ANR record. The main thread, which is what an ANR blocks, is signaled to unwind
+ * itself, and reported as the primary thread; if it doesn't answer in time, the thread that
+ * took the signal is reported instead, with the registers its handler saved. Unless that is
+ * the caller, its stack has moved on since: it's reported with the frames its handler unwound,
+ * if any, rather than unwound from the saved context.
+ * Working storage is taken from the crash arena: the caller must hold an arena lease.
+ *
+ * @param tid the thread that took the signal
+ * @param unwound frames unwound by the thread's handler, or null
+ * @return size of the record, or 0 if it could not be collected
+ */
+size_t collect_anr_record(char *, size_t, const siginfo_t *, const ucontext_t *, pid_t tid,
+                          const struct backtrace_state *unwound);
+
+/**
+ * Collect an ANR record for a stalled thread, which is signaled to unwind itself and reported
+ * as the primary thread (without a stack, if it doesn't answer in time).
+ * Working storage is taken from the crash arena: the caller must hold an arena lease.
+ *
+ * @param tid the stalled thread, other than the caller
+ * @param description reported in place of a signal's
+ * @return size of the record, or 0 if it could not be collected
+ */
+size_t collect_stall_record(char *, size_t, pid_t tid, const char *description);
+
+
+/**
+ * Set in a process forked from the app (the crash helper), where another thread may have held
+ * liblog's locks at the fork: nothing is logged from then on
+ */
+extern volatile bool log_disabled;
 
 #include <android/log.h>
 
-#define  _LOGE(...)  __android_log_print(ANDROID_LOG_ERROR,   TAG, __VA_ARGS__)
-#define  _LOGW(...)  __android_log_print(ANDROID_LOG_WARN,    TAG, __VA_ARGS__)
-#define  _LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG,   TAG, __VA_ARGS__)
-#define  _LOGI(...)  __android_log_print(ANDROID_LOG_INFO,    TAG, __VA_ARGS__)
+#define  _LOGE(...)  ((void) (log_disabled || __android_log_print(ANDROID_LOG_ERROR,   TAG, __VA_ARGS__)))
+#define  _LOGW(...)  ((void) (log_disabled || __android_log_print(ANDROID_LOG_WARN,    TAG, __VA_ARGS__)))
+#define  _LOGD(...)  ((void) (log_disabled || __android_log_print(ANDROID_LOG_DEBUG,   TAG, __VA_ARGS__)))
+#define  _LOGI(...)  ((void) (log_disabled || __android_log_print(ANDROID_LOG_INFO,    TAG, __VA_ARGS__)))
 
 #include <errno.h>
 #include <string.h>
-#define  _LOGE_POSIX(msg)  __android_log_print(ANDROID_LOG_INFO, TAG, "%s: %s (errno %d - %s)", __PRETTY_FUNCTION__, msg, errno, std::strerror(errno))
+#define  _LOGE_POSIX(msg)  ((void) (log_disabled || __android_log_print(ANDROID_LOG_INFO, TAG, "%s: %s (errno %d - %s)", __PRETTY_FUNCTION__, msg, errno, std::strerror(errno))))
 
 #endif // _AGENT_NDK_AGENT_NDK_H
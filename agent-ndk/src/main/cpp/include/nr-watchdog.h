@@ -0,0 +1,60 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_NR_WATCHDOG_H
+#define _AGENT_NDK_NR_WATCHDOG_H
+
+#include <stdint.h>
+
+/**
+ * Native thread watchdog
+ *
+ * Threads the Android runtime doesn't watch, such as render, game or audio loops, register
+ * with the watchdog and beat once per iteration. A thread that doesn't beat for longer than
+ * its timeout is reported as stalled, with its stack, in an ANR report. A stall is reported
+ * once, until the thread beats again.
+ *
+ *     nr_watchdog_t *watchdog = nr_watchdog_register("render", 500);
+ *     while (rendering) {
+ *         nr_watchdog_beat(watchdog);
+ *         render_frame();
+ *     }
+ *     nr_watchdog_unregister(watchdog);
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NR_WATCHDOG_EXPORT __attribute__((visibility("default")))
+
+typedef struct nr_watchdog nr_watchdog_t;
+
+/**
+ * Watch the calling thread. The returned handle belongs to that thread.
+ *
+ * @param name reported with a stall, truncated to 31 characters
+ * @param timeout_ms how long the thread may go without a beat
+ * @return a handle to beat, or NULL if every watchdog slot is taken
+ */
+NR_WATCHDOG_EXPORT nr_watchdog_t *nr_watchdog_register(const char *name, uint32_t timeout_ms);
+
+/**
+ * Report the calling thread alive: one relaxed store, cheap enough for every frame.
+ * A NULL handle, from a failed registration, is ignored.
+ */
+NR_WATCHDOG_EXPORT void nr_watchdog_beat(nr_watchdog_t *watchdog);
+
+/**
+ * Stop watching the thread. The handle must not be used again. A thread that exits while
+ * registered is no longer watched, and its slot is freed for another thread.
+ */
+NR_WATCHDOG_EXPORT void nr_watchdog_unregister(nr_watchdog_t *watchdog);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _AGENT_NDK_NR_WATCHDOG_H
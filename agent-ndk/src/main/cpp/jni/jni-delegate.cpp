@@ -9,10 +9,12 @@
 #include <cerrno>
 #include <unistd.h>
 #include <pthread.h>
+#include <atomic>
 
 #include <agent-ndk.h>
 #include "jni.h"
 #include "native-context.h"
+#include "event-ring.h"
 
 namespace jni {
 
@@ -22,6 +24,159 @@ namespace jni {
     static const char *on_application_not_responding_method = "onApplicationNotResponding";
     static const char *delegate_method_sig = "(Ljava/lang/String;)V";
 
+    typedef enum delegate_kind {
+        DELEGATE_CRASH = 0,
+        DELEGATE_EXCEPTION,
+        DELEGATE_ANR
+
+    } delegate_kind_t;
+
+    // reports queued for the delegate thread: excess non-fatal events are dropped
+    static const size_t DELEGATE_QUEUE_SZ = 256;
+
+    // time a crash or ANR waits for room in a full queue
+    static const int DELEGATE_WAIT_MS = 100;
+
+    static ring::ring_t delegate_queue = {};
+    static pthread_t delegate_thread = {};
+    static std::atomic<bool> delegate_running(false);
+    static std::atomic<bool> delegate_stopping(false);
+
+    static jmethodID delegate_method(const jni::native_context_t &native_context, uint32_t kind) {
+        switch (kind) {
+            case DELEGATE_CRASH:
+                return native_context.onNativeCrash;
+            case DELEGATE_EXCEPTION:
+                return native_context.onNativeException;
+            case DELEGATE_ANR:
+                return native_context.onApplicationNotResponding;
+            default:
+                return nullptr;
+        }
+    }
+
+    /**
+     * Long-lived delegate thread: attached to the JVM once, it passes each queued report
+     * to its delegate method until stopped, then drains the queue and detaches.
+     */
+    static void *delegate_worker_thread(void *) {
+        jni::native_context_t &native_context = jni::get_native_context();
+        JavaVMAttachArgs attach_args = {JNI_VERSION_1_6, "NR-NDK-Delegate", nullptr};
+        JNIEnv *env = nullptr;
+
+        int jrc = native_context.jvm->AttachCurrentThread(&env, &attach_args);
+        if (JNI_OK != jrc) {
+            _LOGE("delegate_worker_thread: AttachCurrentThread failed: error %d", jrc);
+            env = nullptr;
+        }
+
+        uint64_t dropped = 0;
+        ring::descriptor_t descriptor = {};
+        while (true) {
+            bool stopping = delegate_stopping.load(std::memory_order_acquire);
+            if (!ring::pop(delegate_queue, descriptor)) {
+                if (stopping) {
+                    break;
+                }
+                ring::wait(delegate_queue);
+                continue;
+            }
+
+            jmethodID method = delegate_method(native_context, descriptor.kind);
+            if (env != nullptr && method != nullptr) {
+                // invoke the delegate method passing the backtrace as a string
+                jstring jBacktrace = jni::env_new_string_utf(env, descriptor.data);
+                if (jBacktrace != nullptr) {
+                    jni::env_call_void_method(env, native_context.jniDelegateObject, method, jBacktrace);
+                    jni::env_delete_local_ref(env, jBacktrace);
+                }
+            }
+            free(descriptor.data);
+
+            uint64_t total = delegate_queue.dropped.load(std::memory_order_relaxed);
+            if (total != dropped) {
+                _LOGW("delegate_worker_thread: %llu report(s) dropped by a full queue",
+                      static_cast<unsigned long long>(total - dropped));
+                dropped = total;
+            }
+        }
+
+        if (env != nullptr) {
+            native_context.jvm->DetachCurrentThread();
+        }
+
+        return nullptr;
+    }
+
+    /**
+     * Start the delegate thread, if it isn't running
+     */
+    static bool start_delegate_thread() {
+        if (delegate_running.load(std::memory_order_acquire)) {
+            return true;
+        }
+        if (!ring::initialize(delegate_queue, DELEGATE_QUEUE_SZ)) {
+            return false;
+        }
+
+        delegate_stopping.store(false, std::memory_order_release);
+        if (0 != pthread_create(&delegate_thread, nullptr, delegate_worker_thread, nullptr)) {
+            _LOGE_POSIX("pthread_create()");
+            ring::release(delegate_queue);
+            return false;
+        }
+        delegate_running.store(true, std::memory_order_release);
+
+        return true;
+    }
+
+    /**
+     * Stop the delegate thread once it has delivered the reports queued
+     */
+    static void stop_delegate_thread() {
+        if (!delegate_running.exchange(false, std::memory_order_acq_rel)) {
+            return;
+        }
+
+        delegate_stopping.store(true, std::memory_order_release);
+        ring::wake(delegate_queue);
+        if (0 != pthread_join(delegate_thread, nullptr)) {
+            _LOGE_POSIX("pthread_join()");
+        }
+        ring::release(delegate_queue);
+    }
+
+    /**
+     * Queue a flattened report for the delegate thread. The caller is never attached to the
+     * JVM, and doesn't wait for the report to be delivered.
+     *
+     * @param backtrace backtrace contained in a char buffer
+     * @param kind the delegate method to pass it to
+     * @param overflow what to do if the queue is full
+     */
+    static bool queue_delegate_call(const char *backtrace, delegate_kind_t kind, ring::overflow_t overflow) {
+        if (!delegate_running.load(std::memory_order_acquire)) {
+            _LOGE("queue_delegate_call: the delegate thread is not running");
+            return false;
+        }
+
+        size_t size = strlen(backtrace);
+        char *data = static_cast<char *>(malloc(size + 1));
+        if (data == nullptr) {
+            _LOGE("queue_delegate_call: Failed to allocate the report");
+            return false;
+        }
+        memcpy(data, backtrace, size + 1);
+
+        ring::descriptor_t descriptor = {static_cast<uint32_t>(kind), data, size};
+        if (!ring::push(delegate_queue, descriptor, overflow, DELEGATE_WAIT_MS)) {
+            free(data);
+            return false;
+        }
+
+        return true;
+    }
+
     bool bind_delegate(JNIEnv *env, jni::native_context_t &native_context) {
         jclass jniDelegateClass = jni::env_find_class(env, delegate_class);
 
@@ -72,6 +227,11 @@ namespace jni {
             return false;
         }
 
+        if (!start_delegate_thread()) {
+            _LOGE("Failed to start the delegate thread");
+            return false;
+        }
+
         native_context.initialized = true;
 
         return native_context.initialized;
@@ -79,6 +239,8 @@ namespace jni {
 
     void release_delegate(JNIEnv *env, jni::native_context_t &native_context) {
 
+        stop_delegate_thread();
+
         if (env != nullptr) {
             // release objects allocated during binding
             jni::env_delete_global_ref(env, native_context.jniDelegateObject);
@@ -90,145 +252,6 @@ namespace jni {
         }
     }
 
-    /**
-     * Worker thread for payload exchange
-     *
-     * @param arg global ref to passed jstring instance, should be freed on completion.
-     */
-
-    typedef struct delegate_thread_args {
-        JNIEnv *env;
-        jobject delegate;
-        jmethodID method;
-        jobject backtrace;
-
-    } delegate_thread_args_t;
-
-    void *delegate_worker_thread(void *args) {
-        jni::native_context_t &native_context = jni::get_native_context();
-        delegate_thread_args_t *delegate_args = (delegate_thread_args *) args;
-        bool jni_attached = false;
-
-        JNIEnv *env = nullptr;
-        int jrc = native_context.jvm->GetEnv((void **) &env, JNI_VERSION_1_6);
-        switch (jrc) {
-            case JNI_OK:
-                break;
-            case JNI_EDETACHED:
-                jrc = native_context.jvm->AttachCurrentThread(&env, nullptr);
-                if (JNI_OK != jrc) {
-                    _LOGE("delegate_worker_thread: AttachCurrentThread failed: error %d: %s", jrc,
-                          strerror(jrc));
-                    return nullptr;
-                }
-                jni_attached = true;
-                jni::env_check_and_clear_ex(env);
-                jni_attached = true;
-                break;
-            default:
-                _LOGE("delegate_worker_thread:: Unsupported JNI version");
-                return nullptr;
-        };  // switch
-
-        // invoke the delegate method passing the backtrace as a string
-        jni::env_call_void_method(env,
-                                  delegate_args->delegate,
-                                  delegate_args->method,
-                                  delegate_args->backtrace);
-
-        // release the memory alloc'd in calling thread
-        jni::env_delete_global_ref(env, delegate_args->backtrace);
-        delete delegate_args;
-
-        // and detach from JVM
-        if (jni_attached) {
-            native_context.jvm->DetachCurrentThread();
-        }
-
-        return nullptr;
-    }
-
-    /**
-     * Serialize a flattened report and pass to
-     * delegate on a JVM-bound thread
-     *
-     * @param backtrace backtrace contained in a char buffer
-     * @param methodId Method ID of jvm delegate
-     */
-    bool threaded_delegate_call(const char *backtrace, jmethodID methodId) {
-        jni::native_context_t &native_context = jni::get_native_context();
-        if (native_context.jvm == nullptr) {
-            _LOGE("on_native_crash: jvm not supported in native_context");
-            return false;
-        }
-
-        bool jni_attached = false;
-        JNIEnv *env = nullptr;
-        int jrc = native_context.jvm->GetEnv((void **) &env, JNI_VERSION_1_6);
-        switch (jrc) {
-            case JNI_OK:
-                break;
-            case JNI_EDETACHED:
-                jrc = native_context.jvm->AttachCurrentThread(&env, nullptr);
-                if (JNI_OK != jrc) {
-                    _LOGE("threaded_delegate_call: AttachCurrentThread failed: error %d: %s", jrc,
-                          strerror(jrc));
-                    return false;
-                }
-                jni_attached = true;
-                break;
-            default:
-                _LOGE("delegate_worker_thread:: Unsupported JNI version");
-                return false;
-        };  // switch
-
-        delegate_thread_args_t *delegate_thread_args = new delegate_thread_args_t();
-        if (delegate_thread_args == nullptr) {
-            _LOGE("thread_delegate_call: Failed to allocate delegate thread args");
-            return false;
-        }
-
-        jstring jBacktrace = jni::env_new_string_utf(env, backtrace);
-        jobject jBacktraceRef = jni::env_new_global_ref(env, jBacktrace);
-
-        delegate_thread_args->env = env;
-        delegate_thread_args->delegate = native_context.jniDelegateObject;
-        delegate_thread_args->method = methodId;
-        delegate_thread_args->backtrace = jBacktraceRef;
-
-        pthread_t delegate_thread = {};
-        pthread_attr_t thread_attr;
-        pthread_attr_init(&thread_attr);
-        pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
-
-        if (0 != pthread_create(&delegate_thread, &thread_attr, delegate_worker_thread,
-                                delegate_thread_args)) {
-            _LOGE_POSIX("pthread_create()");
-
-            // release the memory alloc'd above
-            if (0 != pthread_attr_destroy(&thread_attr)) {
-                _LOGE_POSIX("pthread_attr_destroy()");
-            }
-            jni::env_delete_global_ref(env, jBacktraceRef);
-            delete delegate_thread_args;
-
-            return false;
-        }
-
-        _LOGD("threaded_delegate_call: delegate running on thread [%p]", (void *) delegate_thread);
-        pthread_attr_destroy(&thread_attr);
-
-        if (0 != pthread_join(delegate_thread, nullptr)) {
-            _LOGE_POSIX("pthread_join()");
-        }
-        if (jni_attached) {
-            native_context.jvm->DetachCurrentThread();
-        }
-
-        return true;
-    }
-
-
     /**
      * Pass a flattened crash report to delegate in agent on a JVM-bound thread
      *
@@ -242,7 +265,7 @@ namespace jni {
             return;
         }
 
-        threaded_delegate_call(backtrace, native_context.onNativeCrash);
+        queue_delegate_call(backtrace, DELEGATE_CRASH, ring::OVERFLOW_WAIT);
     }
 
 
@@ -258,7 +281,7 @@ namespace jni {
             return;
         }
 
-        threaded_delegate_call(backtrace, native_context.onNativeException);
+        queue_delegate_call(backtrace, DELEGATE_EXCEPTION, ring::OVERFLOW_DROP);
     }
 
     /**
@@ -273,7 +296,7 @@ namespace jni {
             return;
         }
 
-        threaded_delegate_call(backtrace, native_context.onApplicationNotResponding);
+        queue_delegate_call(backtrace, DELEGATE_ANR, ring::OVERFLOW_WAIT);
     }
 
 }   // namespace jni
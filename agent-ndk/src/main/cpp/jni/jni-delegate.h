@@ -10,9 +10,9 @@
 namespace jni {
 
     /**
-     * Bind C methods to Java adapters in JavaDelegate.
-     * Delegates will minimize the service time,
-     * making the delegate calls on worker threads.
+     * Bind C methods to Java adapters in JavaDelegate, and start the delegate thread.
+     * Reports are queued to the delegate thread, which is attached to the JVM once
+     * and makes every delegate call, so reporting threads never attach to it.
      *
      * @param env JNI environment
      * @return true JVM classes are bound to JNI structs
@@ -20,7 +20,8 @@ namespace jni {
     bool bind_delegate(JNIEnv *env, jni::native_context_t &native_context);
 
     /**
-     * Release and reset all resources alloc'd in bind_delegate()
+     * Stop the delegate thread once the reports queued are delivered, then
+     * release and reset all resources alloc'd in bind_delegate()
      */
     void release_delegate(JNIEnv *env, jni::native_context_t &native_context);
 
@@ -53,6 +53,7 @@
  *  * Find class ID for delegate class(es)
  *  * Create an instance of delegate class(es)
  *  * Create a global reference to delegates to access from native threads
+ *  * Cache the ManagedContext field IDs read when the context is set
  *
  * Note:
  *  All allocated resources are never released by application
@@ -81,6 +82,10 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *vm, void *reserved) {
         _LOGE("Could not bind to JVM delegates. Reports will cached until the next app launch.");
     }
 
+    if (!jni::cache_native_context_ids(env)) {
+        _LOGW("Could not cache ManagedContext field IDs. They will be looked up when the context is set.");
+    }
+
     return JNI_VERSION_1_6;
 }
 
@@ -290,6 +295,35 @@ namespace jni {
         return nullptr;
     }
 
+    jobject env_new_direct_byte_buffer(JNIEnv *env, const char *bytes, size_t size) {
+        if (env != nullptr) {
+            if (bytes != nullptr) {
+                // the buffer refers to the bytes, it doesn't copy them
+                jobject result = env->NewDirectByteBuffer(const_cast<char *>(bytes), static_cast<jlong>(size));
+                if (env_check_and_clear_ex(env) && result != nullptr) {
+                    env->DeleteLocalRef(result);
+                    result = nullptr;
+                }
+                return result;
+            } else {
+                _LOGE("env_new_direct_byte_buffer: passed bytes are null");
+            }
+        } else {
+            _LOGE("env_new_direct_byte_buffer: JNIEnv is null");
+        }
+        return nullptr;
+    }
+
+    void env_delete_local_ref(JNIEnv *env, jobject _jobject) {
+        if (env != nullptr) {
+            if (_jobject != nullptr) {
+                env->DeleteLocalRef(_jobject);
+            }
+        } else {
+            _LOGE("env_delete_local_ref: JNIEnv is null");
+        }
+    }
+
     jobject env_get_object_field(JNIEnv *env, jobject _jobject, jfieldID _jfieldID) {
         if (env != nullptr) {
             if (_jobject != nullptr && _jfieldID != nullptr) {
@@ -320,6 +354,36 @@ namespace jni {
         return false;
     }
 
+    jlong env_get_long_field(JNIEnv *env, jobject _jobject, jfieldID _jfieldID) {
+        if (env != nullptr) {
+            if (_jobject != nullptr && _jfieldID != nullptr) {
+                jlong result = env->GetLongField(_jobject, _jfieldID);
+                env_check_and_clear_ex(env);
+                return result;
+            } else {
+                _LOGE("env_get_long_field: class or field ID is null");
+            }
+        } else {
+            _LOGE("env_get_long_field: JNIEnv is null");
+        }
+        return 0;
+    }
+
+    jint env_get_int_field(JNIEnv *env, jobject _jobject, jfieldID _jfieldID) {
+        if (env != nullptr) {
+            if (_jobject != nullptr && _jfieldID != nullptr) {
+                jint result = env->GetIntField(_jobject, _jfieldID);
+                env_check_and_clear_ex(env);
+                return result;
+            } else {
+                _LOGE("env_get_int_field: class or field ID is null");
+            }
+        } else {
+            _LOGE("env_get_int_field: JNIEnv is null");
+        }
+        return 0;
+    }
+
     const char *env_get_string_UTF_chars(JNIEnv *env, jstring _jstring) {
         if (env != nullptr) {
             if (_jstring != nullptr) {
@@ -335,6 +399,16 @@ namespace jni {
         }
         return nullptr;
     }
+
+    void env_release_string_UTF_chars(JNIEnv *env, jstring _jstring, const char *chars) {
+        if (env != nullptr) {
+            if (_jstring != nullptr && chars != nullptr) {
+                env->ReleaseStringUTFChars(_jstring, chars);
+            }
+        } else {
+            _LOGE("env_release_string_UTF_chars: JNIEnv is null");
+        }
+    }
 }   // namespace jni
 
 
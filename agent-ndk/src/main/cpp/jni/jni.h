@@ -34,13 +34,25 @@ namespace jni {
 
     jobject env_call_object_method(JNIEnv *, jobject, jmethodID, ...);
 
+    jboolean env_call_bool_method(JNIEnv *, jobject, jmethodID, ...);
+
+    jobject env_new_direct_byte_buffer(JNIEnv *, const char *, size_t);
+
+    void env_delete_local_ref(JNIEnv *, jobject);
+
     jobject env_get_object_field(JNIEnv *, jobject, jfieldID);
 
     jboolean env_get_boolean_field(JNIEnv *, jobject, jfieldID);
 
+    jlong env_get_long_field(JNIEnv *, jobject, jfieldID);
+
+    jint env_get_int_field(JNIEnv *, jobject, jfieldID);
+
 
     const char *env_get_string_UTF_chars(JNIEnv *, jstring);
 
+    void env_release_string_UTF_chars(JNIEnv *, jstring, const char *);
+
 
 }   // namespace procfs
 
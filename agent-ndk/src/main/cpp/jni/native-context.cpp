@@ -16,6 +16,7 @@
 #include "native-context.h"
 #include "jni.h"
 #include "jni-delegate.h"
+#include "context-snapshot.h"
 
 namespace jni {
 
@@ -26,62 +27,162 @@ namespace jni {
         return instance;
     }
 
+    static const char *managed_context_class = "com/newrelic/agent/android/ndk/ManagedContext";
+
+    /**
+     * ManagedContext field and method IDs, valid while the class is held
+     */
+    typedef struct context_ids {
+        jclass managedContextClass;         // global ref
+        jmethodID getAbsolutePath;
+        jfieldID reportsDir;
+        jfieldID sessionId;
+        jfieldID buildId;
+        jfieldID anrMonitor;
+        jfieldID allThreadStacks;
+        jfieldID crashHelper;
+        jfieldID coalesceWindow;
+        jfieldID reportQuotaBytes;
+        jfieldID reportQuotaCount;
+        jfieldID profiler;
+        jfieldID profilerHz;
+        bool cached;
+
+    } context_ids_t;
+
+    static context_ids_t context_ids = {};
+
+    static bool cache_ids(JNIEnv *env, jclass managedContextClass) {
+        if (context_ids.cached) {
+            return true;
+        }
+
+        context_ids_t ids = {};
+        jclass fileClass = jni::env_find_class(env, "java/io/File");
+        ids.getAbsolutePath = jni::env_get_methodid(env, fileClass, "getAbsolutePath", "()Ljava/lang/String;");
+        jni::env_delete_local_ref(env, fileClass);
+
+        ids.reportsDir = jni::env_get_fieldid(env, managedContextClass, "reportsDir", "Ljava/io/File;");
+        ids.sessionId = jni::env_get_fieldid(env, managedContextClass, "sessionId", "Ljava/lang/String;");
+        ids.buildId = jni::env_get_fieldid(env, managedContextClass, "buildId", "Ljava/lang/String;");
+        ids.anrMonitor = jni::env_get_fieldid(env, managedContextClass, "anrMonitor", "Z");
+        ids.allThreadStacks = jni::env_get_fieldid(env, managedContextClass, "allThreadStacks", "Z");
+        ids.crashHelper = jni::env_get_fieldid(env, managedContextClass, "crashHelper", "Z");
+        ids.coalesceWindow = jni::env_get_fieldid(env, managedContextClass, "coalesceWindow", "J");
+        ids.reportQuotaBytes = jni::env_get_fieldid(env, managedContextClass, "reportQuotaBytes", "J");
+        ids.reportQuotaCount = jni::env_get_fieldid(env, managedContextClass, "reportQuotaCount", "J");
+        ids.profiler = jni::env_get_fieldid(env, managedContextClass, "profiler", "I");
+        ids.profilerHz = jni::env_get_fieldid(env, managedContextClass, "profilerHz", "I");
+
+        if (ids.getAbsolutePath == nullptr || ids.reportsDir == nullptr || ids.sessionId == nullptr ||
+            ids.buildId == nullptr || ids.anrMonitor == nullptr || ids.allThreadStacks == nullptr ||
+            ids.crashHelper == nullptr || ids.coalesceWindow == nullptr ||
+            ids.reportQuotaBytes == nullptr || ids.reportQuotaCount == nullptr ||
+            ids.profiler == nullptr || ids.profilerHz == nullptr) {
+            _LOGE("Failed to retrieve ManagedContext field ids");
+            return false;
+        }
+
+        // the IDs are only valid while the class is loaded
+        ids.managedContextClass = static_cast<jclass>(jni::env_new_global_ref(env, managedContextClass));
+        if (ids.managedContextClass == nullptr) {
+            return false;
+        }
+        ids.cached = true;
+        context_ids = ids;
+
+        return true;
+    }
+
+    bool cache_native_context_ids(JNIEnv *env) {
+        jclass managedContextClass = jni::env_find_class(env, managed_context_class);
+        if (managedContextClass == nullptr) {
+            _LOGE("Unable to find class [%s]", managed_context_class);
+            return false;
+        }
+
+        bool cached = cache_ids(env, managedContextClass);
+        jni::env_delete_local_ref(env, managedContextClass);
+
+        return cached;
+    }
+
+    /**
+     * Copy a string, releasing the JVM's copy. A null string is copied as empty.
+     */
+    static void copy_string(JNIEnv *env, jstring value, char *buffer, size_t size) {
+        const char *chars = (value != nullptr) ? jni::env_get_string_UTF_chars(env, value) : nullptr;
+        std::strncpy(buffer, chars != nullptr ? chars : "", size - 1);
+        buffer[size - 1] = '\0';
+        jni::env_release_string_UTF_chars(env, value, chars);
+    }
+
     native_context_t &set_native_context(JNIEnv *env, jobject managedContext) {
         static native_context_t &instance = get_native_context();
 
         if (managedContext != nullptr) {
             jni::native_context_t &native_context = jni::get_native_context();
 
-            jclass managedContextClass = jni::env_get_object_class(env, managedContext);
-            jclass fileClass = static_cast<jclass>(jni::env_find_class(env, "java/io/File"));
-            jmethodID absolutePathMethodId = jni::env_get_methodid(env,
-                                                                   fileClass,
-                                                                   "getAbsolutePath",
-                                                                   "()Ljava/lang/String;");
+            if (!context_ids.cached) {
+                jclass managedContextClass = jni::env_get_object_class(env, managedContext);
+                bool cached = cache_ids(env, managedContextClass);
+                jni::env_delete_local_ref(env, managedContextClass);
+                if (!cached) {
+                    return instance;
+                }
+            }
 
             // copy the report path field
-            jfieldID reportsDir = jni::env_get_fieldid(env,
-                                                       managedContextClass,
-                                                       "reportsDir",
-                                                       "Ljava/io/File;");
-
-            jobject fileObject = jni::env_get_object_field(env, managedContext, reportsDir);
-            jobject pathObject = jni::env_call_object_method(env, fileObject, absolutePathMethodId);
-            const char *reportsPath = jni::env_get_string_UTF_chars(env,
-                                                                    static_cast<jstring>(pathObject));
-
-            std::strncpy(native_context.reportPathAbsolute, reportsPath,
-                         sizeof(native_context.reportPathAbsolute) - 1);
-
-
-            // copy the session ID field
-            jfieldID fieldId = jni::env_get_fieldid(env,
-                                                    managedContextClass,
-                                                    "sessionId",
-                                                    "Ljava/lang/String;");
-            jobject fieldObject = jni::env_get_object_field(env, managedContext, fieldId);
-            const char *sessionId = jni::env_get_string_UTF_chars(env,
-                                                                  static_cast<jstring>(fieldObject));
-            std::strncpy(native_context.sessionId, sessionId, sizeof(native_context.sessionId) - 1);
-
-            // copy the build Id field
-            fieldId = jni::env_get_fieldid(env,
-                                           managedContextClass,
-                                           "buildId",
-                                           "Ljava/lang/String;");
-            fieldObject = jni::env_get_object_field(env, managedContext, fieldId);
-            const char *buildId = jni::env_get_string_UTF_chars(env,
-                                                                static_cast<jstring>(fieldObject));
-            std::strncpy(native_context.buildId, buildId, sizeof(native_context.buildId) - 1);
-
-            // copy the anr monitor field
-
-            fieldId = jni::env_get_fieldid(env,
-                                           managedContextClass,
-                                           "anrMonitor",
-                                           "Z");
-            jboolean anrMonitorEnabled = jni::env_get_boolean_field(env, managedContext, fieldId);
-            native_context.anrMonitorEnabled = anrMonitorEnabled;
+            jobject fileObject = jni::env_get_object_field(env, managedContext, context_ids.reportsDir);
+            jstring pathObject = (fileObject != nullptr) ?
+                                 static_cast<jstring>(jni::env_call_object_method(env, fileObject,
+                                                                                  context_ids.getAbsolutePath)) : nullptr;
+            char reportsPath[sizeof(native_context.reportPathAbsolute)];
+            copy_string(env, pathObject, reportsPath, sizeof(reportsPath));
+            jni::env_delete_local_ref(env, pathObject);
+            jni::env_delete_local_ref(env, fileObject);
+
+            // a crashing thread may be writing a report there: only touch it if it moved
+            if (std::strcmp(native_context.reportPathAbsolute, reportsPath) != 0) {
+                std::strncpy(native_context.reportPathAbsolute, reportsPath,
+                             sizeof(native_context.reportPathAbsolute) - 1);
+            }
+
+            // copy the session ID and build Id fields
+            jobject fieldObject = jni::env_get_object_field(env, managedContext, context_ids.sessionId);
+            copy_string(env, static_cast<jstring>(fieldObject), native_context.sessionId,
+                        sizeof(native_context.sessionId));
+            jni::env_delete_local_ref(env, fieldObject);
+
+            fieldObject = jni::env_get_object_field(env, managedContext, context_ids.buildId);
+            copy_string(env, static_cast<jstring>(fieldObject), native_context.buildId,
+                        sizeof(native_context.buildId));
+            jni::env_delete_local_ref(env, fieldObject);
+
+            // copy the feature fields
+            native_context.anrMonitorEnabled =
+                    jni::env_get_boolean_field(env, managedContext, context_ids.anrMonitor);
+            native_context.allThreadStacksEnabled =
+                    jni::env_get_boolean_field(env, managedContext, context_ids.allThreadStacks);
+            native_context.crashHelperEnabled =
+                    jni::env_get_boolean_field(env, managedContext, context_ids.crashHelper);
+
+            // copy the coalesce window field
+            jlong coalesceWindow = jni::env_get_long_field(env, managedContext, context_ids.coalesceWindow);
+            native_context.coalesceWindow = coalesceWindow > 0 ? coalesceWindow : 0;
+
+            // copy the report store quota fields
+            jlong reportQuotaBytes = jni::env_get_long_field(env, managedContext, context_ids.reportQuotaBytes);
+            native_context.reportQuotaBytes = reportQuotaBytes > 0 ? reportQuotaBytes : 0;
+            jlong reportQuotaCount = jni::env_get_long_field(env, managedContext, context_ids.reportQuotaCount);
+            native_context.reportQuotaCount = reportQuotaCount > 0 ? reportQuotaCount : 0;
+
+            // copy the profiler fields
+            native_context.profilerMode = jni::env_get_int_field(env, managedContext, context_ids.profiler);
+            native_context.profilerHz = jni::env_get_int_field(env, managedContext, context_ids.profilerHz);
+
+            // crash handlers read the process context from the snapshot
+            context::publish();
         }
 
         return instance;
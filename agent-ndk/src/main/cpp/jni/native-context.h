@@ -32,6 +32,23 @@ namespace jni {
 
         bool anrMonitorEnabled;
 
+        // capture every thread's stack, not just the reporting thread's
+        bool allThreadStacksEnabled;
+
+        // process crashes in a pre-forked helper process
+        bool crashHelperEnabled;
+
+        // seconds in which repeats of a report's stack are counted, not reported; 0 reports each
+        long coalesceWindow;
+
+        // report store quota of each report type, in payload bytes and reports; 0 for the default
+        long reportQuotaBytes;
+        long reportQuotaCount;
+
+        // sampling profiler mode (profiler::profile_mode_t, 0 if off) and samples per second
+        int profilerMode;
+        int profilerHz;
+
     } native_context_t;
 
     /**
@@ -41,7 +58,15 @@ namespace jni {
     native_context_t &get_native_context();
 
     /**
-     * Conditions the native context from a passed JVM ManagedContext instance
+     * Cache the ManagedContext class and the field and method IDs read from it, once
+     * @param env
+     * @return true if the IDs are cached
+     */
+    bool cache_native_context_ids(JNIEnv *env);
+
+    /**
+     * Conditions the native context from a passed JVM ManagedContext instance,
+     * and publishes a new context snapshot
      * @param env
      * @param managedContext instance
      * @return
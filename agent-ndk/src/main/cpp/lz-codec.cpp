@@ -0,0 +1,268 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "lz-codec.h"
+
+namespace lz {
+
+    // https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+    static const size_t MIN_MATCH = 4;
+    static const size_t LAST_LITERALS = 5;      // a block ends with at least 5 literals
+    static const size_t MF_LIMIT = 12;          // and its last match starts at least 12 bytes before the end
+    static const size_t MAX_DISTANCE = 65535;
+    static const size_t RUN_MASK = 15;
+
+    // literal runs this long without a match are searched with growing strides
+    static const size_t SKIP_TRIGGER = 6;
+
+    static inline uint32_t read32(const uint8_t *at) {
+        uint32_t value;
+        memcpy(&value, at, sizeof(value));
+        return value;
+    }
+
+    static inline void write32(uint8_t *at, uint32_t value) {
+        at[0] = value;
+        at[1] = value >> 8;
+        at[2] = value >> 16;
+        at[3] = value >> 24;
+    }
+
+    static inline uint32_t load32(const uint8_t *at) {
+        return at[0] | (at[1] << 8) | (at[2] << 16) | (static_cast<uint32_t>(at[3]) << 24);
+    }
+
+    static inline size_t hash(uint32_t sequence) {
+        return (sequence * 2654435761U) >> (32 - HASH_LOG);
+    }
+
+    static uint8_t *put_length(uint8_t *out, size_t length) {
+        for (; length >= 255; length -= 255) {
+            *out++ = 255;
+        }
+        *out++ = static_cast<uint8_t>(length);
+        return out;
+    }
+
+    /**
+     * Emit literals and the match following them (if any)
+     */
+    static uint8_t *put_sequence(uint8_t *out, const uint8_t *literals, size_t literal_cnt,
+                                 size_t offset, size_t match_len) {
+        uint8_t *token = out++;
+        *token = static_cast<uint8_t>((literal_cnt < RUN_MASK ? literal_cnt : RUN_MASK) << 4);
+        if (literal_cnt >= RUN_MASK) {
+            out = put_length(out, literal_cnt - RUN_MASK);
+        }
+        memcpy(out, literals, literal_cnt);
+        out += literal_cnt;
+
+        if (match_len > 0) {
+            *out++ = static_cast<uint8_t>(offset);
+            *out++ = static_cast<uint8_t>(offset >> 8);
+            size_t extra = match_len - MIN_MATCH;
+            *token |= static_cast<uint8_t>(extra < RUN_MASK ? extra : RUN_MASK);
+            if (extra >= RUN_MASK) {
+                out = put_length(out, extra - RUN_MASK);
+            }
+        }
+        return out;
+    }
+
+    /**
+     * Compress [start, end) of data, matching back into anything before it
+     *
+     * @return size of the block, which may be larger than the input (though never BLOCK_BOUND)
+     */
+    static size_t compress_block(const uint8_t *data, size_t start, size_t end, encoder_t &encoder) {
+        uint8_t *out = reinterpret_cast<uint8_t *>(encoder.block);
+        size_t anchor = start;
+        size_t ip = start;
+
+        if (end - start > MF_LIMIT) {
+            size_t search_limit = end - MF_LIMIT;
+            size_t match_limit = end - LAST_LITERALS;
+            size_t searched = 1 << SKIP_TRIGGER;
+
+            while (ip < search_limit) {
+                uint32_t sequence = read32(data + ip);
+                size_t h = hash(sequence);
+                size_t ref = encoder.table[h];
+                encoder.table[h] = static_cast<uint32_t>(ip + 1);
+
+                if (ref == 0 || ip - (ref - 1) > MAX_DISTANCE || read32(data + ref - 1) != sequence) {
+                    ip += searched++ >> SKIP_TRIGGER;
+                    continue;
+                }
+
+                size_t match = ref - 1;
+                while (ip > anchor && match > 0 && data[ip - 1] == data[match - 1]) {
+                    ip--;
+                    match--;
+                }
+                size_t match_len = MIN_MATCH;
+                while (ip + match_len < match_limit && data[match + match_len] == data[ip + match_len]) {
+                    match_len++;
+                }
+
+                out = put_sequence(out, data + anchor, ip - anchor, ip - match, match_len);
+                ip += match_len;
+                anchor = ip;
+                searched = 1 << SKIP_TRIGGER;
+
+                // the position just behind the next search finds repeats of what was just matched
+                if (ip - 2 >= start && ip < search_limit) {
+                    encoder.table[hash(read32(data + ip - 2))] = static_cast<uint32_t>(ip - 2 + 1);
+                }
+            }
+        }
+
+        out = put_sequence(out, data + anchor, end - anchor, 0, 0);
+        return out - reinterpret_cast<uint8_t *>(encoder.block);
+    }
+
+    bool compress(const char *data, size_t size, encoder_t &encoder, writer_t &writer) {
+        if (size > UINT32_MAX) {
+            return false;
+        }
+
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+        uint8_t header[FRAME_HEADER_SZ];
+        write32(header, FRAME_MAGIC);
+        write32(header + 4, static_cast<uint32_t>(size));
+        writer::put(writer, reinterpret_cast<const char *>(header), sizeof(header));
+
+        memset(encoder.table, 0, sizeof(encoder.table));
+        for (size_t start = 0; start < size && writer::ok(writer); start += BLOCK_SZ) {
+            size_t end = (size - start > BLOCK_SZ) ? start + BLOCK_SZ : size;
+            size_t block_size = compress_block(bytes, start, end, encoder);
+
+            uint8_t block_header[4];
+            if (block_size < end - start) {
+                write32(block_header, static_cast<uint32_t>(block_size));
+                writer::put(writer, reinterpret_cast<const char *>(block_header), sizeof(block_header));
+                writer::put(writer, encoder.block, block_size);
+            } else {
+                write32(block_header, static_cast<uint32_t>(end - start) | BLOCK_STORED);
+                writer::put(writer, reinterpret_cast<const char *>(block_header), sizeof(block_header));
+                writer::put(writer, data + start, end - start);
+            }
+        }
+
+        return writer::ok(writer);
+    }
+
+    size_t frame_size(const char *frame, size_t size) {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(frame);
+        if (size < FRAME_HEADER_SZ || load32(bytes) != FRAME_MAGIC) {
+            return 0;
+        }
+        return load32(bytes + 4);
+    }
+
+    static bool get_length(const uint8_t *&in, const uint8_t *in_end, size_t &length) {
+        uint8_t byte;
+        do {
+            if (in >= in_end) {
+                return false;
+            }
+            byte = *in++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    /**
+     * Decode a block into [pos, end) of out, matching back into anything before it
+     */
+    static bool decompress_block(const uint8_t *in, size_t size, uint8_t *out, size_t pos, size_t end) {
+        const uint8_t *in_end = in + size;
+
+        while (in < in_end) {
+            uint8_t token = *in++;
+
+            size_t literal_cnt = token >> 4;
+            if (literal_cnt == RUN_MASK && !get_length(in, in_end, literal_cnt)) {
+                return false;
+            }
+            if (literal_cnt > static_cast<size_t>(in_end - in) || literal_cnt > end - pos) {
+                return false;
+            }
+            memcpy(out + pos, in, literal_cnt);
+            in += literal_cnt;
+            pos += literal_cnt;
+
+            // the last sequence has no match
+            if (in == in_end) {
+                break;
+            }
+
+            if (in_end - in < 2) {
+                return false;
+            }
+            size_t offset = in[0] | (in[1] << 8);
+            in += 2;
+            size_t match_len = token & RUN_MASK;
+            if (match_len == RUN_MASK && !get_length(in, in_end, match_len)) {
+                return false;
+            }
+            match_len += MIN_MATCH;
+            if (offset == 0 || offset > pos || match_len > end - pos) {
+                return false;
+            }
+
+            // byte by byte: a match may overlap the bytes it produces
+            const uint8_t *match = out + pos - offset;
+            for (size_t i = 0; i < match_len; i++) {
+                out[pos + i] = match[i];
+            }
+            pos += match_len;
+        }
+
+        return pos == end;
+    }
+
+    bool decompress(const char *frame, size_t size, char *out, size_t capacity) {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(frame);
+        if (size < FRAME_HEADER_SZ || load32(bytes) != FRAME_MAGIC) {
+            return false;
+        }
+        size_t total = load32(bytes + 4);
+        if (total > capacity) {
+            return false;
+        }
+
+        uint8_t *produced = reinterpret_cast<uint8_t *>(out);
+        size_t in = FRAME_HEADER_SZ;
+        for (size_t pos = 0; pos < total;) {
+            if (size - in < 4) {
+                return false;
+            }
+            uint32_t block_header = load32(bytes + in);
+            size_t block_size = block_header & ~BLOCK_STORED;
+            in += 4;
+            if (block_size > size - in) {
+                return false;
+            }
+
+            size_t end = (total - pos > BLOCK_SZ) ? pos + BLOCK_SZ : total;
+            if (block_header & BLOCK_STORED) {
+                if (block_size != end - pos) {
+                    return false;
+                }
+                memcpy(produced + pos, bytes + in, block_size);
+            } else if (!decompress_block(bytes + in, block_size, produced, pos, end)) {
+                return false;
+            }
+            in += block_size;
+            pos = end;
+        }
+
+        return in == size;
+    }
+
+}   // namespace lz
@@ -0,0 +1,69 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_LZ_CODEC_H
+#define _AGENT_NDK_LZ_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "writer.h"
+
+/**
+ * LZ4 block compression of stored reports
+ *
+ * Reports repeat themselves: module paths, symbol names and every frame's keys. A compressed
+ * report is a frame: an 8 byte header (the magic "NRZ1" and the uncompressed size, little-endian),
+ * then a block per 16K of the report, each prefixed by its size. A block is in the LZ4 block
+ * format, and its matches may reach back into earlier blocks (up to 64K, as LZ4's linked
+ * blocks do), or if compressing didn't pay, stored as-is with the top bit of its size set.
+ *
+ * Reports are JSON, so a reader tells the two apart by the first byte. The encoder works in
+ * a caller-provided state and hands each block to a writer as it is produced: there is no
+ * heap, and everything here is async-signal-safe. Kotlin reads the frames in NativeReport.
+ */
+namespace lz {
+
+    static const uint32_t FRAME_MAGIC = 0x315a524e;     // "NRZ1"
+    static const size_t FRAME_HEADER_SZ = 8;
+    static const size_t BLOCK_SZ = 16 * 1024;
+    static const uint32_t BLOCK_STORED = 0x80000000;
+
+    static const size_t HASH_LOG = 12;
+
+    // the largest an LZ4 block of BLOCK_SZ can be
+    static const size_t BLOCK_BOUND = BLOCK_SZ + BLOCK_SZ / 255 + 16;
+
+    /**
+     * Encoder working storage: about 33K, so best kept off a signal stack
+     */
+    typedef struct encoder {
+        uint32_t table[1 << HASH_LOG];      // 1 + the position last seen with each hash, or 0
+        char block[BLOCK_BOUND];
+
+    } encoder_t;
+
+    /**
+     * Compress data as a frame, passing the header and each block to the writer as it is produced
+     *
+     * @return false if the writer failed, or the data is too large for a frame
+     */
+    bool compress(const char *data, size_t size, encoder_t &, writer_t &);
+
+    /**
+     * @return the uncompressed size of a frame, or 0 if the data is not a frame
+     */
+    size_t frame_size(const char *frame, size_t size);
+
+    /**
+     * Decompress a frame into a buffer of at least frame_size() bytes
+     *
+     * @return false if the frame is malformed or doesn't fit
+     */
+    bool decompress(const char *frame, size_t size, char *out, size_t capacity);
+
+}   // namespace lz
+
+#endif // _AGENT_NDK_LZ_CODEC_H
@@ -0,0 +1,401 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "module-index.h"
+#include "cfi-unwinder.h"
+#include "symbol-cache.h"
+#include "symbolizer.h"
+#include "demangler.h"
+
+namespace modules {
+
+    /**
+     * A complete module table, sorted by start address
+     */
+    typedef struct index {
+        std::vector<module_t> modules;
+        bool counted;               // the loader reports its load and unload counts
+        unsigned long long adds;    // loader counts when the table was built
+        unsigned long long subs;
+        struct index *replaced;     // the table this one replaced, retained until shutdown
+
+    } index_t;
+
+    /**
+     * State threaded through dl_iterate_phdr() while building a table
+     */
+    typedef struct build_state {
+        index_t *index;
+        const index_t *previous;    // modules already indexed, reused when unchanged
+        uintptr_t page_mask;
+
+    } build_state_t;
+
+    static std::atomic<index_t *> current(nullptr);
+    static std::mutex refresh_mutex;
+
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+
+    /**
+     * Find the module holding an address in a table
+     */
+    static const module_t *find_in(const index_t *index, uintptr_t address) {
+        if (index == nullptr || index->modules.empty()) {
+            return nullptr;
+        }
+
+        const std::vector<module_t> &modules = index->modules;
+        auto it = std::upper_bound(modules.begin(), modules.end(), address,
+                                   [](uintptr_t address, const module_t &module) {
+                                       return address < module.start;
+                                   });
+        if (it == modules.begin()) {
+            return nullptr;
+        }
+        --it;
+
+        return (address < it->end) ? &*it : nullptr;
+    }
+
+    /**
+     * Bionic leaves the dynamic section as linked; glibc relocates it in place
+     */
+    static uintptr_t dynamic_ptr(const module_t &module, ElfW(Addr) value) {
+        return (value >= module.start && value < module.end) ? value : value + module.load_bias;
+    }
+
+    /**
+     * The number of dynamic symbols, which only the hash tables record
+     */
+    static size_t gnu_hash_symbol_cnt(const uint32_t *hash) {
+        uint32_t bucket_cnt = hash[0];
+        uint32_t symbol_offset = hash[1];
+        uint32_t bloom_size = hash[2];
+        const uint32_t *buckets = hash + 4 + bloom_size * (sizeof(ElfW(Addr)) / sizeof(uint32_t));
+        const uint32_t *chains = buckets + bucket_cnt;
+
+        uint32_t last = 0;
+        for (uint32_t i = 0; i < bucket_cnt; i++) {
+            last = std::max(last, buckets[i]);
+        }
+        if (last < symbol_offset) {
+            return symbol_offset;
+        }
+
+        // the chain of the last bucket ends with the last symbol
+        while ((chains[last - symbol_offset] & 1) == 0) {
+            last++;
+        }
+        return last + 1;
+    }
+
+    static void read_dynamic(const ElfW(Dyn) *dynamic, module_t &module) {
+        const uint32_t *hash = nullptr;
+        const uint32_t *gnu_hash = nullptr;
+
+        for (const ElfW(Dyn) *dyn = dynamic; dyn->d_tag != DT_NULL; dyn++) {
+            switch (dyn->d_tag) {
+                case DT_SYMTAB:
+                    module.symbols = reinterpret_cast<const ElfW(Sym) *>(dynamic_ptr(module, dyn->d_un.d_ptr));
+                    break;
+                case DT_STRTAB:
+                    module.strings = reinterpret_cast<const char *>(dynamic_ptr(module, dyn->d_un.d_ptr));
+                    break;
+                case DT_STRSZ:
+                    module.strings_size = dyn->d_un.d_val;
+                    break;
+                case DT_HASH:
+                    hash = reinterpret_cast<const uint32_t *>(dynamic_ptr(module, dyn->d_un.d_ptr));
+                    break;
+                case DT_GNU_HASH:
+                    gnu_hash = reinterpret_cast<const uint32_t *>(dynamic_ptr(module, dyn->d_un.d_ptr));
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (module.symbols == nullptr || module.strings == nullptr) {
+            module.symbols = nullptr;
+            module.strings = nullptr;
+        } else if (hash != nullptr) {
+            module.symbol_cnt = hash[1];    // nchain
+        } else if (gnu_hash != nullptr) {
+            module.symbol_cnt = gnu_hash_symbol_cnt(gnu_hash);
+        }
+    }
+
+    static int index_module(struct dl_phdr_info *info, size_t size, void *data) {
+        build_state_t *state = static_cast<build_state_t *>(data);
+        index_t *index = state->index;
+
+        if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+            index->counted = true;
+            index->adds = info->dlpi_adds;
+            index->subs = info->dlpi_subs;
+        }
+
+        module_t module = {};
+        module.start = UINTPTR_MAX;
+        module.load_bias = info->dlpi_addr;
+        for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+            const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+            if (phdr.p_type == PT_LOAD) {
+                module.start = std::min(module.start, (info->dlpi_addr + phdr.p_vaddr) & state->page_mask);
+                module.end = std::max(module.end, info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz);
+            }
+        }
+        if (module.start == UINTPTR_MAX) {
+            return 0;
+        }
+        module.path = (info->dlpi_name != nullptr) ? info->dlpi_name : "";
+
+        // a module still mapped where it was is the same module
+        const module_t *indexed = find_in(state->previous, module.start);
+        if (indexed != nullptr && indexed->start == module.start && indexed->end == module.end &&
+            indexed->load_bias == module.load_bias && (module.path.empty() || indexed->path == module.path)) {
+            index->modules.push_back(*indexed);
+            return 0;
+        }
+
+        for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+            const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+            if (phdr.p_type == PT_DYNAMIC) {
+                read_dynamic(reinterpret_cast<const ElfW(Dyn) *>(info->dlpi_addr + phdr.p_vaddr), module);
+            } else if (phdr.p_type == PT_NOTE && module.build_id[0] == '\0') {
+                symbolizer::read_build_id(reinterpret_cast<const char *>(info->dlpi_addr + phdr.p_vaddr),
+                                          phdr.p_memsz, module.build_id, sizeof(module.build_id));
+            } else if (phdr.p_type == PT_GNU_EH_FRAME) {
+                module.eh_frame_hdr = reinterpret_cast<const uint8_t *>(info->dlpi_addr + phdr.p_vaddr);
+                module.eh_frame_hdr_size = phdr.p_memsz;
+            }
+        }
+        index->modules.push_back(module);
+
+        return 0;
+    }
+
+    static bool same_modules(const index_t *a, const index_t *b) {
+        if (a == nullptr || b == nullptr || a->modules.size() != b->modules.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a->modules.size(); i++) {
+            if (a->modules[i].start != b->modules[i].start || a->modules[i].path != b->modules[i].path) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Build a table from the loader's module list, and publish it. Call with the refresh lock held.
+     */
+    static bool rebuild(index_t *previous) {
+        index_t *index = new index_t();
+        build_state_t state = {index, previous, ~(static_cast<uintptr_t>(getpagesize()) - 1)};
+
+        dl_iterate_phdr(index_module, &state);
+
+        std::sort(index->modules.begin(), index->modules.end(),
+                  [](const module_t &a, const module_t &b) { return a.start < b.start; });
+
+        // the executable is listed without a name (and outside the loader's lock, it can be named)
+        for (auto &module: index->modules) {
+            Dl_info info = {};
+            if (module.path.empty() && dladdr(reinterpret_cast<void *>(module.start), &info) &&
+                info.dli_fname != nullptr) {
+                module.path = info.dli_fname;
+            }
+        }
+
+        if (same_modules(index, previous)) {
+            // without load counts, an unchanged list is only seen once it's rebuilt
+            previous->counted = index->counted;
+            previous->adds = index->adds;
+            previous->subs = index->subs;
+            delete index;
+            return false;
+        }
+
+        index->replaced = previous;
+        current.store(index, std::memory_order_release);
+        _LOGD("modules: indexed %zu modules", index->modules.size());
+
+        return true;
+    }
+
+    /**
+     * Read the loader's load and unload counts from the first module
+     */
+    static int read_counts(struct dl_phdr_info *info, size_t size, void *data) {
+        index_t *counts = static_cast<index_t *>(data);
+        if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+            counts->counted = true;
+            counts->adds = info->dlpi_adds;
+            counts->subs = info->dlpi_subs;
+        }
+        return 1;
+    }
+
+    bool initialize() {
+        refresh();
+        index_t *index = current.load(std::memory_order_acquire);
+        return index != nullptr && !index->modules.empty();
+    }
+
+    void shutdown() {
+        std::lock_guard<std::mutex> lock(refresh_mutex);
+        index_t *index = current.exchange(nullptr, std::memory_order_acq_rel);
+        while (index != nullptr) {
+            index_t *replaced = index->replaced;
+            delete index;
+            index = replaced;
+        }
+        symbolizer::release_functions();
+        cfi::flush();
+    }
+
+    bool refresh() {
+        std::lock_guard<std::mutex> lock(refresh_mutex);
+        index_t *index = current.load(std::memory_order_acquire);
+
+        if (index != nullptr && index->counted) {
+            index_t counts = {};
+            dl_iterate_phdr(read_counts, &counts);
+            if (counts.counted && counts.adds == index->adds && counts.subs == index->subs) {
+                return false;
+            }
+        }
+
+        return rebuild(index);
+    }
+
+    bool available() {
+        return current.load(std::memory_order_acquire) != nullptr;
+    }
+
+    const module_t *find(uintptr_t address) {
+        return find_in(current.load(std::memory_order_acquire), address);
+    }
+
+    bool resolve(size_t index, uintptr_t address, stackframe_t &stackframe) {
+        const module_t *module = find(address);
+
+        stackframe.index = index;
+        stackframe.address = address;
+        if (module == nullptr) {
+            return false;
+        }
+
+        std::strncpy(stackframe.so_path, module->path.c_str(), sizeof(stackframe.so_path) - 1);
+        stackframe.so_base = module->start;
+        stackframe.pc = address - module->start;
+
+        // named by an earlier capture, here or in a previous launch
+        if (symcache::lookup(module->build_id, stackframe.pc, stackframe)) {
+            return true;
+        }
+
+        uintptr_t soaddr = address - module->load_bias;
+        const char *symbol = nullptr;
+        for (size_t i = 0; i < module->symbol_cnt; i++) {
+            const ElfW(Sym) &sym = module->symbols[i];
+            unsigned char bind = sym.st_info >> 4;     // ELF32_ST_BIND == ELF64_ST_BIND
+            if ((bind != STB_GLOBAL && bind != STB_WEAK) || sym.st_shndx == SHN_UNDEF) {
+                continue;
+            }
+            if (soaddr < sym.st_value || soaddr >= sym.st_value + sym.st_size) {
+                continue;
+            }
+            if (sym.st_name >= module->strings_size) {
+                break;
+            }
+
+            symbol = module->strings + sym.st_name;
+            stackframe.sym_addr = module->load_bias + sym.st_value;
+            break;
+        }
+
+        // functions dladdr() can't name, if the module's full symbol tables were indexed
+        if (symbol == nullptr) {
+            const symbolizer::function_index_t *functions = symbolizer::find_functions(module->path.c_str(),
+                                                                                       module->build_id);
+            const symbolizer::function_t *function = (functions != nullptr) ? symbolizer::lookup(*functions, soaddr)
+                                                                            : nullptr;
+            if (function != nullptr) {
+                symbol = functions->names.c_str() + function->name;
+                stackframe.sym_addr = module->load_bias + function->start;
+            }
+        }
+
+        if (symbol != nullptr) {
+            if (!demangler::demangle(symbol, stackframe.sym_name, sizeof(stackframe.sym_name))) {
+                std::strncpy(stackframe.sym_name, symbol, sizeof(stackframe.sym_name) - 1);
+            }
+            stackframe.sym_addr_offset = address - stackframe.sym_addr;
+            symcache::insert(module->build_id, stackframe.pc, stackframe);
+        }
+
+        return true;
+    }
+
+    size_t load_symbols(const uintptr_t *frames, size_t frame_cnt) {
+        size_t loaded = 0;
+
+        for (size_t i = 0; i < frame_cnt; i++) {
+            const module_t *module = find(frames[i]);
+            if (module != nullptr && symbolizer::find_functions(module->path.c_str(), module->build_id) == nullptr &&
+                symbolizer::load_functions(module->path.c_str(), 0, module->build_id) != nullptr) {
+                loaded++;
+            }
+        }
+        return loaded;
+    }
+
+    static void collect_state(const backtrace_state_t &state, moduleinfo_t *modules, size_t max,
+                              size_t &module_cnt) {
+        for (size_t i = 0; i < state.frame_cnt; i++) {
+            const module_t *module = find(state.frames[i]);
+            if (module == nullptr) {
+                continue;
+            }
+
+            size_t m = 0;
+            while (m < module_cnt && modules[m].base != module->start) {
+                m++;
+            }
+            if (m == module_cnt && module_cnt < max) {
+                modules[module_cnt++] = {module->start, module->end, module->path.c_str(), module->build_id};
+            }
+        }
+    }
+
+    size_t collect(const backtrace_t &backtrace, moduleinfo_t *modules, size_t max) {
+        size_t module_cnt = 0;
+
+        collect_state(backtrace.state, modules, max, module_cnt);
+        for (size_t i = 0; i < backtrace.thread_cnt; i++) {
+            const backtrace_state_t *state = backtrace.threads[i].backtrace_state;
+            if (state != nullptr && state != &backtrace.state) {
+                collect_state(*state, modules, max, module_cnt);
+            }
+        }
+
+        return module_cnt;
+    }
+
+}   // namespace modules
@@ -0,0 +1,109 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_MODULE_INDEX_H
+#define _AGENT_NDK_MODULE_INDEX_H
+
+#include <link.h>
+#include <string>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+
+/**
+ * In-process address to module index
+ *
+ * A table of the loaded modules, sorted by address, built with dl_iterate_phdr() while
+ * the process is healthy. Frames are resolved against it with a binary search and a scan
+ * of the module's mapped dynamic symbol table, as dladdr() would, but without taking the
+ * loader lock: a crash inside the loader (or a thread holding it) can't deadlock the handler.
+ *
+ * The table is rebuilt when the loader reports modules were loaded or unloaded. Readers
+ * always see a complete table: a rebuilt table is published atomically, and the table it
+ * replaces is retained until shutdown in case a handler is still reading it.
+ */
+namespace modules {
+
+    // the longest NT_GNU_BUILD_ID kept: a SHA-1 (20 bytes) is the common case
+    static const size_t BUILD_ID_MAX = 32;
+
+    /**
+     * A loaded module
+     */
+    typedef struct module {
+        uintptr_t start;                        // lowest mapped address (the base dladdr() reports)
+        uintptr_t end;                          // end of the highest PT_LOAD segment
+        uintptr_t load_bias;                    // difference between mapped and linked addresses
+        const ElfW(Sym) *symbols;               // .dynsym, as mapped
+        size_t symbol_cnt;
+        const char *strings;                    // .dynstr, as mapped
+        size_t strings_size;
+        const uint8_t *eh_frame_hdr;            // .eh_frame_hdr (PT_GNU_EH_FRAME), as mapped
+        size_t eh_frame_hdr_size;
+        char build_id[BUILD_ID_MAX * 2 + 1];    // hex encoded, or empty
+        std::string path;                       // module path, as dladdr() reports it
+
+    } module_t;
+
+    /**
+     * Build the module table. Call at startup, from a healthy thread.
+     *
+     * @return true if the table holds any modules
+     */
+    bool initialize();
+
+    /**
+     * Release the module table, every table it replaced, and the function indexes built
+     */
+    void shutdown();
+
+    /**
+     * Rebuild the table if modules were loaded or unloaded since it was built.
+     * Modules already indexed are reused. Not async-signal-safe: takes the loader lock.
+     *
+     * @return true if the table was rebuilt
+     */
+    bool refresh();
+
+    /**
+     * @return true once a table is built. Async-signal-safe.
+     */
+    bool available();
+
+    /**
+     * Find the module mapping an address. Async-signal-safe.
+     *
+     * @return the module, or null if the address is not in any indexed module
+     */
+    const module_t *find(uintptr_t address);
+
+    /**
+     * Resolve an address as dladdr() would, or from the module's full symbol tables
+     * if they were indexed. Async-signal-safe.
+     *
+     * @return false if the address is not in any indexed module
+     */
+    bool resolve(size_t index, uintptr_t address, stackframe_t &);
+
+    /**
+     * Index the full symbol tables of the modules holding any of the frames, so that
+     * resolve() can name functions dladdr() can't. Not async-signal-safe: call from a
+     * healthy thread. Modules already indexed are skipped.
+     *
+     * @return number of modules indexed
+     */
+    size_t load_symbols(const uintptr_t *frames, size_t frame_cnt);
+
+    /**
+     * Collect the modules holding any of the backtrace's frames, across all threads.
+     * The modules reference the current table. Async-signal-safe.
+     *
+     * @return number of modules collected
+     */
+    size_t collect(const backtrace_t &, moduleinfo_t *modules, size_t max);
+
+}   // namespace modules
+
+#endif // _AGENT_NDK_MODULE_INDEX_H
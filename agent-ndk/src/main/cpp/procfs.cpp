@@ -4,7 +4,9 @@
  */
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <sys/syscall.h>
 #include <string>
 
 #include <agent-ndk.h>
@@ -12,6 +14,27 @@
 
 namespace procfs {
 
+    // a stat line is a comm of up to 64 bytes and 52 numeric fields
+    static const size_t STAT_LINE_MAX = 1024;
+
+    // the kernel keeps a thread name in 16 bytes, including its terminator
+    static const size_t THREAD_NAME_MAX = 15;
+
+    // a thread's status is under 2k on current kernels
+    static const size_t STATUS_MAX = 4096;
+
+    static const char *const SIGBLK_LABEL = "\nSigBlk:\t";
+
+    // as getdents64 lays out each directory entry
+    typedef struct linux_dirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+
+    } linux_dirent64_t;
+
     // https://www.kernel.org/doc/Documentation/filesystems/proc.txt
 
     const char *trim_trailing_ws(const char *buff) {
@@ -72,13 +95,9 @@ namespace procfs {
         char path[PATH_MAX];
         std::snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, tid);
 
-        FILE *fp = fopen(path, "r");
-        if (fp != nullptr) {
-            char buff[1024];
-            if (fgets(buff, sizeof(buff), fp) != nullptr) {
-                stat = trim_trailing_ws(buff);
-            }
-            fclose(fp);
+        char buff[STAT_LINE_MAX];
+        if (read_stat_file(AT_FDCWD, path, buff, sizeof(buff)) > 0) {
+            stat = trim_trailing_ws(buff);
         } else {
             _LOGE("get_thread_stat: error[%d]: %s", errno, strerror(errno));
         }
@@ -98,13 +117,9 @@ namespace procfs {
         char path[PATH_MAX];
         std::snprintf(path, sizeof(path), "/proc/%d/stat", pid);
 
-        FILE *fp = fopen(path, "r");
-        if (fp != nullptr) {
-            char buff[1024];
-            if (fgets(buff, sizeof(buff), fp) != nullptr) {
-                statResult = trim_trailing_ws(buff);
-            }
-            fclose(fp);
+        char buff[STAT_LINE_MAX];
+        if (read_stat_file(AT_FDCWD, path, buff, sizeof(buff)) > 0) {
+            statResult = trim_trailing_ws(buff);
         } else {
             _LOGE("get_cpu_sample: error[%d]: %s", errno, strerror(errno));
         }
@@ -112,4 +127,316 @@ namespace procfs {
         return statResult.c_str();
     }
 
+    ssize_t read_stat_file(int dirfd, const char *path, char *buffer, size_t size) {
+        int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return -1;
+        }
+
+        // procfs generates the whole line on the first read
+        ssize_t cnt;
+        do {
+            cnt = read(fd, buffer, size - 1);
+        } while (cnt < 0 && errno == EINTR);
+        close(fd);
+
+        buffer[cnt > 0 ? cnt : 0] = '\0';
+        return cnt;
+    }
+
+    static const char *next_field(const char *cursor, const char *end) {
+        while (cursor < end && *cursor != ' ') {
+            cursor++;
+        }
+        while (cursor < end && *cursor == ' ') {
+            cursor++;
+        }
+        return cursor;
+    }
+
+    static unsigned long long scan_udec(const char *cursor, const char *end) {
+        unsigned long long value = 0;
+        for (; cursor < end && *cursor >= '0' && *cursor <= '9'; cursor++) {
+            value = value * 10 + (*cursor - '0');
+        }
+        return value;
+    }
+
+    static long long scan_dec(const char *cursor, const char *end) {
+        if (cursor < end && *cursor == '-') {
+            return -static_cast<long long>(scan_udec(cursor + 1, end));
+        }
+        return static_cast<long long>(scan_udec(cursor, end));
+    }
+
+    /**
+     * Format "<tid>/<name>" (or "<pid>/<name>") without snprintf()
+     */
+    static bool thread_path(char *path, size_t size, pid_t tid, const char *name) {
+        char digits[16];
+        size_t cnt = 0;
+        unsigned value = static_cast<unsigned>(tid);
+        do {
+            digits[cnt++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0 && cnt < sizeof(digits));
+
+        size_t name_len = std::strlen(name);
+        if (cnt + 1 + name_len + 1 > size) {
+            return false;
+        }
+
+        char *cursor = path;
+        while (cnt > 0) {
+            *cursor++ = digits[--cnt];
+        }
+        *cursor++ = '/';
+        std::memcpy(cursor, name, name_len + 1);
+        return true;
+    }
+
+    /**
+     * Read the process name into a caller-supplied buffer, using only async-signal-safe calls
+     */
+    const char *read_process_name(pid_t pid, char *processName, size_t size) {
+        static const char PROC[] = "/proc/";
+        char path[32];
+        std::memcpy(path, PROC, sizeof(PROC) - 1);
+
+        std::strncpy(processName, "<unknown>", size - 1);
+        processName[size - 1] = '\0';
+
+        int fd = -1;
+        if (thread_path(path + sizeof(PROC) - 1, sizeof(path) - (sizeof(PROC) - 1), pid, "cmdline")) {
+            fd = open(path, O_RDONLY | O_CLOEXEC);
+        }
+        if (fd != -1) {
+            ssize_t cnt = read(fd, processName, size - 1);
+            if (cnt > 0) {
+                // cmdline arguments are NUL-separated: the name is the first
+                processName[cnt] = '\0';
+                trim_trailing_ws(processName);
+            } else {
+                std::strncpy(processName, "<unknown>", size - 1);
+            }
+            close(fd);
+        } else {
+            _LOGE("read_process_name: error[%d]: %s", errno, strerror(errno));
+        }
+
+        return processName;
+    }
+
+    int open_task_dir(pid_t pid) {
+        static const char PROC[] = "/proc/";
+        char path[32];
+        std::memcpy(path, PROC, sizeof(PROC) - 1);
+        if (!thread_path(path + sizeof(PROC) - 1, sizeof(path) - (sizeof(PROC) - 1), pid, "task")) {
+            return -1;
+        }
+
+        int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1) {
+            _LOGE_POSIX("Could not open the task directory");
+        }
+        return fd;
+    }
+
+    ssize_t read_thread_file(int task_fd, pid_t tid, const char *name, char *buffer, size_t size) {
+        char path[32];
+        if (!thread_path(path, sizeof(path), tid, name)) {
+            return -1;
+        }
+
+        int fd = openat(task_fd, path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return -1;
+        }
+
+        // procfs generates the whole file on the first read
+        ssize_t cnt;
+        do {
+            cnt = pread(fd, buffer, size - 1, 0);
+        } while (cnt < 0 && errno == EINTR);
+        close(fd);
+
+        buffer[cnt > 0 ? cnt : 0] = '\0';
+        return cnt;
+    }
+
+    bool thread_has_name(int task_fd, pid_t tid, const char *name) {
+        char comm[THREAD_NAME_MAX + 2];
+        ssize_t cnt = read_thread_file(task_fd, tid, "comm", comm, sizeof(comm));
+        if (cnt <= 0) {
+            return false;
+        }
+        if (comm[cnt - 1] == '\n') {
+            comm[--cnt] = '\0';
+        }
+
+        size_t name_len = std::strlen(name);
+        name_len = name_len < THREAD_NAME_MAX ? name_len : THREAD_NAME_MAX;
+        return static_cast<size_t>(cnt) == name_len && std::memcmp(comm, name, name_len) == 0;
+    }
+
+    /**
+     * List the threads of an open task directory with getdents64, from its start
+     *
+     * @param visit called with each thread id, until it returns false
+     * @return false if the directory could not be read
+     */
+    template<typename Visitor>
+    static bool scan_task_dir(int task_fd, Visitor visit) {
+        // a kept-open directory is listed from its start each time
+        if (lseek(task_fd, 0, SEEK_SET) != 0) {
+            return false;
+        }
+
+        alignas(linux_dirent64_t) char entries[4096];
+        for (;;) {
+            long cnt = syscall(SYS_getdents64, task_fd, entries, sizeof(entries));
+            if (cnt < 0 && errno == EINTR) {
+                continue;
+            }
+            if (cnt <= 0) {
+                return cnt == 0;
+            }
+
+            for (long offset = 0; offset < cnt;) {
+                const linux_dirent64_t *entry = reinterpret_cast<const linux_dirent64_t *>(entries + offset);
+                offset += entry->d_reclen;
+
+                // only interested in numeric directories (representing thread ids)
+                if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+                    continue;
+                }
+
+                if (!visit(static_cast<pid_t>(scan_udec(entry->d_name, entry->d_name + NAME_MAX)))) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    pid_t find_thread(int task_fd, const char *name) {
+        pid_t found = -1;
+        scan_task_dir(task_fd, [&](pid_t tid) {
+            if (thread_has_name(task_fd, tid, name)) {
+                found = tid;
+                return false;
+            }
+            return true;
+        });
+
+        return found;
+    }
+
+    size_t list_threads(int task_fd, pid_t *tids, size_t max) {
+        size_t cnt = 0;
+        scan_task_dir(task_fd, [&](pid_t tid) {
+            if (cnt < max) {
+                tids[cnt++] = tid;
+            }
+            return cnt < max;
+        });
+
+        return cnt;
+    }
+
+    bool read_sigblk(int task_fd, pid_t tid, uint64_t &sigblk) {
+        char status[STATUS_MAX];
+        if (read_thread_file(task_fd, tid, "status", status, sizeof(status)) <= 0) {
+            return false;
+        }
+
+        const char *field = std::strstr(status, SIGBLK_LABEL);
+        if (field == nullptr) {
+            return false;
+        }
+
+        sigblk = 0;
+        for (const char *cursor = field + std::strlen(SIGBLK_LABEL); ; cursor++) {
+            char c = *cursor;
+            if (c >= '0' && c <= '9') {
+                sigblk = (sigblk << 4) | (c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                sigblk = (sigblk << 4) | (c - 'a' + 10);
+            } else {
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool parse_stat(const char *stat, size_t length, proc_stat_t &result) {
+        const char *end = stat + length;
+        result = proc_stat_t();
+
+        // the name is everything between the first '(' and the last ')'
+        const char *name = static_cast<const char *>(std::memchr(stat, '(', length));
+        const char *name_end = end;
+        while (name_end > stat && *(name_end - 1) != ')') {
+            name_end--;
+        }
+        if (name == nullptr || name_end <= name + 1) {
+            return false;
+        }
+        name++;
+        name_end--;
+
+        size_t name_len = name_end - name;
+        name_len = name_len < sizeof(result.name) - 1 ? name_len : sizeof(result.name) - 1;
+        std::memcpy(result.name, name, name_len);
+        result.name[name_len] = '\0';
+
+        // fields are numbered from 1 (pid); the name is field 2, state field 3
+        const char *cursor = name_end + 1;
+        while (cursor < end && *cursor == ' ') {
+            cursor++;
+        }
+        if (cursor >= end) {
+            return false;
+        }
+        result.state = *cursor;
+
+        for (int field = 3; cursor < end; field++) {
+            switch (field) {
+                case 4:
+                    result.ppid = scan_dec(cursor, end);
+                    break;
+                case 14:
+                    result.utime = scan_udec(cursor, end);
+                    break;
+                case 15:
+                    result.stime = scan_udec(cursor, end);
+                    break;
+                case 18:
+                    result.priority = scan_dec(cursor, end);
+                    break;
+                case 19:
+                    result.nice = scan_dec(cursor, end);
+                    break;
+                case 20:
+                    result.num_threads = scan_dec(cursor, end);
+                    break;
+                case 28:
+                    result.start_stack = scan_udec(cursor, end);
+                    // ignore the rest
+                    return true;
+                default:
+                    break;
+            }
+            cursor = next_field(cursor, end);
+        }
+
+        // older kernels may report fewer fields
+        return true;
+    }
+
+    bool read_stat(int dirfd, const char *path, proc_stat_t &result) {
+        char buff[STAT_LINE_MAX];
+        ssize_t cnt = read_stat_file(dirfd, path, buff, sizeof(buff));
+        return cnt > 0 && parse_stat(buff, cnt, result);
+    }
+
 }   // namespace procfs
@@ -6,6 +6,8 @@
 #ifndef _AGENT_NDK_PROCFS_H
 #define _AGENT_NDK_PROCFS_H
 
+#include <stdint.h>
+#include <sys/types.h>
 #include <string>
 
 #ifdef __cplusplus
@@ -14,8 +16,92 @@ extern "C" {
 
 namespace procfs {
 
+    /**
+     * Fields of a process or thread stat file (proc(5))
+     */
+    typedef struct proc_stat {
+        char name[32];                  // comm, as reported (may hold spaces and parentheses)
+        char state;                     // single-letter run state code
+        pid_t ppid;
+        unsigned long long utime;       // user time, in clock ticks
+        unsigned long long stime;       // system time, in clock ticks
+        long priority;
+        long nice;
+        long num_threads;
+        uintptr_t start_stack;          // address of the start (bottom) of the stack
+
+    } proc_stat_t;
+
+    /**
+     * Read a stat file, relative to an open directory (or AT_FDCWD), with a single read().
+     * Async-signal-safe.
+     *
+     * @return number of bytes read into the buffer (NUL-terminated), or -1
+     */
+    ssize_t read_stat_file(int dirfd, const char *path, char *buffer, size_t size);
+
+    /**
+     * Parse a stat line in a single forward scan, without allocating. Async-signal-safe.
+     *
+     * @return false if the line is malformed
+     */
+    bool parse_stat(const char *stat, size_t length, proc_stat_t &);
+
+    /**
+     * Read and parse a stat file, relative to an open directory (or AT_FDCWD). Async-signal-safe.
+     */
+    bool read_stat(int dirfd, const char *path, proc_stat_t &);
+
+    /**
+     * Open a process' task directory, to be kept open and scanned with find_thread()
+     * or list_threads(). Async-signal-safe.
+     *
+     * @return the directory's descriptor, or -1
+     */
+    int open_task_dir(pid_t);
+
+    /**
+     * Read one of a thread's files ("<tid>/<name>"), relative to an open task directory,
+     * with a single pread(). Allocates nothing. Async-signal-safe.
+     *
+     * @return number of bytes read into the buffer (NUL-terminated), or -1
+     */
+    ssize_t read_thread_file(int task_fd, pid_t tid, const char *name, char *buffer, size_t size);
+
+    /**
+     * Check a thread's name (comm), relative to an open task directory. Names are compared as
+     * the kernel truncates them. Async-signal-safe.
+     *
+     * @return false if the thread has another name, or has exited
+     */
+    bool thread_has_name(int task_fd, pid_t tid, const char *name);
+
+    /**
+     * Find a thread by its name, listing an open task directory with getdents64.
+     * Allocates nothing. Async-signal-safe.
+     *
+     * @return the first thread listed with the name, or -1
+     */
+    pid_t find_thread(int task_fd, const char *name);
+
+    /**
+     * List the threads of an open task directory with getdents64. Allocates nothing.
+     * Async-signal-safe.
+     *
+     * @return number of thread ids listed, at most max
+     */
+    size_t list_threads(int task_fd, pid_t *tids, size_t max);
+
+    /**
+     * Read the mask of signals a thread blocks (the SigBlk field of its status), relative to
+     * an open task directory. Async-signal-safe.
+     */
+    bool read_sigblk(int task_fd, pid_t tid, uint64_t &sigblk);
+
     const char *get_process_name(pid_t, std::string &);
 
+    const char *read_process_name(pid_t, char *, size_t);
+
     const char *get_thread_name(pid_t, pid_t, std::string &);
 
     const char *get_thread_status_path(pid_t, pid_t, std::string &);
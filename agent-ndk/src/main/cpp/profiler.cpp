@@ -0,0 +1,562 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+#include "unwinder.h"
+#include "procfs.h"
+#include "signal-utils.h"
+#include "stack-trie.h"
+#include "jni/native-context.h"
+#include "profiler.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif  // !sigev_notify_thread_id
+
+namespace profiler {
+
+    static const char *const PROFILE_PREFIX = "profile-";
+    static const char *const PROFILE_SUFFIX = ".folded";
+
+    // a timer's signal value: the thread slot, under the generation it was armed in
+    static const uint32_t SLOT_BITS = 8;
+    static const uint32_t SLOT_MASK = (1u << SLOT_BITS) - 1;
+    static_assert(PROFILE_THREADS_MAX <= (1u << SLOT_BITS), "thread slots must fit a timer's value");
+
+    // threads listed per scan, sampled or not
+    static const size_t SCAN_THREADS_MAX = 1024;
+
+    typedef struct sample {
+        uint32_t frame_cnt;
+        uintptr_t frames[PROFILE_FRAMES_MAX];
+
+    } sample_t;
+
+    /**
+     * A sampled thread: its timer, and the ring its handler pushes samples into. The thread is
+     * the ring's only producer, and the aggregator its only consumer.
+     */
+    typedef struct thread_slot {
+        std::atomic<pid_t> tid;             // 0 if the slot is free
+        std::atomic<uint32_t> generation;   // bumped as the slot is taken and freed
+        timer_t timer;
+        bool listed;                        // by the aggregator's last thread scan
+
+        alignas(64) std::atomic<uint32_t> head;     // next sample to drain
+        alignas(64) std::atomic<uint32_t> tail;     // next sample to push
+        std::atomic<uint64_t> dropped;
+        sample_t samples[PROFILE_RING_SZ];
+
+    } thread_slot_t;
+
+    static std::atomic<thread_slot_t *> slots(nullptr);
+    static std::atomic<int> handlers(0);            // handlers that may be reading the slots
+
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    static pthread_cond_t wakeup;
+    static pthread_t aggregator_thread;
+    static bool active = false;
+    static bool handler_installed = false;
+
+    // held by the aggregator, or whoever holds the mutex
+    static thread_slot_t *table = nullptr;
+    static trie::trie_t profile;
+    static profile_mode_t profile_mode = PROFILE_OFF;
+    static uint64_t interval_ns = 0;
+    static pid_t aggregator_tid = 0;
+    static int task_fd = -1;
+    static uint64_t window_start_ns = 0;
+    static uint64_t next_scan_ns = 0;
+    static stats_t totals = {};
+
+    static uint64_t now_ns() {
+        struct timespec now = {};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+    }
+
+    /**
+     * The CPU time clock of any thread of the process, as the kernel encodes it
+     * (pthread_getcpuclockid() only takes a pthread_t)
+     */
+    static clockid_t thread_cpu_clock(pid_t tid) {
+        static const clockid_t CPUCLOCK_PERTHREAD_SCHED = 6;
+        return static_cast<clockid_t>((~static_cast<unsigned>(tid) << 3) | CPUCLOCK_PERTHREAD_SCHED);
+    }
+
+    /**
+     * Unwind the interrupted thread into its ring. Async-signal-safe and lock-free.
+     */
+    static void take_sample(thread_slot_t &slot, const ucontext_t *ucontext) {
+        uint32_t tail = slot.tail.load(std::memory_order_relaxed);
+        if (tail - slot.head.load(std::memory_order_acquire) >= PROFILE_RING_SZ) {
+            slot.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        backtrace_state_t state = {};
+        state.sa_ucontext = ucontext;
+        if (!unwind_frame_pointers(state)) {
+            unwind_cfi(state);
+        }
+
+        sample_t &sample = slot.samples[tail % PROFILE_RING_SZ];
+        sample.frame_cnt = static_cast<uint32_t>(state.frame_cnt < PROFILE_FRAMES_MAX ?
+                                                 state.frame_cnt : PROFILE_FRAMES_MAX);
+        std::memcpy(sample.frames, state.frames, sample.frame_cnt * sizeof(uintptr_t));
+        slot.tail.store(tail + 1, std::memory_order_release);
+    }
+
+    static void sample_handler(__unused int signo, siginfo_t *info, void *ucontext) {
+        if (info->si_code != SI_TIMER) {
+            return;
+        }
+
+        int saved_errno = errno;
+        handlers.fetch_add(1);
+
+        // a sample queued before its thread's slot was freed (or profiling stopped) is dropped
+        thread_slot_t *sampled = slots.load();
+        uint32_t value = static_cast<uint32_t>(info->si_value.sival_int);
+        if (sampled != nullptr) {
+            thread_slot_t &slot = sampled[value & SLOT_MASK];
+            if ((slot.generation.load(std::memory_order_relaxed) << SLOT_BITS) == (value & ~SLOT_MASK) &&
+                slot.tid.load(std::memory_order_relaxed) == gettid()) {
+                take_sample(slot, static_cast<const ucontext_t *>(ucontext));
+            }
+        }
+
+        handlers.fetch_sub(1);
+        errno = saved_errno;
+    }
+
+    /**
+     * Give a slot to a thread, and arm its timer
+     */
+    static bool arm_thread(size_t index, pid_t tid) {
+        thread_slot_t &slot = table[index];
+        uint32_t generation = slot.generation.load(std::memory_order_relaxed) + 1;
+        slot.generation.store(generation, std::memory_order_relaxed);
+        slot.head.store(slot.tail.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        slot.tid.store(tid, std::memory_order_release);
+
+        struct sigevent event = {};
+        event.sigev_notify = SIGEV_THREAD_ID;
+        event.sigev_signo = SIGPROF;
+        event.sigev_value.sival_int = static_cast<int>((generation << SLOT_BITS) | index);
+        event.sigev_notify_thread_id = tid;
+
+        clockid_t clock = (profile_mode == PROFILE_CPU) ? thread_cpu_clock(tid) : CLOCK_MONOTONIC;
+        if (timer_create(clock, &event, &slot.timer) != 0) {
+            // the thread has exited since it was listed
+            slot.tid.store(0, std::memory_order_release);
+            return false;
+        }
+
+        // stagger the first samples, so wall time timers don't all fire together
+        uint64_t first_ns = interval_ns - (interval_ns * (index % 16)) / 16;
+        struct itimerspec spec = {};
+        spec.it_interval.tv_sec = static_cast<time_t>(interval_ns / 1000000000ULL);
+        spec.it_interval.tv_nsec = static_cast<long>(interval_ns % 1000000000ULL);
+        spec.it_value.tv_sec = static_cast<time_t>(first_ns / 1000000000ULL);
+        spec.it_value.tv_nsec = static_cast<long>(first_ns % 1000000000ULL);
+        if (timer_settime(slot.timer, 0, &spec, nullptr) != 0) {
+            timer_delete(slot.timer);
+            slot.tid.store(0, std::memory_order_release);
+            return false;
+        }
+
+        slot.listed = true;
+        return true;
+    }
+
+    /**
+     * Delete a slot's timer, and free it. Samples already queued for it are dropped.
+     */
+    static void disarm_thread(thread_slot_t &slot) {
+        timer_delete(slot.timer);
+        totals.dropped += slot.dropped.exchange(0, std::memory_order_relaxed);
+        slot.generation.fetch_add(1, std::memory_order_relaxed);
+        slot.tid.store(0, std::memory_order_release);
+    }
+
+    /**
+     * Fold every sample waiting in the rings into the profile
+     */
+    static void drain() {
+        for (size_t i = 0; i < PROFILE_THREADS_MAX; i++) {
+            thread_slot_t &slot = table[i];
+            if (slot.tid.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+
+            uint32_t head = slot.head.load(std::memory_order_relaxed);
+            uint32_t tail = slot.tail.load(std::memory_order_acquire);
+            for (; head != tail; head++) {
+                const sample_t &sample = slot.samples[head % PROFILE_RING_SZ];
+                trie::insert(profile, sample.frames, sample.frame_cnt);
+            }
+            slot.head.store(head, std::memory_order_release);
+        }
+    }
+
+    /**
+     * Arm a timer for each thread started since the last scan, and free the slots of those
+     * that have exited
+     */
+    static void scan_threads() {
+        static pid_t tids[SCAN_THREADS_MAX];
+        size_t tid_cnt = procfs::list_threads(task_fd, tids, SCAN_THREADS_MAX);
+
+        for (size_t i = 0; i < PROFILE_THREADS_MAX; i++) {
+            table[i].listed = false;
+        }
+
+        size_t free_slot = 0;
+        for (size_t t = 0; t < tid_cnt; t++) {
+            pid_t tid = tids[t];
+            if (tid == aggregator_tid) {
+                continue;
+            }
+
+            bool sampled = false;
+            for (size_t i = 0; i < PROFILE_THREADS_MAX && !sampled; i++) {
+                if (table[i].tid.load(std::memory_order_relaxed) == tid) {
+                    table[i].listed = sampled = true;
+                }
+            }
+
+            while (!sampled && free_slot < PROFILE_THREADS_MAX &&
+                   table[free_slot].tid.load(std::memory_order_relaxed) != 0) {
+                free_slot++;
+            }
+            if (!sampled && free_slot < PROFILE_THREADS_MAX) {
+                arm_thread(free_slot, tid);
+            }
+        }
+
+        totals.threads = 0;
+        for (size_t i = 0; i < PROFILE_THREADS_MAX; i++) {
+            thread_slot_t &slot = table[i];
+            if (slot.tid.load(std::memory_order_relaxed) == 0) {
+                continue;
+            }
+            if (!slot.listed) {
+                disarm_thread(slot);
+            } else {
+                totals.threads++;
+            }
+        }
+    }
+
+    static bool write_file(const char *path, const char *data, size_t size) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            return false;
+        }
+
+        size_t pos = 0;
+        while (pos < size) {
+            ssize_t cnt = write(fd, data + pos, size - pos);
+            if (cnt < 0 && errno == EINTR) {
+                continue;
+            }
+            if (cnt <= 0) {
+                break;
+            }
+            pos += cnt;
+        }
+        return (close(fd) == 0) && pos == size;
+    }
+
+    /**
+     * Remove all but the newest PROFILE_FILES_MAX profiles from the report directory
+     */
+    static void prune_profiles(const char *report_path) {
+        DIR *dir = opendir(report_path);
+        if (dir == nullptr) {
+            _LOGE_POSIX("profiler: could not open the report directory");
+            return;
+        }
+
+        std::vector<std::pair<long long, std::string>> written;
+        size_t prefix_len = std::strlen(PROFILE_PREFIX);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            const char *name = entry->d_name;
+            char *end = nullptr;
+            if (std::strncmp(name, PROFILE_PREFIX, prefix_len) != 0) {
+                continue;
+            }
+            long long epoch_ms = std::strtoll(name + prefix_len, &end, 10);
+            if (end != name + prefix_len && std::strcmp(end, PROFILE_SUFFIX) == 0) {
+                written.emplace_back(epoch_ms, name);
+            }
+        }
+        closedir(dir);
+
+        if (written.size() <= PROFILE_FILES_MAX) {
+            return;
+        }
+
+        // oldest first
+        std::sort(written.begin(), written.end());
+        for (size_t i = 0; i < written.size() - PROFILE_FILES_MAX; i++) {
+            std::string path = std::string(report_path) + "/" + written[i].second;
+            if (unlink(path.c_str()) == 0) {
+                totals.pruned++;
+            } else if (errno != ENOENT) {
+                _LOGE_POSIX("profiler: could not remove an old profile");
+            }
+        }
+    }
+
+    /**
+     * Write the window's profile next to the reports, and start a new window
+     */
+    static bool write_profile() {
+        bool written = true;
+        totals.samples += profile.samples;
+        totals.truncated += profile.truncated;
+
+        if (profile.samples > 0) {
+            std::string folded;
+            trie::write_folded(profile, folded);
+
+            struct timeval now = {};
+            gettimeofday(&now, nullptr);
+            long long epoch_ms = static_cast<long long>(now.tv_sec) * 1000LL + now.tv_usec / 1000;
+
+            const char *report_path = jni::get_native_context().reportPathAbsolute;
+            char path[PATH_MAX];
+            char temp_path[PATH_MAX];
+            std::snprintf(path, sizeof(path), "%s/%s%lld%s", report_path, PROFILE_PREFIX, epoch_ms, PROFILE_SUFFIX);
+            std::snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+            written = write_file(temp_path, folded.data(), folded.size()) && rename(temp_path, path) == 0;
+            if (written) {
+                totals.profiles++;
+                _LOGD("profiler: %llu samples written to [%s]", (unsigned long long) profile.samples, path);
+                prune_profiles(report_path);
+            } else {
+                _LOGE_POSIX("profiler: could not write the profile");
+                unlink(temp_path);
+            }
+        }
+
+        trie::initialize(profile, PROFILE_NODES_MAX);
+        window_start_ns = now_ns();
+
+        return written;
+    }
+
+    static void *aggregate(__unused void *unused) {
+        if (0 != pthread_setname_np(pthread_self(), "NR-Profiler")) {
+            _LOGE_POSIX("pthread_setname_np()");
+        }
+
+        pthread_mutex_lock(&mutex);
+        aggregator_tid = gettid();
+        while (active) {
+            uint64_t now = now_ns();
+            drain();
+            if (now >= next_scan_ns) {
+                scan_threads();
+                next_scan_ns = now + PROFILE_THREAD_SCAN_MS * 1000000ULL;
+            }
+            if (now - window_start_ns >= PROFILE_WINDOW_MS * 1000000ULL) {
+                write_profile();
+            }
+
+            uint64_t deadline_ns = now + PROFILE_DRAIN_MS * 1000000ULL;
+            struct timespec deadline = {static_cast<time_t>(deadline_ns / 1000000000ULL),
+                                        static_cast<long>(deadline_ns % 1000000000ULL)};
+            pthread_cond_timedwait(&wakeup, &mutex, &deadline);
+        }
+        pthread_mutex_unlock(&mutex);
+
+        return nullptr;
+    }
+
+    /**
+     * Install the sample handler, unless the app handles SIGPROF itself
+     */
+    static bool install_handler() {
+        if (handler_installed) {
+            return true;
+        }
+
+        struct sigaction current = {};
+        if (sigaction(SIGPROF, nullptr, &current) != 0 ||
+            ((current.sa_flags & SA_SIGINFO) ? current.sa_sigaction != nullptr :
+             (current.sa_handler != SIG_DFL && current.sa_handler != SIG_IGN))) {
+            _LOGE("profiler: SIGPROF is in use. Profiling is not available.");
+            return false;
+        }
+
+        // SA_RESTART: a sample doesn't interrupt the thread's system calls
+        handler_installed = sigutils::install_handler(SIGPROF, sample_handler, nullptr, SA_RESTART);
+        return handler_installed;
+    }
+
+    bool start(profile_mode_t mode, int hz) {
+        if (mode == PROFILE_OFF || hz <= 0) {
+            return false;
+        }
+
+        pthread_mutex_lock(&mutex);
+        if (active || !install_handler()) {
+            pthread_mutex_unlock(&mutex);
+            return false;
+        }
+
+        task_fd = procfs::open_task_dir(getpid());
+        table = new(std::nothrow) thread_slot_t[PROFILE_THREADS_MAX]();
+        if (task_fd == -1 || table == nullptr) {
+            _LOGE("profiler: could not allocate the sample rings");
+            if (task_fd != -1) {
+                close(task_fd);
+                task_fd = -1;
+            }
+            delete[] table;
+            table = nullptr;
+            pthread_mutex_unlock(&mutex);
+            return false;
+        }
+
+        profile_mode = mode;
+        interval_ns = 1000000000ULL / (hz < PROFILE_HZ_MAX ? hz : PROFILE_HZ_MAX);
+        trie::initialize(profile, PROFILE_NODES_MAX);
+        totals = {};
+        window_start_ns = now_ns();
+        next_scan_ns = 0;
+        aggregator_tid = 0;
+        slots.store(table);
+
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&wakeup, &attr);
+        pthread_condattr_destroy(&attr);
+
+        active = true;
+        if (0 != pthread_create(&aggregator_thread, nullptr, aggregate, nullptr)) {
+            _LOGE("Could not create a profiler thread. Profiling is not available.");
+            active = false;
+            slots.store(nullptr);
+            pthread_cond_destroy(&wakeup);
+            close(task_fd);
+            task_fd = -1;
+            delete[] table;
+            table = nullptr;
+            pthread_mutex_unlock(&mutex);
+            return false;
+        }
+        pthread_mutex_unlock(&mutex);
+
+        _LOGI("profiler: sampling %s time at %d Hz", mode == PROFILE_CPU ? "CPU" : "wall", hz);
+        return true;
+    }
+
+    void stop() {
+        pthread_mutex_lock(&mutex);
+        bool stopping = active;
+        active = false;
+        if (stopping) {
+            pthread_cond_signal(&wakeup);
+        }
+        pthread_mutex_unlock(&mutex);
+
+        if (!stopping) {
+            return;
+        }
+        if (0 != pthread_join(aggregator_thread, nullptr)) {
+            _LOGE_POSIX("pthread_join failed");
+        }
+
+        pthread_mutex_lock(&mutex);
+        for (size_t i = 0; i < PROFILE_THREADS_MAX; i++) {
+            if (table[i].tid.load(std::memory_order_relaxed) != 0) {
+                timer_delete(table[i].timer);
+            }
+        }
+        drain();
+        for (size_t i = 0; i < PROFILE_THREADS_MAX; i++) {
+            totals.dropped += table[i].dropped.load(std::memory_order_relaxed);
+        }
+        write_profile();
+        totals.threads = 0;
+
+        // once no handler can still be reading them, the rings are freed
+        slots.store(nullptr);
+        while (handlers.load() != 0) {
+            usleep(1000);
+        }
+        delete[] table;
+        table = nullptr;
+
+        pthread_cond_destroy(&wakeup);
+        close(task_fd);
+        task_fd = -1;
+        pthread_mutex_unlock(&mutex);
+
+        _LOGI("profiler: stopped after %llu samples (%llu dropped)",
+              (unsigned long long) totals.samples, (unsigned long long) totals.dropped);
+    }
+
+    bool flush() {
+        pthread_mutex_lock(&mutex);
+        bool written = false;
+        if (active) {
+            drain();
+            written = write_profile();
+        }
+        pthread_mutex_unlock(&mutex);
+
+        return written;
+    }
+
+    bool running() {
+        pthread_mutex_lock(&mutex);
+        bool is_active = active;
+        pthread_mutex_unlock(&mutex);
+
+        return is_active;
+    }
+
+    stats_t get_stats() {
+        pthread_mutex_lock(&mutex);
+        stats_t stats = totals;
+        if (table != nullptr) {
+            stats.samples += profile.samples;
+            stats.truncated += profile.truncated;
+            for (size_t i = 0; i < PROFILE_THREADS_MAX; i++) {
+                stats.dropped += table[i].dropped.load(std::memory_order_relaxed);
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+
+        return stats;
+    }
+
+}   // namespace profiler
@@ -0,0 +1,101 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_PROFILER_H
+#define _AGENT_NDK_PROFILER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Sampling CPU profiler
+ *
+ * Each thread of the process gets a POSIX timer on its own CPU time clock (or on the monotonic
+ * clock, to sample wall time), which sends SIGPROF to that thread at the sampling rate. The
+ * handler walks the thread's frame records (or its DWARF CFI, if the chain breaks) and pushes
+ * the stack into the thread's own single-producer ring: the handler never locks, allocates or
+ * waits. The runtime's unwinder, which can take the loader lock, is not used.
+ *
+ * An aggregator thread drains the rings, folds the stacks into a stack trie keyed by module
+ * relative pcs, and keeps the timers in step with the threads that start and exit. Each window,
+ * and when profiling stops, the trie is written next to the reports as folded stacks, in a
+ * "profile-<ms since the epoch>.folded" file, and emptied.
+ *
+ * As with any signal, a sample interrupts the sampled thread's sleeps and blocking calls that
+ * SA_RESTART doesn't restart: in wall time, those of idle threads too.
+ *
+ * SIGPROF must not be in use by the app. Once profiling has run, the handler stays installed:
+ * a sample still queued for a thread when profiling stops is dropped, rather than taking
+ * SIGPROF's default action of killing the process.
+ */
+namespace profiler {
+
+    typedef enum profile_mode {
+        PROFILE_OFF = 0,
+        PROFILE_CPU,        // sample threads as they use CPU time
+        PROFILE_WALL,       // sample threads as time passes, running or not
+
+    } profile_mode_t;
+
+    // samples per second, per thread
+    static const int PROFILE_HZ_DEFAULT = 100;
+    static const int PROFILE_HZ_MAX = 1000;
+
+    // threads sampled at once
+    static const size_t PROFILE_THREADS_MAX = 256;
+
+    // frames kept per sample, innermost first
+    static const size_t PROFILE_FRAMES_MAX = 64;
+
+    // samples each thread's ring holds until the aggregator drains it
+    static const size_t PROFILE_RING_SZ = 8;
+
+    // distinct call path nodes held per window
+    static const size_t PROFILE_NODES_MAX = 65536;
+
+    static const long PROFILE_DRAIN_MS = 50;
+    static const long PROFILE_THREAD_SCAN_MS = 1000;
+    static const long PROFILE_WINDOW_MS = 60000;
+
+    // profiles kept next to the reports: the oldest are removed as each is written
+    static const size_t PROFILE_FILES_MAX = 16;
+
+    typedef struct stats {
+        uint64_t samples;           // samples folded into profiles
+        uint64_t dropped;           // samples lost to a full ring
+        uint64_t truncated;         // samples cut short by a full trie
+        size_t threads;             // threads being sampled
+        size_t profiles;            // profiles written
+        size_t pruned;              // older profiles removed to stay within PROFILE_FILES_MAX
+
+    } stats_t;
+
+    /**
+     * Start sampling every thread of the process, other than the aggregator
+     *
+     * @param hz samples per second, per thread
+     * @return false if profiling could not be started, or is already running
+     */
+    bool start(profile_mode_t mode, int hz = PROFILE_HZ_DEFAULT);
+
+    /**
+     * Stop sampling, and write the profile of the current window
+     */
+    void stop();
+
+    /**
+     * Write the profile of the current window now, and start a new window
+     *
+     * @return false if profiling isn't running, or the profile could not be written
+     */
+    bool flush();
+
+    bool running();
+
+    stats_t get_stats();
+
+}   // namespace profiler
+
+#endif // _AGENT_NDK_PROFILER_H
@@ -0,0 +1,1006 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <dirent.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/ucontext.h>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "arena.h"
+#include "emitter.h"
+#include "serializer.h"
+#include "symbolizer.h"
+#include "symbol-cache.h"
+#include "module-index.h"
+#include "fingerprint.h"
+#include "jni/native-context.h"
+#include "record.h"
+
+namespace record {
+
+    static const uint32_t RECORD_MAGIC = 0x5243524e;    // "NRCR"
+    static const uint16_t RECORD_VERSION = 1;
+
+    typedef enum section_tag {
+        TAG_END = 0,
+        TAG_CONTEXT,        // timestamp, ids, description, process name, build and session ids
+        TAG_SIGINFO,        // siginfo_t, as delivered
+        TAG_REGISTERS,      // mcontext_t general registers
+        TAG_FRAMES,         // frame addresses of the crashed thread
+        TAG_THREADS,        // thread table
+        TAG_MODULES,        // extent of each mapped module holding a frame
+        TAG_THREAD_FRAMES,  // frame addresses of one other thread
+        TAG_MODULE_IDS,     // build-id of each captured module, from the module index
+        TAG_FINGERPRINT,    // stack fingerprint, for coalescing repeats
+
+    } section_tag_t;
+
+    typedef struct record_header {
+        uint32_t magic;
+        uint16_t version;
+        uint8_t ptr_size;
+        uint8_t reserved;
+        char arch[16];
+
+    } record_header_t;
+
+    typedef struct section_header {
+        uint16_t tag;
+        uint16_t reserved;
+        uint32_t length;
+
+    } section_header_t;
+
+    static const uint8_t THREAD_CRASHED = 0x1;
+    static const uint8_t THREAD_HAS_FRAMES = 0x2;
+
+#if defined(__aarch64__)
+    // the general registers only: the FP/SIMD context is never reported
+    static const size_t REGISTERS_SZ = offsetof(mcontext_t, __reserved);
+#else
+    static const size_t REGISTERS_SZ = sizeof(mcontext_t);
+#endif
+
+    static const size_t MODULES_MAX = BACKTRACE_MODULES_MAX;
+    static const size_t MAPS_LINE_MAX = PATH_MAX + 128;
+
+    static const char *report_types[] = {"crash-", "ex-", "anr-"};
+
+    // largest report a record is rendered to, before the other threads' stacks are left out
+    static const size_t RENDER_SZ_MAX = 16 * BACKTRACE_SZ_MAX;
+
+    /**
+     * A mapped module, as captured from /proc/self/maps
+     */
+    typedef struct module_span {
+        uintptr_t base;         // start of the module's first mapping
+        uintptr_t end;          // end of the last mapping holding a frame
+        uintptr_t offset;       // file offset of the ELF image (non-zero when loaded from an APK)
+        const char *path;
+
+    } module_span_t;
+
+    /**
+     * Parsed line of /proc/self/maps
+     */
+    typedef struct maps_entry {
+        uintptr_t start;
+        uintptr_t end;
+        const char *perms;
+        uintptr_t offset;
+        const char *path;
+
+    } maps_entry_t;
+
+    static uintptr_t parse_hex(const char *&cursor) {
+        uintptr_t value = 0;
+        for (;; cursor++) {
+            char ch = *cursor;
+            if (ch >= '0' && ch <= '9') {
+                value = (value << 4) | (ch - '0');
+            } else if (ch >= 'a' && ch <= 'f') {
+                value = (value << 4) | (ch - 'a' + 10);
+            } else {
+                return value;
+            }
+        }
+    }
+
+    static void skip_token(const char *&cursor) {
+        while (*cursor == ' ') {
+            cursor++;
+        }
+        while (*cursor != ' ' && *cursor != '\0') {
+            cursor++;
+        }
+    }
+
+    /**
+     * Parse "start-end perms offset dev inode [path]"
+     */
+    static bool parse_maps_line(const char *line, maps_entry_t &entry) {
+        const char *cursor = line;
+        entry.start = parse_hex(cursor);
+        if (*cursor++ != '-') {
+            return false;
+        }
+        entry.end = parse_hex(cursor);
+        if (*cursor++ != ' ' || std::strlen(cursor) < 4) {
+            return false;
+        }
+        entry.perms = cursor;
+        cursor += 4;
+        while (*cursor == ' ') {
+            cursor++;
+        }
+        entry.offset = parse_hex(cursor);
+        skip_token(cursor);     // dev
+        skip_token(cursor);     // inode
+        while (*cursor == ' ') {
+            cursor++;
+        }
+        entry.path = cursor;
+        return true;
+    }
+
+    /**
+     * Frame addresses of every captured thread, sorted
+     */
+    typedef struct frame_index {
+        uintptr_t *addresses;
+        size_t address_cnt;
+
+    } frame_index_t;
+
+    static bool other_thread_state(const threadinfo_t &thread, const backtrace_t &backtrace) {
+        return thread.backtrace_state != nullptr && thread.backtrace_state != &backtrace.state;
+    }
+
+    static void add_frames(frame_index_t &index, const backtrace_state_t &state) {
+        std::memcpy(index.addresses + index.address_cnt, state.frames, state.frame_cnt * sizeof(uintptr_t));
+        index.address_cnt += state.frame_cnt;
+    }
+
+    static frame_index_t index_frames(const backtrace_t &backtrace) {
+        size_t frame_cnt = backtrace.state.frame_cnt;
+        for (size_t i = 0; i < backtrace.thread_cnt; i++) {
+            if (other_thread_state(backtrace.threads[i], backtrace)) {
+                frame_cnt += backtrace.threads[i].backtrace_state->frame_cnt;
+            }
+        }
+
+        frame_index_t index = {arena::alloc_array<uintptr_t>(frame_cnt), 0};
+        if (index.addresses == nullptr) {
+            return index;
+        }
+
+        add_frames(index, backtrace.state);
+        for (size_t i = 0; i < backtrace.thread_cnt; i++) {
+            if (other_thread_state(backtrace.threads[i], backtrace)) {
+                add_frames(index, *backtrace.threads[i].backtrace_state);
+            }
+        }
+        std::sort(index.addresses, index.addresses + index.address_cnt);
+
+        return index;
+    }
+
+    static bool holds_frame(const frame_index_t &index, uintptr_t start, uintptr_t end) {
+        const uintptr_t *first = index.addresses;
+        const uintptr_t *last = first + index.address_cnt;
+        const uintptr_t *address = std::lower_bound(first, last, start);
+        return address != last && *address < end;
+    }
+
+    /**
+     * Read the first bytes of a mapping in another process, or failing that, of the mapped file
+     */
+    static bool read_mapping(pid_t pid, const maps_entry_t &entry, char *data, size_t size) {
+        struct iovec local = {data, size};
+        struct iovec remote = {reinterpret_cast<void *>(entry.start), size};
+        if (process_vm_readv(pid, &local, 1, &remote, 1, 0) == static_cast<ssize_t>(size)) {
+            return true;
+        }
+
+        int fd = open(entry.path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        bool read = (pread(fd, data, size, entry.offset) == static_cast<ssize_t>(size));
+        close(fd);
+        return read;
+    }
+
+    /**
+     * A private, readable file mapping beginning with an ELF header starts a new module
+     */
+    static bool maps_elf_image(pid_t pid, const maps_entry_t &entry) {
+        if (entry.perms[0] != 'r' || entry.perms[3] != 'p' ||
+            entry.path[0] != '/' || std::strncmp(entry.path, "/dev/", 5) == 0) {
+            return false;
+        }
+        if (pid == 0) {
+            return std::memcmp(reinterpret_cast<const void *>(entry.start), ELFMAG, SELFMAG) == 0;
+        }
+
+        char magic[SELFMAG];
+        return read_mapping(pid, entry, magic, sizeof(magic)) &&
+               std::memcmp(magic, ELFMAG, SELFMAG) == 0;
+    }
+
+    /**
+     * Tracks the module spanned by consecutive maps entries
+     */
+    typedef struct maps_run {
+        bool active;
+        uintptr_t base;
+        uintptr_t offset;
+        char *path;
+
+    } maps_run_t;
+
+    static void scan_maps_entry(pid_t pid, const maps_entry_t &entry, const frame_index_t &index,
+                                maps_run_t &run, module_span_t *modules, size_t &module_cnt) {
+        if (entry.path[0] == '\0' && std::strncmp(entry.perms, "---p", 4) == 0) {
+            // alignment padding between the segments of a module
+            return;
+        }
+
+        if (entry.path[0] != '/') {
+            run.active = false;
+        } else if (maps_elf_image(pid, entry)) {
+            run.active = true;
+            run.base = entry.start;
+            run.offset = entry.offset;
+            std::strncpy(run.path, entry.path, PATH_MAX - 1);
+        } else if (!run.active || std::strcmp(entry.path, run.path) != 0) {
+            run.active = false;
+        }
+
+        if (!run.active || !holds_frame(index, entry.start, entry.end)) {
+            return;
+        }
+
+        if (module_cnt > 0 && modules[module_cnt - 1].base == run.base) {
+            modules[module_cnt - 1].end = entry.end;
+        } else if (module_cnt < MODULES_MAX) {
+            size_t path_len = std::strlen(run.path);
+            char *path = arena::alloc_array<char>(path_len + 1);
+            if (path != nullptr) {
+                std::memcpy(path, run.path, path_len + 1);
+                modules[module_cnt++] = {run.base, entry.end, run.offset, path};
+            }
+        }
+    }
+
+    /**
+     * Capture the modules holding any thread's frames, from the maps of the
+     * process the backtrace was taken in. Async-signal-safe.
+     */
+    static size_t capture_modules(const backtrace_t &backtrace, module_span_t *modules) {
+        size_t module_cnt = 0;
+        size_t capacity = MAPS_LINE_MAX * 2;
+        char *chunk = arena::alloc_array<char>(capacity + 1);
+        maps_run_t run = {false, 0, 0, arena::alloc_array<char>(PATH_MAX)};
+        frame_index_t index = index_frames(backtrace);
+
+        if (chunk == nullptr || run.path == nullptr || index.addresses == nullptr) {
+            return 0;
+        }
+
+        // 0 denotes this process, whose mappings can be read directly
+        pid_t pid = (backtrace.pid == getpid()) ? 0 : backtrace.pid;
+        char maps_path[32];
+        writer_t path_writer = {};
+        writer::to_buffer(path_writer, maps_path, sizeof(maps_path) - 1);
+        writer::put_cstr(path_writer, "/proc/");
+        if (pid == 0) {
+            writer::put_cstr(path_writer, "self");
+        } else {
+            writer::put_dec(path_writer, pid);
+        }
+        writer::put_cstr(path_writer, "/maps");
+        maps_path[path_writer.length] = '\0';
+
+        int fd = open(maps_path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            _LOGE_POSIX("record: could not read process maps");
+            return 0;
+        }
+
+        size_t length = 0;
+        bool eof = false;
+        while (!eof || length > 0) {
+            if (!eof) {
+                ssize_t cnt = read(fd, chunk + length, capacity - length);
+                if (cnt < 0 && errno == EINTR) {
+                    continue;
+                }
+                eof = (cnt <= 0);
+                length += (cnt > 0) ? cnt : 0;
+            }
+
+            // consume each complete line (or the remainder, at eof)
+            size_t consumed = 0;
+            while (consumed < length) {
+                char *line = chunk + consumed;
+                char *newline = static_cast<char *>(std::memchr(line, '\n', length - consumed));
+                if (newline == nullptr) {
+                    if (!eof && (consumed > 0 || length < capacity)) {
+                        break;
+                    }
+                    // an over-long line (or the final unterminated line)
+                    newline = chunk + length;
+                }
+                *newline = '\0';
+
+                maps_entry_t entry = {};
+                if (parse_maps_line(line, entry)) {
+                    scan_maps_entry(pid, entry, index, run, modules, module_cnt);
+                }
+                consumed = (newline - chunk) + 1;
+            }
+
+            consumed = consumed < length ? consumed : length;
+            std::memmove(chunk, chunk + consumed, length - consumed);
+            length -= consumed;
+        }
+
+        close(fd);
+
+        return module_cnt;
+    }
+
+    template<typename T>
+    static void put_value(writer_t &writer, T value) {
+        writer::put(writer, reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    static void put_str(writer_t &writer, const char *str) {
+        size_t len = strnlen(str, UINT16_MAX);
+        put_value<uint16_t>(writer, len);
+        writer::put(writer, str, len);
+    }
+
+    static size_t section_begin(writer_t &writer, section_tag_t tag) {
+        size_t at = writer.length;
+        put_value(writer, section_header_t{static_cast<uint16_t>(tag), 0, 0});
+        return at;
+    }
+
+    static void section_end(writer_t &writer, size_t at) {
+        if (writer::ok(writer)) {
+            uint32_t length = writer.length - at - sizeof(section_header_t);
+            std::memcpy(writer.buffer + at + offsetof(section_header_t, length), &length, sizeof(length));
+        }
+    }
+
+    static void put_frames(writer_t &writer, const backtrace_state_t &state) {
+        put_value<int32_t>(writer, state.skipped_frames);
+        put_value<uint64_t>(writer, state.crash_ip);
+        put_value<uint32_t>(writer, state.frame_cnt);
+        for (size_t i = 0; i < state.frame_cnt; i++) {
+            put_value<uint64_t>(writer, state.frames[i]);
+        }
+    }
+
+    size_t encode(const backtrace_t &backtrace, char *buffer, size_t capacity) {
+        writer_t writer = {};
+        writer::to_buffer(writer, buffer, capacity);
+
+        record_header_t header = {RECORD_MAGIC, RECORD_VERSION, sizeof(uintptr_t), 0, {}};
+        std::strncpy(header.arch, backtrace.arch, sizeof(header.arch) - 1);
+        put_value(writer, header);
+
+        size_t at = section_begin(writer, TAG_CONTEXT);
+        put_value<int64_t>(writer, backtrace.timestamp);
+        put_value<int32_t>(writer, backtrace.pid);
+        put_value<int32_t>(writer, backtrace.ppid);
+        put_value<int32_t>(writer, backtrace.uid);
+        put_str(writer, backtrace.description);
+        put_str(writer, backtrace.process_name);
+        put_str(writer, backtrace.build_id);
+        put_str(writer, backtrace.session_id);
+        section_end(writer, at);
+
+        at = section_begin(writer, TAG_FINGERPRINT);
+        put_value<uint64_t>(writer, fingerprint::compute(backtrace));
+        section_end(writer, at);
+
+        if (backtrace.state.siginfo != nullptr) {
+            at = section_begin(writer, TAG_SIGINFO);
+            put_value(writer, *backtrace.state.siginfo);
+            section_end(writer, at);
+        }
+
+        if (backtrace.state.sa_ucontext != nullptr) {
+            at = section_begin(writer, TAG_REGISTERS);
+            writer::put(writer, reinterpret_cast<const char *>(&backtrace.state.sa_ucontext->uc_mcontext),
+                        REGISTERS_SZ);
+            section_end(writer, at);
+        }
+
+        at = section_begin(writer, TAG_FRAMES);
+        put_frames(writer, backtrace.state);
+        section_end(writer, at);
+
+        at = section_begin(writer, TAG_THREADS);
+        put_value<uint32_t>(writer, backtrace.thread_cnt);
+        for (size_t i = 0; i < backtrace.thread_cnt; i++) {
+            const threadinfo_t &thread = backtrace.threads[i];
+            uint8_t flags = (thread.crashed ? THREAD_CRASHED : 0) |
+                            (thread.backtrace_state != nullptr ? THREAD_HAS_FRAMES : 0);
+            put_value<int32_t>(writer, thread.tid);
+            put_value<int32_t>(writer, thread.priority);
+            put_value<uint64_t>(writer, thread.stack);
+            put_value<uint8_t>(writer, flags);
+            put_str(writer, thread.thread_name);
+            put_str(writer, thread.thread_state);
+        }
+        section_end(writer, at);
+
+        for (size_t i = 0; i < backtrace.thread_cnt; i++) {
+            const threadinfo_t &thread = backtrace.threads[i];
+            if (other_thread_state(thread, backtrace)) {
+                at = section_begin(writer, TAG_THREAD_FRAMES);
+                put_value<int32_t>(writer, thread.tid);
+                put_frames(writer, *thread.backtrace_state);
+                section_end(writer, at);
+            }
+        }
+
+        module_span_t *modules = arena::alloc_array<module_span_t>(MODULES_MAX);
+        size_t module_cnt = (modules != nullptr) ? capture_modules(backtrace, modules) : 0;
+        at = section_begin(writer, TAG_MODULES);
+        put_value<uint32_t>(writer, module_cnt);
+        for (size_t i = 0; i < module_cnt; i++) {
+            put_value<uint64_t>(writer, modules[i].base);
+            put_value<uint64_t>(writer, modules[i].end);
+            put_value<uint64_t>(writer, modules[i].offset);
+            put_str(writer, modules[i].path);
+        }
+        section_end(writer, at);
+
+        at = section_begin(writer, TAG_MODULE_IDS);
+        put_value<uint32_t>(writer, module_cnt);
+        for (size_t i = 0; i < module_cnt; i++) {
+            const modules::module_t *indexed = modules::find(modules[i].base);
+            put_value<uint64_t>(writer, modules[i].base);
+            put_str(writer, (indexed != nullptr && indexed->start == modules[i].base) ? indexed->build_id : "");
+        }
+        section_end(writer, at);
+
+        section_begin(writer, TAG_END);
+
+        return writer::ok(writer) ? writer.length : 0;
+    }
+
+    /**
+     * Bounds-checked cursor over a record
+     */
+    typedef struct record_reader {
+        const char *data;
+        size_t size;
+        size_t pos;
+        bool error;
+
+    } record_reader_t;
+
+    static bool get(record_reader_t &reader, void *value, size_t size) {
+        if (reader.error || size > reader.size - reader.pos) {
+            reader.error = true;
+            std::memset(value, 0, size);
+            return false;
+        }
+        std::memcpy(value, reader.data + reader.pos, size);
+        reader.pos += size;
+        return true;
+    }
+
+    template<typename T>
+    static T get_value(record_reader_t &reader) {
+        T value;
+        get(reader, &value, sizeof(value));
+        return value;
+    }
+
+    static void get_str(record_reader_t &reader, char *str, size_t size) {
+        uint16_t len = get_value<uint16_t>(reader);
+        if (!reader.error && len > reader.size - reader.pos) {
+            reader.error = true;
+        }
+        if (reader.error) {
+            *str = '\0';
+            return;
+        }
+
+        size_t copied = len < size - 1 ? len : size - 1;
+        std::memcpy(str, reader.data + reader.pos, copied);
+        str[copied] = '\0';
+        reader.pos += len;
+    }
+
+    /**
+     * Module extent, as captured
+     */
+    typedef struct decoded_module {
+        uintptr_t base;
+        uintptr_t end;
+        uintptr_t offset;
+        char path[PATH_MAX];
+        char build_id[modules::BUILD_ID_MAX * 2 + 1];
+
+    } decoded_module_t;
+
+    /**
+     * A record decoded into the structures the emitter reads, and the storage behind them
+     */
+    typedef struct decoded_record {
+        backtrace_t backtrace;
+        ucontext_t ucontext;
+        siginfo_t siginfo;
+        std::vector<threadinfo_t> threads;
+        std::vector<backtrace_state_t> thread_states;           // other threads' frames, by thread index
+        std::vector<stackframe_t> stackframes;
+        std::vector<std::vector<stackframe_t>> thread_stackframes;
+        std::vector<decoded_module_t> modules;
+        std::vector<moduleinfo_t> moduleinfo;
+        uint64_t fingerprint;
+
+    } decoded_record_t;
+
+    static bool get_frames(record_reader_t &reader, backtrace_state_t &state) {
+        state.skipped_frames = get_value<int32_t>(reader);
+        state.crash_ip = get_value<uint64_t>(reader);
+        uint32_t frame_cnt = get_value<uint32_t>(reader);
+        if (frame_cnt > BACKTRACE_FRAMES_MAX) {
+            return false;
+        }
+        for (uint32_t i = 0; i < frame_cnt; i++) {
+            state.frames[i] = get_value<uint64_t>(reader);
+        }
+        state.frame_cnt = frame_cnt;
+        return !reader.error;
+    }
+
+    static bool decode_section(uint16_t tag, record_reader_t &reader, decoded_record_t &decoded) {
+        backtrace_t &backtrace = decoded.backtrace;
+
+        switch (tag) {
+            case TAG_CONTEXT:
+                backtrace.timestamp = get_value<int64_t>(reader);
+                backtrace.pid = get_value<int32_t>(reader);
+                backtrace.ppid = get_value<int32_t>(reader);
+                backtrace.uid = get_value<int32_t>(reader);
+                get_str(reader, backtrace.description, sizeof(backtrace.description));
+                get_str(reader, backtrace.process_name, sizeof(backtrace.process_name));
+                get_str(reader, backtrace.build_id, sizeof(backtrace.build_id));
+                get_str(reader, backtrace.session_id, sizeof(backtrace.session_id));
+                break;
+
+            case TAG_SIGINFO:
+                get(reader, &decoded.siginfo, sizeof(decoded.siginfo));
+                backtrace.state.siginfo = &decoded.siginfo;
+                break;
+
+            case TAG_REGISTERS:
+                get(reader, &decoded.ucontext.uc_mcontext, REGISTERS_SZ);
+                backtrace.state.sa_ucontext = &decoded.ucontext;
+                break;
+
+            case TAG_FRAMES:
+                if (!get_frames(reader, backtrace.state)) {
+                    return false;
+                }
+                break;
+
+            case TAG_THREADS: {
+                uint32_t thread_cnt = get_value<uint32_t>(reader);
+                if (thread_cnt > BACKTRACE_THREADS_MAX || !decoded.threads.empty()) {
+                    return false;
+                }
+                decoded.threads.resize(thread_cnt);
+                decoded.thread_states.resize(thread_cnt);
+                for (auto &thread: decoded.threads) {
+                    thread.tid = get_value<int32_t>(reader);
+                    thread.priority = get_value<int32_t>(reader);
+                    thread.stack = get_value<uint64_t>(reader);
+                    uint8_t flags = get_value<uint8_t>(reader);
+                    thread.crashed = (flags & THREAD_CRASHED) != 0;
+                    // other threads' frames follow in their own sections
+                    thread.backtrace_state = ((flags & THREAD_HAS_FRAMES) && thread.crashed) ?
+                                             &backtrace.state : nullptr;
+                    get_str(reader, thread.thread_name, sizeof(thread.thread_name));
+                    get_str(reader, thread.thread_state, sizeof(thread.thread_state));
+                }
+                backtrace.threads = decoded.threads.data();
+                backtrace.thread_cnt = decoded.threads.size();
+                break;
+            }
+
+            case TAG_MODULES: {
+                uint32_t module_cnt = get_value<uint32_t>(reader);
+                if (module_cnt > MODULES_MAX) {
+                    return false;
+                }
+                decoded.modules.resize(module_cnt);
+                for (auto &module: decoded.modules) {
+                    module.base = get_value<uint64_t>(reader);
+                    module.end = get_value<uint64_t>(reader);
+                    module.offset = get_value<uint64_t>(reader);
+                    get_str(reader, module.path, sizeof(module.path));
+                }
+                break;
+            }
+
+            case TAG_MODULE_IDS: {
+                uint32_t module_cnt = get_value<uint32_t>(reader);
+                if (module_cnt > MODULES_MAX) {
+                    return false;
+                }
+                for (uint32_t i = 0; i < module_cnt && !reader.error; i++) {
+                    uintptr_t base = get_value<uint64_t>(reader);
+                    char build_id[sizeof(decoded_module_t::build_id)];
+                    get_str(reader, build_id, sizeof(build_id));
+                    for (auto &module: decoded.modules) {
+                        if (module.base == base) {
+                            std::memcpy(module.build_id, build_id, sizeof(build_id));
+                        }
+                    }
+                }
+                break;
+            }
+
+            case TAG_FINGERPRINT:
+                decoded.fingerprint = get_value<uint64_t>(reader);
+                break;
+
+            case TAG_THREAD_FRAMES: {
+                int32_t tid = get_value<int32_t>(reader);
+                for (size_t i = 0; i < decoded.threads.size(); i++) {
+                    threadinfo_t &thread = decoded.threads[i];
+                    if (thread.tid == tid && !thread.crashed) {
+                        if (!get_frames(reader, decoded.thread_states[i])) {
+                            return false;
+                        }
+                        thread.backtrace_state = &decoded.thread_states[i];
+                        break;
+                    }
+                }
+                break;
+            }
+
+            default:
+                // sections added by later versions are skipped
+                break;
+        }
+
+        return !reader.error;
+    }
+
+    static bool valid_header(record_reader_t &reader, record_header_t &header) {
+        header = get_value<record_header_t>(reader);
+        return !reader.error && header.magic == RECORD_MAGIC && header.version == RECORD_VERSION &&
+               header.ptr_size == sizeof(uintptr_t) &&
+               std::strncmp(header.arch, get_arch(), sizeof(header.arch)) == 0;
+    }
+
+    uint64_t fingerprint_of(const char *data, size_t size) {
+        record_reader_t reader = {data, size, 0, false};
+        record_header_t header;
+        if (!valid_header(reader, header)) {
+            return 0;
+        }
+
+        for (;;) {
+            section_header_t section = get_value<section_header_t>(reader);
+            if (reader.error || section.length > size - reader.pos || section.tag == TAG_END) {
+                return 0;
+            }
+            if (section.tag == TAG_FINGERPRINT) {
+                record_reader_t body = {data + reader.pos, section.length, 0, false};
+                return get_value<uint64_t>(body);
+            }
+            reader.pos += section.length;
+        }
+    }
+
+    static bool decode(const char *data, size_t size, decoded_record_t &decoded) {
+        record_reader_t reader = {data, size, 0, false};
+
+        record_header_t header;
+        if (!valid_header(reader, header)) {
+            _LOGE("record: unsupported crash record");
+            return false;
+        }
+        std::strncpy(decoded.backtrace.arch, header.arch, sizeof(decoded.backtrace.arch) - 1);
+
+        for (;;) {
+            section_header_t section = get_value<section_header_t>(reader);
+            if (reader.error || section.length > size - reader.pos) {
+                return false;
+            }
+            if (section.tag == TAG_END) {
+                return true;
+            }
+
+            record_reader_t body = {data + reader.pos, section.length, 0, false};
+            if (!decode_section(section.tag, body, decoded)) {
+                return false;
+            }
+            reader.pos += section.length;
+        }
+    }
+
+    /**
+     * Module images loaded on demand, shared by every thread's frames
+     */
+    typedef struct image_cache {
+        std::vector<symbolizer::elf_image_t> images;
+        std::vector<bool> loaded;
+        std::vector<std::string> paths;     // as each module is reported, once known
+
+    } image_cache_t;
+
+    /**
+     * Name a frame from the symbol cache, without loading its module's image
+     */
+    static bool lookup_cached(const decoded_module_t &module, size_t m, image_cache_t &cache,
+                              stackframe_t &stackframe) {
+        uintptr_t pc = stackframe.address - module.base;
+        if (!symcache::lookup(module.build_id, pc, stackframe)) {
+            return false;
+        }
+
+        if (cache.paths[m].empty()) {
+            char path[PATH_MAX];
+            cache.paths[m] = symcache::lookup_path(module.build_id, path, sizeof(path)) ? path : module.path;
+        }
+        std::strncpy(stackframe.so_path, cache.paths[m].c_str(), sizeof(stackframe.so_path) - 1);
+        stackframe.so_base = module.base;
+        stackframe.pc = pc;
+        return true;
+    }
+
+    /**
+     * Resolve a thread's frames against the module images on disk
+     */
+    static void symbolize_state(const decoded_record_t &decoded, image_cache_t &cache,
+                                backtrace_state_t &state, std::vector<stackframe_t> &stackframes) {
+        std::vector<symbolizer::elf_image_t> &images = cache.images;
+
+        stackframes.resize(state.frame_cnt);
+        for (size_t i = 0; i < state.frame_cnt; i++) {
+            stackframe_t &stackframe = stackframes[i];
+            stackframe.index = i;
+            stackframe.address = state.frames[i];
+
+            for (size_t m = 0; m < decoded.modules.size(); m++) {
+                const decoded_module_t &module = decoded.modules[m];
+                if (stackframe.address >= module.base && stackframe.address < module.end) {
+                    if (lookup_cached(module, m, cache, stackframe)) {
+                        break;
+                    }
+                    if (!cache.loaded[m]) {
+                        if (symbolizer::load(module.path, module.offset, module.build_id, images[m])) {
+                            cache.paths[m] = images[m].path;
+                        }
+                        cache.loaded[m] = true;
+                    }
+                    symbolizer::resolve(images[m], module.base, i, stackframe.address, stackframe);
+
+                    // only an image indexed against the module's build-id is known to be the one that ran
+                    if (images[m].functions != nullptr) {
+                        symcache::insert_path(module.build_id, images[m].path.c_str());
+                        symcache::insert(module.build_id, stackframe.pc, stackframe);
+                    }
+                    break;
+                }
+            }
+        }
+        state.stackframes = stackframes.data();
+    }
+
+    /**
+     * Resolve every thread's frames
+     */
+    static void symbolize(decoded_record_t &decoded) {
+        image_cache_t cache = {std::vector<symbolizer::elf_image_t>(decoded.modules.size()),
+                               std::vector<bool>(decoded.modules.size(), false),
+                               std::vector<std::string>(decoded.modules.size())};
+
+        symbolize_state(decoded, cache, decoded.backtrace.state, decoded.stackframes);
+
+        decoded.thread_stackframes.resize(decoded.threads.size());
+        for (size_t i = 0; i < decoded.threads.size(); i++) {
+            if (decoded.threads[i].backtrace_state == &decoded.thread_states[i]) {
+                symbolize_state(decoded, cache, decoded.thread_states[i], decoded.thread_stackframes[i]);
+            }
+        }
+
+        // every captured module holds a frame; name them as their frames are named
+        decoded.moduleinfo.resize(decoded.modules.size());
+        for (size_t m = 0; m < decoded.modules.size(); m++) {
+            decoded_module_t &module = decoded.modules[m];
+            if (!cache.paths[m].empty()) {
+                std::strncpy(module.path, cache.paths[m].c_str(), sizeof(module.path) - 1);
+            }
+            decoded.moduleinfo[m] = {module.base, module.end, module.path, module.build_id};
+        }
+        decoded.backtrace.modules = decoded.moduleinfo.data();
+        decoded.backtrace.module_cnt = decoded.moduleinfo.size();
+    }
+
+    /**
+     * Decode and symbolize a record
+     *
+     * @return the decoded record, or null if it isn't valid
+     */
+    static std::unique_ptr<decoded_record_t> decode_record(const char *data, size_t size) {
+        std::unique_ptr<decoded_record_t> decoded(new decoded_record_t());
+        if (!decode(data, size, *decoded)) {
+            return nullptr;
+        }
+        symbolize(*decoded);
+
+        return decoded;
+    }
+
+    /**
+     * Emit a decoded record into the report buffer, growing it as the report overflows it.
+     * A report larger than RENDER_SZ_MAX is emitted without the other threads' stacks.
+     *
+     * @return the length of the report, or 0 if it could not be emitted
+     */
+    static size_t emit_report(decoded_record_t &decoded, std::vector<char> &report) {
+        for (;;) {
+            writer_t writer = {};
+            writer::to_buffer(writer, report.data(), report.size());
+            if (emit_backtrace(decoded.backtrace, writer)) {
+                return writer.length;
+            }
+            if (!writer.overflow) {
+                return 0;
+            }
+
+            if (report.size() < RENDER_SZ_MAX) {
+                report.resize(std::min(report.size() * 2, RENDER_SZ_MAX));
+                continue;
+            }
+
+            bool truncated = false;
+            for (threadinfo_t &thread: decoded.threads) {
+                if (thread.backtrace_state != nullptr && thread.backtrace_state != &decoded.backtrace.state) {
+                    thread.backtrace_state = nullptr;
+                    truncated = true;
+                }
+            }
+            if (!truncated) {
+                return 0;
+            }
+            _LOGW("record: report exceeds %zu bytes, leaving out the other threads' stacks", RENDER_SZ_MAX);
+        }
+    }
+
+    static bool read_file(const std::string &path, std::vector<char> &data) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+
+        struct stat st = {};
+        bool ok = (fstat(fd, &st) == 0 && st.st_size > 0 &&
+                   static_cast<size_t>(st.st_size) <= BACKTRACE_SZ_MAX);
+        if (ok) {
+            data.resize(st.st_size);
+            size_t offset = 0;
+            while (ok && offset < data.size()) {
+                ssize_t cnt = read(fd, data.data() + offset, data.size() - offset);
+                if (cnt < 0 && errno == EINTR) {
+                    continue;
+                }
+                ok = (cnt > 0);
+                offset += ok ? cnt : 0;
+            }
+        }
+        close(fd);
+
+        return ok;
+    }
+
+    int render_pending() {
+        jni::native_context_t &native_context = jni::get_native_context();
+        size_t prefix_len = std::strlen(RECORD_PREFIX);
+        int rendered = 0;
+
+        DIR *dir = opendir(native_context.reportPathAbsolute);
+        if (dir == nullptr) {
+            return 0;
+        }
+
+        // reports a killed process was storing were never published
+        serializer::sweep_temporary_files();
+
+        // records of fingerprints counted as pending, and not rendered, are settled after
+        long started = time(nullptr);
+        std::vector<uint64_t> kept;
+        bool unread = false;
+
+        std::vector<char> report(BACKTRACE_SZ_MAX);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (std::strncmp(entry->d_name, RECORD_PREFIX, prefix_len) != 0) {
+                continue;
+            }
+
+            const char *report_type = nullptr;
+            for (auto type: report_types) {
+                if (std::strncmp(entry->d_name + prefix_len, type, std::strlen(type)) == 0) {
+                    report_type = type;
+                }
+            }
+
+            std::string path = std::string(native_context.reportPathAbsolute) + "/" + entry->d_name;
+            std::vector<char> data;
+            if (!read_file(path, data)) {
+                unread = true;
+                continue;
+            }
+
+            std::unique_ptr<decoded_record_t> decoded =
+                    report_type != nullptr ? decode_record(data.data(), data.size()) : nullptr;
+            if (decoded == nullptr) {
+                _LOGE("record: discarding invalid crash record [%s]", entry->d_name);
+                unlink(path.c_str());
+                continue;
+            }
+
+            // repeats counted while the report waited are reported with it, and only taken
+            // once it's stored
+            uint32_t repeats = 0;
+            if (decoded->fingerprint != 0) {
+                repeats = fingerprint::peek(decoded->fingerprint, decoded->backtrace.last_occurrence);
+                decoded->backtrace.occurrences = 1 + repeats;
+            }
+
+            size_t length = emit_report(*decoded, report);
+            if (length == 0) {
+                // a valid record is never discarded: leave it for the next launch
+                _LOGE("record: could not render crash record [%s]", entry->d_name);
+                kept.push_back(decoded->fingerprint);
+                continue;
+            }
+            if (!serializer::to_report_store(report_type, report.data(), length)) {
+                // leave the record in place, and try again on the next launch
+                kept.push_back(decoded->fingerprint);
+                continue;
+            }
+            fingerprint::consume(decoded->fingerprint, repeats);
+            rendered++;
+
+            unlink(path.c_str());
+        }
+
+        closedir(dir);
+        if (!unread) {
+            fingerprint::settle(started, kept.data(), kept.size());
+        }
+
+        return rendered;
+    }
+
+}   // namespace record
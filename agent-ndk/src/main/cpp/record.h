@@ -0,0 +1,56 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_RECORD_H
+#define _AGENT_NDK_RECORD_H
+
+#include <stddef.h>
+#include <agent-ndk.h>
+#include "backtrace.h"
+
+/**
+ * Binary crash records
+ *
+ * A crash record is the raw state captured by a handler: frame addresses, the register
+ * context, siginfo, the thread table, process context fields, and the extent of each
+ * mapped module a frame falls in. Capturing it involves no symbolization, demangling or
+ * text formatting. A record is rendered to the JSON report schema on the next launch,
+ * where the frames are symbolized from the module images on disk.
+ *
+ * Records are versioned. The body is a sequence of tagged sections; readers skip
+ * sections they do not recognize.
+ */
+namespace record {
+
+    // Report files holding a record are named with this prefix ahead of the report type
+    static const char *RECORD_PREFIX = "rec-";
+
+    /**
+     * Encode a backtrace as a record. Async-signal-safe.
+     * Working storage is taken from the crash arena: the caller must hold an arena lease.
+     *
+     * @return size of the record, or 0 if it did not fit
+     */
+    size_t encode(const backtrace_t &, char *buffer, size_t capacity);
+
+    /**
+     * Read the stack fingerprint an encoded record was stamped with. Async-signal-safe.
+     *
+     * @return the fingerprint, or 0 if the record has none
+     */
+    uint64_t fingerprint_of(const char *record, size_t size);
+
+    /**
+     * Render every record in the report directory to the report store, removing the record.
+     * Invalid records are discarded; a valid record that can't be rendered or stored is kept.
+     * The temporary files of reports that were never completely stored are removed first.
+     *
+     * @return number of reports rendered
+     */
+    int render_pending();
+
+}   // namespace record
+
+#endif // _AGENT_NDK_RECORD_H
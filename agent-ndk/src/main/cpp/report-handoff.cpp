@@ -0,0 +1,235 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "lz-codec.h"
+#include "report-handoff.h"
+
+namespace handoff {
+
+    // reports each worker may decompress ahead of delivery
+    static const size_t WORKER_LOOKAHEAD = 2;
+
+    typedef enum job_state {
+        JOB_PENDING = 0,
+        JOB_DECODING,
+        JOB_READY,
+        JOB_DEFERRED,               // no memory to decompress it into: kept for the next flush
+        JOB_FAILED                  // the frame is corrupt, and will never decompress
+
+    } job_state_t;
+
+    typedef struct job {
+        const store::report_t *report;
+        const char *data;           // the decompressed report, or the stored payload if it isn't compressed
+        size_t size;
+        char *buffer;               // owned, freed once the report is delivered
+        job_state_t state;
+
+    } job_t;
+
+    typedef struct pool {
+        pthread_mutex_t mutex;
+        pthread_cond_t decoded;     // a job is ready or failed
+        pthread_cond_t delivered;   // a job was delivered, or the flush stopped
+        std::vector<job_t> jobs;
+        size_t next;                // the next job to decode
+        size_t delivering;          // the job being delivered
+        size_t lookahead;
+        bool stopped;
+
+    } pool_t;
+
+    typedef struct flush_batch {
+        consumer_t consumer;
+        void *arg;
+        int64_t budget_ms;
+        int workers;
+
+    } flush_batch_t;
+
+    static struct timespec deadline_of(int64_t budget_ms) {
+        struct timespec deadline = {};
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += budget_ms / 1000;
+        deadline.tv_nsec += (budget_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        return deadline;
+    }
+
+    static bool expired(const struct timespec &deadline) {
+        struct timespec now = {};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec > deadline.tv_sec) ||
+               (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec);
+    }
+
+    static job_state_t decode(job_t &job) {
+        const store::report_t &report = *job.report;
+        size_t size = lz::frame_size(report.data, report.size);
+        if (size == 0) {
+            job.data = report.data;
+            job.size = report.size;
+            return JOB_READY;
+        }
+
+        job.buffer = static_cast<char *>(malloc(size));
+        if (job.buffer == nullptr) {
+            return JOB_DEFERRED;
+        }
+        if (!lz::decompress(report.data, report.size, job.buffer, size)) {
+            free(job.buffer);
+            job.buffer = nullptr;
+            return JOB_FAILED;
+        }
+        job.data = job.buffer;
+        job.size = size;
+
+        return JOB_READY;
+    }
+
+    /**
+     * Decode a claimed job, with the pool locked
+     */
+    static void run_job(pool_t &pool, job_t &job) {
+        job.state = JOB_DECODING;
+        pthread_mutex_unlock(&pool.mutex);
+        job_state_t decoded = decode(job);
+        pthread_mutex_lock(&pool.mutex);
+        job.state = decoded;
+        pthread_cond_broadcast(&pool.decoded);
+    }
+
+    static void *decode_jobs(void *arg) {
+        pool_t &pool = *static_cast<pool_t *>(arg);
+
+        pthread_mutex_lock(&pool.mutex);
+        while (true) {
+            while (!pool.stopped && pool.next < pool.jobs.size() &&
+                   pool.next >= pool.delivering + pool.lookahead) {
+                pthread_cond_wait(&pool.delivered, &pool.mutex);
+            }
+            if (pool.stopped || pool.next >= pool.jobs.size()) {
+                break;
+            }
+            run_job(pool, pool.jobs[pool.next++]);
+        }
+        pthread_mutex_unlock(&pool.mutex);
+
+        return nullptr;
+    }
+
+    static int worker_cnt(int workers, size_t jobs) {
+        if (workers <= 0) {
+            long cores = sysconf(_SC_NPROCESSORS_ONLN);
+            workers = static_cast<int>(std::min<long>(WORKERS_MAX, std::max<long>(1, cores - 1)));
+        }
+
+        // the flushing thread decodes too: a lone report isn't worth a thread
+        return static_cast<int>(std::min<size_t>(workers, jobs > 1 ? jobs - 1 : 0));
+    }
+
+    static void deliver(const store::report_t *reports, size_t count, bool *acknowledged, void *arg) {
+        flush_batch_t &batch = *static_cast<flush_batch_t *>(arg);
+        struct timespec deadline = deadline_of(batch.budget_ms);
+        int workers = worker_cnt(batch.workers, count);
+
+        pool_t pool = {};
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_mutex_init(&pool.mutex, nullptr);
+        pthread_cond_init(&pool.decoded, &attr);
+        pthread_cond_init(&pool.delivered, &attr);
+        pthread_condattr_destroy(&attr);
+        pool.jobs.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            pool.jobs[i] = {&reports[i], nullptr, 0, nullptr, JOB_PENDING};
+        }
+        pool.lookahead = 1 + WORKER_LOOKAHEAD * workers;
+
+        std::vector<pthread_t> threads;
+        for (int i = 0; i < workers; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, nullptr, decode_jobs, &pool) != 0) {
+                _LOGW("handoff: could not start a worker thread (%d)", errno);
+                break;
+            }
+            threads.push_back(thread);
+        }
+
+        pthread_mutex_lock(&pool.mutex);
+        for (size_t i = 0; i < count; i++) {
+            job_t &job = pool.jobs[i];
+            pool.delivering = i;
+            pthread_cond_broadcast(&pool.delivered);
+
+            // decode the report here rather than wait for a worker to start it
+            if (pool.next == i) {
+                run_job(pool, pool.jobs[pool.next++]);
+            }
+            while (job.state < JOB_READY && !(batch.budget_ms > 0 && expired(deadline))) {
+                if (batch.budget_ms > 0) {
+                    pthread_cond_timedwait(&pool.decoded, &pool.mutex, &deadline);
+                } else {
+                    pthread_cond_wait(&pool.decoded, &pool.mutex);
+                }
+            }
+            if (job.state < JOB_READY) {
+                _LOGW("handoff: flush budget spent, %zu report(s) left for the next launch", count - i);
+                break;
+            }
+
+            pthread_mutex_unlock(&pool.mutex);
+            if (job.state == JOB_READY) {
+                acknowledged[i] = batch.consumer(*job.report, job.data, job.size, batch.arg);
+            } else if (job.state == JOB_DEFERRED) {
+                _LOGW("handoff: no memory to decompress a stored report, left for the next launch");
+            } else {
+                // the checksum matched, so it will never decode: drop it
+                _LOGE("handoff: could not decompress a stored report");
+                acknowledged[i] = true;
+            }
+            free(job.buffer);
+            job.buffer = nullptr;
+            pthread_mutex_lock(&pool.mutex);
+
+            if (batch.budget_ms > 0 && expired(deadline) && i + 1 < count) {
+                _LOGW("handoff: flush budget spent, %zu report(s) left for the next launch", count - i - 1);
+                break;
+            }
+        }
+        pool.stopped = true;
+        pthread_cond_broadcast(&pool.delivered);
+        pthread_mutex_unlock(&pool.mutex);
+
+        for (auto thread: threads) {
+            pthread_join(thread, nullptr);
+        }
+        for (auto &job: pool.jobs) {
+            free(job.buffer);
+        }
+        pthread_cond_destroy(&pool.delivered);
+        pthread_cond_destroy(&pool.decoded);
+        pthread_mutex_destroy(&pool.mutex);
+    }
+
+    int flush(consumer_t consumer, void *arg, int64_t budget_ms, int workers) {
+        flush_batch_t batch = {consumer, arg, budget_ms, workers};
+        return store::for_each_batch(deliver, &batch);
+    }
+
+}   // namespace handoff
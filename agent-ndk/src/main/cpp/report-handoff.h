@@ -0,0 +1,49 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_REPORT_HANDOFF_H
+#define _AGENT_NDK_REPORT_HANDOFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "report-store.h"
+
+/**
+ * Report handoff
+ *
+ * Delivers the reports in the store at launch. Stored reports are mapped from their segments
+ * and decompressed by a small pool of worker threads, while the calling thread hands each one
+ * on, in the order they were stored, straight from native memory. Workers run only a few
+ * reports ahead of delivery, so at most that many decompressed reports are held at once.
+ *
+ * Delivery stops once a time budget has passed: the reports not yet delivered are left in the
+ * store for the next launch.
+ */
+namespace handoff {
+
+    // most worker threads started, whatever the number of cores
+    static const int WORKERS_MAX = 4;
+
+    /**
+     * Called on the flushing thread with each report, decompressed. The data is valid until it
+     * returns, and may be mapped read-only.
+     *
+     * @return true to acknowledge the report
+     */
+    typedef bool (*consumer_t)(const store::report_t &report, const char *data, size_t size, void *arg);
+
+    /**
+     * Deliver the stored reports to a consumer, oldest first
+     *
+     * @param budget_ms time after which no more reports are delivered, or 0 for no limit
+     * @param workers worker threads to decompress with, or 0 to size the pool by the cores
+     * @return number of reports acknowledged
+     */
+    int flush(consumer_t consumer, void *arg, int64_t budget_ms, int workers = 0);
+
+}   // namespace handoff
+
+#endif // _AGENT_NDK_REPORT_HANDOFF_H
@@ -0,0 +1,302 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "jni/native-context.h"
+#include "serializer.h"
+#include "writer.h"
+#include "report-slots.h"
+
+namespace slots {
+
+    static const uint32_t SLOT_MAGIC = 0x4c53524e;      // "NRSL"
+
+    static const uint32_t SLOT_EMPTY = 0;
+    static const uint32_t SLOT_WRITING = 1;
+    static const uint32_t SLOT_COMMITTED = 2;
+
+    // Header is padded so the payload starts on its own cache line
+    static const size_t SLOT_PAYLOAD_OFFSET = 64;
+    static const size_t SLOT_PAYLOAD_SZ = BACKTRACE_SZ_MAX;
+    static const size_t SLOT_FILE_SZ = SLOT_PAYLOAD_OFFSET + SLOT_PAYLOAD_SZ;
+
+    static const char *SLOT_DIR = ".slots";
+
+    typedef struct slot_header {
+        uint32_t magic;
+        uint32_t state;
+        uint64_t length;
+
+    } slot_header_t;
+
+    typedef struct slot {
+        const char *name;           // slot file name
+        const char *prefix;         // report file prefix when drained
+        int fd;
+        char *map;                  // MAP_SHARED view of the slot file, if fully allocated
+        std::atomic<bool> busy;     // claimed by a writer, or holding an undrained report
+
+    } slot_t;
+
+    static slot_t slot_table[SLOT_TYPE_CNT] = {
+            {"crash.slot", "rec-crash-", -1, nullptr, {false}},
+            {"ex.slot",    "rec-ex-",    -1, nullptr, {false}},
+            {"anr.slot",   "rec-anr-",   -1, nullptr, {false}},
+    };
+
+    static pthread_mutex_t slot_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    static bool slot_path(char *path, size_t size, const char *name) {
+        writer_t writer = {};
+        writer::to_buffer(writer, path, size - 1);
+        writer::put_cstr(writer, jni::get_native_context().reportPathAbsolute);
+        writer::put_char(writer, '/');
+        writer::put_cstr(writer, SLOT_DIR);
+        if (name != nullptr) {
+            writer::put_char(writer, '/');
+            writer::put_cstr(writer, name);
+        }
+        path[writer.length] = '\0';
+        return writer::ok(writer);
+    }
+
+    static bool pwrite_fully(int fd, const void *data, size_t size, off_t offset) {
+        const char *bytes = static_cast<const char *>(data);
+        while (size > 0) {
+            ssize_t cnt = pwrite(fd, bytes, size, offset);
+            if (cnt < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            bytes += cnt;
+            size -= cnt;
+            offset += cnt;
+        }
+        return true;
+    }
+
+    static bool pread_fully(int fd, void *data, size_t size, off_t offset) {
+        char *bytes = static_cast<char *>(data);
+        while (size > 0) {
+            ssize_t cnt = pread(fd, bytes, size, offset);
+            if (cnt < 0 && errno == EINTR) {
+                continue;
+            }
+            if (cnt <= 0) {
+                return false;
+            }
+            bytes += cnt;
+            size -= cnt;
+            offset += cnt;
+        }
+        return true;
+    }
+
+    static bool write_header(int fd, uint32_t state, uint64_t length) {
+        slot_header_t header = {SLOT_MAGIC, state, length};
+        return pwrite_fully(fd, &header, sizeof(header), 0);
+    }
+
+    static bool open_slot(slot_t &slot) {
+        char path[PATH_MAX];
+        if (!slot_path(path, sizeof(path), slot.name)) {
+            return false;
+        }
+
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            _LOGE_POSIX("slots: could not open report slot");
+            return false;
+        }
+
+        // Reserve the blocks now, so a full disk can't fail (or SIGBUS) the crash path
+        bool allocated = (fallocate(fd, 0, 0, SLOT_FILE_SZ) == 0);
+        if (!allocated) {
+            _LOGW("slots: could not allocate report slot [%s]: %s", slot.name, strerror(errno));
+            if (ftruncate(fd, SLOT_FILE_SZ) != 0) {
+                _LOGE_POSIX("slots: could not size report slot");
+                close(fd);
+                return false;
+            }
+        }
+
+        slot_header_t header = {};
+        if (!pread_fully(fd, &header, sizeof(header), 0) || header.magic != SLOT_MAGIC) {
+            header.state = SLOT_EMPTY;
+        }
+
+        switch (header.state) {
+            case SLOT_COMMITTED:
+                // an undrained report from a prior launch: keep it until drain()
+                slot.busy = true;
+                break;
+
+            case SLOT_WRITING:
+                _LOGW("slots: discarding incomplete report in [%s]", slot.name);
+                // fall through
+
+            default:
+                if (!write_header(fd, SLOT_EMPTY, 0)) {
+                    _LOGE_POSIX("slots: could not reset report slot");
+                    close(fd);
+                    return false;
+                }
+                slot.busy = false;
+                break;
+        }
+
+        if (allocated) {
+            void *map = mmap(nullptr, SLOT_FILE_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            slot.map = (map == MAP_FAILED) ? nullptr : static_cast<char *>(map);
+        }
+
+        slot.fd = fd;
+
+        return true;
+    }
+
+    static void close_slot(slot_t &slot) {
+        if (slot.map != nullptr) {
+            munmap(slot.map, SLOT_FILE_SZ);
+            slot.map = nullptr;
+        }
+        if (slot.fd != -1) {
+            close(slot.fd);
+            slot.fd = -1;
+        }
+    }
+
+    bool initialize() {
+        char path[PATH_MAX];
+        bool available = false;
+
+        pthread_mutex_lock(&slot_mutex);
+
+        if (slot_path(path, sizeof(path), nullptr) &&
+            (mkdir(path, 0700) == 0 || errno == EEXIST)) {
+            for (auto &slot: slot_table) {
+                if (slot.fd == -1) {
+                    open_slot(slot);
+                }
+                available |= (slot.fd != -1);
+            }
+        } else {
+            _LOGE_POSIX("slots: could not create slot directory");
+        }
+
+        pthread_mutex_unlock(&slot_mutex);
+
+        return available;
+    }
+
+    void shutdown() {
+        pthread_mutex_lock(&slot_mutex);
+        for (auto &slot: slot_table) {
+            close_slot(slot);
+        }
+        pthread_mutex_unlock(&slot_mutex);
+    }
+
+    bool commit(slot_type_t type, const char *payload, size_t payload_size) {
+        if (type < 0 || type >= SLOT_TYPE_CNT || payload_size > SLOT_PAYLOAD_SZ) {
+            return false;
+        }
+
+        slot_t &slot = slot_table[type];
+        bool expected = false;
+        if (slot.fd == -1 || !slot.busy.compare_exchange_strong(expected, true)) {
+            return false;
+        }
+
+        if (slot.map != nullptr) {
+            slot_header_t *header = reinterpret_cast<slot_header_t *>(slot.map);
+            __atomic_store_n(&header->state, SLOT_WRITING, __ATOMIC_RELEASE);
+            memcpy(slot.map + SLOT_PAYLOAD_OFFSET, payload, payload_size);
+            header->length = payload_size;
+            __atomic_store_n(&header->state, SLOT_COMMITTED, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        if (write_header(slot.fd, SLOT_WRITING, 0) &&
+            pwrite_fully(slot.fd, payload, payload_size, SLOT_PAYLOAD_OFFSET) &&
+            write_header(slot.fd, SLOT_COMMITTED, payload_size)) {
+            return true;
+        }
+
+        // leave the slot claimed: its contents are unknown until the next launch resets it
+        _LOGE_POSIX("slots: could not write report slot");
+        return false;
+    }
+
+    /**
+     * Recover a committed report from a slot file.
+     * @return true if a report was recovered
+     */
+    static bool drain_slot(slot_t &slot, int fd) {
+        slot_header_t header = {};
+        if (!pread_fully(fd, &header, sizeof(header), 0) ||
+            header.magic != SLOT_MAGIC || header.state != SLOT_COMMITTED) {
+            return false;
+        }
+
+        bool recovered = false;
+        if (header.length <= SLOT_PAYLOAD_SZ) {
+            std::vector<char> payload(header.length);
+            recovered = pread_fully(fd, payload.data(), payload.size(), SLOT_PAYLOAD_OFFSET) &&
+                        serializer::to_storage(slot.prefix, payload.data(), payload.size());
+            if (!recovered) {
+                // try again on the next launch
+                return false;
+            }
+        } else {
+            _LOGE("slots: discarding corrupt report slot [%s]", slot.name);
+        }
+
+        if (write_header(fd, SLOT_EMPTY, 0)) {
+            slot.busy = false;
+        }
+
+        return recovered;
+    }
+
+    int drain() {
+        int drained = 0;
+
+        pthread_mutex_lock(&slot_mutex);
+
+        for (auto &slot: slot_table) {
+            if (slot.fd != -1) {
+                drained += drain_slot(slot, slot.fd) ? 1 : 0;
+                continue;
+            }
+
+            char path[PATH_MAX];
+            if (slot_path(path, sizeof(path), slot.name)) {
+                int fd = open(path, O_RDWR | O_CLOEXEC);
+                if (fd != -1) {
+                    drained += drain_slot(slot, fd) ? 1 : 0;
+                    close(fd);
+                }
+            }
+        }
+
+        pthread_mutex_unlock(&slot_mutex);
+
+        return drained;
+    }
+
+}   // namespace slots
@@ -0,0 +1,64 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_REPORT_SLOTS_H
+#define _AGENT_NDK_REPORT_SLOTS_H
+
+#include <stddef.h>
+
+/**
+ * Pre-allocated report slots
+ *
+ * One file per report type is opened and fallocate'd when the agent starts, so that
+ * persisting a report from a signal handler never creates a file, never updates the
+ * directory and cannot fail for lack of space. The handler copies the report into its
+ * slot and then commits a small header recording the payload length. Committed slots
+ * are converted to regular report files, and reset, by drain() on the next launch.
+ *
+ * When the slot file could be fully allocated it is also mapped MAP_SHARED and written
+ * with memcpy; otherwise it is written with pwrite(2).
+ */
+namespace slots {
+
+    typedef enum slot_type {
+        SLOT_CRASH = 0,
+        SLOT_EXCEPTION,
+        SLOT_ANR,
+        SLOT_TYPE_CNT
+
+    } slot_type_t;
+
+    /**
+     * Open (creating if needed) and size the slot files under the report directory.
+     * Committed slots left by a previous process are preserved until drained.
+     *
+     * @return true if at least one slot is available
+     */
+    bool initialize();
+
+    /**
+     * Unmap and close the slot files
+     */
+    void shutdown();
+
+    /**
+     * Copy a report into its slot and commit it. Async-signal-safe.
+     *
+     * @return false if the slot is unavailable (not opened, occupied, or payload too large),
+     * in which case the caller should fall back to a regular report file
+     */
+    bool commit(slot_type_t type, const char *payload, size_t payload_size);
+
+    /**
+     * Move committed slot contents into regular report files and reset the slots.
+     * Slots are opened on demand if initialize() has not been called.
+     *
+     * @return number of reports recovered
+     */
+    int drain();
+
+}   // namespace slots
+
+#endif // _AGENT_NDK_REPORT_SLOTS_H
@@ -0,0 +1,1024 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "jni/native-context.h"
+#include "writer.h"
+#include "report-store.h"
+
+namespace store {
+
+    static const uint32_t SEGMENT_MAGIC = 0x4753524e;   // "NRSG"
+    static const uint32_t REPORT_MAGIC = 0x5052524e;    // "NRRP"
+    static const uint32_t COMMIT_MAGIC = 0x4d43524e;    // "NRCM"
+    static const uint32_t INDEX_MAGIC = 0x5849524e;     // "NRIX"
+    static const uint32_t STORE_VERSION = 1;
+
+    static const uint8_t STATE_LIVE = 1;
+    static const uint8_t STATE_ACKNOWLEDGED = 2;
+    static const uint8_t STATE_EVICTED = 3;
+
+    // a segment is compacted once less than 1/COMPACT_RATIO of it is live
+    static const size_t COMPACT_RATIO = 2;
+
+    // no index is believed to hold more
+    static const uint32_t INDEX_SEGMENTS_MAX = 4096;
+    static const uint32_t INDEX_REPORTS_MAX = 64 * 1024;
+
+    static const char *STORE_DIR = ".store";
+    static const char *INDEX_NAME = "index";
+    static const char *INDEX_TEMP_NAME = ".index.tmp";
+    static const char *LOCK_NAME = "lock";
+    static const char *SEGMENT_PREFIX = "seg-";
+
+    static const char *report_prefixes[REPORT_TYPE_CNT] = {"crash-", "ex-", "anr-"};
+
+    static const quota_t default_quotas[REPORT_TYPE_CNT] = {
+            {1024 * 1024, 32},      // crashes
+            {1024 * 1024, 32},      // exceptions
+            {512 * 1024,  16},      // ANRs
+    };
+
+    typedef struct segment_header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t sequence;
+        uint32_t reserved;
+
+    } segment_header_t;
+
+    typedef struct report_header {
+        uint32_t magic;
+        uint8_t type;
+        uint8_t state;              // flipped in place once the report is acknowledged or evicted
+        uint16_t reserved;
+        uint32_t size;
+        uint32_t checksum;          // FNV-1a of the payload
+        int64_t timestamp;
+        uint64_t serial;            // the order reports were stored in, kept when a report is moved
+
+    } report_header_t;
+
+    // follows the payload, padded to 8 bytes: a report without one was torn
+    typedef struct commit_marker {
+        uint32_t magic;
+        uint32_t size;
+
+    } commit_marker_t;
+
+    typedef struct index_header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t generation;        // bumped by each rewrite, so other processes know to reload
+        uint32_t next_sequence;
+        uint32_t segment_cnt;
+        uint32_t report_cnt;
+        uint32_t checksum;          // FNV-1a of the segments and reports that follow
+
+    } index_header_t;
+
+    typedef struct index_segment {
+        uint32_t sequence;
+        uint32_t report_cnt;
+        uint64_t size;              // committed bytes
+
+    } index_segment_t;
+
+    typedef struct index_report {
+        uint32_t offset;            // of the report header in its segment
+        uint32_t size;
+        int64_t timestamp;
+        uint64_t serial;
+        uint8_t type;
+        uint8_t state;
+        uint8_t reserved[6];
+
+    } index_report_t;
+
+    static_assert(sizeof(report_header_t) == 32, "report headers are 32 bytes");
+    static_assert(sizeof(index_header_t) == 32, "index headers are 32 bytes");
+    static_assert(sizeof(index_report_t) == 32, "index reports are 32 bytes");
+
+    typedef struct segment {
+        uint32_t sequence;
+        uint64_t size;
+        std::vector<index_report_t> reports;
+
+    } segment_t;
+
+    static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static bool opened = false;
+    static char opened_path[PATH_MAX] = {};         // the store directory, as opened
+    static int lock_fd = -1;
+    static uint64_t generation = 0;
+    static uint32_t next_sequence = 1;
+    static uint64_t next_serial = 1;
+    static std::vector<segment_t> segments;         // oldest first: the last is active
+    static quota_t quotas[REPORT_TYPE_CNT] = {};
+
+    static bool store_path(char *path, size_t size, const char *name) {
+        writer_t writer = {};
+        writer::to_buffer(writer, path, size - 1);
+        writer::put_cstr(writer, jni::get_native_context().reportPathAbsolute);
+        writer::put_char(writer, '/');
+        writer::put_cstr(writer, STORE_DIR);
+        if (name != nullptr) {
+            writer::put_char(writer, '/');
+            writer::put_cstr(writer, name);
+        }
+        path[writer.length] = '\0';
+        return writer::ok(writer);
+    }
+
+    /**
+     * <reportPath>/.store/seg-<sequence, as 8 hex digits>
+     */
+    static bool segment_path(char *path, size_t size, uint32_t sequence) {
+        char name[16];
+        writer_t writer = {};
+        writer::to_buffer(writer, name, sizeof(name) - 1);
+        writer::put_cstr(writer, SEGMENT_PREFIX);
+        writer::put_hex(writer, sequence, 8);
+        name[writer.length] = '\0';
+        return writer::ok(writer) && store_path(path, size, name);
+    }
+
+    static bool pwrite_fully(int fd, const void *data, size_t size, off_t offset) {
+        const char *bytes = static_cast<const char *>(data);
+        while (size > 0) {
+            ssize_t cnt = pwrite(fd, bytes, size, offset);
+            if (cnt < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            bytes += cnt;
+            size -= cnt;
+            offset += cnt;
+        }
+        return true;
+    }
+
+    static bool pread_fully(int fd, void *data, size_t size, off_t offset) {
+        char *bytes = static_cast<char *>(data);
+        while (size > 0) {
+            ssize_t cnt = pread(fd, bytes, size, offset);
+            if (cnt < 0 && errno == EINTR) {
+                continue;
+            }
+            if (cnt <= 0) {
+                return false;
+            }
+            bytes += cnt;
+            size -= cnt;
+            offset += cnt;
+        }
+        return true;
+    }
+
+    static bool read_fd(int fd, std::vector<char> &data) {
+        struct stat st = {};
+        if (fstat(fd, &st) != 0) {
+            return false;
+        }
+        data.resize(st.st_size);
+        return pread_fully(fd, data.data(), data.size(), 0);
+    }
+
+    static bool read_file(const char *path, std::vector<char> &data) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+
+        bool ok = read_fd(fd, data);
+        close(fd);
+
+        return ok;
+    }
+
+    typedef struct mapping {
+        int fd;                     // kept open to acknowledge reports through
+        const char *data;
+        size_t size;
+
+    } mapping_t;
+
+    /**
+     * Map a segment read-only
+     */
+    static bool map_segment(const segment_t &segment, mapping_t &mapping) {
+        char path[PATH_MAX];
+        struct stat st = {};
+        mapping = {-1, nullptr, 0};
+        if (!segment_path(path, sizeof(path), segment.sequence) ||
+            (mapping.fd = open(path, O_RDWR | O_CLOEXEC)) == -1) {
+            return false;
+        }
+        if (fstat(mapping.fd, &st) != 0 || st.st_size <= 0) {
+            return false;
+        }
+
+        void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, mapping.fd, 0);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        mapping.data = static_cast<const char *>(data);
+        mapping.size = st.st_size;
+
+        return true;
+    }
+
+    static void unmap_segment(mapping_t &mapping) {
+        if (mapping.data != nullptr) {
+            munmap(const_cast<char *>(mapping.data), mapping.size);
+        }
+        if (mapping.fd != -1) {
+            close(mapping.fd);
+        }
+        mapping = {-1, nullptr, 0};
+    }
+
+    static uint32_t checksum(const void *data, size_t size) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        uint32_t hash = 0x811c9dc5;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 0x01000193;
+        }
+        return hash;
+    }
+
+    static size_t padded(size_t size) {
+        return (size + 7) & ~static_cast<size_t>(7);
+    }
+
+    /**
+     * Bytes a report of a payload size takes in its segment
+     */
+    static size_t extent(size_t size) {
+        return sizeof(report_header_t) + padded(size) + sizeof(commit_marker_t);
+    }
+
+    static int64_t now_ms() {
+        struct timespec now = {};
+        clock_gettime(CLOCK_REALTIME, &now);
+        return static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+    }
+
+    static uint64_t id_of(const segment_t &segment, const index_report_t &report) {
+        return (static_cast<uint64_t>(segment.sequence) << 32) | report.offset;
+    }
+
+    static quota_t quota_of(report_type_t type) {
+        quota_t quota = quotas[type];
+        if (quota.bytes == 0) {
+            quota.bytes = default_quotas[type].bytes;
+        }
+        if (quota.count == 0) {
+            quota.count = default_quotas[type].count;
+        }
+        return quota;
+    }
+
+    /**
+     * Read a segment's reports from the segment itself, cutting it at the first torn report
+     *
+     * @return false if the segment has no valid header, and should be removed
+     */
+    static bool scan_segment(segment_t &segment) {
+        char path[PATH_MAX];
+        std::vector<char> data;
+        if (!segment_path(path, sizeof(path), segment.sequence) || !read_file(path, data)) {
+            return false;
+        }
+
+        segment_header_t header = {};
+        if (data.size() < sizeof(header)) {
+            return false;
+        }
+        memcpy(&header, data.data(), sizeof(header));
+        if (header.magic != SEGMENT_MAGIC || header.version != STORE_VERSION ||
+            header.sequence != segment.sequence) {
+            return false;
+        }
+
+        segment.reports.clear();
+        size_t offset = sizeof(header);
+        while (data.size() - offset >= sizeof(report_header_t)) {
+            report_header_t report = {};
+            memcpy(&report, data.data() + offset, sizeof(report));
+            if (report.magic != REPORT_MAGIC || report.type >= REPORT_TYPE_CNT ||
+                report.size > data.size() || extent(report.size) > data.size() - offset) {
+                break;
+            }
+
+            commit_marker_t marker = {};
+            memcpy(&marker, data.data() + offset + sizeof(report) + padded(report.size), sizeof(marker));
+            if (marker.magic != COMMIT_MAGIC || marker.size != report.size) {
+                break;
+            }
+
+            index_report_t entry = {};
+            entry.offset = static_cast<uint32_t>(offset);
+            entry.size = report.size;
+            entry.timestamp = report.timestamp;
+            entry.serial = report.serial;
+            entry.type = report.type;
+            entry.state = report.state;
+            if (entry.state == STATE_LIVE &&
+                checksum(data.data() + offset + sizeof(report), report.size) != report.checksum) {
+                _LOGW("store: discarding a damaged report in segment %u", segment.sequence);
+                entry.state = STATE_EVICTED;
+            }
+            segment.reports.push_back(entry);
+            offset += extent(report.size);
+        }
+
+        if (offset < data.size()) {
+            _LOGW("store: cutting a torn report from segment %u", segment.sequence);
+            if (truncate(path, offset) != 0) {
+                _LOGE_POSIX("store: could not cut a torn report");
+            }
+        }
+        segment.size = offset;
+
+        return true;
+    }
+
+    static bool parse_index(const std::vector<char> &data, std::vector<segment_t> &indexed,
+                            index_header_t &header) {
+        if (data.size() < sizeof(header)) {
+            return false;
+        }
+        memcpy(&header, data.data(), sizeof(header));
+        if (header.magic != INDEX_MAGIC || header.version != STORE_VERSION ||
+            header.segment_cnt > INDEX_SEGMENTS_MAX || header.report_cnt > INDEX_REPORTS_MAX ||
+            data.size() != sizeof(header) + header.segment_cnt * sizeof(index_segment_t) +
+                           header.report_cnt * sizeof(index_report_t) ||
+            checksum(data.data() + sizeof(header), data.size() - sizeof(header)) != header.checksum) {
+            return false;
+        }
+
+        const char *at = data.data() + sizeof(header);
+        const char *reports = at + header.segment_cnt * sizeof(index_segment_t);
+        uint32_t report_cnt = 0;
+        for (uint32_t i = 0; i < header.segment_cnt; i++) {
+            index_segment_t entry = {};
+            memcpy(&entry, at + i * sizeof(entry), sizeof(entry));
+            if (entry.report_cnt > header.report_cnt - report_cnt) {
+                return false;
+            }
+
+            segment_t segment = {entry.sequence, entry.size, std::vector<index_report_t>(entry.report_cnt)};
+            memcpy(segment.reports.data(), reports + report_cnt * sizeof(index_report_t),
+                   entry.report_cnt * sizeof(index_report_t));
+            report_cnt += entry.report_cnt;
+            indexed.push_back(segment);
+        }
+
+        return report_cnt == header.report_cnt;
+    }
+
+    /**
+     * Rewrite the index from the segments in memory, and replace it atomically
+     */
+    static bool save_index() {
+        char path[PATH_MAX];
+        char temp_path[PATH_MAX];
+        if (!store_path(path, sizeof(path), INDEX_NAME) ||
+            !store_path(temp_path, sizeof(temp_path), INDEX_TEMP_NAME)) {
+            return false;
+        }
+
+        std::vector<char> data(sizeof(index_header_t));
+        uint32_t report_cnt = 0;
+        for (auto &segment: segments) {
+            index_segment_t entry = {segment.sequence, static_cast<uint32_t>(segment.reports.size()), segment.size};
+            data.insert(data.end(), reinterpret_cast<char *>(&entry), reinterpret_cast<char *>(&entry + 1));
+        }
+        for (auto &segment: segments) {
+            const char *reports = reinterpret_cast<const char *>(segment.reports.data());
+            data.insert(data.end(), reports, reports + segment.reports.size() * sizeof(index_report_t));
+            report_cnt += segment.reports.size();
+        }
+
+        index_header_t header = {};
+        header.magic = INDEX_MAGIC;
+        header.version = STORE_VERSION;
+        header.generation = generation + 1;
+        header.next_sequence = next_sequence;
+        header.segment_cnt = static_cast<uint32_t>(segments.size());
+        header.report_cnt = report_cnt;
+        header.checksum = checksum(data.data() + sizeof(header), data.size() - sizeof(header));
+        memcpy(data.data(), &header, sizeof(header));
+
+        int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        bool written = (fd != -1) && pwrite_fully(fd, data.data(), data.size(), 0);
+        if (fd != -1 && close(fd) != 0) {
+            written = false;
+        }
+        if (!written || rename(temp_path, path) != 0) {
+            _LOGE_POSIX("store: could not write the index");
+            unlink(temp_path);
+            return false;
+        }
+
+        generation = header.generation;
+        return true;
+    }
+
+    static bool parse_sequence(const char *name, uint32_t &sequence) {
+        size_t prefix_len = strlen(SEGMENT_PREFIX);
+        if (strncmp(name, SEGMENT_PREFIX, prefix_len) != 0 || strlen(name) != prefix_len + 8) {
+            return false;
+        }
+
+        sequence = 0;
+        for (const char *c = name + prefix_len; *c != '\0'; c++) {
+            int digit = (*c >= '0' && *c <= '9') ? *c - '0' : (*c >= 'a' && *c <= 'f') ? *c - 'a' + 10 : -1;
+            if (digit < 0) {
+                return false;
+            }
+            sequence = (sequence << 4) | digit;
+        }
+        return true;
+    }
+
+    /**
+     * Load the index, and reconcile it with the segments on disk
+     */
+    static void load() {
+        char path[PATH_MAX];
+        std::vector<char> data;
+        std::vector<segment_t> indexed;
+        index_header_t header = {};
+
+        bool changed = !(store_path(path, sizeof(path), INDEX_NAME) && read_file(path, data) &&
+                         parse_index(data, indexed, header));
+        if (changed) {
+            indexed.clear();
+            header = {};
+        }
+
+        std::vector<uint32_t> on_disk;
+        DIR *dir = store_path(path, sizeof(path), nullptr) ? opendir(path) : nullptr;
+        if (dir != nullptr) {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                uint32_t sequence;
+                if (parse_sequence(entry->d_name, sequence)) {
+                    on_disk.push_back(sequence);
+                }
+            }
+            closedir(dir);
+        }
+        std::sort(on_disk.begin(), on_disk.end());
+
+        segments.clear();
+        next_sequence = std::max<uint32_t>(header.next_sequence, 1);
+        for (uint32_t sequence: on_disk) {
+            auto found = std::find_if(indexed.begin(), indexed.end(),
+                                      [sequence](const segment_t &s) { return s.sequence == sequence; });
+
+            struct stat st = {};
+            if (found != indexed.end() && segment_path(path, sizeof(path), sequence) &&
+                stat(path, &st) == 0 && static_cast<uint64_t>(st.st_size) == found->size) {
+                segments.push_back(*found);
+            } else {
+                segment_t segment = {sequence, 0, {}};
+                if (scan_segment(segment)) {
+                    segments.push_back(segment);
+                } else if (segment_path(path, sizeof(path), sequence)) {
+                    unlink(path);
+                }
+                changed = true;
+            }
+            next_sequence = std::max(next_sequence, sequence + 1);
+        }
+
+        next_serial = 1;
+        for (auto &segment: segments) {
+            for (auto &report: segment.reports) {
+                next_serial = std::max(next_serial, report.serial + 1);
+            }
+        }
+
+        changed |= (segments.size() != indexed.size());
+        generation = header.generation;
+        if (changed) {
+            save_index();
+        }
+    }
+
+    /**
+     * Take both locks, and reload the index if another process has rewritten it
+     */
+    static bool lock() {
+        pthread_mutex_lock(&store_mutex);
+        if (!opened) {
+            pthread_mutex_unlock(&store_mutex);
+            return false;
+        }
+
+        while (flock(lock_fd, LOCK_EX) != 0 && errno == EINTR);
+
+        char path[PATH_MAX];
+        index_header_t header = {};
+        int fd = store_path(path, sizeof(path), INDEX_NAME) ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+        bool current = (fd != -1) && pread_fully(fd, &header, sizeof(header), 0) &&
+                       header.magic == INDEX_MAGIC && header.generation == generation;
+        if (fd != -1) {
+            close(fd);
+        }
+
+        // appends don't rewrite the index: they grow the active segment
+        struct stat st = {};
+        if (current && !segments.empty()) {
+            current = segment_path(path, sizeof(path), segments.back().sequence) && stat(path, &st) == 0 &&
+                      static_cast<uint64_t>(st.st_size) == segments.back().size;
+        }
+        if (!current) {
+            load();
+        }
+        return true;
+    }
+
+    static void unlock() {
+        flock(lock_fd, LOCK_UN);
+        pthread_mutex_unlock(&store_mutex);
+    }
+
+    /**
+     * Flip the state of a report in its segment, through the segment's fd if it is open
+     */
+    static bool set_state(const segment_t &segment, index_report_t &report, uint8_t state, int fd = -1) {
+        char path[PATH_MAX];
+        int segment_fd = (fd != -1) ? fd : segment_path(path, sizeof(path), segment.sequence) ?
+                                           open(path, O_WRONLY | O_CLOEXEC) : -1;
+        bool written = (segment_fd != -1) &&
+                       pwrite_fully(segment_fd, &state, sizeof(state),
+                                    report.offset + offsetof(report_header_t, state));
+        if (segment_fd != -1 && fd == -1) {
+            close(segment_fd);
+        }
+        if (!written) {
+            _LOGE_POSIX("store: could not update a report");
+            return false;
+        }
+
+        report.state = state;
+        return true;
+    }
+
+    static bool start_segment() {
+        char path[PATH_MAX];
+        segment_t segment = {next_sequence, sizeof(segment_header_t), {}};
+        if (!segment_path(path, sizeof(path), segment.sequence)) {
+            return false;
+        }
+
+        segment_header_t header = {SEGMENT_MAGIC, STORE_VERSION, segment.sequence, 0};
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        bool written = (fd != -1) && pwrite_fully(fd, &header, sizeof(header), 0);
+        if (fd != -1 && close(fd) != 0) {
+            written = false;
+        }
+        if (!written) {
+            _LOGE_POSIX("store: could not start a segment");
+            unlink(path);
+            return false;
+        }
+
+        next_sequence++;
+        segments.push_back(segment);
+        return true;
+    }
+
+    static bool evict_oldest(report_type_t type) {
+        segment_t *oldest_segment = nullptr;
+        index_report_t *oldest = nullptr;
+        for (auto &segment: segments) {
+            for (auto &report: segment.reports) {
+                if (report.type == type && report.state == STATE_LIVE &&
+                    (oldest == nullptr || report.serial < oldest->serial)) {
+                    oldest_segment = &segment;
+                    oldest = &report;
+                }
+            }
+        }
+        return oldest != nullptr && set_state(*oldest_segment, *oldest, STATE_EVICTED);
+    }
+
+    static quota_t usage_of(report_type_t type) {
+        quota_t used = {0, 0};
+        for (auto &segment: segments) {
+            for (auto &report: segment.reports) {
+                if (report.type == type && report.state == STATE_LIVE) {
+                    used.bytes += report.size;
+                    used.count++;
+                }
+            }
+        }
+        return used;
+    }
+
+    /**
+     * Append a report to the active segment, starting a new one if it is full
+     */
+    static bool append_report(report_type_t type, const char *payload, size_t size,
+                              int64_t timestamp, uint64_t serial) {
+        if (segments.empty() ||
+            (segments.back().size + extent(size) > SEGMENT_SZ && !segments.back().reports.empty())) {
+            if (!start_segment()) {
+                return false;
+            }
+        }
+
+        segment_t &segment = segments.back();
+        char path[PATH_MAX];
+        int fd = segment_path(path, sizeof(path), segment.sequence) ?
+                 open(path, O_WRONLY | O_CLOEXEC) : -1;
+        if (fd == -1) {
+            _LOGE_POSIX("store: could not open the active segment");
+            return false;
+        }
+
+        report_header_t header = {};
+        header.magic = REPORT_MAGIC;
+        header.type = type;
+        header.state = STATE_LIVE;
+        header.size = static_cast<uint32_t>(size);
+        header.checksum = checksum(payload, size);
+        header.timestamp = timestamp;
+        header.serial = serial;
+
+        char padding[8] = {};
+        commit_marker_t marker = {COMMIT_MAGIC, header.size};
+        off_t offset = static_cast<off_t>(segment.size);
+
+        // the marker is written only once the report is complete
+        bool written = pwrite_fully(fd, &header, sizeof(header), offset) &&
+                       pwrite_fully(fd, payload, size, offset + sizeof(header)) &&
+                       pwrite_fully(fd, padding, padded(size) - size, offset + sizeof(header) + size) &&
+                       pwrite_fully(fd, &marker, sizeof(marker), offset + sizeof(header) + padded(size));
+        close(fd);
+
+        if (!written) {
+            _LOGE_POSIX("store: could not append a report");
+            // a partial report is cut when the segment is next scanned
+            return false;
+        }
+
+        index_report_t report = {};
+        report.offset = static_cast<uint32_t>(segment.size);
+        report.size = header.size;
+        report.timestamp = timestamp;
+        report.serial = serial;
+        report.type = type;
+        report.state = STATE_LIVE;
+        segment.reports.push_back(report);
+        segment.size += extent(size);
+
+        return true;
+    }
+
+    /**
+     * @return the live payload bytes of a segment
+     */
+    static size_t live_bytes(const segment_t &segment) {
+        size_t bytes = 0;
+        for (auto &report: segment.reports) {
+            bytes += (report.state == STATE_LIVE) ? extent(report.size) : 0;
+        }
+        return bytes;
+    }
+
+    static int compact_segments() {
+        char path[PATH_MAX];
+        int removed = 0;
+        size_t inactive = segments.empty() ? 0 : segments.size() - 1;
+
+        // appending may grow segments: index them, rather than hold references
+        for (size_t i = 0; i < inactive; i++) {
+            size_t live = live_bytes(segments[i]);
+            if (live > 0 && live * COMPACT_RATIO >= segments[i].size) {
+                continue;
+            }
+
+            // move what is live to the active segment, then drop the segment
+            bool moved = true;
+            if (live > 0) {
+                std::vector<char> data;
+                moved = segment_path(path, sizeof(path), segments[i].sequence) && read_file(path, data);
+                for (size_t r = 0; moved && r < segments[i].reports.size(); r++) {
+                    index_report_t report = segments[i].reports[r];
+                    if (report.state != STATE_LIVE) {
+                        continue;
+                    }
+                    moved = report.offset + extent(report.size) <= data.size() &&
+                            append_report(static_cast<report_type_t>(report.type),
+                                          data.data() + report.offset + sizeof(report_header_t),
+                                          report.size, report.timestamp, report.serial);
+                    if (moved) {
+                        set_state(segments[i], segments[i].reports[r], STATE_EVICTED);
+                    }
+                }
+            }
+
+            if (moved && segment_path(path, sizeof(path), segments[i].sequence) &&
+                unlink(path) == 0) {
+                segments[i].reports.clear();
+                segments[i].size = 0;
+                removed++;
+            }
+        }
+
+        segments.erase(std::remove_if(segments.begin(), segments.end(),
+                                      [](const segment_t &s) { return s.size == 0; }),
+                       segments.end());
+
+        return removed;
+    }
+
+    static void close_store() {
+        close(lock_fd);
+        lock_fd = -1;
+        segments.clear();
+        generation = 0;
+        opened = false;
+    }
+
+    bool initialize() {
+        char path[PATH_MAX];
+
+        pthread_mutex_lock(&store_mutex);
+
+        // the report directory moved: the store moves with it
+        if (opened && store_path(path, sizeof(path), nullptr) && strcmp(path, opened_path) != 0) {
+            close_store();
+        }
+
+        if (!opened && store_path(path, sizeof(path), nullptr) &&
+            (mkdir(path, 0700) == 0 || errno == EEXIST)) {
+            strncpy(opened_path, path, sizeof(opened_path) - 1);
+            lock_fd = store_path(path, sizeof(path), LOCK_NAME) ?
+                      open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600) : -1;
+            if (lock_fd != -1) {
+                while (flock(lock_fd, LOCK_EX) != 0 && errno == EINTR);
+                load();
+                flock(lock_fd, LOCK_UN);
+                opened = true;
+            } else {
+                _LOGE_POSIX("store: could not open the report store");
+            }
+        }
+
+        bool available = opened;
+        pthread_mutex_unlock(&store_mutex);
+
+        return available;
+    }
+
+    void shutdown() {
+        pthread_mutex_lock(&store_mutex);
+        if (opened) {
+            close_store();
+        }
+        pthread_mutex_unlock(&store_mutex);
+    }
+
+    report_type_t type_of(const char *prefix) {
+        for (int type = 0; type < REPORT_TYPE_CNT; type++) {
+            if (strcmp(prefix, report_prefixes[type]) == 0) {
+                return static_cast<report_type_t>(type);
+            }
+        }
+        return REPORT_TYPE_CNT;
+    }
+
+    void set_quota(report_type_t type, const quota_t &quota) {
+        if (type < REPORT_TYPE_CNT) {
+            pthread_mutex_lock(&store_mutex);
+            quotas[type] = quota;
+            pthread_mutex_unlock(&store_mutex);
+        }
+    }
+
+    quota_t get_quota(report_type_t type) {
+        quota_t quota = {0, 0};
+        if (type < REPORT_TYPE_CNT) {
+            pthread_mutex_lock(&store_mutex);
+            quota = quota_of(type);
+            pthread_mutex_unlock(&store_mutex);
+        }
+        return quota;
+    }
+
+    quota_t usage(report_type_t type) {
+        quota_t used = {0, 0};
+        if (type < REPORT_TYPE_CNT && (initialize() && lock())) {
+            used = usage_of(type);
+            unlock();
+        }
+        return used;
+    }
+
+    bool append(report_type_t type, const char *payload, size_t size) {
+        if (type >= REPORT_TYPE_CNT || size > UINT32_MAX || !initialize() || !lock()) {
+            return false;
+        }
+
+        quota_t quota = quota_of(type);
+        if (size > quota.bytes) {
+            _LOGW("store: a %zu byte report is over its type's quota of %zu bytes, and was dropped",
+                  size, quota.bytes);
+            unlock();
+            return false;
+        }
+
+        // oldest first, until the report fits
+        bool evicted = false;
+        for (quota_t used = usage_of(type);
+             used.count > 0 && (used.count + 1 > quota.count || used.bytes + size > quota.bytes);
+             used = usage_of(type)) {
+            if (!evict_oldest(type)) {
+                break;
+            }
+            evicted = true;
+        }
+
+        uint32_t sequence = next_sequence;
+        bool appended = append_report(type, payload, size, now_ms(), next_serial);
+        next_serial += appended ? 1 : 0;
+        if (evicted) {
+            compact_segments();
+        }
+
+        // a report appended to the active segment is found by rescanning it
+        if (evicted || next_sequence != sequence) {
+            save_index();
+        }
+        unlock();
+
+        return appended;
+    }
+
+    typedef struct visit {
+        visitor_t visitor;
+        void *arg;
+
+    } visit_t;
+
+    static void visit_each(const report_t *reports, size_t count, bool *acknowledged, void *arg) {
+        visit_t *visit = static_cast<visit_t *>(arg);
+        for (size_t i = 0; i < count; i++) {
+            acknowledged[i] = visit->visitor(reports[i], visit->arg);
+        }
+    }
+
+    int for_each(visitor_t visitor, void *arg) {
+        visit_t visit = {visitor, arg};
+        return for_each_batch(visit_each, &visit);
+    }
+
+    int for_each_batch(batch_visitor_t visitor, void *arg) {
+        if (!initialize() || !lock()) {
+            return 0;
+        }
+
+        // live reports, oldest first: moved reports are out of place in their segments
+        std::vector<std::pair<size_t, size_t>> order;
+        for (size_t i = 0; i < segments.size(); i++) {
+            for (size_t r = 0; r < segments[i].reports.size(); r++) {
+                if (segments[i].reports[r].state == STATE_LIVE) {
+                    order.emplace_back(i, r);
+                }
+            }
+        }
+        std::sort(order.begin(), order.end(), [](const std::pair<size_t, size_t> &a,
+                                                 const std::pair<size_t, size_t> &b) {
+            return segments[a.first].reports[a.second].serial < segments[b.first].reports[b.second].serial;
+        });
+
+        // segments with live reports, mapped once. The lock is held until they are unmapped,
+        // so no other process truncates one under its mapping.
+        std::vector<mapping_t> mappings(segments.size(), mapping_t{-1, nullptr, 0});
+        std::vector<bool> mapped(segments.size(), false);
+        for (auto &at: order) {
+            if (!mapped[at.first]) {
+                mapped[at.first] = true;
+                if (!map_segment(segments[at.first], mappings[at.first])) {
+                    _LOGE_POSIX("store: could not map a segment");
+                }
+            }
+        }
+
+        std::vector<report_t> reports;
+        std::vector<std::pair<size_t, size_t>> visited;
+        bool changed = false;
+
+        for (auto &at: order) {
+            const mapping_t &mapping = mappings[at.first];
+            segment_t &segment = segments[at.first];
+            index_report_t &entry = segment.reports[at.second];
+            if (mapping.data == nullptr || entry.offset + extent(entry.size) > mapping.size) {
+                continue;
+            }
+
+            // the segment is authoritative: another process may have acknowledged it
+            report_header_t header = {};
+            memcpy(&header, mapping.data + entry.offset, sizeof(header));
+            const char *payload = mapping.data + entry.offset + sizeof(header);
+            if (header.state != STATE_LIVE || header.magic != REPORT_MAGIC || header.size != entry.size ||
+                header.checksum != checksum(payload, header.size)) {
+                entry.state = (header.state != STATE_LIVE) ? header.state : STATE_EVICTED;
+                changed = true;
+                continue;
+            }
+
+            reports.push_back({id_of(segment, entry), static_cast<report_type_t>(entry.type),
+                               entry.timestamp, payload, entry.size});
+            visited.push_back(at);
+        }
+
+        std::unique_ptr<bool[]> acknowledged(new bool[reports.size()]());
+        if (!reports.empty()) {
+            visitor(reports.data(), reports.size(), acknowledged.get(), arg);
+        }
+
+        int acknowledged_cnt = 0;
+        for (size_t i = 0; i < visited.size(); i++) {
+            segment_t &segment = segments[visited[i].first];
+            if (acknowledged[i] && set_state(segment, segment.reports[visited[i].second], STATE_ACKNOWLEDGED,
+                                             mappings[visited[i].first].fd)) {
+                acknowledged_cnt++;
+                changed = true;
+            }
+        }
+        for (auto &mapping: mappings) {
+            unmap_segment(mapping);
+        }
+
+        if (compact_segments() > 0 || changed) {
+            save_index();
+        }
+        unlock();
+
+        return acknowledged_cnt;
+    }
+
+    bool acknowledge(uint64_t id) {
+        if (!initialize() || !lock()) {
+            return false;
+        }
+
+        bool acknowledged = false;
+        for (auto &segment: segments) {
+            for (auto &report: segment.reports) {
+                if (id_of(segment, report) == id && report.state == STATE_LIVE) {
+                    acknowledged = set_state(segment, report, STATE_ACKNOWLEDGED);
+                }
+            }
+        }
+
+        if (acknowledged) {
+            save_index();
+        }
+        unlock();
+
+        return acknowledged;
+    }
+
+    int compact() {
+        if (!initialize() || !lock()) {
+            return 0;
+        }
+
+        int removed = compact_segments();
+        if (removed > 0) {
+            save_index();
+        }
+        unlock();
+
+        return removed;
+    }
+
+}   // namespace store
@@ -0,0 +1,153 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_REPORT_STORE_H
+#define _AGENT_NDK_REPORT_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Append-only report store
+ *
+ * Rendered reports are appended to a log of segment files under the report directory, rather
+ * than each written to a file of its own. A segment is filled to SEGMENT_SZ, then a new one is
+ * started. Each report is a header, the payload and a commit marker written after it: a report
+ * torn by the death of the process is missing its marker, and is cut from the segment when the
+ * store is next opened.
+ *
+ * A small index file lists the segments and the reports in each, so the store is opened, and
+ * quotas are checked, without reading the segments. It is only a hint: it is rewritten when
+ * reports are acknowledged, evicted or moved, or a segment is started, but not for an append,
+ * and a segment whose size doesn't match it is rescanned. The state of each report (live,
+ * acknowledged or evicted) is held in its header in the segment, and flipped in place.
+ *
+ * Each report type has a byte and a count quota. Appending a report that would exceed its
+ * type's quota evicts the oldest reports of the type first. Reports are read oldest first, a
+ * segment at a time, and acknowledged once delivered. compact() deletes segments left with no
+ * live reports, and moves the live reports out of segments that are mostly dead. A report may
+ * be delivered twice if the process dies while it is being moved, but is never lost.
+ *
+ * The store is locked with a mutex, and with flock(2) against other processes of the app.
+ * Nothing here is async-signal-safe: crash handlers keep writing records to the report
+ * slots, and those are rendered into the store on the next launch.
+ */
+namespace store {
+
+    typedef enum report_type {
+        REPORT_CRASH = 0,
+        REPORT_EXCEPTION,
+        REPORT_ANR,
+        REPORT_TYPE_CNT
+
+    } report_type_t;
+
+    // Segments are started once the active segment reaches this size
+    static const size_t SEGMENT_SZ = 256 * 1024;
+
+    typedef struct quota {
+        size_t bytes;       // payload bytes of live reports
+        size_t count;       // live reports
+
+    } quota_t;
+
+    typedef struct report {
+        uint64_t id;                // segment sequence and offset: identifies the report to acknowledge()
+        report_type_t type;
+        int64_t timestamp;          // ms since the epoch, when the report was first stored
+        const char *data;
+        size_t size;
+
+    } report_t;
+
+    /**
+     * Called with each live report, in the order they were stored
+     *
+     * @return true to acknowledge the report
+     */
+    typedef bool (*visitor_t)(const report_t &, void *arg);
+
+    /**
+     * Called once with every live report, oldest first. Payloads are mapped read-only from the
+     * segments, and are valid until the visitor returns.
+     *
+     * @param acknowledged set acknowledged[i] to acknowledge reports[i]
+     */
+    typedef void (*batch_visitor_t)(const report_t *reports, size_t count, bool *acknowledged, void *arg);
+
+    /**
+     * Open (creating if needed) the store under the report directory, cutting any torn
+     * report from its active segment. Does nothing if the store is already open.
+     *
+     * @return true if the store is available
+     */
+    bool initialize();
+
+    /**
+     * Close the store
+     */
+    void shutdown();
+
+    /**
+     * @return the type of a report file prefix ("crash-", "ex-", "anr-"), or REPORT_TYPE_CNT
+     */
+    report_type_t type_of(const char *prefix);
+
+    /**
+     * Set the quota of a report type. A zero bytes or count restores its default.
+     * Takes effect on the next append.
+     */
+    void set_quota(report_type_t, const quota_t &);
+
+    quota_t get_quota(report_type_t);
+
+    /**
+     * @return bytes and count of the live reports of a type
+     */
+    quota_t usage(report_type_t);
+
+    /**
+     * Append a report, evicting the oldest reports of its type to keep within its quota.
+     * The store is opened if needed.
+     *
+     * @return true if the report was committed
+     */
+    bool append(report_type_t, const char *payload, size_t size);
+
+    /**
+     * Pass each live report to a visitor, oldest first, from each segment mapped read-only.
+     * Reports the visitor accepts are acknowledged. The store is locked throughout: the
+     * visitor must not call back into it. The store is opened if needed.
+     *
+     * @return number of reports acknowledged
+     */
+    int for_each(visitor_t, void *arg);
+
+    /**
+     * Pass every live report to a visitor at once, so they can be processed out of order or in
+     * parallel. As for_each(), the store is locked until the visitor returns.
+     *
+     * @return number of reports acknowledged
+     */
+    int for_each_batch(batch_visitor_t, void *arg);
+
+    /**
+     * Acknowledge a delivered report, so it is never read again
+     *
+     * @return false if the report is unknown or no longer live
+     */
+    bool acknowledge(uint64_t id);
+
+    /**
+     * Delete segments with no live reports, and move the live reports out of segments that
+     * are mostly dead. The active segment is never compacted.
+     *
+     * @return number of segments removed
+     */
+    int compact();
+
+}   // namespace store
+
+#endif // _AGENT_NDK_REPORT_STORE_H
@@ -5,79 +5,323 @@
  */
 
 #include <jni.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <cstdio>
-#include <iostream>
-#include <fstream>
-#include <chrono>
-#include <sstream>
+#include <cstring>
+#include <memory>
+#include <vector>
 
 #include <agent-ndk.h>
 #include "jni/native-context.h"
 #include "jni/jni-delegate.h"
+#include "writer.h"
+#include "lz-codec.h"
+#include "report-slots.h"
+#include "report-store.h"
+#include "record.h"
+#include "fingerprint.h"
 #include "serializer.h"
 
 namespace serializer {
 
-    static std::string generateTmpFilename(const char *);
+    // Attempts at a unique report name before giving up
+    static const int UNIQUE_NAME_ATTEMPTS = 100;
+
+    // A temporary file untouched for this long was left by a process that died storing it
+    static const time_t TEMPORARY_FILE_AGE_S = 60;
+
+    // fdatasync() each report before it is published
+    static volatile bool sync_storage = false;
+
+    static bool generate_filename(char *, size_t, const char *, const char *,
+                                  const struct timespec &, int, bool);
+
+    static bool write_fully(int, const char *, size_t);
+
+    static bool write_compressed(int, const char *, size_t);
+
+    static bool store(const char *, const char *, size_t, bool);
 
     void from_crash(const char *buffer, size_t buffsz) {
-        to_storage("crash-", buffer, buffsz);
-        // Crashes are left in storage and processed on the next app launch
+        if (coalesce(buffer, buffsz)) {
+            return;
+        }
+        if (!slots::commit(slots::SLOT_CRASH, buffer, buffsz)) {
+            to_storage("rec-crash-", buffer, buffsz);
+        }
+        // Crashes are left in storage as records, and rendered on the next app launch
     }
 
     void from_exception(const char *buffer, size_t buffsz) {
-        to_storage("ex-", buffer, buffsz);
-        // Exceptions are left in storage and processed on the next app launch
+        if (coalesce(buffer, buffsz)) {
+            return;
+        }
+        if (!slots::commit(slots::SLOT_EXCEPTION, buffer, buffsz)) {
+            to_storage("rec-ex-", buffer, buffsz);
+        }
+        // Exceptions are left in storage as records, and rendered on the next app launch
     }
 
     void from_anr(const char *buffer, size_t buffsz) {
-        to_storage("anr-", buffer, buffsz);
-        // ANRs are left in storage and processed on the next app launch
+        if (coalesce(buffer, buffsz)) {
+            return;
+        }
+        if (!slots::commit(slots::SLOT_ANR, buffer, buffsz)) {
+            to_storage("rec-anr-", buffer, buffsz);
+        }
+        // ANRs are left in storage as records, and rendered on the next app launch
     }
 
-    /**
-     * Write the payload locally using MT thread-safe functions
+    bool coalesce(const char *record, size_t size) {
+        long window = jni::get_native_context().coalesceWindow;
+        if (window <= 0) {
+            return false;
+        }
+
+        uint64_t fingerprint = record::fingerprint_of(record, size);
+        if (!fingerprint::coalesce(fingerprint, time(nullptr), window)) {
+            return false;
+        }
 
+        _LOGD("Report repeats a stack reported in the last %lds, and was counted", window);
+        return true;
+    }
+
+    void set_sync_storage(bool sync) {
+        sync_storage = sync;
+    }
+
+    bool to_storage(const char *filePrefix, const char *payload, size_t payload_size) {
+        return store(filePrefix, payload, payload_size, false);
+    }
+
+    bool to_compressed_storage(const char *filePrefix, const char *payload, size_t payload_size) {
+        return store(filePrefix, payload, payload_size, true);
+    }
+
+    bool to_report_store(const char *reportType, const char *payload, size_t payload_size) {
+        store::report_type_t type = store::type_of(reportType);
+        if (type != store::REPORT_TYPE_CNT) {
+            std::unique_ptr<lz::encoder_t> encoder(new lz::encoder_t());
+            std::vector<char> frame(lz::FRAME_HEADER_SZ + payload_size + payload_size / lz::BLOCK_SZ * 4 + 4);
+
+            writer_t writer = {};
+            writer::to_buffer(writer, frame.data(), frame.size());
+            if (lz::compress(payload, payload_size, *encoder, writer) &&
+                store::append(type, frame.data(), writer.length)) {
+                _LOGD("Native report stored (%zu bytes, %zu compressed)", payload_size, writer.length);
+                return true;
+            }
+        }
+
+        return to_compressed_storage(reportType, payload, payload_size);
+    }
+
+    int sweep_temporary_files() {
+        jni::native_context_t &native_context = jni::get_native_context();
+        int removed = 0;
+
+        DIR *dir = opendir(native_context.reportPathAbsolute);
+        if (dir == nullptr) {
+            return 0;
+        }
+
+        time_t now = time(nullptr);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            size_t length = std::strlen(entry->d_name);
+            if (entry->d_name[0] != '.' || length <= 5 || std::strcmp(entry->d_name + length - 4, ".tmp") != 0) {
+                continue;
+            }
+
+            struct stat st = {};
+            if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0 ||
+                !S_ISREG(st.st_mode) || now - st.st_mtime < TEMPORARY_FILE_AGE_S) {
+                continue;
+            }
+
+            if (unlinkat(dirfd(dir), entry->d_name, 0) == 0) {
+                _LOGD("Removed the partial report [%s]", entry->d_name);
+                removed++;
+            }
+        }
+        closedir(dir);
+
+        return removed;
+    }
+
+    /**
+     * Write the payload using only async-signal-safe system calls.
+     *
+     * The report is written to a hidden temporary file, created exclusively, and
+     * renamed into place once complete, so a reader never sees a partial report.
+     *
+     * @param filePrefix report type prefix
      * @param payload
      * @param payload_size
+     * @param compressed store the payload as a compressed frame
      */
-    bool to_storage(const char *filepath, const char *payload, size_t payload_size) {
-        std::string storagePath = generateTmpFilename(filepath).c_str();
-        std::ofstream os{storagePath.c_str(), std::ios::out | std::ios::binary};
-
-        size_t payload_len = std::strlen(payload);
-        payload_size = (payload_size < payload_len ? payload_size : payload_len);
-
-        if (!os) {
-            _LOGE_POSIX("serializer::to_storage error");
-        } else {
-            os.write(payload, payload_size);
-            os.flush();
-            os.close();
-            _LOGD("Native report written to [%s]", storagePath.c_str());
+    static bool store(const char *filePrefix, const char *payload, size_t payload_size, bool compressed) {
+        jni::native_context_t &native_context = jni::get_native_context();
+        char storagePath[PATH_MAX];
+        char tmpPath[PATH_MAX];
+        struct timespec now = {};
+        int fd = -1;
+
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        for (int attempt = 0; attempt < UNIQUE_NAME_ATTEMPTS && fd == -1; attempt++) {
+            if (!generate_filename(storagePath, sizeof(storagePath),
+                                   native_context.reportPathAbsolute, filePrefix,
+                                   now, attempt, false) ||
+                !generate_filename(tmpPath, sizeof(tmpPath),
+                                   native_context.reportPathAbsolute, filePrefix,
+                                   now, attempt, true)) {
+                _LOGE("serializer::store: report path is too long");
+                return false;
+            }
+
+            // an existing report with this name is never replaced
+            if (access(storagePath, F_OK) == 0) {
+                continue;
+            }
+
+            fd = open(tmpPath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+            if (fd == -1 && errno != EEXIST) {
+                _LOGE_POSIX("serializer::store error");
+                return false;
+            }
+        }
+
+        if (fd == -1) {
+            _LOGE("serializer::store: could not create a unique report name");
+            return false;
+        }
+
+        bool written = compressed ? write_compressed(fd, payload, payload_size) :
+                       write_fully(fd, payload, payload_size);
+
+        if (written && sync_storage && fdatasync(fd) != 0) {
+            _LOGE_POSIX("fdatasync()");
+        }
+
+        if (close(fd) != 0) {
+            written = false;
+        }
+
+        if (written && rename(tmpPath, storagePath) == 0) {
+            _LOGD("Native report written to [%s]", storagePath);
             return true;
         }
 
+        _LOGE_POSIX("serializer::store error");
+        unlink(tmpPath);
+
         return false;
     }
 
-    static std::string generateTmpFilename(const char *filePrefix) {
-        jni::native_context_t &native_context = jni::get_native_context();
-        std::ostringstream oss;
-        using namespace std::chrono;
-        auto now = system_clock::now();
-        auto ms = duration_cast<milliseconds>(now.time_since_epoch()) % 1000;
-        auto timer = system_clock::to_time_t(now);
-        std::tm wallTime = *(std::localtime(&timer));
-
-        oss << native_context.reportPathAbsolute << "/"
-            << filePrefix
-            << std::put_time(&wallTime, "%Y%m%d%H%M%S")
-            << std::setfill('0')
-            << std::setw(3)
-            << ms.count();
-
-        return oss.str();
+    /**
+     * Convert seconds since the epoch to a UTC civil date and time, without
+     * touching libc's time conversion (which locks and may load zone data)
+     *
+     * https://howardhinnant.github.io/date_algorithms.html#civil_from_days
+     */
+    static void civil_from_epoch(time_t epoch, int &year, int &month, int &day,
+                                 int &hour, int &min, int &sec) {
+        long long days = epoch / 86400;
+        long long secs = epoch % 86400;
+        if (secs < 0) {
+            secs += 86400;
+            days--;
+        }
+
+        hour = static_cast<int>(secs / 3600);
+        min = static_cast<int>((secs % 3600) / 60);
+        sec = static_cast<int>(secs % 60);
+
+        days += 719468;
+        long long era = (days >= 0 ? days : days - 146096) / 146097;
+        long long doe = days - era * 146097;
+        long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        long long mp = (5 * doy + 2) / 153;
+
+        day = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+        month = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+        year = static_cast<int>(yoe + era * 400 + (month <= 2 ? 1 : 0));
+    }
+
+    /**
+     * Format a report path: <reportPath>/<prefix><YYYYmmddHHMMSS><mmm>[-<n>],
+     * or its hidden temporary counterpart: <reportPath>/.<prefix><YYYYmmddHHMMSS><mmm>[-<n>].tmp
+     */
+    static bool generate_filename(char *path, size_t size, const char *reportPath,
+                                  const char *filePrefix, const struct timespec &now,
+                                  int suffix, bool temporary) {
+        int year, month, day, hour, min, sec;
+        civil_from_epoch(now.tv_sec, year, month, day, hour, min, sec);
+
+        writer_t writer = {};
+        writer::to_buffer(writer, path, size - 1);
+        writer::put_cstr(writer, reportPath);
+        writer::put_char(writer, '/');
+        if (temporary) {
+            writer::put_char(writer, '.');
+        }
+        writer::put_cstr(writer, filePrefix);
+        writer::put_udec(writer, year, 4);
+        writer::put_udec(writer, month, 2);
+        writer::put_udec(writer, day, 2);
+        writer::put_udec(writer, hour, 2);
+        writer::put_udec(writer, min, 2);
+        writer::put_udec(writer, sec, 2);
+        writer::put_udec(writer, now.tv_nsec / 1000000, 3);
+        if (suffix > 0) {
+            writer::put_char(writer, '-');
+            writer::put_udec(writer, suffix);
+        }
+        if (temporary) {
+            writer::put_cstr(writer, ".tmp");
+        }
+        path[writer.length] = '\0';
+
+        return writer::ok(writer);
+    }
+
+    /**
+     * write(2) until the whole payload is written, retrying on EINTR and short writes
+     */
+    static bool write_fully(int fd, const char *payload, size_t payload_size) {
+        size_t offset = 0;
+        while (offset < payload_size) {
+            ssize_t cnt = write(fd, payload + offset, payload_size - offset);
+            if (cnt < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            offset += cnt;
+        }
+        return true;
+    }
+
+    /**
+     * Compress the payload to the file a block at a time. Kept out of store()'s frame:
+     * the encoder is too large for a signal stack.
+     */
+    __attribute__((noinline)) static bool write_compressed(int fd, const char *payload, size_t payload_size) {
+        lz::encoder_t encoder;
+        char staging[lz::BLOCK_SZ];
+
+        writer_t writer = {};
+        writer::to_fd(writer, fd, staging, sizeof(staging));
+        return lz::compress(payload, payload_size, encoder, writer) && writer::flush(writer);
     }
 
-}   // namespace serializer
\ No newline at end of file
+}   // namespace serializer
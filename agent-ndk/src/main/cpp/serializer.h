@@ -20,36 +20,86 @@
 namespace serializer {
 
     /**
-     * Pass a serialized crash report to its delegate.
+     * Pass a crash record to its delegate.
      *
-     * @param buffer character buffer containing the flattened crash report
+     * @param buffer character buffer containing the binary crash record
      * @param cbsz size of cbuffer
      */
     void from_crash(const char *buffer, size_t cbsz);
 
     /**
-     * Pass a serialized exception to its delegate.
+     * Pass an exception record to its delegate.
      *
-     * @param buffer character buffer containing the flattened exception report
+     * @param buffer character buffer containing the binary exception record
      * @param cbsz size of cbuffer
      */
     void from_exception(const char *buffer, size_t cbsz);
 
     /**
-     * Pass a ANR exception to its delegate.
+     * Pass an ANR record to its delegate.
      *
-     * @param buffer character buffer containing the flattened exception report
+     * @param buffer character buffer containing the binary ANR record
      * @param cbsz size of cbuffer
      */
     void from_anr(const char *buffer, size_t cbsz);
 
     /**
-     * Write the payload locally using only MT thread-safe functions
+     * Count a record against a report of the same stack written within the coalesce window,
+     * rather than storing it. Async-signal-safe.
      *
+     * @param record buffer containing the binary record
+     * @param cbsz size of record
+     * @return true if the record was counted, and should not be stored
+     */
+    bool coalesce(const char *record, size_t cbsz);
+
+    /**
+     * Write the payload locally using only async-signal-safe system calls
+     *
+     * @param filePrefix report type prefix ("crash-", "ex-", "anr-"), or record prefix ("rec-crash-", ...)
+     * @param payload char buffer holding data
+     * @param cbsz size of payload
+     * @return true if the report was written and published
+     */
+    bool to_storage(const char *filePrefix, const char *payload, size_t cbsz);
+
+    /**
+     * Write the payload locally as an LZ4 frame (see lz-codec.h), compressed as it is written.
+     * Takes about 50K of stack: not for signal handlers.
+     *
+     * @param filePrefix report type prefix ("crash-", "ex-", "anr-")
      * @param payload char buffer holding data
      * @param cbsz size of payload
+     * @return true if the report was written and published
+     */
+    bool to_compressed_storage(const char *filePrefix, const char *payload, size_t cbsz);
+
+    /**
+     * Compress a rendered report and append it to the report store (see report-store.h). A report
+     * the store can't take is written to a compressed report file instead. Not async-signal-safe.
+     *
+     * @param reportType report type prefix ("crash-", "ex-", "anr-")
+     * @param payload char buffer holding data
+     * @param cbsz size of payload
+     * @return true if the report was stored
+     */
+    bool to_report_store(const char *reportType, const char *payload, size_t cbsz);
+
+    /**
+     * Remove the hidden temporary files left in the report directory by a process killed while
+     * storing a report. A file written to in the last minute may be a report still being stored,
+     * and is left alone. Not async-signal-safe.
+     *
+     * @return number of files removed
+     */
+    int sweep_temporary_files();
+
+    /**
+     * Enable or disable fdatasync() of each report before it is published.
+     * Disabled by default: page cache contents survive the death of the process,
+     * and syncing lengthens the window in which a watchdog can kill the handler.
      */
-    bool to_storage(const char *filepath, const char *payload, size_t cbsz);
+    void set_sync_storage(bool sync);
 
 }   // namespace serializer
 
@@ -11,6 +11,9 @@
 #include "signal-utils.h"
 #include "backtrace.h"
 #include "serializer.h"
+#include "arena.h"
+#include "crash-helper.h"
+#include "jni/native-context.h"
 #include "signal-handler.h"
 
 typedef struct observed_signal {
@@ -72,11 +75,21 @@ void interceptor(int signo, siginfo_t *_siginfo, void *ucontext) {
         _LOGD("Observer for signal[%d] is intercepting [%d callers]", signal->signo,
               signal->intercepting);
 
-        char *buffer = new char[BACKTRACE_SZ_MAX];
-        if (collect_backtrace(buffer, BACKTRACE_SZ_MAX, _siginfo, _ucontext)) {
-            serializer::from_crash(buffer, std::strlen(buffer));
+        // Hand off to the helper process if there is one. Otherwise capture in-process, with
+        // no heap from here on: all capture storage comes from the pre-reserved arena
+        if (helper::request(_siginfo, _ucontext)) {
+            _LOGD("Signal[%d] reported by the crash helper", signo);
+        } else if (arena::acquire()) {
+            char *buffer = arena::alloc_array<char>(BACKTRACE_SZ_MAX);
+            size_t size = (buffer != nullptr) ?
+                          collect_crash_record(buffer, BACKTRACE_SZ_MAX, _siginfo, _ucontext) : 0;
+            if (size > 0) {
+                serializer::from_crash(buffer, size);
+            }
+            arena::release();
+        } else {
+            _LOGE("Crash arena is not available: signal[%d] will not be reported", signo);
         }
-        delete[] buffer;
 
         // Uninstall the custom handler prior to calling the previous sigaction (to prevent recursion)
         uninstall_handler();
@@ -153,9 +166,22 @@ bool signal_handler_initialize() {
 
         if (!sigutils::set_sigstack(&_stack, SIGSTKSZ * 2)) {
             _LOGE("Signal handlers are disabled: could not set the handler signal stack");
+            pthread_mutex_unlock(&mutex);
             return false;
         }
 
+        // Reserve the capture arena now, while the heap is known to be sane
+        if (!arena::initialize(BACKTRACE_ARENA_SZ_MAX)) {
+            _LOGE("Signal handlers are disabled: could not reserve the crash arena");
+            pthread_mutex_unlock(&mutex);
+            return false;
+        }
+
+        // Fork the crash helper now too, so crashes are processed outside the crashing process
+        if (jni::get_native_context().crashHelperEnabled && !helper::initialize()) {
+            _LOGW("Crash helper unavailable. Crashes will be processed in-process.");
+        }
+
         // Main thread does not block SIGQUIT by default.
         // Block it and start a new thread to handle all signals,
         // using the signal mask of the parent thread.
@@ -190,6 +216,8 @@ void signal_handler_shutdown() {
     if (0 == pthread_mutex_lock(&mutex)) {
         uninstall_handler();
         dealloc();
+        helper::shutdown();
+        arena::shutdown();
         if (0 == pthread_mutex_unlock(&mutex)) {
             _LOGI("The signal handler has shutdown");
             return;
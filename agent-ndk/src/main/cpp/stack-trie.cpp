@@ -0,0 +1,132 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include <agent-ndk.h>
+#include "module-index.h"
+#include "stack-trie.h"
+
+namespace trie {
+
+    void initialize(trie_t &trie, size_t node_max) {
+        trie.nodes.clear();
+        trie.nodes.push_back({UNKNOWN_MODULE, 0, NO_NODE, NO_NODE, 0});
+        trie.modules.clear();
+        trie.modules.push_back({0, ""});
+        trie.node_max = node_max;
+        trie.samples = 0;
+        trie.truncated = 0;
+    }
+
+    /**
+     * Key a pc by its module, adding the module to the trie's if it's the first frame in it
+     */
+    static void key_of(trie_t &trie, uintptr_t pc, uint32_t &module, uintptr_t &offset) {
+        const modules::module_t *found = modules::find(pc);
+        if (found == nullptr) {
+            module = UNKNOWN_MODULE;
+            offset = pc;
+            return;
+        }
+
+        offset = pc - found->start;
+        for (module = 1; module < trie.modules.size(); module++) {
+            if (trie.modules[module].start == found->start) {
+                return;
+            }
+        }
+
+        const char *slash = std::strrchr(found->path.c_str(), '/');
+        const char *name = (slash != nullptr) ? slash + 1 : found->path.c_str();
+        trie.modules.push_back({found->start, *name != '\0' ? name : "[unnamed]"});
+    }
+
+    bool insert(trie_t &trie, const uintptr_t *pcs, size_t pc_cnt) {
+        if (trie.nodes.empty()) {
+            return false;
+        }
+
+        uint32_t parent = 0;
+        bool complete = true;
+
+        // from the outermost frame in
+        for (size_t i = pc_cnt; i-- > 0;) {
+            uint32_t module;
+            uintptr_t offset;
+            key_of(trie, pcs[i], module, offset);
+
+            uint32_t child = trie.nodes[parent].first_child;
+            while (child != NO_NODE &&
+                   (trie.nodes[child].offset != offset || trie.nodes[child].module != module)) {
+                child = trie.nodes[child].next_sibling;
+            }
+
+            if (child == NO_NODE) {
+                if (trie.nodes.size() >= trie.node_max) {
+                    complete = false;
+                    break;
+                }
+                child = static_cast<uint32_t>(trie.nodes.size());
+                trie.nodes.push_back({module, offset, NO_NODE, trie.nodes[parent].first_child, 0});
+                trie.nodes[parent].first_child = child;
+            }
+            parent = child;
+        }
+
+        trie.nodes[parent].samples++;
+        trie.samples++;
+        if (!complete) {
+            trie.truncated++;
+        }
+
+        return complete;
+    }
+
+    static size_t write_node(const trie_t &trie, uint32_t index, std::string &path, std::string &out) {
+        const node_t &node = trie.nodes[index];
+        size_t path_len = path.size();
+        size_t lines = 0;
+
+        if (index != 0) {
+            char label[32];
+            path.append(path_len > 0 ? ";" : "");
+            if (node.module == UNKNOWN_MODULE) {
+                std::snprintf(label, sizeof(label), "0x%" PRIxPTR, node.offset);
+            } else {
+                path.append(trie.modules[node.module].name);
+                std::snprintf(label, sizeof(label), "+0x%" PRIxPTR, node.offset);
+            }
+            path.append(label);
+
+            if (node.samples > 0) {
+                out.append(path);
+                out.append(" ");
+                out.append(std::to_string(node.samples));
+                out.append("\n");
+                lines++;
+            }
+        }
+
+        for (uint32_t child = node.first_child; child != NO_NODE; child = trie.nodes[child].next_sibling) {
+            lines += write_node(trie, child, path, out);
+        }
+        path.resize(path_len);
+
+        return lines;
+    }
+
+    size_t write_folded(const trie_t &trie, std::string &out) {
+        if (trie.nodes.empty()) {
+            return 0;
+        }
+
+        std::string path;
+        return write_node(trie, 0, path, out);
+    }
+
+}   // namespace trie
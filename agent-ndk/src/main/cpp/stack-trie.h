@@ -0,0 +1,79 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_STACK_TRIE_H
+#define _AGENT_NDK_STACK_TRIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * Stack sample trie
+ *
+ * Sampled stacks are folded into a prefix tree, from the outermost frame in: stacks that share
+ * callers share nodes, so a profile costs a node per distinct call path rather than a copy of
+ * every sample. Each frame is keyed by its module and its pc relative to that module, which
+ * holds across launches and ASLR and can be symbolicated offline. Each node counts the samples
+ * taken with its frame innermost.
+ *
+ * The trie is written as folded stacks ("outer;...;inner count" per line), as flame graph and
+ * most profile viewers read them.
+ */
+namespace trie {
+
+    static const uint32_t NO_NODE = UINT32_MAX;
+    static const uint32_t UNKNOWN_MODULE = 0;
+
+    typedef struct node {
+        uint32_t module;            // index into the trie's modules
+        uintptr_t offset;           // pc relative to the module, or absolute in an unknown module
+        uint32_t first_child;
+        uint32_t next_sibling;
+        uint64_t samples;           // samples with this frame innermost
+
+    } node_t;
+
+    typedef struct module_ref {
+        uintptr_t start;            // where it is mapped
+        std::string name;           // file name, without its directory
+
+    } module_ref_t;
+
+    typedef struct trie {
+        std::vector<node_t> nodes;                  // nodes[0] is the root, above every outermost frame
+        std::vector<module_ref_t> modules;          // modules[0] holds the frames of unknown modules
+        size_t node_max;
+        uint64_t samples;
+        uint64_t truncated;                         // samples cut short when the trie was full
+
+    } trie_t;
+
+    /**
+     * Empty a trie, bounding its nodes
+     */
+    void initialize(trie_t &, size_t node_max);
+
+    /**
+     * Fold a stack into the trie. A stack that needs more nodes than are left is counted at
+     * the deepest node reached.
+     *
+     * @param pcs the stack's frames, innermost first, as unwound
+     * @return false if the stack was cut short
+     */
+    bool insert(trie_t &, const uintptr_t *pcs, size_t pc_cnt);
+
+    /**
+     * Append the trie as folded stacks, a line per node with samples. Frames are written as
+     * "module+0xoffset", or "0xpc" in an unknown module.
+     *
+     * @return number of lines written
+     */
+    size_t write_folded(const trie_t &, std::string &out);
+
+}   // namespace trie
+
+#endif // _AGENT_NDK_STACK_TRIE_H
@@ -0,0 +1,515 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "jni/native-context.h"
+#include "writer.h"
+#include "symbol-cache.h"
+
+namespace symcache {
+
+    static const uint32_t CACHE_MAGIC = 0x5953524e;     // "NRSY"
+    static const uint32_t CACHE_VERSION = 1;
+
+    // 8K entries of 32 bytes, and as many bytes of names: about half a megabyte on disk
+    static const size_t ENTRY_CNT = 8192;
+    static const size_t NAMES_SZ = 256 * 1024;
+    static const size_t HEADER_SZ = 64;
+    static const size_t CACHE_FILE_SZ = HEADER_SZ + ENTRY_CNT * 32 + NAMES_SZ;
+
+    // inserts are refused past this load, which bounds the probe sequences
+    static const size_t ENTRY_LOAD_MAX = ENTRY_CNT * 3 / 4;
+
+    // initialize() compacts a cache filled past half, down to a quarter
+    static const size_t COMPACT_THRESHOLD = 2;
+    static const size_t COMPACT_TARGET = 4;
+
+    static const uint64_t KEY_EMPTY = 0;
+    static const uint64_t KEY_CLAIMED = 1;
+
+    // pcs of entries other than frames: interned function names, keyed by the function's
+    // relative address, and module paths
+    static const uint64_t FUNCTION_PC = 1ULL << 63;
+    static const uint64_t PATH_PC = ~0ULL;
+
+    static const uint32_t NAME_NONE = ~0U;
+
+    static const char *CACHE_DIR = ".symbols";
+    static const char *CACHE_NAME = "symbols.cache";
+    static const char *CACHE_TEMP_NAME = "symbols.cache.tmp";
+
+    typedef struct cache_header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t entry_cnt;
+        uint32_t names_size;
+        uint32_t generation;        // launches that opened the cache
+        uint32_t used;              // entries claimed
+        uint32_t names_used;        // bytes of the name region allocated
+
+    } cache_header_t;
+
+    typedef struct entry {
+        uint64_t key;               // build-id hash once published, or KEY_EMPTY/KEY_CLAIMED
+        uint64_t pc;
+        uint32_t name;              // offset into the name region
+        uint32_t offset;            // pc - symbol address
+        uint32_t stamp;             // generation of the last insert or lookup
+        uint32_t reserved;
+
+    } entry_t;
+
+    static_assert(sizeof(cache_header_t) <= HEADER_SZ, "cache header overflows its padding");
+    static_assert(sizeof(entry_t) == 32, "cache entries are 32 bytes");
+
+    /**
+     * A view of a cache image: the mapped file, or a compacted copy being built
+     */
+    typedef struct table {
+        cache_header_t *header;
+        entry_t *entries;
+        char *names;
+
+    } table_t;
+
+    static std::atomic<char *> cache_map(nullptr);
+    static int cache_fd = -1;
+    static uint32_t generation = 0;
+
+    static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    static table_t view(char *image) {
+        return {reinterpret_cast<cache_header_t *>(image),
+                reinterpret_cast<entry_t *>(image + HEADER_SZ),
+                image + HEADER_SZ + ENTRY_CNT * sizeof(entry_t)};
+    }
+
+    static bool cache_path(char *path, size_t size, const char *name) {
+        writer_t writer = {};
+        writer::to_buffer(writer, path, size - 1);
+        writer::put_cstr(writer, jni::get_native_context().reportPathAbsolute);
+        writer::put_char(writer, '/');
+        writer::put_cstr(writer, CACHE_DIR);
+        if (name != nullptr) {
+            writer::put_char(writer, '/');
+            writer::put_cstr(writer, name);
+        }
+        path[writer.length] = '\0';
+        return writer::ok(writer);
+    }
+
+    /**
+     * FNV-1a of the hex build-id, clear of the reserved keys
+     * @return 0 if the module has no build-id
+     */
+    static uint64_t module_key(const char *build_id) {
+        if (build_id == nullptr || *build_id == '\0') {
+            return 0;
+        }
+
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (const char *c = build_id; *c != '\0'; c++) {
+            hash = (hash ^ static_cast<uint8_t>(*c)) * 0x100000001b3ULL;
+        }
+        return (hash > KEY_CLAIMED) ? hash : hash + 2;
+    }
+
+    static size_t slot_of(uint64_t key, uint64_t pc) {
+        uint64_t hash = key ^ (pc * 0x9e3779b97f4a7c15ULL);
+        hash ^= hash >> 29;
+        return static_cast<size_t>(hash) & (ENTRY_CNT - 1);
+    }
+
+    /**
+     * @return the NUL-terminated name at an offset, or null if it runs out of the region
+     */
+    static const char *name_at(const table_t &table, uint32_t name) {
+        if (name >= NAMES_SZ) {
+            return nullptr;
+        }
+        const char *at = table.names + name;
+        return (memchr(at, '\0', NAMES_SZ - name) != nullptr) ? at : nullptr;
+    }
+
+    /**
+     * Find a published entry. Lock-free.
+     */
+    static const entry_t *find(const table_t &table, uint64_t key, uint64_t pc) {
+        size_t slot = slot_of(key, pc);
+
+        for (size_t probe = 0; probe < ENTRY_CNT; probe++) {
+            const entry_t &entry = table.entries[(slot + probe) & (ENTRY_CNT - 1)];
+            uint64_t entry_key = __atomic_load_n(&entry.key, __ATOMIC_ACQUIRE);
+            if (entry_key == KEY_EMPTY) {
+                return nullptr;
+            }
+            if (entry_key == key && entry.pc == pc) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Claim, fill and publish an entry. Lock-free.
+     */
+    static bool put(table_t &table, uint64_t key, uint64_t pc, uint32_t name, uint32_t offset, uint32_t stamp) {
+        size_t slot = slot_of(key, pc);
+
+        for (size_t probe = 0; probe < ENTRY_CNT; probe++) {
+            if (__atomic_load_n(&table.header->used, __ATOMIC_RELAXED) >= ENTRY_LOAD_MAX) {
+                return false;
+            }
+
+            entry_t &entry = table.entries[(slot + probe) & (ENTRY_CNT - 1)];
+            uint64_t entry_key = KEY_EMPTY;
+            if (__atomic_compare_exchange_n(&entry.key, &entry_key, KEY_CLAIMED, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+                __atomic_fetch_add(&table.header->used, 1, __ATOMIC_RELAXED);
+                entry.pc = pc;
+                entry.name = name;
+                entry.offset = offset;
+                entry.stamp = stamp;
+                __atomic_store_n(&entry.key, key, __ATOMIC_RELEASE);
+                return true;
+            }
+
+            // another writer got here first, maybe with the same entry
+            if (entry_key == key && entry.pc == pc) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Copy a name into the name region. Lock-free.
+     * @return its offset, or NAME_NONE if the region is full
+     */
+    static uint32_t alloc_name(table_t &table, const char *name, size_t max) {
+        if (__atomic_load_n(&table.header->names_used, __ATOMIC_RELAXED) >= NAMES_SZ) {
+            return NAME_NONE;
+        }
+
+        size_t len = strnlen(name, max - 1);
+        uint32_t at = __atomic_fetch_add(&table.header->names_used, static_cast<uint32_t>(len + 1), __ATOMIC_RELAXED);
+        if (at > NAMES_SZ || len + 1 > NAMES_SZ - at) {
+            return NAME_NONE;
+        }
+
+        memcpy(table.names + at, name, len);
+        table.names[at + len] = '\0';
+        return at;
+    }
+
+    /**
+     * The offset of a function's name, stored once per function
+     */
+    static uint32_t intern(table_t &table, uint64_t key, uint64_t function, const char *name, uint32_t stamp) {
+        const entry_t *entry = find(table, key, FUNCTION_PC | function);
+        if (entry != nullptr && name_at(table, entry->name) != nullptr) {
+            return entry->name;
+        }
+
+        uint32_t at = alloc_name(table, name, sizeof(stackframe_t::sym_name));
+        if (at != NAME_NONE) {
+            put(table, key, FUNCTION_PC | function, at, 0, stamp);
+        }
+        return at;
+    }
+
+    static bool insert_frame(table_t &table, uint64_t key, uint64_t pc, const char *name, uint64_t offset,
+                             uint32_t stamp) {
+        if (offset > pc || offset > UINT32_MAX || pc >= FUNCTION_PC) {
+            return false;
+        }
+        if (find(table, key, pc) != nullptr) {
+            return true;
+        }
+
+        uint32_t at = intern(table, key, pc - offset, name, stamp);
+        return at != NAME_NONE && put(table, key, pc, at, static_cast<uint32_t>(offset), stamp);
+    }
+
+    static bool insert_module_path(table_t &table, uint64_t key, const char *path, uint32_t stamp) {
+        if (find(table, key, PATH_PC) != nullptr) {
+            return true;
+        }
+
+        uint32_t at = alloc_name(table, path, PATH_MAX);
+        return at != NAME_NONE && put(table, key, PATH_PC, at, 0, stamp);
+    }
+
+    static void reset(table_t &table) {
+        memset(table.header, 0, CACHE_FILE_SZ);
+        table.header->magic = CACHE_MAGIC;
+        table.header->version = CACHE_VERSION;
+        table.header->entry_cnt = ENTRY_CNT;
+        table.header->names_size = NAMES_SZ;
+    }
+
+    static bool valid(const cache_header_t &header) {
+        return header.magic == CACHE_MAGIC && header.version == CACHE_VERSION &&
+               header.entry_cnt == ENTRY_CNT && header.names_size == NAMES_SZ &&
+               header.used <= ENTRY_CNT;
+    }
+
+    static bool needs_compaction(const cache_header_t &header) {
+        return header.used > ENTRY_CNT / COMPACT_THRESHOLD || header.names_used > NAMES_SZ / COMPACT_THRESHOLD;
+    }
+
+    static bool write_file(const char *path, const char *data, size_t size) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            return false;
+        }
+
+        size_t pos = 0;
+        while (pos < size) {
+            ssize_t cnt = write(fd, data + pos, size - pos);
+            if (cnt < 0 && errno == EINTR) {
+                continue;
+            }
+            if (cnt <= 0) {
+                break;
+            }
+            pos += cnt;
+        }
+        return (close(fd) == 0) && pos == size;
+    }
+
+    /**
+     * Rebuild the cache file from its most recently used entries, and replace it.
+     * Processes still mapping the old file keep reading (and writing) their copy.
+     */
+    static bool compact(const table_t &from) {
+        std::vector<const entry_t *> frames;
+        std::vector<const entry_t *> paths;
+
+        for (size_t i = 0; i < ENTRY_CNT; i++) {
+            const entry_t &entry = from.entries[i];
+            if (entry.key <= KEY_CLAIMED || name_at(from, entry.name) == nullptr) {
+                continue;
+            }
+            if (entry.pc == PATH_PC) {
+                paths.push_back(&entry);
+            } else if (entry.pc < FUNCTION_PC) {
+                frames.push_back(&entry);
+            }
+        }
+
+        // newest first; function names are interned again as the frames are copied
+        std::stable_sort(frames.begin(), frames.end(), [](const entry_t *a, const entry_t *b) {
+            return a->stamp > b->stamp;
+        });
+
+        std::vector<char> image(CACHE_FILE_SZ);
+        table_t to = view(image.data());
+        reset(to);
+        to.header->generation = from.header->generation;
+
+        std::vector<uint64_t> kept;
+        for (auto entry: frames) {
+            if (to.header->used >= ENTRY_CNT / COMPACT_TARGET || to.header->names_used >= NAMES_SZ / COMPACT_TARGET) {
+                break;
+            }
+            if (insert_frame(to, entry->key, entry->pc, name_at(from, entry->name), entry->offset, entry->stamp)) {
+                kept.push_back(entry->key);
+            }
+        }
+
+        // the paths of modules with frames left
+        std::sort(kept.begin(), kept.end());
+        for (auto entry: paths) {
+            if (std::binary_search(kept.begin(), kept.end(), entry->key)) {
+                insert_module_path(to, entry->key, name_at(from, entry->name), entry->stamp);
+            }
+        }
+
+        char path[PATH_MAX];
+        char temp_path[PATH_MAX];
+        if (!cache_path(path, sizeof(path), CACHE_NAME) || !cache_path(temp_path, sizeof(temp_path), CACHE_TEMP_NAME)) {
+            return false;
+        }
+        if (!write_file(temp_path, image.data(), image.size()) || rename(temp_path, path) != 0) {
+            _LOGE_POSIX("symcache: could not compact the symbol cache");
+            unlink(temp_path);
+            return false;
+        }
+
+        _LOGD("symcache: compacted %u entries to %u", from.header->used, to.header->used);
+        return true;
+    }
+
+    /**
+     * Open, allocate and map the cache file, resetting it if it's not a cache of this version
+     */
+    static char *open_cache(int &fd) {
+        char path[PATH_MAX];
+        if (!cache_path(path, sizeof(path), CACHE_NAME)) {
+            return nullptr;
+        }
+
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd == -1) {
+            _LOGE_POSIX("symcache: could not open the symbol cache");
+            return nullptr;
+        }
+
+        // Reserve the blocks now, so a full disk can't SIGBUS an insert
+        if (fallocate(fd, 0, 0, CACHE_FILE_SZ) != 0) {
+            _LOGW("symcache: could not allocate the symbol cache: %s", strerror(errno));
+            close(fd);
+            fd = -1;
+            return nullptr;
+        }
+
+        void *map = mmap(nullptr, CACHE_FILE_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            _LOGE_POSIX("symcache: could not map the symbol cache");
+            close(fd);
+            fd = -1;
+            return nullptr;
+        }
+
+        table_t table = view(static_cast<char *>(map));
+        if (!valid(*table.header)) {
+            reset(table);
+        }
+        return static_cast<char *>(map);
+    }
+
+    static void close_cache(char *map, int &fd) {
+        munmap(map, CACHE_FILE_SZ);
+        close(fd);
+        fd = -1;
+    }
+
+    bool initialize() {
+        char path[PATH_MAX];
+
+        pthread_mutex_lock(&cache_mutex);
+
+        char *map = cache_map.load(std::memory_order_acquire);
+        if (map == nullptr && cache_path(path, sizeof(path), nullptr) &&
+            (mkdir(path, 0700) == 0 || errno == EEXIST)) {
+            int fd = -1;
+            map = open_cache(fd);
+            if (map != nullptr && needs_compaction(*view(map).header) && compact(view(map))) {
+                close_cache(map, fd);
+                map = open_cache(fd);
+            }
+
+            if (map != nullptr) {
+                generation = __atomic_add_fetch(&view(map).header->generation, 1, __ATOMIC_RELAXED);
+                cache_fd = fd;
+                cache_map.store(map, std::memory_order_release);
+            }
+        }
+
+        pthread_mutex_unlock(&cache_mutex);
+
+        return map != nullptr;
+    }
+
+    void shutdown() {
+        pthread_mutex_lock(&cache_mutex);
+        char *map = cache_map.exchange(nullptr, std::memory_order_acq_rel);
+        if (map != nullptr) {
+            close_cache(map, cache_fd);
+        }
+        pthread_mutex_unlock(&cache_mutex);
+    }
+
+    bool available() {
+        return cache_map.load(std::memory_order_acquire) != nullptr;
+    }
+
+    /**
+     * Mark an entry as used in this generation, dirtying its page only once per launch
+     */
+    static void touch(const entry_t &entry) {
+        entry_t &used = const_cast<entry_t &>(entry);
+        if (__atomic_load_n(&used.stamp, __ATOMIC_RELAXED) != generation) {
+            __atomic_store_n(&used.stamp, generation, __ATOMIC_RELAXED);
+        }
+    }
+
+    bool lookup(const char *build_id, uintptr_t pc, stackframe_t &stackframe) {
+        char *map = cache_map.load(std::memory_order_acquire);
+        uint64_t key = module_key(build_id);
+        if (map == nullptr || key == 0) {
+            return false;
+        }
+
+        table_t table = view(map);
+        const entry_t *entry = find(table, key, pc);
+        const char *name = (entry != nullptr) ? name_at(table, entry->name) : nullptr;
+        if (name == nullptr) {
+            return false;
+        }
+
+        touch(*entry);
+        strncpy(stackframe.sym_name, name, sizeof(stackframe.sym_name) - 1);
+        stackframe.sym_name[sizeof(stackframe.sym_name) - 1] = '\0';
+        stackframe.sym_addr_offset = entry->offset;
+        stackframe.sym_addr = stackframe.address - entry->offset;
+        return true;
+    }
+
+    bool insert(const char *build_id, uintptr_t pc, const stackframe_t &stackframe) {
+        char *map = cache_map.load(std::memory_order_acquire);
+        uint64_t key = module_key(build_id);
+        if (map == nullptr || key == 0 || stackframe.sym_name[0] == '\0') {
+            return false;
+        }
+
+        table_t table = view(map);
+        return insert_frame(table, key, pc, stackframe.sym_name, stackframe.sym_addr_offset, generation);
+    }
+
+    bool lookup_path(const char *build_id, char *path, size_t size) {
+        char *map = cache_map.load(std::memory_order_acquire);
+        uint64_t key = module_key(build_id);
+        if (map == nullptr || key == 0 || size == 0) {
+            return false;
+        }
+
+        table_t table = view(map);
+        const entry_t *entry = find(table, key, PATH_PC);
+        const char *name = (entry != nullptr) ? name_at(table, entry->name) : nullptr;
+        if (name == nullptr) {
+            return false;
+        }
+
+        touch(*entry);
+        strncpy(path, name, size - 1);
+        path[size - 1] = '\0';
+        return true;
+    }
+
+    bool insert_path(const char *build_id, const char *path) {
+        char *map = cache_map.load(std::memory_order_acquire);
+        uint64_t key = module_key(build_id);
+        if (map == nullptr || key == 0 || path == nullptr || *path == '\0') {
+            return false;
+        }
+
+        table_t table = view(map);
+        return insert_module_path(table, key, path, generation);
+    }
+
+}   // namespace symcache
@@ -0,0 +1,82 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_SYMBOL_CACHE_H
+#define _AGENT_NDK_SYMBOL_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+
+/**
+ * Persistent symbol cache
+ *
+ * A fixed-size, open-addressed hash table in a file under the report directory, mapped
+ * MAP_SHARED, that maps (module build-id, pc relative to the module base) to a demangled
+ * symbol name and the pc's offset into it. It survives launches, so frames in hot code
+ * seen by an earlier report are named without reading symbol tables or demangling.
+ *
+ * Entries are only ever appended: a writer claims an empty entry with a CAS, fills it,
+ * then publishes its key, so lookups are lock-free reads and both are async-signal-safe.
+ * Names are interned per function. Modules without a build-id are never cached.
+ *
+ * Each launch is a new generation, and lookups stamp the entries they hit with it. When
+ * the table or its names fill past a threshold, initialize() rebuilds the file keeping the
+ * most recently used entries, and replaces it atomically.
+ */
+namespace symcache {
+
+    /**
+     * Open (creating or compacting if needed) and map the cache file, and start a new
+     * generation. Does nothing if the cache is already open. Call from a healthy thread.
+     *
+     * @return true if the cache is available
+     */
+    bool initialize();
+
+    /**
+     * Unmap and close the cache file
+     */
+    void shutdown();
+
+    /**
+     * @return true if the cache is mapped. Async-signal-safe.
+     */
+    bool available();
+
+    /**
+     * Name a frame from the cache: sets the stackframe's symbol name, address and offset.
+     * Async-signal-safe.
+     *
+     * @param pc address relative to the module's base
+     * @return false on a miss, or if the module has no build-id
+     */
+    bool lookup(const char *build_id, uintptr_t pc, stackframe_t &);
+
+    /**
+     * Record the symbol a frame was resolved to. Async-signal-safe.
+     *
+     * @param pc address relative to the module's base
+     * @return false if the frame has no symbol, the module has no build-id, or the cache is full
+     */
+    bool insert(const char *build_id, uintptr_t pc, const stackframe_t &);
+
+    /**
+     * Find the path a module was reported under. Async-signal-safe.
+     *
+     * @return false on a miss
+     */
+    bool lookup_path(const char *build_id, char *path, size_t size);
+
+    /**
+     * Record the path a module is reported under. Async-signal-safe.
+     */
+    bool insert_path(const char *build_id, const char *path);
+
+}   // namespace symcache
+
+#endif // _AGENT_NDK_SYMBOL_CACHE_H
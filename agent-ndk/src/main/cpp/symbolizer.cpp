@@ -0,0 +1,592 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include <agent-ndk.h>
+#include "symbolizer.h"
+#include "module-index.h"
+#include "demangler.h"
+#include "xz-decoder.h"
+
+namespace symbolizer {
+
+#if defined(__LP64__)
+    static const unsigned char ELF_CLASS = ELFCLASS64;
+#else
+    static const unsigned char ELF_CLASS = ELFCLASS32;
+#endif
+
+    // Zip signatures and fixed record sizes (APPNOTE.TXT 4.3)
+    static const uint32_t ZIP_EOCD_SIG = 0x06054b50;
+    static const uint32_t ZIP_CDIR_SIG = 0x02014b50;
+    static const uint32_t ZIP_LOCAL_SIG = 0x04034b50;
+    static const size_t ZIP_EOCD_SZ = 22;
+    static const size_t ZIP_CDIR_SZ = 46;
+    static const size_t ZIP_LOCAL_SZ = 30;
+    static const size_t ZIP_COMMENT_MAX = 0xffff;
+
+    // function indexes are few (one per module a frame was seen in) and never released early
+    static const size_t FUNCTION_INDEXES_MAX = 256;
+
+    // MiniDebugInfo is a stripped symbol table: a few MB at most, even for libart
+    static const size_t MINI_DEBUG_INFO_MAX = 64 * 1024 * 1024;
+
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+
+    static std::atomic<function_index_t *> function_indexes[FUNCTION_INDEXES_MAX];
+    static std::atomic<size_t> function_index_cnt(0);
+    static std::mutex function_index_mutex;
+
+    static bool read_at(int fd, void *data, size_t size, off_t offset) {
+        char *bytes = static_cast<char *>(data);
+        while (size > 0) {
+            ssize_t cnt = pread(fd, bytes, size, offset);
+            if (cnt < 0 && errno == EINTR) {
+                continue;
+            }
+            if (cnt <= 0) {
+                return false;
+            }
+            bytes += cnt;
+            size -= cnt;
+            offset += cnt;
+        }
+        return true;
+    }
+
+    static uint16_t le16(const unsigned char *p) {
+        return p[0] | (p[1] << 8);
+    }
+
+    static uint32_t le32(const unsigned char *p) {
+        return le16(p) | (static_cast<uint32_t>(le16(p + 2)) << 16);
+    }
+
+    /**
+     * Find a stored zip entry, by name, or by the offset its data begins at if name is null.
+     * The linker reports libraries loaded from an APK as "<apk>!/<entry>".
+     */
+    static bool zip_find(int fd, const char *name, uintptr_t &data_offset, std::string &entry_name) {
+        off_t file_size = lseek(fd, 0, SEEK_END);
+        if (file_size < static_cast<off_t>(ZIP_EOCD_SZ)) {
+            return false;
+        }
+
+        // the end of central directory record is followed by a comment of up to 64k
+        size_t tail_size = std::min(static_cast<size_t>(file_size), ZIP_EOCD_SZ + ZIP_COMMENT_MAX);
+        std::vector<unsigned char> tail(tail_size);
+        if (!read_at(fd, tail.data(), tail_size, file_size - tail_size)) {
+            return false;
+        }
+
+        const unsigned char *eocd = nullptr;
+        for (size_t i = tail_size - ZIP_EOCD_SZ + 1; i-- > 0;) {
+            if (le32(&tail[i]) == ZIP_EOCD_SIG) {
+                eocd = &tail[i];
+                break;
+            }
+        }
+        if (eocd == nullptr) {
+            return false;
+        }
+
+        size_t entry_cnt = le16(eocd + 10);
+        size_t cdir_size = le32(eocd + 12);
+        off_t cdir_offset = le32(eocd + 16);
+        std::vector<unsigned char> cdir(cdir_size);
+        if (!read_at(fd, cdir.data(), cdir_size, cdir_offset)) {
+            return false;
+        }
+
+        size_t name_len = (name != nullptr) ? std::strlen(name) : 0;
+        size_t pos = 0;
+        for (size_t i = 0; i < entry_cnt && pos + ZIP_CDIR_SZ <= cdir_size; i++) {
+            const unsigned char *entry = &cdir[pos];
+            if (le32(entry) != ZIP_CDIR_SIG) {
+                return false;
+            }
+
+            size_t entry_name_len = le16(entry + 28);
+            size_t entry_size = ZIP_CDIR_SZ + entry_name_len + le16(entry + 30) + le16(entry + 32);
+            if (pos + ZIP_CDIR_SZ + entry_name_len > cdir_size) {
+                return false;
+            }
+
+            const char *entry_name_at = reinterpret_cast<const char *>(entry + ZIP_CDIR_SZ);
+            off_t local_offset = le32(entry + 42);
+            bool candidate = (name != nullptr)
+                             ? (entry_name_len == name_len && le16(entry + 10) == 0 &&
+                                std::memcmp(entry_name_at, name, name_len) == 0)
+                             : local_offset < static_cast<off_t>(data_offset);
+
+            // the entry's data follows its local header, whose extra field may differ in length
+            unsigned char local[ZIP_LOCAL_SZ];
+            if (candidate &&
+                read_at(fd, local, sizeof(local), local_offset) &&
+                le32(local) == ZIP_LOCAL_SIG) {
+                uintptr_t offset = local_offset + ZIP_LOCAL_SZ + le16(local + 26) + le16(local + 28);
+                if (name != nullptr || offset == data_offset) {
+                    data_offset = offset;
+                    entry_name.assign(entry_name_at, entry_name_len);
+                    return true;
+                }
+            }
+
+            pos += entry_size;
+        }
+
+        return false;
+    }
+
+    bool load(const char *path, uintptr_t file_offset, const char *build_id, elf_image_t &image) {
+        image.path = path;
+        image.min_vaddr = 0;
+        image.symbols.clear();
+        image.strings.clear();
+        image.functions = nullptr;
+        image.valid = false;
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+
+        ElfW(Ehdr) ehdr = {};
+        if (!read_at(fd, &ehdr, sizeof(ehdr), file_offset) ||
+            std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+            ehdr.e_ident[EI_CLASS] != ELF_CLASS ||
+            ehdr.e_phentsize != sizeof(ElfW(Phdr))) {
+            close(fd);
+            return false;
+        }
+
+        std::vector<ElfW(Phdr)> phdrs(ehdr.e_phnum);
+        if (!read_at(fd, phdrs.data(), phdrs.size() * sizeof(ElfW(Phdr)), file_offset + ehdr.e_phoff)) {
+            close(fd);
+            return false;
+        }
+
+        // the linker maps the image at a base page-aligned below the lowest loadable vaddr
+        uintptr_t min_vaddr = UINTPTR_MAX;
+        for (auto &phdr: phdrs) {
+            if (phdr.p_type == PT_LOAD && phdr.p_vaddr < min_vaddr) {
+                min_vaddr = phdr.p_vaddr;
+            }
+        }
+        if (min_vaddr == UINTPTR_MAX) {
+            close(fd);
+            return false;
+        }
+        image.min_vaddr = min_vaddr & ~(static_cast<uintptr_t>(getpagesize()) - 1);
+        image.valid = true;
+
+        if (file_offset != 0) {
+            std::string entry;
+            uintptr_t data_offset = file_offset;
+            if (zip_find(fd, nullptr, data_offset, entry)) {
+                image.path.append("!/").append(entry);
+            }
+        }
+
+        // the dynamic symbol table, as searched by dladdr()
+        if (ehdr.e_shentsize == sizeof(ElfW(Shdr)) && ehdr.e_shnum > 0) {
+            std::vector<ElfW(Shdr)> shdrs(ehdr.e_shnum);
+            if (read_at(fd, shdrs.data(), shdrs.size() * sizeof(ElfW(Shdr)), file_offset + ehdr.e_shoff)) {
+                for (auto &shdr: shdrs) {
+                    if (shdr.sh_type != SHT_DYNSYM || shdr.sh_link >= shdrs.size()) {
+                        continue;
+                    }
+
+                    const ElfW(Shdr) &strtab = shdrs[shdr.sh_link];
+                    image.symbols.resize(shdr.sh_size / sizeof(ElfW(Sym)));
+                    image.strings.resize(strtab.sh_size);
+                    if (!read_at(fd, image.symbols.data(), image.symbols.size() * sizeof(ElfW(Sym)),
+                                 file_offset + shdr.sh_offset) ||
+                        !read_at(fd, &image.strings[0], image.strings.size(),
+                                 file_offset + strtab.sh_offset)) {
+                        image.symbols.clear();
+                        image.strings.clear();
+                    }
+                    break;
+                }
+            }
+        }
+
+        close(fd);
+
+        image.functions = load_functions(path, file_offset, build_id);
+
+        return true;
+    }
+
+    static void set_symbol(stackframe_t &stackframe, const char *symbol) {
+        if (!demangler::demangle(symbol, stackframe.sym_name, sizeof(stackframe.sym_name))) {
+            std::strncpy(stackframe.sym_name, symbol, sizeof(stackframe.sym_name) - 1);
+        }
+    }
+
+    void resolve(const elf_image_t &image, uintptr_t base, size_t index, uintptr_t address,
+                 stackframe_t &stackframe) {
+        stackframe.index = index;
+        stackframe.address = address;
+
+        if (!image.valid) {
+            return;
+        }
+
+        std::strncpy(stackframe.so_path, image.path.c_str(), sizeof(stackframe.so_path) - 1);
+        stackframe.so_base = base;
+        stackframe.pc = address - base;
+
+        uintptr_t load_bias = base - image.min_vaddr;
+        uintptr_t soaddr = address - load_bias;
+
+        for (auto &sym: image.symbols) {
+            unsigned char bind = sym.st_info >> 4;     // ELF32_ST_BIND == ELF64_ST_BIND
+            if ((bind != STB_GLOBAL && bind != STB_WEAK) || sym.st_shndx == SHN_UNDEF) {
+                continue;
+            }
+            if (soaddr < sym.st_value || soaddr >= sym.st_value + sym.st_size) {
+                continue;
+            }
+            if (sym.st_name >= image.strings.size()) {
+                break;
+            }
+
+            set_symbol(stackframe, image.strings.c_str() + sym.st_name);
+            stackframe.sym_addr = load_bias + sym.st_value;
+            stackframe.sym_addr_offset = address - stackframe.sym_addr;
+            return;
+        }
+
+        const function_t *function = (image.functions != nullptr) ? lookup(*image.functions, soaddr) : nullptr;
+        if (function != nullptr) {
+            set_symbol(stackframe, image.functions->names.c_str() + function->name);
+            stackframe.sym_addr = load_bias + function->start;
+            stackframe.sym_addr_offset = address - stackframe.sym_addr;
+        }
+    }
+
+    bool read_build_id(const void *notes, size_t size, char *build_id, size_t build_id_size) {
+        const char *bytes = static_cast<const char *>(notes);
+        size_t pos = 0;
+
+        while (pos + sizeof(ElfW(Nhdr)) <= size) {
+            const ElfW(Nhdr) *note = reinterpret_cast<const ElfW(Nhdr) *>(bytes + pos);
+            size_t name_at = pos + sizeof(ElfW(Nhdr));
+            size_t desc_at = name_at + ((note->n_namesz + 3) & ~3u);
+            size_t next = desc_at + ((note->n_descsz + 3) & ~3u);
+            if (next > size) {
+                return false;
+            }
+
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                std::memcmp(bytes + name_at, "GNU", 4) == 0 && build_id_size > 0) {
+                const unsigned char *desc = reinterpret_cast<const unsigned char *>(bytes + desc_at);
+                size_t len = std::min(static_cast<size_t>(note->n_descsz), (build_id_size - 1) / 2);
+                for (size_t i = 0; i < len; i++) {
+                    build_id[i * 2] = HEX_DIGITS[desc[i] >> 4];
+                    build_id[i * 2 + 1] = HEX_DIGITS[desc[i] & 0xf];
+                }
+                build_id[len * 2] = '\0';
+                return true;
+            }
+            pos = next;
+        }
+        return false;
+    }
+
+    /**
+     * Bounds-checked section headers of an ELF image in memory
+     */
+    typedef struct elf_sections {
+        const uint8_t *data;
+        size_t size;
+        const ElfW(Shdr) *shdrs;
+        size_t shdr_cnt;
+        const ElfW(Shdr) *names;    // section name string table, or null
+
+    } elf_sections_t;
+
+    static bool in_bounds(const elf_sections_t &elf, const ElfW(Shdr) &shdr) {
+        return shdr.sh_type != SHT_NOBITS && shdr.sh_offset <= elf.size && shdr.sh_size <= elf.size - shdr.sh_offset;
+    }
+
+    static bool read_sections(const uint8_t *data, size_t size, elf_sections_t &elf) {
+        elf = {data, size, nullptr, 0, nullptr};
+        if (size < sizeof(ElfW(Ehdr))) {
+            return false;
+        }
+
+        const ElfW(Ehdr) *ehdr = reinterpret_cast<const ElfW(Ehdr) *>(data);
+        if (std::memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELF_CLASS ||
+            ehdr->e_shentsize != sizeof(ElfW(Shdr)) || ehdr->e_shoff > size ||
+            ehdr->e_shnum > (size - ehdr->e_shoff) / sizeof(ElfW(Shdr))) {
+            return false;
+        }
+
+        elf.shdrs = reinterpret_cast<const ElfW(Shdr) *>(data + ehdr->e_shoff);
+        elf.shdr_cnt = ehdr->e_shnum;
+        if (ehdr->e_shstrndx < elf.shdr_cnt && in_bounds(elf, elf.shdrs[ehdr->e_shstrndx])) {
+            elf.names = &elf.shdrs[ehdr->e_shstrndx];
+        }
+        return true;
+    }
+
+    static const ElfW(Shdr) *find_section(const elf_sections_t &elf, ElfW(Word) type, const char *name = nullptr) {
+        for (size_t i = 0; i < elf.shdr_cnt; i++) {
+            const ElfW(Shdr) &shdr = elf.shdrs[i];
+            if (shdr.sh_type != type || !in_bounds(elf, shdr)) {
+                continue;
+            }
+            if (name == nullptr) {
+                return &shdr;
+            }
+            if (elf.names != nullptr && shdr.sh_name < elf.names->sh_size) {
+                const char *section_name = reinterpret_cast<const char *>(elf.data + elf.names->sh_offset + shdr.sh_name);
+                size_t max = elf.names->sh_size - shdr.sh_name;
+                if (strnlen(section_name, max) < max && std::strcmp(section_name, name) == 0) {
+                    return &shdr;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * A function symbol, ranked to pick one name among aliases
+     */
+    typedef struct candidate {
+        function_t function;
+        bool global;
+
+    } candidate_t;
+
+    static void add_functions(const elf_sections_t &elf, const ElfW(Shdr) &symtab, function_index_t &index,
+                              std::vector<candidate_t> &candidates) {
+        if (symtab.sh_link >= elf.shdr_cnt || !in_bounds(elf, elf.shdrs[symtab.sh_link])) {
+            return;
+        }
+
+        const ElfW(Shdr) &strtab = elf.shdrs[symtab.sh_link];
+        const char *strings = reinterpret_cast<const char *>(elf.data + strtab.sh_offset);
+        const ElfW(Sym) *symbols = reinterpret_cast<const ElfW(Sym) *>(elf.data + symtab.sh_offset);
+        size_t symbol_cnt = symtab.sh_size / sizeof(ElfW(Sym));
+
+        for (size_t i = 0; i < symbol_cnt; i++) {
+            const ElfW(Sym) &sym = symbols[i];
+            unsigned char type = sym.st_info & 0xf;     // ELF32_ST_TYPE == ELF64_ST_TYPE
+            unsigned char bind = sym.st_info >> 4;
+            if ((type != STT_FUNC && type != STT_GNU_IFUNC) || sym.st_shndx == SHN_UNDEF || sym.st_value == 0 ||
+                sym.st_name >= strtab.sh_size) {
+                continue;
+            }
+
+            const char *name = strings + sym.st_name;
+            size_t name_len = strnlen(name, strtab.sh_size - sym.st_name);
+            if (name_len == 0 || name_len == strtab.sh_size - sym.st_name ||
+                index.names.size() + name_len + 1 > UINT32_MAX) {
+                continue;
+            }
+
+            uintptr_t start = sym.st_value;
+#if defined(__arm__)
+            // the Thumb bit
+            start &= ~static_cast<uintptr_t>(1);
+#endif
+            candidate_t candidate = {{start, static_cast<uint32_t>(std::min<uint64_t>(sym.st_size, UINT32_MAX)),
+                                      static_cast<uint32_t>(index.names.size())},
+                                     bind == STB_GLOBAL || bind == STB_WEAK};
+            candidates.push_back(candidate);
+            index.names.append(name, name_len + 1);
+        }
+    }
+
+    /**
+     * Index the function symbols of the ELF image at offset in a mapped file
+     */
+    static bool index_functions(const uint8_t *data, size_t size, const char *build_id, function_index_t &index) {
+        elf_sections_t elf;
+        if (!read_sections(data, size, elf)) {
+            return false;
+        }
+
+        if (build_id != nullptr && *build_id != '\0') {
+            char image_build_id[modules::BUILD_ID_MAX * 2 + 1] = {};
+            const ElfW(Shdr) *notes = find_section(elf, SHT_NOTE, ".note.gnu.build-id");
+            if (notes == nullptr ||
+                !read_build_id(data + notes->sh_offset, notes->sh_size, image_build_id, sizeof(image_build_id)) ||
+                std::strcmp(image_build_id, build_id) != 0) {
+                _LOGD("symbolizer: %s does not match build-id %s", index.path.c_str(), build_id);
+                return false;
+            }
+        }
+
+        // .symtab holds every .dynsym function, unless stripped: MiniDebugInfo then holds the rest
+        std::vector<candidate_t> candidates;
+        const ElfW(Shdr) *symtab = find_section(elf, SHT_SYMTAB);
+        if (symtab == nullptr) {
+            symtab = find_section(elf, SHT_DYNSYM);
+        }
+        if (symtab != nullptr) {
+            add_functions(elf, *symtab, index, candidates);
+        }
+
+        const ElfW(Shdr) *debugdata = find_section(elf, SHT_PROGBITS, ".gnu_debugdata");
+        std::vector<uint8_t> mini_debug_info;
+        if (debugdata != nullptr) {
+            elf_sections_t mini_elf;
+            if (xz::decode(data + debugdata->sh_offset, debugdata->sh_size, MINI_DEBUG_INFO_MAX, mini_debug_info) &&
+                read_sections(mini_debug_info.data(), mini_debug_info.size(), mini_elf) &&
+                (symtab = find_section(mini_elf, SHT_SYMTAB)) != nullptr) {
+                add_functions(mini_elf, *symtab, index, candidates);
+            } else {
+                _LOGD("symbolizer: could not read the MiniDebugInfo of %s", index.path.c_str());
+            }
+        }
+
+        // one function per address, preferring exported names over their local aliases
+        std::sort(candidates.begin(), candidates.end(), [](const candidate_t &a, const candidate_t &b) {
+            if (a.function.start != b.function.start) {
+                return a.function.start < b.function.start;
+            }
+            if (a.global != b.global) {
+                return a.global;
+            }
+            return a.function.size > b.function.size;
+        });
+
+        index.functions.reserve(candidates.size());
+        for (auto &candidate: candidates) {
+            if (index.functions.empty() || index.functions.back().start != candidate.function.start) {
+                index.functions.push_back(candidate.function);
+            }
+        }
+        index.functions.shrink_to_fit();
+        index.names.shrink_to_fit();
+
+        return !index.functions.empty();
+    }
+
+    static bool build_functions(const char *path, uintptr_t file_offset, const char *build_id,
+                                function_index_t &index) {
+        std::string file(path);
+        std::string entry;
+        const char *separator = std::strstr(path, "!/");
+        if (separator != nullptr) {
+            file.assign(path, separator - path);
+        }
+
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        if (separator != nullptr && file_offset == 0 && !zip_find(fd, separator + 2, file_offset, entry)) {
+            close(fd);
+            return false;
+        }
+
+        struct stat st = {};
+        void *mapping = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<uintptr_t>(st.st_size) > file_offset) {
+            mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+
+        bool indexed = index_functions(static_cast<const uint8_t *>(mapping) + file_offset,
+                                       st.st_size - file_offset, build_id, index);
+        munmap(mapping, st.st_size);
+
+        return indexed;
+    }
+
+    static bool same_module(const function_index_t &index, const char *path, const char *build_id) {
+        if (build_id != nullptr && *build_id != '\0') {
+            return index.build_id == build_id;
+        }
+        return index.build_id.empty() && index.path == path;
+    }
+
+    const function_index_t *find_functions(const char *path, const char *build_id) {
+        size_t cnt = function_index_cnt.load(std::memory_order_acquire);
+
+        for (size_t i = 0; i < cnt; i++) {
+            const function_index_t *index = function_indexes[i].load(std::memory_order_acquire);
+            if (index != nullptr && same_module(*index, path, build_id)) {
+                return index->functions.empty() ? nullptr : index;
+            }
+        }
+        return nullptr;
+    }
+
+    const function_index_t *load_functions(const char *path, uintptr_t file_offset, const char *build_id) {
+        std::lock_guard<std::mutex> lock(function_index_mutex);
+
+        size_t cnt = function_index_cnt.load(std::memory_order_acquire);
+        for (size_t i = 0; i < cnt; i++) {
+            const function_index_t *index = function_indexes[i].load(std::memory_order_acquire);
+            if (same_module(*index, path, build_id)) {
+                return index->functions.empty() ? nullptr : index;
+            }
+        }
+        if (cnt == FUNCTION_INDEXES_MAX) {
+            return nullptr;
+        }
+
+        // modules without function symbols are remembered too, so they're read once
+        function_index_t *index = new function_index_t();
+        index->build_id = (build_id != nullptr) ? build_id : "";
+        index->path = path;
+        if (!build_functions(path, file_offset, build_id, *index)) {
+            index->functions.clear();
+            index->names.clear();
+        }
+
+        function_indexes[cnt].store(index, std::memory_order_release);
+        function_index_cnt.store(cnt + 1, std::memory_order_release);
+
+        return index->functions.empty() ? nullptr : index;
+    }
+
+    const function_t *lookup(const function_index_t &index, uintptr_t vaddr) {
+        const std::vector<function_t> &functions = index.functions;
+        auto it = std::upper_bound(functions.begin(), functions.end(), vaddr,
+                                   [](uintptr_t vaddr, const function_t &function) {
+                                       return vaddr < function.start;
+                                   });
+        if (it == functions.begin()) {
+            return nullptr;
+        }
+
+        const function_t &function = *(it - 1);
+        if (function.size != 0 && vaddr - function.start >= function.size) {
+            return nullptr;
+        }
+        return &function;
+    }
+
+    void release_functions() {
+        std::lock_guard<std::mutex> lock(function_index_mutex);
+
+        size_t cnt = function_index_cnt.exchange(0, std::memory_order_acq_rel);
+        for (size_t i = 0; i < cnt; i++) {
+            delete function_indexes[i].exchange(nullptr, std::memory_order_acq_rel);
+        }
+    }
+
+}   // namespace symbolizer
@@ -0,0 +1,120 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_SYMBOLIZER_H
+#define _AGENT_NDK_SYMBOLIZER_H
+
+#include <link.h>
+#include <string>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+
+/**
+ * Offline symbolization
+ *
+ * Resolves addresses captured in another (since departed) process against the module
+ * images on disk, reproducing what dladdr() reported in that process: the dynamic
+ * symbol table is searched for the global or weak symbol containing the address.
+ * Not async-signal-safe: used when rendering records.
+ *
+ * Frames dladdr() can't name (local and hidden functions) are named from a function
+ * index built from the module's full symbol table (.symtab), and from the symbol table
+ * of its MiniDebugInfo (the LZMA-compressed .gnu_debugdata section Android's system
+ * libraries carry). Indexes are built lazily, on healthy threads, and cached per build-id
+ * for the life of the process; the crash path only reads indexes already built.
+ */
+namespace symbolizer {
+
+    /**
+     * A function symbol, at its link-time address
+     */
+    typedef struct function {
+        uintptr_t start;
+        uint32_t size;                  // zero if unknown: the function ends where the next begins
+        uint32_t name;                  // offset into the index's names
+
+    } function_t;
+
+    /**
+     * A module's function symbols, sorted by address
+     */
+    typedef struct function_index {
+        std::string build_id;           // hex encoded, or empty
+        std::string path;               // module path, as given when built
+        std::vector<function_t> functions;
+        std::string names;              // nul-terminated, mangled
+
+    } function_index_t;
+
+    /**
+     * Symbol tables read from a module image
+     */
+    typedef struct elf_image {
+        std::string path;               // module path as reported by dladdr()
+        uintptr_t min_vaddr;            // lowest PT_LOAD address, page aligned
+        std::vector<ElfW(Sym)> symbols; // .dynsym
+        std::string strings;            // .dynstr
+        const function_index_t *functions;  // full symbol tables, or null
+        bool valid;                     // the image is an ELF object of this ABI
+
+    } elf_image_t;
+
+    /**
+     * Read the symbol tables of the ELF image starting at file_offset in path.
+     * A non-zero offset denotes a library loaded directly from an APK. Its function
+     * index is used if the image's build-id matches the one given.
+     *
+     * @return false if the file is not an ELF object of this ABI
+     */
+    bool load(const char *path, uintptr_t file_offset, const char *build_id, elf_image_t &);
+
+    /**
+     * Resolve an address in a module loaded at base, as dladdr() would, or from
+     * the image's function index if dladdr() couldn't name it
+     */
+    void resolve(const elf_image_t &, uintptr_t base, size_t index, uintptr_t address,
+                 stackframe_t &);
+
+    /**
+     * Find or build the function index of a module image. Paths of libraries loaded from
+     * an APK may be given as "<apk>!/<entry>". If a build-id is given, the image must match it.
+     * Not async-signal-safe: maps the image, and may decompress its MiniDebugInfo.
+     *
+     * @return the index, or null if the image has no function symbols or doesn't match
+     */
+    const function_index_t *load_functions(const char *path, uintptr_t file_offset, const char *build_id);
+
+    /**
+     * Find a function index already built, by build-id or, lacking one, by path.
+     * Async-signal-safe.
+     *
+     * @return the index, or null if none was built
+     */
+    const function_index_t *find_functions(const char *path, const char *build_id);
+
+    /**
+     * Find the function containing a link-time address. Async-signal-safe.
+     *
+     * @return the function, or null
+     */
+    const function_t *lookup(const function_index_t &, uintptr_t vaddr);
+
+    /**
+     * Release every function index built. Call once no handler can be reading them.
+     */
+    void release_functions();
+
+    /**
+     * Hex encode the NT_GNU_BUILD_ID note in a run of ELF notes. Async-signal-safe.
+     *
+     * @return false if the notes hold no build-id
+     */
+    bool read_build_id(const void *notes, size_t size, char *build_id, size_t build_id_size);
+
+}   // namespace symbolizer
+
+#endif // _AGENT_NDK_SYMBOLIZER_H
@@ -11,6 +11,7 @@
 #include <agent-ndk.h>
 #include "backtrace.h"
 #include "serializer.h"
+#include "arena.h"
 #include "terminate-handler.h"
 
 static std::terminate_handler currentHandler = std::get_terminate();
@@ -18,6 +19,25 @@ static std::terminate_handler currentHandler = std::get_terminate();
 /* Module-wide mutex */
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
+static bool arena_reserved = false;
+
+/**
+ * Collect and persist an exception report, using the crash arena for storage
+ */
+static void report_exception() {
+    if (arena::acquire()) {
+        char *buffer = arena::alloc_array<char>(BACKTRACE_SZ_MAX);
+        size_t size = (buffer != nullptr) ?
+                      collect_crash_record(buffer, BACKTRACE_SZ_MAX, nullptr, nullptr) : 0;
+        if (size > 0) {
+            serializer::from_exception(buffer, size);
+        }
+        arena::release();
+    } else {
+        _LOGE("Crash arena not available for exception report!");
+    }
+}
+
 /**
  * Report exception via agent HandledException
  */
@@ -31,11 +51,7 @@ static void terminateHandler() noexcept {
             std::free(demangled);
         }
 
-        char *buffer = new char[BACKTRACE_SZ_MAX];
-        if (collect_backtrace(buffer, BACKTRACE_SZ_MAX, nullptr, nullptr)) {
-            serializer::from_exception(buffer, std::strlen(buffer));
-        }
-        delete[] buffer;
+        report_exception();
 
         std::exception_ptr exc = std::current_exception();
         if (exc != nullptr) {
@@ -45,23 +61,15 @@ static void terminateHandler() noexcept {
             _LOGI("Normal termination recvd");
         }
     } catch (const std::exception &e) {
-        char *buffer = new char[BACKTRACE_SZ_MAX];
-        if (collect_backtrace(buffer, BACKTRACE_SZ_MAX, nullptr, nullptr)) {
-            serializer::from_exception(buffer, std::strlen(buffer));
-        }
-        delete[] buffer;
+        report_exception();
 
-        _LOGI("Unexpected exception: %s %s", e.what(), buffer);
+        _LOGI("Unexpected exception: %s", e.what());
         throw e;
 
     } catch (...) {
-        char *buffer = new char[BACKTRACE_SZ_MAX];
-        if (collect_backtrace(buffer, BACKTRACE_SZ_MAX, nullptr, nullptr)) {
-            serializer::from_exception(buffer, std::strlen(buffer));
-        }
-        delete[] buffer;
+        report_exception();
 
-        _LOGI("Unknown exception: %s", buffer);
+        _LOGI("Unknown exception");
     }
 
     // reset the handler
@@ -83,12 +91,7 @@ static void terminateHandler() noexcept {
 std::unexpected_handler currentUnexpectedHandler;
 
 void unexpectedHandler() {
-    char *buffer = new char[BACKTRACE_SZ_MAX];
-
-    if (collect_backtrace(buffer, BACKTRACE_SZ_MAX, nullptr, nullptr)) {
-        serializer::from_exception(buffer, std::strlen(buffer));
-    }
-    delete[] buffer;
+    report_exception();
 }
 
 #endif // _LIBCPP_STD_VER <= 14
@@ -96,6 +99,7 @@ void unexpectedHandler() {
 
 bool terminate_handler_initialize() {
     if (0 == pthread_mutex_lock(&mutex)) {
+        arena_reserved = arena::initialize(BACKTRACE_ARENA_SZ_MAX);
         currentHandler = std::set_terminate(terminateHandler);
 #if _LIBCPP_STD_VER <= 14
         currentUnexpectedHandler = std::set_unexpected(unexpectedHandler);
@@ -121,6 +125,10 @@ void terminate_handler_shutdown() {
 #if _LIBCPP_STD_VER <= 14
         std::set_unexpected(currentUnexpectedHandler);
 #endif // LIBCPP_STD_VER <= 14
+        if (arena_reserved) {
+            arena::shutdown();
+            arena_reserved = false;
+        }
         if (0 != pthread_mutex_unlock(&mutex)) {
             _LOGE_POSIX("pthread_mutex_unlock()");
         }
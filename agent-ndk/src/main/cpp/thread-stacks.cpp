@@ -0,0 +1,340 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include <agent-ndk.h>
+#include "arena.h"
+#include "backtrace.h"
+#include "signal-utils.h"
+#include "unwinder.h"
+#include "thread-stacks.h"
+
+#ifndef SI_TKILL
+#define SI_TKILL -6
+#endif
+
+namespace stacks {
+
+    // bionic reserves the real-time signals below SIGRTMIN for itself
+    static const int CAPTURE_SIGNAL_OFFSET = 5;
+
+    static const int REQUEST_PENDING = 0;
+    static const int REQUEST_RUNNING = 1;
+    static const int REQUEST_DONE = 2;
+    static const int REQUEST_ABANDONED = 3;
+
+    static const uint64_t NSEC_PER_SEC = 1000000000ULL;
+
+    /**
+     * A thread's stack, to be unwound by the thread itself
+     */
+    typedef struct capture_request {
+        int tid;
+        int status;                 // REQUEST_*, advanced with compare-and-swap
+        size_t thread_index;        // index into the backtrace's thread table
+        backtrace_state_t *state;
+        ucontext_t *context;        // receives the thread's context, if set
+
+    } capture_request_t;
+
+    /**
+     * A capture in progress. Lives in the crash arena for the duration of capture().
+     */
+    typedef struct capture_session {
+        capture_request_t *requests;
+        size_t request_cnt;
+        unwinder_t unwinder;
+        int checked_in;             // futex word: number of requests completed
+
+    } capture_session_t;
+
+    static capture_session_t *active_session = nullptr;
+    static int capturing = 0;
+
+    static struct sigaction sa_previous = {};
+    static volatile sig_atomic_t installed = 0;
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    static int capture_signal() {
+        return SIGRTMIN + CAPTURE_SIGNAL_OFFSET;
+    }
+
+    static uint64_t monotonic_ns() {
+        struct timespec ts = {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * NSEC_PER_SEC + ts.tv_nsec;
+    }
+
+    static void futex_wake(int *word) {
+        syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    static void futex_wait(int *word, int expected, uint64_t timeout_ns) {
+        struct timespec ts = {static_cast<time_t>(timeout_ns / NSEC_PER_SEC),
+                              static_cast<long>(timeout_ns % NSEC_PER_SEC)};
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+    }
+
+    /**
+     * Unwind this thread's stack if a request is waiting on it
+     *
+     * @return true if the signal was sent by a capture
+     */
+    static bool answer_request(const ucontext_t *ucontext) {
+        // the lease keeps the session's storage committed until we are done with it
+        if (!arena::acquire()) {
+            return false;
+        }
+
+        capture_session_t *session = __atomic_load_n(&active_session, __ATOMIC_ACQUIRE);
+        if (session != nullptr) {
+            pid_t tid = gettid();
+            for (size_t i = 0; i < session->request_cnt; i++) {
+                capture_request_t &request = session->requests[i];
+                int expected = REQUEST_PENDING;
+                if (request.tid != tid ||
+                    !__atomic_compare_exchange_n(&request.status, &expected, REQUEST_RUNNING,
+                                                 false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    continue;
+                }
+
+                request.state->sa_ucontext = ucontext;
+                session->unwinder(*request.state);
+                if (request.context != nullptr) {
+                    *request.context = *ucontext;
+                    request.state->sa_ucontext = request.context;
+                } else {
+                    request.state->sa_ucontext = nullptr;   // the context is gone once we return
+                }
+
+                __atomic_store_n(&request.status, REQUEST_DONE, __ATOMIC_RELEASE);
+                __atomic_add_fetch(&session->checked_in, 1, __ATOMIC_RELEASE);
+                futex_wake(&session->checked_in);
+                break;
+            }
+        }
+
+        arena::release();
+
+        return session != nullptr;
+    }
+
+    static void capture_handler(int signo, siginfo_t *siginfo, void *ucontext) {
+        int saved_errno = errno;
+
+        bool answered = false;
+        if (siginfo != nullptr && siginfo->si_code == SI_TKILL && siginfo->si_pid == getpid()) {
+            answered = answer_request(static_cast<const ucontext_t *>(ucontext));
+        }
+
+        // not ours: pass it on to whoever held the signal before us
+        if (!answered && (sa_previous.sa_flags & SA_SIGINFO) && sa_previous.sa_sigaction != nullptr) {
+            sa_previous.sa_sigaction(signo, siginfo, ucontext);
+        } else if (!answered && !(sa_previous.sa_flags & SA_SIGINFO) &&
+                   sa_previous.sa_handler != SIG_DFL && sa_previous.sa_handler != SIG_IGN) {
+            sa_previous.sa_handler(signo);
+        }
+
+        errno = saved_errno;
+    }
+
+    bool initialize() {
+        pthread_mutex_lock(&mutex);
+
+        if (!installed) {
+            // SA_ONSTACK: a thread that has an alternate stack unwinds on it
+            if (sigutils::install_handler(capture_signal(), capture_handler, &sa_previous,
+                                          SA_RESTART | SA_ONSTACK)) {
+                installed = 1;
+                _LOGI("Thread stack capture installed on signal %d", capture_signal());
+            } else {
+                _LOGE("Unable to install the thread stack capture handler");
+            }
+        }
+
+        pthread_mutex_unlock(&mutex);
+
+        return installed;
+    }
+
+    void shutdown() {
+        pthread_mutex_lock(&mutex);
+
+        if (installed) {
+            sigutils::uninstall_handler(capture_signal(), &sa_previous);
+            installed = 0;
+        }
+
+        pthread_mutex_unlock(&mutex);
+    }
+
+    static void requests_add(capture_session_t &session, pid_t tid, size_t thread_index,
+                             backtrace_state_t *state, ucontext_t *context) {
+        session.requests[session.request_cnt++] = {tid, REQUEST_PENDING, thread_index, state, context};
+    }
+
+    /**
+     * Signal the thread of each request, and wait for them all to check in or for the deadline
+     *
+     * @return number of threads signaled
+     */
+    static int rendezvous(capture_session_t *session, uint64_t deadline) {
+        __atomic_store_n(&active_session, session, __ATOMIC_RELEASE);
+
+        int signaled = 0;
+        int signo = capture_signal();
+        pid_t pid = getpid();
+        for (size_t i = 0; i < session->request_cnt; i++) {
+            capture_request_t &request = session->requests[i];
+            if (syscall(SYS_tgkill, pid, request.tid, signo) == 0) {
+                signaled++;
+            } else {
+                // the thread has exited since the thread table was read
+                __atomic_store_n(&request.status, REQUEST_ABANDONED, __ATOMIC_RELEASE);
+            }
+        }
+
+        for (;;) {
+            int checked_in = __atomic_load_n(&session->checked_in, __ATOMIC_ACQUIRE);
+            uint64_t now = monotonic_ns();
+            if (checked_in >= signaled || now >= deadline) {
+                break;
+            }
+            futex_wait(&session->checked_in, checked_in, deadline - now);
+        }
+
+        // late threads find no session; any still unwinding hold their own lease until done
+        __atomic_store_n(&active_session, nullptr, __ATOMIC_RELEASE);
+
+        return signaled;
+    }
+
+    /**
+     * Close a request: one still pending is abandoned
+     *
+     * @return true if its thread unwound a stack into it
+     */
+    static bool close_request(capture_request_t &request) {
+        int status = REQUEST_PENDING;
+        if (__atomic_compare_exchange_n(&request.status, &status, REQUEST_ABANDONED, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return false;
+        }
+        return status == REQUEST_DONE && request.state->frame_cnt > 0;
+    }
+
+    /**
+     * Begin a capture: one at a time, a second reporter goes without
+     */
+    static capture_session_t *begin(unwinder_t unwinder, size_t request_cnt) {
+        int expected = 0;
+        if (!__atomic_compare_exchange_n(&capturing, &expected, 1, false,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return nullptr;
+        }
+
+        capture_session_t *session = arena::alloc_array<capture_session_t>(1);
+        capture_request_t *requests = arena::alloc_array<capture_request_t>(request_cnt);
+        if (session == nullptr || requests == nullptr) {
+            __atomic_store_n(&capturing, 0, __ATOMIC_RELEASE);
+            return nullptr;
+        }
+
+        session->requests = requests;
+        session->unwinder = unwinder;
+
+        return session;
+    }
+
+    static void end() {
+        __atomic_store_n(&capturing, 0, __ATOMIC_RELEASE);
+    }
+
+    size_t capture(backtrace_t &backtrace, uint64_t timeout_ns, unwinder_t unwinder) {
+        if (!installed || unwinder == nullptr || backtrace.threads == nullptr || backtrace.thread_cnt == 0) {
+            return 0;
+        }
+
+        uint64_t deadline = monotonic_ns() + timeout_ns;
+        pid_t self = gettid();
+
+        capture_session_t *session = begin(unwinder, backtrace.thread_cnt);
+        if (session == nullptr) {
+            return 0;
+        }
+
+        for (size_t i = 0; i < backtrace.thread_cnt; i++) {
+            const threadinfo_t &thread = backtrace.threads[i];
+            if (thread.tid == self || thread.backtrace_state != nullptr) {
+                continue;
+            }
+            backtrace_state_t *state = arena::alloc_array<backtrace_state_t>(1);
+            if (state == nullptr) {
+                break;
+            }
+            requests_add(*session, thread.tid, i, state, nullptr);
+        }
+
+        int signaled = rendezvous(session, deadline);
+
+        size_t captured = 0;
+        for (size_t i = 0; i < session->request_cnt; i++) {
+            capture_request_t &request = session->requests[i];
+            if (close_request(request)) {
+                backtrace.threads[request.thread_index].backtrace_state = request.state;
+                captured++;
+            }
+        }
+
+        if (captured < static_cast<size_t>(signaled)) {
+            _LOGW("Captured %zu of %d thread stacks", captured, signaled);
+        }
+
+        end();
+
+        return captured;
+    }
+
+    bool capture_thread(pid_t tid, backtrace_state_t &state, uint64_t timeout_ns, unwinder_t unwinder) {
+        if (!installed || unwinder == nullptr || tid == gettid()) {
+            return false;
+        }
+
+        uint64_t deadline = monotonic_ns() + timeout_ns;
+
+        capture_session_t *session = begin(unwinder, 1);
+        if (session == nullptr) {
+            return false;
+        }
+
+        // the thread unwinds into scratch storage, which a late thread may still be writing
+        backtrace_state_t *scratch = arena::alloc_array<backtrace_state_t>(1);
+        ucontext_t *context = arena::alloc_array<ucontext_t>(1);
+        bool captured = false;
+        if (scratch != nullptr && context != nullptr) {
+            requests_add(*session, tid, 0, scratch, context);
+            rendezvous(session, deadline);
+
+            captured = close_request(session->requests[0]);
+            if (captured) {
+                const siginfo_t *siginfo = state.siginfo;
+                state = *scratch;
+                state.siginfo = siginfo;
+            }
+        }
+
+        end();
+
+        return captured;
+    }
+
+}   // namespace stacks
@@ -0,0 +1,62 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_THREAD_STACKS_H
+#define _AGENT_NDK_THREAD_STACKS_H
+
+#include <stdint.h>
+#include <agent-ndk.h>
+#include "backtrace.h"
+#include "unwinder.h"
+
+/**
+ * All-threads stack capture
+ *
+ * Each thread in a backtrace's thread table is sent a dedicated real-time signal with
+ * tgkill(). Its handler unwinds the thread's own stack (walking its frame records, unless
+ * the chain breaks) into a per-thread slot taken from the crash arena, then checks in at a futex rendezvous. The collector waits there until
+ * every thread has checked in or the deadline passes; late threads are abandoned and
+ * reported without a stack.
+ *
+ * Threads that block the capture signal, or that are stopped in the kernel, never check in.
+ */
+namespace stacks {
+
+    /**
+     * Install the capture signal handler
+     */
+    bool initialize();
+
+    /**
+     * Restore the previous capture signal handler
+     */
+    void shutdown();
+
+    /**
+     * Capture the stack of every thread in the backtrace's thread table other than the caller,
+     * attaching each to its threadinfo. Async-signal-safe.
+     * Working storage is taken from the crash arena: the caller must hold an arena lease.
+     *
+     * @param timeout_ns total time allowed for the capture
+     * @param unwinder run by each thread on its own context
+     * @return number of thread stacks captured
+     */
+    size_t capture(backtrace_t &backtrace, uint64_t timeout_ns, unwinder_t unwinder = unwind_fast);
+
+    /**
+     * Capture the stack and registers of one thread other than the caller, which is signaled
+     * as capture() signals every thread. Async-signal-safe.
+     * Working storage is taken from the crash arena: the caller must hold an arena lease.
+     *
+     * @param state receives the thread's frames, and its context (held in the arena); its
+     * siginfo is left as it was
+     * @return false if the thread didn't answer before the timeout, or had no frames
+     */
+    bool capture_thread(pid_t tid, backtrace_state_t &state, uint64_t timeout_ns,
+                        unwinder_t unwinder = unwind_fast);
+
+}   // namespace stacks
+
+#endif // _AGENT_NDK_THREAD_STACKS_H
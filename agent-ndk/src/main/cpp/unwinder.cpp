@@ -6,14 +6,23 @@
 
 #include <unwind.h>
 #include <dlfcn.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include <sys/ucontext.h>
 #include <asm/sigcontext.h>
-#include <cxxabi.h>
+#include <algorithm>
+#include <cstring>
 
 #include <agent-ndk.h>
 #include "backtrace.h"
 #include "unwinder.h"
 #include "procfs.h"
+#include "module-index.h"
+#include "cfi-unwinder.h"
+#include "demangler.h"
 
 /**
  * Get the crash ip, given a pointer to a ucontext_t context.
@@ -33,6 +42,22 @@ static uintptr_t crash_ip_from_mcontext(const mcontext_t *mcontext) {
 #endif
 }
 
+/**
+ * The pc reported for a caller's frame, given the return address into it.
+ *
+ * On aarch64 the return address is the instruction after the call (bl/blr, always 4 bytes):
+ * stepping back onto the call instruction keeps the frame inside the calling function when
+ * the call is its last instruction (a noreturn callee), and matches the pcs Android's own
+ * unwinder reports for callers.
+ **/
+static uintptr_t caller_pc(uintptr_t return_address) {
+#if defined(__aarch64__)
+    return return_address - sizeof(u_int32_t);
+#else
+    return return_address;
+#endif  // __aarch64__
+}
+
 static bool record_frame(uintptr_t ip, backtrace_state_t *state) {
 
     if (state->frame_cnt >= BACKTRACE_FRAMES_MAX) {
@@ -79,6 +104,11 @@ void transform_addr_to_stackframe(size_t index, uintptr_t address, stackframe_t
     stackframe.index = index;
     stackframe.address = address;
 
+    // the module index resolves without taking the loader lock; dladdr() is used until it's built
+    if (modules::resolve(index, address, stackframe) || modules::available()) {
+        return;
+    }
+
     // _LOGD("Resolving frame[%zu]: addr[%zu]", index, address);
     if (dladdr(reinterpret_cast<void *>(address), &info)) {
 
@@ -88,12 +118,9 @@ void transform_addr_to_stackframe(size_t index, uintptr_t address, stackframe_t
 
         if (info.dli_sname) {
             const char *symbol = info.dli_sname;
-            int status = 0;
-            const char *demangled = __cxxabiv1::__cxa_demangle(symbol, 0, 0, &status);
-            if (demangled != nullptr && status == 0) {
-                symbol = demangled;
+            if (!demangler::demangle(symbol, stackframe.sym_name, sizeof(stackframe.sym_name))) {
+                std::strncpy(stackframe.sym_name, symbol, sizeof(stackframe.sym_name) - 1);
             }
-            std::strncpy(stackframe.sym_name, symbol, sizeof(stackframe.sym_name) - 1);
         }
 
         // Relative addresses appear when code is compiled with
@@ -125,26 +152,23 @@ _Unwind_Reason_Code unwinder_cb(struct _Unwind_Context *ucontext, void *arg) {
         state->skipped_frames = state->frame_cnt;
         state->frame_cnt = 0;   // reset the index
     } else if (ip > 0) {
-#if defined(__aarch64__)
-        // TODO find out why we need this adjustment to match Android offset values
-        ip -= sizeof(u_int32_t);
-#endif  // __aarch64__
+        ip = caller_pc(ip);
     }
 
     return record_frame(ip, state) ? _URC_NO_REASON : _URC_END_OF_STACK;
 }
 
-bool unwind_backtrace(backtrace_state_t &state) {
+bool unwind_runtime(backtrace_state_t &state) {
 
     if (state.sa_ucontext == nullptr) {
-        _LOGE("unwind_backtrace: sa_ucontext is null");
+        _LOGE("unwind_runtime: sa_ucontext is null");
         return 0;
     }
 
     // get pointer to machine specific context
     const mcontext_t *mcontext = &(state.sa_ucontext->uc_mcontext);
     if (mcontext == nullptr) {
-        _LOGE("unwind_backtrace: uc_mcontext is null");
+        _LOGE("unwind_runtime: uc_mcontext is null");
         return 0;
     }
 
@@ -155,8 +179,227 @@ bool unwind_backtrace(backtrace_state_t &state) {
     // unwinds the backtrace and fills the buffer with stack frame addresses
     _Unwind_Backtrace(unwinder_cb, &state);
 
-    _LOGD("[%s] unwind_backtrace: frames[%zu] skipped[%d] context[%p]",
+    _LOGD("[%s] unwind_runtime: frames[%zu] skipped[%d] context[%p]",
           get_arch(), state.frame_cnt, state.skipped_frames, state.sa_ucontext);
 
     return true;
 }
+
+bool unwind_cfi(backtrace_state_t &state) {
+    cfi::cursor_t cursor;
+
+    state.skipped_frames = 0;
+    state.frame_cnt = 0;
+    if (state.sa_ucontext == nullptr || !cfi::init(cursor, state.sa_ucontext)) {
+        return false;
+    }
+
+    state.crash_ip = cursor.pc;
+    record_frame(cursor.pc, &state);
+
+    // frames interrupted by a nested signal are reported exactly, like the first
+    while (cfi::step(cursor)) {
+        if (!record_frame(cursor.signal_frame ? cursor.pc : caller_pc(cursor.pc), &state)) {
+            break;
+        }
+    }
+
+    // a library loaded since the index was built: the runtime unwinder finds it
+    if (cursor.unindexed) {
+        _LOGD("unwind_cfi: frame[%zu] is in no indexed module", state.frame_cnt);
+        return false;
+    }
+
+    return state.frame_cnt > 1;
+}
+
+bool unwind_backtrace(backtrace_state_t &state) {
+    if (unwind_cfi(state)) {
+        _LOGD("[%s] unwind_backtrace: frames[%zu] skipped[%d] context[%p]",
+              get_arch(), state.frame_cnt, state.skipped_frames, state.sa_ucontext);
+        return true;
+    }
+
+    // a context in code without indexed CFI (or no context at all), or a stack through a
+    // library the index doesn't hold yet: unwind from here
+    return unwind_runtime(state);
+}
+
+/**
+ * The main thread's stack: the [stack] mapping, down to where its rlimit lets it grow
+ */
+static uintptr_t main_stack_lo = 0;
+static uintptr_t main_stack_hi = 0;
+
+// bionic's limit for a main thread stack with an unlimited rlimit
+static const size_t MAIN_STACK_SZ_DEFAULT = 8 * 1024 * 1024;
+
+void unwinder_initialize() {
+    FILE *maps = fopen("/proc/self/maps", "re");
+    if (maps == nullptr) {
+        return;
+    }
+
+    char line[512];
+    uintptr_t start = 0;
+    uintptr_t end = 0;
+    while (fgets(line, sizeof(line), maps) != nullptr) {
+        if (std::strstr(line, "[stack]") != nullptr &&
+            sscanf(line, "%" SCNxPTR "-%" SCNxPTR, &start, &end) == 2) {
+            break;
+        }
+        end = 0;
+    }
+    fclose(maps);
+
+    if (end != 0) {
+        struct rlimit limit = {};
+        size_t size = MAIN_STACK_SZ_DEFAULT;
+        if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+            size = static_cast<size_t>(limit.rlim_cur);
+        }
+        main_stack_lo = std::min(start, end - std::min(size, static_cast<size_t>(end)));
+        main_stack_hi = end;
+    }
+}
+
+bool get_stack_bounds(uintptr_t &lo, uintptr_t &hi) {
+    if (gettid() == getpid()) {
+        lo = main_stack_lo;
+        hi = main_stack_hi;
+        return hi != 0;
+    }
+
+    // bionic copies the attributes of threads other than the main thread, without locking or allocating
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+        return false;
+    }
+
+    void *stack = nullptr;
+    size_t size = 0;
+    bool known = (pthread_attr_getstack(&attr, &stack, &size) == 0 && stack != nullptr);
+    pthread_attr_destroy(&attr);
+
+    lo = reinterpret_cast<uintptr_t>(stack);
+    hi = lo + size;
+    return known;
+}
+
+/**
+ * Get the registers seeding a frame pointer walk
+ *
+ * @return false where frame records can't be walked
+ */
+static bool frame_registers(const mcontext_t *mcontext, uintptr_t &pc, uintptr_t &sp, uintptr_t &fp) {
+#if defined(__i386)
+    pc = mcontext->gregs[REG_EIP];
+    sp = mcontext->gregs[REG_ESP];
+    fp = mcontext->gregs[REG_EBP];
+    return true;
+#elif defined(__x86_64__)
+    pc = mcontext->gregs[REG_RIP];
+    sp = mcontext->gregs[REG_RSP];
+    fp = mcontext->gregs[REG_RBP];
+    return true;
+#elif defined(__arm__)
+    (void) mcontext;
+    (void) pc;
+    (void) sp;
+    (void) fp;
+    return false;
+#elif defined(__aarch64__)
+    pc = mcontext->pc;
+    sp = mcontext->sp;
+    fp = mcontext->regs[29];
+    return true;
+#else
+#error "Unknown ABI"
+#endif
+}
+
+/**
+ * Get the interrupted frame's return address, which its frame record may not hold yet:
+ * the link register, or on x86 the top of the stack (valid in a leaf that has pushed nothing)
+ */
+static uintptr_t return_address(const mcontext_t *mcontext, uintptr_t sp) {
+#if defined(__i386) || defined(__x86_64__)
+    (void) mcontext;
+    return *reinterpret_cast<const uintptr_t *>(sp);
+#elif defined(__arm__)
+    (void) sp;
+    return mcontext->arm_lr;
+#elif defined(__aarch64__)
+    (void) sp;
+    return mcontext->regs[30];
+#else
+#error "Unknown ABI"
+#endif
+}
+
+bool unwind_frame_pointers(backtrace_state_t &state) {
+    uintptr_t pc = 0;
+    uintptr_t sp = 0;
+    uintptr_t fp = 0;
+    uintptr_t stack_lo = 0;
+    uintptr_t stack_hi = 0;
+
+    state.skipped_frames = 0;
+    state.frame_cnt = 0;
+    if (state.sa_ucontext == nullptr ||
+        !frame_registers(&state.sa_ucontext->uc_mcontext, pc, sp, fp) ||
+        !get_stack_bounds(stack_lo, stack_hi)) {
+        return false;
+    }
+
+    state.crash_ip = pc;
+    record_frame(pc, &state);
+
+    // a context on another stack (an alternate signal stack, a coroutine) can't be validated
+    if (sp < stack_lo || sp >= stack_hi) {
+        return false;
+    }
+
+    // a leaf that hasn't pushed a frame record leaves fp on its caller's, so the caller is only
+    // found through the return address (if it lands in a module). Where the first record returns
+    // there too, the frame is reported once.
+    uintptr_t leaf_return = 0;
+    if (sp <= stack_hi - sizeof(uintptr_t)) {
+        leaf_return = return_address(&state.sa_ucontext->uc_mcontext, sp);
+        if (leaf_return != 0 && (!modules::available() || modules::find(leaf_return) != nullptr)) {
+            record_frame(caller_pc(leaf_return), &state);
+        } else {
+            leaf_return = 0;
+        }
+    }
+
+    // each frame record holds the caller's frame pointer, followed by the return address;
+    // records are above the context's sp, and callers' records at higher addresses
+    uintptr_t floor = sp;
+    while (fp != 0) {
+        if ((fp % sizeof(uintptr_t)) != 0 || fp < floor || fp > stack_hi - 2 * sizeof(uintptr_t)) {
+            return false;
+        }
+
+        const uintptr_t *record = reinterpret_cast<const uintptr_t *>(fp);
+        if (record[1] == 0) {
+            break;
+        }
+        if (record[1] != leaf_return && !record_frame(caller_pc(record[1]), &state)) {
+            break;
+        }
+        leaf_return = 0;
+
+        floor = fp + 2 * sizeof(uintptr_t);
+        fp = record[0];
+    }
+
+    return true;
+}
+
+bool unwind_fast(backtrace_state_t &state) {
+    if (unwind_frame_pointers(state)) {
+        return true;
+    }
+    return unwind_backtrace(state);
+}
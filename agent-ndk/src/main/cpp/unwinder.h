@@ -12,8 +12,59 @@
 extern "C" {
 #endif
 
+/**
+ * An unwinder: fills a backtrace state's frames, starting at its sa_ucontext
+ */
+typedef bool (*unwinder_t)(backtrace_state_t &);
+
+/**
+ * Unwind the DWARF CFI of the context's modules, starting from the context's own registers.
+ * Needs the module index; not supported on 32-bit ARM. Async-signal-safe.
+ *
+ * @return false if no caller of the context's pc could be unwound, or if the walk stopped in a
+ * module loaded after the index was built. The frames unwound up to there are kept.
+ */
+bool unwind_cfi(backtrace_state_t &);
+
+/**
+ * Unwind with the runtime's unwinder (_Unwind_Backtrace), from the caller's own frame,
+ * discarding the frames above the context's pc. Async-signal-safe.
+ */
+bool unwind_runtime(backtrace_state_t &);
+
+/**
+ * Unwind with unwind_cfi(), falling back to unwind_runtime(). Async-signal-safe.
+ */
 bool unwind_backtrace(backtrace_state_t &);
 
+/**
+ * Walk the frame record chain seeded from the context's registers, validating each record
+ * against the calling thread's stack: the context must be the calling thread's own.
+ * Not supported on 32-bit ARM, where Thumb and ARM code keep frame records differently.
+ * Async-signal-safe once unwinder_initialize() has run.
+ *
+ * @return false if the chain broke before reaching the outermost frame
+ */
+bool unwind_frame_pointers(backtrace_state_t &);
+
+/**
+ * Walk frame records, falling back to unwind_backtrace() if the chain breaks. Async-signal-safe.
+ */
+bool unwind_fast(backtrace_state_t &);
+
+/**
+ * Record the main thread's stack bounds, which can't be read from a signal handler.
+ * Call once, from a healthy thread.
+ */
+void unwinder_initialize();
+
+/**
+ * Get the calling thread's stack bounds. Async-signal-safe once unwinder_initialize() has run.
+ *
+ * @return false if they are not known
+ */
+bool get_stack_bounds(uintptr_t &lo, uintptr_t &hi);
+
 #ifdef __cplusplus
 }
 #endif
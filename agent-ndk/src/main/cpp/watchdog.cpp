@@ -0,0 +1,334 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include <agent-ndk.h>
+#include "arena.h"
+#include "backtrace.h"
+#include "serializer.h"
+#include "thread-stacks.h"
+#include "watchdog.h"
+
+static const size_t WATCHDOG_SLOTS_MAX = 32;
+static const size_t WATCHDOG_NAME_MAX = 32;
+static const size_t WATCHDOG_CACHE_LINE = 64;
+
+// the monitor samples at a fraction of the shortest timeout, within these bounds
+static const uint64_t WATCHDOG_POLL_MIN_NS = 10000000ULL;
+static const uint64_t WATCHDOG_POLL_MAX_NS = 1000000000ULL;
+static const uint64_t WATCHDOG_POLL_DIVISOR = 4;
+
+/**
+ * A watched thread. The beat count has its cache line to itself: the rest is written on
+ * registration, and by the monitor, under the watchdog mutex.
+ */
+struct nr_watchdog {
+    alignas(WATCHDOG_CACHE_LINE) std::atomic<uint64_t> beats;
+
+    alignas(WATCHDOG_CACHE_LINE) bool active;
+    pid_t tid;
+    uint64_t timeout_ns;
+    char name[WATCHDOG_NAME_MAX];
+
+    uint64_t seen_beats;        // the count when the monitor last saw it change
+    uint64_t seen_ns;           // and when that was
+    bool reported;              // the current stall has been reported
+};
+
+namespace watchdog {
+
+    static nr_watchdog_t slots[WATCHDOG_SLOTS_MAX];
+    static size_t active_cnt = 0;
+
+    static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    static pthread_cond_t wakeup;
+    static pthread_t monitor_thread;
+    static bool running = false;
+    static bool arena_reserved = false;
+
+    static uint64_t now_ns() {
+        struct timespec now = {};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+    }
+
+    /**
+     * @return false once the thread has exited
+     */
+    static bool thread_alive(pid_t tid) {
+        return syscall(SYS_tgkill, getpid(), tid, 0) == 0 || errno != ESRCH;
+    }
+
+    /**
+     * Free a slot whose thread exited without unregistering. Called with the mutex held.
+     */
+    static void reclaim_slot(nr_watchdog_t &slot) {
+        _LOGD("watchdog: thread[%d] [%s] exited while registered", slot.tid, slot.name);
+        slot.active = false;
+        active_cnt--;
+    }
+
+    /**
+     * A stall to report, copied from its slot
+     */
+    typedef struct stall {
+        pid_t tid;
+        char name[WATCHDOG_NAME_MAX];
+        uint64_t stalled_ns;
+
+    } stall_t;
+
+    /**
+     * Collect and store an ANR report for a stalled thread. Called without the mutex:
+     * the capture waits on the thread.
+     */
+    static void report_stall(const stall_t &stall) {
+        char description[128];
+        std::snprintf(description, sizeof(description), "Native thread %s stalled for %llu ms",
+                      stall.name, static_cast<unsigned long long>(stall.stalled_ns / 1000000ULL));
+        _LOGW("watchdog: %s (thread[%d])", description, stall.tid);
+
+        if (!arena::acquire()) {
+            _LOGE("Crash arena not available for a stall report!");
+            return;
+        }
+
+        char *buffer = arena::alloc_array<char>(BACKTRACE_SZ_MAX);
+        size_t size = (buffer != nullptr) ?
+                      collect_stall_record(buffer, BACKTRACE_SZ_MAX, stall.tid, description) : 0;
+        if (size > 0) {
+            serializer::from_anr(buffer, size);
+        }
+        arena::release();
+    }
+
+    /**
+     * Check each watched thread's beat count, marking those that have stalled as reported.
+     * Called with the mutex held.
+     *
+     * @param stalls receives the stalls to report, once the mutex is released
+     * @param stall_cnt receives their number
+     * @return time until the next check
+     */
+    static uint64_t check_slots(stall_t *stalls, size_t &stall_cnt) {
+        uint64_t now = now_ns();
+        uint64_t poll_ns = WATCHDOG_POLL_MAX_NS;
+
+        stall_cnt = 0;
+        for (auto &slot: slots) {
+            if (!slot.active) {
+                continue;
+            }
+
+            uint64_t beats = slot.beats.load(std::memory_order_relaxed);
+            if (beats != slot.seen_beats) {
+                slot.seen_beats = beats;
+                slot.seen_ns = now;
+                slot.reported = false;
+            } else if (!thread_alive(slot.tid)) {
+                // a thread that exited has stopped beating, but hasn't stalled
+                reclaim_slot(slot);
+                continue;
+            } else if (!slot.reported && (now - slot.seen_ns) >= slot.timeout_ns) {
+                // no beat since the last change was seen: the thread hasn't beaten for a timeout
+                stall_t &stall = stalls[stall_cnt++];
+                stall.tid = slot.tid;
+                std::memcpy(stall.name, slot.name, sizeof(stall.name));
+                stall.stalled_ns = now - slot.seen_ns;
+                slot.reported = true;
+            }
+
+            uint64_t slot_poll_ns = slot.timeout_ns / WATCHDOG_POLL_DIVISOR;
+            poll_ns = (slot_poll_ns < poll_ns) ? slot_poll_ns : poll_ns;
+        }
+
+        return (poll_ns < WATCHDOG_POLL_MIN_NS) ? WATCHDOG_POLL_MIN_NS : poll_ns;
+    }
+
+    static void *monitor(__unused void *unused) {
+        if (0 != pthread_setname_np(pthread_self(), "NR-Watchdog")) {
+            _LOGE_POSIX("pthread_setname_np()");
+        }
+        _LOGD("watchdog: monitor started");
+
+        stall_t stalls[WATCHDOG_SLOTS_MAX];
+        pthread_mutex_lock(&mutex);
+        while (running) {
+            size_t stall_cnt = 0;
+            uint64_t deadline_ns = now_ns() + check_slots(stalls, stall_cnt);
+
+            // threads register, unregister and shut the monitor down while it reports
+            if (stall_cnt > 0) {
+                pthread_mutex_unlock(&mutex);
+                for (size_t i = 0; i < stall_cnt; i++) {
+                    report_stall(stalls[i]);
+                }
+                pthread_mutex_lock(&mutex);
+                if (!running) {
+                    break;
+                }
+            }
+
+            struct timespec deadline = {static_cast<time_t>(deadline_ns / 1000000000ULL),
+                                        static_cast<long>(deadline_ns % 1000000000ULL)};
+            pthread_cond_timedwait(&wakeup, &mutex, &deadline);
+        }
+        pthread_mutex_unlock(&mutex);
+
+        _LOGD("watchdog: monitor stopped");
+        return nullptr;
+    }
+
+    /**
+     * Start the monitor thread, if it isn't running. Called with the mutex held.
+     */
+    static bool start_monitor() {
+        if (running) {
+            return true;
+        }
+
+        // stalled threads are asked for their stacks as the main thread is at an ANR
+        if (!stacks::initialize()) {
+            _LOGW("watchdog: stalled threads will be reported without their stacks");
+        }
+
+        if (!arena_reserved) {
+            arena_reserved = arena::initialize(BACKTRACE_ARENA_SZ_MAX);
+        }
+
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&wakeup, &attr);
+        pthread_condattr_destroy(&attr);
+
+        running = true;
+        if (0 != pthread_create(&monitor_thread, nullptr, monitor, nullptr)) {
+            _LOGE("Could not create a watchdog thread. Native thread stalls will not be reported.");
+            running = false;
+            pthread_cond_destroy(&wakeup);
+        }
+
+        return running;
+    }
+
+    void shutdown() {
+        pthread_mutex_lock(&mutex);
+        bool stopping = running;
+        running = false;
+        if (stopping) {
+            pthread_cond_signal(&wakeup);
+        }
+        pthread_mutex_unlock(&mutex);
+
+        if (stopping) {
+            if (0 != pthread_join(monitor_thread, nullptr)) {
+                _LOGE_POSIX("pthread_join failed");
+            }
+            pthread_cond_destroy(&wakeup);
+        }
+
+        pthread_mutex_lock(&mutex);
+        if (arena_reserved) {
+            arena::shutdown();
+            arena_reserved = false;
+        }
+        pthread_mutex_unlock(&mutex);
+    }
+
+    size_t registered() {
+        pthread_mutex_lock(&mutex);
+        size_t cnt = active_cnt;
+        pthread_mutex_unlock(&mutex);
+
+        return cnt;
+    }
+
+}   // namespace watchdog
+
+extern "C"
+nr_watchdog_t *nr_watchdog_register(const char *name, uint32_t timeout_ms) {
+    using namespace watchdog;
+
+    pthread_mutex_lock(&mutex);
+
+    nr_watchdog_t *slot = nullptr;
+    for (auto &candidate: slots) {
+        if (!candidate.active) {
+            slot = &candidate;
+            break;
+        }
+    }
+
+    // the monitor may not yet have seen a thread exit
+    for (size_t i = 0; slot == nullptr && i < WATCHDOG_SLOTS_MAX; i++) {
+        if (!thread_alive(slots[i].tid)) {
+            reclaim_slot(slots[i]);
+            slot = &slots[i];
+        }
+    }
+
+    if (slot == nullptr) {
+        pthread_mutex_unlock(&mutex);
+        _LOGW("watchdog: all %zu slots are taken, [%s] will not be watched", WATCHDOG_SLOTS_MAX,
+              name != nullptr ? name : "");
+        return nullptr;
+    }
+
+    slot->beats.store(0, std::memory_order_relaxed);
+    slot->tid = gettid();
+    slot->timeout_ns = static_cast<uint64_t>(timeout_ms) * 1000000ULL;
+    std::memset(slot->name, 0, sizeof(slot->name));
+    if (name != nullptr) {
+        std::strncpy(slot->name, name, sizeof(slot->name) - 1);
+    }
+    sanitize_name(slot->name);
+    slot->seen_beats = 0;
+    slot->seen_ns = now_ns();
+    slot->reported = false;
+    slot->active = true;
+    active_cnt++;
+
+    // a new timeout may be shorter than the monitor's current wait
+    if (running) {
+        pthread_cond_signal(&wakeup);
+    } else {
+        start_monitor();
+    }
+    pthread_mutex_unlock(&mutex);
+
+    _LOGD("watchdog: thread[%d] [%s] registered, timeout %u ms", slot->tid, slot->name, timeout_ms);
+    return slot;
+}
+
+extern "C"
+void nr_watchdog_beat(nr_watchdog_t *watchdog) {
+    // only the registered thread writes the count: no read-modify-write is needed
+    if (watchdog != nullptr) {
+        watchdog->beats.store(watchdog->beats.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+extern "C"
+void nr_watchdog_unregister(nr_watchdog_t *watchdog) {
+    if (watchdog == nullptr) {
+        return;
+    }
+
+    pthread_mutex_lock(&watchdog::mutex);
+    if (watchdog->active) {
+        watchdog->active = false;
+        watchdog::active_cnt--;
+    }
+    pthread_mutex_unlock(&watchdog::mutex);
+}
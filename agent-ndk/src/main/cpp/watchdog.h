@@ -0,0 +1,36 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_WATCHDOG_H
+#define _AGENT_NDK_WATCHDOG_H
+
+#include <stddef.h>
+#include <nr-watchdog.h>
+
+/**
+ * Native thread watchdog (see nr-watchdog.h)
+ *
+ * Registered threads hold a slot in a fixed table. Each slot's beat count sits alone on its
+ * cache line, written only by its thread, so a beat is a relaxed store that never contends
+ * with another thread's. One monitor thread, started with the first registration, samples
+ * the counts at a fraction of the shortest timeout, and times how long each has gone
+ * unchanged. A thread found stalled is signaled to unwind itself, as the main thread is at
+ * an ANR, and reported from the monitor.
+ */
+namespace watchdog {
+
+    /**
+     * Stop the monitor thread. Registered threads are watched again from the next registration.
+     */
+    void shutdown();
+
+    /**
+     * @return number of threads registered
+     */
+    size_t registered();
+
+}   // namespace watchdog
+
+#endif // _AGENT_NDK_WATCHDOG_H
@@ -0,0 +1,167 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "writer.h"
+
+namespace writer {
+
+    // Enough for a 64-bit value in any base we emit, plus sign and prefix
+    static const size_t DIGITS_MAX = 24;
+
+    static const char *xdigits = "0123456789abcdef";
+
+    void to_buffer(writer_t &writer, char *buffer, size_t capacity) {
+        writer.buffer = buffer;
+        writer.capacity = capacity;
+        writer.length = 0;
+        writer.flushed = 0;
+        writer.fd = -1;
+        writer.overflow = false;
+        writer.error = false;
+    }
+
+    void to_fd(writer_t &writer, int fd, char *staging, size_t capacity) {
+        to_buffer(writer, staging, capacity);
+        writer.fd = fd;
+    }
+
+    bool flush(writer_t &writer) {
+        if (writer.fd < 0) {
+            return !writer.overflow;
+        }
+
+        size_t offset = 0;
+        while (!writer.error && offset < writer.length) {
+            ssize_t cnt = write(writer.fd, writer.buffer + offset, writer.length - offset);
+            if (cnt < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                writer.error = true;
+            } else {
+                offset += cnt;
+            }
+        }
+        writer.flushed += offset;
+        writer.length = 0;
+
+        return !writer.error;
+    }
+
+    size_t size(const writer_t &writer) {
+        return writer.flushed + writer.length;
+    }
+
+    bool ok(const writer_t &writer) {
+        return !(writer.overflow || writer.error);
+    }
+
+    void put(writer_t &writer, const char *bytes, size_t cnt) {
+        while (cnt > 0) {
+            size_t available = writer.capacity - writer.length;
+            if (available == 0) {
+                if (writer.fd < 0 || !flush(writer)) {
+                    writer.overflow = (writer.fd < 0);
+                    return;
+                }
+                available = writer.capacity;
+            }
+
+            size_t chunk = cnt < available ? cnt : available;
+            memcpy(writer.buffer + writer.length, bytes, chunk);
+            writer.length += chunk;
+            bytes += chunk;
+            cnt -= chunk;
+        }
+    }
+
+    void put_char(writer_t &writer, char ch) {
+        if (writer.length < writer.capacity) {
+            writer.buffer[writer.length++] = ch;
+        } else {
+            put(writer, &ch, 1);
+        }
+    }
+
+    void put_cstr(writer_t &writer, const char *cstr) {
+        if (cstr != nullptr) {
+            put(writer, cstr, strlen(cstr));
+        }
+    }
+
+    void put_string(writer_t &writer, const char *cstr) {
+        if (cstr == nullptr) {
+            return;
+        }
+
+        // copy runs between single quotes in bulk
+        const char *run = cstr;
+        for (; *cstr != '\0'; cstr++) {
+            if (*cstr == '\'') {
+                put(writer, run, cstr - run);
+                put_char(writer, '"');
+                run = cstr + 1;
+            }
+        }
+        put(writer, run, cstr - run);
+    }
+
+    /**
+     * Format digits right-to-left into the tail of a scratch buffer
+     */
+    static size_t format_digits(char *tail, unsigned long long value, unsigned base) {
+        size_t cnt = 0;
+        do {
+            *--tail = xdigits[value % base];
+            value /= base;
+            cnt++;
+        } while (value != 0);
+        return cnt;
+    }
+
+    static void put_padded(writer_t &writer, const char *prefix, size_t prefix_len,
+                           const char *digits, size_t digit_cnt, int width) {
+        put(writer, prefix, prefix_len);
+        for (int pad = width - static_cast<int>(prefix_len + digit_cnt); pad > 0; pad--) {
+            put_char(writer, '0');
+        }
+        put(writer, digits, digit_cnt);
+    }
+
+    void put_dec(writer_t &writer, long long value, int width) {
+        char scratch[DIGITS_MAX];
+        char *tail = scratch + sizeof(scratch);
+        unsigned long long magnitude = value < 0 ? 0ULL - static_cast<unsigned long long>(value)
+                                                 : static_cast<unsigned long long>(value);
+        size_t cnt = format_digits(tail, magnitude, 10);
+        put_padded(writer, "-", value < 0 ? 1 : 0, tail - cnt, cnt, width);
+    }
+
+    void put_udec(writer_t &writer, unsigned long long value, int width) {
+        char scratch[DIGITS_MAX];
+        char *tail = scratch + sizeof(scratch);
+        size_t cnt = format_digits(tail, value, 10);
+        put_padded(writer, nullptr, 0, tail - cnt, cnt, width);
+    }
+
+    void put_hex(writer_t &writer, unsigned long long value, int width) {
+        char scratch[DIGITS_MAX];
+        char *tail = scratch + sizeof(scratch);
+        size_t cnt = format_digits(tail, value, 16);
+        put_padded(writer, nullptr, 0, tail - cnt, cnt, width);
+    }
+
+    void put_ptr(writer_t &writer, uintptr_t value, int width) {
+        char scratch[DIGITS_MAX];
+        char *tail = scratch + sizeof(scratch);
+        size_t cnt = format_digits(tail, value, 16);
+        put_padded(writer, "0x", 2, tail - cnt, cnt, width);
+    }
+
+}   // namespace writer
@@ -0,0 +1,98 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_WRITER_H
+#define _AGENT_NDK_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Async-signal-safe streaming writer
+ *
+ * Reports are emitted through a writer rather than assembled from temporary strings.
+ * A writer either fills a caller-owned buffer (buffer backend), or stages output in a
+ * caller-owned scratch buffer that is drained to a file descriptor with write(2) as it
+ * fills (fd backend). Number formatting is done by hand: there is no heap, no locale
+ * and no stdio anywhere on this path.
+ */
+typedef struct stream_writer {
+    char *buffer;       // output buffer (buffer backend) or staging buffer (fd backend)
+    size_t capacity;    // size of buffer
+    size_t length;      // bytes currently held in buffer
+    size_t flushed;     // bytes drained to fd (fd backend)
+    int fd;             // output file descriptor, or -1 for the buffer backend
+    bool overflow;      // buffer backend ran out of space; output is truncated
+    bool error;         // fd backend failed to write; output is incomplete
+
+}   writer_t;
+
+namespace writer {
+
+    /**
+     * Initialize a writer that emits into a fixed buffer
+     */
+    void to_buffer(writer_t &, char *buffer, size_t capacity);
+
+    /**
+     * Initialize a writer that emits to a file descriptor, staged through a scratch buffer
+     */
+    void to_fd(writer_t &, int fd, char *staging, size_t capacity);
+
+    /**
+     * Drain any staged output (fd backend). No-op for the buffer backend.
+     * @return false if a write failed
+     */
+    bool flush(writer_t &);
+
+    /**
+     * @return total number of bytes emitted so far
+     */
+    size_t size(const writer_t &);
+
+    /**
+     * @return true if all output so far has been retained
+     */
+    bool ok(const writer_t &);
+
+    void put(writer_t &, const char *bytes, size_t cnt);
+
+    void put_char(writer_t &, char);
+
+    /**
+     * Emit a NUL-terminated literal as-is
+     */
+    void put_cstr(writer_t &, const char *);
+
+    /**
+     * Emit the contents of a JSON string value. Single quotes are emitted as double quotes,
+     * preserving the output of the legacy emitter's quote translation pass.
+     */
+    void put_string(writer_t &, const char *);
+
+    /**
+     * Emit a signed decimal, zero-padded to width (printf "%0<width>d")
+     */
+    void put_dec(writer_t &, long long value, int width = 0);
+
+    /**
+     * Emit an unsigned decimal, zero-padded to width (printf "%0<width>u")
+     */
+    void put_udec(writer_t &, unsigned long long value, int width = 0);
+
+    /**
+     * Emit lowercase hex, zero-padded to width (printf "%0<width>x")
+     */
+    void put_hex(writer_t &, unsigned long long value, int width = 0);
+
+    /**
+     * Emit a pointer as bionic's printf formats "%0<width>p": 0x-prefixed hex,
+     * zero-padded so that the prefix and digits fill width
+     */
+    void put_ptr(writer_t &, uintptr_t value, int width = 0);
+
+}   // namespace writer
+
+#endif // _AGENT_NDK_WRITER_H
@@ -0,0 +1,480 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include "xz-decoder.h"
+
+namespace xz {
+
+    // .xz container (xz-file-format.txt)
+    static const uint8_t STREAM_MAGIC[] = {0xfd, '7', 'z', 'X', 'Z', 0x00};
+    static const size_t STREAM_HEADER_SZ = 12;
+    static const size_t CRC32_SZ = 4;
+    static const uint64_t FILTER_LZMA2 = 0x21;
+    static const uint8_t BLOCK_FLAG_FILTERS = 0x03;
+    static const uint8_t BLOCK_FLAG_RESERVED = 0x3c;
+    static const uint8_t BLOCK_FLAG_COMPRESSED_SZ = 0x40;
+    static const uint8_t BLOCK_FLAG_UNCOMPRESSED_SZ = 0x80;
+
+    // LZMA model, as in the LZMA SDK
+    static const uint32_t STATES = 12;
+    static const uint32_t LITERAL_STATES = 7;           // states below this follow a literal
+    static const uint32_t POS_STATES_MAX = 1 << 4;
+    static const uint32_t DIST_STATES = 4;
+    static const uint32_t DIST_SLOTS = 64;
+    static const uint32_t DIST_MODEL_START = 4;
+    static const uint32_t DIST_MODEL_END = 14;
+    static const uint32_t FULL_DISTANCES = 1 << (DIST_MODEL_END / 2);
+    static const uint32_t ALIGN_BITS = 4;
+    static const uint32_t LEN_LOW_SYMBOLS = 1 << 3;
+    static const uint32_t LEN_MID_SYMBOLS = 1 << 3;
+    static const uint32_t LEN_HIGH_SYMBOLS = 1 << 8;
+    static const uint32_t MATCH_LEN_MIN = 2;
+    static const uint32_t LITERAL_CODERS_MAX = 1 << 4;  // LZMA2 limits lc + lp to 4
+    static const uint32_t LITERAL_CODER_SZ = 0x300;
+    static const uint32_t PROPS_MAX = 9 * 5 * 5;
+    static const uint32_t DICT_PROPS_MAX = 40;
+
+    // range coder
+    static const uint32_t PROB_BITS = 11;
+    static const uint32_t MOVE_BITS = 5;
+    static const uint16_t PROB_INIT = 1 << (PROB_BITS - 1);
+    static const uint32_t RC_TOP = 1 << 24;
+    static const size_t RC_INIT_SZ = 5;
+
+    typedef struct length_model {
+        uint16_t choice;
+        uint16_t choice2;
+        uint16_t low[POS_STATES_MAX][LEN_LOW_SYMBOLS];
+        uint16_t mid[POS_STATES_MAX][LEN_MID_SYMBOLS];
+        uint16_t high[LEN_HIGH_SYMBOLS];
+
+    } length_model_t;
+
+    /**
+     * Adaptive bit probabilities, all reset together
+     */
+    typedef struct model {
+        uint16_t is_match[STATES][POS_STATES_MAX];
+        uint16_t is_rep[STATES];
+        uint16_t is_rep0[STATES];
+        uint16_t is_rep1[STATES];
+        uint16_t is_rep2[STATES];
+        uint16_t is_rep0_long[STATES][POS_STATES_MAX];
+        uint16_t dist_slot[DIST_STATES][DIST_SLOTS];
+        uint16_t dist_special[FULL_DISTANCES - DIST_MODEL_END];
+        uint16_t dist_align[1 << ALIGN_BITS];
+        length_model_t match_len;
+        length_model_t rep_len;
+        uint16_t literal[LITERAL_CODERS_MAX][LITERAL_CODER_SZ];
+
+    } model_t;
+
+    typedef struct lzma {
+        uint32_t lc;            // literal context bits
+        uint32_t lp;            // literal position bits
+        uint32_t pb;            // position bits
+        uint32_t state;
+        uint32_t rep0;
+        uint32_t rep1;
+        uint32_t rep2;
+        uint32_t rep3;
+        model_t model;
+
+    } lzma_t;
+
+    typedef struct range_decoder {
+        const uint8_t *in;
+        const uint8_t *end;
+        uint32_t range;
+        uint32_t code;
+        bool error;             // read past the end of the chunk
+
+    } range_decoder_t;
+
+    static uint8_t rc_next(range_decoder_t &rc) {
+        if (rc.in < rc.end) {
+            return *rc.in++;
+        }
+        rc.error = true;
+        return 0;
+    }
+
+    static bool rc_init(range_decoder_t &rc, const uint8_t *in, size_t size) {
+        rc.in = in;
+        rc.end = in + size;
+        rc.range = UINT32_MAX;
+        rc.code = 0;
+        rc.error = false;
+        if (size < RC_INIT_SZ || rc_next(rc) != 0) {
+            return false;
+        }
+        for (size_t i = 1; i < RC_INIT_SZ; i++) {
+            rc.code = (rc.code << 8) | rc_next(rc);
+        }
+        return true;
+    }
+
+    static void rc_normalize(range_decoder_t &rc) {
+        if (rc.range < RC_TOP) {
+            rc.range <<= 8;
+            rc.code = (rc.code << 8) | rc_next(rc);
+        }
+    }
+
+    static uint32_t rc_bit(range_decoder_t &rc, uint16_t &prob) {
+        rc_normalize(rc);
+        uint32_t bound = (rc.range >> PROB_BITS) * prob;
+        if (rc.code < bound) {
+            rc.range = bound;
+            prob += ((1 << PROB_BITS) - prob) >> MOVE_BITS;
+            return 0;
+        }
+        rc.range -= bound;
+        rc.code -= bound;
+        prob -= prob >> MOVE_BITS;
+        return 1;
+    }
+
+    static uint32_t rc_bittree(range_decoder_t &rc, uint16_t *probs, uint32_t limit) {
+        uint32_t symbol = 1;
+        do {
+            symbol = (symbol << 1) + rc_bit(rc, probs[symbol]);
+        } while (symbol < limit);
+        return symbol - limit;
+    }
+
+    static void rc_bittree_reverse(range_decoder_t &rc, uint16_t *probs, uint32_t &dest, uint32_t limit) {
+        uint32_t symbol = 1;
+        for (uint32_t i = 0; i < limit; i++) {
+            uint32_t bit = rc_bit(rc, probs[symbol]);
+            symbol = (symbol << 1) + bit;
+            dest += bit << i;
+        }
+    }
+
+    static void rc_direct(range_decoder_t &rc, uint32_t &dest, uint32_t limit) {
+        do {
+            rc_normalize(rc);
+            rc.range >>= 1;
+            rc.code -= rc.range;
+            uint32_t mask = 0u - (rc.code >> 31);
+            rc.code += rc.range & mask;
+            dest = (dest << 1) + (mask + 1);
+        } while (--limit > 0);
+    }
+
+    static void reset_state(lzma_t &lz) {
+        lz.state = 0;
+        lz.rep0 = lz.rep1 = lz.rep2 = lz.rep3 = 0;
+        std::fill_n(reinterpret_cast<uint16_t *>(&lz.model), sizeof(lz.model) / sizeof(uint16_t), PROB_INIT);
+    }
+
+    static bool set_props(lzma_t &lz, uint8_t props) {
+        if (props >= PROPS_MAX) {
+            return false;
+        }
+        lz.lc = props % 9;
+        props /= 9;
+        lz.lp = props % 5;
+        lz.pb = props / 5;
+        return lz.lc + lz.lp <= 4;
+    }
+
+    static uint32_t decode_length(range_decoder_t &rc, length_model_t &model, uint32_t pos_state) {
+        if (!rc_bit(rc, model.choice)) {
+            return MATCH_LEN_MIN + rc_bittree(rc, model.low[pos_state], LEN_LOW_SYMBOLS);
+        }
+        if (!rc_bit(rc, model.choice2)) {
+            return MATCH_LEN_MIN + LEN_LOW_SYMBOLS + rc_bittree(rc, model.mid[pos_state], LEN_MID_SYMBOLS);
+        }
+        return MATCH_LEN_MIN + LEN_LOW_SYMBOLS + LEN_MID_SYMBOLS + rc_bittree(rc, model.high, LEN_HIGH_SYMBOLS);
+    }
+
+    /**
+     * Decode an LZMA chunk into out[pos, end). The output since the last dictionary
+     * reset, at dict_start, is the dictionary.
+     */
+    static bool decode_lzma(lzma_t &lz, range_decoder_t &rc, uint8_t *out, size_t dict_start, size_t pos,
+                            size_t end) {
+        const uint32_t pos_mask = (1u << lz.pb) - 1;
+        const uint32_t literal_pos_mask = (1u << lz.lp) - 1;
+        model_t &model = lz.model;
+
+        while (pos < end && !rc.error) {
+            size_t decoded = pos - dict_start;
+            uint32_t pos_state = decoded & pos_mask;
+
+            if (!rc_bit(rc, model.is_match[lz.state][pos_state])) {
+                uint32_t prev = (decoded > 0) ? out[pos - 1] : 0;
+                uint16_t *probs = model.literal[((decoded & literal_pos_mask) << lz.lc) + (prev >> (8 - lz.lc))];
+                uint32_t symbol = 1;
+
+                if (lz.state < LITERAL_STATES) {
+                    symbol = rc_bittree(rc, probs, 0x100);
+                } else {
+                    // the byte at the last match distance predicts the literal
+                    if (lz.rep0 >= decoded) {
+                        return false;
+                    }
+                    uint32_t match_byte = static_cast<uint32_t>(out[pos - lz.rep0 - 1]) << 1;
+                    uint32_t offset = 0x100;
+                    do {
+                        uint32_t match_bit = match_byte & offset;
+                        match_byte <<= 1;
+                        if (rc_bit(rc, probs[offset + match_bit + symbol])) {
+                            symbol = (symbol << 1) + 1;
+                            offset = match_bit;
+                        } else {
+                            symbol <<= 1;
+                            offset &= ~match_bit;
+                        }
+                    } while (symbol < 0x100);
+                }
+
+                out[pos++] = static_cast<uint8_t>(symbol);
+                lz.state = (lz.state < 4) ? 0 : (lz.state < 10) ? lz.state - 3 : lz.state - 6;
+                continue;
+            }
+
+            uint32_t len = 0;
+            if (!rc_bit(rc, model.is_rep[lz.state])) {
+                // a match at a new distance
+                lz.state = (lz.state < LITERAL_STATES) ? 7 : 10;
+                lz.rep3 = lz.rep2;
+                lz.rep2 = lz.rep1;
+                lz.rep1 = lz.rep0;
+                len = decode_length(rc, model.match_len, pos_state);
+
+                uint32_t dist_state = std::min(len - MATCH_LEN_MIN, DIST_STATES - 1);
+                uint32_t slot = rc_bittree(rc, model.dist_slot[dist_state], DIST_SLOTS);
+                if (slot < DIST_MODEL_START) {
+                    lz.rep0 = slot;
+                } else {
+                    uint32_t limit = (slot >> 1) - 1;
+                    lz.rep0 = 2 + (slot & 1);
+                    if (slot < DIST_MODEL_END) {
+                        lz.rep0 <<= limit;
+                        rc_bittree_reverse(rc, model.dist_special + lz.rep0 - slot - 1, lz.rep0, limit);
+                    } else {
+                        rc_direct(rc, lz.rep0, limit - ALIGN_BITS);
+                        lz.rep0 <<= ALIGN_BITS;
+                        rc_bittree_reverse(rc, model.dist_align, lz.rep0, ALIGN_BITS);
+                    }
+                }
+            } else {
+                // a match at one of the last four distances
+                if (!rc_bit(rc, model.is_rep0[lz.state])) {
+                    if (!rc_bit(rc, model.is_rep0_long[lz.state][pos_state])) {
+                        lz.state = (lz.state < LITERAL_STATES) ? 9 : 11;
+                        len = 1;
+                    }
+                } else {
+                    uint32_t dist;
+                    if (!rc_bit(rc, model.is_rep1[lz.state])) {
+                        dist = lz.rep1;
+                    } else {
+                        if (!rc_bit(rc, model.is_rep2[lz.state])) {
+                            dist = lz.rep2;
+                        } else {
+                            dist = lz.rep3;
+                            lz.rep3 = lz.rep2;
+                        }
+                        lz.rep2 = lz.rep1;
+                    }
+                    lz.rep1 = lz.rep0;
+                    lz.rep0 = dist;
+                }
+                if (len == 0) {
+                    lz.state = (lz.state < LITERAL_STATES) ? 8 : 11;
+                    len = decode_length(rc, model.rep_len, pos_state);
+                }
+            }
+
+            // matches may overlap their own output, and never cross a chunk
+            if (lz.rep0 >= decoded || len > end - pos) {
+                return false;
+            }
+            const uint8_t *from = out + pos - lz.rep0 - 1;
+            for (uint32_t i = 0; i < len; i++) {
+                out[pos + i] = from[i];
+            }
+            pos += len;
+        }
+
+        return !rc.error;
+    }
+
+    static uint32_t be16(const uint8_t *p) {
+        return (static_cast<uint32_t>(p[0]) << 8) | p[1];
+    }
+
+    /**
+     * LZMA2 chunks, up to the end marker
+     */
+    static bool decode_lzma2(const uint8_t *data, size_t size, size_t &pos, size_t max_size,
+                             std::vector<uint8_t> &out) {
+        std::unique_ptr<lzma_t> lz(new lzma_t());
+        bool have_props = false;
+        size_t dict_start = out.size();
+
+        for (;;) {
+            if (pos >= size) {
+                return false;
+            }
+            uint8_t control = data[pos++];
+            if (control == 0x00) {
+                return true;
+            }
+
+            if (control == 0x01 || control == 0x02) {
+                // stored, after a dictionary reset (0x01) or not
+                if (size - pos < 2) {
+                    return false;
+                }
+                size_t stored = be16(data + pos) + 1;
+                pos += 2;
+                if (stored > size - pos || stored > max_size - out.size()) {
+                    return false;
+                }
+                if (control == 0x01) {
+                    dict_start = out.size();
+                }
+                out.insert(out.end(), data + pos, data + pos + stored);
+                pos += stored;
+                continue;
+            }
+            if (control < 0x80) {
+                return false;
+            }
+
+            // compressed: bits 5-6 select what's reset, bits 0-4 are the top of the unpacked size
+            uint32_t reset = (control >> 5) & 0x03;
+            if (size - pos < 4) {
+                return false;
+            }
+            size_t unpacked = ((static_cast<size_t>(control & 0x1f) << 16) | be16(data + pos)) + 1;
+            size_t packed = be16(data + pos + 2) + 1;
+            pos += 4;
+
+            if (reset == 3) {
+                dict_start = out.size();
+            }
+            if (reset >= 2) {
+                if (pos >= size || !set_props(*lz, data[pos++])) {
+                    return false;
+                }
+                have_props = true;
+            }
+            if (!have_props) {
+                return false;
+            }
+            if (reset >= 1) {
+                reset_state(*lz);
+            }
+
+            range_decoder_t rc = {};
+            if (packed > size - pos || unpacked > max_size - out.size() || !rc_init(rc, data + pos, packed)) {
+                return false;
+            }
+            size_t start = out.size();
+            out.resize(start + unpacked);
+            if (!decode_lzma(*lz, rc, out.data(), dict_start, start, out.size())) {
+                return false;
+            }
+            pos += packed;
+        }
+    }
+
+    static bool read_varint(const uint8_t *data, size_t size, size_t &pos, uint64_t &value) {
+        value = 0;
+        for (unsigned shift = 0; shift < 63 && pos < size; shift += 7) {
+            uint8_t byte = data[pos++];
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * A block: its header, LZMA2 data, padding and check
+     */
+    static bool decode_block(const uint8_t *data, size_t size, size_t &pos, size_t check_size,
+                             size_t max_size, std::vector<uint8_t> &out) {
+        size_t block = pos;
+        size_t header_size = (static_cast<size_t>(data[pos]) + 1) * 4;
+        if (header_size > size - pos || header_size < 2 + CRC32_SZ) {
+            return false;
+        }
+
+        size_t header_end = pos + header_size - CRC32_SZ;
+        uint8_t flags = data[pos + 1];
+        pos += 2;
+        if ((flags & BLOCK_FLAG_RESERVED) != 0 || (flags & BLOCK_FLAG_FILTERS) != 0) {
+            // a filter chain; only LZMA2 alone is supported
+            return false;
+        }
+
+        uint64_t value;
+        if ((flags & BLOCK_FLAG_COMPRESSED_SZ) && !read_varint(data, header_end, pos, value)) {
+            return false;
+        }
+        if ((flags & BLOCK_FLAG_UNCOMPRESSED_SZ) && !read_varint(data, header_end, pos, value)) {
+            return false;
+        }
+
+        uint64_t filter;
+        uint64_t props_size;
+        if (!read_varint(data, header_end, pos, filter) || filter != FILTER_LZMA2 ||
+            !read_varint(data, header_end, pos, props_size) || props_size != 1 ||
+            pos >= header_end || data[pos++] > DICT_PROPS_MAX) {
+            return false;
+        }
+        pos = header_end + CRC32_SZ;
+
+        if (!decode_lzma2(data, size, pos, max_size, out)) {
+            return false;
+        }
+
+        // padded to a multiple of four, then the (unverified) check
+        pos += (4 - (pos - block) % 4) % 4;
+        if (check_size > size - std::min(pos, size)) {
+            return false;
+        }
+        pos += check_size;
+        return true;
+    }
+
+    bool decode(const uint8_t *data, size_t size, size_t max_size, std::vector<uint8_t> &out) {
+        out.clear();
+
+        if (size < STREAM_HEADER_SZ || std::memcmp(data, STREAM_MAGIC, sizeof(STREAM_MAGIC)) != 0 ||
+            data[6] != 0 || (data[7] & 0xf0) != 0) {
+            return false;
+        }
+
+        // check sizes grow with the check id: none, then 4, 8, 16, 32 and 64 bytes, three ids apiece
+        uint8_t check = data[7] & 0x0f;
+        size_t check_size = (check == 0) ? 0 : static_cast<size_t>(4) << ((check - 1) / 3);
+
+        // blocks follow until the index, which begins with a zero byte
+        size_t pos = STREAM_HEADER_SZ;
+        while (pos < size) {
+            if (data[pos] == 0x00) {
+                return true;
+            }
+            if (!decode_block(data, size, pos, check_size, max_size, out)) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+}   // namespace xz
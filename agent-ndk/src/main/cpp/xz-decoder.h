@@ -0,0 +1,32 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_XZ_DECODER_H
+#define _AGENT_NDK_XZ_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Decoder for the .xz streams holding MiniDebugInfo (.gnu_debugdata sections)
+ *
+ * Handles the container and the LZMA2 filter, which is all `xz` writes by default. Other
+ * filter chains (BCJ, delta) are rejected. Integrity checks are skipped rather than verified:
+ * every read is bounds-checked, and a corrupt section only costs its symbols.
+ * Not async-signal-safe: decodes into a heap buffer.
+ */
+namespace xz {
+
+    /**
+     * Decode an .xz stream into out, bounded by max_size
+     *
+     * @return false if the stream is malformed, uses an unsupported filter, or decodes to more than max_size
+     */
+    bool decode(const uint8_t *data, size_t size, size_t max_size, std::vector<uint8_t> &out);
+
+}   // namespace xz
+
+#endif // _AGENT_NDK_XZ_DECODER_H
@@ -12,6 +12,7 @@ import com.newrelic.agent.android.logging.ConsoleAgentLog
 import com.newrelic.agent.android.stats.StatsEngine
 import com.scottyab.rootbeer.RootBeer
 import java.io.File
+import java.nio.ByteBuffer
 import java.util.concurrent.TimeUnit
 import java.util.concurrent.locks.ReentrantLock
 
@@ -23,6 +24,9 @@ open class AgentNDK(val managedContext: ManagedContext? = ManagedContext()) {
     external fun nativeStart(context: ManagedContext? = null): Boolean
     external fun nativeStop()
     external fun nativeSetContext(context: ManagedContext)
+    external fun nativeDrainSlots(): Int
+    external fun nativeRenderRecords(): Int
+    external fun nativeFlushStore(budgetMs: Long): Int
 
     external fun crashNow(cause: String? = "This is a demonstration native crash courtesy of New Relic")
     external fun dumpStack(): String
@@ -46,6 +50,9 @@ open class AgentNDK(val managedContext: ManagedContext? = ManagedContext()) {
             }
         }
 
+        // report file prefixes, in the order of the native report store's types
+        internal val REPORT_PREFIXES = arrayOf("crash-", "ex-", "anr-")
+
         val lock = ReentrantLock()
 
         @Volatile
@@ -102,9 +109,17 @@ open class AgentNDK(val managedContext: ManagedContext? = ManagedContext()) {
         try {
             managedContext?.reportsDir?.run {
                 log.info("Flushing native reports from [${absolutePath}]")
+                recoverNativeReports()
+                flushReportStore()
+
+                // reports the store could not take, or left by earlier agents
                 if (exists() && canRead()) {
                     listFiles()?.let {
                         for (report in it) {
+                            if (report.isDirectory || !isReportFile(report)) {
+                                continue
+                            }
+
                             try {
                                 if (postReport(report)) {
                                     log.info("Native report [${report.name}] submitted to New Relic")
@@ -137,25 +152,115 @@ open class AgentNDK(val managedContext: ManagedContext? = ManagedContext()) {
         }
     }
 
+    /**
+     * Move records committed to the native report slots into the reports directory,
+     * then render all pending crash records as reports
+     */
+    protected fun recoverNativeReports() {
+        try {
+            val drained = nativeDrainSlots()
+            if (drained > 0) {
+                log.info("Recovered $drained native report(s) from report slots")
+            }
+
+            val rendered = nativeRenderRecords()
+            if (rendered > 0) {
+                log.info("Rendered $rendered native crash record(s)")
+            }
+        } catch (e: UnsatisfiedLinkError) {
+            log.warn("Native report recovery is not available: " + e.localizedMessage)
+        }
+    }
+
+    /**
+     * Post the reports in the native report store, oldest first, until the flush budget is
+     * spent. Reports that are consumed, or have expired, are acknowledged and removed from
+     * the store. The rest are posted on the next flush.
+     */
+    protected fun flushReportStore() {
+        try {
+            val flushed = nativeFlushStore(managedContext?.flushBudget ?: ManagedContext.DEFAULT_FLUSH_BUDGET)
+            if (flushed > 0) {
+                log.info("Flushed $flushed native report(s) from the report store")
+            }
+        } catch (e: UnsatisfiedLinkError) {
+            log.warn("Native report store is not available: " + e.localizedMessage)
+        }
+    }
+
+    /**
+     * Called by nativeFlushStore() with each stored report, decompressed into native memory
+     * that is released when this returns
+     *
+     * @param type the report type, as ordered in REPORT_PREFIXES
+     * @param timestamp when the report was stored, in ms since the epoch
+     * @return true if the report was consumed or has expired, and should be removed
+     */
+    protected fun onStoredReport(type: Int, timestamp: Long, report: ByteBuffer): Boolean {
+        try {
+            if (postReport(REPORT_PREFIXES.getOrElse(type) { "" }, report.asReadOnlyBuffer())) {
+                log.info("Stored native report submitted to New Relic")
+                return true
+            }
+        } catch (e: Exception) {
+            log.warn("Failed to parse/write stored native report: $e")
+        }
+
+        val expirationTimeMs: Long = (System.currentTimeMillis() -
+                TimeUnit.MILLISECONDS.convert(managedContext?.expirationPeriod ?: ManagedContext.DEFAULT_TTL,
+                    TimeUnit.SECONDS))
+        if (timestamp < expirationTimeMs) {
+            log.info("Stored native report has expired, deleting...")
+            return true
+        }
+
+        return false
+    }
+
+    protected fun isReportFile(report: File): Boolean {
+        return REPORT_PREFIXES.any { report.name.startsWith(it, true) }
+    }
+
+    /**
+     * Pass a report to the listener method for its type
+     *
+     * @return true if the listener consumed the report
+     */
+    protected fun postReport(prefix: String, report: String): Boolean {
+        return managedContext?.nativeReportListener?.run {
+            when (prefix) {
+                "crash-" -> onNativeCrash(report)
+                "ex-" -> onNativeException(report)
+                "anr-" -> onApplicationNotResponding(report)
+                else -> false
+            }
+        } ?: false
+    }
+
+    /**
+     * Pass a report to a buffer listener as it is, or to any other listener as a string
+     *
+     * @return true if the listener consumed the report
+     */
+    protected fun postReport(prefix: String, report: ByteBuffer): Boolean {
+        return when (val listener = managedContext?.nativeReportListener) {
+            is AgentNDKBufferListener -> when (prefix) {
+                "crash-" -> listener.onNativeCrash(report)
+                "ex-" -> listener.onNativeException(report)
+                "anr-" -> listener.onApplicationNotResponding(report)
+                else -> false
+            }
+            null -> false
+            else -> postReport(prefix, NativeReport.decode(report))
+        }
+    }
+
     protected fun postReport(report: File): Boolean {
         if (report.exists()) {
             log.info("Posting native report data from [${report.absolutePath}]")
             managedContext?.nativeReportListener?.apply {
-                var consumed = false
-
-                when {
-                    report.name.startsWith("crash-", true) -> {
-                        consumed = onNativeCrash(report.readText(Charsets.UTF_8))
-                    }
-
-                    report.name.startsWith("ex-", true) -> {
-                        consumed = onNativeException(report.readText(Charsets.UTF_8))
-                    }
-
-                    report.name.startsWith("anr-", true) -> {
-                        consumed = onApplicationNotResponding(report.readText(Charsets.UTF_8))
-                    }
-                }
+                val prefix = REPORT_PREFIXES.firstOrNull { report.name.startsWith(it, true) }
+                val consumed = (prefix != null) && postReport(prefix, NativeReport.read(report))
 
                 if (consumed) {
                     if (report.delete()) {
@@ -239,6 +344,65 @@ open class AgentNDK(val managedContext: ManagedContext? = ManagedContext()) {
             return this
         }
 
+        /**
+         * Capture the stack of every thread in crash and ANR reports, not just the reporting thread
+         */
+        fun withAllThreadStacks(enabled: Boolean): Builder {
+            managedContext.allThreadStacks = enabled
+            return this
+        }
+
+        /**
+         * Process crashes in a helper process forked at startup, rather than in the crashing process
+         */
+        fun withCrashHelper(enabled: Boolean): Builder {
+            managedContext.crashHelper = enabled
+            return this
+        }
+
+        /**
+         * Sets the period, in seconds, in which repeats of a crash or ANR with the same stack
+         * are counted against the first report, while it waits to be rendered at the next launch,
+         * rather than reported again. 0, the default, reports every one.
+         */
+        fun withCoalesceWindow(coalesceWindow: Long): Builder {
+            managedContext.coalesceWindow = coalesceWindow
+            return this
+        }
+
+        /**
+         * Sets the report store quota of each report type, as the payload bytes and the number of
+         * reports held until they are delivered. The oldest reports are dropped to keep within it.
+         * 0 keeps the default.
+         */
+        fun withReportQuota(bytes: Long, count: Long): Builder {
+            managedContext.reportQuotaBytes = bytes
+            managedContext.reportQuotaCount = count
+            return this
+        }
+
+        /**
+         * Sets the time, in milliseconds, spent posting stored reports at launch. Reports not
+         * posted in that time are posted on the next launch. 0 posts every report.
+         */
+        fun withFlushBudget(flushBudget: Long): Builder {
+            managedContext.flushBudget = flushBudget
+            return this
+        }
+
+        /**
+         * Sample the stacks of the process' native threads, writing a profile of folded stacks
+         * next to the reports each minute. Profiling is off by default.
+         *
+         * @param mode ManagedContext.PROFILER_CPU, PROFILER_WALL or PROFILER_OFF
+         * @param hz samples per second, per thread
+         */
+        fun withProfiler(mode: Int, hz: Int = ManagedContext.DEFAULT_PROFILER_HZ): Builder {
+            managedContext.profiler = mode
+            managedContext.profilerHz = hz
+            return this
+        }
+
         fun build(): AgentNDK {
             managedContext.reportsDir?.mkdirs()
             agentNdk = AgentNDK(managedContext)
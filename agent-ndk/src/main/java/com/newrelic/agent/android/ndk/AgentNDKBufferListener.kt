@@ -0,0 +1,36 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+package com.newrelic.agent.android.ndk
+
+import java.nio.ByteBuffer
+
+/**
+ * A listener that takes stored native reports as UTF-8 JSON in read-only direct buffers,
+ * rather than as strings. The buffers refer to native memory that is released when the
+ * method returns: they must not be retained, or read on another thread.
+ */
+interface AgentNDKBufferListener : AgentNDKListener {
+    /**
+     * A native crash has been detected and forwarded to this method
+     * @param ByteBuffer containing backtrace
+     * @return true if data has been consumed
+     */
+    fun onNativeCrash(crash: ByteBuffer) : Boolean
+
+    /**
+     * A native runtime exception has been detected and forwarded to this method
+     * @param ByteBuffer containing backtrace
+     * @return true if data has been consumed
+     */
+    fun onNativeException(exception: ByteBuffer) : Boolean
+
+    /**
+     * ANR condition has been detected and forwarded to this method
+     * @param ByteBuffer containing backtrace
+     * @return true if data has been consumed
+     */
+    fun onApplicationNotResponding(anr: ByteBuffer) : Boolean
+}
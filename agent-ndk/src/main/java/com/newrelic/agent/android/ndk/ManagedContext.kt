@@ -18,7 +18,15 @@ class ManagedContext(val context: Context? = null) {
     var reportsDir: File? = getNativeReportsDir(context?.cacheDir)
     var nativeReportListener: AgentNDKListener? = null
     var anrMonitor: Boolean = true
+    var allThreadStacks: Boolean = false
+    var crashHelper: Boolean = false
     var expirationPeriod = DEFAULT_TTL
+    var coalesceWindow = DEFAULT_COALESCE_WINDOW
+    var reportQuotaBytes = 0L
+    var reportQuotaCount = 0L
+    var flushBudget = DEFAULT_FLUSH_BUDGET
+    var profiler = PROFILER_OFF
+    var profilerHz = DEFAULT_PROFILER_HZ
 
     fun getNativeReportsDir(rootDir: File?): File {
         return File("${rootDir?.absolutePath}/newrelic/nativeReporting")
@@ -41,6 +49,13 @@ class ManagedContext(val context: Context? = null) {
 
     companion object {
         val DEFAULT_TTL = TimeUnit.SECONDS.convert(7, TimeUnit.DAYS)
+        const val DEFAULT_COALESCE_WINDOW = 0L     // s: coalescing is opt-in
+        const val DEFAULT_FLUSH_BUDGET = 250L      // ms
+
+        const val PROFILER_OFF = 0
+        const val PROFILER_CPU = 1                 // sample threads as they use CPU time
+        const val PROFILER_WALL = 2                // sample threads as time passes, running or not
+        const val DEFAULT_PROFILER_HZ = 100
     }
 
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+package com.newrelic.agent.android.ndk
+
+import java.io.File
+import java.io.IOException
+import java.nio.ByteBuffer
+
+/**
+ * Reads stored native reports, which are JSON text, or JSON compressed by the native
+ * serializer: an 8 byte header ("NRZ1" and the uncompressed size, little-endian), then
+ * LZ4 blocks of 16K, each prefixed by its size (the top bit set if stored as-is).
+ * Matches may reach back into earlier blocks.
+ */
+object NativeReport {
+    private const val FRAME_MAGIC = 0x315a524e     // "NRZ1"
+    private const val FRAME_HEADER_SZ = 8
+    private const val BLOCK_SZ = 16 * 1024
+    private const val BLOCK_STORED = 0x80000000.toInt()
+    private const val MIN_MATCH = 4
+    private const val RUN_MASK = 15
+
+    fun read(report: File): String {
+        return decode(report.readBytes())
+    }
+
+    fun decode(data: ByteArray): String {
+        return String(if (isCompressed(data)) decompress(data) else data, Charsets.UTF_8)
+    }
+
+    /**
+     * Decode a report handed off from native memory, which is never compressed
+     */
+    fun decode(buffer: ByteBuffer): String {
+        return Charsets.UTF_8.decode(buffer.duplicate()).toString()
+    }
+
+    fun isCompressed(data: ByteArray): Boolean {
+        return data.size >= FRAME_HEADER_SZ && int32(data, 0) == FRAME_MAGIC
+    }
+
+    /**
+     * @throws IOException if the frame is malformed
+     */
+    fun decompress(data: ByteArray): ByteArray {
+        if (!isCompressed(data)) {
+            throw IOException("Not a compressed native report")
+        }
+
+        val total = int32(data, 4)
+        if (total < 0) {
+            throw IOException("Compressed native report is too large")
+        }
+
+        val out = ByteArray(total)
+        var input = FRAME_HEADER_SZ
+        var pos = 0
+        while (pos < total) {
+            if (data.size - input < 4) {
+                throw IOException("Compressed native report is truncated")
+            }
+            val blockHeader = int32(data, input)
+            val blockSize = blockHeader and BLOCK_STORED.inv()
+            input += 4
+            if (blockSize > data.size - input) {
+                throw IOException("Compressed native report is truncated")
+            }
+
+            val end = minOf(pos + BLOCK_SZ, total)
+            if (blockHeader and BLOCK_STORED != 0) {
+                if (blockSize != end - pos) {
+                    throw IOException("Stored block is the wrong size")
+                }
+                System.arraycopy(data, input, out, pos, blockSize)
+            } else {
+                decompressBlock(data, input, input + blockSize, out, pos, end)
+            }
+            input += blockSize
+            pos = end
+        }
+
+        if (input != data.size) {
+            throw IOException("Compressed native report has trailing data")
+        }
+        return out
+    }
+
+    private fun decompressBlock(data: ByteArray, from: Int, to: Int, out: ByteArray, start: Int, end: Int) {
+        var input = from
+        var pos = start
+
+        fun length(initial: Int): Int {
+            var length = initial
+            do {
+                if (input >= to) {
+                    throw IOException("Block is truncated")
+                }
+                val byte = data[input++].toInt() and 0xff
+                length += byte
+            } while (byte == 255)
+            return length
+        }
+
+        while (input < to) {
+            val token = data[input++].toInt() and 0xff
+
+            var literals = token ushr 4
+            if (literals == RUN_MASK) {
+                literals = length(literals)
+            }
+            if (literals > to - input || literals > end - pos) {
+                throw IOException("Block literals overrun")
+            }
+            System.arraycopy(data, input, out, pos, literals)
+            input += literals
+            pos += literals
+
+            // the last sequence has no match
+            if (input == to) {
+                break
+            }
+
+            if (to - input < 2) {
+                throw IOException("Block is truncated")
+            }
+            val offset = (data[input].toInt() and 0xff) or ((data[input + 1].toInt() and 0xff) shl 8)
+            input += 2
+            var matchLength = token and RUN_MASK
+            if (matchLength == RUN_MASK) {
+                matchLength = length(matchLength)
+            }
+            matchLength += MIN_MATCH
+            if (offset == 0 || offset > pos || matchLength > end - pos) {
+                throw IOException("Block match overruns")
+            }
+
+            // byte by byte: a match may overlap the bytes it produces
+            for (i in 0 until matchLength) {
+                out[pos + i] = out[pos - offset + i]
+            }
+            pos += matchLength
+        }
+
+        if (pos != end) {
+            throw IOException("Block is the wrong size")
+        }
+    }
+
+    private fun int32(data: ByteArray, at: Int): Int {
+        return (data[at].toInt() and 0xff) or
+                ((data[at + 1].toInt() and 0xff) shl 8) or
+                ((data[at + 2].toInt() and 0xff) shl 16) or
+                ((data[at + 3].toInt() and 0xff) shl 24)
+    }
+}
@@ -0,0 +1,235 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+
+#include <agent-ndk.h>
+#include "anr-handler.h"
+#include "arena.h"
+#include "record.h"
+#include "serializer.h"
+#include "signal-utils.h"
+#include "thread-stacks.h"
+#include "jni/native-context.h"
+#include "TestFixtures.h"
+
+static const int BENCHMARK_ITERATIONS = 20;
+static const uint64_t REPORT_TIMEOUT_NS = 5000000000ULL;
+
+/**
+ * SIGQUITs taken by the test thread, reported by the watchdog into a scratch directory
+ */
+class AnrHandlerTest : public ReportDirTest {
+protected:
+    AnrHandlerTest() : ReportDirTest("anr") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        ASSERT_TRUE(stacks::initialize());
+        ASSERT_TRUE(anr_handler_initialize());
+    }
+
+    void TearDown() override {
+        anr_handler_shutdown();
+        stacks::shutdown();
+        ReportDirTest::TearDown();
+    }
+
+    std::vector<std::string> reports() {
+        std::vector<std::string> names;
+        DIR *dir = opendir(reportDir);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (entry->d_name[0] != '.' && std::strncmp(entry->d_name, "tmp", 3) != 0) {
+                names.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        return names;
+    }
+
+    /**
+     * Wait for the watchdog to store its reports
+     */
+    bool await_reports(size_t count) {
+        uint64_t deadline = fixtures::now_ns() + REPORT_TIMEOUT_NS;
+        while (reports().size() < count) {
+            if (fixtures::now_ns() > deadline) {
+                return false;
+            }
+            usleep(1000);
+        }
+        return true;
+    }
+
+    static uint64_t thread_cpu_ns() {
+        struct timespec cpu = {};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        return cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+    }
+
+    /**
+     * Deliver SIGQUIT to the calling thread: its handler has run when this returns
+     *
+     * @return CPU time the thread spent, in nanoseconds
+     */
+    static uint64_t quit() {
+        sigutils::unblock_signal(SIGQUIT);
+        uint64_t start = thread_cpu_ns();
+        syscall(SYS_tgkill, getpid(), gettid(), SIGQUIT);
+        return thread_cpu_ns() - start;
+    }
+};
+
+TEST_F(AnrHandlerTest, WatchdogReportsTheSignalledThread) {
+    quit();
+    ASSERT_TRUE(await_reports(1));
+
+    std::vector<std::string> names = reports();
+    ASSERT_EQ(1u, names.size());
+    EXPECT_EQ(0, names[0].find("rec-anr-")) << names[0];
+
+    ASSERT_EQ(1, record::render_pending());
+    std::vector<std::string> stored = fixtures::stored_reports();
+    ASSERT_FALSE(stored.empty());
+
+    // the thread that took the signal is reported as such, not the watchdog
+    char fragment[128];
+    std::snprintf(fragment, sizeof(fragment), "\"threadNumber\":%d,", gettid());
+    size_t thread = stored.back().find(fragment);
+    ASSERT_NE(std::string::npos, thread) << fragment;
+    EXPECT_NE(std::string::npos, stored.back().find("\"crashed\":true", thread));
+}
+
+static void *quit_thread(void *) {
+    sigutils::unblock_signal(SIGQUIT);
+    syscall(SYS_tgkill, getpid(), gettid(), SIGQUIT);
+    return nullptr;
+}
+
+TEST_F(AnrHandlerTest, MainThreadIsReportedWhoeverTakesTheSignal) {
+    ASSERT_EQ(getpid(), gettid()) << "the test must run on the main thread";
+
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, nullptr, quit_thread, nullptr));
+    pthread_join(thread, nullptr);
+
+    // the main thread answers the watchdog's request for its stack from here
+    ASSERT_TRUE(await_reports(1));
+    ASSERT_EQ(1, record::render_pending());
+    std::vector<std::string> stored = fixtures::stored_reports();
+    ASSERT_FALSE(stored.empty());
+    const std::string &report = stored.back();
+
+    char fragment[128];
+    std::snprintf(fragment, sizeof(fragment), "\"threadNumber\":%d,", getpid());
+    size_t main_thread = report.find(fragment);
+    ASSERT_NE(std::string::npos, main_thread) << fragment;
+    EXPECT_NE(std::string::npos, report.find("\"crashed\":true,\"stack\":[{", main_thread));
+
+    // and is the only primary thread: the thread that took the signal isn't
+    EXPECT_EQ(report.find("\"crashed\":true"), report.rfind("\"crashed\":true"));
+}
+
+static std::atomic<bool> quit_released(false);
+
+static void *quit_and_wait(void *) {
+    sigutils::unblock_signal(SIGQUIT);
+    syscall(SYS_tgkill, getpid(), gettid(), SIGQUIT);
+
+    // the stack the handler saw is reused while the watchdog waits on the main thread
+    while (!quit_released) {
+        usleep(1000);
+    }
+    return nullptr;
+}
+
+TEST_F(AnrHandlerTest, SignalledThreadIsReportedWithItsHandlersFrames) {
+    ASSERT_EQ(getpid(), gettid()) << "the test must run on the main thread";
+
+    // the main thread never answers the watchdog's request for its stack
+    sigset_t mask, previous;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, &previous);
+    quit_released = false;
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, nullptr, quit_and_wait, nullptr));
+    bool reported = await_reports(1);
+    quit_released = true;
+    pthread_join(thread, nullptr);
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    ASSERT_TRUE(reported);
+
+    ASSERT_EQ(1, record::render_pending());
+    std::vector<std::string> stored = fixtures::stored_reports();
+    ASSERT_FALSE(stored.empty());
+    const std::string &report = stored.back();
+
+    // the thread that took the signal is primary, with the frames its handler walked
+    size_t primary = report.find("\"crashed\":true,\"stack\":[{");
+    ASSERT_NE(std::string::npos, primary) << report;
+    EXPECT_EQ(primary, report.rfind("\"crashed\":true"));
+
+    char fragment[128];
+    std::snprintf(fragment, sizeof(fragment), "\"threadNumber\":%d,", getpid());
+    size_t main_thread = report.find(fragment);
+    ASSERT_NE(std::string::npos, main_thread) << fragment;
+    EXPECT_EQ(report.find("\"crashed\":", main_thread), report.find("\"crashed\":false", main_thread));
+}
+
+TEST_F(AnrHandlerTest, HandlerIsReentrant) {
+    quit();
+    ASSERT_TRUE(await_reports(1));
+    quit();
+    ASSERT_TRUE(await_reports(2));
+}
+
+/**
+ * CPU time the signalled thread spends in the handler: collecting and storing the report there,
+ * as the handler did, against handing it to the watchdog (which wall time would also count,
+ * when the watchdog preempts the signalled thread on a single core)
+ */
+TEST_F(AnrHandlerTest, HandlerBenchmark) {
+    std::printf("[ BENCHMARK] SIGQUIT handler, signalled thread\n");
+
+    siginfo_t siginfo = {};
+    siginfo.si_signo = SIGQUIT;
+    ucontext_t ucontext = {};
+    uint64_t inline_ns = 0;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        getcontext(&ucontext);
+        uint64_t start = thread_cpu_ns();
+        ASSERT_TRUE(arena::acquire());
+        char *buffer = arena::alloc_array<char>(BACKTRACE_SZ_MAX);
+        size_t size = collect_crash_record(buffer, BACKTRACE_SZ_MAX, &siginfo, &ucontext);
+        ASSERT_GT(size, 0u);
+        serializer::from_anr(buffer, size);
+        arena::release();
+        inline_ns += thread_cpu_ns() - start;
+    }
+
+    uint64_t deferred_ns = 0;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        deferred_ns += quit();
+        ASSERT_TRUE(await_reports(BENCHMARK_ITERATIONS + i + 1));
+    }
+
+    std::printf("[ BENCHMARK]   inline:   %10llu ns cpu/signal\n",
+                static_cast<unsigned long long>(inline_ns / BENCHMARK_ITERATIONS));
+    std::printf("[ BENCHMARK]   deferred: %10llu ns cpu/signal\n",
+                static_cast<unsigned long long>(deferred_ns / BENCHMARK_ITERATIONS));
+}
@@ -0,0 +1,97 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "arena.h"
+
+static const int RACE_THREADS = 4;
+static const int RACE_ITERATIONS = 200;
+
+TEST(ArenaTest, LeasesCommitTheRegion) {
+    ASSERT_TRUE(arena::initialize(BACKTRACE_ARENA_SZ_MAX));
+    EXPECT_EQ(nullptr, arena::alloc(64));
+
+    ASSERT_TRUE(arena::acquire());
+    auto *block = static_cast<char *>(arena::alloc(64));
+    ASSERT_NE(nullptr, block);
+    std::memset(block, 0xff, 64);
+    EXPECT_EQ(64u, arena::used());
+    arena::release();
+    EXPECT_EQ(0u, arena::used());
+
+    // the next lease sees zero-filled pages
+    ASSERT_TRUE(arena::acquire());
+    block = static_cast<char *>(arena::alloc(64));
+    ASSERT_NE(nullptr, block);
+    EXPECT_EQ(0, block[0]);
+    arena::release();
+
+    arena::shutdown();
+    EXPECT_FALSE(arena::acquire());
+}
+
+TEST(ArenaTest, OutstandingLeasesKeepTheRegionMapped) {
+    ASSERT_TRUE(arena::initialize(BACKTRACE_ARENA_SZ_MAX));
+    ASSERT_TRUE(arena::acquire());
+
+    arena::shutdown();
+    auto *block = static_cast<char *>(arena::alloc(64));
+    ASSERT_NE(nullptr, block);
+    block[63] = 1;
+    arena::release();
+
+    arena::shutdown();
+    EXPECT_FALSE(arena::acquire());
+}
+
+/**
+ * Take and use leases until told to stop, while the arena comes and goes
+ */
+static void *lease_repeatedly(void *arg) {
+    auto *stop = static_cast<std::atomic<bool> *>(arg);
+    while (!stop->load()) {
+        if (arena::acquire()) {
+            auto *block = static_cast<char *>(arena::alloc(4096));
+            if (block != nullptr) {
+                std::memset(block, 0xff, 4096);
+            }
+            arena::release();
+        }
+    }
+    return nullptr;
+}
+
+TEST(ArenaTest, ShutdownNeverUnmapsALease) {
+    std::atomic<bool> stop(false);
+    std::vector<pthread_t> threads(RACE_THREADS);
+    for (auto &thread: threads) {
+        ASSERT_EQ(0, pthread_create(&thread, nullptr, lease_repeatedly, &stop));
+    }
+
+    // a lease written to after its pages were unmapped would fault
+    for (int i = 0; i < RACE_ITERATIONS; i++) {
+        ASSERT_TRUE(arena::initialize(BACKTRACE_ARENA_SZ_MAX));
+        usleep(100);
+        arena::shutdown();
+    }
+
+    stop = true;
+    for (auto &thread: threads) {
+        pthread_join(thread, nullptr);
+    }
+
+    // a shutdown that found a lease outstanding kept its reference
+    while (arena::capacity() > 0) {
+        arena::shutdown();
+    }
+    EXPECT_FALSE(arena::acquire());
+}
@@ -0,0 +1,341 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <dlfcn.h>
+#include <zlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+#include "cfi-unwinder.h"
+#include "module-index.h"
+#include "unwinder.h"
+#include "TestFixtures.h"
+
+static const int UNWIND_SIGNAL = SIGURG;
+static const int NESTED_SIGNAL = SIGWINCH;
+static const int BENCHMARK_ITERATIONS = 200;
+
+/**
+ * What a signal handler saw at the bottom of a recursion, per thread
+ */
+typedef struct unwound {
+    int iterations;
+    bool cold;                  // flush the FDE cache before each unwind
+    bool nest;                  // raise a nested signal, and unwind its context too
+    void (*probe)(struct unwound &, const ucontext_t *);    // unwinds while the stack is still live
+    bool unwound_cfi;
+    backtrace_state_t cfi;
+    backtrace_state_t runtime;
+    backtrace_state_t nested;
+    backtrace_state_t probed;
+    uint64_t cfi_ns;
+    uint64_t runtime_ns;
+
+} unwound_t;
+
+static thread_local unwound_t *unwound = nullptr;
+
+static void nested_handler(int, siginfo_t *, void *ucontext) {
+    unwound->nested.sa_ucontext = static_cast<const ucontext_t *>(ucontext);
+    unwind_cfi(unwound->nested);
+    unwound->nested.sa_ucontext = nullptr;
+}
+
+static void unwind_handler(int, siginfo_t *, void *ucontext) {
+    const ucontext_t *context = static_cast<const ucontext_t *>(ucontext);
+
+    uint64_t elapsed = 0;
+    for (int i = 0; i < unwound->iterations; i++) {
+        if (unwound->cold) {
+            cfi::flush();
+        }
+        uint64_t start = fixtures::now_ns();
+        unwound->cfi.sa_ucontext = context;
+        unwound->unwound_cfi = unwind_cfi(unwound->cfi);
+        elapsed += fixtures::now_ns() - start;
+    }
+    unwound->cfi_ns = elapsed;
+
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < unwound->iterations; i++) {
+        unwound->runtime.sa_ucontext = context;
+        unwind_runtime(unwound->runtime);
+    }
+    unwound->runtime_ns = fixtures::now_ns() - start;
+
+    if (unwound->probe != nullptr) {
+        unwound->probe(*unwound, context);
+    }
+    if (unwound->nest) {
+        syscall(SYS_tgkill, getpid(), gettid(), NESTED_SIGNAL);
+    }
+
+    unwound->cfi.sa_ucontext = nullptr;
+    unwound->runtime.sa_ucontext = nullptr;
+}
+
+static int descend_b(int depth);
+
+/**
+ * Mutually recursive, so consecutive frames differ (the unwinders drop repeated frames)
+ */
+__attribute__((noinline)) static int descend_a(int depth) {
+    if (depth <= 0) {
+        syscall(SYS_tgkill, getpid(), gettid(), UNWIND_SIGNAL);
+        return 0;
+    }
+    int result = descend_b(depth - 1) + 1;
+    asm volatile("" : : : "memory");
+    return result;
+}
+
+__attribute__((noinline)) static int descend_b(int depth) {
+    if (depth <= 0) {
+        syscall(SYS_tgkill, getpid(), gettid(), UNWIND_SIGNAL);
+        return 0;
+    }
+    int result = descend_a(depth - 1) + 2;
+    asm volatile("" : : : "memory");
+    return result;
+}
+
+static void set_pc(ucontext_t &ucontext, uintptr_t pc) {
+#if defined(__i386)
+    ucontext.uc_mcontext.gregs[REG_EIP] = pc;
+#elif defined(__x86_64__)
+    ucontext.uc_mcontext.gregs[REG_RIP] = pc;
+#elif defined(__arm__)
+    ucontext.uc_mcontext.arm_pc = pc;
+#elif defined(__aarch64__)
+    ucontext.uc_mcontext.pc = pc;
+#endif
+}
+
+static bool same_frames(const backtrace_state_t &a, size_t a_from, const backtrace_state_t &b, size_t b_from) {
+    if (a.frame_cnt - a_from != b.frame_cnt - b_from) {
+        return false;
+    }
+    return std::equal(a.frames + a_from, a.frames + a.frame_cnt, b.frames + b_from);
+}
+
+/**
+ * zlib's allocator, called from inside the library: unwinds from a signal raised below it
+ */
+static voidpf unwinding_alloc(voidpf opaque, uInt, uInt) {
+    unwound = static_cast<unwound_t *>(opaque);
+    descend_a(2);
+    unwound = nullptr;
+    return Z_NULL;
+}
+
+static bool in_library(uintptr_t pc, const void *library_base) {
+    Dl_info info = {};
+    return dladdr(reinterpret_cast<void *>(pc), &info) != 0 && info.dli_fbase == library_base;
+}
+
+class CfiUnwinderTest : public ::testing::Test {
+protected:
+    struct sigaction sa_previous = {};
+    struct sigaction sa_nested_previous = {};
+
+    void SetUp() override {
+#if defined(__arm__)
+        GTEST_SKIP() << "32-bit ARM unwinds with .ARM.exidx";
+#endif
+        unwinder_initialize();
+        ASSERT_TRUE(modules::initialize());
+
+        struct sigaction sa = {};
+        sa.sa_sigaction = unwind_handler;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        ASSERT_EQ(0, sigaction(UNWIND_SIGNAL, &sa, &sa_previous));
+
+        sa.sa_sigaction = nested_handler;
+        ASSERT_EQ(0, sigaction(NESTED_SIGNAL, &sa, &sa_nested_previous));
+    }
+
+    void TearDown() override {
+        sigaction(UNWIND_SIGNAL, &sa_previous, nullptr);
+        sigaction(NESTED_SIGNAL, &sa_nested_previous, nullptr);
+        modules::shutdown();
+    }
+
+    static void unwind_at_depth(unwound_t &state, int depth, int iterations, bool cold = false, bool nest = false,
+                                void (*probe)(unwound_t &, const ucontext_t *) = nullptr) {
+        state = {};
+        state.iterations = iterations;
+        state.cold = cold;
+        state.nest = nest;
+        state.probe = probe;
+        unwound = &state;
+        descend_a(depth);
+        unwound = nullptr;
+    }
+};
+
+TEST_F(CfiUnwinderTest, AgreesWithRuntimeUnwinder) {
+    unwound_t state;
+    cfi::flush();
+    unwind_at_depth(state, 40, 1, false, false, [](unwound_t &unwound, const ucontext_t *ucontext) {
+        // again, from the FDEs cached by the first unwind
+        unwound.probed.sa_ucontext = ucontext;
+        unwind_cfi(unwound.probed);
+    });
+
+    ASSERT_TRUE(state.unwound_cfi);
+    EXPECT_EQ(state.runtime.crash_ip, state.cfi.frames[0]);
+    EXPECT_GT(state.cfi.frame_cnt, 40u);
+    EXPECT_TRUE(same_frames(state.cfi, 0, state.runtime, 0));
+    EXPECT_TRUE(same_frames(state.probed, 0, state.cfi, 0));
+}
+
+TEST_F(CfiUnwinderTest, UnwindsFromAFunctionEntry) {
+    unwound_t state;
+    unwind_at_depth(state, 4, 1, false, false, [](unwound_t &unwound, const ucontext_t *ucontext) {
+        // a call through a null pointer from the syscall stub's caller: the stub is a leaf,
+        // so the return address is where the call would have left it
+        ucontext_t entry = *ucontext;
+        set_pc(entry, 0);
+        unwound.probed.sa_ucontext = &entry;
+        unwind_cfi(unwound.probed);
+        unwound.probed.sa_ucontext = nullptr;
+    });
+
+    ASSERT_TRUE(state.unwound_cfi);
+    ASSERT_GT(state.probed.frame_cnt, 4u);
+    EXPECT_EQ(0u, state.probed.frames[0]);
+    EXPECT_TRUE(same_frames(state.probed, 1, state.cfi, 1));
+}
+
+TEST_F(CfiUnwinderTest, UnwindsThroughNestedSignalFrames) {
+    unwound_t state;
+    unwind_at_depth(state, 8, 1, false, true);
+    ASSERT_TRUE(state.unwound_cfi);
+
+    // the nested handler's stack passes through the outer handler and the sigreturn
+    // trampoline, then continues exactly as the outer context's
+    ASSERT_GT(state.nested.frame_cnt, state.cfi.frame_cnt);
+    EXPECT_TRUE(same_frames(state.nested, state.nested.frame_cnt - state.cfi.frame_cnt, state.cfi, 0));
+}
+
+TEST_F(CfiUnwinderTest, UnknownContextsFallBackToRuntimeUnwinder) {
+    // dumpStack() unwinds from an empty context
+    ucontext_t ucontext = {};
+    backtrace_state_t state = {};
+    state.sa_ucontext = &ucontext;
+    EXPECT_FALSE(unwind_cfi(state));
+    EXPECT_TRUE(unwind_backtrace(state));
+
+    // without a module index
+    modules::shutdown();
+    unwound_t unindexed;
+    unwind_at_depth(unindexed, 4, 1);
+    EXPECT_FALSE(unindexed.unwound_cfi);
+    EXPECT_GT(unindexed.runtime.frame_cnt, 4u);
+}
+
+TEST_F(CfiUnwinderTest, UnwindsThroughLibrariesLoadedAfterTheIndex) {
+    const char *libraries[] = {"libz.so", "libz.so.1"};
+    void *handle = nullptr;
+    for (const char *library: libraries) {
+        if (handle == nullptr && dlopen(library, RTLD_NOW | RTLD_NOLOAD) == nullptr) {
+            handle = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+        }
+    }
+    if (handle == nullptr) {
+        GTEST_SKIP() << "no unloaded zlib to load";
+    }
+
+    typedef int (*inflate_init_t)(z_streamp, const char *, int);
+    inflate_init_t inflate_init = reinterpret_cast<inflate_init_t>(dlsym(handle, "inflateInit_"));
+    ASSERT_NE(nullptr, inflate_init);
+    Dl_info library = {};
+    ASSERT_NE(0, dladdr(reinterpret_cast<void *>(inflate_init), &library));
+    ASSERT_EQ(nullptr, modules::find(reinterpret_cast<uintptr_t>(inflate_init)));
+
+    // a signal raised from a callback the library calls
+    unwound_t state = {};
+    state.iterations = 1;
+    state.probe = [](unwound_t &unwound, const ucontext_t *ucontext) {
+        unwound.probed.sa_ucontext = ucontext;
+        unwind_backtrace(unwound.probed);
+        unwound.probed.sa_ucontext = nullptr;
+    };
+    z_stream stream = {};
+    stream.zalloc = unwinding_alloc;
+    stream.opaque = &state;
+    EXPECT_EQ(Z_MEM_ERROR, inflate_init(&stream, ZLIB_VERSION, sizeof(stream)));
+
+    // the CFI walk stops at the library, and the runtime unwinder carries on through it
+    EXPECT_FALSE(state.unwound_cfi);
+    ASSERT_GT(state.probed.frame_cnt, state.cfi.frame_cnt);
+    EXPECT_TRUE(std::equal(state.cfi.frames, state.cfi.frames + state.cfi.frame_cnt, state.probed.frames));
+
+    const backtrace_state_t &probed = state.probed;
+    const uintptr_t *through = std::find_if(probed.frames, probed.frames + probed.frame_cnt, [&](uintptr_t pc) {
+        return in_library(pc, library.dli_fbase);
+    });
+    ASSERT_NE(probed.frames + probed.frame_cnt, through);
+    EXPECT_GT(probed.frames + probed.frame_cnt, through + 1);
+    dlclose(handle);
+}
+
+TEST_F(CfiUnwinderTest, ThreadsShareTheFdeCache) {
+    static const int THREAD_CNT = 4;
+    std::atomic<int> agreed(0);
+    std::vector<std::thread> threads;
+
+    cfi::flush();
+    for (int t = 0; t < THREAD_CNT; t++) {
+        threads.emplace_back([&agreed, t]() {
+            for (int i = 0; i < 20; i++) {
+                unwound_t state;
+                unwind_at_depth(state, 10 + t * 3 + i % 4, 1);
+                if (state.unwound_cfi && same_frames(state.cfi, 0, state.runtime, 0)) {
+                    agreed++;
+                }
+            }
+        });
+    }
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+    EXPECT_EQ(THREAD_CNT * 20, agreed.load());
+}
+
+TEST_F(CfiUnwinderTest, UnwindBenchmark) {
+    std::printf("[ BENCHMARK] unwinding from a signal context (%d unwinds per depth)\n", BENCHMARK_ITERATIONS);
+    for (int depth: {16, 48, 96}) {
+        unwound_t cold;
+        unwound_t warm;
+        unwind_at_depth(cold, depth, BENCHMARK_ITERATIONS, true);
+        unwind_at_depth(warm, depth, BENCHMARK_ITERATIONS);
+
+        double runtime_frames_us = 1000.0 * warm.runtime.frame_cnt * BENCHMARK_ITERATIONS /
+                                   std::max<uint64_t>(warm.runtime_ns, 1);
+        double cold_frames_us = 1000.0 * cold.cfi.frame_cnt * BENCHMARK_ITERATIONS /
+                                std::max<uint64_t>(cold.cfi_ns, 1);
+        double warm_frames_us = 1000.0 * warm.cfi.frame_cnt * BENCHMARK_ITERATIONS /
+                                std::max<uint64_t>(warm.cfi_ns, 1);
+
+        std::printf("[ BENCHMARK]   depth %3d: _Unwind_Backtrace %3zu frames %6.1f frames/us,"
+                    " context cfi %3zu frames %6.1f frames/us (uncached %6.1f), %s\n",
+                    depth, warm.runtime.frame_cnt, runtime_frames_us,
+                    warm.cfi.frame_cnt, warm_frames_us, cold_frames_us,
+                    same_frames(warm.cfi, 0, warm.runtime, 0) ? "same frames" : "frames differ");
+        EXPECT_TRUE(same_frames(warm.cfi, 0, warm.runtime, 0));
+    }
+}
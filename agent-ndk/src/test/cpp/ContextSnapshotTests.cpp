@@ -0,0 +1,178 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+#include "context-snapshot.h"
+#include "emitter.h"
+#include "writer.h"
+#include "procfs.h"
+#include "jni/native-context.h"
+#include "TestFixtures.h"
+
+static const int BENCHMARK_ITERATIONS = 10000;
+
+class ContextSnapshotTest : public ::testing::Test {
+protected:
+    backtrace_t backtrace = {};
+    threadinfo_t thread = {};
+    siginfo_t siginfo = {};
+    char *buffer = nullptr;
+    jni::native_context_t saved_context = {};
+
+    void SetUp() override {
+        buffer = new char[BACKTRACE_SZ_MAX];
+
+        jni::native_context_t &native_context = jni::get_native_context();
+        saved_context = native_context;
+        std::strncpy(native_context.buildId, "build-0123", sizeof(native_context.buildId) - 1);
+        std::strncpy(native_context.sessionId, "session-4567", sizeof(native_context.sessionId) - 1);
+
+        siginfo.si_signo = SIGSEGV;
+        siginfo.si_code = SEGV_MAPERR;
+        backtrace.state.siginfo = &siginfo;
+        std::strncpy(backtrace.description, "Address not mapped", sizeof(backtrace.description) - 1);
+        backtrace.timestamp = 1700000000;
+
+        thread.tid = getpid();
+        std::strncpy(thread.thread_name, "main", sizeof(thread.thread_name) - 1);
+        std::strncpy(thread.thread_state, "RUNNING", sizeof(thread.thread_state) - 1);
+        thread.crashed = true;
+        thread.backtrace_state = &backtrace.state;
+        backtrace.threads = &thread;
+        backtrace.thread_cnt = 1;
+    }
+
+    void TearDown() override {
+        delete[] buffer;
+        jni::get_native_context() = saved_context;
+        context::publish();
+    }
+
+    /**
+     * Fill the process context with live reads, as a crash without a snapshot does
+     */
+    void with_live_context() {
+        jni::native_context_t &native_context = jni::get_native_context();
+        std::strncpy(backtrace.arch, get_arch(), sizeof(backtrace.arch) - 1);
+        backtrace.pid = getpid();
+        backtrace.ppid = getppid();
+        backtrace.uid = getuid();
+        procfs::read_process_name(backtrace.pid, backtrace.process_name, sizeof(backtrace.process_name));
+        std::strncpy(backtrace.build_id, native_context.buildId, sizeof(backtrace.build_id) - 1);
+        std::strncpy(backtrace.session_id, native_context.sessionId, sizeof(backtrace.session_id) - 1);
+        backtrace.context = nullptr;
+    }
+
+    std::string emit() {
+        writer_t writer = {};
+        writer::to_buffer(writer, buffer, BACKTRACE_SZ_MAX);
+        EXPECT_TRUE(emit_backtrace(backtrace, writer));
+        return std::string(buffer, writer.length);
+    }
+};
+
+TEST_F(ContextSnapshotTest, PublishedSnapshotDescribesTheProcess) {
+    ASSERT_TRUE(context::publish());
+
+    const context::snapshot_t *snapshot = context::acquire(getpid());
+    ASSERT_NE(nullptr, snapshot);
+    EXPECT_EQ(getpid(), snapshot->pid);
+    EXPECT_EQ(getppid(), snapshot->ppid);
+    EXPECT_EQ(static_cast<int>(getuid()), snapshot->uid);
+    EXPECT_STREQ(get_arch(), snapshot->arch);
+    EXPECT_STREQ("build-0123", snapshot->build_id);
+    EXPECT_STREQ("session-4567", snapshot->session_id);
+
+    char process_name[PATH_MAX] = {};
+    procfs::read_process_name(getpid(), process_name, sizeof(process_name));
+    EXPECT_STREQ(process_name, snapshot->process_name);
+    EXPECT_GT(snapshot->json_len, snapshot->json_name_len);
+    context::release(snapshot);
+}
+
+TEST_F(ContextSnapshotTest, SnapshotOfAnotherProcessIsNotAcquired) {
+    ASSERT_TRUE(context::publish());
+    EXPECT_EQ(nullptr, context::acquire(getpid() + 1));
+}
+
+TEST_F(ContextSnapshotTest, HeldSnapshotSurvivesRepublishing) {
+    ASSERT_TRUE(context::publish());
+    const context::snapshot_t *held = context::acquire(getpid());
+    ASSERT_NE(nullptr, held);
+
+    std::strncpy(jni::get_native_context().sessionId, "session-next",
+                 sizeof(jni::get_native_context().sessionId) - 1);
+    ASSERT_TRUE(context::publish());
+
+    const context::snapshot_t *current = context::acquire(getpid());
+    ASSERT_NE(nullptr, current);
+    EXPECT_NE(held, current);
+    EXPECT_STREQ("session-next", current->session_id);
+    EXPECT_STREQ("session-4567", held->session_id);
+    context::release(current);
+    context::release(held);
+
+    // with no readers, the next update frees the retired snapshots
+    ASSERT_TRUE(context::publish());
+}
+
+TEST_F(ContextSnapshotTest, EmitsTheSameReportAsLiveReads) {
+    with_live_context();
+    std::string expected = emit();
+
+    ASSERT_TRUE(context::publish());
+    const context::snapshot_t *snapshot = context::acquire(getpid());
+    ASSERT_NE(nullptr, snapshot);
+    std::memset(backtrace.process_name, 0, sizeof(backtrace.process_name));
+    std::memcpy(backtrace.arch, snapshot->arch, sizeof(backtrace.arch));
+    backtrace.pid = snapshot->pid;
+    backtrace.ppid = snapshot->ppid;
+    backtrace.uid = snapshot->uid;
+    std::memcpy(backtrace.process_name, snapshot->process_name, sizeof(backtrace.process_name));
+    std::memcpy(backtrace.build_id, snapshot->build_id, sizeof(backtrace.build_id));
+    std::memcpy(backtrace.session_id, snapshot->session_id, sizeof(backtrace.session_id));
+    backtrace.context = snapshot;
+
+    EXPECT_EQ(expected, emit());
+    context::release(snapshot);
+}
+
+/**
+ * Cost of filling a report's process context: reading it at crash time, against copying the
+ * published snapshot
+ */
+TEST_F(ContextSnapshotTest, CaptureBenchmark) {
+    ASSERT_TRUE(context::publish());
+    std::printf("[ BENCHMARK] process context capture, %d iterations\n", BENCHMARK_ITERATIONS);
+
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        with_live_context();
+    }
+    uint64_t live_ns = fixtures::now_ns() - start;
+
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        const context::snapshot_t *snapshot = context::acquire(getpid());
+        ASSERT_NE(nullptr, snapshot);
+        std::memcpy(backtrace.process_name, snapshot->process_name, sizeof(backtrace.process_name));
+        std::memcpy(backtrace.build_id, snapshot->build_id, sizeof(backtrace.build_id));
+        std::memcpy(backtrace.session_id, snapshot->session_id, sizeof(backtrace.session_id));
+        backtrace.pid = snapshot->pid;
+        context::release(snapshot);
+    }
+    uint64_t snapshot_ns = fixtures::now_ns() - start;
+
+    std::printf("[ BENCHMARK]   live reads: %8.2f us/capture\n", live_ns / 1e3 / BENCHMARK_ITERATIONS);
+    std::printf("[ BENCHMARK]   snapshot:   %8.2f us/capture\n", snapshot_ns / 1e3 / BENCHMARK_ITERATIONS);
+}
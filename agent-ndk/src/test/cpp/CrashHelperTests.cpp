@@ -0,0 +1,207 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ucontext.h>
+
+#include <agent-ndk.h>
+#include "arena.h"
+#include "context-snapshot.h"
+#include "crash-helper.h"
+#include "record.h"
+#include "serializer.h"
+#include "jni/native-context.h"
+#include "TestFixtures.h"
+
+static const int BENCHMARK_ITERATIONS = 20;
+
+/**
+ * Crashes handed to a helper forked from the test process, reporting into a scratch directory
+ */
+class CrashHelperTest : public ReportDirTest {
+protected:
+    std::string savedSessionId;
+    siginfo_t siginfo = {};
+    ucontext_t ucontext = {};
+
+    CrashHelperTest() : ReportDirTest("helper") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        jni::native_context_t &native_context = jni::get_native_context();
+        savedSessionId = native_context.sessionId;
+        std::strncpy(native_context.sessionId, "session-id", sizeof(native_context.sessionId) - 1);
+        ASSERT_TRUE(context::publish());
+
+        siginfo.si_signo = SIGSEGV;
+        siginfo.si_code = SEGV_MAPERR;
+        siginfo.si_addr = reinterpret_cast<void *>(0xdeadbeef);
+        getcontext(&ucontext);
+
+        ASSERT_TRUE(arena::initialize(BACKTRACE_ARENA_SZ_MAX));
+        ASSERT_TRUE(helper::initialize());
+    }
+
+    void TearDown() override {
+        helper::shutdown();
+        arena::shutdown();
+
+        jni::native_context_t &native_context = jni::get_native_context();
+        native_context.allThreadStacksEnabled = false;
+        std::strncpy(native_context.sessionId, savedSessionId.c_str(),
+                     sizeof(native_context.sessionId) - 1);
+        ReportDirTest::TearDown();
+        context::publish();
+    }
+
+    std::vector<std::string> reports() {
+        std::vector<std::string> names;
+        DIR *dir = opendir(reportDir);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (entry->d_name[0] != '.') {
+                names.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        return names;
+    }
+
+    static void *park(void *arg) {
+        auto *released = static_cast<volatile bool *>(arg);
+        while (!*released) {
+            usleep(1000);
+        }
+        return nullptr;
+    }
+};
+
+TEST_F(CrashHelperTest, HelperWritesCrashRecord) {
+    ASSERT_TRUE(helper::request(&siginfo, &ucontext));
+
+    std::vector<std::string> names = reports();
+    ASSERT_EQ(1u, names.size());
+    EXPECT_EQ(0, names[0].find("rec-crash-")) << names[0];
+
+    // the record describes this process, and renders as any other crash
+    ASSERT_EQ(1, record::render_pending());
+    EXPECT_TRUE(reports().empty());
+    std::vector<std::string> stored = fixtures::stored_reports();
+    ASSERT_EQ(1u, stored.size());
+
+    std::string report = stored[0];
+    char fragment[128];
+    std::snprintf(fragment, sizeof(fragment), "\"pid\":%d", getpid());
+    EXPECT_NE(std::string::npos, report.find(fragment)) << fragment;
+    std::snprintf(fragment, sizeof(fragment), "\"threadNumber\":%d,", gettid());
+    size_t thread = report.find(fragment);
+    ASSERT_NE(std::string::npos, thread) << fragment;
+    EXPECT_NE(std::string::npos, report.find("\"crashed\":true,\"stack\":[{", thread));
+    EXPECT_NE(std::string::npos, report.find("session-id"));
+    EXPECT_NE(std::string::npos, report.find("SIGSEGV"));
+}
+
+TEST_F(CrashHelperTest, HelperIsReusable) {
+    ASSERT_TRUE(helper::request(&siginfo, &ucontext));
+    ASSERT_TRUE(helper::request(&siginfo, &ucontext));
+    EXPECT_EQ(2u, reports().size());
+}
+
+TEST_F(CrashHelperTest, HelperDropsLeasesHeldAtTheFork) {
+    // the helper is forked while this thread holds the arena, as another thread of the app might
+    helper::shutdown();
+    ASSERT_TRUE(arena::acquire());
+    ASSERT_NE(nullptr, arena::alloc(1024));
+    ASSERT_TRUE(helper::initialize());
+    arena::release();
+
+    ASSERT_TRUE(helper::request(&siginfo, &ucontext));
+    ASSERT_TRUE(helper::request(&siginfo, &ucontext));
+    EXPECT_EQ(2u, reports().size());
+    EXPECT_EQ(0u, arena::used());
+}
+
+TEST_F(CrashHelperTest, HelperWalksOtherThreads) {
+    jni::get_native_context().allThreadStacksEnabled = true;
+
+    volatile bool released = false;
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, nullptr, park, const_cast<bool *>(&released)));
+
+    bool requested = helper::request(&siginfo, &ucontext);
+    released = true;
+    pthread_join(thread, nullptr);
+    ASSERT_TRUE(requested);
+
+    ASSERT_EQ(1, record::render_pending());
+    std::string report = fixtures::stored_reports().at(0);
+
+    // every thread the helper could attach to has a stack
+    size_t stacks = 0;
+    for (size_t at = report.find("\"stack\":[{"); at != std::string::npos;
+         at = report.find("\"stack\":[{", at + 1)) {
+        stacks++;
+    }
+    if (stacks < 2) {
+        GTEST_SKIP() << "the helper may not ptrace this process here";
+    }
+    EXPECT_GE(stacks, 2u);
+}
+
+TEST_F(CrashHelperTest, DeadHelperFallsBackToCaller) {
+    helper::shutdown();
+    EXPECT_FALSE(helper::request(&siginfo, &ucontext));
+    EXPECT_TRUE(reports().empty());
+}
+
+TEST_F(CrashHelperTest, HelperBenchmark) {
+    // time and CPU spent in the crashing thread, in-process and with the helper
+    uint64_t local_ns = 0, local_cpu = 0, helper_ns = 0, helper_cpu = 0;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        struct timespec cpu = {};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        uint64_t cpu_start = cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+        uint64_t start = fixtures::now_ns();
+
+        ASSERT_TRUE(arena::acquire());
+        char *buffer = arena::alloc_array<char>(BACKTRACE_SZ_MAX);
+        size_t size = collect_crash_record(buffer, BACKTRACE_SZ_MAX, &siginfo, &ucontext);
+        ASSERT_TRUE(serializer::to_storage("rec-crash-", buffer, size));
+        arena::release();
+
+        local_ns += fixtures::now_ns() - start;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        local_cpu += cpu.tv_sec * 1000000000ULL + cpu.tv_nsec - cpu_start;
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        cpu_start = cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+        start = fixtures::now_ns();
+
+        ASSERT_TRUE(helper::request(&siginfo, &ucontext));
+
+        helper_ns += fixtures::now_ns() - start;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        helper_cpu += cpu.tv_sec * 1000000000ULL + cpu.tv_nsec - cpu_start;
+    }
+
+    std::printf("[ BENCHMARK] crash capture, crashing thread\n");
+    std::printf("[ BENCHMARK]   in-process: %8llu ns/crash %8llu ns cpu/crash\n",
+                static_cast<unsigned long long>(local_ns / BENCHMARK_ITERATIONS),
+                static_cast<unsigned long long>(local_cpu / BENCHMARK_ITERATIONS));
+    std::printf("[ BENCHMARK]   helper:     %8llu ns/crash %8llu ns cpu/crash\n",
+                static_cast<unsigned long long>(helper_ns / BENCHMARK_ITERATIONS),
+                static_cast<unsigned long long>(helper_cpu / BENCHMARK_ITERATIONS));
+}
@@ -0,0 +1,346 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <cxxabi.h>
+#include <pthread.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "demangler.h"
+#include "TestFixtures.h"
+
+static const int BENCHMARK_ITERATIONS = 2000;
+static const size_t BENCHMARK_STACK_SZ = 256 * 1024;
+static const unsigned char STACK_PAINT = 0xa5;
+
+typedef struct expected {
+    const char *mangled;
+    const char *demangled;
+
+} expected_t;
+
+/**
+ * Expected output, as rendered by the LLVM runtime
+ */
+static const expected_t EXPECTED[] = {
+            {"_Z3foov",
+             "foo()"},
+            {"_Z3fooic",
+             "foo(int, char)"},
+            {"_ZN7android6Parcel10writeInt32Ei",
+             "android::Parcel::writeInt32(int)"},
+            {"_ZNSt6vectorIiSaIiEE9push_backERKi",
+             "std::vector<int, std::allocator<int> >::push_back(int const&)"},
+            {"_ZNSsC1Ev",
+             "std::basic_string<char, std::char_traits<char>, std::allocator<char> >::basic_string()"},
+            {"_ZNSt3mapIiSsSt4lessIiESaISt4pairIKiSsEEEixERS3_",
+             "std::map<int, std::string, std::less<int>, "
+             "std::allocator<std::pair<int const, std::string> > >::operator[](int const&)"},
+            {"_ZNSt10unique_ptrIiSt14default_deleteIiEED2Ev",
+             "std::unique_ptr<int, std::default_delete<int> >::~unique_ptr()"},
+            {"_ZNSt8functionIFviEEC2Ev",
+             "std::function<void (int)>::function()"},
+            {"_ZNKSt8functionIFviEEclEi",
+             "std::function<void (int)>::operator()(int) const"},
+            {"_ZNSt17_Function_handlerIFviEZ4mainEUliE_E9_M_invokeERKSt9_Any_dataOi",
+             "std::_Function_handler<void (int), main::'lambda'(int)>::_M_invoke(std::_Any_data const&, int&&)"},
+            {"_ZZ4mainENKUliE_clEi",
+             "main::'lambda'(int)::operator()(int) const"},
+            {"_ZZ4mainENKUliE0_clEi",
+             "main::'lambda0'(int)::operator()(int) const"},
+            {"_ZZZ4mainENKUlvE_clEvENKUlvE_clEv",
+             "main::'lambda'()::operator()() const::'lambda'()::operator()() const"},
+            {"_ZN1AUt_E",
+             "A::'unnamed'"},
+            {"_ZN12_GLOBAL__N_13fooEv",
+             "(anonymous namespace)::foo()"},
+            {"_ZN5OuterIiE5InnerIcE1fEv",
+             "Outer<int>::Inner<char>::f()"},
+            {"_ZN1AIiE1fIcEET_S2_",
+             "char A<int>::f<char>(char)"},
+            {"_Z1fIiJcdEEvT_DpT0_",
+             "void f<int, char, double>(int, char, double)"},
+            {"_Z1fIJEEvDpT_",
+             "void f<>()"},
+            {"_Z1fILi5EEvv",
+             "void f<5>()"},
+            {"_Z1fILj5EEvv",
+             "void f<5u>()"},
+            {"_Z1fILb1EEvv",
+             "void f<true>()"},
+            {"_Z1fILc65EEvv",
+             "void f<(char)65>()"},
+            {"_Z1fILin3EEvv",
+             "void f<-3>()"},
+            {"_Z3fooPA10_i",
+             "foo(int (*) [10])"},
+            {"_Z3fooA2_A3_i",
+             "foo(int [2][3])"},
+            {"_Z3fooPFviE",
+             "foo(void (*)(int))"},
+            {"_Z3fooPPFvvES1_",
+             "foo(void (**)(), void (**)())"},
+            {"_Z1fRKPFvvE",
+             "f(void (* const&)())"},
+            {"_Z3fooM1AFvvE",
+             "foo(void (A::*)())"},
+            {"_Z3fooM1AKFvvE",
+             "foo(void (A::*)() const)"},
+            {"_Z3fooM1Ai",
+             "foo(int A::*)"},
+            {"_ZNKR1A1fEv",
+             "A::f() const &"},
+            {"_ZNO1A1fEv",
+             "A::f() &&"},
+            {"_ZN1AcviEv",
+             "A::operator int()"},
+            {"_ZN1AplERKS_",
+             "A::operator+(A const&)"},
+            {"_Zli3_kmy",
+             "operator\"\" _km(unsigned long long)"},
+            {"_Z1fPVKi",
+             "f(int const volatile*)"},
+            {"_Z1fiz",
+             "f(int, ...)"},
+            {"_Z1fDn",
+             "f(std::nullptr_t)"},
+            {"_Z1fB5cxx11v",
+             "f[abi:cxx11]()"},
+            {"_ZTV1A",
+             "vtable for A"},
+            {"_ZTI1A",
+             "typeinfo for A"},
+            {"_ZTS1A",
+             "typeinfo name for A"},
+            {"_ZThn8_N1A1fEv",
+             "non-virtual thunk to A::f()"},
+            {"_ZTv0_n24_N1A1fEv",
+             "virtual thunk to A::f()"},
+            {"_ZGVZ4mainE1x",
+             "guard variable for main::x"},
+            {"_ZZ4mainEs",
+             "main::string literal"},
+            {"_Z3foov.cold",
+             "foo() (.cold)"},
+};
+
+/**
+ * Names both runtimes render alike, for comparison with the host's __cxa_demangle()
+ */
+static const char *PLAIN[] = {
+        "_ZN7android6Parcel10writeInt32Ei",
+        "_ZNSt6vectorIiSaIiEE9push_backERKi",
+        "_ZNKSt8functionIFviEEclEi",
+        "_ZN5OuterIiE5InnerIcE1fEv",
+        "_ZN1AIiE1fIcEET_S2_",
+        "_Z1fIiJcdEEvT_DpT0_",
+        "_Z3fooPA10_i",
+        "_Z3fooPPFvvES1_",
+        "_Z3fooM1AKFvvE",
+        "_ZTv0_n24_N1A1fEv",
+        "_ZNSt10unique_ptrIiSt14default_deleteIiEED2Ev",
+};
+
+/**
+ * Symbol-heavy frames: std::function invokers, lambdas and deep templates
+ */
+static const char *BENCHMARK_NAMES[] = {
+        "_ZNSt17_Function_handlerIFviEZ4mainEUliE_E9_M_invokeERKSt9_Any_dataOi",
+        "_ZNKSt8functionIFviEEclEi",
+        "_ZZZ4mainENKUlvE_clEvENKUlvE_clEv",
+        "_ZNSt3mapIiSsSt4lessIiESaISt4pairIKiSsEEEixERS3_",
+        "_ZNSt7__cxx1112basic_stringIcSt11char_traitsIcESaIcEEC1IN9__gnu_cxx17__normal_iteratorIPcS4_EEvEET_SA_RKS3_",
+        "_ZNSt6vectorIiSaIiEE9push_backERKi",
+        "_ZN7android6Parcel10writeInt32Ei",
+};
+
+static std::string cxa_demangle(const char *mangled) {
+    int status = 0;
+    char *demangled = __cxxabiv1::__cxa_demangle(mangled, nullptr, nullptr, &status);
+    std::string result((demangled != nullptr && status == 0) ? demangled : mangled);
+    std::free(demangled);
+    return result;
+}
+
+TEST(DemanglerTest, DemanglesLikeTheRuntime) {
+    char buffer[1024];
+    for (auto &expected: EXPECTED) {
+        ASSERT_TRUE(demangler::demangle(expected.mangled, buffer, sizeof(buffer))) << expected.mangled;
+        EXPECT_STREQ(expected.demangled, buffer) << expected.mangled;
+    }
+}
+
+TEST(DemanglerTest, AgreesWithCxaDemangle) {
+    char buffer[1024];
+    for (auto mangled: PLAIN) {
+        ASSERT_TRUE(demangler::demangle(mangled, buffer, sizeof(buffer))) << mangled;
+        EXPECT_EQ(cxa_demangle(mangled), buffer) << mangled;
+    }
+}
+
+TEST(DemanglerTest, RejectsNamesItCannotRender) {
+    const char *names[] = {
+            "main",
+            "_Z",
+            "_ZN1A",
+            "_Z3fooi_trailing",
+            "_Z3fooS_",
+            "_Z1fIiEvT0_",
+            "_Z1fIiEDTcl1gfp_EET_",
+            "_Z1fIXadL_Z1gvEEEvv",
+            "_Z99foo",
+    };
+
+    char buffer[64];
+    for (auto name: names) {
+        std::strcpy(buffer, "unchanged");
+        EXPECT_FALSE(demangler::demangle(name, buffer, sizeof(buffer))) << name;
+    }
+    EXPECT_FALSE(demangler::demangle(nullptr, buffer, sizeof(buffer)));
+    EXPECT_FALSE(demangler::demangle("_Z3foov", buffer, 0));
+}
+
+TEST(DemanglerTest, TruncatesToBuffer) {
+    const char *mangled = "_ZNSt6vectorIiSaIiEE9push_backERKi";
+    char full[256];
+    ASSERT_TRUE(demangler::demangle(mangled, full, sizeof(full)));
+
+    for (size_t size = 1; size < std::strlen(full) + 2; size++) {
+        std::vector<char> buffer(size + 1, '#');
+        ASSERT_TRUE(demangler::demangle(mangled, buffer.data(), size));
+        EXPECT_EQ(std::min(size - 1, std::strlen(full)), std::strlen(buffer.data()));
+        EXPECT_EQ(0, std::strncmp(full, buffer.data(), size - 1));
+        EXPECT_EQ('#', buffer[size]);
+    }
+}
+
+TEST(DemanglerTest, BoundsPathologicalNames) {
+    char buffer[256];
+
+    // nesting deeper than the recursion bound
+    std::string pointers("_Z1f");
+    pointers.append(20000, 'P');
+    pointers.append("i");
+    EXPECT_FALSE(demangler::demangle(pointers.c_str(), buffer, sizeof(buffer)));
+
+    std::string templates("_Z1f");
+    for (int i = 0; i < 5000; i++) {
+        templates.append("1AI");
+    }
+    templates.append("i");
+    templates.append(5000, 'E');
+    EXPECT_FALSE(demangler::demangle(templates.c_str(), buffer, sizeof(buffer)));
+
+    // substitutions that double the output with every parameter
+    std::string doubling("_Z1f1A1BIS_S_E");
+    const char *ids[] = {"S0_", "S1_", "S2_", "S3_", "S4_", "S5_", "S6_", "S7_", "S8_", "S9_",
+                         "SA_", "SB_", "SC_", "SD_", "SE_", "SF_", "SG_", "SH_", "SI_", "SJ_"};
+    for (auto id: ids) {
+        doubling.append("1BI").append(id).append(id).append("E");
+    }
+    uint64_t start = fixtures::now_ns();
+    EXPECT_TRUE(demangler::demangle(doubling.c_str(), buffer, sizeof(buffer)));
+    EXPECT_EQ(sizeof(buffer) - 1, std::strlen(buffer));
+
+    std::vector<char> large(1024 * 1024);
+    demangler::demangle(doubling.c_str(), large.data(), large.size());
+    EXPECT_LT(fixtures::now_ns() - start, 1000000000ULL);
+}
+
+TEST(DemanglerTest, DoesNotAllocate) {
+    char buffer[1024];
+    size_t allocs = fixtures::allocation_count();
+    for (auto &expected: EXPECTED) {
+        demangler::demangle(expected.mangled, buffer, sizeof(buffer));
+    }
+    EXPECT_EQ(allocs, fixtures::allocation_count());
+}
+
+typedef struct stack_probe {
+    bool runtime;
+    size_t depth;
+
+} stack_probe_t;
+
+/**
+ * Demangle the benchmark names on a thread whose stack is painted, and measure how deep it was written
+ */
+static void *probe_stack(void *arg) {
+    auto probe = static_cast<stack_probe_t *>(arg);
+    char buffer[1024];
+
+    for (auto mangled: BENCHMARK_NAMES) {
+        if (probe->runtime) {
+            int status = 0;
+            std::free(__cxxabiv1::__cxa_demangle(mangled, nullptr, nullptr, &status));
+        } else {
+            demangler::demangle(mangled, buffer, sizeof(buffer));
+        }
+    }
+    return nullptr;
+}
+
+static size_t peak_stack(bool runtime) {
+    std::vector<unsigned char> stack(BENCHMARK_STACK_SZ, STACK_PAINT);
+    stack_probe_t probe = {runtime, 0};
+    size_t before = 0;
+    while (before < stack.size() && stack[before] == STACK_PAINT) {
+        before++;
+    }
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack.data(), stack.size());
+    if (pthread_create(&thread, &attr, probe_stack, &probe) != 0) {
+        pthread_attr_destroy(&attr);
+        return 0;
+    }
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attr);
+
+    size_t untouched = 0;
+    while (untouched < stack.size() && stack[untouched] == STACK_PAINT) {
+        untouched++;
+    }
+    return stack.size() - untouched;
+}
+
+TEST(DemanglerTest, DemangleBenchmark) {
+    char buffer[1024];
+    size_t names = sizeof(BENCHMARK_NAMES) / sizeof(BENCHMARK_NAMES[0]);
+
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (auto mangled: BENCHMARK_NAMES) {
+            int status = 0;
+            std::free(__cxxabiv1::__cxa_demangle(mangled, nullptr, nullptr, &status));
+        }
+    }
+    uint64_t runtime_ns = (fixtures::now_ns() - start) / (BENCHMARK_ITERATIONS * names);
+
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (auto mangled: BENCHMARK_NAMES) {
+            demangler::demangle(mangled, buffer, sizeof(buffer));
+        }
+    }
+    uint64_t demangler_ns = (fixtures::now_ns() - start) / (BENCHMARK_ITERATIONS * names);
+
+    size_t runtime_stack = peak_stack(true);
+    size_t demangler_stack = peak_stack(false);
+    EXPECT_LT(demangler_stack, BENCHMARK_STACK_SZ / 4);
+
+    std::printf("[ BENCHMARK] demangling (%zu symbol-heavy names)\n", names);
+    std::printf("[ BENCHMARK]   __cxa_demangle: %8llu ns/symbol, %6zu bytes of stack\n",
+                static_cast<unsigned long long>(runtime_ns), runtime_stack);
+    std::printf("[ BENCHMARK]   demangler:      %8llu ns/symbol, %6zu bytes of stack\n",
+                static_cast<unsigned long long>(demangler_ns), demangler_stack);
+}
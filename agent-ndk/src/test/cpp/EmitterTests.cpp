@@ -0,0 +1,169 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+#include "emitter.h"
+#include "writer.h"
+#include "procfs.h"
+#include "TestFixtures.h"
+#include "legacy/emitter-legacy.h"
+
+static const int BENCHMARK_ITERATIONS = 50;
+
+/**
+ * A crash-sized backtrace: BACKTRACE_THREADS_MAX threads, one of which carries the call stack
+ */
+class EmitterTest : public ::testing::Test {
+protected:
+    backtrace_t backtrace = {};
+    threadinfo_t threads[BACKTRACE_THREADS_MAX] = {};
+    siginfo_t siginfo = {};
+    ucontext_t ucontext = {};
+    char *buffer = nullptr;
+
+    void SetUp() override {
+        buffer = new char[BACKTRACE_SZ_MAX];
+
+        siginfo.si_signo = SIGSEGV;
+        siginfo.si_code = SEGV_MAPERR;
+        siginfo.si_addr = reinterpret_cast<void *>(0xdeadbeef);
+
+        // include values that exercise sign and truncation behaviour of the legacy formats
+        uint8_t *regs = reinterpret_cast<uint8_t *>(&ucontext.uc_mcontext);
+        for (size_t i = 0; i < sizeof(ucontext.uc_mcontext); i++) {
+            regs[i] = static_cast<uint8_t>(i * 37 + 11);
+        }
+
+        backtrace.state.sa_ucontext = &ucontext;
+        backtrace.state.siginfo = &siginfo;
+        std::strncpy(backtrace.description, "Address 'not' mapped", sizeof(backtrace.description) - 1);
+        std::strncpy(backtrace.arch, get_arch(), sizeof(backtrace.arch) - 1);
+        procfs::read_process_name(getpid(), backtrace.process_name, sizeof(backtrace.process_name));
+        backtrace.timestamp = 1700000000;
+        backtrace.pid = getpid();
+        backtrace.ppid = getppid();
+        backtrace.uid = getuid();
+
+        backtrace.threads = threads;
+        backtrace.thread_cnt = BACKTRACE_THREADS_MAX;
+        for (size_t i = 0; i < BACKTRACE_THREADS_MAX; i++) {
+            threads[i].tid = 1000 + static_cast<int>(i);
+            std::snprintf(threads[i].thread_name, sizeof(threads[i].thread_name), "worker-%zu", i);
+            std::strncpy(threads[i].thread_state, "SLEEPING", sizeof(threads[i].thread_state) - 1);
+            threads[i].priority = static_cast<int>(i % 20);
+        }
+        threads[0].crashed = true;
+        threads[0].backtrace_state = &backtrace.state;
+    }
+
+    void TearDown() override {
+        delete[] buffer;
+    }
+
+    void with_frames(size_t cnt, uintptr_t base, uintptr_t stride) {
+        backtrace.state.frame_cnt = cnt;
+        for (size_t i = 0; i < cnt; i++) {
+            backtrace.state.frames[i] = base + (i * stride);
+        }
+    }
+
+    std::string emit_legacy() {
+        std::string state;
+        legacy::emit_backtrace(backtrace, state);
+        return state;
+    }
+
+    std::string emit() {
+        writer_t writer = {};
+        writer::to_buffer(writer, buffer, BACKTRACE_SZ_MAX);
+        EXPECT_TRUE(emit_backtrace(backtrace, writer));
+        return std::string(buffer, writer.length);
+    }
+};
+
+TEST_F(EmitterTest, ByteIdenticalToLegacyEmitter) {
+    with_frames(BACKTRACE_FRAMES_MAX, reinterpret_cast<uintptr_t>(&get_arch), 16);
+    EXPECT_EQ(emit_legacy(), emit());
+}
+
+TEST_F(EmitterTest, ByteIdenticalWithoutRegisterContext) {
+    backtrace.state.sa_ucontext = nullptr;
+    EXPECT_EQ(emit_legacy(), emit());
+}
+
+TEST_F(EmitterTest, TruncatedOutputIsReported) {
+    with_frames(BACKTRACE_FRAMES_MAX, 0x1000, 4);
+    writer_t writer = {};
+    writer::to_buffer(writer, buffer, 512);
+    EXPECT_FALSE(emit_backtrace(backtrace, writer));
+    EXPECT_EQ(512u, writer.length);
+}
+
+TEST_F(EmitterTest, EmitsToFileDescriptor) {
+    with_frames(BACKTRACE_FRAMES_MAX, 0x1000, 4);
+    std::string expected = emit();
+
+    char path[PATH_MAX];
+    std::snprintf(path, sizeof(path), "%s/emitter-XXXXXX", fixtures::temp_dir());
+    int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+
+    char staging[256];
+    writer_t writer = {};
+    writer::to_fd(writer, fd, staging, sizeof(staging));
+    EXPECT_TRUE(emit_backtrace(backtrace, writer));
+    EXPECT_EQ(expected.size(), writer::size(writer));
+
+    std::string actual(expected.size(), '\0');
+    EXPECT_EQ(static_cast<ssize_t>(expected.size()), pread(fd, &actual[0], actual.size(), 0));
+    EXPECT_EQ(expected, actual);
+
+    close(fd);
+    unlink(path);
+}
+
+/**
+ * Unresolvable frames keep dladdr/demangling out of the measurement,
+ * isolating the cost of emission itself
+ */
+TEST_F(EmitterTest, EmitterBenchmark) {
+    with_frames(BACKTRACE_FRAMES_MAX, 0x1000, 4);
+
+    size_t allocs = fixtures::allocation_count();
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        emit_legacy();
+    }
+    uint64_t legacy_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+    size_t legacy_allocs = (fixtures::allocation_count() - allocs) / BENCHMARK_ITERATIONS;
+
+    allocs = fixtures::allocation_count();
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        writer_t writer = {};
+        writer::to_buffer(writer, buffer, BACKTRACE_SZ_MAX);
+        emit_backtrace(backtrace, writer);
+    }
+    uint64_t writer_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+    size_t writer_allocs = (fixtures::allocation_count() - allocs) / BENCHMARK_ITERATIONS;
+
+    std::printf("[ BENCHMARK] emit_backtrace (%zu threads, %zu frames)\n",
+                backtrace.thread_cnt, backtrace.state.frame_cnt);
+    std::printf("[ BENCHMARK]   legacy: %8llu ns/report %6zu allocs/report\n",
+                static_cast<unsigned long long>(legacy_ns), legacy_allocs);
+    std::printf("[ BENCHMARK]   writer: %8llu ns/report %6zu allocs/report\n",
+                static_cast<unsigned long long>(writer_ns), writer_allocs);
+
+    EXPECT_EQ(0u, writer_allocs);
+    EXPECT_LT(writer_ns, legacy_ns);
+}
@@ -0,0 +1,272 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <agent-ndk.h>
+#include "event-ring.h"
+#include "TestFixtures.h"
+
+static const int BENCHMARK_EVENTS = 20000;
+static const int PRODUCERS = 4;
+
+static ring::descriptor_t event(uint32_t kind, size_t n) {
+    char *data = static_cast<char *>(malloc(32));
+    int size = std::snprintf(data, 32, "event %zu", n);
+    return {kind, data, static_cast<size_t>(size)};
+}
+
+class EventRingTest : public ::testing::Test {
+protected:
+    ring::ring_t ring = {};
+
+    void TearDown() override {
+        ring::descriptor_t descriptor;
+        if (ring.cells != nullptr) {
+            while (ring::pop(ring, descriptor)) {
+                free(descriptor.data);
+            }
+            ring::release(ring);
+        }
+    }
+};
+
+TEST_F(EventRingTest, EventsArePoppedInOrder) {
+    ASSERT_TRUE(ring::initialize(ring, 8));
+
+    for (size_t i = 0; i < 5; i++) {
+        ASSERT_TRUE(ring::push(ring, event(1, i)));
+    }
+
+    ring::descriptor_t descriptor;
+    for (size_t i = 0; i < 5; i++) {
+        ASSERT_TRUE(ring::pop(ring, descriptor));
+        EXPECT_EQ(1u, descriptor.kind);
+        EXPECT_EQ("event " + std::to_string(i), std::string(descriptor.data, descriptor.size));
+        free(descriptor.data);
+    }
+    EXPECT_FALSE(ring::pop(ring, descriptor));
+    EXPECT_EQ(5u, ring.pushed.load());
+}
+
+TEST_F(EventRingTest, CapacityIsRoundedToAPowerOfTwo) {
+    ASSERT_TRUE(ring::initialize(ring, 5));
+    EXPECT_EQ(7u, ring.mask);
+}
+
+TEST_F(EventRingTest, FullRingDropsEvents) {
+    ASSERT_TRUE(ring::initialize(ring, 4));
+
+    for (size_t i = 0; i < 4; i++) {
+        ASSERT_TRUE(ring::push(ring, event(0, i)));
+    }
+    ring::descriptor_t extra = event(0, 4);
+    EXPECT_FALSE(ring::push(ring, extra));
+    EXPECT_FALSE(ring::push(ring, extra, ring::OVERFLOW_WAIT, 10));
+    EXPECT_EQ(2u, ring.dropped.load());
+    free(extra.data);
+
+    // room is made as events are popped
+    ring::descriptor_t descriptor;
+    ASSERT_TRUE(ring::pop(ring, descriptor));
+    free(descriptor.data);
+    EXPECT_TRUE(ring::push(ring, event(0, 5)));
+}
+
+static void *drain_after_delay(void *arg) {
+    ring::ring_t &ring = *static_cast<ring::ring_t *>(arg);
+    usleep(20000);
+
+    ring::descriptor_t descriptor;
+    if (ring::pop(ring, descriptor)) {
+        free(descriptor.data);
+    }
+    return nullptr;
+}
+
+TEST_F(EventRingTest, WaitingProducersGetRoom) {
+    ASSERT_TRUE(ring::initialize(ring, 2));
+    ASSERT_TRUE(ring::push(ring, event(0, 0)));
+    ASSERT_TRUE(ring::push(ring, event(0, 1)));
+
+    pthread_t consumer;
+    ASSERT_EQ(0, pthread_create(&consumer, nullptr, drain_after_delay, &ring));
+    ring::descriptor_t waiting = event(0, 2);
+    bool pushed = ring::push(ring, waiting, ring::OVERFLOW_WAIT, 2000);
+    pthread_join(consumer, nullptr);
+
+    EXPECT_TRUE(pushed);
+    if (!pushed) {
+        free(waiting.data);
+    }
+    EXPECT_EQ(0u, ring.dropped.load());
+}
+
+static void *push_after_delay(void *arg) {
+    ring::ring_t &ring = *static_cast<ring::ring_t *>(arg);
+    usleep(20000);
+    ring::push(ring, event(0, 0));
+    return nullptr;
+}
+
+TEST_F(EventRingTest, PushWakesTheConsumer) {
+    ASSERT_TRUE(ring::initialize(ring, 8));
+    EXPECT_FALSE(ring::wait(ring, 0));
+
+    pthread_t producer;
+    ASSERT_EQ(0, pthread_create(&producer, nullptr, push_after_delay, &ring));
+    uint64_t start = fixtures::now_ns();
+    EXPECT_TRUE(ring::wait(ring, 5000));
+    EXPECT_LT(fixtures::now_ns() - start, 2000000000ULL);
+    pthread_join(producer, nullptr);
+}
+
+typedef struct producer {
+    ring::ring_t *ring;
+    uint32_t id;
+    size_t events;
+    ring::overflow_t overflow;
+
+} producer_t;
+
+static void *produce(void *arg) {
+    producer_t &producer = *static_cast<producer_t *>(arg);
+    for (size_t i = 0; i < producer.events; i++) {
+        ring::descriptor_t descriptor = event(producer.id, i);
+        if (!ring::push(*producer.ring, descriptor, producer.overflow, 5000)) {
+            free(descriptor.data);
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Pop every event until the producers are done, checking each producer's events are in order
+ *
+ * @return number of events popped
+ */
+static size_t consume(ring::ring_t &ring, const std::atomic<int> &producing, std::vector<size_t> &next) {
+    size_t popped = 0;
+    ring::descriptor_t descriptor;
+    while (true) {
+        if (!ring::pop(ring, descriptor)) {
+            if (producing.load() == 0 && !ring::wait(ring, 0)) {
+                break;
+            }
+            ring::wait(ring, 10);
+            continue;
+        }
+
+        size_t n = std::strtoul(descriptor.data + 6, nullptr, 10);
+        EXPECT_LE(next[descriptor.kind], n);
+        next[descriptor.kind] = n + 1;
+        free(descriptor.data);
+        popped++;
+    }
+    return popped;
+}
+
+static void *run_producer(void *arg) {
+    void **args = static_cast<void **>(arg);
+    produce(args[0]);
+    static_cast<std::atomic<int> *>(args[1])->fetch_sub(1);
+    return nullptr;
+}
+
+TEST_F(EventRingTest, ProducersAreInterleavedInOrder) {
+    ASSERT_TRUE(ring::initialize(ring, 64));
+
+    std::atomic<int> producing(PRODUCERS);
+    producer_t producers[PRODUCERS];
+    void *args[PRODUCERS][2];
+    pthread_t threads[PRODUCERS];
+    for (int i = 0; i < PRODUCERS; i++) {
+        producers[i] = {&ring, static_cast<uint32_t>(i), 2000, ring::OVERFLOW_WAIT};
+        args[i][0] = &producers[i];
+        args[i][1] = &producing;
+        ASSERT_EQ(0, pthread_create(&threads[i], nullptr, run_producer, args[i]));
+    }
+
+    std::vector<size_t> next(PRODUCERS, 0);
+    size_t popped = consume(ring, producing, next);
+    for (auto &thread: threads) {
+        pthread_join(thread, nullptr);
+    }
+
+    EXPECT_EQ(PRODUCERS * 2000u, popped);
+    EXPECT_EQ(0u, ring.dropped.load());
+}
+
+typedef struct delivery {
+    ring::descriptor_t descriptor;
+    std::atomic<size_t> *delivered;
+
+} delivery_t;
+
+static void *deliver_one(void *arg) {
+    delivery_t *delivery = static_cast<delivery_t *>(arg);
+    free(delivery->descriptor.data);
+    delivery->delivered->fetch_add(1);
+    return nullptr;
+}
+
+/**
+ * Deliveries per second from several producers: a thread created and joined per delivery, as
+ * the delegate did, against the ring and one long-lived consumer
+ */
+TEST_F(EventRingTest, DeliveryBenchmark) {
+    const size_t per_producer = BENCHMARK_EVENTS / PRODUCERS;
+    std::printf("[ BENCHMARK] delivery of %d events from %d producers\n", BENCHMARK_EVENTS, PRODUCERS);
+
+    std::atomic<size_t> delivered(0);
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_EVENTS; i++) {
+        delivery_t delivery = {event(0, i), &delivered};
+        pthread_t thread;
+        ASSERT_EQ(0, pthread_create(&thread, nullptr, deliver_one, &delivery));
+        pthread_join(thread, nullptr);
+    }
+    uint64_t thread_ns = fixtures::now_ns() - start;
+    ASSERT_EQ(static_cast<size_t>(BENCHMARK_EVENTS), delivered.load());
+
+    for (auto overflow: {ring::OVERFLOW_WAIT, ring::OVERFLOW_DROP}) {
+        ASSERT_TRUE(ring::initialize(ring, 256));
+
+        std::atomic<int> producing(PRODUCERS);
+        producer_t producers[PRODUCERS];
+        void *args[PRODUCERS][2];
+        pthread_t threads[PRODUCERS];
+        start = fixtures::now_ns();
+        for (int i = 0; i < PRODUCERS; i++) {
+            producers[i] = {&ring, static_cast<uint32_t>(i), per_producer, overflow};
+            args[i][0] = &producers[i];
+            args[i][1] = &producing;
+            ASSERT_EQ(0, pthread_create(&threads[i], nullptr, run_producer, args[i]));
+        }
+        std::vector<size_t> next(PRODUCERS, 0);
+        size_t popped = consume(ring, producing, next);
+        for (auto &thread: threads) {
+            pthread_join(thread, nullptr);
+        }
+        uint64_t ring_ns = fixtures::now_ns() - start;
+        uint64_t dropped = ring.dropped.load();
+        ASSERT_EQ(static_cast<size_t>(BENCHMARK_EVENTS), popped + dropped);
+
+        std::printf("[ BENCHMARK]   ring (%s): %10.0f events/s, %zu delivered, %llu dropped\n",
+                    overflow == ring::OVERFLOW_WAIT ? "wait" : "drop",
+                    BENCHMARK_EVENTS * 1e9 / ring_ns, popped, static_cast<unsigned long long>(dropped));
+        ring::release(ring);
+    }
+
+    std::printf("[ BENCHMARK]   thread per delivery: %10.0f events/s\n",
+                BENCHMARK_EVENTS * 1e9 / thread_ns);
+}
@@ -0,0 +1,373 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <agent-ndk.h>
+#include "arena.h"
+#include "backtrace.h"
+#include "fingerprint.h"
+#include "jni/native-context.h"
+#include "module-index.h"
+#include "record.h"
+#include "serializer.h"
+#include "TestFixtures.h"
+
+static const long WINDOW = 60;
+static const long NOW = 1700000000;
+static const int STORM_SIZE = 200;
+
+/**
+ * Redirects report storage (and so the fingerprint table) to a scratch directory
+ */
+class FingerprintTest : public ReportDirTest {
+protected:
+    long savedWindow = 0;
+    backtrace_t backtrace = {};
+    siginfo_t siginfo = {};
+    std::vector<char> record = std::vector<char>(BACKTRACE_SZ_MAX);
+
+    FingerprintTest() : ReportDirTest("fingerprint") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        jni::native_context_t &native_context = jni::get_native_context();
+        savedWindow = native_context.coalesceWindow;
+        native_context.coalesceWindow = WINDOW;
+
+        ASSERT_TRUE(fingerprint::initialize());
+        ASSERT_TRUE(modules::initialize());
+        ASSERT_TRUE(arena::initialize(BACKTRACE_ARENA_SZ_MAX));
+
+        siginfo.si_signo = SIGSEGV;
+        siginfo.si_code = SEGV_MAPERR;
+        backtrace.state.siginfo = &siginfo;
+        std::strncpy(backtrace.arch, get_arch(), sizeof(backtrace.arch) - 1);
+        backtrace.timestamp = NOW;
+        backtrace.pid = getpid();
+
+        // exported functions of libc, a few bytes in
+        const uintptr_t functions[] = {
+                reinterpret_cast<uintptr_t>(&write),
+                reinterpret_cast<uintptr_t>(&getpid),
+                reinterpret_cast<uintptr_t>(&strlen),
+                reinterpret_cast<uintptr_t>(&close),
+        };
+        backtrace.state.frame_cnt = 32;
+        for (size_t i = 0; i < backtrace.state.frame_cnt; i++) {
+            backtrace.state.frames[i] = functions[i % 4] + 4 + i;
+        }
+    }
+
+    void TearDown() override {
+        arena::shutdown();
+        modules::shutdown();
+        fingerprint::shutdown();
+        jni::get_native_context().coalesceWindow = savedWindow;
+        ReportDirTest::TearDown();
+    }
+
+    /**
+     * Names of the reports and records in the report directory
+     */
+    std::vector<std::string> reports() const {
+        std::vector<std::string> names;
+        DIR *dir = opendir(reportDir);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (entry->d_name[0] != '.') {
+                names.emplace_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        return names;
+    }
+
+    size_t encode() {
+        EXPECT_TRUE(arena::acquire());
+        size_t size = record::encode(backtrace, record.data(), record.size());
+        arena::release();
+        return size;
+    }
+};
+
+TEST_F(FingerprintTest, FingerprintsTheTopFramesAndSignal) {
+    uint64_t fingerprint = fingerprint::compute(backtrace);
+    EXPECT_NE(0u, fingerprint);
+    EXPECT_EQ(fingerprint, fingerprint::compute(backtrace));
+
+    // frames below the top are not part of it
+    backtrace_t deeper = backtrace;
+    deeper.state.frames[20] += 1;
+    deeper.state.frame_cnt = 24;
+    EXPECT_EQ(fingerprint, fingerprint::compute(deeper));
+
+    backtrace_t moved = backtrace;
+    moved.state.frames[2] += 1;
+    EXPECT_NE(fingerprint, fingerprint::compute(moved));
+
+    siginfo_t other = siginfo;
+    other.si_signo = SIGBUS;
+    backtrace_t signalled = backtrace;
+    signalled.state.siginfo = &other;
+    EXPECT_NE(fingerprint, fingerprint::compute(signalled));
+
+    // the record carries it
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+    EXPECT_EQ(fingerprint, record::fingerprint_of(record.data(), size));
+    EXPECT_EQ(0u, record::fingerprint_of(record.data(), 16));
+}
+
+TEST_F(FingerprintTest, FingerprintsModuleFramesByRelativePc) {
+    const modules::module_t *module = modules::find(backtrace.state.frames[0]);
+    ASSERT_NE(nullptr, module);
+
+    // the same frames, relative to the module, are the same fingerprint (as when the
+    // module is loaded elsewhere); frames outside any module are hashed by address
+    uint64_t fingerprint = fingerprint::compute(backtrace);
+    backtrace_t unindexed = backtrace;
+    modules::shutdown();
+    EXPECT_NE(fingerprint, fingerprint::compute(unindexed));
+    ASSERT_TRUE(modules::initialize());
+    EXPECT_EQ(fingerprint, fingerprint::compute(unindexed));
+}
+
+TEST_F(FingerprintTest, CoalescesRepeatsWithinTheWindow) {
+    uint64_t fingerprint = fingerprint::compute(backtrace);
+
+    EXPECT_FALSE(fingerprint::coalesce(fingerprint, NOW, WINDOW));
+    EXPECT_TRUE(fingerprint::coalesce(fingerprint, NOW + 1, WINDOW));
+    EXPECT_TRUE(fingerprint::coalesce(fingerprint, NOW + WINDOW - 1, WINDOW));
+    EXPECT_FALSE(fingerprint::coalesce(fingerprint + 1, NOW + 2, WINDOW));
+
+    long last = 0;
+    EXPECT_EQ(2u, fingerprint::peek(fingerprint, last));
+    EXPECT_EQ(NOW + WINDOW - 1, last);
+
+    // past the window, the next is reported again, and a new window starts
+    EXPECT_FALSE(fingerprint::coalesce(fingerprint, NOW + WINDOW, WINDOW));
+    EXPECT_TRUE(fingerprint::coalesce(fingerprint, NOW + WINDOW + 1, WINDOW));
+
+    // a zero window coalesces nothing
+    EXPECT_FALSE(fingerprint::coalesce(fingerprint, NOW + WINDOW + 2, 0));
+}
+
+TEST_F(FingerprintTest, OnlyPendingRecordsCoalesceRepeats) {
+    uint64_t fingerprint = fingerprint::compute(backtrace);
+    EXPECT_FALSE(fingerprint::coalesce(fingerprint, NOW, WINDOW));
+    EXPECT_TRUE(fingerprint::coalesce(fingerprint, NOW + 1, WINDOW));
+
+    // once the record is rendered with its repeats, the next is reported, within the window or not
+    long last = 0;
+    EXPECT_EQ(1u, fingerprint::peek(fingerprint, last));
+    fingerprint::consume(fingerprint, 1);
+    EXPECT_EQ(0u, fingerprint::peek(fingerprint, last));
+    EXPECT_FALSE(fingerprint::coalesce(fingerprint, NOW + 2, WINDOW));
+    EXPECT_TRUE(fingerprint::coalesce(fingerprint, NOW + 3, WINDOW));
+}
+
+TEST_F(FingerprintTest, PersistsAcrossLaunches) {
+    uint64_t fingerprint = fingerprint::compute(backtrace);
+    EXPECT_FALSE(fingerprint::coalesce(fingerprint, NOW, WINDOW));
+
+    fingerprint::shutdown();
+    ASSERT_TRUE(fingerprint::initialize());
+    EXPECT_TRUE(fingerprint::coalesce(fingerprint, NOW + 1, WINDOW));
+
+    long last = 0;
+    EXPECT_EQ(1u, fingerprint::peek(fingerprint, last));
+}
+
+TEST_F(FingerprintTest, PendingRecordsAreNotEvicted) {
+    // more fingerprints than the table holds, 16 to a bucket
+    for (uint64_t f = 1; f <= 1024; f++) {
+        EXPECT_FALSE(fingerprint::coalesce(f, NOW + f, WINDOW));
+    }
+
+    // the first of each bucket are tracked until rendered; the rest are written uncounted
+    EXPECT_TRUE(fingerprint::coalesce(1, NOW + 1 + WINDOW / 2, WINDOW));
+    EXPECT_FALSE(fingerprint::coalesce(1025, NOW + 1025, WINDOW));
+    EXPECT_FALSE(fingerprint::coalesce(1025, NOW + 1026, WINDOW));
+
+    // a rendered record's entry is evicted for the next
+    fingerprint::consume(1, 1);
+    EXPECT_FALSE(fingerprint::coalesce(1025, NOW + 1027, WINDOW));
+    EXPECT_TRUE(fingerprint::coalesce(1025, NOW + 1028, WINDOW));
+    EXPECT_FALSE(fingerprint::coalesce(1, NOW + 1028, WINDOW));
+}
+
+TEST_F(FingerprintTest, LocksOfDeadProcessesAreTakenOver) {
+    uint64_t fingerprint = fingerprint::compute(backtrace);
+
+    // a process that dies holding every bucket's lock
+    pid_t child = fork();
+    if (child == 0) {
+        char *map = static_cast<char *>(mmap(nullptr, 64 + 64 * 160, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                             open((std::string(reportDir) + "/.fingerprints").c_str(), O_RDWR),
+                                             0));
+        for (size_t b = 0; b < 64; b++) {
+            *reinterpret_cast<int32_t *>(map + 64 + b * 160) = getpid();
+        }
+        _exit(0);
+    }
+    int status = 0;
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+
+    EXPECT_FALSE(fingerprint::coalesce(fingerprint, NOW, WINDOW));
+    EXPECT_TRUE(fingerprint::coalesce(fingerprint, NOW + 1, WINDOW));
+}
+
+TEST_F(FingerprintTest, ConcurrentRepeatsAreEachCounted) {
+    static const int THREAD_CNT = 4;
+    uint64_t fingerprint = fingerprint::compute(backtrace);
+    ASSERT_FALSE(fingerprint::coalesce(fingerprint, NOW, WINDOW));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREAD_CNT; t++) {
+        threads.emplace_back([fingerprint]() {
+            for (int i = 0; i < 500; i++) {
+                fingerprint::coalesce(fingerprint, NOW + 1, WINDOW);
+            }
+        });
+    }
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+
+    long last = 0;
+    EXPECT_EQ(THREAD_CNT * 500u, fingerprint::peek(fingerprint, last));
+}
+
+TEST_F(FingerprintTest, RepeatsAreReportedAsOccurrences) {
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+    for (int i = 0; i < 5; i++) {
+        serializer::from_crash(record.data(), size);
+    }
+
+    std::vector<std::string> names = reports();
+    ASSERT_EQ(1u, names.size());
+    EXPECT_EQ(0u, names[0].find("rec-crash-"));
+
+    EXPECT_EQ(1, record::render_pending());
+    EXPECT_TRUE(reports().empty());
+    std::vector<std::string> stored = fixtures::stored_reports();
+    ASSERT_EQ(1u, stored.size());
+    EXPECT_NE(std::string::npos, stored[0].find("\"occurrences\":5,\"lastOccurrence\":"));
+
+    // the rendered record takes no more repeats
+    serializer::from_crash(record.data(), size);
+    EXPECT_EQ(1u, reports().size());
+
+    // with coalescing disabled, each is written
+    jni::get_native_context().coalesceWindow = 0;
+    serializer::from_crash(record.data(), size);
+    serializer::from_crash(record.data(), size);
+    EXPECT_EQ(3u, reports().size());
+}
+
+TEST_F(FingerprintTest, RepeatsOfALostRecordAreSettled) {
+    // counted against a record of an earlier launch that is gone by this one
+    uint64_t fingerprint = fingerprint::compute(backtrace);
+    EXPECT_FALSE(fingerprint::coalesce(fingerprint, NOW, WINDOW));
+    EXPECT_TRUE(fingerprint::coalesce(fingerprint, NOW + 1, WINDOW));
+    EXPECT_EQ(0u, reports().size());
+
+    // its repeats can't be reported, and don't swallow the next crash
+    EXPECT_EQ(0, record::render_pending());
+    long last = 0;
+    EXPECT_EQ(0u, fingerprint::peek(fingerprint, last));
+    EXPECT_FALSE(fingerprint::coalesce(fingerprint, NOW + 2, WINDOW));
+}
+
+TEST_F(FingerprintTest, RepeatsAreKeptUntilTheReportIsStored) {
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+    for (int i = 0; i < 5; i++) {
+        serializer::from_crash(record.data(), size);
+    }
+
+    // storage fails: the record and its repeats wait for the next launch
+    struct rlimit saved = {};
+    ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &saved));
+    struct rlimit limited = saved;
+    limited.rlim_cur = 0;
+    sighandler_t previous = signal(SIGXFSZ, SIG_IGN);
+    ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &limited));
+    int rendered = record::render_pending();
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, previous);
+
+    EXPECT_EQ(0, rendered);
+    EXPECT_EQ(1u, reports().size());
+    long last = 0;
+    EXPECT_EQ(4u, fingerprint::peek(fingerprint::compute(backtrace), last));
+
+    EXPECT_EQ(1, record::render_pending());
+    std::vector<std::string> stored = fixtures::stored_reports();
+    ASSERT_EQ(1u, stored.size());
+    EXPECT_NE(std::string::npos, stored[0].find("\"occurrences\":5,\"lastOccurrence\":"));
+    EXPECT_EQ(0u, fingerprint::peek(fingerprint::compute(backtrace), last));
+}
+
+/**
+ * Disk writes and bytes stored in a crash loop, with and without coalescing
+ */
+TEST_F(FingerprintTest, CrashStormBenchmark) {
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+
+    std::printf("[ BENCHMARK] crash storm of %d identical crashes (%zu byte records)\n", STORM_SIZE, size);
+    for (long window: {0L, WINDOW}) {
+        jni::get_native_context().coalesceWindow = window;
+
+        uint64_t start = fixtures::now_ns();
+        for (int i = 0; i < STORM_SIZE; i++) {
+            serializer::from_crash(record.data(), size);
+        }
+        uint64_t store_ns = fixtures::now_ns() - start;
+
+        size_t stored = 0;
+        std::vector<std::string> names = reports();
+        for (const std::string &name: names) {
+            struct stat st = {};
+            stat((std::string(reportDir) + "/" + name).c_str(), &st);
+            stored += st.st_size;
+        }
+
+        start = fixtures::now_ns();
+        int rendered = record::render_pending();
+        uint64_t render_ns = fixtures::now_ns() - start;
+
+        std::printf("[ BENCHMARK]   window %3lds: %3zu records %8zu bytes, %8.1f us/crash,"
+                    " %3d reports rendered in %8.1f ms\n",
+                    window, names.size(), stored, store_ns / 1000.0 / STORM_SIZE,
+                    rendered, render_ns / 1000000.0);
+
+        EXPECT_EQ(window > 0 ? 1u : static_cast<size_t>(STORM_SIZE), names.size());
+        for (const std::string &name: reports()) {
+            unlink((std::string(reportDir) + "/" + name).c_str());
+        }
+        fingerprint::shutdown();
+        unlink((std::string(reportDir) + "/.fingerprints").c_str());
+        ASSERT_TRUE(fingerprint::initialize());
+    }
+}
@@ -0,0 +1,191 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "lz-codec.h"
+#include "writer.h"
+#include "TestFixtures.h"
+
+static const int BENCHMARK_ITERATIONS = 200;
+
+/**
+ * Sample reports from the test resources, next to this source
+ */
+static std::string read_resource(const char *name) {
+    std::string path = __FILE__;
+    path = path.substr(0, path.find_last_of('/') + 1) + "../resources/" + name;
+
+    std::string contents;
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (file != nullptr) {
+        char chunk[4096];
+        size_t cnt;
+        while ((cnt = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            contents.append(chunk, cnt);
+        }
+        std::fclose(file);
+    }
+    return contents;
+}
+
+class LzCodecTest : public ::testing::Test {
+protected:
+    std::unique_ptr<lz::encoder_t> encoder = std::unique_ptr<lz::encoder_t>(new lz::encoder_t());
+
+    std::string compress(const std::string &data) {
+        std::string frame(data.size() + data.size() / 255 + 1024, '\0');
+        writer_t writer = {};
+        writer::to_buffer(writer, &frame[0], frame.size());
+        EXPECT_TRUE(lz::compress(data.data(), data.size(), *encoder, writer));
+        frame.resize(writer.length);
+        return frame;
+    }
+
+    static std::string decompress(const std::string &frame) {
+        std::string data(lz::frame_size(frame.data(), frame.size()), '\0');
+        EXPECT_TRUE(lz::decompress(frame.data(), frame.size(), &data[0], data.size()));
+        return data;
+    }
+
+    /**
+     * A report as the emitter writes them: many frames of a few modules
+     */
+    static std::string synthetic_report(size_t frame_cnt) {
+        std::string report = "{\"backtrace\":{\"name\":\"com.newrelic.sample\",\"threads\":[{\"stack\":[";
+        for (size_t i = 0; i < frame_cnt; i++) {
+            char frame[512];
+            std::snprintf(frame, sizeof(frame),
+                          "%s{\"index\":%zu,\"address\":%zu,\"pc\":%zu,\"so_path\":\"/data/app/~~x1Y2z3==/"
+                          "com.newrelic.sample-AbC==/lib/arm64/libsample-%zu.so\",\"sym_name\":"
+                          "\"sample::worker::process(int, std::__ndk1::basic_string<char>)\","
+                          "\"so_base\":%zu,\"sym_addr\":%zu,\"sym_addr_offset\":%zu}",
+                          i > 0 ? "," : "", i, 0x7a4c200000 + i * 0x1d4, 0x1d4 * i, i % 3,
+                          static_cast<size_t>(0x7a4c200000), 0x7a4c200000 + i * 0x1c0, i % 64);
+            report += frame;
+        }
+        return report + "]}]}}";
+    }
+};
+
+TEST_F(LzCodecTest, RoundTripsSampleReports) {
+    for (const char *name: {"backtrace.json", "threadInfo.json", "stackframe.json"}) {
+        std::string report = read_resource(name);
+        if (report.empty()) {
+            GTEST_SKIP() << "test resources are not on this device";
+        }
+
+        std::string frame = compress(report);
+        EXPECT_EQ(report.size(), lz::frame_size(frame.data(), frame.size()));
+        EXPECT_LT(frame.size(), report.size()) << name;
+        EXPECT_EQ(report, decompress(frame)) << name;
+    }
+}
+
+TEST_F(LzCodecTest, RoundTripsAcrossBlocks) {
+    // several blocks, matching back into the ones before
+    std::string report = synthetic_report(800);
+    ASSERT_GT(report.size(), 8 * lz::BLOCK_SZ);
+
+    std::string frame = compress(report);
+    EXPECT_LT(frame.size() * 4, report.size());
+    EXPECT_EQ(report, decompress(frame));
+
+    // block and run boundaries
+    std::vector<size_t> sizes = {0, 1, 12, 13, 255, 270, lz::BLOCK_SZ - 1, lz::BLOCK_SZ, lz::BLOCK_SZ + 1};
+    for (size_t size: sizes) {
+        std::string data = report.substr(0, size);
+        EXPECT_EQ(data, decompress(compress(data))) << size;
+    }
+    std::string run(100000, 'x');
+    EXPECT_EQ(run, decompress(compress(run)));
+}
+
+TEST_F(LzCodecTest, IncompressibleBlocksAreStored) {
+    std::mt19937 random(1234);
+    std::string data(lz::BLOCK_SZ * 2 + 100, '\0');
+    for (char &c: data) {
+        c = static_cast<char>(random());
+    }
+
+    std::string frame = compress(data);
+    EXPECT_EQ(lz::FRAME_HEADER_SZ + 3 * 4 + data.size(), frame.size());
+    EXPECT_EQ(data, decompress(frame));
+}
+
+TEST_F(LzCodecTest, MalformedFramesAreRejected) {
+    std::string report = synthetic_report(100);
+    std::string frame = compress(report);
+    std::vector<char> out(report.size());
+
+    // not a frame: a report stored uncompressed
+    EXPECT_EQ(0u, lz::frame_size(report.data(), report.size()));
+    EXPECT_FALSE(lz::decompress(report.data(), report.size(), out.data(), out.size()));
+
+    // truncated, or with trailing data
+    EXPECT_FALSE(lz::decompress(frame.data(), frame.size() - 1, out.data(), out.size()));
+    std::string trailing = frame + "x";
+    EXPECT_FALSE(lz::decompress(trailing.data(), trailing.size(), out.data(), out.size()));
+
+    // too large for the buffer
+    EXPECT_FALSE(lz::decompress(frame.data(), frame.size(), out.data(), out.size() - 1));
+
+    // damaged anywhere in its blocks: rejected or wrong, but never out of bounds
+    for (size_t at = lz::FRAME_HEADER_SZ; at < frame.size(); at += 7) {
+        std::string damaged = frame;
+        damaged[at] ^= 0x5a;
+        lz::decompress(damaged.data(), damaged.size(), out.data(), out.size());
+    }
+}
+
+/**
+ * Size and cost of compressing reports as they are stored, and decompressing them to post
+ */
+TEST_F(LzCodecTest, CompressionBenchmark) {
+    std::vector<std::pair<std::string, std::string>> reports = {
+            {"backtrace.json",          read_resource("backtrace.json")},
+            {"threadInfo.json",         read_resource("threadInfo.json")},
+            {"synthetic 100 frames",    synthetic_report(100)},
+            {"synthetic 2000 frames",   synthetic_report(2000)},
+    };
+
+    std::printf("[ BENCHMARK] report compression (%d iterations)\n", BENCHMARK_ITERATIONS);
+    for (auto &report: reports) {
+        if (report.second.empty()) {
+            continue;
+        }
+
+        std::string frame;
+        uint64_t start = fixtures::now_ns();
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            frame = compress(report.second);
+        }
+        uint64_t compress_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+        std::string data;
+        start = fixtures::now_ns();
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            data = decompress(frame);
+        }
+        uint64_t decompress_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+        std::printf("[ BENCHMARK]   %-22s %8zu -> %7zu bytes (%5.2fx), compress %7.1f us (%6.1f MB/s),"
+                    " decompress %7.1f us (%6.1f MB/s)\n",
+                    report.first.c_str(), report.second.size(), frame.size(),
+                    static_cast<double>(report.second.size()) / frame.size(),
+                    compress_ns / 1000.0, 1000.0 * report.second.size() / std::max<uint64_t>(compress_ns, 1),
+                    decompress_ns / 1000.0, 1000.0 * report.second.size() / std::max<uint64_t>(decompress_ns, 1));
+
+        EXPECT_EQ(report.second, data);
+        EXPECT_LT(frame.size() * 2, report.second.size());
+    }
+}
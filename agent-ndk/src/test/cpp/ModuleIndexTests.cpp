@@ -0,0 +1,274 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/ucontext.h>
+
+#include <agent-ndk.h>
+#include "arena.h"
+#include "backtrace.h"
+#include "emitter.h"
+#include "module-index.h"
+#include "record.h"
+#include "TestFixtures.h"
+
+static const int BENCHMARK_ITERATIONS = 50;
+
+static void local_function() {
+}
+
+/**
+ * Resolve an address with dladdr(), as frames were resolved before the index
+ */
+static void dladdr_stackframe(size_t index, uintptr_t address, stackframe_t &stackframe) {
+    Dl_info info = {};
+
+    stackframe.index = index;
+    stackframe.address = address;
+    if (dladdr(reinterpret_cast<void *>(address), &info)) {
+        if (info.dli_fname) {
+            std::strncpy(stackframe.so_path, info.dli_fname, sizeof(stackframe.so_path) - 1);
+        }
+        if (info.dli_sname) {
+            int status = 0;
+            char *demangled = __cxxabiv1::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            std::strncpy(stackframe.sym_name, (demangled != nullptr && status == 0) ? demangled : info.dli_sname,
+                         sizeof(stackframe.sym_name) - 1);
+            std::free(demangled);
+        }
+        stackframe.so_base = reinterpret_cast<uintptr_t>(info.dli_fbase);
+        stackframe.sym_addr = reinterpret_cast<uintptr_t>(info.dli_saddr);
+        if (stackframe.sym_addr != 0) {
+            stackframe.sym_addr_offset = address - stackframe.sym_addr;
+        }
+        stackframe.pc = address - stackframe.so_base;
+    }
+}
+
+class ModuleIndexTest : public ReportDirTest {
+protected:
+    std::vector<uintptr_t> addresses;
+
+    ModuleIndexTest() : ReportDirTest("modules") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        ASSERT_TRUE(modules::initialize());
+
+        // exported functions of libc, the C++ runtime and this binary, a few bytes in
+        const uintptr_t functions[] = {
+                reinterpret_cast<uintptr_t>(&write),
+                reinterpret_cast<uintptr_t>(&getpid),
+                reinterpret_cast<uintptr_t>(&strlen),
+                reinterpret_cast<uintptr_t>(&std::terminate),
+                reinterpret_cast<uintptr_t>(&std::get_terminate),
+                reinterpret_cast<uintptr_t>(&local_function),
+        };
+        for (auto function: functions) {
+            addresses.push_back(function + 4);
+        }
+    }
+
+    void TearDown() override {
+        modules::shutdown();
+        ReportDirTest::TearDown();
+    }
+
+    /**
+     * A library this process has not loaded, or null
+     */
+    static void *open_unloaded_library(uintptr_t &symbol) {
+        const char *libraries[] = {"libz.so", "libz.so.1", "libjnigraphics.so", "libutil.so.1"};
+        const char *symbols[] = {"zlibVersion", "zlibVersion", "AndroidBitmap_getInfo", "openpty"};
+
+        for (size_t i = 0; i < sizeof(libraries) / sizeof(libraries[0]); i++) {
+            if (dlopen(libraries[i], RTLD_NOW | RTLD_NOLOAD) != nullptr) {
+                continue;
+            }
+            void *handle = dlopen(libraries[i], RTLD_NOW | RTLD_LOCAL);
+            if (handle != nullptr) {
+                symbol = reinterpret_cast<uintptr_t>(dlsym(handle, symbols[i]));
+                if (symbol != 0) {
+                    return handle;
+                }
+                dlclose(handle);
+            }
+        }
+        return nullptr;
+    }
+};
+
+TEST_F(ModuleIndexTest, ResolvesAsDladdr) {
+    for (size_t i = 0; i < addresses.size(); i++) {
+        stackframe_t expected = {};
+        stackframe_t actual = {};
+        dladdr_stackframe(i, addresses[i], expected);
+        ASSERT_TRUE(modules::resolve(i, addresses[i], actual)) << expected.so_path;
+
+        EXPECT_STREQ(expected.so_path, actual.so_path);
+        EXPECT_EQ(expected.so_base, actual.so_base) << expected.so_path;
+        EXPECT_EQ(expected.pc, actual.pc) << expected.so_path;
+        if (expected.sym_addr != 0) {
+            EXPECT_STREQ(expected.sym_name, actual.sym_name);
+            EXPECT_EQ(expected.sym_addr, actual.sym_addr) << expected.sym_name;
+            EXPECT_EQ(expected.sym_addr_offset, actual.sym_addr_offset) << expected.sym_name;
+        }
+    }
+}
+
+TEST_F(ModuleIndexTest, UnmappedAddressesAreNotResolved) {
+    stackframe_t stackframe = {};
+    EXPECT_EQ(nullptr, modules::find(0x1000));
+    EXPECT_FALSE(modules::resolve(0, 0x1000, stackframe));
+    EXPECT_EQ('\0', *stackframe.so_path);
+}
+
+TEST_F(ModuleIndexTest, ModulesCarryBuildIds) {
+    const modules::module_t *module = modules::find(reinterpret_cast<uintptr_t>(&write));
+    ASSERT_NE(nullptr, module);
+
+    size_t len = std::strlen(module->build_id);
+    if (len == 0) {
+        GTEST_SKIP() << module->path << " was linked without a build-id";
+    }
+    EXPECT_EQ(0u, len % 2);
+    EXPECT_EQ(len, std::strspn(module->build_id, "0123456789abcdef"));
+}
+
+TEST_F(ModuleIndexTest, RefreshIndexesLoadedModules) {
+    EXPECT_FALSE(modules::refresh());
+
+    uintptr_t symbol = 0;
+    void *handle = open_unloaded_library(symbol);
+    if (handle == nullptr) {
+        GTEST_SKIP() << "no unloaded library to load";
+    }
+
+    EXPECT_EQ(nullptr, modules::find(symbol));
+    const modules::module_t *before = modules::find(reinterpret_cast<uintptr_t>(&write));
+
+    EXPECT_TRUE(modules::refresh());
+    EXPECT_NE(nullptr, modules::find(symbol));
+
+    // modules still loaded are carried over, and the replaced table stays readable
+    const modules::module_t *after = modules::find(reinterpret_cast<uintptr_t>(&write));
+    ASSERT_NE(nullptr, after);
+    EXPECT_NE(before, after);
+    EXPECT_EQ(before->start, after->start);
+    EXPECT_STREQ(before->build_id, after->build_id);
+
+    // the loader may keep a library mapped after the last dlclose(), so only the table's consistency is checked
+    dlclose(handle);
+    modules::refresh();
+    EXPECT_NE(nullptr, modules::find(reinterpret_cast<uintptr_t>(&write)));
+}
+
+TEST_F(ModuleIndexTest, EmittedReportListsModules) {
+    ASSERT_TRUE(arena::initialize(BACKTRACE_ARENA_SZ_MAX));
+    ASSERT_TRUE(arena::acquire());
+
+    std::vector<char> buffer(BACKTRACE_SZ_MAX);
+    siginfo_t siginfo = {};
+    ucontext_t ucontext = {};
+    getcontext(&ucontext);
+    ASSERT_TRUE(collect_backtrace(buffer.data(), buffer.size(), &siginfo, &ucontext));
+    arena::release();
+    arena::shutdown();
+
+    // this test's own module holds a frame
+    const modules::module_t *module = modules::find(reinterpret_cast<uintptr_t>(&local_function));
+    ASSERT_NE(nullptr, module);
+    std::string report(buffer.data());
+    char fragment[PATH_MAX + 128];
+    std::snprintf(fragment, sizeof(fragment), "{\"path\":\"%s\",\"base\":%zu,\"end\":%zu,\"buildId\":\"%s\"}",
+                  module->path.c_str(), static_cast<size_t>(module->start), static_cast<size_t>(module->end),
+                  module->build_id);
+    EXPECT_NE(std::string::npos, report.find("\"modules\":[{")) << report;
+    EXPECT_NE(std::string::npos, report.find(fragment)) << fragment;
+}
+
+TEST_F(ModuleIndexTest, RenderedRecordListsBuildIds) {
+    ASSERT_TRUE(arena::initialize(BACKTRACE_ARENA_SZ_MAX));
+
+    backtrace_t backtrace = {};
+    threadinfo_t thread = {};
+    siginfo_t siginfo = {};
+    ucontext_t ucontext = {};
+    backtrace.state.sa_ucontext = &ucontext;
+    backtrace.state.siginfo = &siginfo;
+    std::strncpy(backtrace.arch, get_arch(), sizeof(backtrace.arch) - 1);
+    backtrace.pid = getpid();
+    backtrace.threads = &thread;
+    backtrace.thread_cnt = 1;
+    thread.crashed = true;
+    thread.backtrace_state = &backtrace.state;
+    for (auto address: addresses) {
+        backtrace.state.frames[backtrace.state.frame_cnt++] = address;
+    }
+
+    std::vector<char> record(BACKTRACE_SZ_MAX);
+    ASSERT_TRUE(arena::acquire());
+    size_t size = record::encode(backtrace, record.data(), record.size());
+    arena::release();
+    arena::shutdown();
+    ASSERT_GT(size, 0u);
+
+    std::string report = render_record(record.data(), size);
+    ASSERT_FALSE(report.empty());
+
+    const modules::module_t *module = modules::find(reinterpret_cast<uintptr_t>(&write));
+    ASSERT_NE(nullptr, module);
+    char fragment[128];
+    std::snprintf(fragment, sizeof(fragment), "\"base\":%zu,", static_cast<size_t>(module->start));
+    size_t at = report.find(fragment, report.find("\"modules\":["));
+    ASSERT_NE(std::string::npos, at) << report;
+    std::snprintf(fragment, sizeof(fragment), "\"buildId\":\"%s\"}", module->build_id);
+    EXPECT_EQ(report.find(fragment, at) + std::strlen(fragment) - 1, report.find('}', at)) << fragment;
+}
+
+TEST_F(ModuleIndexTest, ResolveBenchmark) {
+    std::vector<uintptr_t> frames;
+    for (size_t i = 0; i < BACKTRACE_FRAMES_MAX; i++) {
+        frames.push_back(addresses[i % addresses.size()]);
+    }
+
+    stackframe_t stackframe = {};
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (size_t f = 0; f < frames.size(); f++) {
+            stackframe = {};
+            dladdr_stackframe(f, frames[f], stackframe);
+        }
+    }
+    uint64_t dladdr_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (size_t f = 0; f < frames.size(); f++) {
+            stackframe = {};
+            modules::resolve(f, frames[f], stackframe);
+        }
+    }
+    uint64_t index_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        modules::refresh();
+    }
+    uint64_t refresh_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    std::printf("[ BENCHMARK] frame resolution (%zu frames)\n", frames.size());
+    std::printf("[ BENCHMARK]   dladdr: %8llu ns/stack\n", static_cast<unsigned long long>(dladdr_ns));
+    std::printf("[ BENCHMARK]   index:  %8llu ns/stack\n", static_cast<unsigned long long>(index_ns));
+    std::printf("[ BENCHMARK]   unchanged refresh: %8llu ns\n", static_cast<unsigned long long>(refresh_ns));
+}
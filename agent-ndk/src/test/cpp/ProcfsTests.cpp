@@ -0,0 +1,299 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+#include "procfs.h"
+#include "legacy/anr-detect-legacy.h"
+#include "legacy/thread-info-legacy.h"
+#include "TestFixtures.h"
+
+static const int BENCHMARK_ITERATIONS = 20;
+static const int DISCOVERY_THREADS = 250;
+static const char *const CATCHER_NAME = "Signal Catcher";
+
+static const char *STAT_LINE =
+        "4242 (Binder:4242_2) S 1 4242 0 0 -1 1077952832 1234 0 5 0 "
+        "87 13 0 0 10 -10 42 0 123456 1830502400 23456 18446744073709551615 "
+        "1 1 140737488346112 0 0 0 4612 0 1073775864 0 0 0 -1 3 0 0 0 0 0";
+
+TEST(ProcfsTest, ParsesStatFields) {
+    procfs::proc_stat_t stat;
+    ASSERT_TRUE(procfs::parse_stat(STAT_LINE, std::strlen(STAT_LINE), stat));
+
+    EXPECT_STREQ("Binder:4242_2", stat.name);
+    EXPECT_EQ('S', stat.state);
+    EXPECT_EQ(1, stat.ppid);
+    EXPECT_EQ(87u, stat.utime);
+    EXPECT_EQ(13u, stat.stime);
+    EXPECT_EQ(10, stat.priority);
+    EXPECT_EQ(-10, stat.nice);
+    EXPECT_EQ(42, stat.num_threads);
+    EXPECT_EQ(static_cast<uintptr_t>(140737488346112ULL), stat.start_stack);
+}
+
+TEST(ProcfsTest, ParsesNamesHoldingParenthesesAndSpaces) {
+    const char *line = "17 (a) b (c)) R 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16";
+    procfs::proc_stat_t stat;
+    ASSERT_TRUE(procfs::parse_stat(line, std::strlen(line), stat));
+
+    EXPECT_STREQ("a) b (c)", stat.name);
+    EXPECT_EQ('R', stat.state);
+    EXPECT_EQ(1, stat.ppid);
+    EXPECT_EQ(11u, stat.utime);
+    EXPECT_EQ(15, stat.priority);
+    EXPECT_EQ(16, stat.nice);
+}
+
+TEST(ProcfsTest, RejectsMalformedStat) {
+    procfs::proc_stat_t stat;
+    EXPECT_FALSE(procfs::parse_stat("", 0, stat));
+    EXPECT_FALSE(procfs::parse_stat("17 no-name R 1", 14, stat));
+    EXPECT_FALSE(procfs::parse_stat("17 (name)", 9, stat));
+}
+
+TEST(ProcfsTest, ThreadInfoMatchesLegacy) {
+    pthread_setname_np(pthread_self(), "procfs-test");
+    int task_fd = open("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ASSERT_NE(-1, task_fd);
+
+    threadinfo_t expected = {};
+    threadinfo_t actual = {};
+    legacy::collect_thread_info(getpid(), gettid(), expected);
+    collect_thread_info(task_fd, gettid(), actual);
+    close(task_fd);
+
+    EXPECT_EQ(expected.tid, actual.tid);
+    EXPECT_STREQ("procfs-test", actual.thread_name);
+    EXPECT_STREQ(expected.thread_name, actual.thread_name);
+    EXPECT_STREQ(expected.thread_state, actual.thread_state);
+    EXPECT_EQ(expected.priority, actual.priority);
+    EXPECT_EQ(expected.stack, actual.stack);
+}
+
+TEST(ProcfsTest, ProcessStatIsRead) {
+    std::string stat;
+    procfs::get_process_stat(getpid(), stat);
+
+    char prefix[32];
+    std::snprintf(prefix, sizeof(prefix), "%d (", getpid());
+    EXPECT_EQ(0u, stat.find(prefix));
+    EXPECT_NE('\n', stat.back());
+}
+
+static void *park(void *arg) {
+    auto *released = static_cast<volatile bool *>(arg);
+    while (!*released) {
+        usleep(1000);
+    }
+    return nullptr;
+}
+
+TEST(ProcfsTest, ThreadInfoBenchmark) {
+    volatile bool released = false;
+    std::vector<pthread_t> threads(BACKTRACE_THREADS_MAX - 1);
+    for (auto &thread: threads) {
+        ASSERT_EQ(0, pthread_create(&thread, nullptr, park, const_cast<bool *>(&released)));
+    }
+
+    std::vector<pid_t> tids;
+    DIR *dir = opendir("/proc/self/task");
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] != '.') {
+            tids.push_back(std::strtol(entry->d_name, nullptr, 10));
+        }
+    }
+
+    std::vector<threadinfo_t> table(tids.size());
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (size_t t = 0; t < tids.size(); t++) {
+            legacy::collect_thread_info(getpid(), tids[t], table[t]);
+        }
+    }
+    uint64_t legacy_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (size_t t = 0; t < tids.size(); t++) {
+            collect_thread_info(dirfd(dir), tids[t], table[t]);
+        }
+    }
+    uint64_t parser_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+    closedir(dir);
+
+    released = true;
+    for (auto &thread: threads) {
+        pthread_join(thread, nullptr);
+    }
+
+    std::printf("[ BENCHMARK] collect_thread_info (%zu threads)\n", tids.size());
+    std::printf("[ BENCHMARK]   legacy: %8llu ns/table\n", static_cast<unsigned long long>(legacy_ns));
+    std::printf("[ BENCHMARK]   parser: %8llu ns/table\n", static_cast<unsigned long long>(parser_ns));
+}
+
+typedef struct catcher {
+    volatile bool named;
+    volatile bool released;
+    pid_t tid;
+
+} catcher_t;
+
+/**
+ * Park under the runtime's ANR thread name, blocking SIGQUIT as that thread does
+ */
+static void *catch_signals(void *arg) {
+    auto *catcher = static_cast<catcher_t *>(arg);
+    sigset_t blocked;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGQUIT);
+    pthread_sigmask(SIG_BLOCK, &blocked, nullptr);
+    pthread_setname_np(pthread_self(), CATCHER_NAME);
+    catcher->tid = gettid();
+    catcher->named = true;
+
+    while (!catcher->released) {
+        usleep(1000);
+    }
+    return nullptr;
+}
+
+class ThreadDiscoveryTest : public ::testing::Test {
+protected:
+    volatile bool released = false;
+    std::vector<pthread_t> threads;
+    catcher_t catcher = {};
+    pthread_t catcher_thread = {};
+    int task_fd = -1;
+
+    void SetUp() override {
+        ASSERT_EQ(0, pthread_create(&catcher_thread, nullptr, catch_signals, &catcher));
+        while (!catcher.named) {
+            usleep(1000);
+        }
+        task_fd = procfs::open_task_dir(getpid());
+        ASSERT_NE(-1, task_fd);
+    }
+
+    void TearDown() override {
+        if (task_fd != -1) {
+            close(task_fd);
+        }
+        catcher.released = true;
+        pthread_join(catcher_thread, nullptr);
+        released = true;
+        for (auto &thread: threads) {
+            pthread_join(thread, nullptr);
+        }
+    }
+
+    void park_threads(int count) {
+        threads.resize(count);
+        for (auto &thread: threads) {
+            ASSERT_EQ(0, pthread_create(&thread, nullptr, park, const_cast<bool *>(&released)));
+        }
+    }
+};
+
+TEST_F(ThreadDiscoveryTest, FindsThreadByName) {
+    park_threads(DISCOVERY_THREADS);
+
+    EXPECT_EQ(catcher.tid, procfs::find_thread(task_fd, CATCHER_NAME));
+    EXPECT_EQ(-1, procfs::find_thread(task_fd, "Signal Catchers"));
+    EXPECT_EQ(-1, procfs::find_thread(task_fd, "Signal"));
+
+    // the directory is rewound: a second scan finds the thread again
+    EXPECT_EQ(catcher.tid, procfs::find_thread(task_fd, CATCHER_NAME));
+}
+
+TEST_F(ThreadDiscoveryTest, NamesAreComparedAsTheKernelTruncatesThem) {
+    EXPECT_FALSE(procfs::thread_has_name(task_fd, catcher.tid, "Signal Catcher and more"));
+
+    // all the kernel keeps of a longer name
+    ASSERT_EQ(0, pthread_setname_np(catcher_thread, "Signal Catcher "));
+    EXPECT_EQ(catcher.tid, procfs::find_thread(task_fd, "Signal Catcher and more"));
+    EXPECT_TRUE(procfs::thread_has_name(task_fd, catcher.tid, "Signal Catcher and more"));
+    EXPECT_FALSE(procfs::thread_has_name(task_fd, catcher.tid, CATCHER_NAME));
+}
+
+TEST_F(ThreadDiscoveryTest, ReadsTheBlockedSignalMask) {
+    uint64_t sigblk = 0;
+    ASSERT_TRUE(procfs::read_sigblk(task_fd, catcher.tid, sigblk));
+    EXPECT_EQ(1ULL << (SIGQUIT - 1), sigblk & (1ULL << (SIGQUIT - 1)));
+
+    uint64_t expected = 0;
+    EXPECT_EQ(catcher.tid, legacy::find_thread(getpid(), CATCHER_NAME, expected));
+    EXPECT_EQ(expected, sigblk);
+}
+
+TEST_F(ThreadDiscoveryTest, RevalidationFailsOnceTheThreadHasGone) {
+    ASSERT_TRUE(procfs::thread_has_name(task_fd, catcher.tid, CATCHER_NAME));
+
+    pthread_setname_np(catcher_thread, "renamed");
+    EXPECT_FALSE(procfs::thread_has_name(task_fd, catcher.tid, CATCHER_NAME));
+    EXPECT_TRUE(procfs::thread_has_name(task_fd, catcher.tid, "renamed"));
+
+    catcher.released = true;
+    pthread_join(catcher_thread, nullptr);
+    EXPECT_FALSE(procfs::thread_has_name(task_fd, catcher.tid, "renamed"));
+    EXPECT_EQ(-1, procfs::find_thread(task_fd, CATCHER_NAME));
+
+    uint64_t sigblk = 0;
+    EXPECT_FALSE(procfs::read_sigblk(task_fd, catcher.tid, sigblk));
+
+    // TearDown joins the catcher again: start another under the same name
+    catcher = {};
+    ASSERT_EQ(0, pthread_create(&catcher_thread, nullptr, catch_signals, &catcher));
+    while (!catcher.named) {
+        usleep(1000);
+    }
+}
+
+/**
+ * Finding the runtime's ANR thread and its signal mask among many threads: a readdir and stat
+ * read per thread then a buffered status read, as shipped, against the getdents64 scan on a
+ * directory kept open; and the cost of revalidating the thread found before each signal
+ */
+TEST_F(ThreadDiscoveryTest, DiscoveryBenchmark) {
+    park_threads(DISCOVERY_THREADS);
+
+    uint64_t sigblk = 0;
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        ASSERT_EQ(catcher.tid, legacy::find_thread(getpid(), CATCHER_NAME, sigblk));
+    }
+    uint64_t legacy_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        pid_t tid = procfs::find_thread(task_fd, CATCHER_NAME);
+        ASSERT_EQ(catcher.tid, tid);
+        ASSERT_TRUE(procfs::read_sigblk(task_fd, tid, sigblk));
+    }
+    uint64_t scan_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        ASSERT_TRUE(procfs::thread_has_name(task_fd, catcher.tid, CATCHER_NAME));
+    }
+    uint64_t revalidate_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    std::printf("[ BENCHMARK] ANR thread discovery (%d threads)\n", DISCOVERY_THREADS + 2);
+    std::printf("[ BENCHMARK]   legacy:     %8llu ns/scan\n", static_cast<unsigned long long>(legacy_ns));
+    std::printf("[ BENCHMARK]   getdents64: %8llu ns/scan\n", static_cast<unsigned long long>(scan_ns));
+    std::printf("[ BENCHMARK]   revalidate: %8llu ns/check\n", static_cast<unsigned long long>(revalidate_ns));
+}
@@ -0,0 +1,308 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ucontext.h>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+#include "module-index.h"
+#include "profiler.h"
+#include "unwinder.h"
+#include "jni/native-context.h"
+#include "TestFixtures.h"
+
+static const useconds_t PROFILE_RUN_US = 400000;
+static const uint64_t BENCHMARK_WORK = 50000000ULL;
+static const int BENCHMARK_PAIRS = 31;
+static const int BENCHMARK_SIGNALS = 100000;
+
+static uint64_t thread_cpu_ns() {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Sleep through the samples, which interrupt sleeps as any signal does
+ */
+static void sleep_for(useconds_t us) {
+    uint64_t deadline = fixtures::now_ns() + us * 1000ULL;
+    for (uint64_t now = fixtures::now_ns(); now < deadline; now = fixtures::now_ns()) {
+        usleep(static_cast<useconds_t>((deadline - now) / 1000));
+    }
+}
+
+static __attribute__((noinline)) uint64_t spin_work(uint64_t iterations) {
+    volatile uint64_t sum = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        sum = sum + (i ^ (sum >> 3));
+    }
+    return sum;
+}
+
+/**
+ * A thread spinning or sleeping until released
+ */
+typedef struct worker {
+    bool spinning;
+    std::atomic<bool> released;
+
+} worker_t;
+
+static void *work(void *arg) {
+    worker_t &worker = *static_cast<worker_t *>(arg);
+    while (!worker.released) {
+        if (worker.spinning) {
+            spin_work(100000);
+        } else {
+            usleep(1000);
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Profiles written into a scratch report directory
+ */
+class ProfilerTest : public ReportDirTest {
+protected:
+    ProfilerTest() : ReportDirTest("profile") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        unwinder_initialize();
+        ASSERT_TRUE(modules::initialize());
+    }
+
+    void TearDown() override {
+        profiler::stop();
+        modules::shutdown();
+        ReportDirTest::TearDown();
+    }
+
+    std::vector<std::string> profiles() {
+        std::vector<std::string> names;
+        DIR *dir = opendir(reportDir);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            std::string name = entry->d_name;
+            if (name.compare(0, 8, "profile-") == 0 && name.find(".folded") == name.size() - 7) {
+                names.push_back(name);
+            }
+        }
+        closedir(dir);
+        return names;
+    }
+
+    std::string read_profile(const std::string &name) {
+        std::ifstream in(std::string(reportDir) + "/" + name);
+        std::stringstream contents;
+        contents << in.rdbuf();
+        return contents.str();
+    }
+
+    /**
+     * Profile a worker thread for a while
+     */
+    profiler::stats_t profile(profiler::profile_mode_t mode, bool spinning) {
+        worker_t worker = {spinning, {false}};
+        pthread_t thread;
+        EXPECT_EQ(0, pthread_create(&thread, nullptr, work, &worker));
+
+        bool started = profiler::start(mode, profiler::PROFILE_HZ_DEFAULT);
+        sleep_for(PROFILE_RUN_US);
+        profiler::stats_t stats = profiler::get_stats();
+        profiler::stop();
+
+        worker.released = true;
+        pthread_join(thread, nullptr);
+        EXPECT_TRUE(started);
+
+        return stats;
+    }
+};
+
+TEST_F(ProfilerTest, SamplesSpinningThreadsOnCpuTime) {
+    profiler::stats_t stats = profile(profiler::PROFILE_CPU, true);
+    EXPECT_GE(stats.threads, 2u);
+    EXPECT_FALSE(profiler::running());
+
+    std::vector<std::string> names = profiles();
+    ASSERT_EQ(1u, names.size());
+
+    // the spinning thread's frames are keyed to the test binary
+    const modules::module_t *module = modules::find(reinterpret_cast<uintptr_t>(&spin_work));
+    ASSERT_NE(nullptr, module);
+    const char *slash = std::strrchr(module->path.c_str(), '/');
+    std::string binary = std::string(slash != nullptr ? slash + 1 : module->path.c_str()) + "+0x";
+
+    std::string folded = read_profile(names[0]);
+    EXPECT_NE(std::string::npos, folded.find(binary)) << folded;
+    EXPECT_EQ('\n', folded.back());
+
+    profiler::stats_t totals = profiler::get_stats();
+    EXPECT_GT(totals.samples, 0u);
+    EXPECT_EQ(1u, totals.profiles);
+}
+
+TEST_F(ProfilerTest, SamplesSleepingThreadsOnWallTime) {
+    profile(profiler::PROFILE_WALL, false);
+
+    // a thread using no CPU time is still sampled
+    profiler::stats_t totals = profiler::get_stats();
+    EXPECT_GT(totals.samples, 0u);
+    EXPECT_EQ(1u, profiles().size());
+}
+
+TEST_F(ProfilerTest, FlushStartsANewWindow) {
+    EXPECT_FALSE(profiler::flush());
+
+    ASSERT_TRUE(profiler::start(profiler::PROFILE_WALL, profiler::PROFILE_HZ_MAX));
+    sleep_for(PROFILE_RUN_US / 4);
+    EXPECT_TRUE(profiler::flush());
+    EXPECT_EQ(1u, profiler::get_stats().profiles);
+}
+
+TEST_F(ProfilerTest, KeepsOnlyTheNewestProfiles) {
+    // profiles left by earlier windows and launches, more than are kept
+    for (size_t i = 0; i < profiler::PROFILE_FILES_MAX + 4; i++) {
+        std::ofstream(std::string(reportDir) + "/profile-" + std::to_string(1000 + i) + ".folded") << "main 1\n";
+    }
+    std::ofstream(std::string(reportDir) + "/profile-notes.txt") << "kept\n";
+
+    ASSERT_TRUE(profiler::start(profiler::PROFILE_WALL, profiler::PROFILE_HZ_MAX));
+    sleep_for(PROFILE_RUN_US / 4);
+    EXPECT_TRUE(profiler::flush());
+    profiler::stop();
+
+    std::vector<std::string> names = profiles();
+    EXPECT_EQ(profiler::PROFILE_FILES_MAX, names.size());
+    EXPECT_EQ(5u, profiler::get_stats().pruned);
+
+    // the oldest went first
+    std::sort(names.begin(), names.end());
+    EXPECT_EQ("profile-1005.folded", names.front());
+    EXPECT_EQ(0, access((std::string(reportDir) + "/profile-notes.txt").c_str(), F_OK));
+}
+
+TEST_F(ProfilerTest, StartsOnce) {
+    EXPECT_FALSE(profiler::start(profiler::PROFILE_OFF));
+    EXPECT_FALSE(profiler::start(profiler::PROFILE_CPU, 0));
+
+    ASSERT_TRUE(profiler::start(profiler::PROFILE_CPU));
+    EXPECT_TRUE(profiler::running());
+    EXPECT_FALSE(profiler::start(profiler::PROFILE_WALL));
+
+    profiler::stop();
+    EXPECT_FALSE(profiler::running());
+
+    // and again, once stopped
+    EXPECT_TRUE(profiler::start(profiler::PROFILE_WALL));
+}
+
+/**
+ * The CPU time of a fixed workload, profiled at the default rate or not
+ */
+static uint64_t profiled_work_ns(bool profiled, uint64_t &samples) {
+    if (profiled) {
+        EXPECT_TRUE(profiler::start(profiler::PROFILE_CPU, profiler::PROFILE_HZ_DEFAULT));
+        sleep_for(10000);  // for the first thread scan to arm this thread's timer
+    }
+
+    // the work's own CPU time, which includes the time its thread spends in the handler
+    uint64_t start = thread_cpu_ns();
+    spin_work(BENCHMARK_WORK);
+    uint64_t elapsed_ns = thread_cpu_ns() - start;
+
+    if (profiled) {
+        profiler::stop();
+        samples += profiler::get_stats().samples;
+    }
+    return elapsed_ns;
+}
+
+/**
+ * The median overhead of runs paired with an unprofiled run next to them, in either order:
+ * the drift of the CPU's clock over the benchmark cancels out, as an outlier run does
+ */
+static double profiled_overhead(uint64_t &off_ns, uint64_t &on_ns, uint64_t &samples) {
+    std::vector<double> overheads;
+    std::vector<uint64_t> offs, ons;
+    for (int pair = 0; pair < BENCHMARK_PAIRS; pair++) {
+        bool profiled_first = (pair % 2) == 1;
+        uint64_t first_ns = profiled_work_ns(profiled_first, samples);
+        uint64_t second_ns = profiled_work_ns(!profiled_first, samples);
+        uint64_t off = profiled_first ? second_ns : first_ns;
+        uint64_t on = profiled_first ? first_ns : second_ns;
+
+        overheads.push_back(100.0 * (static_cast<double>(on) - off) / off);
+        offs.push_back(off);
+        ons.push_back(on);
+    }
+
+    std::sort(overheads.begin(), overheads.end());
+    std::sort(offs.begin(), offs.end());
+    std::sort(ons.begin(), ons.end());
+    off_ns = offs[offs.size() / 2];
+    on_ns = ons[ons.size() / 2];
+    return overheads[overheads.size() / 2];
+}
+
+TEST_F(ProfilerTest, OverheadBenchmark) {
+    std::printf("[ BENCHMARK] CPU profiling at %d Hz, median of %d paired runs of %llu iterations\n",
+                profiler::PROFILE_HZ_DEFAULT, BENCHMARK_PAIRS, (unsigned long long) BENCHMARK_WORK);
+
+    uint64_t samples = 0;
+    uint64_t off_ns = 0;
+    uint64_t on_ns = 0;
+    double overhead = profiled_overhead(off_ns, on_ns, samples);
+
+    // the cost of a sample, in parts: taking the signal, and walking the stack
+    ASSERT_TRUE(profiler::start(profiler::PROFILE_CPU, profiler::PROFILE_HZ_DEFAULT));
+    uint64_t start = thread_cpu_ns();
+    for (int i = 0; i < BENCHMARK_SIGNALS; i++) {
+        raise(SIGPROF);
+    }
+    double signal_ns = static_cast<double>(thread_cpu_ns() - start) / BENCHMARK_SIGNALS;
+    profiler::stop();
+
+    ucontext_t ucontext = {};
+    getcontext(&ucontext);
+    backtrace_state_t state = {};
+    start = thread_cpu_ns();
+    for (int i = 0; i < BENCHMARK_SIGNALS; i++) {
+        state.sa_ucontext = &ucontext;
+        unwind_frame_pointers(state);
+    }
+    double unwind_ns = static_cast<double>(thread_cpu_ns() - start) / BENCHMARK_SIGNALS;
+    double sample_ns = signal_ns + unwind_ns;
+
+    std::printf("[ BENCHMARK]   off:      %8.2f ms\n", off_ns / 1e6);
+    std::printf("[ BENCHMARK]   on:       %8.2f ms (%+.2f%% paired, %llu samples)\n", on_ns / 1e6,
+                overhead, (unsigned long long) samples);
+    std::printf("[ BENCHMARK]   sample:   %8.2f us (signal %.2f us, %zu frames %.2f us)\n",
+                sample_ns / 1e3, signal_ns / 1e3, state.frame_cnt, unwind_ns / 1e3);
+    std::printf("[ BENCHMARK]   overhead: %8.3f%% of a thread's CPU time\n",
+                sample_ns * profiler::PROFILE_HZ_DEFAULT / 1e7);
+    EXPECT_GT(samples, 0u);
+
+    // within the 2% budget at the default rate
+    EXPECT_LT(overhead, 2.0);
+}
@@ -0,0 +1,288 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <agent-ndk.h>
+#include "arena.h"
+#include "backtrace.h"
+#include "emitter.h"
+#include "record.h"
+#include "report-store.h"
+#include "serializer.h"
+#include "symbolizer.h"
+#include "unwinder.h"
+#include "writer.h"
+#include "procfs.h"
+#include "jni/native-context.h"
+#include "TestFixtures.h"
+
+static const int BENCHMARK_ITERATIONS = 50;
+
+/**
+ * A crash-sized backtrace whose frames resolve to exported functions of loaded libraries,
+ * rendered into a scratch report directory
+ */
+class RecordTest : public ReportDirTest {
+protected:
+    backtrace_t backtrace = {};
+    threadinfo_t threads[BACKTRACE_THREADS_MAX] = {};
+    siginfo_t siginfo = {};
+    ucontext_t ucontext = {};
+    std::vector<char> buffer = std::vector<char>(BACKTRACE_SZ_MAX);
+    std::vector<char> record = std::vector<char>(BACKTRACE_SZ_MAX);
+
+    RecordTest() : ReportDirTest("record") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        ASSERT_TRUE(arena::initialize(BACKTRACE_ARENA_SZ_MAX));
+
+        siginfo.si_signo = SIGSEGV;
+        siginfo.si_code = SEGV_MAPERR;
+        siginfo.si_addr = reinterpret_cast<void *>(0xdeadbeef);
+
+        uint8_t *regs = reinterpret_cast<uint8_t *>(&ucontext.uc_mcontext);
+        for (size_t i = 0; i < sizeof(ucontext.uc_mcontext); i++) {
+            regs[i] = static_cast<uint8_t>(i * 37 + 11);
+        }
+
+        backtrace.state.sa_ucontext = &ucontext;
+        backtrace.state.siginfo = &siginfo;
+        std::strncpy(backtrace.description, "Address not mapped", sizeof(backtrace.description) - 1);
+        std::strncpy(backtrace.arch, get_arch(), sizeof(backtrace.arch) - 1);
+        std::strncpy(backtrace.build_id, "build-id", sizeof(backtrace.build_id) - 1);
+        std::strncpy(backtrace.session_id, "session-id", sizeof(backtrace.session_id) - 1);
+        procfs::read_process_name(getpid(), backtrace.process_name, sizeof(backtrace.process_name));
+        backtrace.timestamp = 1700000000;
+        backtrace.pid = getpid();
+        backtrace.ppid = getppid();
+        backtrace.uid = getuid();
+
+        backtrace.threads = threads;
+        backtrace.thread_cnt = BACKTRACE_THREADS_MAX;
+        for (size_t i = 0; i < BACKTRACE_THREADS_MAX; i++) {
+            threads[i].tid = 1000 + static_cast<int>(i);
+            std::snprintf(threads[i].thread_name, sizeof(threads[i].thread_name), "worker-%zu", i);
+            std::strncpy(threads[i].thread_state, "SLEEPING", sizeof(threads[i].thread_state) - 1);
+            threads[i].priority = static_cast<int>(i % 20);
+        }
+        threads[0].crashed = true;
+        threads[0].backtrace_state = &backtrace.state;
+
+        // exported functions of libc and the C++ runtime, a few bytes in
+        const uintptr_t functions[] = {
+                reinterpret_cast<uintptr_t>(&write),
+                reinterpret_cast<uintptr_t>(&getpid),
+                reinterpret_cast<uintptr_t>(&strlen),
+                reinterpret_cast<uintptr_t>(&std::terminate),
+                reinterpret_cast<uintptr_t>(&std::get_terminate),
+        };
+        const size_t function_cnt = sizeof(functions) / sizeof(functions[0]);
+        backtrace.state.frame_cnt = BACKTRACE_FRAMES_MAX;
+        for (size_t i = 0; i < BACKTRACE_FRAMES_MAX; i++) {
+            backtrace.state.frames[i] = functions[i % function_cnt] + 4;
+        }
+    }
+
+    void TearDown() override {
+        arena::shutdown();
+        ReportDirTest::TearDown();
+    }
+
+    std::string emit() {
+        writer_t writer = {};
+        writer::to_buffer(writer, buffer.data(), buffer.size());
+        EXPECT_TRUE(emit_backtrace(backtrace, writer));
+        return std::string(buffer.data(), writer.length);
+    }
+
+    size_t encode() {
+        EXPECT_TRUE(arena::acquire());
+        size_t size = record::encode(backtrace, record.data(), record.size());
+        arena::release();
+        return size;
+    }
+
+    std::string render(size_t size) {
+        return render_record(record.data(), size);
+    }
+
+    static std::string real_path(const char *path) {
+        char resolved[PATH_MAX];
+        return realpath(path, resolved) ? resolved : path;
+    }
+};
+
+TEST_F(RecordTest, RenderedRecordMatchesEmitterWithoutSymbols) {
+    for (size_t i = 0; i < BACKTRACE_FRAMES_MAX; i++) {
+        backtrace.state.frames[i] = 0x1000 + (i * 4);
+    }
+
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+    EXPECT_EQ(emit(), render(size));
+}
+
+TEST_F(RecordTest, RenderedRecordMatchesEmitterWithOtherThreadStacks) {
+    for (size_t i = 0; i < BACKTRACE_FRAMES_MAX; i++) {
+        backtrace.state.frames[i] = 0x1000 + (i * 4);
+    }
+
+    std::vector<backtrace_state_t> states(3);
+    for (size_t t = 0; t < states.size(); t++) {
+        states[t].frame_cnt = 10 * (t + 1);
+        states[t].skipped_frames = static_cast<int>(t);
+        for (size_t i = 0; i < states[t].frame_cnt; i++) {
+            states[t].frames[i] = 0x2000 + (t * 0x100) + (i * 4);
+        }
+        threads[10 * (t + 1)].backtrace_state = &states[t];
+    }
+
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+    EXPECT_EQ(emit(), render(size));
+}
+
+TEST_F(RecordTest, RenderedRecordMatchesEmitterWithoutRegisterContext) {
+    backtrace.state.sa_ucontext = nullptr;
+    backtrace.state.siginfo = nullptr;
+
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+    EXPECT_EQ(emit(), render(size));
+}
+
+TEST_F(RecordTest, SymbolizedFramesMatchDladdr) {
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+    std::string rendered = render(size);
+
+    for (size_t i = 0; i < 5; i++) {
+        stackframe_t expected = {};
+        transform_addr_to_stackframe(i, backtrace.state.frames[i], expected);
+        ASSERT_NE('\0', *expected.so_path);
+
+        // the rendered report holds the same symbol, at the same address
+        char fragment[512];
+        std::snprintf(fragment, sizeof(fragment),
+                      "\"pc\":%zu,\"so_base\":%zu,\"sym_addr\":%zu,\"sym_addr_offset\":%zu",
+                      static_cast<size_t>(expected.pc), static_cast<size_t>(expected.so_base),
+                      static_cast<size_t>(expected.sym_addr), static_cast<size_t>(expected.sym_addr_offset));
+        EXPECT_NE(std::string::npos, rendered.find(fragment)) << fragment;
+        EXPECT_NE(std::string::npos, rendered.find(real_path(expected.so_path))) << expected.so_path;
+    }
+}
+
+TEST_F(RecordTest, InvalidRecordIsRejected) {
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+
+    EXPECT_EQ("", render_record(record.data(), size / 2));
+
+    record[0] ^= 0xff;
+    EXPECT_EQ("", render_record(record.data(), size));
+
+    // both are discarded
+    EXPECT_EQ(0, record::render_pending());
+    EXPECT_TRUE(fixtures::stored_reports().empty());
+}
+
+TEST_F(RecordTest, PendingRecordsAreRendered) {
+    for (size_t i = 0; i < BACKTRACE_FRAMES_MAX; i++) {
+        backtrace.state.frames[i] = 0x1000 + (i * 4);
+    }
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+    serializer::from_anr(record.data(), size);
+
+    EXPECT_EQ(1, record::render_pending());
+
+    // the record is consumed, and the report is appended to the store
+    std::vector<std::string> names;
+    DIR *dir = opendir(reportDir);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_name[0] != '.') {
+            names.emplace_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    EXPECT_TRUE(names.empty());
+
+    std::vector<std::string> reports = fixtures::stored_reports();
+    ASSERT_EQ(1u, reports.size());
+    EXPECT_EQ(emit(), reports[0]);
+}
+
+TEST_F(RecordTest, OversizedReportsAreRenderedWhole) {
+    store::set_quota(store::REPORT_CRASH, {64 * 1024 * 1024, 16});
+
+    // every thread's stack symbolized: more JSON than a report buffer holds
+    std::vector<backtrace_state_t> states(BACKTRACE_THREADS_MAX);
+    for (size_t t = 1; t < BACKTRACE_THREADS_MAX; t++) {
+        states[t] = backtrace.state;
+        states[t].sa_ucontext = nullptr;
+        states[t].siginfo = nullptr;
+        threads[t].backtrace_state = &states[t];
+    }
+    size_t size = encode();
+    ASSERT_GT(size, 0u);
+    serializer::from_crash(record.data(), size);
+
+    EXPECT_EQ(1, record::render_pending());
+    std::vector<std::string> reports = fixtures::stored_reports();
+    ASSERT_EQ(1u, reports.size());
+    EXPECT_GT(reports[0].size(), BACKTRACE_SZ_MAX);
+    EXPECT_NE(std::string::npos, reports[0].find("worker-99"));
+
+    store::set_quota(store::REPORT_CRASH, {0, 0});
+}
+
+/**
+ * Crash-time cost and size of a symbolized JSON report vs. a binary record
+ */
+TEST_F(RecordTest, RecordBenchmark) {
+    std::string report;
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        report = emit();
+    }
+    uint64_t emit_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    size_t size = 0;
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        size = encode();
+    }
+    uint64_t encode_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        render(size);
+    }
+    uint64_t render_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    std::printf("[ BENCHMARK] crash-time report (%zu threads, %zu frames)\n",
+                backtrace.thread_cnt, backtrace.state.frame_cnt);
+    std::printf("[ BENCHMARK]   json:   %8llu ns/report %8zu bytes\n",
+                static_cast<unsigned long long>(emit_ns), report.size());
+    std::printf("[ BENCHMARK]   record: %8llu ns/report %8zu bytes\n",
+                static_cast<unsigned long long>(encode_ns), size);
+    std::printf("[ BENCHMARK]   render: %8llu ns/report (next launch)\n",
+                static_cast<unsigned long long>(render_ns));
+
+    EXPECT_LT(encode_ns, emit_ns);
+    EXPECT_LT(size, report.size());
+}
@@ -0,0 +1,241 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <agent-ndk.h>
+#include "jni/native-context.h"
+#include "lz-codec.h"
+#include "report-store.h"
+#include "report-handoff.h"
+#include "serializer.h"
+#include "TestFixtures.h"
+
+/**
+ * The process' mapped address space, in bytes
+ */
+static size_t mapped_size() {
+    size_t kb = 0;
+    FILE *status = fopen("/proc/self/status", "re");
+    char line[128];
+    while (status != nullptr && fgets(line, sizeof(line), status) != nullptr) {
+        if (std::sscanf(line, "VmSize: %zu kB", &kb) == 1) {
+            break;
+        }
+    }
+    if (status != nullptr) {
+        fclose(status);
+    }
+    return kb * 1024;
+}
+
+static const int BENCHMARK_REPORTS = 64;
+
+/**
+ * Collects the reports handed off, consuming every one or every other one
+ */
+typedef struct handed {
+    std::vector<std::string> reports;
+    bool consume_alternate;
+    useconds_t delay_us;
+
+} handed_t;
+
+static bool collect(const store::report_t &report, const char *data, size_t size, void *arg) {
+    handed_t *handed = static_cast<handed_t *>(arg);
+    (void) report;
+    handed->reports.emplace_back(data, size);
+    if (handed->delay_us > 0) {
+        usleep(handed->delay_us);
+    }
+    return !handed->consume_alternate || (handed->reports.size() % 2 == 1);
+}
+
+/**
+ * Redirects report storage (and so the store) to a scratch directory
+ */
+class ReportHandoffTest : public ReportDirTest {
+protected:
+    ReportHandoffTest() : ReportDirTest("handoff") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        ASSERT_TRUE(store::initialize());
+        store::set_quota(store::REPORT_CRASH, {64 * 1024 * 1024, 1024});
+    }
+
+    void TearDown() override {
+        store::shutdown();
+        store::set_quota(store::REPORT_CRASH, {0, 0});
+        ReportDirTest::TearDown();
+    }
+
+    /**
+     * A report that compresses about as well as a rendered crash
+     */
+    static std::string report(int n, size_t frames = 16) {
+        std::string payload = "{\"report\":" + std::to_string(n) + ",\"frames\":[";
+        char frame[128];
+        for (size_t i = 0; i < frames; i++) {
+            std::snprintf(frame, sizeof(frame), "%s{\"pc\":\"0x%08zx\",\"symbol\":\"fn_%zu\",\"offset\":%zu}",
+                          i ? "," : "", 0x7000a000 + i * 0x1f4 + n, (i * 7 + n) % 97, i * 13);
+            payload += frame;
+        }
+        return payload + "]}";
+    }
+
+    static void store_reports(int cnt, size_t frames = 16) {
+        for (int i = 0; i < cnt; i++) {
+            std::string payload = report(i, frames);
+            ASSERT_TRUE(serializer::to_report_store("crash-", payload.data(), payload.size()));
+        }
+    }
+};
+
+TEST_F(ReportHandoffTest, ReportsAreDecompressedInOrder) {
+    store_reports(12);
+
+    handed_t handed = {{}, false, 0};
+    EXPECT_EQ(12, handoff::flush(collect, &handed, 0, 3));
+    ASSERT_EQ(12u, handed.reports.size());
+    for (int i = 0; i < 12; i++) {
+        EXPECT_EQ(report(i), handed.reports[i]);
+    }
+
+    handed = {{}, false, 0};
+    EXPECT_EQ(0, handoff::flush(collect, &handed, 0, 3));
+    EXPECT_TRUE(handed.reports.empty());
+}
+
+TEST_F(ReportHandoffTest, UnconsumedReportsAreKept) {
+    store_reports(6);
+
+    handed_t handed = {{}, true, 0};
+    EXPECT_EQ(3, handoff::flush(collect, &handed, 0));
+    EXPECT_EQ(6u, handed.reports.size());
+
+    handed = {{}, false, 0};
+    EXPECT_EQ(3, handoff::flush(collect, &handed, 0));
+    ASSERT_EQ(3u, handed.reports.size());
+    EXPECT_EQ(report(1), handed.reports[0]);
+    EXPECT_EQ(report(5), handed.reports[2]);
+}
+
+TEST_F(ReportHandoffTest, UncompressedReportsArePassedAsStored) {
+    std::string payload = report(1);
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, payload.data(), payload.size()));
+
+    handed_t handed = {{}, false, 0};
+    EXPECT_EQ(1, handoff::flush(collect, &handed, 0));
+    ASSERT_EQ(1u, handed.reports.size());
+    EXPECT_EQ(payload, handed.reports[0]);
+}
+
+TEST_F(ReportHandoffTest, BudgetLeavesReportsForTheNextLaunch) {
+    store_reports(10);
+
+    // each delivery takes 20ms, against a budget of 50ms
+    handed_t handed = {{}, false, 20000};
+    int delivered = handoff::flush(collect, &handed, 50, 2);
+    EXPECT_GE(delivered, 1);
+    EXPECT_LT(delivered, 10);
+
+    handed_t rest = {{}, false, 0};
+    EXPECT_EQ(10 - delivered, handoff::flush(collect, &rest, 0, 2));
+    ASSERT_EQ(static_cast<size_t>(10 - delivered), rest.reports.size());
+    EXPECT_EQ(report(delivered), rest.reports[0]);
+    EXPECT_EQ(report(9), rest.reports.back());
+}
+
+TEST_F(ReportHandoffTest, ReportsAreKeptWhenMemoryRunsOut) {
+    // a frame that would decompress to 1GB, but holds no valid block
+    std::string frame(64, '\x5a');
+    const uint32_t header[] = {lz::FRAME_MAGIC, 0x40000000};
+    std::memcpy(&frame[0], header, sizeof(header));
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, frame.data(), frame.size()));
+    store_reports(1);
+
+    // with too little address space left to decompress it into, it's left for the next launch
+    struct rlimit saved = {};
+    ASSERT_EQ(0, getrlimit(RLIMIT_AS, &saved));
+    struct rlimit limited = saved;
+    limited.rlim_cur = mapped_size() + 64 * 1024 * 1024;
+    ASSERT_EQ(0, setrlimit(RLIMIT_AS, &limited));
+    handed_t handed = {{}, false, 0};
+    int delivered = handoff::flush(collect, &handed, 0, 1);
+    setrlimit(RLIMIT_AS, &saved);
+
+    EXPECT_EQ(1, delivered);
+    ASSERT_EQ(1u, handed.reports.size());
+    EXPECT_EQ(report(0), handed.reports[0]);
+
+    // once it can be decompressed, it's found corrupt and dropped
+    handed = {{}, false, 0};
+    EXPECT_EQ(1, handoff::flush(collect, &handed, 0, 1));
+    EXPECT_TRUE(handed.reports.empty());
+
+    EXPECT_EQ(0, handoff::flush(collect, &handed, 0, 1));
+}
+
+typedef struct copied {
+    size_t reports;
+    size_t bytes;
+
+} copied_t;
+
+/**
+ * The handoff it replaces: copy each stored report out, as into a byte[], then decompress it
+ */
+static bool copy_and_decompress(const store::report_t &report, void *arg) {
+    copied_t *copied = static_cast<copied_t *>(arg);
+    std::vector<char> copy(report.data, report.data + report.size);
+    std::string decompressed(lz::frame_size(copy.data(), copy.size()), '\0');
+    if (lz::decompress(copy.data(), copy.size(), &decompressed[0], decompressed.size())) {
+        copied->reports++;
+        copied->bytes += decompressed.size();
+    }
+    return false;
+}
+
+/**
+ * Flushing a backlog of large reports: copied and decompressed one at a time, against the
+ * handoff's worker pool
+ */
+TEST_F(ReportHandoffTest, HandoffBenchmark) {
+    const size_t frames = 2048;
+    store_reports(BENCHMARK_REPORTS, frames);
+    size_t size = report(0, frames).size();
+
+    std::printf("[ BENCHMARK] handoff of %d reports of %zu bytes\n", BENCHMARK_REPORTS, size);
+
+    copied_t copied = {};
+    uint64_t start = fixtures::now_ns();
+    store::for_each(copy_and_decompress, &copied);
+    uint64_t serial_ns = fixtures::now_ns() - start;
+    ASSERT_EQ(static_cast<size_t>(BENCHMARK_REPORTS), copied.reports);
+
+    size_t touched = 0;
+    start = fixtures::now_ns();
+    int delivered = handoff::flush([](const store::report_t &, const char *data, size_t size, void *arg) {
+        // touch the report, as a listener would
+        *static_cast<size_t *>(arg) += (size > 0 && data[size - 1] == '}') ? 1 : 0;
+        return true;
+    }, &touched, 0);
+    uint64_t handoff_ns = fixtures::now_ns() - start;
+    ASSERT_EQ(BENCHMARK_REPORTS, delivered);
+    EXPECT_EQ(static_cast<size_t>(BENCHMARK_REPORTS), touched);
+
+    std::printf("[ BENCHMARK]   copied and decompressed: %8.1f us/report\n",
+                serial_ns / 1000.0 / BENCHMARK_REPORTS);
+    std::printf("[ BENCHMARK]   handed off:              %8.1f us/report\n",
+                handoff_ns / 1000.0 / BENCHMARK_REPORTS);
+}
@@ -0,0 +1,143 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <agent-ndk.h>
+#include "jni/native-context.h"
+#include "report-slots.h"
+#include "serializer.h"
+#include "TestFixtures.h"
+
+/**
+ * Redirects report storage (and so the slot directory) to a scratch directory
+ */
+class ReportSlotsTest : public ReportDirTest {
+protected:
+    std::string payload = "{\"backtrace\":{}}";
+
+    ReportSlotsTest() : ReportDirTest("slots") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        ASSERT_TRUE(slots::initialize());
+    }
+
+    void TearDown() override {
+        slots::shutdown();
+        ReportDirTest::TearDown();
+    }
+
+    static std::vector<std::string> list(const std::string &path) {
+        std::vector<std::string> names;
+        DIR *dir = opendir(path.c_str());
+        if (dir != nullptr) {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0) {
+                    names.emplace_back(entry->d_name);
+                }
+            }
+            closedir(dir);
+        }
+        return names;
+    }
+
+    std::vector<std::string> reports() {
+        std::vector<std::string> names;
+        for (auto &name: list(reportDir)) {
+            if (name[0] != '.') {
+                names.push_back(name);
+            }
+        }
+        return names;
+    }
+
+    std::string read(const std::string &name) {
+        std::string path = std::string(reportDir) + "/" + name;
+        std::string contents;
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd != -1) {
+            char buf[4096];
+            ssize_t cnt;
+            while ((cnt = ::read(fd, buf, sizeof(buf))) > 0) {
+                contents.append(buf, cnt);
+            }
+            close(fd);
+        }
+        return contents;
+    }
+};
+
+TEST_F(ReportSlotsTest, SlotFilesArePreallocated) {
+    auto names = list(std::string(reportDir) + "/.slots");
+    EXPECT_EQ(static_cast<size_t>(slots::SLOT_TYPE_CNT), names.size());
+    EXPECT_TRUE(reports().empty());
+}
+
+TEST_F(ReportSlotsTest, CommittedReportIsDrained) {
+    ASSERT_TRUE(slots::commit(slots::SLOT_CRASH, payload.data(), payload.size()));
+    EXPECT_TRUE(reports().empty());
+
+    EXPECT_EQ(1, slots::drain());
+    auto names = reports();
+    ASSERT_EQ(1u, names.size());
+    EXPECT_EQ(0u, names[0].find("rec-crash-"));
+    EXPECT_EQ(payload, read(names[0]));
+
+    // the slot is reset, and can be used again
+    EXPECT_EQ(0, slots::drain());
+    EXPECT_TRUE(slots::commit(slots::SLOT_CRASH, payload.data(), payload.size()));
+}
+
+TEST_F(ReportSlotsTest, OccupiedSlotIsNotOverwritten) {
+    ASSERT_TRUE(slots::commit(slots::SLOT_ANR, payload.data(), payload.size()));
+    EXPECT_FALSE(slots::commit(slots::SLOT_ANR, "{}", 2));
+    EXPECT_TRUE(slots::commit(slots::SLOT_EXCEPTION, "{}", 2));
+    EXPECT_EQ(2, slots::drain());
+}
+
+TEST_F(ReportSlotsTest, CommittedReportSurvivesRestart) {
+    ASSERT_TRUE(slots::commit(slots::SLOT_EXCEPTION, payload.data(), payload.size()));
+    slots::shutdown();
+
+    // drained without reopening the slots, as at next launch before the agent starts
+    EXPECT_EQ(1, slots::drain());
+    ASSERT_EQ(1u, reports().size());
+    EXPECT_EQ(0u, reports()[0].find("rec-ex-"));
+
+    ASSERT_TRUE(slots::initialize());
+    ASSERT_TRUE(slots::commit(slots::SLOT_EXCEPTION, payload.data(), payload.size()));
+    slots::shutdown();
+    ASSERT_TRUE(slots::initialize());
+    EXPECT_FALSE(slots::commit(slots::SLOT_EXCEPTION, payload.data(), payload.size()));
+    EXPECT_EQ(1, slots::drain());
+    EXPECT_EQ(2u, reports().size());
+}
+
+TEST_F(ReportSlotsTest, OversizedReportIsRejected) {
+    std::string oversized(BACKTRACE_SZ_MAX + 1, 'x');
+    EXPECT_FALSE(slots::commit(slots::SLOT_CRASH, oversized.data(), oversized.size()));
+    EXPECT_TRUE(slots::commit(slots::SLOT_CRASH, payload.data(), payload.size()));
+}
+
+TEST_F(ReportSlotsTest, SerializerFallsBackToReportFile) {
+    serializer::from_crash(payload.data(), payload.size());
+    EXPECT_TRUE(reports().empty());
+
+    serializer::from_crash(payload.data(), payload.size());
+    ASSERT_EQ(1u, reports().size());
+
+    EXPECT_EQ(1, slots::drain());
+    EXPECT_EQ(2u, reports().size());
+}
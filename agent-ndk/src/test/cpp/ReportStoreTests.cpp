@@ -0,0 +1,407 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <agent-ndk.h>
+#include "jni/native-context.h"
+#include "report-store.h"
+#include "serializer.h"
+#include "TestFixtures.h"
+
+static const int BENCHMARK_REPORTS = 200;
+
+typedef struct stored {
+    store::report_type_t type;
+    std::string payload;
+    uint64_t id;
+
+} stored_t;
+
+/**
+ * Collects the reports visited, acknowledging every other one if asked
+ */
+typedef struct visit {
+    std::vector<stored_t> reports;
+    bool acknowledge_alternate;
+
+} visit_t;
+
+static bool collect(const store::report_t &report, void *arg) {
+    visit_t *visit = static_cast<visit_t *>(arg);
+    visit->reports.push_back({report.type, std::string(report.data, report.size), report.id});
+    return visit->acknowledge_alternate && (visit->reports.size() % 2 == 1);
+}
+
+/**
+ * Redirects report storage (and so the store) to a scratch directory
+ */
+class ReportStoreTest : public ReportDirTest {
+protected:
+    ReportStoreTest() : ReportDirTest("store") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        ASSERT_TRUE(store::initialize());
+    }
+
+    void TearDown() override {
+        store::shutdown();
+        for (int type = 0; type < store::REPORT_TYPE_CNT; type++) {
+            store::set_quota(static_cast<store::report_type_t>(type), {0, 0});
+        }
+        ReportDirTest::TearDown();
+    }
+
+    static std::string report(int n, size_t size = 64) {
+        std::string payload = "{\"report\":" + std::to_string(n) + ",\"padding\":\"";
+        payload.append(size > payload.size() + 2 ? size - payload.size() - 2 : 0, 'a' + n % 26);
+        return payload + "\"}";
+    }
+
+    static std::vector<stored_t> read_all(bool acknowledge_alternate = false) {
+        visit_t visit = {{}, acknowledge_alternate};
+        store::for_each(collect, &visit);
+        return visit.reports;
+    }
+
+    std::string store_path(const char *name = nullptr) const {
+        return std::string(reportDir) + "/.store" + (name != nullptr ? std::string("/") + name : "");
+    }
+
+    std::vector<std::string> segments() const {
+        std::vector<std::string> names;
+        DIR *dir = opendir(store_path().c_str());
+        if (dir != nullptr) {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                if (std::strncmp(entry->d_name, "seg-", 4) == 0) {
+                    names.emplace_back(entry->d_name);
+                }
+            }
+            closedir(dir);
+        }
+        std::sort(names.begin(), names.end());
+        return names;
+    }
+
+    static void append_bytes(const std::string &path, const char *bytes, size_t size) {
+        int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+        ASSERT_NE(-1, fd);
+        ASSERT_EQ(static_cast<ssize_t>(size), write(fd, bytes, size));
+        close(fd);
+    }
+};
+
+TEST_F(ReportStoreTest, ReportsAreReadInOrder) {
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, report(1).data(), report(1).size()));
+    ASSERT_TRUE(store::append(store::REPORT_ANR, report(2).data(), report(2).size()));
+    ASSERT_TRUE(store::append(store::REPORT_EXCEPTION, report(3).data(), report(3).size()));
+
+    std::vector<stored_t> reports = read_all();
+    ASSERT_EQ(3u, reports.size());
+    EXPECT_EQ(store::REPORT_CRASH, reports[0].type);
+    EXPECT_EQ(report(1), reports[0].payload);
+    EXPECT_EQ(store::REPORT_ANR, reports[1].type);
+    EXPECT_EQ(report(2), reports[1].payload);
+    EXPECT_EQ(store::REPORT_EXCEPTION, reports[2].type);
+    EXPECT_EQ(report(3), reports[2].payload);
+
+    // nothing was acknowledged, and all three share a segment
+    EXPECT_EQ(3u, read_all().size());
+    EXPECT_EQ(1u, segments().size());
+
+    EXPECT_EQ(store::REPORT_CRASH, store::type_of("crash-"));
+    EXPECT_EQ(store::REPORT_ANR, store::type_of("anr-"));
+    EXPECT_EQ(store::REPORT_TYPE_CNT, store::type_of("rec-crash-"));
+}
+
+TEST_F(ReportStoreTest, AcknowledgedReportsAreNotReadAgain) {
+    for (int i = 0; i < 6; i++) {
+        ASSERT_TRUE(store::append(store::REPORT_CRASH, report(i).data(), report(i).size()));
+    }
+
+    EXPECT_EQ(6u, read_all(true).size());
+    std::vector<stored_t> reports = read_all();
+    ASSERT_EQ(3u, reports.size());
+    EXPECT_EQ(report(1), reports[0].payload);
+    EXPECT_EQ(report(3), reports[1].payload);
+    EXPECT_EQ(report(5), reports[2].payload);
+
+    EXPECT_TRUE(store::acknowledge(reports[1].id));
+    EXPECT_FALSE(store::acknowledge(reports[1].id));
+    EXPECT_FALSE(store::acknowledge(0));
+    EXPECT_EQ(2u, read_all().size());
+
+    // acknowledgements are held in the segment, and survive a reopen
+    store::shutdown();
+    ASSERT_TRUE(store::initialize());
+    EXPECT_EQ(2u, read_all().size());
+    EXPECT_EQ(2u, store::usage(store::REPORT_CRASH).count);
+}
+
+TEST_F(ReportStoreTest, QuotasEvictTheOldestReports) {
+    store::set_quota(store::REPORT_CRASH, {1024 * 1024, 3});
+    for (int i = 0; i < 5; i++) {
+        ASSERT_TRUE(store::append(store::REPORT_CRASH, report(i).data(), report(i).size()));
+    }
+    ASSERT_TRUE(store::append(store::REPORT_ANR, report(9).data(), report(9).size()));
+
+    std::vector<stored_t> reports = read_all();
+    ASSERT_EQ(4u, reports.size());
+    EXPECT_EQ(report(2), reports[0].payload);
+    EXPECT_EQ(report(3), reports[1].payload);
+    EXPECT_EQ(report(4), reports[2].payload);
+    EXPECT_EQ(report(9), reports[3].payload);
+    EXPECT_EQ(3u, store::usage(store::REPORT_CRASH).count);
+    EXPECT_EQ(1u, store::usage(store::REPORT_ANR).count);
+
+    // a byte quota: two reports of 1K fit in 2.5K
+    store::set_quota(store::REPORT_ANR, {2560, 100});
+    for (int i = 10; i < 14; i++) {
+        ASSERT_TRUE(store::append(store::REPORT_ANR, report(i, 1024).data(), 1024));
+    }
+    store::quota_t used = store::usage(store::REPORT_ANR);
+    EXPECT_EQ(2u, used.count);
+    EXPECT_EQ(2048u, used.bytes);
+
+    // a report larger than its whole quota is not stored
+    EXPECT_FALSE(store::append(store::REPORT_ANR, report(20, 4096).data(), 4096));
+    EXPECT_EQ(2u, store::usage(store::REPORT_ANR).count);
+
+    // a zero quota is the default
+    store::set_quota(store::REPORT_ANR, {0, 0});
+    EXPECT_GT(store::get_quota(store::REPORT_ANR).count, 0u);
+    EXPECT_GT(store::get_quota(store::REPORT_ANR).bytes, 0u);
+}
+
+TEST_F(ReportStoreTest, TornReportsAreCut) {
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, report(1).data(), report(1).size()));
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, report(2).data(), report(2).size()));
+    store::shutdown();
+
+    // the process died part way through the next report: a header and some of the payload
+    std::vector<std::string> names = segments();
+    ASSERT_EQ(1u, names.size());
+    std::string segment = store_path(names[0].c_str());
+    struct stat st = {};
+    ASSERT_EQ(0, stat(segment.c_str(), &st));
+    const char torn[] = "NRRP\0\1\0\0\100\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0{\"report\":3,";
+    append_bytes(segment, torn, sizeof(torn) - 1);
+
+    ASSERT_TRUE(store::initialize());
+    std::vector<stored_t> reports = read_all();
+    ASSERT_EQ(2u, reports.size());
+    EXPECT_EQ(report(2), reports[1].payload);
+
+    struct stat cut = {};
+    ASSERT_EQ(0, stat(segment.c_str(), &cut));
+    EXPECT_EQ(st.st_size, cut.st_size);
+
+    // and the log continues from where the last complete report ends
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, report(3).data(), report(3).size()));
+    reports = read_all();
+    ASSERT_EQ(3u, reports.size());
+    EXPECT_EQ(report(3), reports[2].payload);
+}
+
+TEST_F(ReportStoreTest, DamagedReportsAreSkipped) {
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, report(1).data(), report(1).size()));
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, report(2).data(), report(2).size()));
+    store::shutdown();
+
+    // flip a payload byte of the first report
+    std::string segment = store_path(segments().at(0).c_str());
+    int fd = open(segment.c_str(), O_RDWR);
+    ASSERT_NE(-1, fd);
+    char byte = 0;
+    ASSERT_EQ(1, pread(fd, &byte, 1, 16 + 32 + 4));
+    byte ^= 0x20;
+    ASSERT_EQ(1, pwrite(fd, &byte, 1, 16 + 32 + 4));
+    close(fd);
+
+    ASSERT_TRUE(store::initialize());
+    std::vector<stored_t> reports = read_all();
+    ASSERT_EQ(1u, reports.size());
+    EXPECT_EQ(report(2), reports[0].payload);
+}
+
+TEST_F(ReportStoreTest, IndexIsRebuiltFromSegments) {
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(store::append(store::REPORT_EXCEPTION, report(i).data(), report(i).size()));
+    }
+    EXPECT_EQ(4u, read_all(true).size());
+    store::shutdown();
+
+    ASSERT_EQ(0, unlink(store_path("index").c_str()));
+    ASSERT_TRUE(store::initialize());
+    std::vector<stored_t> reports = read_all();
+    ASSERT_EQ(2u, reports.size());
+    EXPECT_EQ(report(1), reports[0].payload);
+    EXPECT_EQ(report(3), reports[1].payload);
+
+    // a damaged index is as good as none
+    store::shutdown();
+    int fd = open(store_path("index").c_str(), O_WRONLY);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(4, pwrite(fd, "XXXX", 4, 40));
+    close(fd);
+    ASSERT_TRUE(store::initialize());
+    EXPECT_EQ(2u, read_all().size());
+}
+
+TEST_F(ReportStoreTest, CompactionKeepsDiskUsageBounded) {
+    const size_t size = 16 * 1024;
+    store::set_quota(store::REPORT_CRASH, {64 * size, 64});
+
+    for (int i = 0; i < 48; i++) {
+        ASSERT_TRUE(store::append(store::REPORT_CRASH, report(i, size).data(), size));
+    }
+    size_t segment_cnt = segments().size();
+    ASSERT_GE(segment_cnt, 3u);
+
+    // deliver all but the last few: the segments they filled are dropped
+    visit_t visit = {{}, false};
+    store::for_each([](const store::report_t &report, void *arg) {
+        auto *count = static_cast<visit_t *>(arg);
+        count->reports.push_back({report.type, std::string(), report.id});
+        return count->reports.size() <= 44;
+    }, &visit);
+    EXPECT_EQ(48u, visit.reports.size());
+    EXPECT_LT(segments().size(), segment_cnt);
+
+    std::vector<stored_t> reports = read_all();
+    ASSERT_EQ(4u, reports.size());
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(report(44 + i, size), reports[i].payload);
+    }
+
+    // with a small quota, eviction keeps what is on disk close to the quota
+    store::set_quota(store::REPORT_CRASH, {8 * size, 8});
+    for (int i = 0; i < 200; i++) {
+        ASSERT_TRUE(store::append(store::REPORT_CRASH, report(i, size).data(), size));
+    }
+    size_t disk = 0;
+    for (auto &name: segments()) {
+        struct stat st = {};
+        stat(store_path(name.c_str()).c_str(), &st);
+        disk += st.st_size;
+    }
+    EXPECT_EQ(8u, store::usage(store::REPORT_CRASH).count);
+    EXPECT_LE(disk, 8 * size * 2 + store::SEGMENT_SZ + size);
+
+    reports = read_all();
+    ASSERT_EQ(8u, reports.size());
+    EXPECT_EQ(report(199, size), reports[7].payload);
+}
+
+TEST_F(ReportStoreTest, ReportsAppendedByOtherProcessesAreRead) {
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, report(1).data(), report(1).size()));
+
+    pid_t child = fork();
+    ASSERT_NE(-1, child);
+    if (child == 0) {
+        bool appended = store::append(store::REPORT_ANR, report(2).data(), report(2).size());
+        _exit(appended ? 0 : 1);
+    }
+
+    int status = 0;
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    std::vector<stored_t> reports = read_all();
+    ASSERT_EQ(2u, reports.size());
+    EXPECT_EQ(report(2), reports[1].payload);
+}
+
+TEST_F(ReportStoreTest, StoreFollowsTheReportDirectory) {
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, report(1).data(), report(1).size()));
+
+    char otherDir[PATH_MAX];
+    std::snprintf(otherDir, sizeof(otherDir), "%s/store-XXXXXX", fixtures::temp_dir());
+    ASSERT_NE(nullptr, mkdtemp(otherDir));
+    jni::native_context_t &native_context = jni::get_native_context();
+    std::strncpy(native_context.reportPathAbsolute, otherDir, sizeof(native_context.reportPathAbsolute) - 1);
+
+    EXPECT_TRUE(read_all().empty());
+    ASSERT_TRUE(store::append(store::REPORT_CRASH, report(2).data(), report(2).size()));
+    EXPECT_EQ(1u, read_all().size());
+
+    std::strncpy(native_context.reportPathAbsolute, reportDir, sizeof(native_context.reportPathAbsolute) - 1);
+    std::vector<stored_t> reports = read_all();
+    ASSERT_EQ(1u, reports.size());
+    EXPECT_EQ(report(1), reports[0].payload);
+    fixtures::remove_tree(otherDir);
+}
+
+/**
+ * Storing and flushing a backlog of reports: a file per report, against the store
+ */
+TEST_F(ReportStoreTest, FlushBenchmark) {
+    const size_t size = 4096;
+    std::vector<std::string> payloads;
+    for (int i = 0; i < BENCHMARK_REPORTS; i++) {
+        payloads.push_back(report(i, size));
+    }
+    store::set_quota(store::REPORT_CRASH, {BENCHMARK_REPORTS * size, BENCHMARK_REPORTS});
+
+    std::printf("[ BENCHMARK] flush of %d reports of %zu bytes\n", BENCHMARK_REPORTS, size);
+
+    // a file per report: list the directory, then open and read each
+    uint64_t start = fixtures::now_ns();
+    for (auto &payload: payloads) {
+        ASSERT_TRUE(serializer::to_storage("crash-", payload.data(), payload.size()));
+    }
+    uint64_t store_ns = fixtures::now_ns() - start;
+
+    start = fixtures::now_ns();
+    size_t read_cnt = 0;
+    std::vector<char> buffer(size * 2);
+    DIR *dir = opendir(reportDir);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (std::strncmp(entry->d_name, "crash-", 6) == 0) {
+            std::string path = std::string(reportDir) + "/" + entry->d_name;
+            int fd = open(path.c_str(), O_RDONLY);
+            read_cnt += (read(fd, buffer.data(), buffer.size()) > 0) ? 1 : 0;
+            close(fd);
+            unlink(path.c_str());
+        }
+    }
+    closedir(dir);
+    uint64_t flush_ns = fixtures::now_ns() - start;
+    EXPECT_EQ(static_cast<size_t>(BENCHMARK_REPORTS), read_cnt);
+
+    std::printf("[ BENCHMARK]   files: store %8.1f us/report, flush %8.1f us/report\n",
+                store_ns / 1000.0 / BENCHMARK_REPORTS, flush_ns / 1000.0 / BENCHMARK_REPORTS);
+
+    // the store: appends, then one pass over its segments
+    start = fixtures::now_ns();
+    for (auto &payload: payloads) {
+        ASSERT_TRUE(store::append(store::REPORT_CRASH, payload.data(), payload.size()));
+    }
+    store_ns = fixtures::now_ns() - start;
+
+    start = fixtures::now_ns();
+    read_cnt = store::for_each([](const store::report_t &, void *) { return true; }, nullptr);
+    flush_ns = fixtures::now_ns() - start;
+    EXPECT_EQ(static_cast<size_t>(BENCHMARK_REPORTS), read_cnt);
+
+    std::printf("[ BENCHMARK]   store: store %8.1f us/report, flush %8.1f us/report, %zu segments left\n",
+                store_ns / 1000.0 / BENCHMARK_REPORTS, flush_ns / 1000.0 / BENCHMARK_REPORTS,
+                segments().size());
+}
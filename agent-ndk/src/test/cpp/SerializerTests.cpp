@@ -0,0 +1,201 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <climits>
+#include <csignal>
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <agent-ndk.h>
+#include "jni/native-context.h"
+#include "serializer.h"
+#include "TestFixtures.h"
+#include "legacy/serializer-legacy.h"
+
+static const int BENCHMARK_ITERATIONS = 50;
+
+static const size_t REPORT_SZ = 0x10000;
+
+/**
+ * Redirects report storage to a scratch directory
+ */
+class SerializerTest : public ReportDirTest {
+protected:
+    std::string payload;
+
+    SerializerTest() : ReportDirTest("serializer") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        payload.resize(REPORT_SZ);
+        for (size_t i = 0; i < payload.size(); i++) {
+            payload[i] = static_cast<char>('a' + (i % 26));
+        }
+
+        serializer::set_sync_storage(false);
+    }
+
+    void TearDown() override {
+        serializer::set_sync_storage(false);
+        ReportDirTest::TearDown();
+    }
+
+    std::vector<std::string> reports() {
+        std::vector<std::string> names;
+        DIR *dir = opendir(reportDir);
+        if (dir != nullptr) {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                if (std::strcmp(entry->d_name, ".") != 0 && std::strcmp(entry->d_name, "..") != 0) {
+                    names.emplace_back(entry->d_name);
+                }
+            }
+            closedir(dir);
+        }
+        return names;
+    }
+
+    std::string read(const std::string &name) {
+        std::string path = std::string(reportDir) + "/" + name;
+        std::string contents;
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd != -1) {
+            char buf[4096];
+            ssize_t cnt;
+            while ((cnt = ::read(fd, buf, sizeof(buf))) > 0) {
+                contents.append(buf, cnt);
+            }
+            close(fd);
+        }
+        return contents;
+    }
+
+    void clear() {
+        for (auto &name: reports()) {
+            unlink((std::string(reportDir) + "/" + name).c_str());
+        }
+    }
+};
+
+TEST_F(SerializerTest, WritesReportWithPrefix) {
+    ASSERT_TRUE(serializer::to_storage("crash-", payload.data(), payload.size()));
+
+    auto names = reports();
+    ASSERT_EQ(1u, names.size());
+    EXPECT_EQ(0u, names[0].find("crash-"));
+    EXPECT_EQ(std::strlen("crash-") + 17, names[0].size());  // YYYYmmddHHMMSSmmm
+    EXPECT_EQ(payload, read(names[0]));
+}
+
+TEST_F(SerializerTest, WritesExactPayloadSize) {
+    ASSERT_TRUE(serializer::to_storage("ex-", payload.data(), 100));
+
+    auto names = reports();
+    ASSERT_EQ(1u, names.size());
+    EXPECT_EQ(payload.substr(0, 100), read(names[0]));
+}
+
+TEST_F(SerializerTest, ReportNamesAreUnique) {
+    serializer::set_sync_storage(true);
+    for (int i = 0; i < 8; i++) {
+        ASSERT_TRUE(serializer::to_storage("anr-", payload.data(), 64));
+    }
+
+    // no temp files are left behind, and no report was replaced
+    auto names = reports();
+    EXPECT_EQ(8u, names.size());
+    for (auto &name: names) {
+        EXPECT_NE('.', name[0]);
+    }
+}
+
+TEST_F(SerializerTest, FailsWithoutReportDirectory) {
+    jni::native_context_t &native_context = jni::get_native_context();
+    std::snprintf(native_context.reportPathAbsolute, sizeof(native_context.reportPathAbsolute),
+                  "%s/missing", reportDir);
+    EXPECT_FALSE(serializer::to_storage("crash-", payload.data(), payload.size()));
+    EXPECT_TRUE(reports().empty());
+}
+
+TEST_F(SerializerTest, SweepsTemporaryFilesLeftByAKilledProcess) {
+    ASSERT_TRUE(serializer::to_storage("crash-", payload.data(), 64));
+    const char *abandoned[] = {".crash-20240101000000000.tmp", ".rec-anr-20240101000000000-1.tmp"};
+    const char *writing = ".ex-20240101000000000.tmp";
+
+    // abandoned files were last written to long ago; one being written to now is kept
+    struct timespec times[2] = {{time(nullptr) - 3600, 0}, {time(nullptr) - 3600, 0}};
+    for (auto name: abandoned) {
+        int fd = open((std::string(reportDir) + "/" + name).c_str(), O_WRONLY | O_CREAT, 0600);
+        ASSERT_NE(-1, fd);
+        ASSERT_EQ(0, futimens(fd, times));
+        close(fd);
+    }
+    close(open((std::string(reportDir) + "/" + writing).c_str(), O_WRONLY | O_CREAT, 0600));
+
+    EXPECT_EQ(2, serializer::sweep_temporary_files());
+    auto names = reports();
+    ASSERT_EQ(2u, names.size());
+    for (auto &name: names) {
+        EXPECT_TRUE(name == writing || name.find("crash-") == 0) << name;
+    }
+}
+
+/**
+ * Signal-to-file latency: the time from raising a signal to the report being on disk,
+ * measured from within the handler as the crash path does
+ */
+static bool (*benchmark_writer)(const char *, const char *, size_t) = nullptr;
+static const std::string *benchmark_payload = nullptr;
+
+static void benchmark_handler(int) {
+    benchmark_writer("crash-", benchmark_payload->data(), benchmark_payload->size());
+}
+
+static uint64_t signal_to_file_ns(bool (*writer)(const char *, const char *, size_t),
+                                  const std::string &payload) {
+    struct sigaction action = {}, previous = {};
+    action.sa_handler = benchmark_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, &previous);
+
+    benchmark_writer = writer;
+    benchmark_payload = &payload;
+
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        raise(SIGUSR2);
+    }
+    uint64_t elapsed = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    sigaction(SIGUSR2, &previous, nullptr);
+    return elapsed;
+}
+
+TEST_F(SerializerTest, StorageLatencyBenchmark) {
+    uint64_t legacy_ns = signal_to_file_ns(legacy::to_storage, payload);
+    clear();
+    uint64_t syscall_ns = signal_to_file_ns(serializer::to_storage, payload);
+    EXPECT_EQ(static_cast<size_t>(BENCHMARK_ITERATIONS), reports().size());
+    clear();
+    serializer::set_sync_storage(true);
+    uint64_t synced_ns = signal_to_file_ns(serializer::to_storage, payload);
+    clear();
+
+    std::printf("[ BENCHMARK] signal-to-file latency (%zu byte report)\n", payload.size());
+    std::printf("[ BENCHMARK]   ofstream:          %8llu ns/report\n",
+                static_cast<unsigned long long>(legacy_ns));
+    std::printf("[ BENCHMARK]   syscalls:          %8llu ns/report\n",
+                static_cast<unsigned long long>(syscall_ns));
+    std::printf("[ BENCHMARK]   syscalls+fdatasync:%8llu ns/report\n",
+                static_cast<unsigned long long>(synced_ns));
+}
@@ -0,0 +1,120 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include "module-index.h"
+#include "stack-trie.h"
+
+static const uintptr_t UNMAPPED_PC = 0x1000;
+
+static void outer_function() {
+}
+
+static void inner_function() {
+}
+
+/**
+ * Stacks of pcs in the test binary and libc, keyed by the module index
+ */
+class StackTrieTest : public ::testing::Test {
+protected:
+    trie::trie_t trie;
+    uintptr_t outer = reinterpret_cast<uintptr_t>(&outer_function) + 4;
+    uintptr_t inner = reinterpret_cast<uintptr_t>(&inner_function) + 4;
+    uintptr_t libc = reinterpret_cast<uintptr_t>(&write) + 4;
+
+    void SetUp() override {
+        ASSERT_TRUE(modules::initialize());
+        ASSERT_NE(nullptr, modules::find(outer));
+        ASSERT_NE(nullptr, modules::find(libc));
+        trie::initialize(trie, 1024);
+    }
+
+    void TearDown() override {
+        modules::shutdown();
+    }
+
+    /**
+     * A frame as written to folded stacks
+     */
+    std::string label(uintptr_t pc) {
+        const modules::module_t *module = modules::find(pc);
+        const char *slash = std::strrchr(module->path.c_str(), '/');
+        char offset[32];
+        std::snprintf(offset, sizeof(offset), "+0x%" PRIxPTR, pc - module->start);
+        return std::string(slash != nullptr ? slash + 1 : module->path.c_str()) + offset;
+    }
+};
+
+TEST_F(StackTrieTest, SharedCallersShareNodes) {
+    uintptr_t first[] = {libc, inner, outer};
+    uintptr_t second[] = {inner, outer};
+
+    EXPECT_TRUE(trie::insert(trie, first, 3));
+    EXPECT_TRUE(trie::insert(trie, first, 3));
+    EXPECT_TRUE(trie::insert(trie, second, 2));
+
+    // the root, and a node per distinct frame
+    EXPECT_EQ(4u, trie.nodes.size());
+    EXPECT_EQ(3u, trie.samples);
+    EXPECT_EQ(0u, trie.truncated);
+
+    // the test binary and libc, after the unknown module
+    EXPECT_EQ(3u, trie.modules.size());
+}
+
+TEST_F(StackTrieTest, WritesFoldedStacks) {
+    uintptr_t first[] = {libc, inner, outer};
+    uintptr_t second[] = {inner, outer};
+    uintptr_t unknown[] = {UNMAPPED_PC, outer};
+
+    trie::insert(trie, first, 3);
+    trie::insert(trie, first, 3);
+    trie::insert(trie, second, 2);
+    trie::insert(trie, unknown, 2);
+
+    std::string folded;
+    EXPECT_EQ(3u, trie::write_folded(trie, folded));
+
+    std::string path = label(outer) + ";" + label(inner);
+    EXPECT_NE(std::string::npos, folded.find(path + ";" + label(libc) + " 2\n")) << folded;
+    EXPECT_NE(std::string::npos, folded.find(path + " 1\n")) << folded;
+    EXPECT_NE(std::string::npos, folded.find(label(outer) + ";0x1000 1\n")) << folded;
+}
+
+TEST_F(StackTrieTest, FullTrieTruncatesSamples) {
+    trie::initialize(trie, 3);
+    uintptr_t first[] = {inner, outer};
+    uintptr_t second[] = {libc, inner, outer};
+
+    EXPECT_TRUE(trie::insert(trie, first, 2));
+    EXPECT_FALSE(trie::insert(trie, second, 3));
+
+    // the sample is counted where the trie ran out
+    EXPECT_EQ(3u, trie.nodes.size());
+    EXPECT_EQ(2u, trie.samples);
+    EXPECT_EQ(1u, trie.truncated);
+
+    std::string folded;
+    trie::write_folded(trie, folded);
+    EXPECT_EQ(label(outer) + ";" + label(inner) + " 2\n", folded);
+}
+
+TEST_F(StackTrieTest, InitializeEmptiesTheTrie) {
+    uintptr_t stack[] = {inner, outer};
+    trie::insert(trie, stack, 2);
+    trie::initialize(trie, 1024);
+
+    std::string folded;
+    EXPECT_EQ(0u, trie::write_folded(trie, folded));
+    EXPECT_EQ(1u, trie.nodes.size());
+    EXPECT_EQ(0u, trie.samples);
+}
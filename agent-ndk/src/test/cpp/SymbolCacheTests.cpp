@@ -0,0 +1,331 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <agent-ndk.h>
+#include "arena.h"
+#include "jni/native-context.h"
+#include "module-index.h"
+#include "record.h"
+#include "symbol-cache.h"
+#include "TestFixtures.h"
+
+static const char *BUILD_ID = "0123456789abcdef0123456789abcdef01234567";
+static const int BENCHMARK_ITERATIONS = 50;
+
+/**
+ * Redirects report storage (and so the cache file) to a scratch directory
+ */
+class SymbolCacheTest : public ReportDirTest {
+protected:
+    SymbolCacheTest() : ReportDirTest("symcache") {}
+
+    void SetUp() override {
+        ReportDirTest::SetUp();
+        ASSERT_TRUE(symcache::initialize());
+    }
+
+    void TearDown() override {
+        symcache::shutdown();
+        ReportDirTest::TearDown();
+    }
+
+    std::string cache_file() const {
+        return std::string(reportDir) + "/.symbols/symbols.cache";
+    }
+
+    /**
+     * A header field of the cache file, by its index
+     */
+    uint32_t header_field(size_t index) const {
+        uint32_t value = 0;
+        int fd = open(cache_file().c_str(), O_RDONLY | O_CLOEXEC);
+        EXPECT_EQ(static_cast<ssize_t>(sizeof(value)), pread(fd, &value, sizeof(value), index * sizeof(value)));
+        close(fd);
+        return value;
+    }
+
+    static void reopen() {
+        symcache::shutdown();
+        ASSERT_TRUE(symcache::initialize());
+    }
+
+    static stackframe_t frame(uintptr_t pc, uintptr_t offset, const char *name) {
+        stackframe_t stackframe = {};
+        stackframe.address = 0x70000000 + pc;
+        stackframe.pc = pc;
+        stackframe.sym_addr = stackframe.address - offset;
+        stackframe.sym_addr_offset = offset;
+        std::strncpy(stackframe.sym_name, name, sizeof(stackframe.sym_name) - 1);
+        return stackframe;
+    }
+
+    static bool lookup(uintptr_t pc, stackframe_t &stackframe, const char *build_id = BUILD_ID) {
+        stackframe = {};
+        stackframe.address = 0x70000000 + pc;
+        return symcache::lookup(build_id, pc, stackframe);
+    }
+
+    /**
+     * Insert frames at pcs [first, first + cnt), in functions of 256 bytes
+     */
+    static size_t insert_range(uintptr_t first, size_t cnt) {
+        size_t inserted = 0;
+        for (uintptr_t pc = first; pc < first + cnt; pc++) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "function_%zx()", static_cast<size_t>(pc >> 8));
+            stackframe_t stackframe = frame(pc, pc & 0xff, name);
+            inserted += symcache::insert(BUILD_ID, pc, stackframe) ? 1 : 0;
+        }
+        return inserted;
+    }
+
+    static size_t count_hits(uintptr_t first, size_t cnt) {
+        size_t hits = 0;
+        stackframe_t stackframe = {};
+        for (uintptr_t pc = first; pc < first + cnt; pc++) {
+            hits += lookup(pc, stackframe) ? 1 : 0;
+        }
+        return hits;
+    }
+};
+
+TEST_F(SymbolCacheTest, NamesInsertedFrames) {
+    stackframe_t stackframe = {};
+    EXPECT_FALSE(lookup(0x1234, stackframe));
+
+    ASSERT_TRUE(symcache::insert(BUILD_ID, 0x1234, frame(0x1234, 0x34, "ns::function(int)")));
+    ASSERT_TRUE(lookup(0x1234, stackframe));
+    EXPECT_STREQ("ns::function(int)", stackframe.sym_name);
+    EXPECT_EQ(0x34u, stackframe.sym_addr_offset);
+    EXPECT_EQ(0x70001200u, stackframe.sym_addr);
+
+    // keyed by module and pc
+    EXPECT_FALSE(lookup(0x1235, stackframe));
+    EXPECT_FALSE(lookup(0x1234, stackframe, "fedcba9876543210"));
+
+    // modules without a build-id, and unnamed frames, are not cached
+    EXPECT_FALSE(symcache::insert("", 0x1234, frame(0x1234, 0x34, "ns::function(int)")));
+    EXPECT_FALSE(lookup(0x1234, stackframe, ""));
+    EXPECT_FALSE(symcache::insert(BUILD_ID, 0x2000, frame(0x2000, 0, "")));
+}
+
+TEST_F(SymbolCacheTest, PersistsAcrossLaunches) {
+    ASSERT_TRUE(symcache::insert(BUILD_ID, 0x1234, frame(0x1234, 0x34, "ns::function(int)")));
+    ASSERT_TRUE(symcache::insert_path(BUILD_ID, "/data/app/base.apk!/lib/arm64-v8a/libapp.so"));
+    uint32_t generation = header_field(4);
+
+    reopen();
+    EXPECT_EQ(generation + 1, header_field(4));
+
+    stackframe_t stackframe = {};
+    ASSERT_TRUE(lookup(0x1234, stackframe));
+    EXPECT_STREQ("ns::function(int)", stackframe.sym_name);
+
+    char path[PATH_MAX] = {};
+    ASSERT_TRUE(symcache::lookup_path(BUILD_ID, path, sizeof(path)));
+    EXPECT_STREQ("/data/app/base.apk!/lib/arm64-v8a/libapp.so", path);
+}
+
+TEST_F(SymbolCacheTest, InternsFunctionNames) {
+    const char *name = "a_rather_long_function_name_shared_by_every_frame(int, char const*)";
+    uint32_t names_used = header_field(6);
+
+    for (uintptr_t offset = 0; offset < 64; offset++) {
+        ASSERT_TRUE(symcache::insert(BUILD_ID, 0x4000 + offset, frame(0x4000 + offset, offset, name)));
+    }
+    EXPECT_EQ(names_used + std::strlen(name) + 1, header_field(6));
+
+    stackframe_t stackframe = {};
+    ASSERT_TRUE(lookup(0x4020, stackframe));
+    EXPECT_STREQ(name, stackframe.sym_name);
+    EXPECT_EQ(0x20u, stackframe.sym_addr_offset);
+}
+
+TEST_F(SymbolCacheTest, RefusesInsertsWhenFull) {
+    size_t inserted = insert_range(0, 8192);
+    EXPECT_LT(inserted, 8192u);
+    EXPECT_GT(inserted, 4096u);
+
+    // everything inserted stays readable
+    EXPECT_EQ(inserted, count_hits(0, 8192));
+}
+
+TEST_F(SymbolCacheTest, CompactionKeepsRecentlyUsedFrames) {
+    ASSERT_EQ(3000u, insert_range(0, 3000));
+    reopen();
+
+    // a later launch uses a few of those, and adds more
+    EXPECT_EQ(100u, count_hits(0, 100));
+    ASSERT_EQ(1500u, insert_range(0x100000, 1500));
+    ASSERT_TRUE(symcache::insert_path(BUILD_ID, "/system/lib64/libapp.so"));
+    reopen();
+
+    EXPECT_EQ(1500u, count_hits(0x100000, 1500));
+    EXPECT_EQ(100u, count_hits(0, 100));
+    size_t survivors = count_hits(100, 2900);
+    EXPECT_LT(survivors, 2900u);
+    EXPECT_LT(header_field(5), 8192u / 4 + 64);
+
+    char path[PATH_MAX] = {};
+    EXPECT_TRUE(symcache::lookup_path(BUILD_ID, path, sizeof(path)));
+}
+
+TEST_F(SymbolCacheTest, ResetsDamagedCaches) {
+    ASSERT_TRUE(symcache::insert(BUILD_ID, 0x1234, frame(0x1234, 0x34, "ns::function(int)")));
+    symcache::shutdown();
+
+    int fd = open(cache_file().c_str(), O_RDWR | O_CLOEXEC);
+    ASSERT_NE(-1, fd);
+    std::vector<char> garbage(4096, '\x5a');
+    ASSERT_EQ(static_cast<ssize_t>(garbage.size()), pwrite(fd, garbage.data(), garbage.size(), 0));
+    close(fd);
+
+    ASSERT_TRUE(symcache::initialize());
+    stackframe_t stackframe = {};
+    EXPECT_FALSE(lookup(0x1234, stackframe));
+    EXPECT_TRUE(symcache::insert(BUILD_ID, 0x1234, frame(0x1234, 0x34, "ns::function(int)")));
+    EXPECT_TRUE(lookup(0x1234, stackframe));
+}
+
+TEST_F(SymbolCacheTest, ConcurrentInsertsAndLookups) {
+    const size_t per_thread = 512;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> bad_names(0);
+
+    for (size_t t = 0; t < 4; t++) {
+        threads.emplace_back([t, per_thread]() {
+            insert_range(t * per_thread, per_thread);
+        });
+        threads.emplace_back([t, per_thread, &bad_names]() {
+            stackframe_t stackframe = {};
+            for (int pass = 0; pass < 4; pass++) {
+                for (uintptr_t pc = t * per_thread; pc < (t + 1) * per_thread; pc++) {
+                    char name[32];
+                    std::snprintf(name, sizeof(name), "function_%zx()", static_cast<size_t>(pc >> 8));
+                    if (lookup(pc, stackframe) && std::strcmp(name, stackframe.sym_name) != 0) {
+                        bad_names++;
+                    }
+                }
+            }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(0u, bad_names.load());
+    EXPECT_EQ(4 * per_thread, count_hits(0, 4 * per_thread));
+}
+
+TEST_F(SymbolCacheTest, ModuleIndexResolvesThroughCache) {
+    ASSERT_TRUE(modules::initialize());
+    uintptr_t address = reinterpret_cast<uintptr_t>(&write) + 4;
+    const modules::module_t *module = modules::find(address);
+    ASSERT_NE(nullptr, module);
+    if (*module->build_id == '\0') {
+        modules::shutdown();
+        GTEST_SKIP() << module->path << " was linked without a build-id";
+    }
+
+    stackframe_t resolved = {};
+    ASSERT_TRUE(modules::resolve(0, address, resolved));
+    ASSERT_NE('\0', resolved.sym_name[0]);
+
+    stackframe_t cached = {};
+    cached.address = address;
+    ASSERT_TRUE(symcache::lookup(module->build_id, address - module->start, cached));
+    EXPECT_STREQ(resolved.sym_name, cached.sym_name);
+    EXPECT_EQ(resolved.sym_addr, cached.sym_addr);
+
+    // a hit resolves the frame as a miss did
+    stackframe_t hit = {};
+    ASSERT_TRUE(modules::resolve(0, address, hit));
+    EXPECT_STREQ(resolved.sym_name, hit.sym_name);
+    EXPECT_STREQ(resolved.so_path, hit.so_path);
+    EXPECT_EQ(resolved.so_base, hit.so_base);
+    EXPECT_EQ(resolved.pc, hit.pc);
+    EXPECT_EQ(resolved.sym_addr_offset, hit.sym_addr_offset);
+
+    modules::shutdown();
+}
+
+TEST_F(SymbolCacheTest, RenderBenchmark) {
+    ASSERT_TRUE(modules::initialize());
+    ASSERT_TRUE(arena::initialize(BACKTRACE_ARENA_SZ_MAX));
+
+    // frames in libc, the C++ runtime and this binary
+    backtrace_t backtrace = {};
+    threadinfo_t thread = {};
+    siginfo_t siginfo = {};
+    ucontext_t ucontext = {};
+    backtrace.state.sa_ucontext = &ucontext;
+    backtrace.state.siginfo = &siginfo;
+    std::strncpy(backtrace.arch, get_arch(), sizeof(backtrace.arch) - 1);
+    backtrace.pid = getpid();
+    backtrace.threads = &thread;
+    backtrace.thread_cnt = 1;
+    thread.crashed = true;
+    thread.backtrace_state = &backtrace.state;
+    const uintptr_t functions[] = {
+            reinterpret_cast<uintptr_t>(&write),
+            reinterpret_cast<uintptr_t>(&getpid),
+            reinterpret_cast<uintptr_t>(&std::terminate),
+            reinterpret_cast<uintptr_t>(&symcache::lookup),
+    };
+    for (size_t i = 0; i < 32; i++) {
+        backtrace.state.frames[backtrace.state.frame_cnt++] = functions[i % 4] + 4 + (i / 4);
+    }
+
+    std::vector<char> record(BACKTRACE_SZ_MAX);
+    ASSERT_TRUE(arena::acquire());
+    size_t size = record::encode(backtrace, record.data(), record.size());
+    arena::release();
+    arena::shutdown();
+    ASSERT_GT(size, 0u);
+
+    auto render = [&]() {
+        std::string report = render_record(record.data(), size);
+        EXPECT_FALSE(report.empty());
+        return report;
+    };
+
+    symcache::shutdown();
+    uint64_t start = fixtures::now_ns();
+    std::string uncached;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        uncached = render();
+    }
+    uint64_t uncached_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    ASSERT_TRUE(symcache::initialize());
+    std::string first = render();
+    start = fixtures::now_ns();
+    std::string cached;
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        cached = render();
+    }
+    uint64_t cached_ns = (fixtures::now_ns() - start) / BENCHMARK_ITERATIONS;
+
+    // the cache changes nothing rendered
+    EXPECT_EQ(uncached, first);
+    EXPECT_EQ(uncached, cached);
+
+    std::printf("[ BENCHMARK] pending record rendering, read to stored (%zu frames)\n", backtrace.state.frame_cnt);
+    std::printf("[ BENCHMARK]   symbolized: %10llu ns/record\n", static_cast<unsigned long long>(uncached_ns));
+    std::printf("[ BENCHMARK]   cached:     %10llu ns/record\n", static_cast<unsigned long long>(cached_ns));
+
+    modules::shutdown();
+}
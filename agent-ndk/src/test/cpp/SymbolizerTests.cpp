@@ -0,0 +1,400 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <agent-ndk.h>
+#include "module-index.h"
+#include "symbolizer.h"
+#include "xz-decoder.h"
+#include "TestFixtures.h"
+
+/**
+ * `xz --check=crc64` of payload()
+ */
+static const uint8_t COMPRESSED_PAYLOAD[] = {
+        0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6, 0xd6, 0xb4, 0x46,
+        0x04, 0xc0, 0x8a, 0x03, 0xe8, 0x13, 0x21, 0x01, 0x16, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x7e, 0x46, 0xc5, 0x24, 0xe0, 0x09, 0xe7, 0x01,
+        0x82, 0x5d, 0x00, 0x33, 0x1c, 0x88, 0x46, 0x80, 0x9c, 0xf3, 0x60, 0x38,
+        0x8f, 0x3b, 0x83, 0x50, 0x34, 0xe2, 0xf7, 0xc8, 0x22, 0x20, 0x8d, 0x24,
+        0x91, 0xad, 0x73, 0xd2, 0x38, 0x1f, 0x9f, 0x04, 0x9a, 0x3a, 0x40, 0x97,
+        0x03, 0x1d, 0x82, 0x74, 0xdb, 0x52, 0x03, 0x6b, 0x6a, 0x09, 0x5f, 0xe2,
+        0xd0, 0x3f, 0x93, 0x7b, 0x21, 0xb3, 0x02, 0xcc, 0x0c, 0xb0, 0x43, 0xf3,
+        0x3e, 0x8e, 0x00, 0xc4, 0x1c, 0x1b, 0xd2, 0xd5, 0x7d, 0xad, 0x7b, 0xcd,
+        0x12, 0xb7, 0xdc, 0xf7, 0x89, 0x5a, 0x16, 0x34, 0x4e, 0x60, 0xb2, 0xf1,
+        0x94, 0x4c, 0x34, 0x32, 0x1f, 0x31, 0x1b, 0x91, 0x51, 0x3d, 0xd9, 0xd9,
+        0xfb, 0x67, 0xe5, 0x77, 0xd4, 0x94, 0x52, 0xb1, 0x5d, 0x43, 0xc1, 0x0b,
+        0xb8, 0xb0, 0x2f, 0x8f, 0x64, 0xc3, 0x96, 0x8b, 0xb9, 0x26, 0x10, 0x3f,
+        0xf7, 0x44, 0xee, 0x33, 0x80, 0xfc, 0xe1, 0xc9, 0xb9, 0xc6, 0x73, 0x87,
+        0x97, 0x56, 0x1c, 0x15, 0x45, 0x7f, 0x48, 0x5e, 0xba, 0xa4, 0x24, 0x4f,
+        0x24, 0x2d, 0x9f, 0x48, 0xdf, 0x54, 0xf9, 0x72, 0xd7, 0xa6, 0x0a, 0x7a,
+        0xad, 0xc3, 0xdb, 0xc2, 0x23, 0x1c, 0x6b, 0x55, 0x30, 0x4a, 0x74, 0x02,
+        0x7c, 0xa8, 0x0b, 0xc1, 0x38, 0x58, 0x7a, 0xa5, 0x37, 0x85, 0xb5, 0x8f,
+        0x2f, 0xc1, 0x78, 0x65, 0xfb, 0xa6, 0x5c, 0xc8, 0x5d, 0xc1, 0xb9, 0xfb,
+        0x45, 0x52, 0x3e, 0x27, 0x3a, 0xa7, 0xc2, 0x3c, 0xaa, 0xd7, 0x63, 0x14,
+        0x44, 0x0c, 0x6e, 0x14, 0xe9, 0xb2, 0xe9, 0xea, 0xd7, 0xf3, 0xf0, 0x35,
+        0x17, 0x68, 0xad, 0x45, 0xb4, 0xc0, 0x0f, 0x45, 0x91, 0xf3, 0x8a, 0x1e,
+        0x49, 0xa1, 0x65, 0xee, 0xdf, 0xe3, 0x19, 0xeb, 0xca, 0x52, 0x08, 0x44,
+        0x2b, 0x97, 0xd5, 0xdb, 0xd3, 0x81, 0x4d, 0xdf, 0xd5, 0x5b, 0xd4, 0xc1,
+        0x67, 0xa7, 0x79, 0x64, 0x95, 0x51, 0xe5, 0xbc, 0x69, 0x7b, 0xf0, 0x49,
+        0x10, 0xba, 0xb4, 0x86, 0x9f, 0x2b, 0xe9, 0xc9, 0xd6, 0xd3, 0x69, 0xbd,
+        0x07, 0xae, 0x49, 0x20, 0x56, 0x88, 0x8f, 0xc2, 0xbf, 0x98, 0x49, 0x8d,
+        0xc1, 0x90, 0x29, 0xa5, 0xfb, 0xcf, 0x90, 0xc9, 0x96, 0x0c, 0x66, 0x6d,
+        0x95, 0xf9, 0xe7, 0x56, 0x30, 0xe8, 0x39, 0x5e, 0xae, 0x8e, 0xcd, 0x80,
+        0xc8, 0xcc, 0x48, 0x06, 0x28, 0x1c, 0x14, 0x7f, 0x6f, 0x64, 0x72, 0x43,
+        0x9a, 0x4e, 0xf1, 0x72, 0xc8, 0xea, 0x87, 0x32, 0x44, 0xaf, 0x9a, 0xcc,
+        0xc5, 0x51, 0x49, 0xe1, 0x56, 0xa8, 0x24, 0x61, 0xf5, 0xef, 0x20, 0x6e,
+        0x64, 0x1e, 0x13, 0x55, 0x8f, 0xbc, 0x36, 0xe0, 0xc6, 0x54, 0x4d, 0x20,
+        0x32, 0x89, 0xa9, 0x42, 0x1a, 0x60, 0x29, 0x15, 0x68, 0x1c, 0x25, 0x04,
+        0x19, 0xe6, 0x9d, 0xbb, 0x96, 0xa8, 0xed, 0xfc, 0xfa, 0x6e, 0xf3, 0x31,
+        0x19, 0x65, 0xf5, 0x93, 0x4c, 0x00, 0x00, 0x00, 0xd6, 0xf2, 0x89, 0x29,
+        0x83, 0xf5, 0xa4, 0x57, 0x00, 0x01, 0xa6, 0x03, 0xe8, 0x13, 0x00, 0x00,
+        0x00, 0x28, 0x1b, 0x46, 0xb1, 0xc4, 0x67, 0xfb, 0x02, 0x00, 0x00, 0x00,
+        0x00, 0x04, 0x59, 0x5a,
+};
+
+static const uintptr_t IMAGE_BASE = 0x70000000;
+
+static std::string payload() {
+    std::string text;
+    char line[64];
+    for (int i = 0; i < 128; i++) {
+        std::snprintf(line, sizeof(line), "frame %d: symbol_%d\n", i, i * 7 % 31);
+        text.append(line);
+    }
+    return text;
+}
+
+/**
+ * A function only the test binary's .symtab can name
+ */
+__attribute__((noinline)) static int symbolizer_local_function(int value) {
+    return value * 3 + 1;
+}
+
+/**
+ * Wrap data in an .xz stream of stored LZMA2 chunks
+ */
+static std::vector<uint8_t> xz_stored(const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> stream = {0xfd, '7', 'z', 'X', 'Z', 0x00, 0x00, 0x00, 0, 0, 0, 0};
+
+    // block header: one LZMA2 filter, padded, then its (unchecked) CRC32
+    const uint8_t header[] = {0x02, 0x00, 0x21, 0x01, 0x16, 0x00, 0x00, 0x00, 0, 0, 0, 0};
+    stream.insert(stream.end(), header, header + sizeof(header));
+
+    for (size_t pos = 0; pos < data.size(); pos += 0x10000) {
+        size_t size = std::min(data.size() - pos, static_cast<size_t>(0x10000));
+        stream.push_back(pos == 0 ? 0x01 : 0x02);
+        stream.push_back(static_cast<uint8_t>((size - 1) >> 8));
+        stream.push_back(static_cast<uint8_t>(size - 1));
+        stream.insert(stream.end(), data.begin() + pos, data.begin() + pos + size);
+    }
+    stream.push_back(0x00);
+    while (stream.size() % 4 != 0) {
+        stream.push_back(0x00);
+    }
+
+    // the index indicator ends the blocks
+    stream.push_back(0x00);
+    return stream;
+}
+
+/**
+ * Assemble an ELF image of this ABI from sections
+ */
+class ElfBuilder {
+public:
+    typedef struct section {
+        std::string name;
+        ElfW(Word) type;
+        ElfW(Word) link;
+        ElfW(Xword) entsize;
+        std::vector<uint8_t> data;
+
+    } section_t;
+
+    std::vector<section_t> sections;
+
+    size_t add(const char *name, ElfW(Word) type, std::vector<uint8_t> data, ElfW(Word) link = 0,
+               ElfW(Xword) entsize = 0) {
+        sections.push_back({name, type, link, entsize, std::move(data)});
+        return sections.size();     // section 0 is the null section
+    }
+
+    /**
+     * A symbol table and its string table
+     */
+    size_t add_symbols(const char *name, ElfW(Word) type, const char *strings_name,
+                       const std::vector<std::pair<std::string, ElfW(Sym)>> &symbols) {
+        std::vector<uint8_t> strings(1, 0);
+        std::vector<uint8_t> table(sizeof(ElfW(Sym)), 0);
+        for (auto &symbol: symbols) {
+            ElfW(Sym) sym = symbol.second;
+            sym.st_name = static_cast<ElfW(Word)>(strings.size());
+            strings.insert(strings.end(), symbol.first.begin(), symbol.first.end());
+            strings.push_back(0);
+            const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&sym);
+            table.insert(table.end(), bytes, bytes + sizeof(sym));
+        }
+        size_t strtab = add(strings_name, SHT_STRTAB, strings);
+        return add(name, type, table, static_cast<ElfW(Word)>(strtab), sizeof(ElfW(Sym)));
+    }
+
+    std::vector<uint8_t> build() const {
+        std::vector<uint8_t> image(sizeof(ElfW(Ehdr)) + sizeof(ElfW(Phdr)), 0);
+
+        std::vector<uint8_t> names(1, 0);
+        std::vector<ElfW(Shdr)> shdrs(1);
+        for (auto &section: sections) {
+            while (image.size() % 8 != 0) {
+                image.push_back(0);
+            }
+            ElfW(Shdr) shdr = {};
+            shdr.sh_name = static_cast<ElfW(Word)>(names.size());
+            shdr.sh_type = section.type;
+            shdr.sh_link = section.link;
+            shdr.sh_entsize = section.entsize;
+            shdr.sh_offset = image.size();
+            shdr.sh_size = section.data.size();
+            shdrs.push_back(shdr);
+            names.insert(names.end(), section.name.begin(), section.name.end());
+            names.push_back(0);
+            image.insert(image.end(), section.data.begin(), section.data.end());
+        }
+
+        // the section name table comes last
+        ElfW(Shdr) shstrtab = {};
+        shstrtab.sh_name = static_cast<ElfW(Word)>(names.size());
+        shstrtab.sh_type = SHT_STRTAB;
+        shstrtab.sh_offset = image.size();
+        const char shstrtab_name[] = ".shstrtab";
+        names.insert(names.end(), shstrtab_name, shstrtab_name + sizeof(shstrtab_name));
+        shstrtab.sh_size = names.size();
+        shdrs.push_back(shstrtab);
+        image.insert(image.end(), names.begin(), names.end());
+        while (image.size() % 8 != 0) {
+            image.push_back(0);
+        }
+
+        ElfW(Ehdr) ehdr = {};
+        std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+#if defined(__LP64__)
+        ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+#else
+        ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+#endif
+        ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+        ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+        ehdr.e_type = ET_DYN;
+        ehdr.e_version = EV_CURRENT;
+        ehdr.e_ehsize = sizeof(ElfW(Ehdr));
+        ehdr.e_phoff = sizeof(ElfW(Ehdr));
+        ehdr.e_phentsize = sizeof(ElfW(Phdr));
+        ehdr.e_phnum = 1;
+        ehdr.e_shoff = image.size();
+        ehdr.e_shentsize = sizeof(ElfW(Shdr));
+        ehdr.e_shnum = static_cast<ElfW(Half)>(shdrs.size());
+        ehdr.e_shstrndx = static_cast<ElfW(Half)>(shdrs.size() - 1);
+
+        ElfW(Phdr) phdr = {};
+        phdr.p_type = PT_LOAD;
+        phdr.p_flags = PF_R | PF_X;
+        phdr.p_filesz = image.size();
+        phdr.p_memsz = 0x10000;
+        phdr.p_align = 0x1000;
+
+        std::memcpy(&image[0], &ehdr, sizeof(ehdr));
+        std::memcpy(&image[sizeof(ehdr)], &phdr, sizeof(phdr));
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(shdrs.data());
+        image.insert(image.end(), bytes, bytes + shdrs.size() * sizeof(ElfW(Shdr)));
+        return image;
+    }
+};
+
+static ElfW(Sym) function_symbol(uintptr_t value, size_t size, unsigned char bind) {
+    ElfW(Sym) sym = {};
+    sym.st_value = value;
+    sym.st_size = size;
+    sym.st_info = static_cast<unsigned char>((bind << 4) | STT_FUNC);
+    sym.st_shndx = 1;
+    return sym;
+}
+
+class SymbolizerTest : public ::testing::Test {
+protected:
+    char path[PATH_MAX] = {};
+
+    /**
+     * A stripped library: exported functions in .dynsym, the rest in its MiniDebugInfo
+     */
+    void SetUp() override {
+        ElfBuilder mini_debug_info;
+        mini_debug_info.add_symbols(".symtab", SHT_SYMTAB, ".strtab", {
+                {"_ZL14local_functionv", function_symbol(0x1100, 0x40, STB_LOCAL)},
+                {"_ZN12_GLOBAL__N_16helperEv", function_symbol(0x1200, 0, STB_LOCAL)},
+        });
+
+        const uint8_t note[] = {4, 0, 0, 0, 4, 0, 0, 0, NT_GNU_BUILD_ID, 0, 0, 0, 'G', 'N', 'U', 0,
+                                0xde, 0xad, 0xbe, 0xef};
+        ElfBuilder library;
+        library.add(".note.gnu.build-id", SHT_NOTE, std::vector<uint8_t>(note, note + sizeof(note)));
+        library.add_symbols(".dynsym", SHT_DYNSYM, ".dynstr", {
+                {"exported_function", function_symbol(0x1000, 0x20, STB_GLOBAL)},
+        });
+        library.add(".gnu_debugdata", SHT_PROGBITS, xz_stored(mini_debug_info.build()));
+
+        std::snprintf(path, sizeof(path), "%s/symbolizer-XXXXXX", fixtures::temp_dir());
+        int fd = mkstemp(path);
+        ASSERT_NE(-1, fd);
+        std::vector<uint8_t> image = library.build();
+        ASSERT_EQ(static_cast<ssize_t>(image.size()), write(fd, image.data(), image.size()));
+        close(fd);
+    }
+
+    void TearDown() override {
+        symbolizer::release_functions();
+        unlink(path);
+    }
+
+    static std::string function_name(const symbolizer::function_index_t &index, uintptr_t vaddr) {
+        const symbolizer::function_t *function = symbolizer::lookup(index, vaddr);
+        return (function != nullptr) ? index.names.c_str() + function->name : "";
+    }
+};
+
+TEST(XzDecoderTest, DecodesCompressedStream) {
+    std::string expected = payload();
+    std::vector<uint8_t> out;
+    ASSERT_TRUE(xz::decode(COMPRESSED_PAYLOAD, sizeof(COMPRESSED_PAYLOAD), 1 << 20, out));
+    EXPECT_EQ(expected, std::string(out.begin(), out.end()));
+
+    // a stream decoding to more than allowed
+    EXPECT_FALSE(xz::decode(COMPRESSED_PAYLOAD, sizeof(COMPRESSED_PAYLOAD), expected.size() - 1, out));
+}
+
+TEST(XzDecoderTest, DecodesStoredChunks) {
+    std::vector<uint8_t> data(0x18000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<uint8_t>(i * 31 + (i >> 8));
+    }
+
+    std::vector<uint8_t> stream = xz_stored(data);
+    std::vector<uint8_t> out;
+    ASSERT_TRUE(xz::decode(stream.data(), stream.size(), data.size(), out));
+    EXPECT_EQ(data, out);
+}
+
+TEST(XzDecoderTest, RejectsDamagedStreams) {
+    // decoding ends at the index indicator: the index and the stream footer aren't read
+    const uint8_t *footer = COMPRESSED_PAYLOAD + sizeof(COMPRESSED_PAYLOAD) - 12;
+    uint32_t backward_size = footer[4] | (footer[5] << 8) | (footer[6] << 16) | (static_cast<uint32_t>(footer[7]) << 24);
+    size_t blocks_end = sizeof(COMPRESSED_PAYLOAD) - 12 - (backward_size + 1) * 4 + 1;
+
+    std::vector<uint8_t> out;
+    for (size_t size = 0; size < blocks_end; size++) {
+        EXPECT_FALSE(xz::decode(COMPRESSED_PAYLOAD, size, 1 << 20, out)) << size;
+    }
+
+    std::vector<uint8_t> stream(COMPRESSED_PAYLOAD, COMPRESSED_PAYLOAD + sizeof(COMPRESSED_PAYLOAD));
+    stream[0] = 0;
+    EXPECT_FALSE(xz::decode(stream.data(), stream.size(), 1 << 20, out));
+
+    // an unsupported filter chain
+    stream.assign(COMPRESSED_PAYLOAD, COMPRESSED_PAYLOAD + sizeof(COMPRESSED_PAYLOAD));
+    stream[13] |= 0x01;
+    EXPECT_FALSE(xz::decode(stream.data(), stream.size(), 1 << 20, out));
+
+    // corrupt compressed data must fail or decode to something, never read out of bounds
+    for (size_t i = 24; i < stream.size(); i += 7) {
+        stream.assign(COMPRESSED_PAYLOAD, COMPRESSED_PAYLOAD + sizeof(COMPRESSED_PAYLOAD));
+        stream[i] ^= 0x5a;
+        xz::decode(stream.data(), stream.size(), 1 << 20, out);
+    }
+}
+
+TEST_F(SymbolizerTest, IndexesDynamicAndMiniDebugInfoSymbols) {
+    const symbolizer::function_index_t *index = symbolizer::load_functions(path, 0, "deadbeef");
+    ASSERT_NE(nullptr, index);
+    EXPECT_EQ(3u, index->functions.size());
+
+    EXPECT_EQ("exported_function", function_name(*index, 0x1010));
+    EXPECT_EQ("_ZL14local_functionv", function_name(*index, 0x1100));
+    EXPECT_EQ("_ZL14local_functionv", function_name(*index, 0x113f));
+    EXPECT_EQ("_ZN12_GLOBAL__N_16helperEv", function_name(*index, 0x1280));
+    EXPECT_EQ("", function_name(*index, 0x0ff0));
+    EXPECT_EQ("", function_name(*index, 0x1020));
+    EXPECT_EQ("", function_name(*index, 0x1140));
+
+    // built once, then found by build-id
+    EXPECT_EQ(index, symbolizer::load_functions(path, 0, "deadbeef"));
+    EXPECT_EQ(index, symbolizer::find_functions("elsewhere", "deadbeef"));
+}
+
+TEST_F(SymbolizerTest, RejectsImagesOfOtherBuilds) {
+    EXPECT_EQ(nullptr, symbolizer::load_functions(path, 0, "0123456789abcdef"));
+    EXPECT_EQ(nullptr, symbolizer::find_functions(path, "0123456789abcdef"));
+
+    // without a build-id to match, the image is indexed by path
+    EXPECT_NE(nullptr, symbolizer::load_functions(path, 0, ""));
+    EXPECT_NE(nullptr, symbolizer::find_functions(path, nullptr));
+}
+
+TEST_F(SymbolizerTest, ResolvesFramesDladdrCannotName) {
+    symbolizer::elf_image_t image;
+    ASSERT_TRUE(symbolizer::load(path, 0, "deadbeef", image));
+    ASSERT_NE(nullptr, image.functions);
+
+    stackframe_t stackframe = {};
+    symbolizer::resolve(image, IMAGE_BASE, 0, IMAGE_BASE + 0x1124, stackframe);
+    EXPECT_STREQ("local_function()", stackframe.sym_name);
+    EXPECT_EQ(IMAGE_BASE + 0x1100, stackframe.sym_addr);
+    EXPECT_EQ(0x24u, stackframe.sym_addr_offset);
+
+    // exported functions are still named from .dynsym
+    stackframe = {};
+    symbolizer::resolve(image, IMAGE_BASE, 1, IMAGE_BASE + 0x1004, stackframe);
+    EXPECT_STREQ("exported_function", stackframe.sym_name);
+
+    stackframe = {};
+    symbolizer::resolve(image, IMAGE_BASE, 2, IMAGE_BASE + 0x1204, stackframe);
+    EXPECT_STREQ("(anonymous namespace)::helper()", stackframe.sym_name);
+}
+
+TEST_F(SymbolizerTest, NamesLocalFunctionsInProcess) {
+    ASSERT_TRUE(modules::initialize());
+    uintptr_t address = reinterpret_cast<uintptr_t>(&symbolizer_local_function) + 4;
+
+    Dl_info info = {};
+    if (symbolizer_local_function(1) != 4 || !dladdr(reinterpret_cast<void *>(address), &info) ||
+        (info.dli_sname != nullptr && info.dli_saddr == reinterpret_cast<void *>(&symbolizer_local_function))) {
+        modules::shutdown();
+        GTEST_SKIP() << "dladdr() names the function";
+    }
+
+    stackframe_t stackframe = {};
+    ASSERT_TRUE(modules::resolve(0, address, stackframe));
+    EXPECT_STRNE("symbolizer_local_function(int)", stackframe.sym_name);
+
+    if (modules::load_symbols(&address, 1) == 0) {
+        modules::shutdown();
+        GTEST_SKIP() << "the test binary has no .symtab";
+    }
+    stackframe = {};
+    ASSERT_TRUE(modules::resolve(0, address, stackframe));
+    EXPECT_STREQ("symbolizer_local_function(int)", stackframe.sym_name);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(&symbolizer_local_function), stackframe.sym_addr);
+    EXPECT_EQ(4u, stackframe.sym_addr_offset);
+
+    modules::shutdown();
+}
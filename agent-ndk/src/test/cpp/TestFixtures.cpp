@@ -18,3 +18,121 @@ using ::testing::Bool;
 using ::testing::Values;
 using ::testing::Combine;
 using ::testing::UnitTest;
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <dirent.h>
+#include <unistd.h>
+#include "lz-codec.h"
+#include "record.h"
+#include "report-store.h"
+#include "serializer.h"
+#include "jni/native-context.h"
+#include "TestFixtures.h"
+
+/**
+ * Count heap allocations made through operator new, so tests and benchmarks
+ * can assert on (and report) the allocation behaviour of the code under test.
+ */
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t size) {
+    allocations++;
+    void *ptr = std::malloc(size != 0 ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace fixtures {
+
+    size_t allocation_count() {
+        return allocations.load();
+    }
+
+    static bool collect_report(const store::report_t &report, void *arg) {
+        auto *reports = static_cast<std::vector<std::string> *>(arg);
+        std::string decompressed(lz::frame_size(report.data, report.size), '\0');
+        if (lz::decompress(report.data, report.size, &decompressed[0], decompressed.size())) {
+            reports->push_back(decompressed);
+        } else {
+            reports->emplace_back(report.data, report.size);
+        }
+        return false;
+    }
+
+    std::vector<std::string> stored_reports() {
+        std::vector<std::string> reports;
+        store::for_each(collect_report, &reports);
+        return reports;
+    }
+
+    void remove_tree(const char *path) {
+        DIR *dir = opendir(path);
+        if (dir != nullptr) {
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                std::string name = entry->d_name;
+                if (name == "." || name == "..") {
+                    continue;
+                }
+                if (entry->d_type == DT_DIR) {
+                    remove_tree((std::string(path) + "/" + name).c_str());
+                } else {
+                    unlink((std::string(path) + "/" + name).c_str());
+                }
+            }
+            closedir(dir);
+        }
+        rmdir(path);
+    }
+
+}   // namespace fixtures
+
+void ReportDirTest::SetUp() {
+    jni::native_context_t &native_context = jni::get_native_context();
+    std::strncpy(savedPath, native_context.reportPathAbsolute, sizeof(savedPath) - 1);
+
+    std::snprintf(reportDir, sizeof(reportDir), "%s/%s-XXXXXX", fixtures::temp_dir(), name);
+    ASSERT_NE(nullptr, mkdtemp(reportDir));
+    std::strncpy(native_context.reportPathAbsolute, reportDir,
+                 sizeof(native_context.reportPathAbsolute) - 1);
+}
+
+void ReportDirTest::TearDown() {
+    fixtures::remove_tree(reportDir);
+    std::strncpy(jni::get_native_context().reportPathAbsolute, savedPath,
+                 sizeof(jni::get_native_context().reportPathAbsolute) - 1);
+}
+
+std::string ReportDirTest::render_record(const char *record, size_t size) {
+    if (!serializer::to_storage("rec-crash-", record, size) || record::render_pending() != 1) {
+        return "";
+    }
+    std::vector<std::string> reports = fixtures::stored_reports();
+    return reports.empty() ? "" : reports.back();
+}
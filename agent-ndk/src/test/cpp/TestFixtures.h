@@ -0,0 +1,91 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_TEST_FIXTURES_H
+#define _AGENT_NDK_TEST_FIXTURES_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+namespace fixtures {
+
+    /**
+     * Number of global operator new calls made by this process so far
+     */
+    size_t allocation_count();
+
+    /**
+     * Writable scratch directory on both host and device
+     */
+    inline const char *temp_dir() {
+        const char *tmpdir = getenv("TMPDIR");
+        if (tmpdir != nullptr && *tmpdir != '\0') {
+            return tmpdir;
+        }
+#if defined(__ANDROID__)
+        return "/data/local/tmp";
+#else
+        return "/tmp";
+#endif
+    }
+
+    /**
+     * Monotonic clock, in nanoseconds
+     */
+    inline uint64_t now_ns() {
+        struct timespec ts = {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+    }
+
+    /**
+     * Reports held in the report store, decompressed, oldest first. They are left in the store.
+     */
+    std::vector<std::string> stored_reports();
+
+    /**
+     * Remove a directory, and everything in it
+     */
+    void remove_tree(const char *path);
+
+}   // namespace fixtures
+
+/**
+ * A suite whose reports are stored in a scratch directory, made the report path for each test
+ * and removed after it. Suites overriding SetUp() and TearDown() call these first, and last.
+ */
+class ReportDirTest : public ::testing::Test {
+protected:
+    char reportDir[PATH_MAX] = {};
+
+    /**
+     * @param name prefix of the scratch directory's name
+     */
+    explicit ReportDirTest(const char *name) : name(name) {}
+
+    void SetUp() override;
+
+    void TearDown() override;
+
+    /**
+     * Render an encoded record as the next launch would: written to the report directory,
+     * rendered with the pending records, and read back from the report store
+     *
+     * @return the stored report, or empty if the record was not rendered
+     */
+    std::string render_record(const char *record, size_t size);
+
+private:
+    const char *name;
+    char savedPath[PATH_MAX] = {};
+};
+
+#endif // _AGENT_NDK_TEST_FIXTURES_H
@@ -0,0 +1,251 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "arena.h"
+#include "backtrace.h"
+#include "thread-stacks.h"
+#include "TestFixtures.h"
+
+static const uint64_t CAPTURE_TIMEOUT_NS = BACKTRACE_THREADS_TIMEOUT_MS * 1000000ULL;
+static const int BENCHMARK_ITERATIONS = 20;
+
+/**
+ * A set of threads parked on a condition variable until the test is done with them
+ */
+class ThreadStacksTest : public ::testing::Test {
+protected:
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    bool released = false;
+    bool block_capture_signal = false;
+    std::atomic<int> started{0};
+    std::vector<pthread_t> threads;
+    std::vector<pid_t> tids;
+
+    void SetUp() override {
+        ASSERT_TRUE(arena::initialize(BACKTRACE_ARENA_SZ_MAX));
+        ASSERT_TRUE(stacks::initialize());
+    }
+
+    void TearDown() override {
+        release_threads();
+        stacks::shutdown();
+        arena::shutdown();
+    }
+
+    static void *park(void *arg) {
+        auto *test = static_cast<ThreadStacksTest *>(arg);
+
+        if (test->block_capture_signal) {
+            // the pending signal is discarded when the thread exits
+            sigset_t mask;
+            sigfillset(&mask);
+            pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+        }
+
+        pthread_mutex_lock(&test->mutex);
+        test->tids.push_back(gettid());
+        test->started++;
+        while (!test->released) {
+            pthread_cond_wait(&test->cond, &test->mutex);
+        }
+        pthread_mutex_unlock(&test->mutex);
+
+        return nullptr;
+    }
+
+    void start_threads(size_t cnt) {
+        for (size_t i = 0; i < cnt; i++) {
+            pthread_t thread;
+            ASSERT_EQ(0, pthread_create(&thread, nullptr, park, this));
+            threads.push_back(thread);
+        }
+        while (started < static_cast<int>(threads.size())) {
+            usleep(100);
+        }
+    }
+
+    void release_threads() {
+        pthread_mutex_lock(&mutex);
+        released = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+        for (auto thread: threads) {
+            pthread_join(thread, nullptr);
+        }
+        threads.clear();
+    }
+
+    /**
+     * Read the thread table and capture every thread's stack, as the crash path does.
+     * The caller must hold an arena lease.
+     */
+    backtrace_t *capture(uint64_t timeout_ns, size_t &captured) {
+        backtrace_t *backtrace = arena::alloc_array<backtrace_t>(1);
+        backtrace->pid = getpid();
+        backtrace->threads = arena::alloc_array<threadinfo_t>(BACKTRACE_THREADS_MAX);
+        collect_thread_state(*backtrace, gettid());
+        captured = stacks::capture(*backtrace, timeout_ns);
+        return backtrace;
+    }
+
+    static const threadinfo_t *find_thread(const backtrace_t &backtrace, pid_t tid) {
+        for (size_t i = 0; i < backtrace.thread_cnt; i++) {
+            if (backtrace.threads[i].tid == tid) {
+                return &backtrace.threads[i];
+            }
+        }
+        return nullptr;
+    }
+};
+
+TEST_F(ThreadStacksTest, CapturesEveryThread) {
+    start_threads(10);
+
+    ASSERT_TRUE(arena::acquire());
+    size_t captured = 0;
+    backtrace_t *backtrace = capture(CAPTURE_TIMEOUT_NS, captured);
+
+    EXPECT_GE(captured, tids.size());
+    for (auto tid: tids) {
+        const threadinfo_t *thread = find_thread(*backtrace, tid);
+        ASSERT_NE(nullptr, thread) << tid;
+        ASSERT_NE(nullptr, thread->backtrace_state) << tid;
+        EXPECT_GT(thread->backtrace_state->frame_cnt, 0u) << tid;
+        EXPECT_EQ(nullptr, thread->backtrace_state->sa_ucontext);
+    }
+
+    // the calling thread is left to the caller
+    const threadinfo_t *self = find_thread(*backtrace, gettid());
+    ASSERT_NE(nullptr, self);
+    EXPECT_EQ(nullptr, self->backtrace_state);
+    arena::release();
+}
+
+TEST_F(ThreadStacksTest, ThreadTableIsListedFromTheArena) {
+    start_threads(4);
+
+    ASSERT_TRUE(arena::acquire());
+    size_t used = arena::used();
+    backtrace_t *backtrace = arena::alloc_array<backtrace_t>(1);
+    backtrace->pid = getpid();
+    backtrace->threads = arena::alloc_array<threadinfo_t>(BACKTRACE_THREADS_MAX);
+    size_t table = arena::used();
+    int before = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    close(before);
+    collect_thread_state(*backtrace, gettid());
+
+    // the thread ids are listed into the arena, and the task directory is closed
+    EXPECT_GT(arena::used(), table);
+    EXPECT_GT(table, used);
+    int after = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    close(after);
+    EXPECT_EQ(before, after);
+
+    for (auto tid: tids) {
+        EXPECT_NE(nullptr, find_thread(*backtrace, tid)) << tid;
+    }
+    const threadinfo_t *self = find_thread(*backtrace, gettid());
+    ASSERT_NE(nullptr, self);
+    EXPECT_TRUE(self->crashed);
+    arena::release();
+}
+
+TEST_F(ThreadStacksTest, ThreadBlockingSignalTimesOut) {
+    block_capture_signal = true;
+    start_threads(1);
+
+    ASSERT_TRUE(arena::acquire());
+    size_t captured = 0;
+    uint64_t start = fixtures::now_ns();
+    backtrace_t *backtrace = capture(20 * 1000000ULL, captured);
+    uint64_t elapsed = fixtures::now_ns() - start;
+
+    const threadinfo_t *thread = find_thread(*backtrace, tids[0]);
+    ASSERT_NE(nullptr, thread);
+    EXPECT_EQ(nullptr, thread->backtrace_state);
+    EXPECT_GE(elapsed, 20 * 1000000ULL);
+    EXPECT_LT(elapsed, CAPTURE_TIMEOUT_NS * 10);
+    arena::release();
+}
+
+TEST_F(ThreadStacksTest, LateThreadsDoNotOutliveCapture) {
+    start_threads(5);
+
+    // with no time to answer, every request is abandoned; late handlers find no session
+    ASSERT_TRUE(arena::acquire());
+    size_t captured = 0;
+    capture(0, captured);
+    arena::release();
+
+    usleep(10000);
+    EXPECT_EQ(0u, arena::used());
+}
+
+TEST_F(ThreadStacksTest, CapturesOneThreadWithItsContext) {
+    start_threads(3);
+
+    ASSERT_TRUE(arena::acquire());
+    siginfo_t siginfo = {};
+    backtrace_state_t state = {};
+    state.siginfo = &siginfo;
+    ASSERT_TRUE(stacks::capture_thread(tids[1], state, CAPTURE_TIMEOUT_NS));
+
+    EXPECT_GT(state.frame_cnt, 0u);
+    EXPECT_NE(nullptr, state.sa_ucontext);
+    EXPECT_EQ(&siginfo, state.siginfo);
+
+    // the caller can't be signaled to unwind itself
+    backtrace_state_t self = {};
+    EXPECT_FALSE(stacks::capture_thread(gettid(), self, CAPTURE_TIMEOUT_NS));
+    arena::release();
+}
+
+TEST_F(ThreadStacksTest, OneThreadBlockingSignalTimesOut) {
+    block_capture_signal = true;
+    start_threads(1);
+
+    ASSERT_TRUE(arena::acquire());
+    backtrace_state_t state = {};
+    uint64_t start = fixtures::now_ns();
+    EXPECT_FALSE(stacks::capture_thread(tids[0], state, 20 * 1000000ULL));
+    EXPECT_GE(fixtures::now_ns() - start, 20 * 1000000ULL);
+    EXPECT_EQ(0u, state.frame_cnt);
+    EXPECT_EQ(nullptr, state.sa_ucontext);
+    arena::release();
+}
+
+TEST_F(ThreadStacksTest, CaptureBenchmark) {
+    const size_t thread_counts[] = {1, 10, 50, BACKTRACE_THREADS_MAX - 1};
+
+    std::printf("[ BENCHMARK] stacks::capture (timeout %ld ms)\n", BACKTRACE_THREADS_TIMEOUT_MS);
+    for (auto cnt: thread_counts) {
+        start_threads(cnt - threads.size());
+
+        uint64_t total_ns = 0;
+        size_t captured = 0;
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            ASSERT_TRUE(arena::acquire());
+            uint64_t start = fixtures::now_ns();
+            capture(CAPTURE_TIMEOUT_NS, captured);
+            total_ns += fixtures::now_ns() - start;
+            arena::release();
+        }
+
+        EXPECT_GE(captured, cnt);
+        std::printf("[ BENCHMARK]   %3zu threads: %8llu ns/capture %3zu stacks\n", cnt,
+                    static_cast<unsigned long long>(total_ns / BENCHMARK_ITERATIONS), captured);
+    }
+}
@@ -0,0 +1,255 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ucontext.h>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <agent-ndk.h>
+#include "backtrace.h"
+#include "unwinder.h"
+#include "TestFixtures.h"
+
+static const int UNWIND_SIGNAL = SIGURG;
+static const int BENCHMARK_ITERATIONS = 200;
+
+/**
+ * What the signal handler saw at the bottom of a recursion
+ */
+static struct {
+    int iterations;
+    bool walked;
+    backtrace_state_t frame_pointers;
+    backtrace_state_t cfi;
+    uint64_t frame_pointers_ns;
+    uint64_t cfi_ns;
+    ucontext_t ucontext;
+
+} unwound;
+
+static void unwind_handler(int, siginfo_t *, void *ucontext) {
+    const ucontext_t *context = static_cast<const ucontext_t *>(ucontext);
+    unwound.ucontext = *context;
+
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < unwound.iterations; i++) {
+        unwound.frame_pointers.sa_ucontext = context;
+        unwound.walked = unwind_frame_pointers(unwound.frame_pointers);
+    }
+    unwound.frame_pointers_ns = fixtures::now_ns() - start;
+
+    start = fixtures::now_ns();
+    for (int i = 0; i < unwound.iterations; i++) {
+        unwound.cfi.sa_ucontext = context;
+        unwind_backtrace(unwound.cfi);
+    }
+    unwound.cfi_ns = fixtures::now_ns() - start;
+
+    unwound.frame_pointers.sa_ucontext = nullptr;
+    unwound.cfi.sa_ucontext = nullptr;
+}
+
+static int descend_b(int depth);
+
+/**
+ * Mutually recursive, so consecutive frames differ (the unwinders drop repeated frames)
+ */
+__attribute__((noinline)) static int descend_a(int depth) {
+    if (depth <= 0) {
+        syscall(SYS_tgkill, getpid(), gettid(), UNWIND_SIGNAL);
+        return 0;
+    }
+    int result = descend_b(depth - 1) + 1;
+    asm volatile("" : : : "memory");
+    return result;
+}
+
+__attribute__((noinline)) static int descend_b(int depth) {
+    if (depth <= 0) {
+        syscall(SYS_tgkill, getpid(), gettid(), UNWIND_SIGNAL);
+        return 0;
+    }
+    int result = descend_a(depth - 1) + 2;
+    asm volatile("" : : : "memory");
+    return result;
+}
+
+/**
+ * Length of the longest common subsequence of two stacks' frames
+ */
+static size_t common_frames(const backtrace_state_t &a, const backtrace_state_t &b) {
+    std::vector<size_t> row(b.frame_cnt + 1, 0);
+    for (size_t i = 0; i < a.frame_cnt; i++) {
+        size_t diagonal = 0;
+        for (size_t j = 0; j < b.frame_cnt; j++) {
+            size_t above = row[j + 1];
+            row[j + 1] = (a.frames[i] == b.frames[j]) ? diagonal + 1 : std::max(row[j], above);
+            diagonal = above;
+        }
+    }
+    return row[b.frame_cnt];
+}
+
+static void set_frame_pointer(ucontext_t &ucontext, uintptr_t fp) {
+#if defined(__i386)
+    ucontext.uc_mcontext.gregs[REG_EBP] = fp;
+#elif defined(__x86_64__)
+    ucontext.uc_mcontext.gregs[REG_RBP] = fp;
+#elif defined(__arm__)
+    ucontext.uc_mcontext.arm_fp = fp;
+#elif defined(__aarch64__)
+    ucontext.uc_mcontext.regs[29] = fp;
+#endif
+}
+
+static uintptr_t stack_pointer(const ucontext_t &ucontext) {
+#if defined(__i386)
+    return ucontext.uc_mcontext.gregs[REG_ESP];
+#elif defined(__x86_64__)
+    return ucontext.uc_mcontext.gregs[REG_RSP];
+#elif defined(__arm__)
+    return ucontext.uc_mcontext.arm_sp;
+#elif defined(__aarch64__)
+    return ucontext.uc_mcontext.sp;
+#endif
+}
+
+class UnwinderTest : public ::testing::Test {
+protected:
+    struct sigaction sa_previous = {};
+
+    void SetUp() override {
+#if defined(__arm__)
+        GTEST_SKIP() << "frame records are not walked on 32-bit ARM";
+#endif
+        unwinder_initialize();
+
+        struct sigaction sa = {};
+        sa.sa_sigaction = unwind_handler;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        ASSERT_EQ(0, sigaction(UNWIND_SIGNAL, &sa, &sa_previous));
+    }
+
+    void TearDown() override {
+        sigaction(UNWIND_SIGNAL, &sa_previous, nullptr);
+    }
+
+    static void unwind_at_depth(int depth, int iterations) {
+        unwound = {};
+        unwound.iterations = iterations;
+        descend_a(depth);
+    }
+};
+
+TEST_F(UnwinderTest, StackBoundsHoldLocals) {
+    int local = 0;
+    uintptr_t lo = 0;
+    uintptr_t hi = 0;
+    ASSERT_TRUE(get_stack_bounds(lo, hi));
+    EXPECT_LE(lo, reinterpret_cast<uintptr_t>(&local));
+    EXPECT_GT(hi, reinterpret_cast<uintptr_t>(&local));
+
+    bool known = false;
+    std::thread thread([&]() {
+        int thread_local_var = 0;
+        uintptr_t thread_lo = 0;
+        uintptr_t thread_hi = 0;
+        known = get_stack_bounds(thread_lo, thread_hi) &&
+                thread_lo <= reinterpret_cast<uintptr_t>(&thread_local_var) &&
+                thread_hi > reinterpret_cast<uintptr_t>(&thread_local_var);
+    });
+    thread.join();
+    EXPECT_TRUE(known);
+}
+
+TEST_F(UnwinderTest, FramePointerWalkAgreesWithCfi) {
+    unwind_at_depth(40, 1);
+
+    // code built without frame pointers (as a host's libraries may be) ends the walk early
+    EXPECT_EQ(unwound.cfi.crash_ip, unwound.frame_pointers.frames[0]);
+    EXPECT_GT(unwound.frame_pointers.frame_cnt, 40u);
+
+    // every frame walked is one the CFI unwinder found, the frameless leaf's (the tgkill stub)
+    // caller included
+    size_t common = common_frames(unwound.frame_pointers, unwound.cfi);
+    EXPECT_EQ(unwound.frame_pointers.frame_cnt, common);
+    if (unwound.walked) {
+        EXPECT_EQ(common, unwound.cfi.frame_cnt);
+    }
+}
+
+TEST_F(UnwinderTest, FramePointerWalkKeepsTheLeafsCaller) {
+    for (int depth = 0; depth < 4; depth++) {
+        unwind_at_depth(depth, 1);
+
+        // the stub, each descend_*() frame and the fixture are found as the CFI unwinder finds them
+        size_t frame_cnt = depth + 3;
+        ASSERT_GE(unwound.frame_pointers.frame_cnt, frame_cnt) << "depth " << depth;
+        ASSERT_GE(unwound.cfi.frame_cnt, frame_cnt) << "depth " << depth;
+        for (size_t i = 0; i < frame_cnt; i++) {
+            EXPECT_EQ(unwound.cfi.frames[i], unwound.frame_pointers.frames[i]) << "depth " << depth << ", frame " << i;
+        }
+    }
+}
+
+TEST_F(UnwinderTest, BrokenChainFallsBackToCfi) {
+    unwind_at_depth(4, 1);
+
+    // a frame pointer below the stack pointer can't hold a caller's record
+    ucontext_t ucontext = unwound.ucontext;
+    set_frame_pointer(ucontext, stack_pointer(ucontext) - 64);
+
+    backtrace_state_t state = {};
+    state.sa_ucontext = &ucontext;
+    EXPECT_FALSE(unwind_frame_pointers(state));
+    EXPECT_EQ(2u, state.frame_cnt);     // the pc, and the leaf's return address
+
+    state = {};
+    state.sa_ucontext = &ucontext;
+    EXPECT_TRUE(unwind_fast(state));
+    EXPECT_GT(state.frame_cnt, 1u);
+}
+
+TEST_F(UnwinderTest, ContextsOffTheThreadStackAreNotWalked) {
+    unwind_at_depth(4, 1);
+    EXPECT_GT(unwound.frame_pointers.frame_cnt, 4u);
+
+    // the context of another thread's stack
+    bool walked = true;
+    ucontext_t ucontext = unwound.ucontext;
+    std::thread thread([&]() {
+        backtrace_state_t state = {};
+        state.sa_ucontext = &ucontext;
+        walked = unwind_frame_pointers(state);
+    });
+    thread.join();
+    EXPECT_FALSE(walked);
+}
+
+TEST_F(UnwinderTest, UnwindBenchmark) {
+    std::printf("[ BENCHMARK] unwinding from a signal handler (%d unwinds per depth)\n", BENCHMARK_ITERATIONS);
+    for (int depth: {16, 48, 96}) {
+        unwind_at_depth(depth, BENCHMARK_ITERATIONS);
+
+        double fp_frames_us = 1000.0 * unwound.frame_pointers.frame_cnt * BENCHMARK_ITERATIONS /
+                              std::max<uint64_t>(unwound.frame_pointers_ns, 1);
+        double cfi_frames_us = 1000.0 * unwound.cfi.frame_cnt * BENCHMARK_ITERATIONS /
+                               std::max<uint64_t>(unwound.cfi_ns, 1);
+        double agreement = 100.0 * common_frames(unwound.frame_pointers, unwound.cfi) /
+                           std::max(unwound.frame_pointers.frame_cnt, unwound.cfi.frame_cnt);
+
+        std::printf("[ BENCHMARK]   depth %3d: frame pointers %3zu frames %8.1f frames/us,"
+                    " cfi %3zu frames %6.1f frames/us, agreement %5.1f%%\n",
+                    depth, unwound.frame_pointers.frame_cnt, fp_frames_us,
+                    unwound.cfi.frame_cnt, cfi_frames_us, agreement);
+    }
+}
@@ -0,0 +1,268 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <agent-ndk.h>
+#include <nr-watchdog.h>
+#include "record.h"
+#include "thread-stacks.h"
+#include "watchdog.h"
+#include "jni/native-context.h"
+#include "TestFixtures.h"
+
+static const uint32_t STALL_TIMEOUT_MS = 50;
+static const uint64_t REPORT_TIMEOUT_NS = 5000000000ULL;
+static const int BENCHMARK_BEATS = 10000000;
+
+/**
+ * A watched thread, beating until told to stall, then until told to stop
+ */
+typedef struct watched {
+    const char *name;
+    std::atomic<bool> stalled;
+    std::atomic<bool> released;
+    std::atomic<pid_t> tid;
+    std::atomic<bool> registered;
+    bool deaf;                  // blocks signals while stalled, so its stack can't be captured
+
+} watched_t;
+
+static void *watch(void *arg) {
+    watched_t &watched = *static_cast<watched_t *>(arg);
+    nr_watchdog_t *watchdog = nr_watchdog_register(watched.name, STALL_TIMEOUT_MS);
+    watched.registered = (watchdog != nullptr);
+    watched.tid = gettid();
+
+    sigset_t mask, previous;
+    sigfillset(&mask);
+    bool blocked = false;
+    while (!watched.released) {
+        if (!watched.stalled) {
+            nr_watchdog_beat(watchdog);
+        } else if (watched.deaf && !blocked) {
+            blocked = (pthread_sigmask(SIG_BLOCK, &mask, &previous) == 0);
+        }
+        usleep(1000);
+    }
+    if (blocked) {
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+
+    nr_watchdog_unregister(watchdog);
+    return nullptr;
+}
+
+/**
+ * Watched threads, with their stall reports stored in a scratch directory
+ */
+class WatchdogTest : public ReportDirTest {
+protected:
+    WatchdogTest() : ReportDirTest("watchdog") {}
+
+    void TearDown() override {
+        watchdog::shutdown();
+        stacks::shutdown();
+        ReportDirTest::TearDown();
+    }
+
+    size_t reports() {
+        size_t cnt = 0;
+        DIR *dir = opendir(reportDir);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != nullptr) {
+            if (std::strncmp(entry->d_name, "rec-anr-", 8) == 0) {
+                cnt++;
+            }
+        }
+        closedir(dir);
+        return cnt;
+    }
+
+    bool await_reports(size_t count) {
+        uint64_t deadline = fixtures::now_ns() + REPORT_TIMEOUT_NS;
+        while (reports() < count) {
+            if (fixtures::now_ns() > deadline) {
+                return false;
+            }
+            usleep(1000);
+        }
+        return true;
+    }
+
+    static void start(pthread_t &thread, watched_t &watched) {
+        ASSERT_EQ(0, pthread_create(&thread, nullptr, watch, &watched));
+        while (watched.tid == 0) {
+            usleep(1000);
+        }
+        ASSERT_TRUE(watched.registered);
+    }
+
+    static void stop(pthread_t thread, watched_t &watched) {
+        watched.released = true;
+        pthread_join(thread, nullptr);
+    }
+};
+
+TEST_F(WatchdogTest, BeatingThreadIsNotReported) {
+    watched_t watched = {"render"};
+    pthread_t thread;
+    start(thread, watched);
+    EXPECT_EQ(1u, watchdog::registered());
+
+    usleep(STALL_TIMEOUT_MS * 6 * 1000);
+    stop(thread, watched);
+
+    EXPECT_EQ(0u, reports());
+    EXPECT_EQ(0u, watchdog::registered());
+}
+
+TEST_F(WatchdogTest, StalledThreadIsReportedWithItsStack) {
+    watched_t watched = {"render \"loop\" 'ui'"};
+    pthread_t thread;
+    start(thread, watched);
+
+    watched.stalled = true;
+    bool reported = await_reports(1);
+    stop(thread, watched);
+    ASSERT_TRUE(reported);
+
+    ASSERT_EQ(1, record::render_pending());
+    std::vector<std::string> stored = fixtures::stored_reports();
+    ASSERT_FALSE(stored.empty());
+    const std::string &report = stored.back();
+
+    EXPECT_NE(std::string::npos, report.find("Native thread render _loop_ _ui_ stalled for")) << report;
+
+    char fragment[128];
+    std::snprintf(fragment, sizeof(fragment), "\"threadNumber\":%d,", watched.tid.load());
+    size_t stalled = report.find(fragment);
+    ASSERT_NE(std::string::npos, stalled) << fragment;
+    EXPECT_NE(std::string::npos, report.find("\"crashed\":true,\"stack\":[{", stalled));
+    EXPECT_EQ(report.find("\"crashed\":true"), report.rfind("\"crashed\":true"));
+}
+
+TEST_F(WatchdogTest, StallIsReportedOnceUntilTheThreadBeatsAgain) {
+    watched_t watched = {"audio"};
+    pthread_t thread;
+    start(thread, watched);
+
+    watched.stalled = true;
+    EXPECT_TRUE(await_reports(1));
+    usleep(STALL_TIMEOUT_MS * 4 * 1000);
+    EXPECT_EQ(1u, reports());
+
+    // the thread recovers, for long enough to be seen beating, then stalls again
+    watched.stalled = false;
+    usleep(STALL_TIMEOUT_MS * 1000);
+    EXPECT_EQ(1u, reports());
+    watched.stalled = true;
+    EXPECT_TRUE(await_reports(2));
+    stop(thread, watched);
+}
+
+TEST_F(WatchdogTest, RegistrationIsNotHeldUpByAReport) {
+    watched_t watched = {"decoder"};
+    watched.deaf = true;
+    pthread_t thread;
+    start(thread, watched);
+
+    // the report waits out the capture timeout on the deaf thread: register meanwhile
+    watched.stalled = true;
+    usleep((STALL_TIMEOUT_MS + BACKTRACE_MAIN_THREAD_TIMEOUT_MS / 2) * 1000);
+    uint64_t start = fixtures::now_ns();
+    nr_watchdog_t *watchdog = nr_watchdog_register("late", 60000);
+    nr_watchdog_unregister(watchdog);
+    uint64_t elapsed_ns = fixtures::now_ns() - start;
+
+    EXPECT_TRUE(await_reports(1));
+    stop(thread, watched);
+    EXPECT_NE(nullptr, watchdog);
+    EXPECT_LT(elapsed_ns, BACKTRACE_MAIN_THREAD_TIMEOUT_MS * 1000000ULL / 4);
+}
+
+TEST_F(WatchdogTest, RegistrationsAreBounded) {
+    std::vector<nr_watchdog_t *> watchdogs;
+    nr_watchdog_t *watchdog;
+    while ((watchdog = nr_watchdog_register("bounded", 60000)) != nullptr) {
+        watchdogs.push_back(watchdog);
+        ASSERT_LE(watchdogs.size(), 1024u);
+    }
+    EXPECT_EQ(watchdogs.size(), watchdog::registered());
+
+    // a beat on a failed registration is ignored
+    nr_watchdog_beat(nullptr);
+
+    nr_watchdog_unregister(watchdogs.back());
+    watchdogs.pop_back();
+    watchdog = nr_watchdog_register("bounded", 60000);
+    ASSERT_NE(nullptr, watchdog);
+    watchdogs.push_back(watchdog);
+
+    for (auto registered: watchdogs) {
+        nr_watchdog_unregister(registered);
+    }
+    EXPECT_EQ(0u, watchdog::registered());
+}
+
+static void *register_and_exit(void *) {
+    return nr_watchdog_register("short-lived", STALL_TIMEOUT_MS);
+}
+
+TEST_F(WatchdogTest, ExitedThreadsFreeTheirSlots) {
+    // far more threads than there are slots, each exiting while registered
+    for (int i = 0; i < 256; i++) {
+        pthread_t thread;
+        void *watchdog = nullptr;
+        ASSERT_EQ(0, pthread_create(&thread, nullptr, register_and_exit, nullptr));
+        pthread_join(thread, &watchdog);
+        ASSERT_NE(nullptr, watchdog) << "thread " << i;
+    }
+
+    // and none is reported as stalled once it stops beating
+    usleep(STALL_TIMEOUT_MS * 4 * 1000);
+    EXPECT_EQ(0u, reports());
+    EXPECT_EQ(0u, watchdog::registered());
+}
+
+/**
+ * Cost of a heartbeat: a beat count store, against the clock read and store a timestamp
+ * heartbeat would need
+ */
+TEST_F(WatchdogTest, BeatBenchmark) {
+    nr_watchdog_t *watchdog = nr_watchdog_register("benchmark", 60000);
+    ASSERT_NE(nullptr, watchdog);
+    std::printf("[ BENCHMARK] heartbeat, %d beats\n", BENCHMARK_BEATS);
+
+    std::atomic<uint64_t> timestamp(0);
+    uint64_t start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_BEATS; i++) {
+        struct timespec now = {};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        timestamp.store(now.tv_sec * 1000000000ULL + now.tv_nsec, std::memory_order_relaxed);
+    }
+    uint64_t timestamp_ns = fixtures::now_ns() - start;
+
+    start = fixtures::now_ns();
+    for (int i = 0; i < BENCHMARK_BEATS; i++) {
+        nr_watchdog_beat(watchdog);
+    }
+    uint64_t beat_ns = fixtures::now_ns() - start;
+    nr_watchdog_unregister(watchdog);
+
+    std::printf("[ BENCHMARK]   timestamp: %6.2f ns/beat\n", static_cast<double>(timestamp_ns) / BENCHMARK_BEATS);
+    std::printf("[ BENCHMARK]   beat:      %6.2f ns/beat\n", static_cast<double>(beat_ns) / BENCHMARK_BEATS);
+}
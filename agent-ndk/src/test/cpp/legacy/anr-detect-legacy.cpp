@@ -0,0 +1,69 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <dirent.h>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "procfs.h"
+#include "anr-detect-legacy.h"
+
+namespace legacy {
+
+    static const char *const SIGBLK_LABEL = "SigBlk:\t";
+
+    pid_t find_thread(pid_t pid, const char *name, uint64_t &sigblk) {
+        struct dirent *_dirent;
+        std::string path;
+        const char *taskPath = procfs::get_task_path(pid, path);
+        DIR *dir = opendir(taskPath);
+        if (dir == nullptr) {
+            return -1;
+        }
+
+        pid_t found = -1;
+        while ((_dirent = readdir(dir)) != nullptr) {
+            if (!isdigit(_dirent->d_name[0])) {
+                continue;
+            }
+
+            pid_t tid = std::strtol(_dirent->d_name, nullptr, 10);
+
+            char statPath[NAME_MAX + 8];
+            std::snprintf(statPath, sizeof(statPath), "%s/stat", _dirent->d_name);
+
+            procfs::proc_stat_t stat;
+            if (!procfs::read_stat(dirfd(dir), statPath, stat)) {
+                continue;
+            }
+
+            if (std::strncmp(stat.name, name, std::strlen(name)) == 0) {
+                char buff[1024];
+                sigblk = 0;
+                std::string threadStatus;
+                FILE *fp = fopen(procfs::get_thread_status_path(pid, tid, threadStatus), "r");
+
+                if (fp != nullptr) {
+                    while (fgets(buff, sizeof(buff), fp) != NULL) {
+                        if (std::strncmp(buff, SIGBLK_LABEL, std::strlen(SIGBLK_LABEL)) == 0) {
+                            sigblk = std::strtoull(buff + std::strlen(SIGBLK_LABEL), nullptr, 16);
+                            break;
+                        }
+                    }
+                    fclose(fp);
+                }
+                found = tid;
+            }
+        }
+        closedir(dir);
+
+        return found;
+    }
+
+}   // namespace legacy
@@ -0,0 +1,24 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_ANR_DETECT_LEGACY_H
+#define _AGENT_NDK_ANR_DETECT_LEGACY_H
+
+#include <cstdint>
+#include <sys/types.h>
+
+namespace legacy {
+
+    /**
+     * Find a thread by name with opendir/readdir and a stat read per thread, then read its
+     * SigBlk mask with fopen/fgets, as shipped prior to the getdents64 scan
+     *
+     * @return the thread's id, or -1 if no thread holds the name
+     */
+    pid_t find_thread(pid_t pid, const char *name, uint64_t &sigblk);
+
+}   // namespace legacy
+
+#endif // _AGENT_NDK_ANR_DETECT_LEGACY_H
@@ -0,0 +1,22 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_EMITTER_LEGACY_H
+#define _AGENT_NDK_EMITTER_LEGACY_H
+
+#include <string>
+#include <agent-ndk.h>
+#include "backtrace.h"
+
+namespace legacy {
+
+    /**
+     * Emit a report using the std::string/vsnprintf emitter, as shipped prior to the writer
+     */
+    const char *emit_backtrace(backtrace_t &, std::string &);
+
+}   // namespace legacy
+
+#endif // _AGENT_NDK_EMITTER_LEGACY_H
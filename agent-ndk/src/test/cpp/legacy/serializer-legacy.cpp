@@ -0,0 +1,55 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "jni/native-context.h"
+#include "serializer-legacy.h"
+
+namespace legacy {
+
+    static std::string generateTmpFilename(const char *filePrefix) {
+        jni::native_context_t &native_context = jni::get_native_context();
+        std::ostringstream oss;
+        using namespace std::chrono;
+        auto now = system_clock::now();
+        auto ms = duration_cast<milliseconds>(now.time_since_epoch()) % 1000;
+        auto timer = system_clock::to_time_t(now);
+        std::tm wallTime = *(std::localtime(&timer));
+
+        oss << native_context.reportPathAbsolute << "/"
+            << filePrefix
+            << std::put_time(&wallTime, "%Y%m%d%H%M%S")
+            << std::setfill('0')
+            << std::setw(3)
+            << ms.count();
+
+        return oss.str();
+    }
+
+    bool to_storage(const char *filePrefix, const char *payload, size_t payload_size) {
+        std::string storagePath = generateTmpFilename(filePrefix);
+        std::ofstream os{storagePath.c_str(), std::ios::out | std::ios::binary};
+
+        size_t payload_len = std::strlen(payload);
+        payload_size = (payload_size < payload_len ? payload_size : payload_len);
+
+        if (!os) {
+            return false;
+        }
+
+        os.write(payload, payload_size);
+        os.flush();
+        os.close();
+
+        return true;
+    }
+
+}   // namespace legacy
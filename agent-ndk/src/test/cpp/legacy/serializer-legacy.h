@@ -0,0 +1,20 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_SERIALIZER_LEGACY_H
+#define _AGENT_NDK_SERIALIZER_LEGACY_H
+
+#include <stddef.h>
+
+namespace legacy {
+
+    /**
+     * Write a report using std::ofstream and localtime naming, as shipped prior to raw syscalls
+     */
+    bool to_storage(const char *filePrefix, const char *payload, size_t payload_size);
+
+}   // namespace legacy
+
+#endif // _AGENT_NDK_SERIALIZER_LEGACY_H
@@ -0,0 +1,124 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <unistd.h>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <agent-ndk.h>
+#include "thread-info-legacy.h"
+
+namespace legacy {
+
+    static const char *get_thread_stat(pid_t pid, pid_t tid, std::string &stat) {
+        char path[PATH_MAX];
+        std::snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, tid);
+
+        FILE *fp = fopen(path, "r");
+        if (fp != nullptr) {
+            char buff[1024];
+            if (fgets(buff, sizeof(buff), fp) != nullptr) {
+                stat = buff;
+            }
+            fclose(fp);
+        }
+
+        return stat.c_str();
+    }
+
+    void collect_thread_info(pid_t pid, pid_t tid, threadinfo_t &threadinfo) {
+        std::string cstr;
+        const char *tstat = get_thread_stat(pid, tid, cstr);
+
+        threadinfo.tid = tid;
+
+        // everything needed is in thread's /proc stat file
+        if (tstat && *tstat != '\0') {
+            char value[0x100];
+            const char *delim = " ";
+            char *ppos = const_cast<char *>(tstat);
+            char *token = strtok_r(ppos, delim, &ppos);
+
+            if (token) {
+                token = strtok_r(nullptr, ")", &ppos);
+                if (token) {
+                    if (std::sscanf(token, "(%[A-Za-z0-9 _.:-])", value) == 1) {
+                        std::strncpy(threadinfo.thread_name, value, sizeof(threadinfo.thread_name) - 1);
+                    }
+                }
+                token = strtok_r(nullptr, delim, &ppos);
+                if (token) {
+                    const char *rstate = "unknown";
+                    switch (std::tolower(*token)) {
+                        case 'r':
+                            rstate = "RUNNING";
+                            break;
+                        case 's':
+                        case 'd':
+                            rstate = "SLEEPING";
+                            break;
+                        case 'z':
+                            rstate = "ZOMBIE";
+                            break;
+                        case 't':
+                            rstate = "STOPPED";
+                            break;
+                        case 'x':
+                            rstate = "DEAD";
+                            break;
+                        case 'w':
+                            rstate = "WAKING";
+                            break;
+                        case 'k':
+                            rstate = "WAKE KILL";
+                            break;
+                        case 'p':
+                            rstate = "PARKED";
+                            break;
+                    };  // switch
+                    std::strncpy(threadinfo.thread_state, rstate, sizeof(threadinfo.thread_state) - 1);
+                }
+                token = strtok_r(nullptr, delim, &ppos);    // skip ppid
+                token = strtok_r(nullptr, delim, &ppos);    // skip pgrp
+                token = strtok_r(nullptr, delim, &ppos);    // skip session id
+                token = strtok_r(nullptr, delim, &ppos);    // skip tty_nr
+                token = strtok_r(nullptr, delim, &ppos);    // skip tty_pgrp
+                token = strtok_r(nullptr, delim, &ppos);    // skip flags
+                token = strtok_r(nullptr, delim, &ppos);    // skip min_fault
+                token = strtok_r(nullptr, delim, &ppos);    // skip cmin_fault
+                token = strtok_r(nullptr, delim, &ppos);    // skip maj_fault
+                token = strtok_r(nullptr, delim, &ppos);    // skip cmaj_fault
+                token = strtok_r(nullptr, delim, &ppos);    // skip utime
+                token = strtok_r(nullptr, delim, &ppos);    // skip stime
+                token = strtok_r(nullptr, delim, &ppos);    // skip cutime
+                token = strtok_r(nullptr, delim, &ppos);    // skip cstime
+                token = strtok_r(nullptr, delim, &ppos);    // prior
+                if (token) {
+                    threadinfo.priority = std::strtol(token, nullptr, 10);
+                }
+                token = strtok_r(nullptr, delim, &ppos);    // skip nice
+                token = strtok_r(nullptr, delim, &ppos);    // skip num threads
+                token = strtok_r(nullptr, delim, &ppos);    // skip itrealvalue
+                token = strtok_r(nullptr, delim, &ppos);    // skip start time
+                token = strtok_r(nullptr, delim, &ppos);    // skip vsize
+                token = strtok_r(nullptr, delim, &ppos);    // skip rss mem
+                token = strtok_r(nullptr, delim, &ppos);    // skip rss lim
+                token = strtok_r(nullptr, delim, &ppos);    // skip start code
+                token = strtok_r(nullptr, delim, &ppos);    // skip end code
+                token = strtok_r(nullptr, delim, &ppos);    // start stack
+                if (token) {
+                    threadinfo.stack = std::strtoull(token, nullptr, 10);
+                }
+                // ignore the rest, the values tend to be the same for all threads anyway
+            }
+        }
+
+        threadinfo.crashed = (tid == gettid());
+    }
+
+}   // namespace legacy
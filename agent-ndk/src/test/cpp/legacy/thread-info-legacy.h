@@ -0,0 +1,21 @@
+/**
+ * Copyright 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _AGENT_NDK_THREAD_INFO_LEGACY_H
+#define _AGENT_NDK_THREAD_INFO_LEGACY_H
+
+#include "backtrace.h"
+
+namespace legacy {
+
+    /**
+     * Read a thread's stat file with fopen/fgets into a std::string and tokenize it
+     * with strtok_r and sscanf, as shipped prior to the single-pass parser
+     */
+    void collect_thread_info(pid_t pid, pid_t tid, threadinfo_t &);
+
+}   // namespace legacy
+
+#endif // _AGENT_NDK_THREAD_INFO_LEGACY_H
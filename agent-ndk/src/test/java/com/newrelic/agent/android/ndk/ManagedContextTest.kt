@@ -72,6 +72,24 @@ class ManagedContextTest : TestCase(), AgentNDKListener {
         Assert.assertEquals(managedContext?.expirationPeriod, TimeUnit.SECONDS.convert(7, TimeUnit.DAYS))
     }
 
+    @Test
+    fun testCoalesceWindow() {
+        Assert.assertEquals(managedContext?.coalesceWindow, ManagedContext.DEFAULT_COALESCE_WINDOW)
+        Assert.assertEquals(managedContext?.coalesceWindow, 0L)
+    }
+
+    @Test
+    fun testReportQuota() {
+        // 0 leaves the native defaults in place
+        Assert.assertEquals(0L, managedContext?.reportQuotaBytes)
+        Assert.assertEquals(0L, managedContext?.reportQuotaCount)
+    }
+
+    @Test
+    fun testFlushBudget() {
+        Assert.assertEquals(ManagedContext.DEFAULT_FLUSH_BUDGET, managedContext?.flushBudget)
+    }
+
     override fun onNativeCrash(crashAsString: String?): Boolean {
         TODO("Not yet implemented")
     }
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2024-present New Relic Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+package com.newrelic.agent.android.ndk
+
+import junit.framework.TestCase
+import org.junit.Assert
+import java.io.File
+import java.io.IOException
+import java.nio.ByteBuffer
+
+class NativeReportTest : TestCase() {
+
+    val backtrace = this::class.java.classLoader?.getResource("backtrace.json")?.readText()
+
+    private fun frame(size: Int, vararg blocks: ByteArray): ByteArray {
+        val header = byteArrayOf(
+            'N'.code.toByte(), 'R'.code.toByte(), 'Z'.code.toByte(), '1'.code.toByte(),
+            size.toByte(), (size shr 8).toByte(), (size shr 16).toByte(), (size shr 24).toByte()
+        )
+        return blocks.fold(header) { frame, block -> frame + block }
+    }
+
+    private fun bytes(vararg values: Int): ByteArray {
+        return ByteArray(values.size) { values[it].toByte() }
+    }
+
+    fun testUncompressedReportsPassThrough() {
+        val report = backtrace!!.toByteArray(Charsets.UTF_8)
+        Assert.assertFalse(NativeReport.isCompressed(report))
+        Assert.assertEquals(backtrace, NativeReport.decode(report))
+        Assert.assertEquals("", NativeReport.decode(ByteArray(0)))
+    }
+
+    fun testStoredBlock() {
+        val frame = frame(5, bytes(5, 0, 0, 0x80), "hello".toByteArray())
+        Assert.assertTrue(NativeReport.isCompressed(frame))
+        Assert.assertEquals("hello", NativeReport.decode(frame))
+    }
+
+    fun testCompressedBlock() {
+        // "abc", then a match of 12 at offset 3 overlapping its own output, then a last literal
+        val block = bytes(0x38, 'a'.code, 'b'.code, 'c'.code, 3, 0, 0x10, 'X'.code)
+        val frame = frame(16, bytes(block.size, 0, 0, 0), block)
+        Assert.assertEquals("abcabcabcabcabcX", NativeReport.decode(frame))
+    }
+
+    fun testDecodeBuffer() {
+        val buffer = ByteBuffer.allocateDirect(backtrace!!.length * 4)
+        buffer.put(backtrace.toByteArray(Charsets.UTF_8)).flip()
+        val report = buffer.asReadOnlyBuffer()
+
+        Assert.assertEquals(backtrace, NativeReport.decode(report))
+        Assert.assertEquals("decoding does not consume the buffer", 0, report.position())
+    }
+
+    fun testReadReportFile() {
+        val report = File.createTempFile("crash-", ".json")
+        try {
+            report.writeBytes(frame(5, bytes(5, 0, 0, 0x80), "hello".toByteArray()))
+            Assert.assertEquals("hello", NativeReport.read(report))
+            report.writeText(backtrace!!)
+            Assert.assertEquals(backtrace, NativeReport.read(report))
+        } finally {
+            report.delete()
+        }
+    }
+
+    fun testMalformedFramesThrow() {
+        val block = bytes(0x38, 'a'.code, 'b'.code, 'c'.code, 3, 0, 0x10, 'X'.code)
+        val malformed = listOf(
+            frame(16, bytes(block.size, 0, 0, 0), block.copyOf(block.size - 1)),       // truncated
+            frame(16, bytes(block.size, 0, 0, 0), block, bytes(0)),                     // trailing data
+            frame(17, bytes(block.size, 0, 0, 0), block),                               // wrong size
+            frame(16, bytes(block.size, 0, 0, 0), block.copyOf().also { it[4] = 9 }),  // offset out of range
+            frame(6, bytes(5, 0, 0, 0x80), "hello".toByteArray()),                      // stored block too small
+        )
+
+        for (frame in malformed) {
+            try {
+                NativeReport.decompress(frame)
+                Assert.fail("Malformed frame was decompressed")
+            } catch (e: IOException) {
+                Assert.assertNotNull(e.message)
+            }
+        }
+
+        try {
+            NativeReport.decompress("{}".toByteArray())
+            Assert.fail("Uncompressed report was decompressed")
+        } catch (e: IOException) {
+            Assert.assertNotNull(e.message)
+        }
+    }
+}